@@ -0,0 +1,166 @@
+#!/bin/bash
+# Boot latency benchmark: boots each image headless in QEMU a number of times
+# and reports the median and 95th percentile time to every boot milestone.
+#
+# Usage: build_scripts/bench_boot.sh [-n runs] [-t timeout] <kind>:<image>...
+#   kind is floppy (drive A), hdd (first hard disk) or iso (CD-ROM)
+#   QEMU picks the emulator (qemu-system-x86_64), QEMU_FLAGS adds options
+#   such as "-accel kvm"
+#
+# stage2 and the kernel write "boot: <tsc> <name>" to the 0xE9 debug console
+# at each boottime_mark, and the kernel ends with "boot-rate: <tsc_hz>" once
+# the shell is up. Two times are reported per milestone: host, from starting
+# QEMU (power-on, firmware included) to the line arriving, and guest, TSC
+# cycles since the first mark turned into time with the kernel's rate.
+#
+# Each milestone is one line, like the benchmark programs':
+#   BENCH boot/<kind>/<milestone> runs=<n> host_median_ms=... host_p95_ms=...
+#         guest_median_ms=... guest_p95_ms=...
+
+RUNS=10
+TIMEOUT=60
+QEMU="${QEMU:-qemu-system-x86_64}"
+
+usage() {
+    echo "Usage: $0 [-n runs] [-t timeout seconds] <floppy|hdd|iso>:<image>..."
+    exit 1
+}
+
+while getopts "n:t:" opt; do
+    case "${opt}" in
+        n) RUNS="${OPTARG}" ;;
+        t) TIMEOUT="${OPTARG}" ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || usage
+
+if ! command -v "${QEMU}" > /dev/null 2>&1; then
+    echo "Error: ${QEMU} not found. Please install QEMU."
+    exit 1
+fi
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "${WORK}"' EXIT
+
+# Microseconds on the host clock
+now_us() {
+    local t="${EPOCHREALTIME//[.,]/}"
+    echo "$((10#${t}))"
+}
+
+# boot_once <kind> <image> <record file>: one boot, one "<name>\t<host us>\t<tsc>"
+# line per mark in the record, then "rate\t<tsc_hz>". Fails on timeout.
+boot_once() {
+    local kind="$1" image="$2" record="$3"
+    local drive
+    case "${kind}" in
+        floppy) drive=(-drive "file=${image},format=raw,if=floppy" -boot a) ;;
+        hdd) drive=(-drive "file=${image},format=raw,if=ide" -boot c) ;;
+        iso) drive=(-cdrom "${image}" -boot d) ;;
+        *) echo "Unknown image kind ${kind}"; return 1 ;;
+    esac
+
+    local fifo="${WORK}/debugcon"
+    rm -f "${fifo}"
+    mkfifo "${fifo}"
+    # Open both ends here, so neither QEMU nor the reader waits for the other
+    exec 3<> "${fifo}"
+
+    : > "${record}"
+    local start
+    start="$(now_us)"
+    # -snapshot: writes to the images are thrown away
+    # shellcheck disable=SC2086
+    "${QEMU}" -display none -serial null -monitor none -no-reboot -snapshot \
+        -m 128 "${drive[@]}" -debugcon "file:${fifo}" ${QEMU_FLAGS} \
+        > /dev/null 2>&1 &
+    local pid=$!
+
+    local deadline=$((start + TIMEOUT * 1000000)) chunk line pending="" now done=1
+    while [ "$(now_us)" -lt "${deadline}" ]; do
+        # A line cut off by the timeout is finished by the next read
+        if ! IFS= read -r -t 1 chunk <&3; then
+            pending="${pending}${chunk}"
+            kill -0 "${pid}" 2> /dev/null || break
+            continue
+        fi
+        line="${pending}${chunk}"
+        pending=""
+        now="$(now_us)"
+        case "${line}" in
+            "boot: "*)
+                line="${line#boot: }"
+                printf '%s\t%s\t%s\n' "${line#* }" "$((now - start))" "$((16#${line%% *}))" >> "${record}"
+                ;;
+            "boot-rate: "*)
+                printf 'rate\t%s\n' "$((16#${line#boot-rate: }))" >> "${record}"
+                done=0
+                break
+                ;;
+        esac
+    done
+
+    kill "${pid}" 2> /dev/null
+    wait "${pid}" 2> /dev/null
+    exec 3<&-
+    rm -f "${fifo}"
+    return "${done}"
+}
+
+# Median and 95th percentile of the numbers on stdin (microseconds) in ms
+percentiles() {
+    sort -n | awk '{ v[NR] = $1 }
+        END {
+            m = int((NR + 1) / 2); p = int(NR * 0.95 + 0.999)
+            if (p < 1) p = 1
+            printf "%.2f %.2f", v[m] / 1000, v[p] / 1000
+        }'
+}
+
+failed=0
+for target in "$@"; do
+    kind="${target%%:*}"
+    image="${target#*:}"
+    if [ "${kind}" = "${target}" ] || [ ! -f "${image}" ]; then
+        echo "BENCH_FAIL boot/${kind} reason=no_image"
+        failed=1
+        continue
+    fi
+
+    # One line per mark of every complete run: <name>\t<host us>\t<guest us>
+    samples="${WORK}/${kind}.samples"
+    : > "${samples}"
+    complete=0
+    for ((run = 1; run <= RUNS; run++)); do
+        record="${WORK}/${kind}.${run}"
+        if ! boot_once "${kind}" "${image}" "${record}"; then
+            last="$(tail -n 1 "${record}" | cut -f 1)"
+            echo "BENCH_FAIL boot/${kind} run=${run} last=\"${last:-none}\""
+            failed=1
+            continue
+        fi
+        complete=$((complete + 1))
+        awk -F '\t' '$1 == "rate" { hz = $2; next }
+            { name[NR] = $1; host[NR] = $2; tsc[NR] = $3; if (!first) first = $3 }
+            END {
+                for (i = 1; i in name; i++)
+                    printf "%s\t%d\t%d\n", name[i], host[i], hz ? (tsc[i] - first) / hz * 1000000 : 0
+            }' "${record}" >> "${samples}"
+    done
+
+    echo "BENCH_BEGIN boot/${kind} image=${image} runs=${complete}/${RUNS}"
+    # Milestones in the order they come up
+    cut -f 1 "${samples}" | awk '!seen[$0]++' | while IFS= read -r name; do
+        host="$(awk -F '\t' -v n="${name}" '$1 == n { print $2 }' "${samples}" | percentiles)"
+        guest="$(awk -F '\t' -v n="${name}" '$1 == n { print $3 }' "${samples}" | percentiles)"
+        count="$(awk -F '\t' -v n="${name}" '$1 == n' "${samples}" | wc -l)"
+        echo "BENCH boot/${kind}/${name// /_} runs=${count}" \
+            "host_median_ms=${host% *} host_p95_ms=${host#* }" \
+            "guest_median_ms=${guest% *} guest_p95_ms=${guest#* }"
+    done
+    echo "BENCH_END boot/${kind}"
+done
+
+exit "${failed}"
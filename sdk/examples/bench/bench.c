@@ -0,0 +1,302 @@
+/*
+ * Microbenchmarks for NBOS
+ *
+ * Times system calls, drawing, the heap and memcpy with the TSC and the
+ * monotonic clock. Every result is one line, on the console and on COM1:
+ *
+ *   BENCH <name> ops=<n> cycles_per_op=<n> ns_per_op=<n> rate=<n> unit=<per second>
+ *
+ * between a BENCH_BEGIN line carrying the TSC rate and BENCH_END. Pass
+ * group names (syscall, gfx, malloc, memcpy) to run only those.
+ */
+
+#include <nbos.h>
+#include <graphics.h>
+
+#define SYSCALL_ITERS 20000
+#define VBLANK_ITERS  10
+#define MALLOC_ITERS  100000
+#define LARGE_ITERS   1000
+#define COPY_BYTES    (64ULL << 20)   // Copied per memcpy size
+#define COPY_MAX      (8ULL << 20)
+
+// Unused by the kernel, the bare cost of entering and leaving it
+#define SYS_UNUSED 63
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* ============================================================================
+ * Output
+ * ============================================================================ */
+
+static char line_buf[256];
+static int line_len;
+
+static void put_str(const char *s) {
+    while (*s && line_len < (int)sizeof(line_buf) - 2) line_buf[line_len++] = *s++;
+}
+
+static void put_u64(uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n && line_len < (int)sizeof(line_buf) - 2) line_buf[line_len++] = digits[--n];
+}
+
+static void emit(void) {
+    line_buf[line_len++] = '\n';
+    line_buf[line_len] = '\0';
+    // The console mirrors to COM1, a serial_print too would double it
+    print(line_buf);
+    line_len = 0;
+}
+
+// work units per second; ns stays well below 2^34 so nothing overflows
+static uint64_t per_second(uint64_t work, uint64_t ns) {
+    if (!ns) return 0;
+    return work / ns * 1000000000ULL + work % ns * 1000000000ULL / ns;
+}
+
+static void report(const char *name, uint64_t ops, uint64_t cycles, uint64_t ns,
+                   uint64_t work, const char *unit) {
+    put_str("BENCH ");
+    put_str(name);
+    put_str(" ops=");
+    put_u64(ops);
+    put_str(" cycles_per_op=");
+    put_u64(ops ? cycles / ops : 0);
+    put_str(" ns_per_op=");
+    put_u64(ops ? ns / ops : 0);
+    put_str(" rate=");
+    put_u64(per_second(work, ns));
+    put_str(" unit=");
+    put_str(unit);
+    emit();
+}
+
+// Time iters runs of the body (the rest of the arguments, commas and
+// all); work counts units for the rate
+#define TIME_LOOP(name, iters, work, unit, ...)                           \
+    do {                                                                  \
+        uint64_t t0_ = uptime_ns(), c0_ = rdtsc();                        \
+        for (uint64_t i = 0; i < (iters); i++) { __VA_ARGS__; }           \
+        uint64_t c1_ = rdtsc(), t1_ = uptime_ns();                        \
+        report(name, (iters), c1_ - c0_, t1_ - t0_, (work), unit);        \
+    } while (0)
+
+/* ============================================================================
+ * System Calls
+ * ============================================================================ */
+
+static inline uint64_t int80_unused(void) {
+    uint64_t ret;
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"((uint64_t)SYS_UNUSED) : "memory");
+    return ret;
+}
+
+static void bench_syscall(void) {
+    key_event_t ev;
+    const uint64_t n = SYSCALL_ITERS;
+
+    TIME_LOOP("syscall/unused", n, n, "calls/s", syscall0(SYS_UNUSED));
+    TIME_LOOP("int80/unused", n, n, "calls/s", int80_unused());
+    TIME_LOOP("syscall/clock", n, n, "calls/s", syscall0(SYS_CLOCK));
+    TIME_LOOP("syscall/kbhit", n, n, "calls/s", syscall0(SYS_KBHIT));
+    TIME_LOOP("syscall/getevent", n, n, "calls/s",
+              syscall2(SYS_GETEVENT, (uint64_t)&ev, 0));
+    TIME_LOOP("syscall/getwidth", n, n, "calls/s", syscall0(SYS_GETWIDTH));
+    TIME_LOOP("syscall/getheight", n, n, "calls/s", syscall0(SYS_GETHEIGHT));
+    TIME_LOOP("syscall/getpixel", n, n, "calls/s", syscall2(SYS_GETPIXEL, 0, 0));
+    TIME_LOOP("syscall/sleep_until", n, n, "calls/s", syscall1(SYS_SLEEP_UNTIL, 0));
+    TIME_LOOP("syscall/sbrk", n, n, "calls/s", sbrk(0));
+    TIME_LOOP("syscall/mmap_munmap", n, n, "pairs/s",
+              munmap(mmap(0, 4096, PROT_READ | PROT_WRITE), 4096));
+    TIME_LOOP("syscall/wait_vblank", VBLANK_ITERS, VBLANK_ITERS, "vblanks/s",
+              wait_vblank(0));
+}
+
+/* ============================================================================
+ * Graphics
+ * ============================================================================ */
+
+static uint32_t seed = 12345;
+
+static int rnd(int range) {
+    seed = seed * 1103515245 + 12345;
+    return (int)((seed >> 8) % (uint32_t)range);
+}
+
+static void bench_gfx(void) {
+    if (!syscall0(SYS_GETWIDTH)) {
+        put_str("BENCH_SKIP gfx reason=text_mode");
+        emit();
+        return;
+    }
+    int gd = DETECT, gm;
+    initgraph(&gd, &gm, "");
+    int w = getmaxx() + 1, h = getmaxy() + 1;
+    uint64_t screen = (uint64_t)w * h;
+
+    // One system call and one present per pixel
+    TIME_LOOP("gfx/putpixel_syscall", 4096, 4096, "pixels/s",
+              syscall3(SYS_PUTPIXEL, i & 63, i >> 6, 0xFFFFFF));
+
+    // Into the back buffer, shown once
+    TIME_LOOP("gfx/putpixel", screen, screen, "pixels/s",
+              putpixel((int)(i % (uint64_t)w), (int)(i / (uint64_t)w), (int)(i & 0xFFFFFF)));
+    present();
+
+    // Plain stores into the mapped screen
+    fb_info_t fb;
+    if (map_framebuffer(&fb, FB_MAP_SCREEN) == 0) {
+        uint64_t pixels = (uint64_t)fb.width * fb.height;
+        TIME_LOOP("gfx/fb_fill", 8, 8 * pixels, "pixels/s", {
+            uint8_t *row = fb.addr;
+            for (uint32_t y = 0; y < fb.height; y++, row += fb.pitch) {
+                if (fb.bytes_pp == 4) {
+                    uint32_t *p = (uint32_t *)row;
+                    for (uint32_t x = 0; x < fb.width; x++) p[x] = (uint32_t)i * 0x00102030;
+                } else {
+                    memset(row, (int)i * 0x11, (size_t)fb.width * fb.bytes_pp);
+                }
+            }
+        });
+    }
+
+    setcolor(LIGHTGREEN);
+    TIME_LOOP("gfx/line", 10000, 10000, "lines/s",
+              line(rnd(w), rnd(h), rnd(w), rnd(h)));
+    setcolor(YELLOW);
+    TIME_LOOP("gfx/circle", 10000, 10000, "circles/s",
+              circle(rnd(w), rnd(h), 8 + rnd(64)));
+    setfillstyle(SOLID_FILL, BLUE);
+    // Nominal pixels, bars at the edges are clipped
+    TIME_LOOP("gfx/bar", 10000, 10000 * 100 * 100, "pixels/s", {
+        int x = rnd(w), y = rnd(h);
+        bar(x, y, x + 99, y + 99);
+    });
+    setcolor(WHITE);
+    TIME_LOOP("gfx/outtextxy", 10000, 10000 * 32, "chars/s",
+              outtextxy(rnd(w), rnd(h), "0123456789ABCDEF0123456789ABCDEF"));
+
+    // The whole screen damaged each time
+    TIME_LOOP("gfx/present_full", 20, 20 * screen, "pixels/s", {
+        cleardevice();
+        present();
+    });
+    TIME_LOOP("gfx/present_vsync", VBLANK_ITERS, VBLANK_ITERS, "frames/s", {
+        setfillstyle(SOLID_FILL, (int)(i & 15));
+        bar(0, 0, 63, 63);
+        present_vsync();
+    });
+
+    cleardevice();
+    closegraph();
+}
+
+/* ============================================================================
+ * Heap
+ * ============================================================================ */
+
+static void bench_malloc(void) {
+    static const struct {
+        const char *name;
+        size_t size;
+        uint64_t iters;
+    } sizes[] = {
+        {"malloc/16", 16, MALLOC_ITERS},
+        {"malloc/64", 64, MALLOC_ITERS},
+        {"malloc/256", 256, MALLOC_ITERS},
+        {"malloc/1024", 1024, MALLOC_ITERS},
+        {"malloc/8192", 8192, MALLOC_ITERS},
+        {"malloc/65536", 65536, LARGE_ITERS},
+        {"malloc/1048576", 1048576, LARGE_ITERS},
+    };
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        TIME_LOOP(sizes[s].name, sizes[s].iters, sizes[s].iters, "pairs/s", {
+            void *p = malloc(sizes[s].size);
+            *(volatile uint8_t *)p = 1;
+            free(p);
+        });
+
+    // Many live blocks: the free lists rather than one reused block
+    static void *live[1000];
+    TIME_LOOP("malloc/batch_256", 100, 100 * 1000, "pairs/s", {
+        for (int j = 0; j < 1000; j++) live[j] = malloc(256);
+        for (int j = 0; j < 1000; j++) free(live[j]);
+    });
+}
+
+/* ============================================================================
+ * memcpy
+ * ============================================================================ */
+
+static void bench_memcpy(void) {
+    static const struct {
+        const char *name;
+        size_t size;
+    } sizes[] = {
+        {"memcpy/64", 64},
+        {"memcpy/256", 256},
+        {"memcpy/4096", 4096},
+        {"memcpy/65536", 65536},
+        {"memcpy/1048576", 1048576},
+        {"memcpy/8388608", 8388608},
+    };
+    uint8_t *src = malloc(COPY_MAX);
+    uint8_t *dst = malloc(COPY_MAX);
+    if (!src || !dst) {
+        put_str("BENCH_SKIP memcpy reason=no_memory");
+        emit();
+        return;
+    }
+    // Fault the pages in first, so only copying is timed
+    memset(src, 0x5A, COPY_MAX);
+    memset(dst, 0, COPY_MAX);
+
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint64_t iters = COPY_BYTES / sizes[s].size;
+        TIME_LOOP(sizes[s].name, iters, iters * sizes[s].size, "bytes/s",
+                  memcpy(dst, src, sizes[s].size));
+    }
+    free(src);
+    free(dst);
+}
+
+/* ============================================================================
+ * Main
+ * ============================================================================ */
+
+static int wanted(int argc, char **argv, const char *group) {
+    if (argc < 2) return 1;
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], group) == 0) return 1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // The TSC against the monotonic clock, for turning cycles into time
+    uint64_t t0 = uptime_ns(), c0 = rdtsc();
+    sleep(50);
+    uint64_t c1 = rdtsc(), t1 = uptime_ns();
+
+    put_str("BENCH_BEGIN version=1 tsc_hz=");
+    put_u64(per_second(c1 - c0, t1 - t0));
+    emit();
+
+    if (wanted(argc, argv, "syscall")) bench_syscall();
+    if (wanted(argc, argv, "malloc")) bench_malloc();
+    if (wanted(argc, argv, "memcpy")) bench_memcpy();
+    if (wanted(argc, argv, "gfx")) bench_gfx();
+
+    put_str("BENCH_END");
+    emit();
+    return 0;
+}
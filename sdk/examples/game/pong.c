@@ -1,6 +1,6 @@
 /*
  * Simple Pong Game for NBOS
- * Arrow keys to move paddle, Q to quit
+ * Arrow keys (or A/D) to move paddle, Q to quit
  */
 
 #include <nbos.h>
@@ -9,7 +9,7 @@
 #define PADDLE_WIDTH  80
 #define PADDLE_HEIGHT 10
 #define BALL_SIZE     8
-#define PADDLE_SPEED  15
+#define PADDLE_SPEED  8   // Pixels per frame while a key is held
 #define BALL_SPEED    5
 
 int main(void) {
@@ -18,6 +18,16 @@ int main(void) {
     
     int max_x = getmaxx();
     int max_y = getmaxy();
+
+    // The border is drawn once. Play happens inside it, in a viewport that
+    // clips, so erasing the ball never touches the border.
+    setbkcolor(BLACK);
+    cleardevice();
+    setcolor(WHITE);
+    rectangle(0, 0, max_x, max_y);
+    setviewport(1, 1, max_x - 1, max_y - 1, 1);
+    max_x -= 2;
+    max_y -= 2;
     
     // Paddle position
     int paddle_x = (max_x - PADDLE_WIDTH) / 2;
@@ -32,17 +42,29 @@ int main(void) {
     // Score
     int score = 0;
     int running = 1;
-    
-    setbkcolor(BLACK);
+    int left_held = 0;
+    int right_held = 0;
+
+    // Where the ball and the paddle were drawn last frame
+    int drawn_ball_x = ball_x;
+    int drawn_ball_y = ball_y;
+    int drawn_paddle_x = paddle_x;
     
     while (running) {
-        // Clear screen
-        cleardevice();
-        
-        // Draw border
+        // Erase the ball and paddle where they were instead of clearing the
+        // screen, so only a few small rectangles are presented
+        setfillstyle(SOLID_FILL, BLACK);
+        bar(drawn_ball_x - BALL_SIZE, drawn_ball_y - BALL_SIZE,
+            drawn_ball_x + BALL_SIZE, drawn_ball_y + BALL_SIZE);
+        if (drawn_paddle_x != paddle_x) {
+            bar(drawn_paddle_x, paddle_y, drawn_paddle_x + PADDLE_WIDTH,
+                paddle_y + PADDLE_HEIGHT);
+        }
+
+        // The ball may have passed over the title
         setcolor(WHITE);
-        rectangle(0, 0, max_x, max_y);
-        
+        outtextxy(10, 10, "PONG - Use arrow keys, Q to quit");
+
         // Draw paddle
         setfillstyle(SOLID_FILL, CYAN);
         bar(paddle_x, paddle_y, paddle_x + PADDLE_WIDTH, paddle_y + PADDLE_HEIGHT);
@@ -50,10 +72,9 @@ int main(void) {
         // Draw ball
         setfillstyle(SOLID_FILL, YELLOW);
         fillcircle(ball_x, ball_y, BALL_SIZE);
-        
-        // Draw score
-        setcolor(WHITE);
-        outtextxy(10, 10, "PONG - Use arrow keys, Q to quit");
+        drawn_ball_x = ball_x;
+        drawn_ball_y = ball_y;
+        drawn_paddle_x = paddle_x;
         
         // Update ball position
         ball_x += ball_dx;
@@ -84,30 +105,33 @@ int main(void) {
             ball_dy = -BALL_SPEED;
         }
         
-        // Check for input
-        if (kbhit()) {
-            char key = getch();
-            switch (key) {
-                case 'a':
-                case 'A':
-                    paddle_x -= PADDLE_SPEED;
-                    if (paddle_x < 0) paddle_x = 0;
-                    break;
-                case 'd':
-                case 'D':
-                    paddle_x += PADDLE_SPEED;
-                    if (paddle_x > max_x - PADDLE_WIDTH) 
-                        paddle_x = max_x - PADDLE_WIDTH;
-                    break;
-                case 'q':
-                case 'Q':
-                    running = 0;
-                    break;
+        // Drain the key events: the paddle moves while a key is held and
+        // stops on its release
+        key_event_t ev;
+        while (get_key_event(&ev, 0)) {
+            int down = !(ev.flags & KEY_EVENT_RELEASE);
+            char key = ev.ascii | 0x20;  // Either case
+            if (ev.keycode == KEY_LEFT || key == 'a') {
+                left_held = down;
+            } else if (ev.keycode == KEY_RIGHT || key == 'd') {
+                right_held = down;
+            } else if (down && key == 'q') {
+                running = 0;
             }
         }
-        
-        // Simple delay
-        delay(16);  // ~60 FPS
+        if (left_held) {
+            paddle_x -= PADDLE_SPEED;
+            if (paddle_x < 0) paddle_x = 0;
+        }
+        if (right_held) {
+            paddle_x += PADDLE_SPEED;
+            if (paddle_x > max_x - PADDLE_WIDTH)
+                paddle_x = max_x - PADDLE_WIDTH;
+        }
+
+        // Show the frame (only what changed) at the next vertical blank: no
+        // tearing, and the loop sleeps until then at the display's rate
+        present_vsync();
     }
     
     closegraph();
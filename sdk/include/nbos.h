@@ -34,46 +34,210 @@ typedef int64_t  ssize_t;
 #define SYS_PRINT     1
 #define SYS_GETKEY    2
 #define SYS_KBHIT     3
-#define SYS_MALLOC    4
-#define SYS_FREE      5
 #define SYS_SLEEP     6
+#define SYS_CLOCK     7
+#define SYS_SLEEP_UNTIL 8
 #define SYS_PUTPIXEL  10
 #define SYS_GETPIXEL  11
 #define SYS_CLEAR     12
 #define SYS_GETWIDTH  13
 #define SYS_GETHEIGHT 14
+#define SYS_LINE      15
+#define SYS_FILLRECT  16
+#define SYS_FILLCIRCLE 17
+#define SYS_GFX_SUBMIT 18
+#define SYS_GETEVENT  19
+#define SYS_EXEC      20
+#define SYS_MAP_FRAMEBUFFER 21
+#define SYS_SBRK      22
+#define SYS_MMAP      23
+#define SYS_MUNMAP    24
+#define SYS_WAIT_VBLANK 25
+#define SYS_SERIAL_WRITE 26
+
+// System calls use the SYSCALL instruction. Define NBOS_SYSCALL_INT80 before
+// including this header to go through int 0x80 instead.
+//
+// Arguments go in RBX, RCX, RDX, RSI and RDI, the result comes back in RAX.
+// SYSCALL returns through RCX and R11, so there the second argument moves
+// to R10 and both registers are clobbered.
+#ifdef NBOS_SYSCALL_INT80
+#define NBOS_SYSCALL_INSN "int $0x80"
+#define NBOS_ARG2(v) uint64_t nbos_arg2 = (v)
+#define NBOS_ARG2_REG "c"
+#define NBOS_SYSCALL_CLOBBERS "memory"
+#else
+#define NBOS_SYSCALL_INSN "syscall"
+#define NBOS_ARG2(v) register uint64_t nbos_arg2 __asm__("r10") = (v)
+#define NBOS_ARG2_REG "r"
+#define NBOS_SYSCALL_CLOBBERS "rcx", "r11", "memory"
+#endif
 
-// Inline system call wrapper
 static inline uint64_t syscall0(uint64_t num) {
     uint64_t ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num));
+    __asm__ volatile(NBOS_SYSCALL_INSN : "=a"(ret) : "a"(num)
+                     : NBOS_SYSCALL_CLOBBERS);
     return ret;
 }
 
 static inline uint64_t syscall1(uint64_t num, uint64_t arg1) {
     uint64_t ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1));
+    __asm__ volatile(NBOS_SYSCALL_INSN : "=a"(ret) : "a"(num), "b"(arg1)
+                     : NBOS_SYSCALL_CLOBBERS);
     return ret;
 }
 
 static inline uint64_t syscall2(uint64_t num, uint64_t arg1, uint64_t arg2) {
     uint64_t ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1), "c"(arg2));
+    NBOS_ARG2(arg2);
+    __asm__ volatile(NBOS_SYSCALL_INSN : "=a"(ret)
+                     : "a"(num), "b"(arg1), NBOS_ARG2_REG(nbos_arg2)
+                     : NBOS_SYSCALL_CLOBBERS);
     return ret;
 }
 
 static inline uint64_t syscall3(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3) {
     uint64_t ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1), "c"(arg2), "d"(arg3));
+    NBOS_ARG2(arg2);
+    __asm__ volatile(NBOS_SYSCALL_INSN : "=a"(ret)
+                     : "a"(num), "b"(arg1), NBOS_ARG2_REG(nbos_arg2), "d"(arg3)
+                     : NBOS_SYSCALL_CLOBBERS);
     return ret;
 }
 
 static inline uint64_t syscall4(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4) {
     uint64_t ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4));
+    NBOS_ARG2(arg2);
+    __asm__ volatile(NBOS_SYSCALL_INSN : "=a"(ret)
+                     : "a"(num), "b"(arg1), NBOS_ARG2_REG(nbos_arg2), "d"(arg3),
+                       "S"(arg4)
+                     : NBOS_SYSCALL_CLOBBERS);
+    return ret;
+}
+
+static inline uint64_t syscall5(uint64_t num, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+    uint64_t ret;
+    NBOS_ARG2(arg2);
+    __asm__ volatile(NBOS_SYSCALL_INSN : "=a"(ret)
+                     : "a"(num), "b"(arg1), NBOS_ARG2_REG(nbos_arg2), "d"(arg3),
+                       "S"(arg4), "D"(arg5)
+                     : NBOS_SYSCALL_CLOBBERS);
     return ret;
 }
 
+/* ============================================================================
+ * Graphics Command Ring
+ * ============================================================================ */
+
+// Drawing commands are queued on a ring in program memory and handed to the
+// kernel in one SYS_GFX_SUBMIT, which runs them in order. Layout matches
+// the kernel's gfx_ring.h. graphics.h batches through one of these.
+#define GFX_RING_ENTRIES    256
+#define GFX_RING_TEXT_BYTES 4096
+
+#define GFX_CMD_NOP         0
+#define GFX_CMD_CLEAR       1   // color
+#define GFX_CMD_PIXEL       2   // x, y, color
+#define GFX_CMD_FILL_RECT   3   // x, y, w, h, color
+#define GFX_CMD_LINE        4   // x, y to w, h, color
+#define GFX_CMD_FILL_CIRCLE 5   // x, y, radius in w, color
+#define GFX_CMD_BLIT        6   // x, y, w, h, data: pixels, pitch
+#define GFX_CMD_TEXT        7   // x, y, color, bg, data: text offset, w: length
+#define GFX_CMD_PRESENT     8   // Show everything drawn so far
+#define GFX_CMD_DAMAGE      9   // x, y, w, h: drawn by direct stores
+
+#define GFX_FLAG_COMPLETE    0x1  // Post a completion even on success
+#define GFX_FLAG_TRANSPARENT 0x2  // TEXT: leave background pixels alone
+
+typedef struct {
+    uint16_t op;
+    uint16_t flags;
+    uint32_t color;
+    int32_t  x, y;
+    int32_t  w, h;
+    uint32_t bg;
+    uint32_t pitch;
+    uint64_t data;
+    uint64_t user_data;
+} gfx_cmd_t;
+
+typedef struct {
+    uint64_t user_data;
+    int32_t  result;    // 0, or -1 for a bad command
+    uint32_t reserved;
+} gfx_cqe_t;
+
+// The program owns sq_tail and cq_head, the kernel sq_head and cq_tail
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    volatile uint32_t cq_overflow;
+    uint32_t reserved[3];
+    gfx_cmd_t sq[GFX_RING_ENTRIES];
+    gfx_cqe_t cq[GFX_RING_ENTRIES];
+    char text[GFX_RING_TEXT_BYTES];
+} gfx_ring_t;
+
+// Run everything queued on ring, returns the number of commands consumed
+static inline int64_t gfx_submit(gfx_ring_t *ring) {
+    return (int64_t)syscall1(SYS_GFX_SUBMIT, (uint64_t)ring);
+}
+
+/* ============================================================================
+ * Framebuffer Mapping
+ * ============================================================================ */
+
+// Pixels mapped straight into the program, drawn with plain stores. Layout
+// matches FramebufferMapping in the kernel's graphics.h.
+#define FB_MAP_SCREEN   0   // The screen the kernel draws on, write-combining
+#define FB_MAP_PRIVATE  1   // A zeroed 0x00RRGGBB buffer, shown with gfx_blit
+
+#define FB_INFO_DAMAGE  0x1 // Stores show once reported with GFX_CMD_DAMAGE
+                            // and GFX_CMD_PRESENT
+
+typedef struct {
+    uint8_t *addr;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;     // Bytes per row
+    uint8_t  bpp;
+    uint8_t  bytes_pp;
+    uint8_t  red_pos, red_size;
+    uint8_t  green_pos, green_size;
+    uint8_t  blue_pos, blue_size;
+    uint32_t flags;     // FB_INFO_*
+    uint32_t reserved;
+} fb_info_t;
+
+// Map the screen or a private buffer, 0 on success. Mapping the same one
+// again returns the existing mapping.
+static inline int map_framebuffer(fb_info_t *info, int mode) {
+    return syscall2(SYS_MAP_FRAMEBUFFER, (uint64_t)info, (uint64_t)mode) ==
+           (uint64_t)-1 ? -1 : 0;
+}
+
+// Where vblanks come from: the VGA retrace when it's a real one, the
+// monotonic clock at 60Hz otherwise
+#define VBLANK_SOURCE_TIMER 0
+#define VBLANK_SOURCE_VGA   1
+
+// Matches vblank_info_t in the kernel's vblank.h
+typedef struct {
+    uint64_t seq;       // Vblanks since boot
+    uint64_t time_ns;   // uptime_ns() when this one began
+    uint64_t period_ns; // Refresh period
+    uint32_t source;    // VBLANK_SOURCE_*
+    uint32_t reserved;
+} vblank_info_t;
+
+// Sleep until the next vertical blank begins. Its sequence number, and a
+// description at info unless that's 0.
+static inline uint64_t wait_vblank(vblank_info_t *info) {
+    return syscall1(SYS_WAIT_VBLANK, (uint64_t)info);
+}
+
 /* ============================================================================
  * Console I/O
  * ============================================================================ */
@@ -83,6 +247,12 @@ static inline void print(const char *str) {
     syscall1(SYS_PRINT, (uint64_t)str);
 }
 
+// Write a string to the serial port (COM1), for output meant to be
+// captured by the host
+static inline void serial_print(const char *str) {
+    syscall1(SYS_SERIAL_WRITE, (uint64_t)str);
+}
+
 // Get a keypress (blocking)
 static inline char getkey(void) {
     return (char)syscall0(SYS_GETKEY);
@@ -93,39 +263,77 @@ static inline int kbhit(void) {
     return (int)syscall0(SYS_KBHIT);
 }
 
+// Keycodes: the set 1 scancode, plus 0x80 for extended keys
+#define KEY_ESCAPE   0x01
+#define KEY_ENTER    0x1C
+#define KEY_SPACE    0x39
+#define KEY_UP       0xC8
+#define KEY_LEFT     0xCB
+#define KEY_RIGHT    0xCD
+#define KEY_DOWN     0xD0
+
+#define KEY_MOD_SHIFT 0x01
+#define KEY_MOD_CTRL  0x02
+#define KEY_MOD_ALT   0x04
+#define KEY_MOD_CAPS  0x08
+
+#define KEY_EVENT_RELEASE 0x01
+
+// Every press and release, in order (matches the kernel's keyboard.h)
+typedef struct {
+    uint64_t time_ns;   // uptime_ns() when the key interrupt came in
+    uint8_t  scancode;
+    uint8_t  keycode;
+    uint8_t  modifiers;
+    uint8_t  flags;
+    char     ascii;     // Character typed, or 0
+    uint8_t  reserved[3];
+} key_event_t;
+
+// Next key event into *event. Returns 0 when there is none and wait is 0,
+// otherwise blocks until one arrives.
+static inline int get_key_event(key_event_t *event, int wait) {
+    return (int)syscall2(SYS_GETEVENT, (uint64_t)event, (uint64_t)wait);
+}
+
 /* ============================================================================
  * Memory Management
  * ============================================================================ */
 
-// Allocate memory
-static inline void *malloc(size_t size) {
-    return (void *)syscall1(SYS_MALLOC, size);
-}
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+#define MAP_FAILED ((void *)-1)
 
-// Free memory
-static inline void free(void *ptr) {
-    syscall1(SYS_FREE, (uint64_t)ptr);
+// Move the program break by increment bytes. The old break, or MAP_FAILED.
+// malloc carves its small blocks out of the break, programs that use the
+// heap shouldn't move it themselves.
+static inline void *sbrk(intptr_t increment) {
+    return (void *)syscall1(SYS_SBRK, (uint64_t)increment);
 }
 
-// Set memory to a value
-static inline void *memset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
-    while (n--) {
-        *p++ = (uint8_t)c;
-    }
-    return s;
+// Zero filled pages of their own, anywhere the kernel has room (addr is a
+// hint). The address, or MAP_FAILED.
+static inline void *mmap(void *addr, size_t length, int prot) {
+    return (void *)syscall3(SYS_MMAP, (uint64_t)addr, length, (uint64_t)prot);
 }
 
-// Copy memory
-static inline void *memcpy(void *dest, const void *src, size_t n) {
-    uint8_t *d = (uint8_t *)dest;
-    const uint8_t *s = (const uint8_t *)src;
-    while (n--) {
-        *d++ = *s++;
-    }
-    return dest;
+static inline int munmap(void *addr, size_t length) {
+    return (int)syscall2(SYS_MUNMAP, (uint64_t)addr, length);
 }
 
+// The heap is in lib/libnbosc.a: small blocks from size classes in the
+// program break, large ones mapped on their own
+void *malloc(size_t size);
+void free(void *ptr);
+void *calloc(size_t count, size_t size);
+void *realloc(void *ptr, size_t size);
+
+// Memory and string routines are in lib/libnbosc.a, tuned for the CPU
+// at startup
+void *memset(void *s, int c, size_t n);
+void *memcpy(void *dest, const void *src, size_t n);
+
 /* ============================================================================
  * System Control
  * ============================================================================ */
@@ -136,41 +344,41 @@ static inline void exit(int code) {
     for(;;); // Never returns
 }
 
+// Run another program and wait for it. Its exit code, or a negative value
+// if it couldn't be loaded.
+static inline int exec(const char *path) {
+    return (int)syscall2(SYS_EXEC, (uint64_t)path, 0);
+}
+
+// The same with the arguments main gets, a null terminated list that
+// starts with the program's name
+static inline int execv(const char *path, char *const argv[]) {
+    return (int)syscall2(SYS_EXEC, (uint64_t)path, (uint64_t)argv);
+}
+
 // Sleep for milliseconds
 static inline void sleep(int ms) {
     syscall1(SYS_SLEEP, (uint64_t)ms);
 }
 
-/* ============================================================================
- * String Functions
- * ============================================================================ */
-
-static inline size_t strlen(const char *s) {
-    size_t len = 0;
-    while (*s++) len++;
-    return len;
+// Monotonic time since boot in nanoseconds
+static inline uint64_t uptime_ns(void) {
+    return syscall0(SYS_CLOCK);
 }
 
-static inline int strcmp(const char *s1, const char *s2) {
-    while (*s1 && (*s1 == *s2)) {
-        s1++;
-        s2++;
-    }
-    return *(unsigned char *)s1 - *(unsigned char *)s2;
+// Sleep until uptime_ns() reaches deadline_ns (returns at once if it has)
+static inline void sleep_until(uint64_t deadline_ns) {
+    syscall1(SYS_SLEEP_UNTIL, deadline_ns);
 }
 
-static inline char *strcpy(char *dest, const char *src) {
-    char *d = dest;
-    while ((*d++ = *src++));
-    return dest;
-}
+/* ============================================================================
+ * String Functions
+ * ============================================================================ */
 
-static inline char *strcat(char *dest, const char *src) {
-    char *d = dest;
-    while (*d) d++;
-    while ((*d++ = *src++));
-    return dest;
-}
+size_t strlen(const char *s);
+int strcmp(const char *s1, const char *s2);
+char *strcpy(char *dest, const char *src);
+char *strcat(char *dest, const char *src);
 
 #ifdef __cplusplus
 }
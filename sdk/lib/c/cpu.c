@@ -0,0 +1,32 @@
+/*
+ * libnbosc - startup and CPU feature detection
+ */
+
+#include "nbosc_internal.h"
+
+uint32_t _nbosc_cpu = 0;
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
+                         uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid"
+                     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                     : "a"(leaf), "c"(subleaf));
+}
+
+// Called by crt0 before main
+void _nbosc_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t max_leaf = eax;
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (edx & (1u << 26))
+        _nbosc_cpu |= NBOSC_CPU_SSE2;
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & (1u << 9))
+            _nbosc_cpu |= NBOSC_CPU_ERMS;
+    }
+
+    _nbosc_string_init();
+}
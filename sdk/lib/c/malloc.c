@@ -0,0 +1,163 @@
+/*
+ * libnbosc - heap
+ *
+ * Blocks up to SMALL_MAX bytes come from size classes: runs of RUN_SIZE
+ * bytes taken from the program break, each cut into blocks of one class
+ * as they are needed, with freed blocks kept on a list per class. Which
+ * class a run holds is kept in a table indexed by run, so small blocks
+ * carry no header. Larger blocks get pages of their own from mmap with a
+ * header holding the mapping's size, and go back with munmap.
+ *
+ * Programs have one thread. The lists live in a cache struct all the
+ * same, so each thread can get its own without touching the rest.
+ */
+
+#include "nbosc_internal.h"
+
+#define RUN_SHIFT 16
+#define RUN_SIZE (1ULL << RUN_SHIFT)
+#define MAX_RUNS 16384 // 1GB of small blocks
+
+// 16 byte steps up to 128, then four classes per doubling
+#define SMALL_MAX 8192
+#define CLASSES 32
+
+#define LARGE_HEADER 16 // Keeps large blocks 16 byte aligned
+#define PAGE_SIZE 4096
+
+typedef struct block {
+    struct block *next;
+} block_t;
+
+typedef struct {
+    block_t *free[CLASSES];
+    // What's left of the newest run of each class, cut up on demand so
+    // its pages are only touched when used
+    uint8_t *carve[CLASSES];
+    uint8_t *carve_end[CLASSES];
+} heap_cache_t;
+
+static heap_cache_t main_cache;
+static uint8_t *heap_base;   // First run, RUN_SIZE aligned
+static uint8_t *heap_top;    // End of the last run
+static uint8_t run_class[MAX_RUNS];
+
+static inline int size_class(size_t n) {
+    if (n <= 128) return n ? (int)((n - 1) / 16) : 0;
+    int k = 63 - __builtin_clzll(n - 1);  // 7 to 12
+    return 8 + (k - 7) * 4 + (int)((n - 1) >> (k - 2)) - 4;
+}
+
+static inline size_t class_size(int c) {
+    if (c < 8) return (size_t)(c + 1) * 16;
+    int k = (c - 8) / 4 + 7;
+    return ((size_t)1 << k) + (size_t)((c - 8) % 4 + 1) * ((size_t)1 << (k - 2));
+}
+
+// A fresh run for class c at the top of the heap, or 0
+static uint8_t *new_run(int c) {
+    if (!heap_base) {
+        uint8_t *brk = sbrk(0);
+        if (brk == MAP_FAILED) return 0;
+        size_t pad = (size_t)(-(uintptr_t)brk & (RUN_SIZE - 1));
+        if (pad && sbrk((intptr_t)pad) == MAP_FAILED) return 0;
+        heap_base = heap_top = brk + pad;
+    }
+    size_t index = (size_t)(heap_top - heap_base) >> RUN_SHIFT;
+    if (index >= MAX_RUNS) return 0;
+    uint8_t *run = sbrk((intptr_t)RUN_SIZE);
+    if (run == MAP_FAILED) return 0;
+    if (run != heap_top) {
+        // Someone else moved the break, the runs must stay contiguous
+        sbrk(-(intptr_t)RUN_SIZE);
+        return 0;
+    }
+    run_class[index] = (uint8_t)c;
+    heap_top += RUN_SIZE;
+    return run;
+}
+
+static void *small_alloc(heap_cache_t *cache, int c) {
+    block_t *b = cache->free[c];
+    if (b) {
+        cache->free[c] = b->next;
+        return b;
+    }
+    size_t size = class_size(c);
+    if (cache->carve[c] == cache->carve_end[c]) {
+        uint8_t *run = new_run(c);
+        if (!run) return 0;
+        cache->carve[c] = run;
+        cache->carve_end[c] = run + RUN_SIZE / size * size;
+    }
+    void *p = cache->carve[c];
+    cache->carve[c] += size;
+    return p;
+}
+
+static inline int is_small(const void *ptr) {
+    return (const uint8_t *)ptr >= heap_base && (const uint8_t *)ptr < heap_top;
+}
+
+// Bytes the block at ptr can hold
+static size_t block_size(const void *ptr) {
+    if (is_small(ptr))
+        return class_size(run_class[(size_t)((const uint8_t *)ptr - heap_base) >> RUN_SHIFT]);
+    const size_t *header = (const size_t *)((const uint8_t *)ptr - LARGE_HEADER);
+    return *header - LARGE_HEADER;
+}
+
+/* ============================================================================
+ * Public Routines
+ * ============================================================================ */
+
+void *malloc(size_t size) {
+    if (size <= SMALL_MAX)
+        return small_alloc(&main_cache, size_class(size));
+
+    size_t total = (size + LARGE_HEADER + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    if (total < size) return 0;
+    uint8_t *p = mmap(0, total, PROT_READ | PROT_WRITE);
+    if (p == MAP_FAILED) return 0;
+    *(size_t *)p = total;
+    return p + LARGE_HEADER;
+}
+
+void free(void *ptr) {
+    if (!ptr) return;
+    if (is_small(ptr)) {
+        heap_cache_t *cache = &main_cache;
+        int c = run_class[(size_t)((uint8_t *)ptr - heap_base) >> RUN_SHIFT];
+        block_t *b = ptr;
+        b->next = cache->free[c];
+        cache->free[c] = b;
+        return;
+    }
+    uint8_t *p = (uint8_t *)ptr - LARGE_HEADER;
+    munmap(p, *(size_t *)p);
+}
+
+void *calloc(size_t count, size_t size) {
+    if (size && count > (size_t)-1 / size) return 0;
+    size_t n = count * size;
+    void *p = malloc(n);
+    // Large blocks are fresh pages, already zero
+    if (p && n <= SMALL_MAX) memset(p, 0, n);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (!size) {
+        free(ptr);
+        return 0;
+    }
+    size_t have = block_size(ptr);
+    if (size <= have) return ptr;
+
+    void *p = malloc(size);
+    if (!p) return 0;
+    memcpy(p, ptr, have);
+    free(ptr);
+    return p;
+}
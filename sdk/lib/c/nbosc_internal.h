@@ -0,0 +1,23 @@
+/*
+ * libnbosc internals
+ */
+
+#ifndef _NBOSC_INTERNAL_H
+#define _NBOSC_INTERNAL_H
+
+#include "nbos.h"
+
+// CPU features the routines pick their variants by, from CPUID
+#define NBOSC_CPU_SSE2 0x1
+#define NBOSC_CPU_ERMS 0x2  // Enhanced rep movsb/stosb
+
+extern uint32_t _nbosc_cpu;
+
+// Vector code is kept to functions marked like this, the rest of the SDK
+// is built with -mno-sse
+#define NBOSC_SSE2 __attribute__((target("sse2")))
+
+// Choose the string routine variants for _nbosc_cpu
+void _nbosc_string_init(void);
+
+#endif /* _NBOSC_INTERNAL_H */
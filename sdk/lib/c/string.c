@@ -0,0 +1,274 @@
+/*
+ * libnbosc - memory and string routines
+ *
+ * Short operations are done inline with 8 byte words. Longer ones go to
+ * the variant _nbosc_string_init picked for the CPU: rep movsb/stosb on
+ * CPUs with ERMS, which handle them in whole cache lines, 16 byte SSE2
+ * loops otherwise, and rep movsq/stosq on anything older. strlen scans a
+ * word (or with SSE2 16 bytes) at a time; aligned loads never cross into
+ * the next page, so reading past the terminator is safe.
+ */
+
+#include "nbosc_internal.h"
+
+// Below this copies and fills stay inline
+#define SMALL_BYTES 32
+// From here rep movsb/stosb beats the vector loops on ERMS CPUs
+#define ERMS_MIN_BYTES 512
+// Copies this big bypass the cache with non-temporal stores (SSE2 only):
+// the destination, usually a frame buffer, won't be read back soon
+#define STREAM_MIN_BYTES (256 * 1024)
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) word_t;
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define HAS_ZERO(v) (((v) - ONES) & ~(v) & HIGHS)
+
+/* ============================================================================
+ * Variants
+ * ============================================================================ */
+
+static void copy_movsq(uint8_t *d, const uint8_t *s, size_t n) {
+    size_t words = n / 8, bytes = n & 7;
+    __asm__ volatile("rep movsq\n\t"
+                     "mov %3, %%rcx\n\t"
+                     "rep movsb"
+                     : "+D"(d), "+S"(s), "+c"(words)
+                     : "r"(bytes)
+                     : "memory");
+}
+
+static void fill_stosq(uint8_t *d, uint64_t pattern, size_t n) {
+    size_t words = n / 8, bytes = n & 7;
+    __asm__ volatile("rep stosq\n\t"
+                     "mov %3, %%rcx\n\t"
+                     "rep stosb"
+                     : "+D"(d), "+c"(words), "+a"(pattern)
+                     : "r"(bytes)
+                     : "memory");
+}
+
+static inline void copy_movsb(uint8_t *d, const uint8_t *s, size_t n) {
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+static inline void fill_stosb(uint8_t *d, uint8_t c, size_t n) {
+    __asm__ volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+}
+
+// n >= 16. The first and last 16 bytes are stored unaligned, everything
+// between with aligned stores, 64 bytes a round.
+NBOSC_SSE2 static void copy_sse2(uint8_t *d, const uint8_t *s, size_t n) {
+    uint8_t *end = d + n;
+    const uint8_t *send = s + n;
+    __asm__ volatile("movdqu (%1), %%xmm0\n\t"
+                     "movdqu %%xmm0, (%0)"
+                     : : "r"(d), "r"(s) : "xmm0", "memory");
+    size_t skip = 16 - ((uintptr_t)d & 15);
+    d += skip;
+    s += skip;
+    n -= skip;
+
+    size_t rounds = n / 64;
+    if (rounds && n >= STREAM_MIN_BYTES) {
+        __asm__ volatile("1:\n\t"
+                         "movdqu (%1), %%xmm0\n\t"
+                         "movdqu 16(%1), %%xmm1\n\t"
+                         "movdqu 32(%1), %%xmm2\n\t"
+                         "movdqu 48(%1), %%xmm3\n\t"
+                         "movntdq %%xmm0, (%0)\n\t"
+                         "movntdq %%xmm1, 16(%0)\n\t"
+                         "movntdq %%xmm2, 32(%0)\n\t"
+                         "movntdq %%xmm3, 48(%0)\n\t"
+                         "add $64, %1\n\t"
+                         "add $64, %0\n\t"
+                         "dec %2\n\t"
+                         "jnz 1b\n\t"
+                         "sfence"
+                         : "+r"(d), "+r"(s), "+r"(rounds)
+                         :
+                         : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+    } else if (rounds) {
+        __asm__ volatile("1:\n\t"
+                         "movdqu (%1), %%xmm0\n\t"
+                         "movdqu 16(%1), %%xmm1\n\t"
+                         "movdqu 32(%1), %%xmm2\n\t"
+                         "movdqu 48(%1), %%xmm3\n\t"
+                         "movdqa %%xmm0, (%0)\n\t"
+                         "movdqa %%xmm1, 16(%0)\n\t"
+                         "movdqa %%xmm2, 32(%0)\n\t"
+                         "movdqa %%xmm3, 48(%0)\n\t"
+                         "add $64, %1\n\t"
+                         "add $64, %0\n\t"
+                         "dec %2\n\t"
+                         "jnz 1b"
+                         : "+r"(d), "+r"(s), "+r"(rounds)
+                         :
+                         : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+    }
+    n &= 63;
+
+    for (; n >= 16; n -= 16, d += 16, s += 16)
+        __asm__ volatile("movdqu (%1), %%xmm0\n\t"
+                         "movdqa %%xmm0, (%0)"
+                         : : "r"(d), "r"(s) : "xmm0", "memory");
+    __asm__ volatile("movdqu (%1), %%xmm0\n\t"
+                     "movdqu %%xmm0, (%0)"
+                     : : "r"(end - 16), "r"(send - 16) : "xmm0", "memory");
+}
+
+// n >= 16: unaligned stores at both ends, aligned ones between. One asm
+// statement, so xmm0 holds the pattern throughout.
+NBOSC_SSE2 static void fill_sse2(uint8_t *d, uint64_t pattern, size_t n) {
+    uint8_t *end = d + n;
+    uint8_t *a = (uint8_t *)(((uintptr_t)d + 16) & ~(uintptr_t)15);
+    size_t blocks = (size_t)(((uintptr_t)end & ~(uintptr_t)15) - (uintptr_t)a) / 16;
+    __asm__ volatile("movq %4, %%xmm0\n\t"
+                     "punpcklqdq %%xmm0, %%xmm0\n\t"
+                     "movdqu %%xmm0, (%2)\n\t"
+                     "movdqu %%xmm0, -16(%3)\n\t"
+                     "test %1, %1\n\t"
+                     "jz 2f\n\t"
+                     "1:\n\t"
+                     "movdqa %%xmm0, (%0)\n\t"
+                     "add $16, %0\n\t"
+                     "dec %1\n\t"
+                     "jnz 1b\n\t"
+                     "2:"
+                     : "+r"(a), "+r"(blocks)
+                     : "r"(d), "r"(end), "r"(pattern)
+                     : "xmm0", "memory", "cc");
+}
+
+static size_t strlen_swar(const char *s) {
+    const char *p = s;
+    for (; (uintptr_t)p & 7; p++)
+        if (!*p) return (size_t)(p - s);
+
+    const word_t *w = (const word_t *)p;
+    while (!HAS_ZERO(*w)) w++;
+    for (p = (const char *)w; *p; p++);
+    return (size_t)(p - s);
+}
+
+// 16 aligned bytes at a time, the first block masked down to the string
+NBOSC_SSE2 static size_t strlen_sse2(const char *s) {
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    uint32_t mask;
+    __asm__ volatile("pxor %%xmm0, %%xmm0\n\t"
+                     "movdqa (%1), %%xmm1\n\t"
+                     "pcmpeqb %%xmm0, %%xmm1\n\t"
+                     "pmovmskb %%xmm1, %0"
+                     : "=r"(mask) : "r"(p) : "xmm0", "xmm1", "memory");
+    mask >>= (uintptr_t)s & 15;
+    if (mask) return (size_t)__builtin_ctz(mask);
+
+    do {
+        p += 16;
+        __asm__ volatile("pxor %%xmm0, %%xmm0\n\t"
+                         "movdqa (%1), %%xmm1\n\t"
+                         "pcmpeqb %%xmm0, %%xmm1\n\t"
+                         "pmovmskb %%xmm1, %0"
+                         : "=r"(mask) : "r"(p) : "xmm0", "xmm1", "memory");
+    } while (!mask);
+    return (size_t)(p - s) + (size_t)__builtin_ctz(mask);
+}
+
+/* ============================================================================
+ * Dispatch
+ * ============================================================================ */
+
+// What runs before _nbosc_init works on any x86-64 CPU
+static void (*copy_impl)(uint8_t *, const uint8_t *, size_t) = copy_movsq;
+static void (*fill_impl)(uint8_t *, uint64_t, size_t) = fill_stosq;
+static size_t (*strlen_impl)(const char *) = strlen_swar;
+static int use_erms = 0;
+
+void _nbosc_string_init(void) {
+    if (_nbosc_cpu & NBOSC_CPU_SSE2) {
+        copy_impl = copy_sse2;
+        fill_impl = fill_sse2;
+        strlen_impl = strlen_sse2;
+    }
+    use_erms = (_nbosc_cpu & NBOSC_CPU_ERMS) != 0;
+}
+
+/* ============================================================================
+ * Public Routines
+ * ============================================================================ */
+
+void *memcpy(void *dest, const void *src, size_t n) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+
+    if (n < SMALL_BYTES) {
+        // Overlapping words from both ends
+        if (n >= 8) {
+            word_t last = *(const word_t *)(s + n - 8);
+            for (size_t i = 0; i + 8 <= n; i += 8)
+                *(word_t *)(d + i) = *(const word_t *)(s + i);
+            *(word_t *)(d + n - 8) = last;
+        } else {
+            while (n--) *d++ = *s++;
+        }
+        return dest;
+    }
+    if (use_erms && n >= ERMS_MIN_BYTES)
+        copy_movsb(d, s, n);
+    else
+        copy_impl(d, s, n);
+    return dest;
+}
+
+void *memset(void *s, int c, size_t n) {
+    uint8_t *d = (uint8_t *)s;
+
+    if (n < SMALL_BYTES) {
+        if (n >= 8) {
+            uint64_t pattern = (uint8_t)c * ONES;
+            for (size_t i = 0; i + 8 <= n; i += 8)
+                *(word_t *)(d + i) = pattern;
+            *(word_t *)(d + n - 8) = pattern;
+        } else {
+            while (n--) *d++ = (uint8_t)c;
+        }
+        return s;
+    }
+    if (use_erms && n >= ERMS_MIN_BYTES)
+        fill_stosb(d, (uint8_t)c, n);
+    else
+        fill_impl(d, (uint8_t)c * ONES, n);
+    return s;
+}
+
+size_t strlen(const char *s) {
+    return strlen_impl(s);
+}
+
+int strcmp(const char *s1, const char *s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char *)s1 - *(unsigned char *)s2;
+}
+
+// A word at a time once the source is aligned, until a word holds the
+// terminator
+char *strcpy(char *dest, const char *src) {
+    char *d = dest;
+    for (; (uintptr_t)src & 7; src++, d++)
+        if (!(*d = *src)) return dest;
+
+    const word_t *w = (const word_t *)src;
+    for (; !HAS_ZERO(*w); w++, d += 8)
+        *(word_t *)d = *w;
+    for (src = (const char *)w; (*d++ = *src++););
+    return dest;
+}
+
+char *strcat(char *dest, const char *src) {
+    strcpy(dest + strlen(dest), src);
+    return dest;
+}
@@ -1,30 +1,59 @@
 ; NBOS C Runtime Startup
-; This is the entry point for NBOS programs
+; This is the entry point for NBOS programs. The kernel starts it the way
+; the SysV ABI has it: argc at [rsp], then argv, with rsp 16 byte aligned.
 
 bits 64
 section .text
 
 global _start
 extern main
+extern _nbosc_init
+extern __bss_start
+extern __bss_end
+extern __init_array_start
+extern __init_array_end
 
 _start:
-    ; Set up stack frame
-    push rbp
-    mov rbp, rsp
-    
-    ; Clear BSS (if needed)
-    ; For now, skip this
-    
-    ; Call main()
-    xor edi, edi        ; argc = 0
-    xor esi, esi        ; argv = NULL
+    xor ebp, ebp                ; Outermost frame
+    mov r12, [rsp]              ; argc
+    lea r13, [rsp + 8]          ; argv
+
+    ; Clear BSS. The kernel fills .bss pages with zeros as they are touched,
+    ; only the part sharing its first page with .data comes from the file,
+    ; so that part is cleared here and the rest left untouched.
+    lea rdi, [rel __bss_start]
+    lea rcx, [rel __bss_end]
+    lea rax, [rdi + 4095]
+    and rax, -4096
+    cmp rcx, rax
+    cmova rcx, rax
+    sub rcx, rdi
+    xor eax, eax
+    rep stosb
+
+    ; Pick the libnbosc routines for this CPU
+    call _nbosc_init
+
+    ; Constructors, in link order
+    lea rbx, [rel __init_array_start]
+.ctors:
+    lea rax, [rel __init_array_end]
+    cmp rbx, rax
+    jae .main
+    call qword [rbx]
+    add rbx, 8
+    jmp .ctors
+
+.main:
+    mov edi, r12d               ; argc
+    mov rsi, r13                ; argv
     call main
-    
+
     ; Exit with return value from main
-    mov rdi, rax        ; Return value
-    mov rax, 0          ; SYS_EXIT
+    mov ebx, eax                ; Exit code
+    xor eax, eax                ; SYS_EXIT
     int 0x80
-    
+
     ; Should never reach here
     cli
 .halt:
@@ -0,0 +1,286 @@
+/*
+ * libnbosgfx - drawing primitives
+ */
+
+#include "gfx_internal.h"
+
+void cleardevice(void) {
+    gfx_rect_t all = {0, 0, _gfx.target->width, _gfx.target->height};
+    gfx_rect_t clip = _gfx.clip;
+    _gfx.clip = all;
+    _gfx_fill(all, _gfx_rgb(_gfx.bkcolor));
+    _gfx.clip = clip;
+}
+
+void clearviewport(void) {
+    _gfx_fill(_gfx.view, _gfx_rgb(_gfx.bkcolor));
+}
+
+void putpixel(int x, int y, int color) {
+    x += _gfx.org_x;
+    y += _gfx.org_y;
+    if (x < _gfx.clip.x0 || x >= _gfx.clip.x1 ||
+        y < _gfx.clip.y0 || y >= _gfx.clip.y1)
+        return;
+    *_gfx_row(x, y) = _gfx_rgb(color);
+    gfx_rect_t r = {x, y, x + 1, y + 1};
+    _gfx_damage(r);
+}
+
+int getpixel(int x, int y) {
+    x += _gfx.org_x;
+    y += _gfx.org_y;
+    if (x < 0 || y < 0 || x >= _gfx.target->width || y >= _gfx.target->height)
+        return 0;
+    return (int)*_gfx_row(x, y);
+}
+
+// Cohen-Sutherland against the viewport
+#define CLIP_LEFT   1
+#define CLIP_RIGHT  2
+#define CLIP_TOP    4
+#define CLIP_BOTTOM 8
+
+static int outcode(int x, int y) {
+    int code = 0;
+    if (x < _gfx.clip.x0) code |= CLIP_LEFT;
+    else if (x >= _gfx.clip.x1) code |= CLIP_RIGHT;
+    if (y < _gfx.clip.y0) code |= CLIP_TOP;
+    else if (y >= _gfx.clip.y1) code |= CLIP_BOTTOM;
+    return code;
+}
+
+// Clip a line to the viewport, 0 if none of it is visible
+static int clip_line(int *x0, int *y0, int *x1, int *y1) {
+    int xmin = _gfx.clip.x0, xmax = _gfx.clip.x1 - 1;
+    int ymin = _gfx.clip.y0, ymax = _gfx.clip.y1 - 1;
+    int code0 = outcode(*x0, *y0);
+    int code1 = outcode(*x1, *y1);
+
+    // Each pass moves one endpoint onto an edge; the pass limit stops
+    // integer rounding from bouncing between edges
+    for (int pass = 0; pass < 8; pass++) {
+        if (!(code0 | code1)) return 1;
+        if (code0 & code1) return 0;
+
+        int code = code0 ? code0 : code1;
+        int64_t dx = *x1 - *x0;
+        int64_t dy = *y1 - *y0;
+        int x, y;
+        if (code & CLIP_TOP) {
+            x = *x0 + (int)(dx * (ymin - *y0) / dy);
+            y = ymin;
+        } else if (code & CLIP_BOTTOM) {
+            x = *x0 + (int)(dx * (ymax - *y0) / dy);
+            y = ymax;
+        } else if (code & CLIP_RIGHT) {
+            y = *y0 + (int)(dy * (xmax - *x0) / dx);
+            x = xmax;
+        } else {
+            y = *y0 + (int)(dy * (xmin - *x0) / dx);
+            x = xmin;
+        }
+
+        if (code == code0) {
+            *x0 = x; *y0 = y;
+            code0 = outcode(x, y);
+        } else {
+            *x1 = x; *y1 = y;
+            code1 = outcode(x, y);
+        }
+    }
+    return !(code0 | code1);
+}
+
+// Clipped once, then Bresenham stepping a pointer
+void line(int x1, int y1, int x2, int y2) {
+    uint32_t color = _gfx_rgb(_gfx.color);
+    x1 += _gfx.org_x; y1 += _gfx.org_y;
+    x2 += _gfx.org_x; y2 += _gfx.org_y;
+    if (!clip_line(&x1, &y1, &x2, &y2))
+        return;
+
+    int dx = x2 > x1 ? x2 - x1 : x1 - x2;
+    int dy = y2 > y1 ? y2 - y1 : y1 - y2;
+    gfx_rect_t r = {x1 < x2 ? x1 : x2, y1 < y2 ? y1 : y2, 0, 0};
+    r.x1 = r.x0 + dx + 1;
+    r.y1 = r.y0 + dy + 1;
+    if (dx == 0 || dy == 0) {
+        _gfx_fill(r, color);
+        return;
+    }
+    _gfx_damage(r);
+
+    int step_x = x2 > x1 ? 1 : -1;
+    int step_y = y2 > y1 ? _gfx.target->stride : -_gfx.target->stride;
+    uint32_t *p = _gfx_row(x1, y1);
+    if (dx >= dy) {
+        int err = dx / 2;
+        for (int i = 0; i <= dx; i++, p += step_x) {
+            *p = color;
+            err -= dy;
+            if (err < 0) { err += dx; p += step_y; }
+        }
+    } else {
+        int err = dy / 2;
+        for (int i = 0; i <= dy; i++, p += step_y) {
+            *p = color;
+            err -= dx;
+            if (err < 0) { err += dy; p += step_x; }
+        }
+    }
+}
+
+void rectangle(int left, int top, int right, int bottom) {
+    line(left, top, right, top);
+    line(right, top, right, bottom);
+    line(right, bottom, left, bottom);
+    line(left, bottom, left, top);
+}
+
+void bar(int left, int top, int right, int bottom) {
+    if (right < left || bottom < top) return;
+    gfx_rect_t r = {left + _gfx.org_x, top + _gfx.org_y,
+                    right + _gfx.org_x + 1, bottom + _gfx.org_y + 1};
+    _gfx_fill(r, _gfx_rgb(_gfx.fill_color));
+}
+
+void bar3d(int left, int top, int right, int bottom, int depth, int topflag) {
+    bar(left, top, right, bottom);
+    rectangle(left, top, right, bottom);
+    if (depth > 0) {
+        line(right, top, right + depth, top - depth);
+        line(right + depth, top - depth, right + depth, bottom - depth);
+        line(right, bottom, right + depth, bottom - depth);
+        if (topflag) {
+            line(left, top, left + depth, top - depth);
+            line(left + depth, top - depth, right + depth, top - depth);
+        }
+    }
+}
+
+// Midpoint circle; pixels are only checked when it crosses the viewport
+void circle(int xc, int yc, int radius) {
+    if (radius < 0) return;
+    xc += _gfx.org_x;
+    yc += _gfx.org_y;
+    int clip = _gfx_begin(xc - radius, yc - radius, xc + radius, yc + radius);
+    if (clip < 0) return;
+
+    uint32_t color = _gfx_rgb(_gfx.color);
+    int x = radius;
+    int y = 0;
+    int err = 0;
+    while (x >= y) {
+        _gfx_plot(xc + x, yc + y, color, clip);
+        _gfx_plot(xc + y, yc + x, color, clip);
+        _gfx_plot(xc - y, yc + x, color, clip);
+        _gfx_plot(xc - x, yc + y, color, clip);
+        _gfx_plot(xc - x, yc - y, color, clip);
+        _gfx_plot(xc - y, yc - x, color, clip);
+        _gfx_plot(xc + y, yc - x, color, clip);
+        _gfx_plot(xc + x, yc - y, color, clip);
+
+        y++;
+        err += 1 + 2 * y;
+        if (2 * (err - x) + 1 > 0) {
+            x--;
+            err += 1 - 2 * x;
+        }
+    }
+}
+
+// Horizontal run clipped to the viewport (damage is the caller's)
+static void hspan(int x0, int x1, int y, uint32_t color) {
+    if (y < _gfx.clip.y0 || y >= _gfx.clip.y1) return;
+    if (x0 < _gfx.clip.x0) x0 = _gfx.clip.x0;
+    if (x1 > _gfx.clip.x1) x1 = _gfx.clip.x1;
+    if (x0 < x1) _gfx_span(_gfx_row(x0, y), x1 - x0, color);
+}
+
+// One span per row. The half width x of row y is the largest x with
+// x*x + y*y <= r*r, walked down incrementally with the midpoint error term.
+void fillcircle(int xc, int yc, int radius) {
+    if (radius < 0) return;
+    xc += _gfx.org_x;
+    yc += _gfx.org_y;
+    if (_gfx_begin(xc - radius, yc - radius, xc + radius, yc + radius) < 0)
+        return;
+
+    uint32_t color = _gfx_rgb(_gfx.fill_color);
+    int x = radius;
+    int err = 0;  // r*r - x*x - y*y
+    for (int y = 0; y <= radius; y++) {
+        while (err < 0) {
+            err += 2 * x - 1;
+            x--;
+        }
+        hspan(xc - x, xc + x + 1, yc + y, color);
+        if (y) hspan(xc - x, xc + x + 1, yc - y, color);
+        err -= 2 * y + 1;
+    }
+}
+
+// Angles aren't supported yet, the whole circle is drawn
+void arc(int xc, int yc, int stangle, int endangle, int radius) {
+    (void)stangle;
+    (void)endangle;
+    circle(xc, yc, radius);
+}
+
+static inline void plot4(int xc, int yc, int x, int y, uint32_t color, int clip) {
+    _gfx_plot(xc + x, yc + y, color, clip);
+    _gfx_plot(xc - x, yc + y, color, clip);
+    _gfx_plot(xc + x, yc - y, color, clip);
+    _gfx_plot(xc - x, yc - y, color, clip);
+}
+
+// Midpoint ellipse, the whole outline
+void ellipse(int xc, int yc, int stangle, int endangle, int xradius, int yradius) {
+    (void)stangle;
+    (void)endangle;
+    if (xradius < 0 || yradius < 0) return;
+    xc += _gfx.org_x;
+    yc += _gfx.org_y;
+    int clip = _gfx_begin(xc - xradius, yc - yradius, xc + xradius, yc + yradius);
+    if (clip < 0) return;
+
+    uint32_t color = _gfx_rgb(_gfx.color);
+    int x = 0;
+    int y = yradius;
+    long rx2 = (long)xradius * xradius;
+    long ry2 = (long)yradius * yradius;
+    long px = 0;
+    long py = 2 * rx2 * y;
+    plot4(xc, yc, x, y, color, clip);
+
+    // Region 1
+    long p = ry2 - rx2 * yradius + rx2 / 4;
+    while (px < py) {
+        x++;
+        px += 2 * ry2;
+        if (p < 0) {
+            p += ry2 + px;
+        } else {
+            y--;
+            py -= 2 * rx2;
+            p += ry2 + px - py;
+        }
+        plot4(xc, yc, x, y, color, clip);
+    }
+
+    // Region 2
+    p = ry2 * (x + 1) * (x + 1) + rx2 * (y - 1) * (y - 1) - rx2 * ry2;
+    while (y > 0) {
+        y--;
+        py -= 2 * rx2;
+        if (p > 0) {
+            p += rx2 - py;
+        } else {
+            x++;
+            px += 2 * ry2;
+            p += rx2 - py + px;
+        }
+        plot4(xc, yc, x, y, color, clip);
+    }
+}
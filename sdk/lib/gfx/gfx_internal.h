@@ -0,0 +1,108 @@
+/*
+ * libnbosgfx internals
+ *
+ * All drawing goes into a gfx_surface_t in 0x00RRGGBB. Primitives clip
+ * their extent against the viewport once and then fill spans without
+ * further checks. While the target is the screen's back buffer every
+ * primitive records the rectangle it touched, and present() copies only
+ * those to the screen.
+ */
+
+#ifndef _GFX_INTERNAL_H
+#define _GFX_INTERNAL_H
+
+#include "graphics.h"
+
+#define GFX_MAX_DAMAGE  16  // Rectangles kept before they are merged
+#define GFX_FONT_WIDTH  8
+#define GFX_FONT_HEIGHT 16
+#define GFX_GLYPHS      95  // ASCII 32-126
+
+// x1 and y1 are exclusive, empty while x1 <= x0 or y1 <= y0
+typedef struct {
+    int x0, y0, x1, y1;
+} gfx_rect_t;
+
+typedef struct {
+    int initialized;
+    gfx_surface_t screen;   // Private back buffer (FB_MAP_PRIVATE)
+    gfx_surface_t *target;  // Where drawing goes
+    fb_info_t fb;           // The screen, when it could be mapped
+    uint8_t *fb_pixels;
+
+    // Viewport: origin, and the clip rectangle in target coordinates
+    int org_x, org_y;
+    gfx_rect_t clip;
+    gfx_rect_t view;        // As set, for clearviewport
+
+    gfx_rect_t damage[GFX_MAX_DAMAGE];
+    int damage_count;
+
+    int color;
+    int bkcolor;
+    int fill_color;
+    int fill_pattern;
+
+    gfx_ring_t ring;        // Blits to the screen when it isn't mapped
+
+    // present_vsync() bookkeeping
+    gfx_frame_stats_t stats;
+    uint64_t last_seq;
+    uint64_t last_vblank_ns;
+    uint64_t last_return_ns;
+} gfx_state_t;
+
+extern gfx_state_t _gfx;
+extern const uint8_t _gfx_font[GFX_GLYPHS][GFX_FONT_HEIGHT];
+
+// BGI palette index or RGB() value to 0x00RRGGBB
+uint32_t _gfx_rgb(int color);
+
+// Record that r of the target was drawn (r is already clipped)
+void _gfx_damage(gfx_rect_t r);
+
+// Clip r to the viewport, false if nothing is left
+static inline int _gfx_clip(gfx_rect_t *r) {
+    if (r->x0 < _gfx.clip.x0) r->x0 = _gfx.clip.x0;
+    if (r->y0 < _gfx.clip.y0) r->y0 = _gfx.clip.y0;
+    if (r->x1 > _gfx.clip.x1) r->x1 = _gfx.clip.x1;
+    if (r->y1 > _gfx.clip.y1) r->y1 = _gfx.clip.y1;
+    return r->x0 < r->x1 && r->y0 < r->y1;
+}
+
+static inline uint32_t *_gfx_row(int x, int y) {
+    return _gfx.target->pixels + (int64_t)y * _gfx.target->stride + x;
+}
+
+// Unclipped run of n pixels
+static inline void _gfx_span(uint32_t *p, int n, uint32_t color) {
+    size_t count = (size_t)n;
+    __asm__ volatile("rep stosl" : "+D"(p), "+c"(count) : "a"(color) : "memory");
+}
+
+static inline void _gfx_copy(uint32_t *dst, const uint32_t *src, int n) {
+    size_t count = (size_t)n;
+    __asm__ volatile("rep movsl" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+// Fill r (target coordinates), clipped and recorded as damage
+void _gfx_fill(gfx_rect_t r, uint32_t color);
+
+// One pixel of a primitive set up with _gfx_begin, checked against the
+// viewport only if clip says the primitive crosses its edge
+static inline void _gfx_plot(int x, int y, uint32_t color, int clip) {
+    if (clip && (x < _gfx.clip.x0 || x >= _gfx.clip.x1 ||
+                 y < _gfx.clip.y0 || y >= _gfx.clip.y1))
+        return;
+    *_gfx_row(x, y) = color;
+}
+
+// Set up bounds (target coordinates, inclusive) for a primitive drawn with
+// _gfx_plot: records the damage and returns the clip flag, or -1 when none
+// of it is visible
+int _gfx_begin(int x0, int y0, int x1, int y1);
+
+// Put the viewport back to the whole target
+void _gfx_reset_viewport(void);
+
+#endif /* _GFX_INTERNAL_H */
@@ -0,0 +1,292 @@
+/*
+ * libnbosgfx - graphics state and presenting
+ */
+
+#include "gfx_internal.h"
+
+gfx_state_t _gfx;
+
+uint32_t _gfx_rgb(int color) {
+    static const uint32_t palette[16] = {
+        0x000000,  // BLACK
+        0x0000AA,  // BLUE
+        0x00AA00,  // GREEN
+        0x00AAAA,  // CYAN
+        0xAA0000,  // RED
+        0xAA00AA,  // MAGENTA
+        0xAA5500,  // BROWN
+        0xAAAAAA,  // LIGHTGRAY
+        0x555555,  // DARKGRAY
+        0x5555FF,  // LIGHTBLUE
+        0x55FF55,  // LIGHTGREEN
+        0x55FFFF,  // LIGHTCYAN
+        0xFF5555,  // LIGHTRED
+        0xFF55FF,  // LIGHTMAGENTA
+        0xFFFF55,  // YELLOW
+        0xFFFFFF   // WHITE
+    };
+    if (color >= 0 && color < 16) {
+        return palette[color];
+    }
+    return (uint32_t)color;  // Assume it's already RGB
+}
+
+/* ============================================================================
+ * Screen Access
+ * ============================================================================ */
+
+// Whether the mapped screen is laid out like a surface, rows then copy as is
+static int fb_is_xrgb(void) {
+    const fb_info_t *fb = &_gfx.fb;
+    return fb->bytes_pp == 4 && fb->red_pos == 16 && fb->green_pos == 8 &&
+           fb->blue_pos == 0 && fb->red_size == 8 && fb->green_size == 8 &&
+           fb->blue_size == 8;
+}
+
+static uint32_t fb_pack(uint32_t rgb) {
+    const fb_info_t *fb = &_gfx.fb;
+    return (((rgb >> (24 - fb->red_size)) & ((1u << fb->red_size) - 1)) << fb->red_pos) |
+           (((rgb >> (16 - fb->green_size)) & ((1u << fb->green_size) - 1)) << fb->green_pos) |
+           (((rgb >> (8 - fb->blue_size)) & ((1u << fb->blue_size) - 1)) << fb->blue_pos);
+}
+
+static uint32_t fb_unpack(uint32_t v) {
+    const fb_info_t *fb = &_gfx.fb;
+    return (((v >> fb->red_pos) & ((1u << fb->red_size) - 1)) << (24 - fb->red_size)) |
+           (((v >> fb->green_pos) & ((1u << fb->green_size) - 1)) << (16 - fb->green_size)) |
+           (((v >> fb->blue_pos) & ((1u << fb->blue_size) - 1)) << (8 - fb->blue_size));
+}
+
+// Copy r between the back buffer and the mapped screen, either way
+static void fb_copy(gfx_rect_t r, int to_screen) {
+    const fb_info_t *fb = &_gfx.fb;
+    gfx_surface_t *s = &_gfx.screen;
+    uint32_t *pixels = s->pixels + (int64_t)r.y0 * s->stride + r.x0;
+    uint8_t *screen = _gfx.fb_pixels + (uint64_t)r.y0 * fb->pitch +
+                      (uint64_t)r.x0 * fb->bytes_pp;
+    int w = r.x1 - r.x0;
+    int xrgb = fb_is_xrgb();
+
+    for (int y = r.y0; y < r.y1; y++) {
+        if (xrgb) {
+            if (to_screen) _gfx_copy((uint32_t *)screen, pixels, w);
+            else _gfx_copy(pixels, (const uint32_t *)screen, w);
+        } else {
+            uint8_t *p = screen;
+            for (int x = 0; x < w; x++, p += fb->bytes_pp) {
+                if (to_screen) {
+                    uint32_t v = fb_pack(pixels[x]);
+                    p[0] = (uint8_t)v;
+                    p[1] = (uint8_t)(v >> 8);
+                    if (fb->bytes_pp > 2) p[2] = (uint8_t)(v >> 16);
+                    if (fb->bytes_pp > 3) p[3] = (uint8_t)(v >> 24);
+                } else {
+                    uint32_t v = p[0] | ((uint32_t)p[1] << 8);
+                    if (fb->bytes_pp > 2) v |= (uint32_t)p[2] << 16;
+                    if (fb->bytes_pp > 3) v |= (uint32_t)p[3] << 24;
+                    pixels[x] = fb_unpack(v);
+                }
+            }
+        }
+        pixels += s->stride;
+        screen += fb->pitch;
+    }
+}
+
+// Next free ring slot, queued by ring_push once filled in
+static gfx_cmd_t *ring_cmd(uint16_t op) {
+    gfx_ring_t *ring = &_gfx.ring;
+    if (ring->sq_tail - ring->sq_head >= GFX_RING_ENTRIES) {
+        gfx_submit(ring);
+        ring->cq_head = ring->cq_tail;  // Completions aren't used here
+    }
+    gfx_cmd_t *cmd = &ring->sq[ring->sq_tail & (GFX_RING_ENTRIES - 1)];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->op = op;
+    return cmd;
+}
+
+static void ring_push(void) {
+    __atomic_store_n(&_gfx.ring.sq_tail, _gfx.ring.sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+void present(void) {
+    if (!_gfx.initialized || !_gfx.damage_count) return;
+
+    gfx_surface_t *s = &_gfx.screen;
+    for (int i = 0; i < _gfx.damage_count; i++) {
+        gfx_rect_t r = _gfx.damage[i];
+        gfx_cmd_t *cmd;
+        if (_gfx.fb_pixels) {
+            fb_copy(r, 1);
+            if (!(_gfx.fb.flags & FB_INFO_DAMAGE)) continue;
+            cmd = ring_cmd(GFX_CMD_DAMAGE);
+        } else {
+            cmd = ring_cmd(GFX_CMD_BLIT);
+            cmd->data = (uint64_t)(s->pixels + (int64_t)r.y0 * s->stride + r.x0);
+            cmd->pitch = (uint32_t)s->stride;
+        }
+        cmd->x = r.x0;
+        cmd->y = r.y0;
+        cmd->w = r.x1 - r.x0;
+        cmd->h = r.y1 - r.y0;
+        ring_push();
+    }
+    _gfx.damage_count = 0;
+
+    ring_cmd(GFX_CMD_PRESENT);
+    ring_push();
+    gfx_submit(&_gfx.ring);
+    _gfx.ring.cq_head = _gfx.ring.cq_tail;
+}
+
+void gfx_flush(void) {
+    present();
+}
+
+void present_vsync(void) {
+    gfx_frame_stats_t *st = &_gfx.stats;
+    uint64_t start = uptime_ns();
+    vblank_info_t vb;
+    if (wait_vblank(&vb) == (uint64_t)-1) {
+        present();
+        return;
+    }
+    present();
+
+    if (st->frames) {
+        st->work_ns = start - _gfx.last_return_ns;
+        st->frame_ns = vb.time_ns - _gfx.last_vblank_ns;
+        if (vb.seq > _gfx.last_seq + 1)
+            st->missed += vb.seq - _gfx.last_seq - 1;
+        // 1/16 of each new frame
+        st->avg_frame_ns = st->frames == 1 ? st->frame_ns
+                           : st->avg_frame_ns - st->avg_frame_ns / 16 + st->frame_ns / 16;
+        if (st->frame_ns > st->max_frame_ns) st->max_frame_ns = st->frame_ns;
+    }
+    st->frames++;
+    st->refresh_ns = vb.period_ns;
+    st->source = (int)vb.source;
+    _gfx.last_seq = vb.seq;
+    _gfx.last_vblank_ns = vb.time_ns;
+    _gfx.last_return_ns = uptime_ns();
+}
+
+void gfx_frame_stats(gfx_frame_stats_t *stats) {
+    *stats = _gfx.stats;
+}
+
+/* ============================================================================
+ * Setup
+ * ============================================================================ */
+
+void initgraph(int *graphdriver, int *graphmode, const char *pathtodriver) {
+    (void)graphdriver;
+    (void)graphmode;
+    (void)pathtodriver;
+
+    _gfx.ring.sq_head = _gfx.ring.sq_tail = 0;
+    _gfx.ring.cq_head = _gfx.ring.cq_tail = 0;
+
+    // Without a back buffer the screen is an empty surface, nothing shows
+    fb_info_t back;
+    if (map_framebuffer(&back, FB_MAP_PRIVATE) == 0)
+        gfx_surface_init(&_gfx.screen, (uint32_t *)back.addr, (int)back.width,
+                         (int)back.height, (int)(back.pitch / 4));
+    else
+        gfx_surface_init(&_gfx.screen, 0, 0, 0, 0);
+
+    // Layouts fb_copy handles, any other screen is reached through the ring
+    _gfx.fb_pixels = 0;
+    if (map_framebuffer(&_gfx.fb, FB_MAP_SCREEN) == 0 &&
+        _gfx.fb.bytes_pp >= 2 && _gfx.fb.bytes_pp <= 4 &&
+        _gfx.fb.red_size <= 8 && _gfx.fb.green_size <= 8 &&
+        _gfx.fb.blue_size <= 8 &&
+        (int)_gfx.fb.width == _gfx.screen.width &&
+        (int)_gfx.fb.height == _gfx.screen.height)
+        _gfx.fb_pixels = _gfx.fb.addr;
+
+    // Start from what's on screen, so getpixel and undrawn areas match it
+    gfx_rect_t all = {0, 0, _gfx.screen.width, _gfx.screen.height};
+    if (_gfx.fb_pixels && all.x1 > 0 && all.y1 > 0)
+        fb_copy(all, 0);
+
+    _gfx.damage_count = 0;
+    memset(&_gfx.stats, 0, sizeof(_gfx.stats));
+    gfx_set_target(0);
+    _gfx.color = WHITE;
+    _gfx.bkcolor = BLACK;
+    _gfx.fill_color = WHITE;
+    _gfx.fill_pattern = SOLID_FILL;
+    _gfx.initialized = 1;
+}
+
+void closegraph(void) {
+    gfx_set_target(0);
+    present();
+    _gfx.initialized = 0;
+}
+
+int getmaxx(void) {
+    return _gfx.target->width - 1;
+}
+
+int getmaxy(void) {
+    return _gfx.target->height - 1;
+}
+
+/* ============================================================================
+ * Colors and Viewport
+ * ============================================================================ */
+
+void setcolor(int color) {
+    _gfx.color = color;
+}
+
+int getcolor(void) {
+    return _gfx.color;
+}
+
+void setbkcolor(int color) {
+    _gfx.bkcolor = color;
+}
+
+int getbkcolor(void) {
+    return _gfx.bkcolor;
+}
+
+// Only solid fills so far, the pattern is recorded
+void setfillstyle(int pattern, int color) {
+    _gfx.fill_pattern = pattern;
+    _gfx.fill_color = color;
+}
+
+void setviewport(int left, int top, int right, int bottom, int clip) {
+    gfx_rect_t all = {0, 0, _gfx.target->width, _gfx.target->height};
+    gfx_rect_t view = {left, top, right + 1, bottom + 1};
+    _gfx.org_x = left;
+    _gfx.org_y = top;
+    _gfx.clip = all;
+    if (!_gfx_clip(&view)) view.x1 = view.x0;
+    _gfx.view = view;
+    if (clip) _gfx.clip = view;
+}
+
+/* ============================================================================
+ * Utility Functions
+ * ============================================================================ */
+
+void delay(int ms) {
+    present();
+    sleep(ms);
+}
+
+int kbhit_gfx(void) {
+    present();
+    return kbhit();
+}
+
+int getch(void) {
+    present();
+    return getkey();
+}
@@ -0,0 +1,108 @@
+/*
+ * libnbosgfx - surfaces, clipping and damage
+ */
+
+#include "gfx_internal.h"
+
+void gfx_surface_init(gfx_surface_t *surface, uint32_t *pixels,
+                      int width, int height, int stride) {
+    surface->pixels = pixels;
+    surface->width = width;
+    surface->height = height;
+    surface->stride = stride;
+}
+
+void _gfx_reset_viewport(void) {
+    _gfx.org_x = _gfx.org_y = 0;
+    _gfx.clip.x0 = _gfx.clip.y0 = 0;
+    _gfx.clip.x1 = _gfx.target->width;
+    _gfx.clip.y1 = _gfx.target->height;
+    _gfx.view = _gfx.clip;
+}
+
+void gfx_set_target(gfx_surface_t *surface) {
+    _gfx.target = surface ? surface : &_gfx.screen;
+    _gfx_reset_viewport();
+}
+
+gfx_surface_t *gfx_screen(void) {
+    return &_gfx.screen;
+}
+
+// Overlapping or touching rectangles are merged, and once the list is full
+// everything collapses into one
+void _gfx_damage(gfx_rect_t r) {
+    if (_gfx.target != &_gfx.screen || r.x1 <= r.x0 || r.y1 <= r.y0)
+        return;
+
+    for (int i = 0; i < _gfx.damage_count; i++) {
+        gfx_rect_t *d = &_gfx.damage[i];
+        if (r.x0 <= d->x1 && d->x0 <= r.x1 && r.y0 <= d->y1 && d->y0 <= r.y1) {
+            if (d->x0 < r.x0) r.x0 = d->x0;
+            if (d->y0 < r.y0) r.y0 = d->y0;
+            if (d->x1 > r.x1) r.x1 = d->x1;
+            if (d->y1 > r.y1) r.y1 = d->y1;
+            // The grown rectangle may now touch others
+            _gfx.damage[i] = _gfx.damage[--_gfx.damage_count];
+            _gfx_damage(r);
+            return;
+        }
+    }
+
+    if (_gfx.damage_count == GFX_MAX_DAMAGE) {
+        for (int i = 0; i < _gfx.damage_count; i++) {
+            gfx_rect_t *d = &_gfx.damage[i];
+            if (d->x0 < r.x0) r.x0 = d->x0;
+            if (d->y0 < r.y0) r.y0 = d->y0;
+            if (d->x1 > r.x1) r.x1 = d->x1;
+            if (d->y1 > r.y1) r.y1 = d->y1;
+        }
+        _gfx.damage_count = 0;
+    }
+    _gfx.damage[_gfx.damage_count++] = r;
+}
+
+void _gfx_fill(gfx_rect_t r, uint32_t color) {
+    if (!_gfx_clip(&r))
+        return;
+    _gfx_damage(r);
+    uint32_t *p = _gfx_row(r.x0, r.y0);
+    int w = r.x1 - r.x0;
+    for (int y = r.y0; y < r.y1; y++, p += _gfx.target->stride)
+        _gfx_span(p, w, color);
+}
+
+int _gfx_begin(int x0, int y0, int x1, int y1) {
+    gfx_rect_t r = {x0, y0, x1 + 1, y1 + 1};
+    gfx_rect_t visible = r;
+    if (!_gfx_clip(&visible))
+        return -1;
+    _gfx_damage(visible);
+    return visible.x0 != r.x0 || visible.y0 != r.y0 ||
+           visible.x1 != r.x1 || visible.y1 != r.y1;
+}
+
+// src must not overlap the target
+void gfx_draw_surface(int x, int y, const gfx_surface_t *src) {
+    x += _gfx.org_x;
+    y += _gfx.org_y;
+    gfx_rect_t r = {x, y, x + src->width, y + src->height};
+    if (!_gfx_clip(&r))
+        return;
+    _gfx_damage(r);
+
+    const uint32_t *s = src->pixels + (int64_t)(r.y0 - y) * src->stride + (r.x0 - x);
+    uint32_t *d = _gfx_row(r.x0, r.y0);
+    int w = r.x1 - r.x0;
+    for (int row = r.y0; row < r.y1; row++) {
+        _gfx_copy(d, s, w);
+        s += src->stride;
+        d += _gfx.target->stride;
+    }
+}
+
+void gfx_blit(int x, int y, int w, int h, const uint32_t *pixels) {
+    gfx_surface_t src;
+    gfx_surface_init(&src, (uint32_t *)pixels, w, h, w);
+    gfx_draw_surface(x, y, &src);
+}
@@ -0,0 +1,95 @@
+/*
+ * libnbosgfx - text
+ *
+ * Glyphs are expanded once per color pair into ready-made pixel rows, so
+ * an unclipped character is 16 row copies. A few pairs are cached, the
+ * least recently used one is reused.
+ */
+
+#include "gfx_internal.h"
+
+#define GLYPH_CACHE_PAIRS 4
+
+typedef struct {
+    int valid;
+    uint32_t fg, bg;
+    uint64_t last_use;
+    uint8_t expanded[GFX_GLYPHS];
+    uint32_t pixels[GFX_GLYPHS][GFX_FONT_HEIGHT][GFX_FONT_WIDTH];
+} glyph_set_t;
+
+static glyph_set_t glyph_cache[GLYPH_CACHE_PAIRS];
+static uint64_t glyph_clock = 0;
+
+static glyph_set_t *glyph_set(uint32_t fg, uint32_t bg) {
+    glyph_set_t *victim = &glyph_cache[0];
+    for (int i = 0; i < GLYPH_CACHE_PAIRS; i++) {
+        glyph_set_t *set = &glyph_cache[i];
+        if (set->valid && set->fg == fg && set->bg == bg) {
+            set->last_use = ++glyph_clock;
+            return set;
+        }
+        if (set->last_use < victim->last_use) victim = set;
+    }
+
+    memset(victim->expanded, 0, sizeof(victim->expanded));
+    victim->valid = 1;
+    victim->fg = fg;
+    victim->bg = bg;
+    victim->last_use = ++glyph_clock;
+    return victim;
+}
+
+// Rows of glyph g in the set's colors, expanded on first use
+static uint32_t (*glyph_rows(glyph_set_t *set, int g))[GFX_FONT_WIDTH] {
+    uint32_t (*rows)[GFX_FONT_WIDTH] = set->pixels[g];
+    if (set->expanded[g]) return rows;
+
+    for (int row = 0; row < GFX_FONT_HEIGHT; row++) {
+        uint8_t bits = _gfx_font[g][row];
+        for (int col = 0; col < GFX_FONT_WIDTH; col++)
+            rows[row][col] = (bits & (0x80 >> col)) ? set->fg : set->bg;
+    }
+    set->expanded[g] = 1;
+    return rows;
+}
+
+static inline int glyph_index(char c) {
+    if (c < 32 || c > 126) c = ' ';
+    return c - 32;
+}
+
+void outtextxy(int x, int y, const char *text) {
+    x += _gfx.org_x;
+    y += _gfx.org_y;
+    int len = (int)strlen(text);
+    int clip = _gfx_begin(x, y, x + len * GFX_FONT_WIDTH - 1, y + GFX_FONT_HEIGHT - 1);
+    if (len == 0 || clip < 0) return;
+
+    glyph_set_t *set = glyph_set(_gfx_rgb(_gfx.color), _gfx_rgb(_gfx.bkcolor));
+    int stride = _gfx.target->stride;
+    for (int i = 0; i < len; i++, x += GFX_FONT_WIDTH) {
+        uint32_t (*rows)[GFX_FONT_WIDTH] = glyph_rows(set, glyph_index(text[i]));
+
+        // Only characters crossing the viewport edge are clipped
+        gfx_rect_t r = {x, y, x + GFX_FONT_WIDTH, y + GFX_FONT_HEIGHT};
+        if (clip && !_gfx_clip(&r)) continue;
+        uint32_t *d = _gfx_row(r.x0, r.y0);
+        for (int row = r.y0; row < r.y1; row++, d += stride)
+            _gfx_copy(d, &rows[row - y][r.x0 - x], r.x1 - r.x0);
+    }
+}
+
+// At the origin: there's no current position yet
+void outtext(const char *text) {
+    outtextxy(0, 0, text);
+}
+
+int textwidth(const char *text) {
+    return (int)strlen(text) * GFX_FONT_WIDTH;
+}
+
+int textheight(const char *text) {
+    (void)text;
+    return GFX_FONT_HEIGHT;
+}
@@ -2,6 +2,9 @@
 # Include this in your project Makefiles
 
 NBOS_SDK ?= $(shell dirname $(realpath $(lastword $(MAKEFILE_LIST))))/..
+
+# The including Makefile's all, not the CRT rule below
+.DEFAULT_GOAL := all
 NBOS_INCLUDE = $(NBOS_SDK)/include
 NBOS_LIB = $(NBOS_SDK)/lib
 
@@ -26,12 +29,15 @@ CFLAGS += -I$(NBOS_INCLUDE)
 # Assembler flags
 ASFLAGS = -f elf64
 
-# Linker flags  
-LDFLAGS = -nostdlib -static -m elf_x86_64
+# Linker flags: ELF64 at the address the kernel loads programs at
+LDFLAGS = -nostdlib -static -m elf_x86_64 -T $(NBOS_LIB)/nbos.ld -z max-page-size=4096
 
 # CRT object
 CRT0 = $(NBOS_LIB)/crt0.o
 
+# SDK libraries (build with make -C $(NBOS_LIB))
+NBOS_LIBS = $(NBOS_LIB)/libnbosgfx.a $(NBOS_LIB)/libnbosc.a
+
 # Build CRT if needed
 $(CRT0): $(NBOS_LIB)/crt0.asm
 	$(AS) $(ASFLAGS) -o $@ $<
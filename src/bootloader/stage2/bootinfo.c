@@ -0,0 +1,107 @@
+#include "bootinfo.h"
+#include "memdefs.h"
+#include "memory.h"
+#include "stdio.h"
+#include "x86.h"
+
+static const char loader_name[] = "NBOS stage2";
+
+// Walk INT 15h E820 into the multiboot mmap area, returns the entry count
+static int bootinfo_detect_e820(void) {
+  multiboot_mmap_entry_t *mmap = (multiboot_mmap_entry_t *)MEMORY_MMAP_ADDR;
+  int max = MEMORY_MMAP_SIZE / sizeof(multiboot_mmap_entry_t);
+  uint32_t continuation = 0;
+  int count = 0;
+
+  do {
+    multiboot_mmap_entry_t *entry = &mmap[count];
+    uint32_t size = x86_E820GetNextBlock(&entry->base_addr, &continuation);
+    if (size < 20)
+      break;
+
+    // Skip empty ranges some BIOSes report
+    if (entry->length != 0) {
+      entry->size = 20;
+      count++;
+    }
+  } while (continuation != 0 && count < max);
+
+  return count;
+}
+
+void bootinfo_init(uint8_t bootDrive) {
+  multiboot_info_t *info = (multiboot_info_t *)MEMORY_BOOTINFO_ADDR;
+  memset(info, 0, sizeof(multiboot_info_t));
+
+  // boot_device: drive number in the top byte, no partition info
+  info->boot_device = ((uint32_t)bootDrive << 24) | 0x00FFFFFF;
+  info->boot_loader_name = (uint32_t)loader_name;
+  info->flags |= MULTIBOOT_INFO_BOOTDEV | MULTIBOOT_INFO_BOOT_LOADER_NAME;
+
+  int count = bootinfo_detect_e820();
+  if (count == 0) {
+    printf("[ERR]  E820 memory map not available\r\n");
+    return;
+  }
+
+  info->mmap_addr = (uint32_t)MEMORY_MMAP_ADDR;
+  info->mmap_length = count * sizeof(multiboot_mmap_entry_t);
+  info->flags |= MULTIBOOT_INFO_MEM_MAP;
+
+  // mem_lower: usable KB from 0, mem_upper: usable KB contiguous from 1MB
+  multiboot_mmap_entry_t *mmap = (multiboot_mmap_entry_t *)MEMORY_MMAP_ADDR;
+  for (int i = 0; i < count; i++) {
+    if (mmap[i].type != MULTIBOOT_MEMORY_AVAILABLE)
+      continue;
+
+    uint64_t start = mmap[i].base_addr;
+    uint64_t end = start + mmap[i].length;
+    if (start == 0) {
+      uint64_t lower = end > 0xA0000 ? 0xA0000 : end;
+      info->mem_lower = (uint32_t)(lower / 1024);
+    }
+    if (start <= 0x100000 && end > 0x100000) {
+      uint64_t upper = end - 0x100000;
+      if (upper > 0xFFFFFFFFull)
+        upper = 0xFFFFFFFFull;
+      info->mem_upper = (uint32_t)(upper / 1024);
+    }
+  }
+  info->flags |= MULTIBOOT_INFO_MEMORY;
+}
+
+void bootinfo_set_framebuffer(const FramebufferInfo *fb) {
+  multiboot_info_t *info = (multiboot_info_t *)MEMORY_BOOTINFO_ADDR;
+
+  info->framebuffer_addr = fb->framebuffer_addr;
+  info->framebuffer_pitch = fb->pitch;
+  info->framebuffer_width = fb->width;
+  info->framebuffer_height = fb->height;
+  info->framebuffer_bpp = fb->bpp;
+  info->framebuffer_type = MULTIBOOT_FRAMEBUFFER_TYPE_RGB;
+  info->color_info[0] = fb->red_field_pos;
+  info->color_info[1] = fb->red_mask_size;
+  info->color_info[2] = fb->green_field_pos;
+  info->color_info[3] = fb->green_mask_size;
+  info->color_info[4] = fb->blue_field_pos;
+  info->color_info[5] = fb->blue_mask_size;
+  info->flags |= MULTIBOOT_INFO_FRAMEBUFFER_INFO;
+}
+
+void bootinfo_set_video_modes(const VideoMode *modes, int count) {
+  multiboot_info_t *info = (multiboot_info_t *)MEMORY_BOOTINFO_ADDR;
+  int max = MEMORY_VIDEO_MODES_SIZE / sizeof(VideoMode);
+  if (count > max)
+    count = max;
+  if (count <= 0)
+    return;
+
+  memcpy(MEMORY_VIDEO_MODES_ADDR, modes, count * sizeof(VideoMode));
+  info->video_modes_addr = (uint32_t)MEMORY_VIDEO_MODES_ADDR;
+  info->video_modes_count = count;
+  info->flags |= MULTIBOOT_INFO_NBOS_VIDEO_MODES;
+}
+
+multiboot_info_t *bootinfo_get(void) {
+  return (multiboot_info_t *)MEMORY_BOOTINFO_ADDR;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "stdint.h"
+#include "vesa.h"
+
+// Multiboot (v1) boot information, filled in by stage2 and passed to the
+// kernel in EBX. Layout matches kernel/multiboot.h
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+#define MULTIBOOT_INFO_MEMORY 0x00000001
+#define MULTIBOOT_INFO_BOOTDEV 0x00000002
+#define MULTIBOOT_INFO_MEM_MAP 0x00000040
+#define MULTIBOOT_INFO_BOOT_LOADER_NAME 0x00000200
+#define MULTIBOOT_INFO_FRAMEBUFFER_INFO 0x00001000
+// Not in the multiboot spec: video_modes_addr/count are valid
+#define MULTIBOOT_INFO_NBOS_VIDEO_MODES 0x80000000
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB 1
+
+typedef struct {
+  uint32_t flags;
+  uint32_t mem_lower;
+  uint32_t mem_upper;
+  uint32_t boot_device;
+  uint32_t cmdline;
+  uint32_t mods_count;
+  uint32_t mods_addr;
+  uint32_t syms[4];
+  uint32_t mmap_length;
+  uint32_t mmap_addr;
+  uint32_t drives_length;
+  uint32_t drives_addr;
+  uint32_t config_table;
+  uint32_t boot_loader_name;
+  uint32_t apm_table;
+  uint32_t vbe_control_info;
+  uint32_t vbe_mode_info;
+  uint16_t vbe_mode;
+  uint16_t vbe_interface_seg;
+  uint16_t vbe_interface_off;
+  uint16_t vbe_interface_len;
+
+  uint64_t framebuffer_addr;
+  uint32_t framebuffer_pitch;
+  uint32_t framebuffer_width;
+  uint32_t framebuffer_height;
+  uint8_t framebuffer_bpp;
+  uint8_t framebuffer_type;
+  uint8_t color_info[6];
+
+  // stage2 only, after what multiboot defines: VideoMode entries
+  uint32_t video_modes_addr;
+  uint32_t video_modes_count;
+} __attribute__((packed)) multiboot_info_t;
+
+// Memory map entry, 'size' excludes itself (E820 data follows it)
+typedef struct {
+  uint32_t size;
+  uint64_t base_addr;
+  uint64_t length;
+  uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// Reset the info block and collect the BIOS E820 memory map
+void bootinfo_init(uint8_t bootDrive);
+
+// Record the active VESA framebuffer
+void bootinfo_set_framebuffer(const FramebufferInfo *fb);
+
+// Hand the kernel the usable modes, so it can switch without a reboot
+void bootinfo_set_video_modes(const VideoMode *modes, int count);
+
+multiboot_info_t *bootinfo_get(void);
@@ -0,0 +1,46 @@
+#include "boottime.h"
+
+static inline uint64_t rdtsc(void) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void outb(uint16_t port, uint8_t val) {
+  __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// "boot: <tsc> <name>" on the debug console, for build_scripts/bench_boot.sh
+static void debugcon_mark(uint64_t tsc, const char *name) {
+  const char *hex = "0123456789abcdef";
+  for (const char *p = "boot: "; *p; p++)
+    outb(BOOT_DEBUGCON_PORT, *p);
+  for (int shift = 60; shift >= 0; shift -= 4)
+    outb(BOOT_DEBUGCON_PORT, hex[(tsc >> shift) & 0xF]);
+  outb(BOOT_DEBUGCON_PORT, ' ');
+  for (; *name; name++)
+    outb(BOOT_DEBUGCON_PORT, *name);
+  outb(BOOT_DEBUGCON_PORT, '\n');
+}
+
+void boottime_init(void) {
+  BootTimingInfo *info = (BootTimingInfo *)BOOT_TIMING_ADDR;
+  info->magic = BOOT_TIMING_MAGIC;
+  info->count = 0;
+}
+
+void boottime_mark(const char *name) {
+  BootTimingInfo *info = (BootTimingInfo *)BOOT_TIMING_ADDR;
+  if (info->count >= BOOT_TIMING_MAX_ENTRIES)
+    return;
+
+  BootTimingEntry *entry = &info->entries[info->count++];
+  entry->tsc = rdtsc();
+
+  int i = 0;
+  for (; i < BOOT_TIMING_NAME_LEN - 1 && name[i]; i++)
+    entry->name[i] = name[i];
+  entry->name[i] = '\0';
+
+  debugcon_mark(entry->tsc, entry->name);
+}
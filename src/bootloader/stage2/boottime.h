@@ -0,0 +1,27 @@
+#pragma once
+
+#include "stdint.h"
+
+// Boot phase timestamps handed to the kernel at a fixed address.
+// Layout must match kernel/boottime.h
+#define BOOT_TIMING_ADDR 0x8400
+#define BOOT_TIMING_MAGIC 0x4D495442 // 'BTIM'
+#define BOOT_TIMING_MAX_ENTRIES 16
+#define BOOT_TIMING_NAME_LEN 24
+
+// Every mark is also written to the QEMU/Bochs debug console
+#define BOOT_DEBUGCON_PORT 0xE9
+
+typedef struct {
+  uint64_t tsc;
+  char name[BOOT_TIMING_NAME_LEN];
+} __attribute__((packed)) BootTimingEntry;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t count;
+  BootTimingEntry entries[BOOT_TIMING_MAX_ENTRIES];
+} __attribute__((packed)) BootTimingInfo;
+
+void boottime_init(void);
+void boottime_mark(const char *name);
@@ -1,13 +1,19 @@
 #include "disk.h"
 #include "x86.h"
+#include "memdefs.h"
+#include "memory.h"
 
-// Helper function for 32-bit division
-static uint32_t div32(uint32_t dividend, uint16_t divisor, uint32_t* remainder)
+typedef struct
 {
-    if(remainder)
-        *remainder = dividend % divisor;
-    return dividend / divisor;
-}
+    bool valid;
+    uint8_t drive;
+    uint32_t firstLba;
+    uint32_t lastUse;
+} DISK_CachedTrack;
+
+static DISK_CachedTrack g_CachedTracks[DISK_CACHE_TRACKS];
+static uint32_t g_CacheSlots;
+static uint32_t g_CacheClock;
 
 bool DISK_Initialize(DISK* disk, uint8_t driveNumber)
 {
@@ -24,6 +30,28 @@ bool DISK_Initialize(DISK* disk, uint8_t driveNumber)
     disk->cylinders = cylinders;
     disk->heads = heads;
     disk->sectors = sectors;
+    reciprocal_init(&disk->sectorsRecip, sectors);
+    reciprocal_init(&disk->headsRecip, heads);
+
+    // Only hard disks (and HDD-emulated USB) get LBA reads, floppies keep CHS
+    disk->haveExtensions = (driveNumber & 0x80) && x86_Disk_ExtensionsPresent(driveNumber);
+
+    // As many whole tracks as fit the cache memory, stage2's .bss isn't zeroed
+    disk->cacheHits = 0;
+    disk->cacheMisses = 0;
+    g_CacheSlots = 0;
+    if (disk->sectors > 0)
+    {
+        g_CacheSlots = MEMORY_TRACKCACHE_SIZE / ((uint32_t)disk->sectors * SECTOR_SIZE);
+    }
+    if (g_CacheSlots > DISK_CACHE_TRACKS)
+    {
+        g_CacheSlots = DISK_CACHE_TRACKS;
+    }
+    for (uint32_t i = 0; i < DISK_CACHE_TRACKS; i++)
+    {
+        g_CachedTracks[i].valid = false;
+    }
 
     return true;
 }
@@ -34,30 +62,198 @@ void DISK_LBA2CHS(DISK* disk, uint32_t lba, uint16_t* cylinderOut, uint16_t* sec
     uint32_t temp, rem;
     
     // sector = (lba % sectors_per_track) + 1
-    temp = div32(lba, disk->sectors, &rem);
+    temp = reciprocal_divide(&disk->sectorsRecip, lba, &rem);
     *sectorOut = (uint16_t)rem + 1;
     
     // cylinder = temp / heads
     // head = temp % heads
-    *cylinderOut = (uint16_t)div32(temp, disk->heads, &rem);
+    *cylinderOut = (uint16_t)reciprocal_divide(&disk->headsRecip, temp, &rem);
     *headOut = (uint16_t)rem;
 }
 
 
-bool DISK_ReadSectors(DISK* disk, uint32_t lba, uint8_t sectors, void* dataOut)
+static bool DISK_ReadExtended(DISK* disk, uint32_t lba, uint16_t sectors, uint8_t* u8DataOut)
 {
-    uint16_t cylinder, sector, head;
-    DISK_LBA2CHS(disk, lba, &cylinder, &sector, &head);
+    while (sectors > 0)
+    {
+        uint16_t count = sectors;
+        if (count > DISK_MAX_EXTENDED_SECTORS)
+            count = DISK_MAX_EXTENDED_SECTORS;
+
+        bool ok = false;
+        for(int i = 0; i < 3 && !ok; i++)
+        {
+            ok = x86_Disk_ExtendedRead(disk->id, lba, count, u8DataOut);
+            if (!ok)
+                x86_Disk_Reset(disk->id);
+        }
+
+        if (!ok)
+            return false;
+
+        lba += count;
+        sectors -= count;
+        u8DataOut += count * SECTOR_SIZE;
+    }
+
+    return true;
+}
 
-    // loop
-    for(int i = 0; i < 3; i++)
+static bool DISK_ReadCHS(DISK* disk, uint32_t lba, uint16_t sectors, uint8_t* u8DataOut)
+{
+    while (sectors > 0)
     {
-        if(x86_Disk_Read(disk->id, cylinder, sector, head, sectors, dataOut))
+        uint16_t cylinder, sector, head;
+        DISK_LBA2CHS(disk, lba, &cylinder, &sector, &head);
+
+        // A single CHS transfer has to stay on one track, and must not cross a
+        // 64 KiB physical boundary (ISA DMA limit on real floppy controllers)
+        uint32_t count = disk->sectors - (sector - 1);
+        uint32_t toBoundary = (0x10000 - ((uint32_t)u8DataOut & 0xFFFF)) / SECTOR_SIZE;
+        if (count > toBoundary)
+            count = toBoundary;
+        if (count > sectors)
+            count = sectors;
+        if (count == 0)
+            count = 1;
+
+        bool ok = false;
+        for(int i = 0; i < 3 && !ok; i++)
         {
+            ok = x86_Disk_Read(disk->id, cylinder, sector, head, (uint8_t)count, u8DataOut);
+            if (!ok)
+                x86_Disk_Reset(disk->id);
+        }
+
+        if (!ok)
+            return false;
+
+        lba += count;
+        sectors -= count;
+        u8DataOut += count * SECTOR_SIZE;
+    }
+
+    return true;
+}
+
+static bool DISK_ReadLow(DISK* disk, uint32_t lba, uint16_t sectors, uint8_t* u8DataOut)
+{
+    if (disk->haveExtensions)
+    {
+        if (DISK_ReadExtended(disk, lba, sectors, u8DataOut))
             return true;
+
+        // Some BIOSes advertise extensions they don't really implement
+        disk->haveExtensions = false;
+    }
+
+    return DISK_ReadCHS(disk, lba, sectors, u8DataOut);
+}
+
+// Find the cache slot holding the track that starts at firstLba, reading the
+// track into the least recently used slot on a miss
+static uint8_t* DISK_CacheGetTrack(DISK* disk, uint32_t firstLba)
+{
+    DISK_CachedTrack* victim = &g_CachedTracks[0];
+    uint32_t victimIndex = 0;
+
+    for (uint32_t i = 0; i < g_CacheSlots; i++)
+    {
+        DISK_CachedTrack* track = &g_CachedTracks[i];
+        if (track->valid && track->drive == disk->id && track->firstLba == firstLba)
+        {
+            track->lastUse = ++g_CacheClock;
+            disk->cacheHits++;
+            return (uint8_t*)MEMORY_TRACKCACHE_ADDR + i * disk->sectors * SECTOR_SIZE;
+        }
+
+        if (!track->valid || (victim->valid && track->lastUse < victim->lastUse))
+        {
+            victim = track;
+            victimIndex = i;
         }
-        x86_Disk_Reset(disk->id);
     }
 
-    return false;
+    uint8_t* buffer = (uint8_t*)MEMORY_TRACKCACHE_ADDR + victimIndex * disk->sectors * SECTOR_SIZE;
+    victim->valid = false;
+    if (!DISK_ReadLow(disk, firstLba, disk->sectors, buffer))
+    {
+        return NULL;
+    }
+
+    disk->cacheMisses++;
+    victim->valid = true;
+    victim->drive = disk->id;
+    victim->firstLba = firstLba;
+    victim->lastUse = ++g_CacheClock;
+    return buffer;
+}
+
+// Serve a small request from whole cached tracks
+static bool DISK_CacheRead(DISK* disk, uint32_t lba, uint16_t sectors, uint8_t* u8DataOut)
+{
+    while (sectors > 0)
+    {
+        uint32_t sectorInTrack;
+        reciprocal_divide(&disk->sectorsRecip, lba, &sectorInTrack);
+        uint32_t firstLba = lba - sectorInTrack;
+
+        uint8_t* track = DISK_CacheGetTrack(disk, firstLba);
+        if (track == NULL)
+        {
+            return false;
+        }
+
+        uint32_t count = disk->sectors - sectorInTrack;
+        if (count > sectors)
+            count = sectors;
+
+        memcpy(u8DataOut, track + sectorInTrack * SECTOR_SIZE, count * SECTOR_SIZE);
+
+        lba += count;
+        sectors -= count;
+        u8DataOut += count * SECTOR_SIZE;
+    }
+
+    return true;
+}
+
+bool DISK_ReadSectors(DISK* disk, uint32_t lba, uint16_t sectors, void* dataOut)
+{
+    uint8_t* u8DataOut = (uint8_t*)dataOut;
+
+    // Requests smaller than a track go through the read-ahead cache, so the
+    // following sequential reads hit memory instead of paying another seek.
+    // Larger ones already amortise it and are read directly. If a track
+    // can't be read whole (end of disk) fall back to the direct path.
+    if (g_CacheSlots > 0 && sectors < disk->sectors && DISK_CacheRead(disk, lba, sectors, u8DataOut))
+    {
+        return true;
+    }
+
+    if ((uint32_t)u8DataOut + (uint32_t)sectors * SECTOR_SIZE <= MEMORY_MAX)
+    {
+        return DISK_ReadLow(disk, lba, sectors, u8DataOut);
+    }
+
+    // The BIOS can only transfer into conventional memory, so anything going
+    // higher (the kernel at 1 MiB) is read through the bounce buffer in chunks
+    // and copied up from protected mode
+    while (sectors > 0)
+    {
+        uint16_t count = sectors;
+        if (count > DISK_BOUNCE_SECTORS)
+            count = DISK_BOUNCE_SECTORS;
+
+        if (!DISK_ReadLow(disk, lba, count, (uint8_t*)MEMORY_DISK_BOUNCE_ADDR))
+            return false;
+
+        memcpy(u8DataOut, MEMORY_DISK_BOUNCE_ADDR, (uint32_t)count * SECTOR_SIZE);
+
+        lba += count;
+        sectors -= count;
+        u8DataOut += count * SECTOR_SIZE;
+    }
+
+    return true;
 }
@@ -1,6 +1,18 @@
 #pragma once
 
 #include "stdint.h"
+#include "utility.h"
+
+#define SECTOR_SIZE 512
+
+// Most BIOSes cap one AH=42h transfer at 127 sectors
+#define DISK_MAX_EXTENDED_SECTORS 127
+
+// Number of tracks kept by the read-ahead cache (if they fit its memory)
+#define DISK_CACHE_TRACKS 4
+
+// Chunk size for reads staged through the bounce buffer, one BIOS call each
+#define DISK_BOUNCE_SECTORS DISK_MAX_EXTENDED_SECTORS
 
 typedef struct
 {
@@ -8,7 +20,16 @@ typedef struct
     uint16_t cylinders;
     uint16_t sectors;
     uint16_t heads;
+    bool haveExtensions;
+
+    // For the LBA to CHS conversion on every CHS read
+    Reciprocal sectorsRecip;
+    Reciprocal headsRecip;
+
+    // track read-ahead cache statistics
+    uint32_t cacheHits;
+    uint32_t cacheMisses;
 } DISK;
 
 bool DISK_Initialize(DISK* disk, uint8_t driveNumber);
-bool DISK_ReadSectors(DISK* disk, uint32_t lba, uint8_t sectors, void* dataOut);
+bool DISK_ReadSectors(DISK* disk, uint32_t lba, uint16_t sectors, void* dataOut);
@@ -0,0 +1,85 @@
+#include "elf.h"
+#include "stdio.h"
+#include "memory.h"
+
+#define ELF_MAX_PROGRAM_HEADERS 16
+
+// Lowest address a segment may be loaded to, below this lives stage2 itself
+#define ELF_MIN_LOAD_ADDRESS 0x100000
+
+static ELF64_ProgramHeader g_ProgramHeaders[ELF_MAX_PROGRAM_HEADERS];
+
+static bool ELF_ReadAt(DISK* disk, FAT_File* file, uint32_t offset, uint32_t size, void* dataOut)
+{
+    if (!FAT_Seek(file, offset))
+    {
+        return false;
+    }
+
+    return FAT_Read(disk, file, size, dataOut) == size;
+}
+
+bool ELF_Load(DISK* disk, FAT_File* file, uint32_t* entryOut)
+{
+    ELF64_Header header;
+
+    if (!ELF_ReadAt(disk, file, 0, sizeof(header), &header))
+    {
+        printf("ELF: Could not read header!\r\n");
+        return false;
+    }
+
+    if (header.Magic != ELF_MAGIC || header.Class != ELF_CLASS_64 ||
+        header.Data != ELF_DATA_LITTLE_ENDIAN || header.Type != ELF_TYPE_EXECUTABLE ||
+        header.Machine != ELF_MACHINE_X86_64)
+    {
+        printf("ELF: Not an x86_64 executable!\r\n");
+        return false;
+    }
+
+    if (header.ProgramHeaderEntrySize != sizeof(ELF64_ProgramHeader) ||
+        header.ProgramHeaderCount > ELF_MAX_PROGRAM_HEADERS)
+    {
+        printf("ELF: Unsupported program header table (%u entries)!\r\n", header.ProgramHeaderCount);
+        return false;
+    }
+
+    uint32_t tableSize = header.ProgramHeaderCount * sizeof(ELF64_ProgramHeader);
+    if (!ELF_ReadAt(disk, file, (uint32_t)header.ProgramHeaderOffset, tableSize, g_ProgramHeaders))
+    {
+        printf("ELF: Could not read program headers!\r\n");
+        return false;
+    }
+
+    for (int i = 0; i < header.ProgramHeaderCount; i++)
+    {
+        ELF64_ProgramHeader* ph = &g_ProgramHeaders[i];
+        if (ph->Type != ELF_PROGRAM_TYPE_LOAD || ph->MemorySize == 0)
+        {
+            continue;
+        }
+
+        uint64_t end = ph->PhysicalAddress + ph->MemorySize;
+        if (ph->PhysicalAddress < ELF_MIN_LOAD_ADDRESS || end > 0xFFFFFFFFull || ph->FileSize > ph->MemorySize)
+        {
+            printf("ELF: Segment %d at 0x%x can't be loaded!\r\n", i, (uint32_t)ph->PhysicalAddress);
+            return false;
+        }
+
+        uint8_t* dest = (uint8_t*)(uint32_t)ph->PhysicalAddress;
+        uint32_t fileSize = (uint32_t)ph->FileSize;
+        uint32_t memorySize = (uint32_t)ph->MemorySize;
+
+        if (fileSize > 0 && !ELF_ReadAt(disk, file, (uint32_t)ph->Offset, fileSize, dest))
+        {
+            printf("ELF: Could not read segment %d!\r\n", i);
+            return false;
+        }
+
+        // .bss and other zero-initialised tails are not stored in the file
+        memset(dest + fileSize, 0, memorySize - fileSize);
+    }
+
+    *entryOut = (uint32_t)header.Entry;
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "stdint.h"
+#include "disk.h"
+#include "fat.h"
+
+#define ELF_MAGIC 0x464C457F // "\x7FELF"
+
+#define ELF_CLASS_64 2
+#define ELF_DATA_LITTLE_ENDIAN 1
+#define ELF_TYPE_EXECUTABLE 2
+#define ELF_MACHINE_X86_64 0x3E
+
+#define ELF_PROGRAM_TYPE_LOAD 1
+
+#pragma pack(push, 1)
+
+typedef struct
+{
+    uint32_t Magic;
+    uint8_t Class;
+    uint8_t Data;
+    uint8_t IdentVersion;
+    uint8_t OsAbi;
+    uint8_t _Padding[8];
+    uint16_t Type;
+    uint16_t Machine;
+    uint32_t Version;
+    uint64_t Entry;
+    uint64_t ProgramHeaderOffset;
+    uint64_t SectionHeaderOffset;
+    uint32_t Flags;
+    uint16_t HeaderSize;
+    uint16_t ProgramHeaderEntrySize;
+    uint16_t ProgramHeaderCount;
+    uint16_t SectionHeaderEntrySize;
+    uint16_t SectionHeaderCount;
+    uint16_t SectionNamesIndex;
+} ELF64_Header;
+
+typedef struct
+{
+    uint32_t Type;
+    uint32_t Flags;
+    uint64_t Offset;
+    uint64_t VirtualAddress;
+    uint64_t PhysicalAddress;
+    uint64_t FileSize;
+    uint64_t MemorySize;
+    uint64_t Align;
+} ELF64_ProgramHeader;
+
+#pragma pack(pop)
+
+// Load the PT_LOAD segments of an ELF64 executable to their physical
+// addresses, zeroing the part of each segment not backed by the file
+bool ELF_Load(DISK* disk, FAT_File* file, uint32_t* entryOut);
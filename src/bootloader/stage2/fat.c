@@ -6,10 +6,13 @@
 #include "memory.h"
 #include "ctype.h"
 
-#define SECTOR_SIZE 512
 #define MAX_PATH_SIZE 512
 #define MAX_FILE_HANDLES 10
 #define ROOT_DIRECTORY_HANDLE -1
+#define MAX_FILE_EXTENTS 16
+#define MAX_CACHED_DIRECTORIES 8
+#define MAX_CACHED_ENTRIES 768
+#define DIRECTORY_HASH_BUCKETS 64
 
 #pragma pack(push, 1)
 typedef struct
@@ -55,13 +58,28 @@ typedef struct
 
 #pragma pack(pop)
 
+// A run of physically contiguous sectors belonging to one file
+typedef struct
+{
+    uint32_t Lba;
+    uint32_t Sectors;
+} FAT_Extent;
+
 typedef struct
 {
     FAT_File Public;
     bool Opened;
     uint32_t FirstCluster;
-    uint32_t CurrentCluster;
-    uint32_t CurrentSectorInCluster;
+
+    // The cluster chain is decoded once into extents. NextCluster is the first
+    // cluster not covered by Extents (end of chain if the list is complete).
+    FAT_Extent Extents[MAX_FILE_EXTENTS];
+    uint16_t ExtentCount;
+    uint16_t CurrentExtent;
+    uint32_t SectorInExtent;
+    uint32_t NextCluster;
+
+    bool BufferValid;
     uint8_t Buffer[SECTOR_SIZE];
 } FAT_FileData;
 
@@ -79,13 +97,32 @@ typedef struct
 
 } FAT_Data;
 
+// Directories are indexed once by a hash of their 8.3 names. Entries of all
+// cached directories share one pool, chained per bucket by index + 1 (0 ends).
+typedef struct
+{
+    uint32_t FirstCluster;      // 0 for the root directory
+    uint16_t Buckets[DIRECTORY_HASH_BUCKETS];
+} FAT_CachedDirectory;
+
+typedef struct
+{
+    FAT_CachedDirectory Directories[MAX_CACHED_DIRECTORIES];
+    uint16_t DirectoryCount;
+    uint16_t EntryCount;
+    uint16_t Next[MAX_CACHED_ENTRIES];
+    FAT_DirectoryEntry Entries[MAX_CACHED_ENTRIES];
+} FAT_DirectoryCache;
+
 static FAT_Data *g_Data;
+static FAT_DirectoryCache *g_DirCache;
 static uint8_t *g_Fat = NULL;
 static uint32_t g_DataSectionLba;
 
 // Forward declarations
 bool FAT_ReadFat(DISK* disk);
 bool FAT_ReadRootDirectory(DISK* disk);
+static FAT_CachedDirectory *FAT_CacheDirectory(uint32_t firstCluster, const FAT_DirectoryEntry *entries, uint32_t count);
 
 // Helper function
 uint32_t min(uint32_t a, uint32_t b)
@@ -162,16 +199,16 @@ bool FAT_Initialize(DISK *disk)
     g_Data->RootDirectory.Public.Size = sizeof(FAT_DirectoryEntry) * g_Data->BS.BootSector.DirEntryCount;
     g_Data->RootDirectory.Opened = true;
     g_Data->RootDirectory.FirstCluster = 0;
-    g_Data->RootDirectory.CurrentCluster = 0;
-    g_Data->RootDirectory.CurrentSectorInCluster = 0;
-
-    if (!DISK_ReadSectors(disk, rootDirLba, 1, g_Data->RootDirectory.Buffer))
-    {
-        printf("Error: Could not read root directory!\r\n");
-        return false;
-    }
+    g_Data->RootDirectory.BufferValid = false;
 
+    // the root directory is one contiguous run of sectors before the data area
     uint32_t rootDirSectors = (rootDirSize + g_Data->BS.BootSector.BytesPerSector - 1) / g_Data->BS.BootSector.BytesPerSector;
+    g_Data->RootDirectory.Extents[0].Lba = rootDirLba;
+    g_Data->RootDirectory.Extents[0].Sectors = rootDirSectors;
+    g_Data->RootDirectory.ExtentCount = 1;
+    g_Data->RootDirectory.CurrentExtent = 0;
+    g_Data->RootDirectory.SectorInExtent = 0;
+    g_Data->RootDirectory.NextCluster = 0;
     g_DataSectionLba = rootDirLba + rootDirSectors;
 
     // reset opened files
@@ -180,6 +217,20 @@ bool FAT_Initialize(DISK *disk)
         g_Data->OpenedFiles[i].Opened = false;
     }
 
+    // index the root directory we just read, so opens don't touch the disk
+    if (sizeof(FAT_DirectoryCache) > MEMORY_DIRCACHE_SIZE)
+    {
+        printf("Error: Directory cache exceeds allocated memory! Required: %u, Available: %u\r\n", sizeof(FAT_DirectoryCache), MEMORY_DIRCACHE_SIZE);
+        return false;
+    }
+
+    g_DirCache = (FAT_DirectoryCache *)MEMORY_DIRCACHE_ADDR;
+    g_DirCache->DirectoryCount = 0;
+    g_DirCache->EntryCount = 0;
+
+    FAT_DirectoryEntry *rootEntries = (FAT_DirectoryEntry *)(g_Fat + fatSize);
+    FAT_CacheDirectory(0, rootEntries, g_Data->BS.BootSector.DirEntryCount);
+
     return true;
 }
 
@@ -188,7 +239,57 @@ uint32_t FAT_ClusterToLba(uint32_t cluster)
     return g_DataSectionLba + (cluster - 2) * g_Data->BS.BootSector.SectorsPerCluster;
 }
 
-FAT_File *FAT_OpenEntry(DISK *disk, FAT_DirectoryEntry *entry)
+uint32_t FAT_NextCluster(uint32_t currentCluster)
+{
+    uint32_t fatIndex = currentCluster * 3 / 2;
+
+    if (currentCluster % 2 == 0)
+    {
+        return (*(uint16_t *)(g_Fat + fatIndex)) & 0x0FFF;
+    }
+
+    else
+    {
+        return (*(uint16_t *)(g_Fat + fatIndex)) >> 4;
+    }
+}
+
+static bool FAT_IsEndOfChain(uint32_t cluster)
+{
+    return cluster < 2 || cluster >= 0x0FF8;
+}
+
+// Walk the cluster chain from 'cluster' and record it as a list of extents,
+// merging clusters that follow each other on disk
+static void FAT_BuildExtents(FAT_FileData *fd, uint32_t cluster)
+{
+    uint32_t sectorsPerCluster = g_Data->BS.BootSector.SectorsPerCluster;
+
+    fd->ExtentCount = 0;
+    fd->CurrentExtent = 0;
+    fd->SectorInExtent = 0;
+
+    while (!FAT_IsEndOfChain(cluster) && fd->ExtentCount < MAX_FILE_EXTENTS)
+    {
+        FAT_Extent *extent = &fd->Extents[fd->ExtentCount++];
+        extent->Lba = FAT_ClusterToLba(cluster);
+        extent->Sectors = sectorsPerCluster;
+
+        uint32_t next = FAT_NextCluster(cluster);
+        while (next == cluster + 1)
+        {
+            extent->Sectors += sectorsPerCluster;
+            cluster = next;
+            next = FAT_NextCluster(cluster);
+        }
+
+        cluster = next;
+    }
+
+    fd->NextCluster = cluster;
+}
+
+FAT_File *FAT_OpenEntry(FAT_DirectoryEntry *entry)
 {
     // Find a free file handle
     int handle = -1;
@@ -213,34 +314,37 @@ FAT_File *FAT_OpenEntry(DISK *disk, FAT_DirectoryEntry *entry)
     fd->Public.Size = entry->Size;
     fd->Opened = true;
     fd->FirstCluster = (entry->FirstClusterHigh << 16) | entry->FirstClusterLow;
-    fd->CurrentCluster = fd->FirstCluster;
-    fd->CurrentSectorInCluster = 0;
-
-    uint32_t lba = FAT_ClusterToLba(fd->CurrentCluster);
+    FAT_BuildExtents(fd, fd->FirstCluster);
 
-    // Load the first sector of the file/directory
-    if (!DISK_ReadSectors(disk, lba, 1, fd->Buffer))
+    // Directory entries record a size of 0, the chain length is the size
+    if (fd->Public.IsDirectory)
     {
-        printf("Error: Could not read first sector of the file!\r\n");
-        return NULL;
+        uint32_t clusters = 0;
+        for (uint32_t c = fd->FirstCluster; !FAT_IsEndOfChain(c); c = FAT_NextCluster(c))
+        {
+            clusters++;
+        }
+        fd->Public.Size = clusters * g_Data->BS.BootSector.SectorsPerCluster * SECTOR_SIZE;
     }
-    
-    fd->Opened = true;
+
+    // The first sector is only pulled into fd->Buffer if the first read is
+    // unaligned, aligned reads go straight to the caller
+    fd->BufferValid = false;
+
     return &fd->Public;
 }
 
-uint32_t FAT_NextCluster(uint32_t currentCluster)
+// Move the current position forward by a number of whole sectors, never past
+// the end of the current extent
+static void FAT_AdvanceSectors(FAT_FileData *fd, uint32_t sectors)
 {
-    uint32_t fatIndex = currentCluster * 3 / 2;
+    fd->SectorInExtent += sectors;
+    fd->BufferValid = false;
 
-    if (currentCluster % 2 == 0)
+    if (fd->SectorInExtent >= fd->Extents[fd->CurrentExtent].Sectors)
     {
-        return (*(uint16_t *)(g_Fat + fatIndex)) & 0x0FFF;
-    }
-
-    else
-    {
-        return (*(uint16_t *)(g_Fat + fatIndex)) >> 4;
+        fd->CurrentExtent++;
+        fd->SectorInExtent = 0;
     }
 }
 
@@ -255,48 +359,67 @@ uint32_t FAT_Read(DISK *disk, FAT_File *file, uint32_t byteCCount, void *dataOut
 
     while (byteCount > 0)
     {
-        uint32_t leftInBuffer = SECTOR_SIZE - (fd->Public.Position % SECTOR_SIZE);
-        uint32_t take = min(byteCount, leftInBuffer);
+        if (fd->CurrentExtent >= fd->ExtentCount)
+        {
+            if (FAT_IsEndOfChain(fd->NextCluster))
+            {
+                // End of file/cluster chain reached
+                printf("Error: Unexpected end of cluster chain!\r\n");
+                break;
+            }
+
+            // very fragmented file, decode the next part of the chain
+            FAT_BuildExtents(fd, fd->NextCluster);
+        }
 
-        memcpy(u8DataOut, fd->Buffer + fd->Public.Position % SECTOR_SIZE, take);
-        u8DataOut += take;
-        fd->Public.Position += take;
-        byteCount -= take;
+        FAT_Extent *extent = &fd->Extents[fd->CurrentExtent];
+        uint32_t lba = extent->Lba + fd->SectorInExtent;
+        uint32_t offset = fd->Public.Position % SECTOR_SIZE;
 
-        if (byteCount > 0)
+        if (offset == 0 && byteCount >= SECTOR_SIZE)
         {
-            if (fd->Public.Handle == ROOT_DIRECTORY_HANDLE)
+            // Aligned middle of the request: read as much of the current
+            // extent as fits directly into the caller's buffer
+            uint32_t sectors = min(byteCount / SECTOR_SIZE, extent->Sectors - fd->SectorInExtent);
+            if (sectors > 0xFFFF)
             {
-                ++fd->CurrentCluster;
-
-                if (!DISK_ReadSectors(disk, fd->CurrentCluster, 1, fd->Buffer))
-                {
-                    printf("Error: Could not read sector from disk!\r\n");
-                    return u8DataOut - (uint8_t *)dataOut;
-                }
+                sectors = 0xFFFF;
             }
 
-            else
+            if (!DISK_ReadSectors(disk, lba, (uint16_t)sectors, u8DataOut))
             {
+                printf("Error: Could not read sector from disk!\r\n");
+                break;
+            }
 
-                if (++fd->CurrentSectorInCluster >= g_Data->BS.BootSector.SectorsPerCluster)
-                {
-                    fd->CurrentSectorInCluster = 0;
-                    fd->CurrentCluster = FAT_NextCluster(fd->CurrentCluster);
-                }
-
-                if (fd->CurrentCluster >= 0x0FF8)
+            uint32_t take = sectors * SECTOR_SIZE;
+            u8DataOut += take;
+            fd->Public.Position += take;
+            byteCount -= take;
+            FAT_AdvanceSectors(fd, sectors);
+        }
+        else
+        {
+            // Unaligned head or tail: go through the single-sector buffer
+            if (!fd->BufferValid)
+            {
+                if (!DISK_ReadSectors(disk, lba, 1, fd->Buffer))
                 {
-                    // End of file/cluster chain reached
-                    printf("Error: Unexpected end of cluster chain!\r\n");
+                    printf("Error: Could not read sector from disk!\r\n");
                     break;
                 }
+                fd->BufferValid = true;
+            }
 
-                if (!DISK_ReadSectors(disk, FAT_ClusterToLba(fd->CurrentCluster) + fd->CurrentSectorInCluster, 1, fd->Buffer))
-                {
-                    printf("Error: Could not read sector from disk!\r\n");
-                    return u8DataOut - (uint8_t *)dataOut;
-                }
+            uint32_t take = min(byteCount, SECTOR_SIZE - offset);
+            memcpy(u8DataOut, fd->Buffer + offset, take);
+            u8DataOut += take;
+            fd->Public.Position += take;
+            byteCount -= take;
+
+            if (fd->Public.Position % SECTOR_SIZE == 0)
+            {
+                FAT_AdvanceSectors(fd, 1);
             }
         }
     }
@@ -309,6 +432,58 @@ bool FAT_ReadEntry(DISK *disk, FAT_File *file, FAT_DirectoryEntry *dirEntry)
     return FAT_Read(disk, file, sizeof(FAT_DirectoryEntry), dirEntry) == sizeof(FAT_DirectoryEntry);
 }
 
+bool FAT_Seek(FAT_File *file, uint32_t position)
+{
+    FAT_FileData *fd = (file->Handle == ROOT_DIRECTORY_HANDLE)
+                               ? &g_Data->RootDirectory
+                               : &g_Data->OpenedFiles[file->Handle];
+
+    if (position > fd->Public.Size)
+    {
+        return false;
+    }
+
+    // Seeking backwards restarts from the beginning of the chain
+    if (position < fd->Public.Position)
+    {
+        if (fd->Public.Handle == ROOT_DIRECTORY_HANDLE)
+        {
+            fd->CurrentExtent = 0;
+            fd->SectorInExtent = 0;
+        }
+        else
+        {
+            FAT_BuildExtents(fd, fd->FirstCluster);
+        }
+
+        fd->Public.Position = 0;
+        fd->BufferValid = false;
+    }
+
+    // Skip whole sectors, an extent at a time
+    uint32_t sectors = position / SECTOR_SIZE - fd->Public.Position / SECTOR_SIZE;
+    while (sectors > 0)
+    {
+        if (fd->CurrentExtent >= fd->ExtentCount)
+        {
+            if (FAT_IsEndOfChain(fd->NextCluster))
+            {
+                printf("Error: Unexpected end of cluster chain!\r\n");
+                return false;
+            }
+
+            FAT_BuildExtents(fd, fd->NextCluster);
+        }
+
+        uint32_t step = min(sectors, fd->Extents[fd->CurrentExtent].Sectors - fd->SectorInExtent);
+        FAT_AdvanceSectors(fd, step);
+        sectors -= step;
+    }
+
+    fd->Public.Position = position;
+    return true;
+}
+
 void FAT_Close(FAT_File *file)
 {
     if (file == NULL)
@@ -319,8 +494,9 @@ void FAT_Close(FAT_File *file)
     if (file->Handle == ROOT_DIRECTORY_HANDLE)
     {
         g_Data->RootDirectory.Public.Position = 0;
-        g_Data->RootDirectory.CurrentCluster = g_Data->RootDirectory.FirstCluster;
-        g_Data->RootDirectory.CurrentSectorInCluster = 0;
+        g_Data->RootDirectory.CurrentExtent = 0;
+        g_Data->RootDirectory.SectorInExtent = 0;
+        g_Data->RootDirectory.BufferValid = false;
     }
     else if (file->Handle >= 0 && file->Handle < MAX_FILE_HANDLES)
     {
@@ -328,6 +504,105 @@ void FAT_Close(FAT_File *file)
     }
 }
 
+static uint32_t FAT_HashName(const uint8_t *name)
+{
+    // FNV-1a over the 11 byte 8.3 name
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 11; i++)
+    {
+        hash = (hash ^ name[i]) * 16777619u;
+    }
+
+    return hash % DIRECTORY_HASH_BUCKETS;
+}
+
+static FAT_CachedDirectory *FAT_FindCachedDirectory(uint32_t firstCluster)
+{
+    for (int i = 0; i < g_DirCache->DirectoryCount; i++)
+    {
+        if (g_DirCache->Directories[i].FirstCluster == firstCluster)
+        {
+            return &g_DirCache->Directories[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Add the valid entries of a directory to the cache. 'entries' may point into
+// the free part of the entry pool itself, they are only ever moved down.
+static FAT_CachedDirectory *FAT_CacheDirectory(uint32_t firstCluster, const FAT_DirectoryEntry *entries, uint32_t count)
+{
+    if (g_DirCache->DirectoryCount >= MAX_CACHED_DIRECTORIES)
+    {
+        return NULL;
+    }
+
+    FAT_CachedDirectory *dir = &g_DirCache->Directories[g_DirCache->DirectoryCount];
+    dir->FirstCluster = firstCluster;
+    memset(dir->Buckets, 0, sizeof(dir->Buckets));
+
+    uint16_t used = g_DirCache->EntryCount;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const FAT_DirectoryEntry *entry = &entries[i];
+
+        // a zero first byte marks the end of the directory
+        if (entry->Name[0] == 0x00)
+        {
+            break;
+        }
+
+        // skip deleted entries, long name fragments and the volume label
+        if (entry->Name[0] == 0xE5 || (entry->Attributes & FAT_ATTRIBUTE_LONG_NAME) == FAT_ATTRIBUTE_LONG_NAME ||
+            (entry->Attributes & FAT_ATTRIBUTE_VOLUME_ID))
+        {
+            continue;
+        }
+
+        if (used >= MAX_CACHED_ENTRIES)
+        {
+            return NULL;
+        }
+
+        if (&g_DirCache->Entries[used] != entry)
+        {
+            memcpy(&g_DirCache->Entries[used], entry, sizeof(FAT_DirectoryEntry));
+        }
+
+        uint32_t bucket = FAT_HashName(g_DirCache->Entries[used].Name);
+        g_DirCache->Next[used] = dir->Buckets[bucket];
+        dir->Buckets[bucket] = used + 1;
+        used++;
+    }
+
+    g_DirCache->EntryCount = used;
+    g_DirCache->DirectoryCount++;
+    return dir;
+}
+
+// Read a whole subdirectory straight into the free part of the entry pool
+// and index it. Returns NULL if it doesn't fit, callers then scan the disk.
+static FAT_CachedDirectory *FAT_LoadDirectory(DISK *disk, FAT_File *file)
+{
+    FAT_FileData *fd = &g_Data->OpenedFiles[file->Handle];
+    uint32_t freeEntries = MAX_CACHED_ENTRIES - g_DirCache->EntryCount;
+
+    if (g_DirCache->DirectoryCount >= MAX_CACHED_DIRECTORIES ||
+        file->Size > freeEntries * sizeof(FAT_DirectoryEntry))
+    {
+        return NULL;
+    }
+
+    FAT_DirectoryEntry *raw = &g_DirCache->Entries[g_DirCache->EntryCount];
+    if (!FAT_Seek(file, 0) || FAT_Read(disk, file, file->Size, raw) != file->Size)
+    {
+        return NULL;
+    }
+
+    return FAT_CacheDirectory(fd->FirstCluster, raw, file->Size / sizeof(FAT_DirectoryEntry));
+}
+
 bool FAT_FindFile(DISK* disk, FAT_File* file, const char* name, FAT_DirectoryEntry* entryOut)
 {
     char fatName[11];
@@ -337,7 +612,8 @@ bool FAT_FindFile(DISK* disk, FAT_File* file, const char* name, FAT_DirectoryEnt
 
     if(ext == NULL)
     {
-        ext = name + 11;
+        // no extension, the base name runs to the end of the string
+        ext = name + strlen(name);
     }
 
     for(int i = 0; i < 8 && name + i < ext; i++)
@@ -353,6 +629,29 @@ bool FAT_FindFile(DISK* disk, FAT_File* file, const char* name, FAT_DirectoryEnt
         }
     }
 
+    uint32_t firstCluster = (file->Handle == ROOT_DIRECTORY_HANDLE) ? 0 : g_Data->OpenedFiles[file->Handle].FirstCluster;
+    FAT_CachedDirectory *dir = FAT_FindCachedDirectory(firstCluster);
+    if (dir == NULL && file->Handle != ROOT_DIRECTORY_HANDLE)
+    {
+        dir = FAT_LoadDirectory(disk, file);
+    }
+
+    if (dir != NULL)
+    {
+        uint32_t bucket = FAT_HashName((const uint8_t *)fatName);
+        for (uint16_t i = dir->Buckets[bucket]; i != 0; i = g_DirCache->Next[i - 1])
+        {
+            if (memcmp(fatName, g_DirCache->Entries[i - 1].Name, 11) == 0)
+            {
+                *entryOut = g_DirCache->Entries[i - 1];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // directory not cached (cache full), scan it entry by entry
     FAT_DirectoryEntry entry;
     
     while(FAT_ReadEntry(disk, file, &entry))
@@ -409,7 +708,7 @@ FAT_File *FAT_Open(DISK *disk, const char *path)
                 return NULL;
             }
 
-            current = FAT_OpenEntry(disk, &entry);
+            current = FAT_OpenEntry(&entry);
         }
 
         else
@@ -43,6 +43,7 @@ enum FAT_Attributes
 bool FAT_Initialize(DISK* disk);
 FAT_File* FAT_Open(DISK* disk, const char* path);
 uint32_t FAT_Read(DISK* disk, FAT_File* file, uint32_t byteCCount, void* dataOut);
+bool FAT_Seek(FAT_File* file, uint32_t position);
 bool FAT_ReadEntry(DISK* disk, FAT_File* file, FAT_DirectoryEntry* dirEntry);
 void FAT_Close(FAT_File* file);
 
@@ -0,0 +1,95 @@
+#include "kimage.h"
+#include "lz4.h"
+#include "memdefs.h"
+#include "memory.h"
+#include "stdio.h"
+
+// Lowest address a segment may be loaded to, below this lives stage2 itself
+#define KIMAGE_MIN_LOAD_ADDRESS 0x100000
+
+static KIMAGE_Segment g_Segments[KIMAGE_MAX_SEGMENTS];
+
+static bool KIMAGE_ReadExact(DISK* disk, FAT_File* file, uint32_t size, void* dataOut)
+{
+    return FAT_Read(disk, file, size, dataOut) == size;
+}
+
+bool KIMAGE_Load(DISK* disk, FAT_File* file, uint32_t* entryOut)
+{
+    KIMAGE_Header header;
+
+    if (!KIMAGE_ReadExact(disk, file, sizeof(header), &header) || header.Magic != KIMAGE_MAGIC)
+    {
+        printf("KIMAGE: Not a compressed kernel image!\r\n");
+        return false;
+    }
+
+    if (header.SegmentCount > KIMAGE_MAX_SEGMENTS ||
+        !KIMAGE_ReadExact(disk, file, header.SegmentCount * sizeof(KIMAGE_Segment), g_Segments))
+    {
+        printf("KIMAGE: Could not read segment table!\r\n");
+        return false;
+    }
+
+    uint8_t* blockBuffer = (uint8_t*)MEMORY_KIMAGE_BLOCK_ADDR;
+
+    for (uint32_t i = 0; i < header.SegmentCount; i++)
+    {
+        KIMAGE_Segment* segment = &g_Segments[i];
+        if (segment->Address < KIMAGE_MIN_LOAD_ADDRESS || segment->FileSize > segment->MemorySize)
+        {
+            printf("KIMAGE: Segment %u at 0x%x can't be loaded!\r\n", i, segment->Address);
+            return false;
+        }
+
+        uint8_t* segmentStart = (uint8_t*)segment->Address;
+        uint8_t* dest = segmentStart;
+
+        for (uint32_t b = 0; b < segment->BlockCount; b++)
+        {
+            KIMAGE_Block block;
+            if (!KIMAGE_ReadExact(disk, file, sizeof(block), &block))
+            {
+                printf("KIMAGE: Could not read block header!\r\n");
+                return false;
+            }
+
+            uint32_t packedSize = block.CompressedSize & ~KIMAGE_BLOCK_UNCOMPRESSED;
+            if (block.Size > KIMAGE_BLOCK_SIZE || packedSize > MEMORY_KIMAGE_BLOCK_SIZE ||
+                dest + block.Size > segmentStart + segment->FileSize)
+            {
+                printf("KIMAGE: Bad block %u in segment %u!\r\n", b, i);
+                return false;
+            }
+
+            if (block.CompressedSize & KIMAGE_BLOCK_UNCOMPRESSED)
+            {
+                // stored block, read it straight to its destination
+                if (!KIMAGE_ReadExact(disk, file, block.Size, dest))
+                {
+                    printf("KIMAGE: Could not read block %u!\r\n", b);
+                    return false;
+                }
+            }
+            else
+            {
+                // read the packed block into low memory, then expand it in
+                // place before the next read; matches may reach back into
+                // earlier blocks of the same segment
+                if (!KIMAGE_ReadExact(disk, file, packedSize, blockBuffer) ||
+                    LZ4_DecompressBlock(blockBuffer, packedSize, dest, block.Size, segmentStart) != block.Size)
+                {
+                    printf("KIMAGE: Could not decompress block %u!\r\n", b);
+                    return false;
+                }
+            }
+
+            dest += block.Size;
+        }
+
+        memset(segmentStart + segment->FileSize, 0, segment->MemorySize - segment->FileSize);
+    }
+
+    *entryOut = header.Entry;
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "stdint.h"
+#include "disk.h"
+#include "fat.h"
+
+// Compressed kernel image produced by tools/kpack (layout matches kpack.c):
+// KIMAGE_Header, KIMAGE_Segment[SegmentCount], then every segment's blocks
+// in order, each a KIMAGE_Block followed by its data
+#define KIMAGE_MAGIC 0x5A4B424E // 'NBKZ'
+#define KIMAGE_BLOCK_SIZE 0x8000
+#define KIMAGE_BLOCK_UNCOMPRESSED 0x80000000
+#define KIMAGE_MAX_SEGMENTS 16
+
+#pragma pack(push, 1)
+
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t Entry;
+    uint32_t SegmentCount;
+} KIMAGE_Header;
+
+typedef struct
+{
+    uint32_t Address;
+    uint32_t FileSize;
+    uint32_t MemorySize;
+    uint32_t BlockCount;
+} KIMAGE_Segment;
+
+typedef struct
+{
+    uint32_t CompressedSize;
+    uint32_t Size;
+} KIMAGE_Block;
+
+#pragma pack(pop)
+
+// Stream the image from disk, decompressing each block straight to its
+// load address and zeroing the rest of every segment
+bool KIMAGE_Load(DISK* disk, FAT_File* file, uint32_t* entryOut);
@@ -0,0 +1,94 @@
+#include "lz4.h"
+#include "memory.h"
+
+#define LZ4_MIN_MATCH 4
+
+static uint32_t LZ4_ReadLength(const uint8_t** ip, const uint8_t* ipEnd, uint32_t length)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= ipEnd)
+        {
+            return 0xFFFFFFFF;
+        }
+        b = *(*ip)++;
+        length += b;
+    } while (b == 255);
+
+    return length;
+}
+
+uint32_t LZ4_DecompressBlock(const uint8_t* src, uint32_t srcSize, uint8_t* dst, uint32_t dstSize, const uint8_t* windowStart)
+{
+    const uint8_t* ip = src;
+    const uint8_t* ipEnd = src + srcSize;
+    uint8_t* op = dst;
+    uint8_t* opEnd = dst + dstSize;
+
+    while (ip < ipEnd)
+    {
+        uint8_t token = *ip++;
+
+        // literals
+        uint32_t literals = token >> 4;
+        if (literals == 15)
+        {
+            literals = LZ4_ReadLength(&ip, ipEnd, literals);
+        }
+        if (literals > (uint32_t)(ipEnd - ip) || literals > (uint32_t)(opEnd - op))
+        {
+            return 0;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence has no match part
+        if (ip >= ipEnd)
+        {
+            break;
+        }
+        if (ipEnd - ip < 2)
+        {
+            return 0;
+        }
+
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        uint32_t length = token & 0x0F;
+        if (length == 15)
+        {
+            length = LZ4_ReadLength(&ip, ipEnd, length);
+            if (length == 0xFFFFFFFF)
+            {
+                return 0;
+            }
+        }
+        length += LZ4_MIN_MATCH;
+
+        const uint8_t* match = op - offset;
+        if (offset == 0 || match < windowStart || length > (uint32_t)(opEnd - op))
+        {
+            return 0;
+        }
+
+        if (offset >= length)
+        {
+            // source and destination don't overlap
+            memcpy(op, match, length);
+            op += length;
+        }
+        else
+        {
+            // overlapping copy repeats the last 'offset' bytes
+            while (length--)
+            {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (uint32_t)(op - dst);
+}
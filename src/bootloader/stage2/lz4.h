@@ -0,0 +1,7 @@
+#pragma once
+#include "stdint.h"
+
+// Decompress one LZ4 block (raw block format, no frame) to dst. Matches may
+// refer back into output written before dst, down to windowStart.
+// Returns the number of bytes written, or 0 if the block is malformed.
+uint32_t LZ4_DecompressBlock(const uint8_t* src, uint32_t srcSize, uint8_t* dst, uint32_t dstSize, const uint8_t* windowStart);
@@ -9,10 +9,6 @@ global entry
 STAGE2_SEGMENT equ 0x2000
 BOOT_DRIVE_OFFSET equ 0x7F00   ; Store boot drive at a known offset within segment
 
-; VESA info buffer location (in low memory, accessible in real mode)
-VESA_INFO_BUFFER equ 0x7000    ; Linear address for VBE info
-VESA_MODE_BUFFER equ 0x7200    ; Linear address for mode info
-
 entry:
     cli
     
@@ -32,9 +28,6 @@ entry:
     ; Save boot drive at a known location
     mov [BOOT_DRIVE_OFFSET], dl
 
-    ; Set up VESA graphics mode before protected mode
-    call SetupVESA
-
     call EnableA20
     call LoadGDT
 
@@ -133,209 +126,3 @@ GDTEnd:
 GDTDesc:
     dw GDTEnd - GDTStart - 1        ; limit (size - 1)
     dd GDTStart                      ; linear address of GDT (linker provides 0x20xxx)
-
-
-; ============================================================================
-; VESA VBE Setup (called in real mode before protected mode)
-; ============================================================================
-
-SetupVESA:
-    push es
-    push di
-    push si
-    push bx
-    
-    ; First, get VBE controller info
-    ; ES:DI = pointer to VbeInfoBlock
-    xor ax, ax
-    mov es, ax
-    mov di, VESA_INFO_BUFFER
-    
-    ; Set signature to "VBE2" to request VBE 2.0+ info
-    mov dword [es:di], 'VBE2'
-    
-    mov ax, 0x4F00      ; VBE Function 00h - Get Controller Info
-    int 0x10
-    
-    ; Check if VBE is supported
-    cmp ax, 0x004F
-    jne .vesa_failed
-    
-    ; Verify signature changed to "VESA"
-    cmp dword [es:di], 'VESA'
-    jne .vesa_failed
-    
-    ; Now enumerate modes to find a good one
-    ; Get mode list pointer (at offset 14 in VbeInfoBlock)
-    mov si, [es:di + 14]    ; Offset of mode list
-    mov ax, [es:di + 16]    ; Segment of mode list
-    mov fs, ax              ; FS:SI = mode list
-    
-.find_mode:
-    mov cx, [fs:si]         ; Get mode number
-    cmp cx, 0xFFFF          ; End of list?
-    je .try_fallback
-    
-    ; Get mode info for this mode
-    push cx
-    push si
-    
-    xor ax, ax
-    mov es, ax
-    mov di, VESA_MODE_BUFFER
-    mov ax, 0x4F01          ; VBE Function 01h - Get Mode Info
-    int 0x10
-    
-    pop si
-    pop cx
-    
-    cmp ax, 0x004F
-    jne .next_mode
-    
-    ; Check mode attributes (offset 0)
-    ; Bit 0: Mode supported
-    ; Bit 4: Graphics mode
-    ; Bit 7: Linear framebuffer available
-    mov ax, [es:di]
-    and ax, 0x0091          ; Check bits 0, 4, 7
-    cmp ax, 0x0091
-    jne .next_mode
-    
-    ; Check resolution - look for 1024x768 or 800x600 with 32bpp
-    mov ax, [es:di + 18]    ; Width
-    cmp ax, 1024
-    jne .check_800
-    mov ax, [es:di + 20]    ; Height
-    cmp ax, 768
-    jne .check_800
-    mov al, [es:di + 25]    ; BPP
-    cmp al, 32
-    je .found_mode
-    
-.check_800:
-    mov ax, [es:di + 18]
-    cmp ax, 800
-    jne .check_640
-    mov ax, [es:di + 20]
-    cmp ax, 600
-    jne .check_640
-    mov al, [es:di + 25]
-    cmp al, 32
-    je .found_mode
-    
-.check_640:
-    mov ax, [es:di + 18]
-    cmp ax, 640
-    jne .next_mode
-    mov ax, [es:di + 20]
-    cmp ax, 480
-    jne .next_mode
-    mov al, [es:di + 25]
-    cmp al, 32
-    je .found_mode
-    cmp al, 24
-    je .found_mode
-    
-.next_mode:
-    add si, 2
-    jmp .find_mode
-
-.try_fallback:
-    ; Try standard VBE mode numbers
-    mov cx, 0x118           ; 1024x768x32
-    call .try_set_mode
-    jc .try_115
-    jmp .mode_set_done
-    
-.try_115:
-    mov cx, 0x115           ; 800x600x32
-    call .try_set_mode
-    jc .try_112
-    jmp .mode_set_done
-    
-.try_112:
-    mov cx, 0x112           ; 640x480x32
-    call .try_set_mode
-    jc .vesa_failed
-    jmp .mode_set_done
-
-.found_mode:
-    ; CX still has the mode number
-    ; Set the mode with linear framebuffer
-    mov bx, cx
-    or bx, 0x4000           ; Bit 14 = use linear framebuffer
-    mov ax, 0x4F02           ; VBE Function 02h - Set Mode
-    int 0x10
-    cmp ax, 0x004F
-    jne .vesa_failed
-
-.mode_set_done:
-    ; Save mode info to a fixed low memory location for C code to read
-    ; We'll use 0x8100 as a safe location (after FB_INFO at 0x8000)
-    push ds
-    push es
-    
-    xor ax, ax
-    mov ds, ax
-    mov si, VESA_MODE_BUFFER    ; Source: mode info from BIOS
-    mov di, 0x8100              ; Destination: fixed location
-    mov es, ax
-    
-    mov cx, 128                 ; Copy 256 bytes
-    rep movsw
-    
-    ; Mark VESA as available at 0x80FF
-    mov byte [0x80FF], 1
-    
-    pop es
-    pop ds
-    jmp .vesa_done
-
-.try_set_mode:
-    ; Try to set mode in CX
-    ; First get mode info
-    push cx
-    xor ax, ax
-    mov es, ax
-    mov di, VESA_MODE_BUFFER
-    mov ax, 0x4F01
-    int 0x10
-    pop cx
-    
-    cmp ax, 0x004F
-    jne .try_set_failed
-    
-    ; Check if mode is valid
-    mov ax, [es:di]
-    and ax, 0x0091
-    cmp ax, 0x0091
-    jne .try_set_failed
-    
-    ; Set the mode
-    mov bx, cx
-    or bx, 0x4000
-    mov ax, 0x4F02
-    int 0x10
-    cmp ax, 0x004F
-    jne .try_set_failed
-    
-    clc                     ; Success
-    ret
-    
-.try_set_failed:
-    stc                     ; Failure
-    ret
-
-.vesa_failed:
-    ; VESA not available, stay in text mode
-    ; Mark at 0x80FF as not available
-    xor ax, ax
-    mov es, ax
-    mov byte [es:0x80FF], 0
-    
-.vesa_done:
-    pop bx
-    pop si
-    pop di
-    pop es
-    ret
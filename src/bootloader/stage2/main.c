@@ -1,4 +1,8 @@
+#include "bootinfo.h"
+#include "boottime.h"
 #include "disk.h"
+#include "elf.h"
+#include "kimage.h"
 #include "fat.h"
 #include "memory.h"
 #include "stdint.h"
@@ -14,14 +18,10 @@
 #define LOG_ERROR "[ERR]  "
 #define LOG_DEBUG "[DBG]  "
 
-// Fixed address where we store framebuffer info for kernel
-#define FB_INFO_ADDR 0x8000
-
-// VESA info locations (set by assembly in real mode)
-#define VESA_AVAILABLE_ADDR 0x80FF
-#define VESA_MODE_INFO_ADDR 0x8100
-
 void _cdecl cstart_(uint16_t bootDrive) {
+  boottime_init();
+  boottime_mark("stage2 start");
+
   printf("\r\n\r\n");
   printf("**************************************************\r\n");
   printf("* BOOTLOADER STAGE 2 STARTED - GCC BUILD        *\r\n");
@@ -33,131 +33,124 @@ void _cdecl cstart_(uint16_t bootDrive) {
   printf(LOG_INFO "Initializing system components...\r\n");
   printf("\r\n");
 
-  // Step 1: Initialize disk subsystem
-  printf(LOG_INFO "Step 1: Initializing disk subsystem...\r\n");
+  // Step 1: Collect the memory map for the kernel
+  printf(LOG_INFO "Step 1: Detecting memory (E820)...\r\n");
+  bootinfo_init((uint8_t)bootDrive);
+  multiboot_info_t *mbi = bootinfo_get();
+  if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+    printf(LOG_OK "Memory map: %u entries, lower %uKB, upper %uKB\r\n",
+           mbi->mmap_length / sizeof(multiboot_mmap_entry_t), mbi->mem_lower,
+           mbi->mem_upper);
+  }
+  boottime_mark("memory map");
+  printf("\r\n");
+
+  // Step 2: Initialize disk subsystem
+  printf(LOG_INFO "Step 2: Initializing disk subsystem...\r\n");
   DISK disk;
   if (!DISK_Initialize(&disk, (uint8_t)bootDrive)) {
     printf(LOG_ERROR "Could not initialize disk!\r\n");
     printf(LOG_ERROR "Boot halted. Please check disk connection.\r\n");
     goto end;
   }
+  boottime_mark("disk init");
   printf(LOG_OK "Disk initialized successfully\r\n");
   printf(LOG_DEBUG "Disk ID: 0x%x, Cylinders: %u, Heads: %u, Sectors: %u\r\n",
          disk.id, disk.cylinders, disk.heads, disk.sectors);
   printf("\r\n");
 
-  // Step 2: Initialize FAT filesystem
-  printf(LOG_INFO "Step 2: Initializing FAT filesystem...\r\n");
+  // Step 3: Initialize FAT filesystem
+  printf(LOG_INFO "Step 3: Initializing FAT filesystem...\r\n");
   if (!FAT_Initialize(&disk)) {
     printf(LOG_ERROR "Could not initialize FAT filesystem!\r\n");
     printf(LOG_ERROR "Boot halted. Please verify disk format.\r\n");
     goto end;
   }
+  boottime_mark("fat init");
   printf(LOG_OK "FAT filesystem initialized successfully\r\n");
   printf("\r\n");
 
-  // Step 3: Load Kernel
-  printf(LOG_INFO "Step 3: Loading kernel...\r\n");
-  printf(LOG_INFO "Searching for kernel.bin in root directory...\r\n");
-  FAT_File *fd = FAT_Open(&disk, "/kernel.bin");
+  // Step 4: Load Kernel
+  printf(LOG_INFO "Step 4: Loading kernel...\r\n");
+  // Prefer the LZ4 compressed image, it takes far fewer sectors to read
+  printf(LOG_INFO "Searching for kernel.lz4 in root directory...\r\n");
+  bool compressed = true;
+  FAT_File *fd = FAT_Open(&disk, "/kernel.lz4");
   if (fd == NULL) {
-    printf(LOG_ERROR "Could not open kernel.bin!\r\n");
+    printf(LOG_INFO "Searching for kernel.elf in root directory...\r\n");
+    compressed = false;
+    fd = FAT_Open(&disk, "/kernel.elf");
+  }
+  if (fd == NULL) {
+    printf(LOG_ERROR "Could not open kernel.lz4 or kernel.elf!\r\n");
     printf(LOG_ERROR "Boot halted. Kernel file not found.\r\n");
     goto end;
   }
+  boottime_mark("kernel open");
   printf(LOG_OK "Kernel file found\r\n");
   printf(LOG_DEBUG "Kernel size: %u bytes\r\n", fd->Size);
   printf("\r\n");
 
-  // Step 4: Read kernel to temporary buffer
-  printf(LOG_INFO
-         "Step 4: Reading kernel to temporary buffer (0x30000)...\r\n");
-  uint8_t *kernelBuffer = (uint8_t *)0x30000;
-  uint32_t read = FAT_Read(&disk, fd, fd->Size, kernelBuffer);
-
-  if (read != fd->Size) {
-    printf(LOG_ERROR "Could not read entire kernel!\r\n");
-    printf(LOG_ERROR "Expected: %u bytes, Read: %u bytes\r\n", fd->Size, read);
-    printf(LOG_ERROR "Boot halted. Disk read error.\r\n");
+  // Step 5: Load the kernel's segments straight to their physical
+  // addresses. DISK_ReadSectors stages the transfer through low memory, so
+  // there is no size limit here.
+  printf(LOG_INFO "Step 5: Loading kernel segments%s...\r\n",
+         compressed ? " (LZ4)" : "");
+  uint32_t entryPoint;
+  bool loaded = compressed ? KIMAGE_Load(&disk, fd, &entryPoint)
+                           : ELF_Load(&disk, fd, &entryPoint);
+  if (!loaded) {
+    printf(LOG_ERROR "Could not load the kernel image!\r\n");
+    printf(LOG_ERROR "Boot halted. Disk read error or bad executable.\r\n");
     goto end;
   }
-  printf(LOG_OK "Kernel read successfully (%u bytes)\r\n", read);
+  boottime_mark("kernel read");
+  printf(LOG_OK "Kernel loaded, entry point at 0x%x\r\n", entryPoint);
+  printf(LOG_DEBUG "Track cache: %u hits, %u misses\r\n", disk.cacheHits,
+         disk.cacheMisses);
 
   FAT_Close(fd);
   printf("\r\n");
 
-  // Step 5: Copy kernel to final location
-  printf(LOG_INFO "Step 5: Copying kernel to 0x100000 (1MB mark)...\r\n");
-  uint8_t *kernelStart = (uint8_t *)0x100000;
-  memcpy(kernelStart, kernelBuffer, fd->Size);
-  printf(LOG_OK "Kernel copied to 0x100000\r\n");
-  printf("\r\n");
-
-  // Step 6: Check VESA graphics (set up in real mode by assembly)
-  printf(LOG_INFO "Step 6: Checking VESA graphics...\r\n");
-  
-  // Copy framebuffer info to fixed address for kernel
-  FramebufferInfo *fb_dest = (FramebufferInfo *)FB_INFO_ADDR;
-  
-  // Read VESA availability flag from fixed location
-  uint8_t vesa_available = *(volatile uint8_t *)VESA_AVAILABLE_ADDR;
-  
-  if (vesa_available) {
-    // Parse mode info from fixed memory location
-    uint8_t *mode_info = (uint8_t *)VESA_MODE_INFO_ADDR;
-    
-    // VESAModeInfo structure offsets:
-    // 16: bytes_per_scanline (word)
-    // 18: width (word), 20: height (word), 25: bpp (byte)
-    // 27: memory_model (byte)
-    // 31-36: color field info
-    // 40: framebuffer (dword)
-    fb_dest->width = *(uint16_t *)(mode_info + 18);
-    fb_dest->height = *(uint16_t *)(mode_info + 20);
-    fb_dest->bpp = mode_info[25];
-    fb_dest->pitch = *(uint16_t *)(mode_info + 16);
-    fb_dest->framebuffer_addr = *(uint32_t *)(mode_info + 40);
-    fb_dest->memory_model = mode_info[27];
-    
-    // Color field info
-    fb_dest->red_mask_size = mode_info[31];
-    fb_dest->red_field_pos = mode_info[32];
-    fb_dest->green_mask_size = mode_info[33];
-    fb_dest->green_field_pos = mode_info[34];
-    fb_dest->blue_mask_size = mode_info[35];
-    fb_dest->blue_field_pos = mode_info[36];
-    
-    printf(LOG_OK "VESA mode set: %ux%ux%u\r\n", 
-           fb_dest->width, fb_dest->height, fb_dest->bpp);
-    printf(LOG_DEBUG "Framebuffer at: 0x%x, pitch: %u\r\n",
-           fb_dest->framebuffer_addr, fb_dest->pitch);
+  // Step 6: Rank the VESA modes and set the best one
+  printf(LOG_INFO "Step 6: Setting up VESA graphics...\r\n");
+
+  // Framebuffer info and the mode list are passed to the kernel in the
+  // multiboot block
+  if (vesa_init() == 0) {
+    FramebufferInfo *fb = vesa_get_framebuffer_info();
+    int mode_count;
+    const VideoMode *modes = vesa_get_modes(&mode_count);
+
+    printf(LOG_OK "VESA mode set: %ux%ux%u\r\n", fb->width, fb->height,
+           fb->bpp);
+    printf(LOG_DEBUG "Framebuffer at: 0x%x, pitch: %u, %d modes listed\r\n",
+           fb->framebuffer_addr, fb->pitch, mode_count);
+    bootinfo_set_framebuffer(fb);
+    bootinfo_set_video_modes(modes, mode_count);
   } else {
-    // Clear framebuffer info to indicate text mode
-    memset(fb_dest, 0, sizeof(FramebufferInfo));
+    // No framebuffer flag in the multiboot block means text mode
     printf(LOG_INFO "VESA not available, continuing in text mode\r\n");
   }
+  boottime_mark("vesa info");
   printf("\r\n");
 
   // Step 7: Transfer control to kernel
   printf(LOG_INFO "Step 7: Transferring control to kernel...\r\n");
-  printf(LOG_INFO "Jumping to kernel entry point at 0x100000\r\n");
+  printf(LOG_INFO "Jumping to kernel entry point at 0x%x\r\n", entryPoint);
   printf("**************************************************\r\n");
   printf("*           KERNEL HANDOFF IN PROGRESS          *\r\n");
   printf("**************************************************\r\n");
   printf("\r\n");
 
-  // Create a minimal Multiboot info structure (zeroed out for now)
-  static uint32_t multiboot_info[32] = {0};
-
   // Use inline assembly with explicit immediate moves
   // This bypasses any compiler register allocation issues
-  // Jump to _start which is 16 bytes after kernel start (past multiboot header + alignment)
-  uint32_t entryPoint = (uint32_t)kernelStart + 16;
+  boottime_mark("kernel jump");
   __asm__ volatile("movl $0x2BADB002, %%eax\n" // Multiboot magic
                    "movl %0, %%ebx\n"          // Multiboot info
                    "jmp *%1\n"                 // Jump to kernel entry
                    :
-                   : "r"((uint32_t)multiboot_info), "r"(entryPoint)
+                   : "r"((uint32_t)mbi), "r"(entryPoint)
                    : "eax", "ebx");
 
   // Should never reach here
@@ -3,5 +3,30 @@
 #define MEMORY_MIN      0x00000500
 #define MEMORY_MAX      0x00080000
 
+// Multiboot info block and memory map handed to the kernel
+#define MEMORY_BOOTINFO_ADDR  ((void*)0x8800)
+#define MEMORY_MMAP_ADDR      ((void*)0x8900)
+#define MEMORY_MMAP_SIZE      0x00000700
+
+// Usable VESA modes in rank order, see bootinfo_set_video_modes
+#define MEMORY_VIDEO_MODES_ADDR  ((void*)0x9000)
+#define MEMORY_VIDEO_MODES_SIZE  0x00000800
+
+// BIOS disk reads destined above conventional memory are staged here
+#define MEMORY_DISK_BOUNCE_ADDR  ((void*)0x30000)
+#define MEMORY_DISK_BOUNCE_SIZE  0x00010000
+
 #define MEMORY_FAT_ADDR  ((void*)0x40000)
 #define MEMORY_FAT_SIZE  0x00010500
+
+// Cached directory entries with a name hash, filled as directories are visited
+#define MEMORY_DIRCACHE_ADDR  ((void*)0x51000)
+#define MEMORY_DIRCACHE_SIZE  0x00008000
+
+// Whole tracks read ahead by the DISK layer
+#define MEMORY_TRACKCACHE_ADDR  ((void*)0x60000)
+#define MEMORY_TRACKCACHE_SIZE  0x00008000
+
+// Compressed kernel blocks are read here and decompressed to their load address
+#define MEMORY_KIMAGE_BLOCK_ADDR  ((void*)0x70000)
+#define MEMORY_KIMAGE_BLOCK_SIZE  0x00010000
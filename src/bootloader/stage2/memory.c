@@ -1,32 +1,37 @@
 #include "memory.h"
 
-void *memcpy(void *dst, const void *src, uint16_t num)
+void *memcpy(void *dst, const void *src, uint32_t num)
 {
     uint8_t *u8Dst = (uint8_t *)dst;
     const uint8_t *u8Src = (const uint8_t *)src;
-    for (uint16_t i = 0; i < num; i++)
-    {
-        u8Dst[i] = u8Src[i];
-    }
+    uint32_t dwords = num / 4;
+    uint32_t bytes = num % 4;
+
+    // bulk of the copy a dword at a time, then the odd tail bytes
+    __asm__ volatile("cld\n\trep movsl" : "+D"(u8Dst), "+S"(u8Src), "+c"(dwords) : : "memory");
+    __asm__ volatile("rep movsb" : "+D"(u8Dst), "+S"(u8Src), "+c"(bytes) : : "memory");
 
     return dst;
 }
 
-void* memset(void* ptr, int value, uint16_t num)
+void* memset(void* ptr, int value, uint32_t num)
 {
     uint8_t* u8Ptr = (uint8_t*)ptr;
-    for (uint16_t i = 0; i < num; i++)
-    {
-        u8Ptr[i] = (uint8_t)value;
-    }
+    uint32_t pattern = (uint8_t)value * 0x01010101u;
+    uint32_t dwords = num / 4;
+    uint32_t bytes = num % 4;
+
+    __asm__ volatile("cld\n\trep stosl" : "+D"(u8Ptr), "+c"(dwords) : "a"(pattern) : "memory");
+    __asm__ volatile("rep stosb" : "+D"(u8Ptr), "+c"(bytes) : "a"(pattern) : "memory");
+
     return ptr;
 }
 
-int memcmp(const void* ptr1, const void* ptr2, uint16_t num)
+int memcmp(const void* ptr1, const void* ptr2, uint32_t num)
 {
     const uint8_t* u8Ptr1 = (const uint8_t*)ptr1;
     const uint8_t* u8Ptr2 = (const uint8_t*)ptr2;
-    for (uint16_t i = 0; i < num; i++)
+    for (uint32_t i = 0; i < num; i++)
     {
         if (u8Ptr1[i] != u8Ptr2[i])
         {
@@ -4,8 +4,14 @@ typedef signed char        int8_t;
 typedef unsigned char      uint8_t;
 typedef signed short       int16_t;
 typedef unsigned short     uint16_t;
+#ifdef __LP64__
+// tools/hostbench builds the FAT code as 64-bit host code
+typedef signed int         int32_t;
+typedef unsigned int       uint32_t;
+#else
 typedef signed long int    int32_t;
 typedef unsigned long int  uint32_t;
+#endif
 typedef signed long long   int64_t;
 typedef unsigned long long uint64_t;
 
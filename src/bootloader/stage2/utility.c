@@ -9,4 +9,11 @@ uint32_t align(uint32_t number, uint32_t alignTo)
 
     uint32_t rem = number % alignTo;
     return (rem == 0) ? number : (number + (alignTo - rem));
-}
\ No newline at end of file
+}
+
+void reciprocal_init(Reciprocal* r, uint32_t divisor)
+{
+    // A BIOS reporting 0 sectors or heads gets nonsense back, not a fault
+    r->divisor = divisor;
+    r->reciprocal = divisor ? 0xFFFFFFFF / divisor : 0;
+}
@@ -2,4 +2,29 @@
 #include "stdint.h"
 
 uint32_t align(uint32_t number, uint32_t alignTo);
-//Time for it's .c file!
+
+// Division by a number fixed at run time and used over and over (the disk
+// geometry). reciprocal is floor((2^32 - 1) / divisor), so the high half
+// of n * reciprocal is the quotient or one short of it, and one compare
+// fixes that up: a multiply instead of a div per call.
+typedef struct
+{
+    uint32_t divisor;
+    uint32_t reciprocal;
+} Reciprocal;
+
+void reciprocal_init(Reciprocal* r, uint32_t divisor);
+
+static inline uint32_t reciprocal_divide(const Reciprocal* r, uint32_t n, uint32_t* remainder)
+{
+    uint32_t q = (uint32_t)(((uint64_t)n * r->reciprocal) >> 32);
+    uint32_t rem = n - q * r->divisor;
+    if (rem >= r->divisor)
+    {
+        q++;
+        rem -= r->divisor;
+    }
+    if (remainder)
+        *remainder = rem;
+    return q;
+}
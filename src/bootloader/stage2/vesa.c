@@ -105,66 +105,108 @@ int vesa_set_mode(uint16_t mode) {
   return 0;
 }
 
-// Enumerate available VESA modes and find a suitable one
-static uint16_t vesa_find_mode(VBEInfoBlock *vbe_info, uint16_t target_width, 
-                                uint16_t target_height, uint8_t target_bpp) {
+// Lower is better, -1 for depths the kernel can't draw
+static int bpp_rank(uint8_t bpp) {
+  switch (bpp) {
+  case 32:
+    return 0;
+  case 24:
+    return 1;
+  case 16:
+    return 2;
+  case 15:
+    return 3;
+  default:
+    return -1;
+  }
+}
+
+// Whether a ranks above b
+static int mode_better(const VideoMode *a, const VideoMode *b) {
+  int ra = bpp_rank(a->bpp), rb = bpp_rank(b->bpp);
+  if (ra != rb)
+    return ra < rb;
+
+  uint32_t pa = (uint32_t)a->width * a->height;
+  uint32_t pb = (uint32_t)b->width * b->height;
+  int exact_a = a->width == VESA_PREFER_WIDTH && a->height == VESA_PREFER_HEIGHT;
+  int exact_b = b->width == VESA_PREFER_WIDTH && b->height == VESA_PREFER_HEIGHT;
+  if (exact_a != exact_b)
+    return exact_a;
+  int fits_a = a->width <= VESA_PREFER_WIDTH && a->height <= VESA_PREFER_HEIGHT;
+  int fits_b = b->width <= VESA_PREFER_WIDTH && b->height <= VESA_PREFER_HEIGHT;
+  if (fits_a != fits_b)
+    return fits_a;
+  if (fits_a)
+    return pa > pb;
+  return pa < pb;
+}
+
+// Ranked usable modes, built by vesa_rank_modes
+static VideoMode modes[VESA_MAX_MODES];
+static int mode_count = 0;
+
+// Collect every usable mode the BIOS lists, in rank order
+static void vesa_rank_modes(VBEInfoBlock *vbe_info) {
   // Get the mode list pointer (far pointer: segment:offset)
   uint16_t mode_seg = (vbe_info->video_modes_ptr >> 16) & 0xFFFF;
   uint16_t mode_off = vbe_info->video_modes_ptr & 0xFFFF;
-  
-  // Convert to linear address
-  uint32_t mode_list_addr = ((uint32_t)mode_seg << 4) + mode_off;
-  uint16_t *mode_list = (uint16_t *)mode_list_addr;
-  
-  printf("  Mode list at: 0x%x (seg:0x%x off:0x%x)\n", 
-         mode_list_addr, mode_seg, mode_off);
-  
+  uint16_t *mode_list = (uint16_t *)(((uint32_t)mode_seg << 4) + mode_off);
+
+  // The list may live in the BIOS buffers the mode info calls reuse, take
+  // a copy first
+  uint16_t list[256];
+  int listed = 0;
+  while (listed < 256 && mode_list[listed] != 0xFFFF) {
+    list[listed] = mode_list[listed];
+    listed++;
+  }
+
   VESAModeInfo mode_info;
-  uint16_t best_mode = 0;
-  int best_score = -1;
-  
-  // Iterate through mode list (terminated by 0xFFFF)
-  for (int i = 0; mode_list[i] != 0xFFFF && i < 256; i++) {
-    uint16_t mode = mode_list[i];
-    
-    if (vesa_get_mode_info(mode, &mode_info) != 0) {
+  mode_count = 0;
+  for (int i = 0; i < listed; i++) {
+    if (vesa_get_mode_info(list[i], &mode_info) != 0)
+      continue;
+
+    // Supported, graphics, linear framebuffer
+    if ((mode_info.mode_attributes & 0x91) != 0x91)
       continue;
-    }
-    
-    // Check if mode supports linear framebuffer and is graphics mode
-    if ((mode_info.mode_attributes & 0x90) != 0x90) {
+    // Direct color (memory_model = 6) at a depth the kernel draws
+    if (mode_info.memory_model != 6 || bpp_rank(mode_info.bpp) < 0 ||
+        !mode_info.framebuffer)
       continue;
-    }
-    
-    // Check for direct color mode (memory_model = 6)
-    if (mode_info.memory_model != 6) {
+
+    VideoMode m;
+    m.mode = list[i];
+    m.width = mode_info.width;
+    m.height = mode_info.height;
+    m.pitch = mode_info.bytes_per_scanline;
+    m.framebuffer = mode_info.framebuffer;
+    m.bpp = mode_info.bpp;
+    m.red_mask_size = mode_info.red_mask_size;
+    m.red_field_pos = mode_info.red_field_position;
+    m.green_mask_size = mode_info.green_mask_size;
+    m.green_field_pos = mode_info.green_field_position;
+    m.blue_mask_size = mode_info.blue_mask_size;
+    m.blue_field_pos = mode_info.blue_field_position;
+    m.reserved = 0;
+
+    // Insertion sort, a full list drops whatever ranks last
+    int pos = mode_count;
+    while (pos > 0 && mode_better(&m, &modes[pos - 1]))
+      pos--;
+    if (pos >= VESA_MAX_MODES)
       continue;
-    }
-    
-    // Score based on how close to target resolution
-    int score = 0;
-    
-    // Prefer exact match
-    if (mode_info.width == target_width && mode_info.height == target_height 
-        && mode_info.bpp == target_bpp) {
-      return mode; // Exact match!
-    }
-    
-    // Otherwise score based on closeness
-    if (mode_info.bpp >= 24) score += 100; // Prefer high color
-    if (mode_info.width >= 800 && mode_info.width <= 1280) score += 50;
-    if (mode_info.height >= 600 && mode_info.height <= 1024) score += 50;
-    
-    if (score > best_score) {
-      best_score = score;
-      best_mode = mode;
-    }
+    int last = mode_count < VESA_MAX_MODES ? mode_count : VESA_MAX_MODES - 1;
+    for (int j = last; j > pos; j--)
+      modes[j] = modes[j - 1];
+    modes[pos] = m;
+    if (mode_count < VESA_MAX_MODES)
+      mode_count++;
   }
-  
-  return best_mode;
 }
 
-// Initialize VESA and find a suitable mode
+// Initialize VESA and set the best ranked mode
 int vesa_init(void) {
   VBEInfoBlock vbe_info;
 
@@ -180,61 +222,54 @@ int vesa_init(void) {
          vbe_info.version & 0xFF);
   printf("  Total memory: %d KB\n", vbe_info.total_memory * 64);
 
-  // Find a suitable mode - try 1024x768x32 first
-  uint16_t selected_mode = vesa_find_mode(&vbe_info, 1024, 768, 32);
-  
-  if (selected_mode == 0) {
-    // Fallback: try 800x600x32
-    selected_mode = vesa_find_mode(&vbe_info, 800, 600, 32);
-  }
-  
-  if (selected_mode == 0) {
-    // Fallback: try 640x480x32
-    selected_mode = vesa_find_mode(&vbe_info, 640, 480, 32);
-  }
+  vesa_rank_modes(&vbe_info);
+  printf("  %d usable modes, preferring %dx%d\n", mode_count,
+         VESA_PREFER_WIDTH, VESA_PREFER_HEIGHT);
 
-  if (selected_mode == 0) {
+  // Some BIOSes list modes they then refuse, fall down the ranking. The
+  // one that took moves to the front of the list.
+  int selected = 0;
+  while (selected < mode_count && vesa_set_mode(modes[selected].mode) != 0)
+    selected++;
+  if (selected == mode_count) {
     puts("  No suitable VESA mode found!\n");
+    mode_count = 0;
     return -1;
   }
+  VideoMode chosen = modes[selected];
+  for (int i = selected; i > 0; i--)
+    modes[i] = modes[i - 1];
+  modes[0] = chosen;
 
-  // Get final mode info
-  VESAModeInfo mode_info;
-  if (vesa_get_mode_info(selected_mode, &mode_info) != 0) {
-    puts("  Failed to get mode info!\n");
-    return -1;
-  }
-
-  printf("  Selected mode 0x%x: %dx%dx%d\n", selected_mode,
-         mode_info.width, mode_info.height, mode_info.bpp);
-  printf("  Framebuffer at: 0x%x\n", mode_info.framebuffer);
-  printf("  Pitch: %d bytes/line\n", mode_info.bytes_per_scanline);
-
-  // Set the mode
-  if (vesa_set_mode(selected_mode) != 0) {
-    puts("  Failed to set VESA mode!\n");
-    return -1;
-  }
+  printf("  Selected mode 0x%x: %dx%dx%d\n", chosen.mode, chosen.width,
+         chosen.height, chosen.bpp);
+  printf("  Framebuffer at: 0x%x\n", chosen.framebuffer);
+  printf("  Pitch: %d bytes/line\n", chosen.pitch);
 
   // Store framebuffer info for kernel
-  fb_info.framebuffer_addr = mode_info.framebuffer;
-  fb_info.width = mode_info.width;
-  fb_info.height = mode_info.height;
-  fb_info.pitch = mode_info.bytes_per_scanline;
-  fb_info.bpp = mode_info.bpp;
-  fb_info.memory_model = mode_info.memory_model;
+  fb_info.framebuffer_addr = chosen.framebuffer;
+  fb_info.width = chosen.width;
+  fb_info.height = chosen.height;
+  fb_info.pitch = chosen.pitch;
+  fb_info.bpp = chosen.bpp;
+  fb_info.memory_model = 6;
   
   // Red/Green/Blue field positions
-  fb_info.red_mask_size = mode_info.red_mask_size;
-  fb_info.red_field_pos = mode_info.red_field_position;
-  fb_info.green_mask_size = mode_info.green_mask_size;
-  fb_info.green_field_pos = mode_info.green_field_position;
-  fb_info.blue_mask_size = mode_info.blue_mask_size;
-  fb_info.blue_field_pos = mode_info.blue_field_position;
+  fb_info.red_mask_size = chosen.red_mask_size;
+  fb_info.red_field_pos = chosen.red_field_pos;
+  fb_info.green_mask_size = chosen.green_mask_size;
+  fb_info.green_field_pos = chosen.green_field_pos;
+  fb_info.blue_mask_size = chosen.blue_mask_size;
+  fb_info.blue_field_pos = chosen.blue_field_pos;
 
   puts("  VESA initialized successfully!\n");
   return 0;
 }
 
+const VideoMode *vesa_get_modes(int *count) {
+  *count = mode_count;
+  return modes;
+}
+
 // Get framebuffer info (to pass to kernel)
 FramebufferInfo *vesa_get_framebuffer_info(void) { return &fb_info; }
@@ -87,7 +87,43 @@ typedef struct
 } __attribute__((packed)) FramebufferInfo;
 
 
+// A usable mode: linear framebuffer, direct color, 15 to 32 bpp. The list
+// handed to the kernel holds these in rank order, the active mode first.
+typedef struct 
+{
+  uint16_t mode; // VBE mode number
+  uint16_t width;
+  uint16_t height;
+  uint16_t pitch;
+  uint32_t framebuffer;
+  uint8_t bpp;
+  uint8_t red_mask_size;
+  uint8_t red_field_pos;
+  uint8_t green_mask_size;
+  uint8_t green_field_pos;
+  uint8_t blue_mask_size;
+  uint8_t blue_field_pos;
+  uint8_t reserved;
+} __attribute__((packed)) VideoMode;
+
+#define VESA_MAX_MODES 64
+
+// Modes are ranked by bpp, 32 first since a pixel is then one aligned
+// store, then by closeness to this resolution: an exact match, else the
+// largest mode that fits in it, else the smallest one above it. Set at
+// build time with VESA_WIDTH/VESA_HEIGHT.
+#ifndef VESA_PREFER_WIDTH
+#define VESA_PREFER_WIDTH 1024
+#endif
+#ifndef VESA_PREFER_HEIGHT
+#define VESA_PREFER_HEIGHT 768
+#endif
+
 // Function prototypes
+// Rank the BIOS's modes and set the best one the BIOS accepts
 int vesa_init(void);
 int vesa_set_mode(uint16_t mode);
 FramebufferInfo *vesa_get_framebuffer_info(void);
+
+// The ranked usable modes, valid after vesa_init
+const VideoMode *vesa_get_modes(int *count);
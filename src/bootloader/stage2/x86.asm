@@ -6,6 +6,9 @@ global x86_Video_WriteCharTeletype
 global x86_Disk_Reset
 global x86_Disk_Read
 global x86_Disk_GetDriveParams
+global x86_Disk_ExtensionsPresent
+global x86_Disk_ExtendedRead
+global x86_E820GetNextBlock
 
 ; ------------------------------------------------------------------------------
 ; x86_Video_WriteCharTeletype
@@ -259,6 +262,214 @@ x86_Disk_GetDriveParams:
     ret
 
 
+; ------------------------------------------------------------------------------
+; x86_Disk_ExtensionsPresent
+; bool x86_Disk_ExtensionsPresent(uint8_t drive);
+; INT 13h AH=41h - true if the BIOS supports packet (LBA) disk access
+; ------------------------------------------------------------------------------
+x86_Disk_ExtensionsPresent:
+    push ebp
+    mov ebp, esp
+    push ebx
+    push esi
+    push edi
+
+    mov dl, [ebp + 8]   ; drive
+    mov ah, 0x41
+    mov bx, 0x55AA
+
+    mov [g_RegDX], dx
+    mov [g_RegAX], ax
+    mov [g_RegBX], bx
+
+    call x86_EnterRealMode
+
+    [bits 16]
+    a32 mov dx, [g_RegDX]
+    a32 mov ax, [g_RegAX]
+    a32 mov bx, [g_RegBX]
+    stc
+    int 0x13
+
+    pushf
+    pop ax
+    a32 mov [g_RegFlags], ax
+    a32 mov [g_RegBX], bx
+    a32 mov [g_RegCX], cx
+
+    call x86_EnterProtectedMode
+    [bits 32]
+
+    ; CF clear, BX = AA55h and CX bit 0 (DAP access) set
+    movzx eax, word [g_RegFlags]
+    test al, 1
+    jnz .error
+    cmp word [g_RegBX], 0xAA55
+    jne .error
+    test word [g_RegCX], 1
+    jz .error
+    mov eax, 1
+    jmp .done
+.error:
+    xor eax, eax
+.done:
+
+    pop edi
+    pop esi
+    pop ebx
+    mov esp, ebp
+    pop ebp
+    ret
+
+; ------------------------------------------------------------------------------
+; x86_Disk_ExtendedRead
+; bool x86_Disk_ExtendedRead(uint8_t drive, uint32_t lba, uint16_t count, void* dataOut);
+; INT 13h AH=42h - read using a disk address packet
+; ------------------------------------------------------------------------------
+x86_Disk_ExtendedRead:
+    push ebp
+    mov ebp, esp
+    push ebx
+    push esi
+    push edi
+
+    ; Fill in the disk address packet
+    mov eax, [ebp + 12] ; lba
+    mov [g_DAP_LBA], eax
+    mov dword [g_DAP_LBA + 4], 0
+    mov ax, [ebp + 16]  ; count
+    mov [g_DAP_Count], ax
+
+    mov ebx, [ebp + 20] ; dataOut
+
+    ; Convert linear address to seg:off
+    mov esi, ebx
+    shr esi, 4
+    and ebx, 0xF
+    mov [g_DAP_Offset], bx
+    mov [g_DAP_Segment], si
+
+    mov dl, [ebp + 8]   ; drive
+    mov ah, 0x42
+    mov [g_RegDX], dx
+    mov [g_RegAX], ax
+
+    ; DS:SI -> packet
+    mov eax, g_DAP
+    mov esi, eax
+    shr esi, 4
+    and eax, 0xF
+    mov [g_RegDS], si
+    mov [g_RegSI], ax
+
+    call x86_EnterRealMode
+
+    [bits 16]
+    a32 mov dx, [g_RegDX]
+    a32 mov ax, [g_RegAX]
+    a32 mov si, [g_RegSI]
+    a32 mov bx, [g_RegDS]
+    mov ds, bx          ; DS must be loaded last, variables need DS=0
+
+    stc
+    int 0x13
+
+    pushf
+    pop ax
+    xor bx, bx
+    mov ds, bx
+    a32 mov [g_RegFlags], ax
+
+    call x86_EnterProtectedMode
+    [bits 32]
+
+    ; Check carry flag (bit 0 = error)
+    movzx eax, word [g_RegFlags]
+    test al, 1
+    jnz .error
+    mov eax, 1
+    jmp .done
+.error:
+    xor eax, eax
+.done:
+
+    pop edi
+    pop esi
+    pop ebx
+    mov esp, ebp
+    pop ebp
+    ret
+
+; ------------------------------------------------------------------------------
+; x86_E820GetNextBlock
+; uint32_t x86_E820GetNextBlock(void* entryOut, uint32_t* continuationId);
+; INT 15h EAX=E820h - returns the entry size in bytes, 0 on failure
+; ------------------------------------------------------------------------------
+x86_E820GetNextBlock:
+    push ebp
+    mov ebp, esp
+    push ebx
+    push esi
+    push edi
+
+    ; ES:DI -> entry buffer
+    mov ebx, [ebp + 8]  ; entryOut
+    mov esi, ebx
+    shr esi, 4
+    and ebx, 0xF
+    mov [g_RegES], si
+    mov [g_RegDI], bx
+
+    mov esi, [ebp + 12] ; continuationId
+    mov eax, [esi]
+    mov [g_E820_EBX], eax
+
+    call x86_EnterRealMode
+
+    [bits 16]
+    a32 mov ax, [g_RegES]
+    mov es, ax
+    a32 mov di, [g_RegDI]
+    a32 mov ebx, [g_E820_EBX]
+    mov eax, 0xE820
+    mov ecx, 20
+    mov edx, 0x534D4150 ; 'SMAP'
+    stc
+    int 0x15
+
+    pushf
+    a32 mov [g_E820_EAX], eax
+    a32 mov [g_E820_EBX], ebx
+    a32 mov [g_E820_ECX], ecx
+    pop ax
+    a32 mov [g_RegFlags], ax
+
+    call x86_EnterProtectedMode
+    [bits 32]
+
+    ; CF clear and EAX = 'SMAP' on success
+    movzx eax, word [g_RegFlags]
+    test al, 1
+    jnz .error
+    cmp dword [g_E820_EAX], 0x534D4150
+    jne .error
+
+    mov esi, [ebp + 12]
+    mov eax, [g_E820_EBX]
+    mov [esi], eax
+    mov eax, [g_E820_ECX]
+    jmp .done
+.error:
+    xor eax, eax
+.done:
+
+    pop edi
+    pop esi
+    pop ebx
+    mov esp, ebp
+    pop ebp
+    ret
+
 ; ------------------------------------------------------------------------------
 ; Mode Switching
 ; ------------------------------------------------------------------------------
@@ -526,3 +737,18 @@ g_RegSI: dw 0
 g_RegDI: dw 0
 g_RegFlags: dw 0
 g_RegsPtr: dd 0
+
+; 32-bit registers for INT 15h E820h
+g_E820_EAX: dd 0
+g_E820_EBX: dd 0
+g_E820_ECX: dd 0
+
+; Disk address packet for INT 13h AH=42h
+align 4
+g_DAP:
+g_DAP_Size: db 0x10
+g_DAP_Reserved: db 0
+g_DAP_Count: dw 0
+g_DAP_Offset: dw 0
+g_DAP_Segment: dw 0
+g_DAP_LBA: dq 0
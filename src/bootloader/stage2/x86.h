@@ -12,6 +12,12 @@ bool _cdecl x86_Disk_Read(uint8_t drive, uint16_t cylinder, uint16_t sector, uin
 
 bool _cdecl x86_Disk_GetDriveParams(uint8_t drive, uint8_t* driveTypeOut, uint16_t* cylindersOut, uint16_t* sectorsOut, uint16_t* headsOut);
 
+bool _cdecl x86_Disk_ExtensionsPresent(uint8_t drive);
+
+bool _cdecl x86_Disk_ExtendedRead(uint8_t drive, uint32_t lba, uint16_t count, void* dataOut);
+
+uint32_t _cdecl x86_E820GetNextBlock(void* entryOut, uint32_t* continuationId);
+
 typedef struct {
     uint16_t ax, bx, cx, dx, si, di, es, ds, flags;
 } Registers16;
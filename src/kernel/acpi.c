@@ -0,0 +1,109 @@
+#include "acpi.h"
+#include "stdint.h"
+
+// The firmware tables only need reading, so this walks them in place
+// through the identity map. Tables above 4GB are out of reach and skipped.
+#define IDENTITY_MAP_END 0x100000000ULL
+
+#define BDA_EBDA_SEGMENT 0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+
+typedef struct {
+  char signature[8]; // "RSD PTR "
+  uint8_t checksum;
+  char oem_id[6];
+  uint8_t revision; // 0 for ACPI 1.0, 2 and up have the XSDT fields
+  uint32_t rsdt_addr;
+  uint32_t length;
+  uint64_t xsdt_addr;
+  uint8_t ext_checksum;
+  uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+static const acpi_header_t *root = 0;
+static bool root_is_xsdt = false;
+
+static bool checksum_ok(const void *data, uint32_t length) {
+  const uint8_t *p = (const uint8_t *)data;
+  uint8_t sum = 0;
+  for (uint32_t i = 0; i < length; i++)
+    sum += p[i];
+  return sum == 0;
+}
+
+static bool signature_is(const char *a, const char *b, int n) {
+  for (int i = 0; i < n; i++)
+    if (a[i] != b[i])
+      return false;
+  return true;
+}
+
+// The RSDP sits on a 16 byte boundary in the first 1KB of the EBDA or in
+// the BIOS ROM area
+static const acpi_rsdp_t *scan_rsdp(uint64_t start, uint64_t end) {
+  for (uint64_t addr = start; addr + 20 <= end; addr += 16) {
+    const acpi_rsdp_t *rsdp = (const acpi_rsdp_t *)(uintptr_t)addr;
+    if (signature_is(rsdp->signature, "RSD PTR ", 8) && checksum_ok(rsdp, 20))
+      return rsdp;
+  }
+  return 0;
+}
+
+static const acpi_header_t *table_at(uint64_t addr) {
+  if (!addr || addr + sizeof(acpi_header_t) > IDENTITY_MAP_END)
+    return 0;
+  const acpi_header_t *table = (const acpi_header_t *)(uintptr_t)addr;
+  if (addr + table->length > IDENTITY_MAP_END)
+    return 0;
+  return table;
+}
+
+// Low memory read that GCC can't treat as a null pointer offset
+static uint16_t read_bda16(uintptr_t addr) {
+  __asm__("" : "+r"(addr));
+  return *(const volatile uint16_t *)addr;
+}
+
+bool acpi_init(void) {
+  uint64_t ebda = (uint64_t)read_bda16(BDA_EBDA_SEGMENT) << 4;
+  const acpi_rsdp_t *rsdp = 0;
+  if (ebda >= 0x80000 && ebda < 0xA0000)
+    rsdp = scan_rsdp(ebda, ebda + 1024);
+  if (!rsdp)
+    rsdp = scan_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+  if (!rsdp)
+    return false;
+
+  // Prefer the XSDT when the firmware provides a valid one
+  if (rsdp->revision >= 2 && checksum_ok(rsdp, rsdp->length)) {
+    root = table_at(rsdp->xsdt_addr);
+    root_is_xsdt = root && checksum_ok(root, root->length);
+  }
+  if (!root_is_xsdt) {
+    root = table_at(rsdp->rsdt_addr);
+    if (!root || !checksum_ok(root, root->length)) {
+      root = 0;
+      return false;
+    }
+  }
+  return true;
+}
+
+const acpi_header_t *acpi_find_table(const char *signature) {
+  if (!root)
+    return 0;
+
+  uint32_t entry_size = root_is_xsdt ? 8 : 4;
+  uint32_t count = (root->length - sizeof(acpi_header_t)) / entry_size;
+  const uint8_t *entries = (const uint8_t *)(root + 1);
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t addr = root_is_xsdt ? *(const uint64_t *)(entries + i * 8)
+                                 : *(const uint32_t *)(entries + i * 4);
+    const acpi_header_t *table = table_at(addr);
+    if (table && signature_is(table->signature, signature, 4) &&
+        checksum_ok(table, table->length))
+      return table;
+  }
+  return 0;
+}
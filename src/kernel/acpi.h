@@ -0,0 +1,84 @@
+#pragma once
+#include "stdint.h"
+
+// Common header of every ACPI system description table
+typedef struct {
+  char signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  uint32_t oem_revision;
+  uint32_t creator_id;
+  uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+// Multiple APIC Description Table ("APIC")
+typedef struct {
+  acpi_header_t header;
+  uint32_t lapic_addr;
+  uint32_t flags; // Bit 0: dual 8259 PICs present
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_PCAT_COMPAT 0x1
+
+// MADT entry types
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_ISO 2 // Interrupt source override
+#define MADT_LAPIC_NMI 4
+#define MADT_LAPIC_OVERRIDE 5
+#define MADT_X2APIC 9
+
+typedef struct {
+  uint8_t type;
+  uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+typedef struct {
+  madt_entry_t entry;
+  uint8_t processor_id;
+  uint8_t apic_id;
+  uint32_t flags; // Bit 0 enabled, bit 1 online capable
+} __attribute__((packed)) madt_lapic_t;
+
+typedef struct {
+  madt_entry_t entry;
+  uint8_t ioapic_id;
+  uint8_t reserved;
+  uint32_t addr;
+  uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic_t;
+
+typedef struct {
+  madt_entry_t entry;
+  uint8_t bus;
+  uint8_t source; // ISA IRQ
+  uint32_t gsi;
+  uint16_t flags; // MPS INTI polarity (bits 0-1) and trigger mode (bits 2-3)
+} __attribute__((packed)) madt_iso_t;
+
+typedef struct {
+  madt_entry_t entry;
+  uint16_t reserved;
+  uint64_t lapic_addr;
+} __attribute__((packed)) madt_lapic_override_t;
+
+typedef struct {
+  madt_entry_t entry;
+  uint16_t reserved;
+  uint32_t x2apic_id;
+  uint32_t flags;
+  uint32_t processor_uid;
+} __attribute__((packed)) madt_x2apic_t;
+
+#define MADT_CPU_ENABLED 0x1
+#define MADT_CPU_ONLINE_CAPABLE 0x2
+
+// Find the RSDP and root table, false if the firmware has no ACPI
+bool acpi_init(void);
+
+// Table with the given signature (e.g. "APIC"), NULL if absent or its
+// checksum is wrong
+const acpi_header_t *acpi_find_table(const char *signature);
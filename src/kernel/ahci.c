@@ -0,0 +1,462 @@
+#include "ahci.h"
+#include "apic.h"
+#include "blk.h"
+#include "paging.h"
+#include "pci.h"
+#include "pmm.h"
+#include "string.h"
+#include "timer.h"
+
+// HBA registers
+#define HBA_CAP 0x00
+#define HBA_GHC 0x04
+#define HBA_IS 0x08
+#define HBA_PI 0x0C
+#define HBA_PORTS 0x100
+#define HBA_PORT_STRIDE 0x80
+#define HBA_MAP_SIZE 0x2000 // Generic registers and all 32 ports
+
+#define CAP_SLOTS_SHIFT 8
+#define CAP_SLOTS_MASK 0x1F
+#define CAP_NCQ (1u << 30)
+#define CAP_64BIT (1u << 31)
+#define GHC_IE (1u << 1)
+#define GHC_AE (1u << 31)
+
+// Port registers
+#define PORT_CLB 0x00
+#define PORT_CLBU 0x04
+#define PORT_FB 0x08
+#define PORT_FBU 0x0C
+#define PORT_IS 0x10
+#define PORT_IE 0x14
+#define PORT_CMD 0x18
+#define PORT_TFD 0x20
+#define PORT_SIG 0x24
+#define PORT_SSTS 0x28
+#define PORT_SERR 0x30
+#define PORT_SACT 0x34
+#define PORT_CI 0x38
+
+#define CMD_ST (1u << 0)
+#define CMD_FRE (1u << 4)
+#define CMD_FR (1u << 14)
+#define CMD_CR (1u << 15)
+
+#define TFD_ERR 0x01
+#define TFD_DRQ 0x08
+#define TFD_BSY 0x80
+
+#define SSTS_DET_MASK 0xF
+#define SSTS_DET_PRESENT 0x3
+#define SSTS_IPM_SHIFT 8
+#define SSTS_IPM_MASK 0xF
+#define SSTS_IPM_ACTIVE 0x1
+
+#define SIG_ATA 0x00000101
+
+// Port interrupts: completions, then the errors that stop the port
+#define IS_DHRS (1u << 0)
+#define IS_PSS (1u << 1)
+#define IS_DSS (1u << 2)
+#define IS_SDBS (1u << 3)
+#define IS_UFS (1u << 4)
+#define IS_DPS (1u << 5)
+#define IS_IFS (1u << 27)
+#define IS_HBDS (1u << 28)
+#define IS_HBFS (1u << 29)
+#define IS_TFES (1u << 30)
+#define IS_ERRORS (IS_IFS | IS_HBDS | IS_HBFS | IS_TFES)
+#define IS_ENABLED                                                             \
+  (IS_DHRS | IS_PSS | IS_DSS | IS_SDBS | IS_UFS | IS_DPS | IS_ERRORS)
+
+#define FIS_TYPE_H2D 0x27
+#define FIS_H2D_COMMAND 0x80
+#define FIS_DEVICE_LBA 0x40
+
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_FPDMA 0x60
+#define ATA_CMD_WRITE_FPDMA 0x61
+#define ATA_CMD_IDENTIFY 0xEC
+
+// IDENTIFY words
+#define ID_QUEUE_DEPTH 75
+#define ID_SATA_CAPS 76
+#define ID_COMMAND_SETS 83
+#define ID_LBA48_SECTORS 100
+#define ID_SATA_NCQ 0x100
+#define ID_SETS_LBA48 0x400
+
+#define HEADER_CFL 5 // Command FIS length in dwords
+#define HEADER_WRITE (1u << 6)
+#define PRD_BYTES_MASK 0x3FFFFF
+
+#define AHCI_TIMEOUT_NS 1000000000ULL
+
+typedef struct {
+  uint32_t flags; // CFL, W, PRDT length in the top half
+  volatile uint32_t bytes;
+  uint32_t table;
+  uint32_t table_high;
+  uint32_t reserved[4];
+} __attribute__((packed)) ahci_header_t;
+
+typedef struct {
+  uint32_t data;
+  uint32_t data_high;
+  uint32_t reserved;
+  uint32_t count; // Bytes - 1
+} __attribute__((packed)) ahci_prd_t;
+
+typedef struct {
+  uint8_t fis[64];
+  uint8_t atapi[16];
+  uint8_t reserved[48];
+  ahci_prd_t prdt[AHCI_MAX_PRD];
+} __attribute__((packed)) ahci_table_t;
+
+_Static_assert(sizeof(ahci_table_t) % 128 == 0, "tables are 128-byte aligned");
+
+#define TABLE_PAGES                                                            \
+  ((AHCI_MAX_SLOTS * sizeof(ahci_table_t) + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE)
+
+// The command list (1KB) and received FIS area (256 bytes) share a page
+#define FIS_OFFSET 0x400
+
+typedef struct {
+  blk_device_t blk;
+  volatile uint32_t *regs;
+  spinlock_t lock;
+  ahci_header_t *headers;
+  ahci_table_t *tables;
+  uint64_t tables_phys;
+  blk_request_t *slots[AHCI_MAX_SLOTS]; // Batch each busy slot carries
+  uint32_t active;                      // Busy slots
+  int depth;                            // Slots to use
+  bool ncq;
+} ahci_port_t;
+
+static volatile uint32_t *hba = 0;
+static ahci_port_t ports[AHCI_MAX_PORTS];
+static uint32_t port_mask = 0; // Ports with a registered disk
+static bool addr64 = false;
+
+static inline uint32_t hba_read(uint32_t reg) { return hba[reg / 4]; }
+
+static inline void hba_write(uint32_t reg, uint32_t value) {
+  hba[reg / 4] = value;
+}
+
+static inline uint32_t port_read(const ahci_port_t *p, uint32_t reg) {
+  return p->regs[reg / 4];
+}
+
+static inline void port_write(ahci_port_t *p, uint32_t reg, uint32_t value) {
+  p->regs[reg / 4] = value;
+}
+
+static bool wait_clear(ahci_port_t *p, uint32_t reg, uint32_t bits) {
+  uint64_t deadline = timer_now_ns() + AHCI_TIMEOUT_NS;
+  while (port_read(p, reg) & bits)
+    if (timer_now_ns() > deadline)
+      return false;
+  return true;
+}
+
+static bool stop_port(ahci_port_t *p) {
+  port_write(p, PORT_CMD, port_read(p, PORT_CMD) & ~CMD_ST);
+  if (!wait_clear(p, PORT_CMD, CMD_CR))
+    return false;
+  port_write(p, PORT_CMD, port_read(p, PORT_CMD) & ~CMD_FRE);
+  return wait_clear(p, PORT_CMD, CMD_FR);
+}
+
+static bool start_port(ahci_port_t *p) {
+  port_write(p, PORT_SERR, 0xFFFFFFFF);
+  port_write(p, PORT_IS, 0xFFFFFFFF);
+  port_write(p, PORT_CMD, port_read(p, PORT_CMD) | CMD_FRE);
+  if (!wait_clear(p, PORT_TFD, TFD_BSY | TFD_DRQ))
+    return false;
+  port_write(p, PORT_CMD, port_read(p, PORT_CMD) | CMD_ST);
+  return true;
+}
+
+// Fill a slot's command FIS and PRD table, returns false if the buffers
+// can't be described (too many pieces, or out of the HBA's reach)
+static bool build_command(ahci_port_t *p, int slot, uint8_t command,
+                          const blk_request_t *batch, uint64_t lba,
+                          uint32_t sectors, bool queued) {
+  ahci_table_t *table = &p->tables[slot];
+  blk_segment_t segments[AHCI_MAX_PRD];
+  int count = blk_batch_segments(batch, segments, AHCI_MAX_PRD);
+  if (count <= 0)
+    return false;
+  for (int i = 0; i < count; i++) {
+    if (!addr64 && segments[i].phys + segments[i].length > 0x100000000ULL)
+      return false;
+    table->prdt[i].data = (uint32_t)segments[i].phys;
+    table->prdt[i].data_high = (uint32_t)(segments[i].phys >> 32);
+    table->prdt[i].reserved = 0;
+    table->prdt[i].count = (segments[i].length - 1) & PRD_BYTES_MASK;
+  }
+
+  uint8_t *fis = table->fis;
+  memset(fis, 0, 20);
+  fis[0] = FIS_TYPE_H2D;
+  fis[1] = FIS_H2D_COMMAND;
+  fis[2] = command;
+  fis[4] = lba;
+  fis[5] = lba >> 8;
+  fis[6] = lba >> 16;
+  fis[7] = FIS_DEVICE_LBA;
+  fis[8] = lba >> 24;
+  fis[9] = lba >> 32;
+  fis[10] = lba >> 40;
+  if (queued) {
+    // First party DMA: the count goes in the features, the tag in count
+    fis[3] = sectors;
+    fis[11] = sectors >> 8;
+    fis[12] = slot << 3;
+  } else {
+    fis[12] = sectors;
+    fis[13] = sectors >> 8;
+  }
+
+  ahci_header_t *header = &p->headers[slot];
+  header->flags = HEADER_CFL | (uint32_t)count << 16 |
+                  (batch->op == BLK_WRITE ? HEADER_WRITE : 0);
+  header->bytes = 0;
+  return true;
+}
+
+static void port_kick(ahci_port_t *p) {
+  uint64_t flags = spin_lock_irqsave(&p->lock);
+  for (;;) {
+    uint32_t free = ~p->active & ((1ULL << p->depth) - 1);
+    if (!free)
+      break;
+    blk_request_t *batch = blk_next_batch(&p->blk);
+    if (!batch)
+      break;
+
+    int slot = __builtin_ctz(free);
+    uint32_t sectors = 0;
+    for (blk_request_t *r = batch; r; r = r->next)
+      sectors += r->count;
+    uint8_t command;
+    if (p->ncq)
+      command = batch->op == BLK_READ ? ATA_CMD_READ_FPDMA : ATA_CMD_WRITE_FPDMA;
+    else
+      command =
+          batch->op == BLK_READ ? ATA_CMD_READ_DMA_EXT : ATA_CMD_WRITE_DMA_EXT;
+    if (!build_command(p, slot, command, batch, batch->lba, sectors, p->ncq)) {
+      blk_complete(&p->blk, batch, BLK_EIO);
+      continue;
+    }
+
+    p->slots[slot] = batch;
+    p->active |= 1u << slot;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // Tables before the doorbell
+    if (p->ncq)
+      port_write(p, PORT_SACT, 1u << slot);
+    port_write(p, PORT_CI, 1u << slot);
+  }
+  spin_unlock_irqrestore(&p->lock, flags);
+}
+
+static void ahci_kick(blk_device_t *dev) { port_kick(dev->driver); }
+
+static void port_irq(ahci_port_t *p) {
+  blk_request_t *done[AHCI_MAX_SLOTS];
+  int status[AHCI_MAX_SLOTS];
+  int count = 0;
+
+  uint64_t flags = spin_lock_irqsave(&p->lock);
+  uint32_t is = port_read(p, PORT_IS);
+  port_write(p, PORT_IS, is);
+
+  uint32_t finished;
+  int result = BLK_OK;
+  if (is & IS_ERRORS) {
+    // The port stops on an error; which command failed matters less than
+    // getting it going again, so everything in flight fails with it
+    finished = p->active;
+    result = BLK_EIO;
+    stop_port(p);
+    start_port(p);
+  } else {
+    finished = p->active & ~(port_read(p, PORT_SACT) | port_read(p, PORT_CI));
+  }
+  while (finished) {
+    int slot = __builtin_ctz(finished);
+    finished &= finished - 1;
+    done[count] = p->slots[slot];
+    status[count++] = result;
+    p->slots[slot] = 0;
+    p->active &= ~(1u << slot);
+  }
+  spin_unlock_irqrestore(&p->lock, flags);
+
+  for (int i = 0; i < count; i++)
+    blk_complete(&p->blk, done[i], status[i]);
+  if (count)
+    port_kick(p);
+}
+
+static void ahci_irq(Registers *regs) {
+  (void)regs;
+  uint32_t pending = hba_read(HBA_IS);
+  for (uint32_t bits = pending & port_mask; bits; bits &= bits - 1)
+    port_irq(&ports[__builtin_ctz(bits)]);
+  hba_write(HBA_IS, pending);
+}
+
+// Run IDENTIFY in slot 0 by polling, before the port's interrupts are on
+static bool identify(ahci_port_t *p, uint16_t *id) {
+  uint64_t page = pmm_alloc_page();
+  if (!page)
+    return false;
+  blk_request_t probe = {0};
+  probe.count = 1;
+  probe.buffer = (void *)(uintptr_t)page;
+  bool ok = build_command(p, 0, ATA_CMD_IDENTIFY, &probe, 0, 0, false);
+  if (ok) {
+    port_write(p, PORT_CI, 1);
+    ok = wait_clear(p, PORT_CI, 1) && !(port_read(p, PORT_TFD) & TFD_ERR) &&
+         !(port_read(p, PORT_IS) & IS_ERRORS);
+  }
+  if (ok)
+    memcpy(id, (const void *)(uintptr_t)page, 256 * sizeof(*id));
+  pmm_free_page(page);
+  return ok;
+}
+
+static bool setup_port(ahci_port_t *p, int index, int slots) {
+  uint32_t ssts = port_read(p, PORT_SSTS);
+  if ((ssts & SSTS_DET_MASK) != SSTS_DET_PRESENT ||
+      ((ssts >> SSTS_IPM_SHIFT) & SSTS_IPM_MASK) != SSTS_IPM_ACTIVE ||
+      port_read(p, PORT_SIG) != SIG_ATA)
+    return false;
+  if (!stop_port(p))
+    return false;
+
+  uint64_t list = pmm_alloc_page();
+  uint64_t tables = pmm_alloc_pages(TABLE_PAGES);
+  if (!list || !tables)
+    return false;
+  memset((void *)(uintptr_t)list, 0, PMM_PAGE_SIZE);
+  memset((void *)(uintptr_t)tables, 0, TABLE_PAGES * PMM_PAGE_SIZE);
+  p->headers = (ahci_header_t *)(uintptr_t)list;
+  p->tables = (ahci_table_t *)(uintptr_t)tables;
+  p->tables_phys = tables;
+  for (int slot = 0; slot < AHCI_MAX_SLOTS; slot++) {
+    uint64_t table = tables + slot * sizeof(ahci_table_t);
+    p->headers[slot].table = (uint32_t)table;
+    p->headers[slot].table_high = (uint32_t)(table >> 32);
+  }
+  uint64_t fis = list + FIS_OFFSET;
+  port_write(p, PORT_CLB, (uint32_t)list);
+  port_write(p, PORT_CLBU, (uint32_t)(list >> 32));
+  port_write(p, PORT_FB, (uint32_t)fis);
+  port_write(p, PORT_FBU, (uint32_t)(fis >> 32));
+  port_write(p, PORT_IE, 0);
+  if (!start_port(p))
+    return false;
+
+  uint16_t id[256];
+  if (!identify(p, id) || !(id[ID_COMMAND_SETS] & ID_SETS_LBA48))
+    return false;
+  uint64_t sectors = (uint64_t)id[ID_LBA48_SECTORS] |
+                     (uint64_t)id[ID_LBA48_SECTORS + 1] << 16 |
+                     (uint64_t)id[ID_LBA48_SECTORS + 2] << 32 |
+                     (uint64_t)id[ID_LBA48_SECTORS + 3] << 48;
+  if (!sectors)
+    return false;
+
+  p->ncq = (hba_read(HBA_CAP) & CAP_NCQ) && (id[ID_SATA_CAPS] & ID_SATA_NCQ);
+  p->depth = 1;
+  if (p->ncq) {
+    p->depth = (id[ID_QUEUE_DEPTH] & 0x1F) + 1;
+    if (p->depth > slots)
+      p->depth = slots;
+  }
+  p->lock = (spinlock_t)SPINLOCK_INIT;
+  p->active = 0;
+
+  blk_device_t *blk = &p->blk;
+  const char *prefix = "ahci";
+  int n = 0;
+  while (prefix[n]) {
+    blk->name[n] = prefix[n];
+    n++;
+  }
+  if (index >= 10)
+    blk->name[n++] = '0' + index / 10;
+  blk->name[n++] = '0' + index % 10;
+  blk->name[n] = '\0';
+  blk->sectors = sectors;
+  blk->max_sectors = AHCI_MAX_SECTORS;
+  blk->max_segments = AHCI_MAX_PRD;
+  blk->kick = ahci_kick;
+  blk->driver = p;
+  if (!blk_register(blk))
+    return false;
+
+  port_write(p, PORT_IS, 0xFFFFFFFF);
+  port_write(p, PORT_IE, IS_ENABLED);
+  return true;
+}
+
+void ahci_init(void) {
+  const pci_device_t *pci = pci_find_class(PCI_CLASS_STORAGE,
+                                           PCI_SUBCLASS_SATA, 0);
+  if (!pci)
+    return;
+  bool io;
+  uint64_t abar = pci_bar(pci, 5, &io);
+  if (!abar || io)
+    return;
+
+  if (!paging_map(abar, abar, HBA_MAP_SIZE, PAGE_RW | PAGE_CACHE_UC))
+    return;
+  hba = (volatile uint32_t *)(uintptr_t)abar;
+  pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+  // Completions need an interrupt: a vector of our own over MSI, or the
+  // legacy line when the controller (or the APIC) can't do that
+  int vector = -1;
+  if (apic_enabled() && pci_find_capability(pci, PCI_CAP_MSI)) {
+    vector = pci_alloc_vector(ahci_irq);
+    if (vector >= 0 && !pci_enable_msi(pci, vector))
+      vector = -1;
+  }
+  if (vector < 0) {
+    if (pci->irq_line >= 16)
+      return;
+    register_interrupt_handler(IRQ_BASE_VECTOR + pci->irq_line, ahci_irq);
+  }
+
+  hba_write(HBA_GHC, hba_read(HBA_GHC) | GHC_AE);
+
+  uint32_t cap = hba_read(HBA_CAP);
+  int slots = ((cap >> CAP_SLOTS_SHIFT) & CAP_SLOTS_MASK) + 1;
+  addr64 = (cap & CAP_64BIT) != 0;
+
+  uint32_t implemented = hba_read(HBA_PI);
+  int disks = 0;
+  for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+    if (!(implemented & (1u << i)))
+      continue;
+    ahci_port_t *p = &ports[i];
+    p->regs = hba + (HBA_PORTS + i * HBA_PORT_STRIDE) / 4;
+    if (setup_port(p, disks, slots)) {
+      port_mask |= 1u << i;
+      disks++;
+    }
+  }
+
+  hba_write(HBA_IS, 0xFFFFFFFF);
+  if (disks)
+    hba_write(HBA_GHC, hba_read(HBA_GHC) | GHC_IE);
+}
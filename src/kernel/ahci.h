@@ -0,0 +1,15 @@
+#pragma once
+#include "stdint.h"
+
+// SATA disks behind an AHCI controller. Every port with a disk becomes a
+// block device ("ahci0" and up) that keeps up to 32 commands in flight
+// with native command queuing, or one at a time on disks without it.
+// Completions come in on a message signalled interrupt when the
+// controller has MSI, its INTx line otherwise.
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_SLOTS 32
+#define AHCI_MAX_SECTORS 512 // Per command
+#define AHCI_MAX_PRD 64      // Scatter-gather entries per command table
+
+// Find the first controller and register its disks with the block layer
+void ahci_init(void);
@@ -0,0 +1,335 @@
+#include "apic.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "i8259.h"
+#include "idt.h"
+#include "isr.h"
+#include "paging.h"
+#include "timer.h"
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define APIC_BASE_ENABLE (1u << 11)
+#define APIC_BASE_X2APIC (1u << 10)
+#define X2APIC_MSR_BASE 0x800
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_TIMER_DIV16 0x3
+#define TIMER_CALIBRATE_NS 10000000ULL
+
+// IOAPIC registers, selected through IOREGSEL and accessed through IOWIN
+#define IOAPIC_REGSEL 0
+#define IOAPIC_WIN 4 // In 32-bit words
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIR(n) (0x10 + 2 * (n))
+
+#define IOAPIC_ACTIVE_LOW (1u << 13)
+#define IOAPIC_LEVEL (1u << 15)
+#define IOAPIC_MASKED (1u << 16)
+
+// MPS INTI flags in interrupt source overrides
+#define ISO_POLARITY_MASK 0x3
+#define ISO_POLARITY_LOW 0x3
+#define ISO_TRIGGER_MASK 0xC
+#define ISO_TRIGGER_LEVEL 0xC
+
+#define ISA_IRQS 16
+#define ISA_CASCADE_IRQ 2
+
+typedef struct {
+  volatile uint32_t *regs;
+  uint32_t gsi_base;
+  uint32_t gsi_count;
+} ioapic_t;
+
+typedef struct {
+  uint32_t gsi;
+  uint16_t flags;
+} isa_route_t;
+
+static bool enabled = false;
+static bool x2apic = false;
+static volatile uint32_t *lapic = 0;
+
+static uint32_t cpu_ids[APIC_MAX_CPUS];
+static int cpu_count = 0;
+static ioapic_t ioapics[APIC_MAX_IOAPICS];
+static int ioapic_count = 0;
+static isa_route_t isa_routes[ISA_IRQS];
+static uint64_t timer_hz = 0; // Local APIC timer rate after the divider
+
+extern void isr255();
+
+uint32_t lapic_read(uint32_t reg) {
+  if (x2apic)
+    return (uint32_t)rdmsr(X2APIC_MSR_BASE + (reg >> 4));
+  return lapic[reg / 4];
+}
+
+void lapic_write(uint32_t reg, uint32_t value) {
+  if (x2apic)
+    wrmsr(X2APIC_MSR_BASE + (reg >> 4), value);
+  else
+    lapic[reg / 4] = value;
+}
+
+void apic_eoi(void) { lapic_write(LAPIC_EOI, 0); }
+
+uint32_t apic_current_id(void) {
+  uint32_t id = lapic_read(LAPIC_ID);
+  return x2apic ? id : id >> 24;
+}
+
+static uint32_t ioapic_read(const ioapic_t *io, uint32_t reg) {
+  io->regs[IOAPIC_REGSEL] = reg;
+  return io->regs[IOAPIC_WIN];
+}
+
+static void ioapic_write(const ioapic_t *io, uint32_t reg, uint32_t value) {
+  io->regs[IOAPIC_REGSEL] = reg;
+  io->regs[IOAPIC_WIN] = value;
+}
+
+static const ioapic_t *ioapic_for(uint32_t gsi) {
+  for (int i = 0; i < ioapic_count; i++) {
+    const ioapic_t *io = &ioapics[i];
+    if (gsi >= io->gsi_base && gsi < io->gsi_base + io->gsi_count)
+      return io;
+  }
+  return 0;
+}
+
+static void add_cpu(uint32_t apic_id, uint32_t flags) {
+  if (!(flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAPABLE)))
+    return;
+  for (int i = 0; i < cpu_count; i++)
+    if (cpu_ids[i] == apic_id)
+      return;
+  if (cpu_count < APIC_MAX_CPUS)
+    cpu_ids[cpu_count++] = apic_id;
+}
+
+static void parse_madt(const acpi_madt_t *madt, uint64_t *lapic_addr) {
+  *lapic_addr = madt->lapic_addr;
+  for (int irq = 0; irq < ISA_IRQS; irq++) {
+    isa_routes[irq].gsi = irq;
+    isa_routes[irq].flags = 0;
+  }
+
+  const uint8_t *p = (const uint8_t *)(madt + 1);
+  const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+  while (p + sizeof(madt_entry_t) <= end) {
+    const madt_entry_t *e = (const madt_entry_t *)p;
+    if (e->length < sizeof(madt_entry_t) || p + e->length > end)
+      break;
+
+    switch (e->type) {
+    case MADT_LAPIC: {
+      const madt_lapic_t *cpu = (const madt_lapic_t *)e;
+      add_cpu(cpu->apic_id, cpu->flags);
+      break;
+    }
+    case MADT_X2APIC: {
+      const madt_x2apic_t *cpu = (const madt_x2apic_t *)e;
+      add_cpu(cpu->x2apic_id, cpu->flags);
+      break;
+    }
+    case MADT_IOAPIC: {
+      const madt_ioapic_t *io = (const madt_ioapic_t *)e;
+      if (ioapic_count < APIC_MAX_IOAPICS) {
+        ioapics[ioapic_count].regs = (volatile uint32_t *)(uintptr_t)io->addr;
+        ioapics[ioapic_count].gsi_base = io->gsi_base;
+        ioapic_count++;
+      }
+      break;
+    }
+    case MADT_ISO: {
+      const madt_iso_t *iso = (const madt_iso_t *)e;
+      if (iso->bus == 0 && iso->source < ISA_IRQS) {
+        isa_routes[iso->source].gsi = iso->gsi;
+        isa_routes[iso->source].flags = iso->flags;
+      }
+      break;
+    }
+    case MADT_LAPIC_OVERRIDE:
+      *lapic_addr = ((const madt_lapic_override_t *)e)->lapic_addr;
+      break;
+    }
+    p += e->length;
+  }
+}
+
+bool apic_route_irq(uint8_t irq, uint8_t vector, uint32_t dest_apic_id) {
+  if (irq >= ISA_IRQS)
+    return false;
+  const isa_route_t *route = &isa_routes[irq];
+  const ioapic_t *io = ioapic_for(route->gsi);
+  if (!io)
+    return false;
+
+  // ISA lines default to active high, edge triggered
+  uint32_t low = vector;
+  if ((route->flags & ISO_POLARITY_MASK) == ISO_POLARITY_LOW)
+    low |= IOAPIC_ACTIVE_LOW;
+  if ((route->flags & ISO_TRIGGER_MASK) == ISO_TRIGGER_LEVEL)
+    low |= IOAPIC_LEVEL;
+
+  uint32_t pin = route->gsi - io->gsi_base;
+  ioapic_write(io, IOAPIC_REDIR(pin), low | IOAPIC_MASKED);
+  ioapic_write(io, IOAPIC_REDIR(pin) + 1, dest_apic_id << 24);
+  ioapic_write(io, IOAPIC_REDIR(pin), low);
+  return true;
+}
+
+void apic_mask_irq(uint8_t irq, bool masked) {
+  if (irq >= ISA_IRQS)
+    return;
+  const ioapic_t *io = ioapic_for(isa_routes[irq].gsi);
+  if (!io)
+    return;
+  uint32_t reg = IOAPIC_REDIR(isa_routes[irq].gsi - io->gsi_base);
+  uint32_t low = ioapic_read(io, reg);
+  ioapic_write(io, reg, masked ? low | IOAPIC_MASKED : low & ~IOAPIC_MASKED);
+}
+
+void apic_send_ipi(uint32_t dest_apic_id, uint32_t command) {
+  if (x2apic) {
+    // One 64-bit write, no delivery status to wait for
+    wrmsr(X2APIC_MSR_BASE + (LAPIC_ICR_LOW >> 4),
+          ((uint64_t)dest_apic_id << 32) | command);
+    return;
+  }
+  lapic_write(LAPIC_ICR_HIGH, dest_apic_id << 24);
+  lapic_write(LAPIC_ICR_LOW, command);
+  while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+    __asm__ volatile("pause");
+}
+
+// Count down from the maximum for a fixed TSC interval
+static void calibrate_timer(void) {
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+  uint64_t start = timer_now_ns();
+  uint64_t now;
+  while ((now = timer_now_ns()) - start < TIMER_CALIBRATE_NS)
+    __asm__ volatile("pause");
+  uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+  lapic_write(LAPIC_TIMER_INITIAL, 0);
+  timer_hz = (uint64_t)elapsed * 1000000000ULL / (now - start);
+}
+
+bool apic_timer_start(uint64_t period_ns, uint8_t vector) {
+  if (!enabled)
+    return false;
+  if (!timer_hz)
+    calibrate_timer();
+
+  uint64_t count = timer_hz * period_ns / 1000000000ULL;
+  if (!count || count > 0xFFFFFFFF)
+    return false;
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+  lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | vector);
+  lapic_write(LAPIC_TIMER_INITIAL, (uint32_t)count);
+  return true;
+}
+
+bool apic_timer_oneshot(uint64_t delay_ns, uint8_t vector) {
+  if (!enabled || !timer_hz)
+    return false;
+  if (delay_ns > 1000000000ULL)
+    delay_ns = 1000000000ULL;
+  uint64_t count = timer_hz * delay_ns / 1000000000ULL;
+  if (count > 0xFFFFFFFF)
+    count = 0xFFFFFFFF;
+  if (!count)
+    count = 1;
+  lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+  lapic_write(LAPIC_LVT_TIMER, vector);
+  lapic_write(LAPIC_TIMER_INITIAL, (uint32_t)count);
+  return true;
+}
+
+// Spurious interrupts are not acknowledged
+static void spurious_handler(Registers *regs) { (void)regs; }
+
+// Enable the calling CPU's local APIC, in x2APIC mode if the boot CPU chose
+// it (the register window is shared, so only the mode switch is per CPU)
+static void lapic_setup(void) {
+  uint64_t base = rdmsr(IA32_APIC_BASE_MSR) | APIC_BASE_ENABLE;
+  wrmsr(IA32_APIC_BASE_MSR, base);
+  if (x2apic)
+    wrmsr(IA32_APIC_BASE_MSR, base | APIC_BASE_X2APIC);
+
+  // Accept every priority; LINT0 carried the 8259's ExtINT, LINT1 is NMI
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_LVT_LINT1, LAPIC_DELIVERY_NMI);
+  lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+  lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+bool apic_init(void) {
+  if (!cpu_has(CPU_FEATURE_APIC) || !acpi_init())
+    return false;
+  const acpi_madt_t *madt = (const acpi_madt_t *)acpi_find_table("APIC");
+  if (!madt)
+    return false;
+
+  uint64_t lapic_addr;
+  parse_madt(madt, &lapic_addr);
+  if (!ioapic_count)
+    return false;
+
+  // Register windows are device memory, keep the CPU from caching them
+  for (int i = 0; i < ioapic_count; i++) {
+    uint64_t addr = (uint64_t)(uintptr_t)ioapics[i].regs;
+    paging_map(addr, addr, PAGE_SIZE_4K, PAGE_RW | PAGE_CACHE_UC);
+    uint32_t version = ioapic_read(&ioapics[i], IOAPIC_VERSION);
+    ioapics[i].gsi_count = ((version >> 16) & 0xFF) + 1;
+  }
+
+  x2apic = cpu_has(CPU_FEATURE_X2APIC);
+  if (!x2apic) {
+    paging_map(lapic_addr, lapic_addr, PAGE_SIZE_4K, PAGE_RW | PAGE_CACHE_UC);
+    lapic = (volatile uint32_t *)(uintptr_t)lapic_addr;
+  }
+
+  idt_set_gate(APIC_SPURIOUS_VECTOR, (uint64_t)isr255, 0x08, 0x8E);
+  register_interrupt_handler(APIC_SPURIOUS_VECTOR, spurious_handler);
+  lapic_setup();
+
+  // Everything masked, then the ISA lines on their usual vectors to the
+  // boot CPU
+  for (int i = 0; i < ioapic_count; i++)
+    for (uint32_t pin = 0; pin < ioapics[i].gsi_count; pin++)
+      ioapic_write(&ioapics[i], IOAPIC_REDIR(pin), IOAPIC_MASKED);
+  uint32_t bsp = apic_current_id();
+  for (int irq = 0; irq < ISA_IRQS; irq++)
+    if (irq != ISA_CASCADE_IRQ)
+      apic_route_irq(irq, IRQ_BASE_VECTOR + irq, bsp);
+
+  // The 8259 stays remapped so a stray interrupt can't look like an
+  // exception, but it delivers nothing from here on
+  i8259_disable();
+  enabled = true;
+  return true;
+}
+
+void apic_init_cpu(void) {
+  if (enabled)
+    lapic_setup();
+}
+
+bool apic_enabled(void) { return enabled; }
+
+bool apic_is_x2apic(void) { return enabled && x2apic; }
+
+int apic_cpu_count(void) { return cpu_count; }
+
+uint32_t apic_cpu_id(int index) {
+  if (index < 0 || index >= cpu_count)
+    return 0;
+  return cpu_ids[index];
+}
+
+int apic_ioapic_count(void) { return ioapic_count; }
@@ -0,0 +1,77 @@
+#pragma once
+#include "stdint.h"
+
+#define APIC_MAX_CPUS 64
+#define APIC_MAX_IOAPICS 4
+
+// ISA IRQ n arrives on vector IRQ_BASE_VECTOR + n, as it did with the 8259
+#define IRQ_BASE_VECTOR 32
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+// Local APIC registers (MMIO offsets; x2APIC MSR = 0x800 + offset / 16)
+#define LAPIC_ID 0x20
+#define LAPIC_VERSION 0x30
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ESR 0x280
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_DELIVERY_NMI 0x400
+
+// Interrupt command register (low half)
+#define LAPIC_ICR_FIXED 0x000
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_PENDING 0x1000 // Delivery status, xAPIC only
+#define LAPIC_ICR_ASSERT 0x4000
+
+// Parse the MADT, enable this CPU's local APIC (x2APIC when available),
+// route the ISA IRQs through the IOAPIC and mask the 8259. False leaves
+// the 8259 in charge.
+bool apic_init(void);
+// Enable an application processor's local APIC, once apic_init succeeded
+void apic_init_cpu(void);
+bool apic_enabled(void);
+bool apic_is_x2apic(void);
+
+// Acknowledge the interrupt being serviced: one MSR write in x2APIC mode,
+// one uncached store otherwise
+void apic_eoi(void);
+
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t value);
+uint32_t apic_current_id(void);
+
+// Run this CPU's local APIC timer, firing vector every period_ns. The
+// first call measures the timer against the TSC, so it has to come from
+// the boot CPU after timer_init().
+bool apic_timer_start(uint64_t period_ns, uint8_t vector);
+// Fire vector once, delay_ns from now (longer delays are cut to what the
+// counter holds), replacing the periodic timer. Needs apic_timer_start to
+// have calibrated the timer.
+bool apic_timer_oneshot(uint64_t delay_ns, uint8_t vector);
+
+// Send an interprocessor interrupt (LAPIC_ICR_* command and vector) and
+// wait until the local APIC has accepted it
+void apic_send_ipi(uint32_t dest_apic_id, uint32_t command);
+
+// CPUs listed in the MADT, the boot CPU included
+int apic_cpu_count(void);
+uint32_t apic_cpu_id(int index);
+int apic_ioapic_count(void);
+
+// Deliver ISA IRQ irq as vector on the CPU with the given APIC id,
+// honouring the MADT's source overrides
+bool apic_route_irq(uint8_t irq, uint8_t vector, uint32_t dest_apic_id);
+void apic_mask_irq(uint8_t irq, bool masked);
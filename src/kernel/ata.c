@@ -0,0 +1,391 @@
+#include "ata.h"
+#include "apic.h"
+#include "blk.h"
+#include "pci.h"
+#include "pmm.h"
+#include "timer.h"
+
+// Task file registers, from the channel's command block
+#define ATA_REG_DATA 0
+#define ATA_REG_ERROR 1
+#define ATA_REG_COUNT 2
+#define ATA_REG_LBA0 3
+#define ATA_REG_LBA1 4
+#define ATA_REG_LBA2 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+
+#define ATA_CONTROL_NIEN 0x02 // Interrupts off
+
+#define ATA_DRIVE_LBA 0xE0 // LBA addressing, bits 7 and 5 always set
+
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_IDENTIFY 0xEC
+
+// IDENTIFY words
+#define ID_CAPABILITIES 49
+#define ID_LBA28_SECTORS 60
+#define ID_COMMAND_SETS 83
+#define ID_LBA48_SECTORS 100
+#define ID_CAP_DMA 0x100
+#define ID_SETS_LBA48 0x400
+
+// Bus master registers, per channel
+#define BM_COMMAND 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+#define BM_CHANNEL_STRIDE 8
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_TO_MEMORY 0x08 // Device to memory, a disk read
+#define BM_STATUS_ERROR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define PRD_LAST 0x8000
+
+// PCI programming interface: channel in native mode, ports from the BARs
+#define IDE_PRIMARY_NATIVE 0x01
+#define IDE_SECONDARY_NATIVE 0x04
+
+#define ATA_IRQ_PRIMARY 14
+#define ATA_IRQ_SECONDARY 15
+#define ATA_IDENTIFY_TIMEOUT_NS 1000000000ULL
+
+#define LBA28_LIMIT (1ULL << 28)
+
+typedef struct {
+  uint32_t phys;
+  uint16_t length; // 0 means 64KB
+  uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+struct ata_channel;
+
+typedef struct {
+  blk_device_t blk;
+  struct ata_channel *channel;
+  uint8_t drive; // 0 master, 1 slave
+  bool present;
+  bool lba48;
+} ata_drive_t;
+
+typedef struct ata_channel {
+  uint16_t base;
+  uint16_t ctrl;
+  uint16_t bm;
+  spinlock_t lock;
+  ata_prd_t *prdt;
+  uint32_t prdt_phys;
+  ata_drive_t drives[2];
+  ata_drive_t *active;  // Drive the command in flight is for
+  blk_request_t *batch; // The command's requests, 0 when idle
+  int turn;             // Drive to look at first next time
+} ata_channel_t;
+
+static ata_channel_t channels[2];
+static int native_irq = -1; // Line both channels share in native mode
+
+static inline uint8_t inb(uint16_t port) {
+  uint8_t ret;
+  __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+  return ret;
+}
+
+static inline uint16_t inw(uint16_t port) {
+  uint16_t ret;
+  __asm__ volatile("inw %1, %0" : "=a"(ret) : "Nd"(port));
+  return ret;
+}
+
+static inline void outb(uint16_t port, uint8_t val) {
+  __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline void outl(uint16_t port, uint32_t val) {
+  __asm__ volatile("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// Reading the alternate status four times gives the drive its 400ns
+static void ata_delay(const ata_channel_t *ch) {
+  for (int i = 0; i < 4; i++)
+    inb(ch->ctrl);
+}
+
+static bool wait_not_busy(const ata_channel_t *ch, uint64_t deadline) {
+  while (inb(ch->ctrl) & ATA_STATUS_BSY)
+    if (timer_now_ns() > deadline)
+      return false;
+  return true;
+}
+
+static void select_drive(const ata_channel_t *ch, uint8_t drive,
+                         uint8_t lba_high) {
+  outb(ch->base + ATA_REG_DRIVE, ATA_DRIVE_LBA | drive << 4 | lba_high);
+  ata_delay(ch);
+}
+
+// Load the task file and issue a DMA command. The bus master is set up
+// but not started yet.
+static void issue(ata_channel_t *ch, const ata_drive_t *d, int op,
+                  uint64_t lba, uint32_t sectors) {
+  uint16_t base = ch->base;
+  uint8_t command;
+  if (d->lba48) {
+    select_drive(ch, d->drive, 0);
+    outb(base + ATA_REG_COUNT, sectors >> 8);
+    outb(base + ATA_REG_LBA0, lba >> 24);
+    outb(base + ATA_REG_LBA1, lba >> 32);
+    outb(base + ATA_REG_LBA2, lba >> 40);
+    outb(base + ATA_REG_COUNT, sectors);
+    outb(base + ATA_REG_LBA0, lba);
+    outb(base + ATA_REG_LBA1, lba >> 8);
+    outb(base + ATA_REG_LBA2, lba >> 16);
+    command = op == BLK_READ ? ATA_CMD_READ_DMA_EXT : ATA_CMD_WRITE_DMA_EXT;
+  } else {
+    select_drive(ch, d->drive, (lba >> 24) & 0x0F);
+    outb(base + ATA_REG_COUNT, sectors); // 256 wraps to 0, which means 256
+    outb(base + ATA_REG_LBA0, lba);
+    outb(base + ATA_REG_LBA1, lba >> 8);
+    outb(base + ATA_REG_LBA2, lba >> 16);
+    command = op == BLK_READ ? ATA_CMD_READ_DMA : ATA_CMD_WRITE_DMA;
+  }
+  outb(base + ATA_REG_COMMAND, command);
+}
+
+// Build the PRD table for a batch, false if a buffer can't be reached by
+// the 32-bit bus master
+static bool load_prdt(ata_channel_t *ch, const blk_request_t *batch) {
+  blk_segment_t segments[ATA_MAX_PRD];
+  int count = blk_batch_segments(batch, segments, ATA_MAX_PRD);
+  if (count <= 0)
+    return false;
+  for (int i = 0; i < count; i++) {
+    if (segments[i].phys + segments[i].length > 0x100000000ULL)
+      return false;
+    ch->prdt[i].phys = (uint32_t)segments[i].phys;
+    ch->prdt[i].length = (uint16_t)segments[i].length;
+    ch->prdt[i].flags = i == count - 1 ? PRD_LAST : 0;
+  }
+  return true;
+}
+
+// Start the next batch of either drive if the channel is idle
+static void channel_start(ata_channel_t *ch) {
+  uint64_t flags = spin_lock_irqsave(&ch->lock);
+  while (!ch->batch) {
+    ata_drive_t *d = 0;
+    blk_request_t *batch = 0;
+    for (int i = 0; i < 2 && !batch; i++) {
+      d = &ch->drives[(ch->turn + i) & 1];
+      if (d->present)
+        batch = blk_next_batch(&d->blk);
+    }
+    if (!batch)
+      break;
+
+    if (!load_prdt(ch, batch)) {
+      blk_complete(&d->blk, batch, BLK_EIO);
+      continue;
+    }
+    uint32_t sectors = 0;
+    for (blk_request_t *r = batch; r; r = r->next)
+      sectors += r->count;
+
+    ch->batch = batch;
+    ch->active = d;
+    ch->turn = d->drive ^ 1;
+
+    uint8_t direction = batch->op == BLK_READ ? BM_COMMAND_TO_MEMORY : 0;
+    outb(ch->bm + BM_COMMAND, direction);
+    outl(ch->bm + BM_PRDT, ch->prdt_phys);
+    outb(ch->bm + BM_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+    issue(ch, d, batch->op, batch->lba, sectors);
+    outb(ch->bm + BM_COMMAND, direction | BM_COMMAND_START);
+  }
+  spin_unlock_irqrestore(&ch->lock, flags);
+}
+
+static void ata_kick(blk_device_t *dev) {
+  ata_drive_t *d = dev->driver;
+  channel_start(d->channel);
+}
+
+static void channel_irq(ata_channel_t *ch) {
+  if (!ch->bm)
+    return;
+  uint64_t flags = spin_lock_irqsave(&ch->lock);
+  uint8_t bm_status = inb(ch->bm + BM_STATUS);
+  if (!(bm_status & BM_STATUS_IRQ)) {
+    // Not this channel, or nothing we started (reading status acks it)
+    if (!ch->batch && native_irq < 0)
+      inb(ch->base + ATA_REG_STATUS);
+    spin_unlock_irqrestore(&ch->lock, flags);
+    return;
+  }
+
+  outb(ch->bm + BM_COMMAND, 0);
+  uint8_t status = inb(ch->base + ATA_REG_STATUS);
+  outb(ch->bm + BM_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+  blk_request_t *batch = ch->batch;
+  ata_drive_t *d = ch->active;
+  ch->batch = 0;
+  spin_unlock_irqrestore(&ch->lock, flags);
+
+  if (!batch)
+    return;
+  bool failed = (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) ||
+                (bm_status & BM_STATUS_ERROR);
+  blk_complete(&d->blk, batch, failed ? BLK_EIO : BLK_OK);
+  channel_start(ch);
+}
+
+static void primary_irq(Registers *regs) {
+  (void)regs;
+  channel_irq(&channels[0]);
+}
+
+static void secondary_irq(Registers *regs) {
+  (void)regs;
+  channel_irq(&channels[1]);
+}
+
+static void native_irq_handler(Registers *regs) {
+  (void)regs;
+  channel_irq(&channels[0]);
+  channel_irq(&channels[1]);
+}
+
+// PIO IDENTIFY with the channel's interrupt off, false for an empty slot
+// or a packet (ATAPI) device
+static bool identify(ata_channel_t *ch, uint8_t drive, uint16_t *id) {
+  uint64_t deadline = timer_now_ns() + ATA_IDENTIFY_TIMEOUT_NS;
+  select_drive(ch, drive, 0);
+  outb(ch->base + ATA_REG_COUNT, 0);
+  outb(ch->base + ATA_REG_LBA0, 0);
+  outb(ch->base + ATA_REG_LBA1, 0);
+  outb(ch->base + ATA_REG_LBA2, 0);
+  outb(ch->base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+  ata_delay(ch);
+
+  uint8_t status = inb(ch->base + ATA_REG_STATUS);
+  if (status == 0 || status == 0xFF || !wait_not_busy(ch, deadline))
+    return false;
+  if (inb(ch->base + ATA_REG_LBA1) || inb(ch->base + ATA_REG_LBA2))
+    return false;
+  while (!((status = inb(ch->ctrl)) & (ATA_STATUS_DRQ | ATA_STATUS_ERR)))
+    if (timer_now_ns() > deadline)
+      return false;
+  if (status & ATA_STATUS_ERR)
+    return false;
+
+  for (int i = 0; i < 256; i++)
+    id[i] = inw(ch->base + ATA_REG_DATA);
+  return true;
+}
+
+static void probe_channel(ata_channel_t *ch, int index) {
+  uint64_t page = pmm_alloc_page();
+  if (!page || page >= 0x100000000ULL)
+    return;
+  ch->prdt = (ata_prd_t *)(uintptr_t)page;
+  ch->prdt_phys = (uint32_t)page;
+  ch->lock = (spinlock_t)SPINLOCK_INIT;
+
+  outb(ch->ctrl, ATA_CONTROL_NIEN);
+  int found = 0;
+  for (uint8_t drive = 0; drive < 2; drive++) {
+    uint16_t id[256];
+    ata_drive_t *d = &ch->drives[drive];
+    d->channel = ch;
+    d->drive = drive;
+    if (!identify(ch, drive, id) || !(id[ID_CAPABILITIES] & ID_CAP_DMA))
+      continue;
+
+    d->lba48 = (id[ID_COMMAND_SETS] & ID_SETS_LBA48) != 0;
+    uint64_t sectors = (uint64_t)id[ID_LBA28_SECTORS] |
+                       (uint64_t)id[ID_LBA28_SECTORS + 1] << 16;
+    if (d->lba48)
+      sectors = (uint64_t)id[ID_LBA48_SECTORS] |
+                (uint64_t)id[ID_LBA48_SECTORS + 1] << 16 |
+                (uint64_t)id[ID_LBA48_SECTORS + 2] << 32 |
+                (uint64_t)id[ID_LBA48_SECTORS + 3] << 48;
+    else if (sectors > LBA28_LIMIT)
+      sectors = LBA28_LIMIT;
+    if (!sectors)
+      continue;
+
+    blk_device_t *blk = &d->blk;
+    blk->name[0] = 'a';
+    blk->name[1] = 't';
+    blk->name[2] = 'a';
+    blk->name[3] = '0' + index * 2 + drive;
+    blk->name[4] = '\0';
+    blk->sectors = sectors;
+    blk->max_sectors = ATA_MAX_SECTORS;
+    blk->max_segments = ATA_MAX_PRD;
+    blk->kick = ata_kick;
+    blk->driver = d;
+    if (blk_register(blk)) {
+      d->present = true;
+      found++;
+    }
+  }
+
+  if (found)
+    outb(ch->ctrl, 0);
+  else
+    ch->bm = 0;
+}
+
+void ata_init(void) {
+  const pci_device_t *pci = pci_find_class(PCI_CLASS_STORAGE,
+                                           PCI_SUBCLASS_IDE, 0);
+  if (!pci)
+    return;
+  bool io;
+  uint64_t bm = pci_bar(pci, 4, &io);
+  if (!bm || !io)
+    return; // No bus master, PIO only
+  pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  for (int i = 0; i < 2; i++) {
+    ata_channel_t *ch = &channels[i];
+    bool native =
+        (pci->prog_if & (i ? IDE_SECONDARY_NATIVE : IDE_PRIMARY_NATIVE)) != 0;
+    if (native) {
+      bool cmd_io, ctrl_io;
+      ch->base = (uint16_t)pci_bar(pci, i * 2, &cmd_io);
+      ch->ctrl = (uint16_t)pci_bar(pci, i * 2 + 1, &ctrl_io) + 2;
+      if (!cmd_io || !ctrl_io || !ch->base)
+        continue;
+    } else {
+      ch->base = i ? 0x170 : 0x1F0;
+      ch->ctrl = i ? 0x376 : 0x3F6;
+    }
+    ch->bm = (uint16_t)bm + i * BM_CHANNEL_STRIDE;
+
+    // Handlers first: a stray interrupt has to find a channel to ack
+    if (native && pci->irq_line < 16) {
+      if (native_irq < 0) {
+        native_irq = pci->irq_line;
+        register_interrupt_handler(IRQ_BASE_VECTOR + native_irq,
+                                   native_irq_handler);
+      }
+    } else if (!native) {
+      register_interrupt_handler(
+          IRQ_BASE_VECTOR + (i ? ATA_IRQ_SECONDARY : ATA_IRQ_PRIMARY),
+          i ? secondary_irq : primary_irq);
+    } else {
+      continue; // Native with no line we can take
+    }
+    probe_channel(ch, i);
+  }
+}
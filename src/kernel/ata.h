@@ -0,0 +1,12 @@
+#pragma once
+#include "stdint.h"
+
+// Parallel ATA disks on the first IDE controller, moved by its bus master
+// DMA engine. Each channel runs one command at a time for both its drives
+// and finishes it from the channel's interrupt. Disks appear as "ata0"
+// (primary master) to "ata3" (secondary slave).
+#define ATA_MAX_SECTORS 256 // Per command, the most LBA28 can ask for
+#define ATA_MAX_PRD 64      // Physical region descriptors per command
+
+// Find the controller and register its disks with the block layer
+void ata_init(void);
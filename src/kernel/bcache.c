@@ -0,0 +1,402 @@
+#include "bcache.h"
+#include "pmm.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "string.h"
+#include "timer.h"
+
+#define HASH_MASK (BCACHE_HASH_SIZE - 1)
+
+// Where the last read of each device was, to spot sequential readers
+typedef struct {
+  blk_device_t *dev;
+  uint64_t last;     // Block last asked for
+  uint64_t ahead_to; // Read-ahead has been started up to here
+} stream_t;
+
+static bcache_buf_t buffers[BCACHE_BUFFERS];
+static bcache_buf_t *hash[BCACHE_HASH_SIZE];
+static bcache_buf_t *lru_head = 0; // Coldest unheld buffer
+static bcache_buf_t *lru_tail = 0;
+static stream_t streams[BLK_MAX_DEVICES];
+static uint32_t used = 0; // Buffers that have a page
+static volatile uint32_t writes_in_flight = 0;
+static bcache_stats_t stats;
+
+// One lock for the hash, the LRU list and every buffer's flags and refs.
+// It is never held across a call into the block layer, whose completions
+// take it from interrupt context.
+static spinlock_t lock = SPINLOCK_INIT;
+static wait_queue_t waiters = WAIT_QUEUE_INIT;
+
+static inline uint32_t hash_of(const blk_device_t *dev, uint64_t block) {
+  uint64_t key = (uint64_t)(uintptr_t)dev ^ (block * 0x9E3779B97F4A7C15ULL);
+  return (uint32_t)(key >> 32) & HASH_MASK;
+}
+
+static uint64_t device_blocks(const blk_device_t *dev) {
+  return (dev->sectors + BCACHE_SECTORS - 1) / BCACHE_SECTORS;
+}
+
+static void lru_remove(bcache_buf_t *b) {
+  if (b->lru_prev)
+    b->lru_prev->lru_next = b->lru_next;
+  else
+    lru_head = b->lru_next;
+  if (b->lru_next)
+    b->lru_next->lru_prev = b->lru_prev;
+  else
+    lru_tail = b->lru_prev;
+  b->lru_prev = b->lru_next = 0;
+}
+
+static void lru_append(bcache_buf_t *b) {
+  b->lru_next = 0;
+  b->lru_prev = lru_tail;
+  if (lru_tail)
+    lru_tail->lru_next = b;
+  else
+    lru_head = b;
+  lru_tail = b;
+}
+
+static void hash_remove(bcache_buf_t *b) {
+  bcache_buf_t **link = &hash[hash_of(b->dev, b->block)];
+  while (*link && *link != b)
+    link = &(*link)->hash_next;
+  if (*link)
+    *link = b->hash_next;
+  b->hash_next = 0;
+}
+
+static bcache_buf_t *lookup(const blk_device_t *dev, uint64_t block) {
+  for (bcache_buf_t *b = hash[hash_of(dev, block)]; b; b = b->hash_next)
+    if (b->dev == dev && b->block == block)
+      return b;
+  return 0;
+}
+
+static void hold(bcache_buf_t *b) {
+  if (b->refs++ == 0)
+    lru_remove(b);
+}
+
+static void put(bcache_buf_t *b) {
+  if (--b->refs == 0)
+    lru_append(b);
+}
+
+// A buffer to reuse for a new block: a fresh one while there are frames
+// left, then the coldest one that is clean and idle. 0 if there is none.
+static bcache_buf_t *take_victim(void) {
+  if (used < BCACHE_BUFFERS) {
+    uint64_t page = pmm_alloc_page();
+    if (page) {
+      bcache_buf_t *b = &buffers[used++];
+      b->data = (uint8_t *)(uintptr_t)page;
+      return b;
+    }
+  }
+  for (bcache_buf_t *b = lru_head; b; b = b->lru_next) {
+    if (b->flags & (BCACHE_DIRTY | BCACHE_WRITING | BCACHE_BUSY))
+      continue;
+    lru_remove(b);
+    hash_remove(b);
+    stats.evictions++;
+    return b;
+  }
+  return 0;
+}
+
+// Held buffer for (dev, block), cached or newly claimed (flags 0). Lock held.
+static bcache_buf_t *get_locked(blk_device_t *dev, uint64_t block, bool *hit) {
+  bcache_buf_t *b = lookup(dev, block);
+  *hit = b != 0;
+  if (b) {
+    hold(b);
+    return b;
+  }
+  b = take_victim();
+  if (!b)
+    return 0;
+  b->dev = dev;
+  b->block = block;
+  b->flags = 0;
+  b->refs = 1;
+  uint32_t h = hash_of(dev, block);
+  b->hash_next = hash[h];
+  hash[h] = b;
+  return b;
+}
+
+static void wait_clear(bcache_buf_t *b, uint32_t bits) {
+  if (sched_can_block()) {
+    WAIT_EVENT(&waiters, !(__atomic_load_n(&b->flags, __ATOMIC_ACQUIRE) & bits));
+  } else {
+    while (__atomic_load_n(&b->flags, __ATOMIC_ACQUIRE) & bits)
+      __asm__ volatile("pause");
+  }
+}
+
+static void read_done(blk_request_t *req) {
+  bcache_buf_t *b = req->arg;
+  uint64_t flags = spin_lock_irqsave(&lock);
+  uint32_t f = b->flags & ~BCACHE_BUSY;
+  if (req->status == BLK_OK)
+    f |= BCACHE_VALID;
+  else
+    stats.errors++;
+  b->flags = f;
+  put(b); // The read's own hold
+  spin_unlock_irqrestore(&lock, flags);
+  wait_queue_wake_all(&waiters);
+}
+
+static void write_done(blk_request_t *req) {
+  bcache_buf_t *b = req->arg;
+  uint64_t flags = spin_lock_irqsave(&lock);
+  b->flags &= ~BCACHE_WRITING;
+  if (req->status != BLK_OK)
+    stats.errors++;
+  put(b);
+  writes_in_flight--;
+  spin_unlock_irqrestore(&lock, flags);
+  wait_queue_wake_all(&waiters);
+}
+
+// Start filling a BUSY buffer. The request holds its own reference.
+static void start_io(bcache_buf_t *b, int op, blk_done_t done) {
+  uint64_t lba = b->block * BCACHE_SECTORS;
+  uint64_t count = b->dev->sectors - lba;
+  if (count > BCACHE_SECTORS)
+    count = BCACHE_SECTORS;
+  if (op == BLK_READ && count < BCACHE_SECTORS)
+    memset(b->data + count * BLK_SECTOR_SIZE, 0,
+           (BCACHE_SECTORS - count) * BLK_SECTOR_SIZE);
+
+  blk_request_t *req = &b->req;
+  req->dev = b->dev;
+  req->lba = lba;
+  req->count = (uint32_t)count;
+  req->op = op;
+  req->buffer = b->data;
+  req->done = done;
+  req->arg = b;
+  if (blk_submit(req) != BLK_OK)
+    done(req); // Rejected requests never complete on their own
+}
+
+// Claim and start reading the blocks after a sequential reader
+static void read_ahead(blk_device_t *dev, uint64_t block) {
+  bcache_buf_t *started[BCACHE_READAHEAD_BLOCKS];
+  int count = 0;
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  stream_t *s = 0;
+  for (int i = 0; i < BLK_MAX_DEVICES && !s; i++)
+    if (streams[i].dev == dev || !streams[i].dev)
+      s = &streams[i];
+  if (!s) {
+    spin_unlock_irqrestore(&lock, flags);
+    return;
+  }
+  bool sequential = s->dev == dev && block == s->last + 1;
+  s->dev = dev;
+  s->last = block;
+  if (sequential) {
+    uint64_t from = s->ahead_to > block + 1 ? s->ahead_to : block + 1;
+    uint64_t to = block + 1 + BCACHE_READAHEAD_BLOCKS;
+    if (to > device_blocks(dev))
+      to = device_blocks(dev);
+    for (uint64_t n = from; n < to; n++) {
+      if (lookup(dev, n))
+        continue;
+      bool hit;
+      bcache_buf_t *b = get_locked(dev, n, &hit);
+      if (!b)
+        break;
+      b->flags = BCACHE_BUSY | BCACHE_READAHEAD;
+      started[count++] = b;
+      s->ahead_to = n + 1;
+    }
+    stats.readahead += count;
+  }
+  spin_unlock_irqrestore(&lock, flags);
+
+  for (int i = 0; i < count; i++)
+    start_io(started[i], BLK_READ, read_done);
+}
+
+bcache_buf_t *bread(blk_device_t *dev, uint64_t block) {
+  if (!dev || block >= device_blocks(dev))
+    return 0;
+
+  bcache_buf_t *b = 0;
+  bool hit = false;
+  for (int attempt = 0; attempt < 2 && !b; attempt++) {
+    // Every buffer dirty: write them back once, then try again
+    if (attempt)
+      bcache_sync(0);
+    uint64_t flags = spin_lock_irqsave(&lock);
+    b = get_locked(dev, block, &hit);
+    if (b) {
+      stats.lookups++;
+      if (hit)
+        stats.hits++;
+      if (b->flags & BCACHE_READAHEAD) {
+        b->flags &= ~BCACHE_READAHEAD;
+        stats.readahead_hits++;
+      }
+      // A block not there yet (new, or an earlier read failed)
+      if (!(b->flags & (BCACHE_VALID | BCACHE_BUSY))) {
+        b->flags |= BCACHE_BUSY;
+        hold(b);
+        hit = false;
+      } else {
+        hit = true;
+      }
+    }
+    spin_unlock_irqrestore(&lock, flags);
+  }
+  if (!b)
+    return 0;
+
+  if (!hit)
+    start_io(b, BLK_READ, read_done);
+  read_ahead(dev, block);
+  wait_clear(b, BCACHE_BUSY);
+  if (!(b->flags & BCACHE_VALID)) {
+    brelse(b);
+    return 0;
+  }
+  return b;
+}
+
+void brelse(bcache_buf_t *b) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  put(b);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void bdirty(bcache_buf_t *b) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (!(b->flags & BCACHE_DIRTY))
+    stats.dirty++;
+  b->flags |= BCACHE_DIRTY;
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+int bcache_read(blk_device_t *dev, uint64_t lba, uint32_t count,
+                void *buffer) {
+  uint8_t *out = buffer;
+  while (count) {
+    uint64_t block = lba / BCACHE_SECTORS;
+    uint32_t first = lba % BCACHE_SECTORS;
+    uint32_t n = BCACHE_SECTORS - first;
+    if (n > count)
+      n = count;
+    bcache_buf_t *b = bread(dev, block);
+    if (!b)
+      return BLK_EIO;
+    memcpy(out, b->data + first * BLK_SECTOR_SIZE, n * BLK_SECTOR_SIZE);
+    brelse(b);
+    out += n * BLK_SECTOR_SIZE;
+    lba += n;
+    count -= n;
+  }
+  return BLK_OK;
+}
+
+int bcache_write(blk_device_t *dev, uint64_t lba, uint32_t count,
+                 const void *buffer) {
+  const uint8_t *in = buffer;
+  if (!dev || lba >= dev->sectors || count > dev->sectors - lba)
+    return BLK_EINVAL;
+  while (count) {
+    uint64_t block = lba / BCACHE_SECTORS;
+    uint32_t first = lba % BCACHE_SECTORS;
+    uint32_t n = BCACHE_SECTORS - first;
+    if (n > count)
+      n = count;
+
+    bcache_buf_t *b;
+    if (n == BCACHE_SECTORS) {
+      // Overwritten whole, so there is nothing to read first
+      bool hit;
+      uint64_t flags = spin_lock_irqsave(&lock);
+      b = get_locked(dev, block, &hit);
+      spin_unlock_irqrestore(&lock, flags);
+      if (!b) {
+        bcache_sync(0);
+        b = bread(dev, block);
+      } else {
+        wait_clear(b, BCACHE_BUSY);
+      }
+    } else {
+      b = bread(dev, block);
+    }
+    if (!b)
+      return BLK_EIO;
+
+    memcpy(b->data + first * BLK_SECTOR_SIZE, in, n * BLK_SECTOR_SIZE);
+    uint64_t flags = spin_lock_irqsave(&lock);
+    b->flags |= BCACHE_VALID;
+    spin_unlock_irqrestore(&lock, flags);
+    bdirty(b);
+    brelse(b);
+    in += n * BLK_SECTOR_SIZE;
+    lba += n;
+    count -= n;
+  }
+  return BLK_OK;
+}
+
+int bcache_sync(blk_device_t *dev) {
+  for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+    bcache_buf_t *b = &buffers[i];
+    uint64_t flags = spin_lock_irqsave(&lock);
+    if (i >= used) {
+      spin_unlock_irqrestore(&lock, flags);
+      break;
+    }
+    bool start = (b->flags & BCACHE_DIRTY) && !(b->flags & BCACHE_WRITING) &&
+                 (!dev || b->dev == dev);
+    if (start) {
+      // Changes made while the write is out dirty it again
+      b->flags = (b->flags & ~BCACHE_DIRTY) | BCACHE_WRITING;
+      hold(b);
+      stats.dirty--;
+      stats.writebacks++;
+      writes_in_flight++;
+    }
+    spin_unlock_irqrestore(&lock, flags);
+    if (start)
+      start_io(b, BLK_WRITE, write_done);
+  }
+
+  if (sched_can_block()) {
+    WAIT_EVENT(&waiters, __atomic_load_n(&writes_in_flight, __ATOMIC_ACQUIRE) == 0);
+  } else {
+    while (__atomic_load_n(&writes_in_flight, __ATOMIC_ACQUIRE))
+      __asm__ volatile("pause");
+  }
+  return BLK_OK;
+}
+
+void bcache_get_stats(bcache_stats_t *out) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  *out = stats;
+  out->buffers = used;
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+static void flusher_main(void *arg) {
+  (void)arg;
+  for (;;) {
+    sched_sleep_until(timer_now_ns() + BCACHE_FLUSH_NS);
+    if (stats.dirty)
+      bcache_sync(0);
+  }
+}
+
+void bcache_init(void) { task_create("bflush", flusher_main, 0); }
@@ -0,0 +1,65 @@
+#pragma once
+#include "blk.h"
+#include "stdint.h"
+
+// Buffer cache over the block layer, one page per buffer. Buffers are
+// found by (device, block) through a hash table, and the ones nobody holds
+// sit on an LRU list that eviction takes from the cold end. Sequential
+// reads start read-ahead of the following blocks, and writes only dirty
+// the buffer: a flusher task writes them back every BCACHE_FLUSH_NS.
+#define BCACHE_BLOCK_SIZE 4096
+#define BCACHE_SECTORS (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BCACHE_BUFFERS 1024       // 4MB, frames taken as they are first used
+#define BCACHE_HASH_SIZE 256      // Power of two
+#define BCACHE_READAHEAD_BLOCKS 8 // Ahead of a sequential reader
+#define BCACHE_FLUSH_NS 5000000000ULL
+
+#define BCACHE_VALID 0x1      // Data matches the disk or newer
+#define BCACHE_BUSY 0x2       // Read in flight, data not there yet
+#define BCACHE_DIRTY 0x4      // Changed since it was last written
+#define BCACHE_WRITING 0x8    // Write-back in flight
+#define BCACHE_READAHEAD 0x10 // Read ahead and not looked at since
+
+typedef struct bcache_buf {
+  blk_device_t *dev;
+  uint64_t block; // In BCACHE_BLOCK_SIZE units
+  uint8_t *data;
+  volatile uint32_t flags;
+  uint32_t refs;
+  struct bcache_buf *hash_next;
+  struct bcache_buf *lru_prev;
+  struct bcache_buf *lru_next;
+  blk_request_t req; // For the read or write in flight
+} bcache_buf_t;
+
+typedef struct {
+  uint32_t buffers; // Holding a page
+  uint32_t dirty;
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t evictions;
+  uint64_t readahead;      // Blocks read ahead
+  uint64_t readahead_hits; // Of those, later asked for
+  uint64_t writebacks;
+  uint64_t errors;
+} bcache_stats_t;
+
+// Start the flusher task (needs the scheduler)
+void bcache_init(void);
+
+// The buffer for a block with its data read in, held until brelse();
+// 0 on a read error or past the end of the device
+bcache_buf_t *bread(blk_device_t *dev, uint64_t block);
+void brelse(bcache_buf_t *b);
+// Mark a held buffer changed, it is written back later
+void bdirty(bcache_buf_t *b);
+
+// Sectors through the cache, any alignment
+int bcache_read(blk_device_t *dev, uint64_t lba, uint32_t count, void *buffer);
+int bcache_write(blk_device_t *dev, uint64_t lba, uint32_t count,
+                 const void *buffer);
+
+// Write back every dirty buffer of dev (all devices for 0) and wait
+int bcache_sync(blk_device_t *dev);
+
+void bcache_get_stats(bcache_stats_t *out);
@@ -0,0 +1,358 @@
+#include "bench.h"
+#include "apic.h"
+#include "boottime.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "graphics.h"
+#include "idt.h"
+#include "isr.h"
+#include "paging.h"
+#include "pmm.h"
+#include "smp.h"
+#include "string.h"
+#include "timer.h"
+
+#define BENCH_SAMPLES 5             // Best of, for the bandwidth tests
+#define BENCH_MEM_BYTES (16ULL << 20) // Moved per sample, at least one pass
+#define BENCH_DRAM_MIN (64ULL << 20)  // Working set past any last level cache
+
+#define TLB_BLOCKS 4 // pmm blocks of frames for the chase
+#define TLB_BLOCK_PAGES (1u << PMM_MAX_ORDER)
+#define TLB_ROUNDS 16
+
+extern void irq22();
+
+static inline uint64_t irq_save(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+  __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+// Units per second from units done in cycles
+static uint64_t per_second(uint64_t units, uint64_t cycles) {
+  if (!cycles)
+    return 0;
+  // 128-bit product and divide in two instructions; the kernel links no
+  // libgcc for __udivti3. The quotient fits: it's below units * hz.
+  uint64_t hi, lo = units;
+  __asm__("mulq %2" : "+a"(lo), "=d"(hi) : "rm"(timer_tsc_hz()) : "cc");
+  if (hi >= cycles)
+    return ~0ULL;
+  __asm__("divq %2" : "+a"(lo), "+d"(hi) : "rm"(cycles) : "cc");
+  return lo;
+}
+
+// Data cache sizes from CPUID: the deterministic cache leaf (Intel's 4,
+// AMD's 0x8000001D with TOPOEXT), else AMD's legacy L1/L2/L3 leaves
+static void cache_sizes(uint64_t *l1, uint64_t *l2, uint64_t *llc) {
+  uint32_t a, b, c, d;
+  *l1 = 32 << 10;
+  *l2 = 256 << 10;
+  *llc = 8 << 20;
+
+  cpuid(0x80000000, 0, &a, &b, &c, &d);
+  uint32_t max_ext = a;
+  uint32_t leaf = 0;
+  cpuid(0, 0, &a, &b, &c, &d);
+  if (a >= 4 && b == 0x756E6547) { // "Genu"ineIntel
+    leaf = 4;
+  } else if (max_ext >= 0x8000001D) {
+    cpuid(0x80000001, 0, &a, &b, &c, &d);
+    if (c & (1u << 22)) // TOPOEXT
+      leaf = 0x8000001D;
+  }
+
+  if (leaf) {
+    for (uint32_t i = 0; i < 8; i++) {
+      cpuid(leaf, i, &a, &b, &c, &d);
+      uint32_t type = a & 0x1F;
+      if (!type)
+        break;
+      if (type == 2) // Instruction cache
+        continue;
+      uint32_t level = (a >> 5) & 7;
+      uint64_t size = (uint64_t)((b >> 22) + 1) * (((b >> 12) & 0x3FF) + 1) *
+                      ((b & 0xFFF) + 1) * (c + 1);
+      if (level == 1)
+        *l1 = size;
+      else if (level == 2)
+        *l2 = size;
+      if (level >= 2)
+        *llc = size;
+    }
+    return;
+  }
+  if (max_ext >= 0x80000006) {
+    cpuid(0x80000005, 0, &a, &b, &c, &d);
+    if (c >> 24)
+      *l1 = (uint64_t)(c >> 24) << 10;
+    cpuid(0x80000006, 0, &a, &b, &c, &d);
+    if (c >> 16)
+      *l2 = *llc = (uint64_t)(c >> 16) << 10;
+    if (d >> 18)
+      *llc = (uint64_t)(d >> 18) * (512 << 10);
+  }
+}
+
+// Best copy and fill times over a buffer pair of size bytes each
+static void measure_mem(bench_mem_t *r, uint64_t size) {
+  uint8_t *src = (uint8_t *)(uintptr_t)VMAP_BENCH;
+  uint8_t *dst = src + size;
+  uint64_t reps = BENCH_MEM_BYTES / size;
+  if (!reps)
+    reps = 1;
+  memset(src, 0x5A, 2 * size); // Fault in and warm up
+
+  uint64_t best_copy = ~0ULL, best_set = ~0ULL;
+  for (int s = 0; s < BENCH_SAMPLES; s++) {
+    uint64_t flags = irq_save();
+    uint64_t t0 = rdtsc();
+    for (uint64_t i = 0; i < reps; i++)
+      memcpy(dst, src, size);
+    uint64_t t1 = rdtsc();
+    for (uint64_t i = 0; i < reps; i++)
+      memset(dst, (uint8_t)i, size);
+    uint64_t t2 = rdtsc();
+    irq_restore(flags);
+    if (t1 - t0 < best_copy)
+      best_copy = t1 - t0;
+    if (t2 - t1 < best_set)
+      best_set = t2 - t1;
+  }
+  r->size = size;
+  r->copy_bps = per_second(reps * size, best_copy);
+  r->set_bps = per_second(reps * size, best_set);
+}
+
+int bench_mem(bench_mem_t *results) {
+  static const char *const levels[BENCH_MEM_LEVELS] = {"L1", "L2", "DRAM"};
+  uint64_t l1, l2, llc;
+  cache_sizes(&l1, &l2, &llc);
+  // Half a cache holds both buffers with room for the rest of the kernel
+  uint64_t sizes[BENCH_MEM_LEVELS] = {l1 / 4, l2 / 4, 4 * llc};
+  if (sizes[2] < BENCH_DRAM_MIN)
+    sizes[2] = BENCH_DRAM_MIN;
+
+  int count = 0;
+  for (int i = 0; i < BENCH_MEM_LEVELS; i++) {
+    uint64_t size = sizes[i];
+    // DRAM falls back to smaller buffers on a small machine, but stays
+    // well past the caches
+    while (!paging_alloc(VMAP_BENCH, 2 * size, PAGE_RW)) {
+      size /= 2;
+      if (i < BENCH_MEM_LEVELS - 1 || size < 2 * llc)
+        return count;
+    }
+    results[count].level = levels[i];
+    measure_mem(&results[count++], size);
+    paging_free(VMAP_BENCH, 2 * size);
+  }
+  return count;
+}
+
+#define GFX_RECT 256
+#define GFX_STRING "The quick brown fox jumps over t" // 32 characters
+
+// Cycles spent in calls calls of test, each with interrupts off
+static uint64_t time_gfx(int test, int calls, int w, int h) {
+  uint64_t total = 0;
+  int rect_w = w < GFX_RECT ? w : GFX_RECT;
+  int rect_h = h < GFX_RECT ? h : GFX_RECT;
+  int text_w = graphics_get_font_width() * 32;
+  for (int i = 0; i < calls; i++) {
+    int x = (i * 61) % (w > text_w ? w - text_w : 1);
+    int y = (i * 37) % (h > rect_h ? h - rect_h : 1);
+    uint64_t flags = irq_save();
+    uint64_t t0 = rdtsc();
+    switch (test) {
+    case 0:
+      graphics_fill_rect(x, y, rect_w, rect_h, RGB(i, 255 - i, 128));
+      break;
+    case 1:
+      graphics_draw_string(x, y, GFX_STRING, COLOR_WHITE, COLOR_BLACK);
+      break;
+    case 2:
+      graphics_clear(RGB(0, i, 64));
+      break;
+    default:
+      graphics_mark_dirty(0, 0, w, h);
+      graphics_present();
+      break;
+    }
+    total += rdtsc() - t0;
+    irq_restore(flags);
+  }
+  return total;
+}
+
+int bench_gfx(bench_gfx_t *results) {
+  if (!graphics_is_available())
+    return 0;
+  FramebufferInfo *fb = graphics_get_info();
+  int w = fb->width;
+  int h = fb->height;
+  uint64_t rect = (uint64_t)(w < GFX_RECT ? w : GFX_RECT) *
+                  (h < GFX_RECT ? h : GFX_RECT);
+  uint64_t text =
+      32ULL * graphics_get_font_width() * graphics_get_font_height();
+  const struct {
+    const char *name;
+    uint64_t pixels;
+    int calls;
+  } tests[BENCH_GFX_TESTS] = {
+      {"fill_rect 256x256", rect, 256},
+      {"draw_string 32 chars", text, 1024},
+      {"clear", (uint64_t)w * h, 16},
+      {"present full screen", (uint64_t)w * h, 16},
+  };
+
+  int count = graphics_has_backbuffer() ? BENCH_GFX_TESTS : BENCH_GFX_TESTS - 1;
+  for (int i = 0; i < count; i++) {
+    uint64_t cycles = time_gfx(i, tests[i].calls, w, h);
+    results[i].name = tests[i].name;
+    results[i].pixels = tests[i].pixels;
+    results[i].pixels_per_s =
+        per_second(tests[i].pixels * tests[i].calls, cycles);
+  }
+  return count;
+}
+
+static volatile uint64_t irq_tsc; // Set by the handler
+static bool irq_ready = false;
+
+static void bench_irq_handler(Registers *regs) {
+  (void)regs;
+  irq_tsc = rdtsc();
+}
+
+static void sort(uint64_t *v, int n) {
+  for (int i = 1; i < n; i++) {
+    uint64_t x = v[i];
+    int j = i;
+    for (; j > 0 && v[j - 1] > x; j--)
+      v[j] = v[j - 1];
+    v[j] = x;
+  }
+}
+
+bool bench_irq(bench_irq_t *r) {
+  if (!apic_enabled())
+    return false;
+  if (!irq_ready) {
+    idt_set_gate(BENCH_VECTOR, (uint64_t)irq22, GDT_KERNEL_CODE, 0x8E);
+    if (this_cpu()->irq_stack_top)
+      idt_set_ist(BENCH_VECTOR, IST_IRQ);
+    register_interrupt_handler(BENCH_VECTOR, bench_irq_handler);
+    irq_ready = true;
+  }
+
+  static uint64_t entry[BENCH_IRQ_SAMPLES], round[BENCH_IRQ_SAMPLES];
+  for (int i = 0; i < BENCH_IRQ_SAMPLES; i++) {
+    // The IPI stays pending until sti, and the wait after it is the only
+    // window other interrupts have
+    uint64_t flags = irq_save();
+    irq_tsc = 0;
+    uint64_t t0 = rdtsc();
+    apic_send_ipi(apic_current_id(), LAPIC_ICR_FIXED | BENCH_VECTOR);
+    __asm__ volatile("sti" ::: "memory");
+    while (!irq_tsc)
+      __asm__ volatile("pause");
+    uint64_t t1 = rdtsc();
+    irq_restore(flags);
+    entry[i] = irq_tsc - t0;
+    round[i] = t1 - t0;
+  }
+
+  sort(entry, BENCH_IRQ_SAMPLES);
+  sort(round, BENCH_IRQ_SAMPLES);
+  int p50 = BENCH_IRQ_SAMPLES / 2;
+  int p99 = BENCH_IRQ_SAMPLES * 99 / 100;
+  r->entry_min = timer_tsc_to_ns(entry[0]);
+  r->entry_p50 = timer_tsc_to_ns(entry[p50]);
+  r->entry_p99 = timer_tsc_to_ns(entry[p99]);
+  r->round_min = timer_tsc_to_ns(round[0]);
+  r->round_p50 = timer_tsc_to_ns(round[p50]);
+  r->round_p99 = timer_tsc_to_ns(round[p99]);
+  return true;
+}
+
+static uint64_t tlb_blocks[TLB_BLOCKS];
+static uint32_t tlb_order[TLB_BLOCKS * TLB_BLOCK_PAGES];
+
+static inline uint64_t tlb_phys(uint32_t page) {
+  return tlb_blocks[page / TLB_BLOCK_PAGES] +
+         (uint64_t)(page % TLB_BLOCK_PAGES) * PAGE_SIZE_4K;
+}
+
+// Address of the line page uses, at a different offset on each page so
+// the lines spread over the cache sets
+static inline uint64_t tlb_line(uint32_t page, bool direct) {
+  uint64_t offset = (page * 7 % 64) * 64;
+  if (direct)
+    return (uint64_t)(uintptr_t)phys_to_virt(tlb_phys(page)) + offset;
+  return VMAP_BENCH + (uint64_t)page * PAGE_SIZE_4K + offset;
+}
+
+// Cycles per access, in hundredths, for a chase through one view
+static uint64_t tlb_chase(uint32_t pages, bool direct) {
+  for (uint32_t k = 0; k < pages; k++)
+    *(volatile uint64_t *)(uintptr_t)tlb_line(tlb_order[k], direct) =
+        tlb_line(tlb_order[(k + 1) % pages], direct);
+
+  // One pass to settle the caches, then the timed rounds
+  uint64_t start = tlb_line(tlb_order[0], direct);
+  uint64_t p = start;
+  for (uint32_t k = 0; k < pages; k++)
+    p = *(volatile uint64_t *)(uintptr_t)p;
+  uint64_t accesses = (uint64_t)pages * TLB_ROUNDS;
+  uint64_t flags = irq_save();
+  uint64_t t0 = rdtsc();
+  for (uint64_t n = 0; n < accesses; n++)
+    p = *(volatile uint64_t *)(uintptr_t)p;
+  uint64_t cycles = rdtsc() - t0;
+  irq_restore(flags);
+  __asm__ volatile("" : : "r"(p));
+  return cycles * 100 / accesses;
+}
+
+bool bench_tlb(bench_tlb_t *r) {
+  int blocks = 0;
+  for (; blocks < TLB_BLOCKS; blocks++)
+    if (!(tlb_blocks[blocks] = pmm_alloc_pages(TLB_BLOCK_PAGES)))
+      break;
+  uint32_t pages = blocks * TLB_BLOCK_PAGES;
+
+  // Page by page, so nothing gets a large page
+  bool ok = blocks > 0;
+  for (uint32_t i = 0; ok && i < pages; i++)
+    ok = paging_map(VMAP_BENCH + (uint64_t)i * PAGE_SIZE_4K, tlb_phys(i),
+                    PAGE_SIZE_4K, PAGE_RW);
+
+  if (ok) {
+    // Random order, so neither prefetchers nor the walker's caches help
+    uint64_t seed = rdtsc() | 1;
+    for (uint32_t i = 0; i < pages; i++)
+      tlb_order[i] = i;
+    for (uint32_t i = pages - 1; i > 0; i--) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      uint32_t j = seed % (i + 1);
+      uint32_t t = tlb_order[i];
+      tlb_order[i] = tlb_order[j];
+      tlb_order[j] = t;
+    }
+    r->pages = pages;
+    r->small_cycles_x100 = tlb_chase(pages, false);
+    r->large_cycles_x100 = tlb_chase(pages, true);
+  }
+
+  paging_unmap(VMAP_BENCH, (uint64_t)pages * PAGE_SIZE_4K);
+  for (int i = 0; i < blocks; i++)
+    pmm_free_pages(tlb_blocks[i], TLB_BLOCK_PAGES);
+  return ok;
+}
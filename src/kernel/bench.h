@@ -0,0 +1,53 @@
+#pragma once
+#include "stdint.h"
+
+// In-kernel microbenchmarks behind the shell's bench command, for numbers
+// on machines where no host tools run. Every timed sample runs with
+// interrupts off, so nothing is preempted or interrupted halfway; they
+// come back on between samples. Times are TSC cycles converted with the
+// calibrated rate.
+#define BENCH_VECTOR 55 // Self-IPI for bench_irq (irq22 in interrupts.asm)
+
+#define BENCH_MEM_LEVELS 3 // Working sets in L1, L2 and DRAM
+#define BENCH_GFX_TESTS 4
+#define BENCH_IRQ_SAMPLES 1024
+
+typedef struct {
+  const char *level;
+  uint64_t size;     // Bytes per buffer
+  uint64_t copy_bps; // memcpy, bytes per second
+  uint64_t set_bps;  // memset
+} bench_mem_t;
+
+typedef struct {
+  const char *name;
+  uint64_t pixels;     // Per call
+  uint64_t pixels_per_s;
+} bench_gfx_t;
+
+// Nanoseconds from sending the IPI to the handler's first instruction
+// (entry) and to being back after iretq (round trip)
+typedef struct {
+  uint64_t entry_min, entry_p50, entry_p99;
+  uint64_t round_min, round_p50, round_p99;
+} bench_irq_t;
+
+// A pointer chase touching one line per page, through the same memory
+// mapped with 4K pages and through the direct map's large pages. The
+// lines are the same, so the difference is the page walks.
+typedef struct {
+  uint64_t pages;
+  uint64_t small_cycles_x100; // Per access, hundredths of a cycle
+  uint64_t large_cycles_x100;
+} bench_tlb_t;
+
+// Best of several samples at each level. Returns how many levels were
+// measured; DRAM is skipped when its buffers can't be allocated.
+int bench_mem(bench_mem_t *results);
+// graphics_fill_rect, graphics_draw_string, graphics_clear and, with the
+// back buffer, a full-screen graphics_present. Draws over the screen.
+// Returns the number of tests run, 0 without a framebuffer.
+int bench_gfx(bench_gfx_t *results);
+// False without a local APIC
+bool bench_irq(bench_irq_t *result);
+bool bench_tlb(bench_tlb_t *result);
@@ -0,0 +1,167 @@
+#include "display.h"
+#include "paging.h"
+#include "pci.h"
+
+// Bochs Graphics Adapter: the VBE extension of QEMU's and Bochs' standard
+// VGA (and of VirtualBox's), programmed through an index/data port pair
+// instead of BIOS calls. The whole video memory is one linear framebuffer
+// behind BAR 0; a mode's visible area is a window into it that starts at
+// the Y offset, so with room for two screens a flip is one register write.
+#define BGA_INDEX 0x01CE
+#define BGA_DATA 0x01CF
+
+#define BGA_REG_ID 0x0
+#define BGA_REG_XRES 0x1
+#define BGA_REG_YRES 0x2
+#define BGA_REG_BPP 0x3
+#define BGA_REG_ENABLE 0x4
+#define BGA_REG_VIRT_WIDTH 0x6
+#define BGA_REG_VIRT_HEIGHT 0x7
+#define BGA_REG_X_OFFSET 0x8
+#define BGA_REG_Y_OFFSET 0x9
+#define BGA_REG_VIDEO_MEMORY_64K 0xA
+
+// Interface versions; virtual height and Y offset need at least 0xB0C2
+#define BGA_ID_MIN 0xB0C2
+#define BGA_ID_MAX 0xB0C5
+
+#define BGA_DISABLED 0x00
+#define BGA_ENABLED 0x01
+#define BGA_GETCAPS 0x02 // XRES, YRES and BPP read back the limits
+#define BGA_LFB_ENABLED 0x40
+
+#define BGA_DEFAULT_WIDTH 1024
+#define BGA_DEFAULT_HEIGHT 768
+
+static inline void outw(uint16_t port, uint16_t val) {
+  __asm__ volatile("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port) {
+  uint16_t ret;
+  __asm__ volatile("inw %1, %0" : "=a"(ret) : "Nd"(port));
+  return ret;
+}
+
+static void bga_write(uint16_t reg, uint16_t value) {
+  outw(BGA_INDEX, reg);
+  outw(BGA_DATA, value);
+}
+
+static uint16_t bga_read(uint16_t reg) {
+  outw(BGA_INDEX, reg);
+  return inw(BGA_DATA);
+}
+
+static uint64_t lfb;       // Physical (and identity mapped) address
+static uint64_t vram_size; // Bytes
+static uint32_t max_width, max_height, max_bpp;
+static uint32_t shown_height; // Rows per buffer in the current mode
+
+static bool bga_set_mode(uint32_t width, uint32_t height, uint32_t bpp,
+                         display_mode_t *mode) {
+  if (!width || !height) {
+    width = BGA_DEFAULT_WIDTH;
+    height = BGA_DEFAULT_HEIGHT;
+  }
+  if (bpp != 15 && bpp != 16 && bpp != 24 && bpp != 32)
+    return false;
+  if (width > max_width || height > max_height || bpp > max_bpp)
+    return false;
+  uint32_t bytes_pp = (bpp + 7) / 8;
+  if ((uint64_t)width * bytes_pp * height > vram_size)
+    return false;
+
+  // Enabling clears video memory and sets the virtual size to the whole
+  // of it at this width
+  bga_write(BGA_REG_ENABLE, BGA_DISABLED);
+  bga_write(BGA_REG_XRES, width);
+  bga_write(BGA_REG_YRES, height);
+  bga_write(BGA_REG_BPP, bpp);
+  bga_write(BGA_REG_ENABLE, BGA_ENABLED | BGA_LFB_ENABLED);
+  if (bga_read(BGA_REG_XRES) != width || bga_read(BGA_REG_YRES) != height ||
+      bga_read(BGA_REG_BPP) != bpp)
+    return false;
+  bga_write(BGA_REG_X_OFFSET, 0);
+  bga_write(BGA_REG_Y_OFFSET, 0);
+
+  uint32_t pitch = bga_read(BGA_REG_VIRT_WIDTH) * bytes_pp;
+  uint32_t virt_height = bga_read(BGA_REG_VIRT_HEIGHT);
+  shown_height = height;
+
+  mode->width = width;
+  mode->height = height;
+  mode->pitch = pitch;
+  mode->bpp = bpp;
+  if (bpp == 16) {
+    mode->red_pos = 11;
+    mode->red_size = 5;
+    mode->green_pos = 5;
+    mode->green_size = 6;
+    mode->blue_size = 5;
+  } else if (bpp == 15) {
+    mode->red_pos = 10;
+    mode->green_pos = 5;
+    mode->red_size = mode->green_size = mode->blue_size = 5;
+  } else {
+    mode->red_pos = 16;
+    mode->green_pos = 8;
+    mode->red_size = mode->green_size = mode->blue_size = 8;
+  }
+  mode->blue_pos = 0;
+  mode->buffers = virt_height >= 2 * height ? DISPLAY_BUFFERS : 1;
+  for (int i = 0; i < DISPLAY_BUFFERS; i++)
+    mode->pixels[i] = (volatile uint8_t *)(uintptr_t)(
+        lfb + (i < mode->buffers ? (uint64_t)i * pitch * height : 0));
+  return true;
+}
+
+// The adapter latches the start address once per frame, so the switch is
+// never seen half way
+static void bga_flip(int buffer) {
+  bga_write(BGA_REG_Y_OFFSET, buffer * shown_height);
+}
+
+static const display_driver_t bga_driver = {
+    "bga",
+    bga_set_mode,
+    bga_flip,
+    0,
+};
+
+const display_driver_t *bga_probe(void) {
+  const pci_device_t *pci = pci_find_device(0x1234, 0x1111, 0); // QEMU, Bochs
+  if (!pci)
+    pci = pci_find_device(0x80EE, 0xBEEF, 0); // VirtualBox
+  if (!pci)
+    return 0;
+
+  // Ask for the newest interface and see which one answers
+  bga_write(BGA_REG_ID, BGA_ID_MAX);
+  uint16_t id = bga_read(BGA_REG_ID);
+  if (id < BGA_ID_MIN || id > BGA_ID_MAX)
+    return 0;
+
+  bool io;
+  lfb = pci_bar(pci, 0, &io);
+  if (!lfb || io)
+    return 0;
+  vram_size = (uint64_t)bga_read(BGA_REG_VIDEO_MEMORY_64K) << 16;
+  if (!vram_size)
+    return 0;
+
+  // Read the limits without losing the mode stage2 set
+  uint16_t enable = bga_read(BGA_REG_ENABLE);
+  bga_write(BGA_REG_ENABLE, enable | BGA_GETCAPS);
+  max_width = bga_read(BGA_REG_XRES);
+  max_height = bga_read(BGA_REG_YRES);
+  max_bpp = bga_read(BGA_REG_BPP);
+  bga_write(BGA_REG_ENABLE, enable);
+
+  // Write-combining over all of video memory, both buffers of any mode
+  if (!paging_map(lfb, lfb, vram_size,
+                  PAGE_RW | (paging_has_pat() ? PAGE_CACHE_WC : PAGE_CACHE_UC)))
+    return 0;
+  pci_enable(pci, PCI_COMMAND_MEMORY);
+  return &bga_driver;
+}
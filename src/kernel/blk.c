@@ -0,0 +1,229 @@
+#include "blk.h"
+#include "ahci.h"
+#include "ata.h"
+#include "paging.h"
+#include "trace.h"
+
+static blk_device_t *devices[BLK_MAX_DEVICES];
+static int device_count = 0;
+
+// Pages a buffer touches, the most scatter-gather entries it can need
+static uint32_t page_span(const void *buffer, uint32_t sectors) {
+  uint64_t start = (uint64_t)(uintptr_t)buffer;
+  uint64_t end = start + (uint64_t)sectors * BLK_SECTOR_SIZE - 1;
+  return (uint32_t)((end >> 12) - (start >> 12) + 1);
+}
+
+static bool same_name(const char *a, const char *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+void blk_init(void) {
+  ata_init();
+  ahci_init();
+}
+
+bool blk_register(blk_device_t *dev) {
+  if (device_count == BLK_MAX_DEVICES || !dev->kick || !dev->max_sectors ||
+      !dev->max_segments)
+    return false;
+  dev->lock = (spinlock_t)SPINLOCK_INIT;
+  dev->waiters = (wait_queue_t)WAIT_QUEUE_INIT;
+  dev->queue = 0;
+  dev->next_lba = 0;
+  dev->in_flight = 0;
+  devices[device_count++] = dev;
+  return true;
+}
+
+int blk_device_count(void) { return device_count; }
+
+blk_device_t *blk_device(int index) {
+  if (index < 0 || index >= device_count)
+    return 0;
+  return devices[index];
+}
+
+blk_device_t *blk_find(const char *name) {
+  for (int i = 0; i < device_count; i++)
+    if (same_name(devices[i]->name, name))
+      return devices[i];
+  return 0;
+}
+
+int blk_submit(blk_request_t *req) {
+  blk_device_t *dev = req->dev;
+  if (!dev || !req->buffer || !req->count || req->count > dev->max_sectors ||
+      (req->op != BLK_READ && req->op != BLK_WRITE) ||
+      req->lba >= dev->sectors || req->count > dev->sectors - req->lba ||
+      page_span(req->buffer, req->count) > dev->max_segments) {
+    req->status = BLK_EINVAL;
+    return BLK_EINVAL;
+  }
+
+  // Once queued the request may complete and be gone on another CPU
+  TRACE(TRACE_BLK_SUBMIT, req->lba, req->count, req->op);
+  req->status = BLK_PENDING;
+  uint64_t flags = spin_lock_irqsave(&dev->lock);
+  blk_request_t **link = &dev->queue;
+  while (*link && (*link)->lba <= req->lba)
+    link = &(*link)->next;
+  req->next = *link;
+  *link = req;
+  dev->requests++;
+  spin_unlock_irqrestore(&dev->lock, flags);
+
+  dev->kick(dev);
+  return BLK_OK;
+}
+
+// C-LOOK: carry on upwards from the last batch, wrap to the lowest LBA
+// once nothing is left above it
+blk_request_t *blk_next_batch(blk_device_t *dev) {
+  uint64_t flags = spin_lock_irqsave(&dev->lock);
+  blk_request_t **link = &dev->queue;
+  while (*link && (*link)->lba < dev->next_lba)
+    link = &(*link)->next;
+  if (!*link)
+    link = &dev->queue;
+  blk_request_t *batch = *link;
+  if (!batch) {
+    spin_unlock_irqrestore(&dev->lock, flags);
+    return 0;
+  }
+
+  // Requests that pick up where the previous one ends go along
+  blk_request_t *last = batch;
+  uint32_t sectors = batch->count;
+  uint32_t segments = page_span(batch->buffer, batch->count);
+  for (blk_request_t *r = batch->next; r; r = r->next) {
+    uint32_t span = page_span(r->buffer, r->count);
+    if (r->op != batch->op || r->lba != last->lba + last->count ||
+        sectors + r->count > dev->max_sectors ||
+        segments + span > dev->max_segments)
+      break;
+    sectors += r->count;
+    segments += span;
+    last = r;
+    dev->merges++;
+  }
+  *link = last->next;
+  last->next = 0;
+
+  dev->next_lba = batch->lba + sectors;
+  dev->commands++;
+  dev->in_flight++;
+  spin_unlock_irqrestore(&dev->lock, flags);
+  return batch;
+}
+
+int blk_batch_segments(const blk_request_t *batch, blk_segment_t *out,
+                       int max) {
+  int count = 0;
+  for (const blk_request_t *r = batch; r; r = r->next) {
+    uint64_t virt = (uint64_t)(uintptr_t)r->buffer;
+    uint64_t left = (uint64_t)r->count * BLK_SECTOR_SIZE;
+    while (left) {
+      uint64_t phys;
+      if (!paging_translate(virt, &phys))
+        return -1;
+      uint64_t length = PAGE_SIZE_4K - (virt & (PAGE_SIZE_4K - 1));
+      if (length > left)
+        length = left;
+
+      // Join physically contiguous pages within one 64KB window
+      blk_segment_t *prev = count ? &out[count - 1] : 0;
+      if (prev && prev->phys + prev->length == phys &&
+          (prev->phys & ~(uint64_t)(BLK_SEGMENT_MAX - 1)) ==
+              ((phys + length - 1) & ~(uint64_t)(BLK_SEGMENT_MAX - 1))) {
+        prev->length += length;
+      } else {
+        if (count == max)
+          return -1;
+        out[count].phys = phys;
+        out[count].length = length;
+        count++;
+      }
+      virt += length;
+      left -= length;
+    }
+  }
+  return count;
+}
+
+void blk_complete(blk_device_t *dev, blk_request_t *batch, int status) {
+  while (batch) {
+    // Once the status is out the request may be gone
+    blk_request_t *next = batch->next;
+    blk_done_t done = batch->done;
+    TRACE(TRACE_BLK_COMPLETE, batch->lba, batch->count, status);
+    if (status != BLK_OK)
+      dev->errors++;
+    else if (batch->op == BLK_READ)
+      dev->sectors_read += batch->count;
+    else
+      dev->sectors_written += batch->count;
+    __atomic_store_n(&batch->status, status, __ATOMIC_RELEASE);
+    if (done)
+      done(batch);
+    batch = next;
+  }
+  __atomic_fetch_sub(&dev->in_flight, 1, __ATOMIC_RELAXED);
+  wait_queue_wake_all(&dev->waiters);
+}
+
+static int wait_request(blk_request_t *req) {
+  if (sched_can_block()) {
+    WAIT_EVENT(&req->dev->waiters,
+               __atomic_load_n(&req->status, __ATOMIC_ACQUIRE) != BLK_PENDING);
+  } else {
+    while (__atomic_load_n(&req->status, __ATOMIC_ACQUIRE) == BLK_PENDING)
+      __asm__ volatile("pause");
+  }
+  return req->status;
+}
+
+static int transfer(blk_device_t *dev, int op, uint64_t lba, uint32_t count,
+                    void *buffer) {
+  if (!dev)
+    return BLK_EINVAL;
+
+  // The largest piece that fits one command wherever the buffer starts
+  uint32_t chunk = dev->max_sectors;
+  uint32_t by_segments =
+      (dev->max_segments - 1) * (uint32_t)(PAGE_SIZE_4K / BLK_SECTOR_SIZE);
+  if (by_segments && by_segments < chunk)
+    chunk = by_segments;
+
+  uint8_t *p = buffer;
+  while (count) {
+    blk_request_t req = {0};
+    req.dev = dev;
+    req.lba = lba;
+    req.count = count < chunk ? count : chunk;
+    req.op = op;
+    req.buffer = p;
+    if (blk_submit(&req) != BLK_OK)
+      return req.status;
+    int status = wait_request(&req);
+    if (status != BLK_OK)
+      return status;
+    lba += req.count;
+    p += (uint64_t)req.count * BLK_SECTOR_SIZE;
+    count -= req.count;
+  }
+  return BLK_OK;
+}
+
+int blk_read(blk_device_t *dev, uint64_t lba, uint32_t count, void *buffer) {
+  return transfer(dev, BLK_READ, lba, count, buffer);
+}
+
+int blk_write(blk_device_t *dev, uint64_t lba, uint32_t count,
+              const void *buffer) {
+  return transfer(dev, BLK_WRITE, lba, count, (void *)buffer);
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "sched.h"
+#include "spinlock.h"
+#include "stdint.h"
+
+// Block devices. Requests are queued per device in LBA order and handed to
+// the driver in batches: a run of requests in the same direction whose
+// sectors follow on from each other becomes one hardware command, each
+// request adding its buffer to the scatter-gather list. Drivers complete
+// batches from their interrupt handlers.
+#define BLK_SECTOR_SIZE 512
+#define BLK_MAX_DEVICES 8
+#define BLK_NAME_LEN 8
+
+#define BLK_READ 0
+#define BLK_WRITE 1
+
+// Request status
+#define BLK_OK 0
+#define BLK_PENDING 1
+#define BLK_EIO -1
+#define BLK_EINVAL -2
+
+// Scatter-gather pieces never cross a 64KB boundary (a bus master IDE
+// rule), so one holds at most this many bytes
+#define BLK_SEGMENT_MAX 0x10000
+
+struct blk_device;
+struct blk_request;
+
+// Called from interrupt context once the request has finished
+typedef void (*blk_done_t)(struct blk_request *req);
+
+typedef struct blk_request {
+  struct blk_device *dev;
+  uint64_t lba;
+  uint32_t count; // Sectors
+  int op;         // BLK_READ or BLK_WRITE
+  void *buffer;   // count * BLK_SECTOR_SIZE bytes of kernel memory
+  blk_done_t done;
+  void *arg;               // For the submitter
+  volatile int status;     // BLK_PENDING until it completes
+  struct blk_request *next; // Queue link, then the link within its batch
+} blk_request_t;
+
+typedef struct {
+  uint64_t phys;
+  uint32_t length;
+} blk_segment_t;
+
+typedef struct blk_device {
+  char name[BLK_NAME_LEN];
+  uint64_t sectors;
+  uint32_t max_sectors;  // Per hardware command
+  uint32_t max_segments; // Scatter-gather entries per command
+  // Start as many queued batches as the hardware has room for. Called
+  // after every submission and may run on any CPU.
+  void (*kick)(struct blk_device *dev);
+  void *driver;
+
+  spinlock_t lock;
+  blk_request_t *queue;      // Waiting requests, ascending LBA
+  uint64_t next_lba;         // Where the last batch handed out ended
+  wait_queue_t waiters;      // Tasks in blk_read() and blk_write()
+  volatile uint32_t in_flight;
+
+  // Statistics
+  uint64_t requests;
+  uint64_t merges; // Requests that joined another one's command
+  uint64_t commands;
+  uint64_t sectors_read;
+  uint64_t sectors_written;
+  uint64_t errors;
+} blk_device_t;
+
+// Probe the storage drivers (needs pci_init() and interrupts enabled)
+void blk_init(void);
+
+// Called by drivers for each disk they find; name is set by the driver
+bool blk_register(blk_device_t *dev);
+int blk_device_count(void);
+blk_device_t *blk_device(int index);
+blk_device_t *blk_find(const char *name);
+
+// Queue req on its device. The request must stay valid until it has
+// completed: done has run, or status has left BLK_PENDING when done is 0.
+int blk_submit(blk_request_t *req);
+
+// Synchronous transfers of any length, split as the device needs. Blocks
+// the calling task, the boot flow polls.
+int blk_read(blk_device_t *dev, uint64_t lba, uint32_t count, void *buffer);
+int blk_write(blk_device_t *dev, uint64_t lba, uint32_t count,
+              const void *buffer);
+
+// Driver side. Take the next batch off the queue (elevator order, at most
+// max_sectors and max_segments), 0 if the queue is empty. The requests stay
+// linked through next.
+blk_request_t *blk_next_batch(blk_device_t *dev);
+// Physical pieces of a batch's buffers, in order; -1 if more than max
+// would be needed or a buffer isn't mapped
+int blk_batch_segments(const blk_request_t *batch, blk_segment_t *out,
+                       int max);
+// Finish every request of a batch, from the driver's interrupt handler
+void blk_complete(blk_device_t *dev, blk_request_t *batch, int status);
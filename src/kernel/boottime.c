@@ -0,0 +1,90 @@
+#include "boottime.h"
+
+typedef struct {
+  uint32_t magic;
+  uint32_t count;
+  boottime_entry_t entries[];
+} __attribute__((packed)) boot_timing_info_t;
+
+static boottime_entry_t entries[BOOTTIME_MAX_ENTRIES];
+static int entry_count = 0;
+
+static inline void outb(uint16_t port, uint8_t val) {
+  __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static void debugcon_puts(const char *s) {
+  while (*s)
+    outb(BOOT_DEBUGCON_PORT, *s++);
+}
+
+static void debugcon_hex(uint64_t val) {
+  const char *hex = "0123456789abcdef";
+  for (int shift = 60; shift >= 0; shift -= 4)
+    outb(BOOT_DEBUGCON_PORT, hex[(val >> shift) & 0xF]);
+}
+
+// Same lines as stage2 writes: boot: <tsc> <name>
+static void debugcon_mark(const boottime_entry_t *entry) {
+  debugcon_puts("boot: ");
+  debugcon_hex(entry->tsc);
+  debugcon_puts(" ");
+  debugcon_puts(entry->name);
+  debugcon_puts("\n");
+}
+
+static void copy_name(char *dst, const char *src) {
+  int i = 0;
+  for (; i < BOOT_TIMING_NAME_LEN - 1 && src[i]; i++)
+    dst[i] = src[i];
+  dst[i] = '\0';
+}
+
+void boottime_init(void) {
+  // Grab the kernel entry time before doing anything else
+  uint64_t now = rdtsc();
+
+  // Low memory may be reused later, so take a copy of the stage2 block now
+  volatile boot_timing_info_t *info =
+      (volatile boot_timing_info_t *)(uintptr_t)BOOT_TIMING_ADDR;
+  entry_count = 0;
+  if (info->magic == BOOT_TIMING_MAGIC) {
+    uint32_t count = info->count;
+    if (count > BOOTTIME_MAX_ENTRIES - 1)
+      count = BOOTTIME_MAX_ENTRIES - 1;
+    for (uint32_t i = 0; i < count; i++) {
+      entries[entry_count].tsc = info->entries[i].tsc;
+      copy_name(entries[entry_count].name, (const char *)info->entries[i].name);
+      entry_count++;
+    }
+  }
+
+  entries[entry_count].tsc = now;
+  copy_name(entries[entry_count].name, "kernel entry");
+  debugcon_mark(&entries[entry_count]);
+  entry_count++;
+}
+
+void boottime_mark(const char *name) {
+  if (entry_count >= BOOTTIME_MAX_ENTRIES)
+    return;
+
+  entries[entry_count].tsc = rdtsc();
+  copy_name(entries[entry_count].name, name);
+  debugcon_mark(&entries[entry_count]);
+  entry_count++;
+}
+
+void boottime_report_rate(uint64_t tsc_hz) {
+  debugcon_puts("boot-rate: ");
+  debugcon_hex(tsc_hz);
+  debugcon_puts("\n");
+}
+
+int boottime_count(void) { return entry_count; }
+
+const boottime_entry_t *boottime_get(int index) {
+  if (index < 0 || index >= entry_count)
+    return NULL;
+  return &entries[index];
+}
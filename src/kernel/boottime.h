@@ -0,0 +1,37 @@
+#pragma once
+#include "stdint.h"
+
+// Boot timing block written by stage2 (matches bootloader's boottime.h)
+#define BOOT_TIMING_ADDR 0x8400
+#define BOOT_TIMING_MAGIC 0x4D495442 // 'BTIM'
+#define BOOT_TIMING_NAME_LEN 24
+
+// Marks are also written to the debug console, as stage2 does
+#define BOOT_DEBUGCON_PORT 0xE9
+
+// Kernel-side table holds the stage2 marks followed by the kernel's own
+#define BOOTTIME_MAX_ENTRIES 32
+
+typedef struct {
+  uint64_t tsc;
+  char name[BOOT_TIMING_NAME_LEN];
+} __attribute__((packed)) boottime_entry_t;
+
+// Copy stage2's timestamps (if present) and start recording kernel ones
+void boottime_init(void);
+
+// Record a timestamp for the named boot milestone
+void boottime_mark(const char *name);
+
+// "boot-rate: <tsc_hz>" on the debug console, ending the marks there so
+// build_scripts/bench_boot.sh can turn them into time
+void boottime_report_rate(uint64_t tsc_hz);
+
+int boottime_count(void);
+const boottime_entry_t *boottime_get(int index);
+
+static inline uint64_t rdtsc(void) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((uint64_t)hi << 32) | lo;
+}
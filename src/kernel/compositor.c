@@ -0,0 +1,482 @@
+#include "compositor.h"
+#include "kmalloc.h"
+#include "spinlock.h"
+#include "stdint.h"
+#include "string.h"
+#include "tasklet.h"
+
+#define COMP_SHADOW_COLOR COLOR_DARK_GRAY
+
+// Screen rectangle, exclusive right / bottom
+typedef struct {
+  int x0, y0, x1, y1;
+} comp_rect_t;
+
+static comp_window_t windows[COMP_MAX_WINDOWS];
+static comp_window_t *top = 0; // Stack, linked downwards through below
+static uint32_t background = 0;
+static bool active = false;
+static bool suspended = false; // A program has the screen
+
+static comp_rect_t damage[COMP_MAX_DAMAGE];
+static int damage_count = 0;
+
+static uint64_t frames = 0;
+static uint64_t composed_pixels = 0;
+
+static spinlock_t lock = SPINLOCK_INIT;
+
+static void compose_tasklet(void *arg);
+static tasklet_t compose_work = TASKLET_INIT(compose_tasklet, 0);
+
+static inline bool rect_empty(comp_rect_t r) {
+  return r.x0 >= r.x1 || r.y0 >= r.y1;
+}
+
+static inline uint64_t rect_area(comp_rect_t r) {
+  return rect_empty(r) ? 0 : (uint64_t)(r.x1 - r.x0) * (uint64_t)(r.y1 - r.y0);
+}
+
+static inline comp_rect_t rect_intersect(comp_rect_t a, comp_rect_t b) {
+  comp_rect_t r = {a.x0 > b.x0 ? a.x0 : b.x0, a.y0 > b.y0 ? a.y0 : b.y0,
+                   a.x1 < b.x1 ? a.x1 : b.x1, a.y1 < b.y1 ? a.y1 : b.y1};
+  return r;
+}
+
+static inline comp_rect_t rect_union(comp_rect_t a, comp_rect_t b) {
+  comp_rect_t r = {a.x0 < b.x0 ? a.x0 : b.x0, a.y0 < b.y0 ? a.y0 : b.y0,
+                   a.x1 > b.x1 ? a.x1 : b.x1, a.y1 > b.y1 ? a.y1 : b.y1};
+  return r;
+}
+
+static inline bool rect_touches(comp_rect_t a, comp_rect_t b) {
+  return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+static inline bool rect_contains(comp_rect_t outer, comp_rect_t r) {
+  return r.x0 >= outer.x0 && r.y0 >= outer.y0 && r.x1 <= outer.x1 &&
+         r.y1 <= outer.y1;
+}
+
+// r minus hole (which lies inside r): up to four pieces, returns how many
+static int rect_subtract(comp_rect_t r, comp_rect_t hole, comp_rect_t *out) {
+  int n = 0;
+  if (hole.y0 > r.y0)
+    out[n++] = (comp_rect_t){r.x0, r.y0, r.x1, hole.y0};
+  if (hole.y1 < r.y1)
+    out[n++] = (comp_rect_t){r.x0, hole.y1, r.x1, r.y1};
+  if (hole.x0 > r.x0)
+    out[n++] = (comp_rect_t){r.x0, hole.y0, hole.x0, hole.y1};
+  if (hole.x1 < r.x1)
+    out[n++] = (comp_rect_t){hole.x1, hole.y0, r.x1, hole.y1};
+  return n;
+}
+
+// Unused pixels a merge may add: a quarter of the union
+static inline bool cheap_merge(comp_rect_t a, comp_rect_t b, comp_rect_t u) {
+  uint64_t used = rect_area(a) + rect_area(b) - rect_area(rect_intersect(a, b));
+  return (rect_area(u) - used) * 4 <= rect_area(u);
+}
+
+// Add r to the damage, keeping the rectangles disjoint
+static void add_damage(comp_rect_t r) {
+  FramebufferInfo *fb = graphics_get_info();
+  comp_rect_t screen = {0, 0, (int)fb->width, (int)fb->height};
+  r = rect_intersect(r, screen);
+  if (rect_empty(r))
+    return;
+
+  for (int i = 0; i < damage_count; i++) {
+    comp_rect_t d = damage[i];
+    if (!rect_touches(r, d))
+      continue;
+    if (rect_contains(d, r))
+      return;
+
+    comp_rect_t u = rect_union(r, d);
+    if (cheap_merge(r, d, u)) {
+      // The union may reach others now, add it over again
+      damage[i] = damage[--damage_count];
+      add_damage(u);
+      return;
+    }
+
+    comp_rect_t overlap = rect_intersect(r, d);
+    if (!rect_empty(overlap)) {
+      comp_rect_t pieces[4];
+      int n = rect_subtract(r, overlap, pieces);
+      for (int p = 0; p < n; p++)
+        add_damage(pieces[p]);
+      return;
+    }
+  }
+
+  if (damage_count == COMP_MAX_DAMAGE) {
+    // Full: grow whichever rectangle that wastes least to take r in
+    int best = 0;
+    uint64_t best_growth = ~0ULL;
+    for (int i = 0; i < damage_count; i++) {
+      uint64_t growth =
+          rect_area(rect_union(r, damage[i])) - rect_area(damage[i]);
+      if (growth < best_growth) {
+        best_growth = growth;
+        best = i;
+      }
+    }
+    comp_rect_t u = rect_union(r, damage[best]);
+    damage[best] = damage[--damage_count];
+    add_damage(u);
+    return;
+  }
+  damage[damage_count++] = r;
+}
+
+static inline comp_rect_t window_rect(const comp_window_t *win) {
+  comp_rect_t r = {win->x, win->y, win->x + win->w, win->y + win->h};
+  return r;
+}
+
+static inline comp_rect_t shadow_rect(const comp_window_t *win) {
+  comp_rect_t r = window_rect(win);
+  r.x0 += COMP_SHADOW_OFFSET;
+  r.y0 += COMP_SHADOW_OFFSET;
+  r.x1 += COMP_SHADOW_OFFSET;
+  r.y1 += COMP_SHADOW_OFFSET;
+  return r;
+}
+
+// Everything a window puts on screen, its shadow included
+static void damage_window(const comp_window_t *win) {
+  add_damage(window_rect(win));
+  if (win->flags & COMP_SHADOW)
+    add_damage(shadow_rect(win));
+}
+
+static void schedule(void) {
+  if (damage_count)
+    tasklet_schedule(&compose_work);
+}
+
+// Paint r from the layer at (win, shadow) down: each window is two layers,
+// its surface and under it its shadow. The first layer r meets is drawn
+// where they overlap, the rest of r goes on to the layers below.
+static void paint(comp_rect_t r, comp_window_t *win, bool shadow) {
+  while (win) {
+    comp_rect_t area = shadow ? shadow_rect(win) : window_rect(win);
+    comp_rect_t part = rect_intersect(r, area);
+    if (!rect_empty(part)) {
+      int w = part.x1 - part.x0;
+      int h = part.y1 - part.y0;
+      if (shadow) {
+        graphics_fill_rect(part.x0, part.y0, w, h, COMP_SHADOW_COLOR);
+      } else {
+        const uint32_t *src = win->pixels +
+                              (int64_t)(part.y0 - win->y) * win->w +
+                              (part.x0 - win->x);
+        graphics_blit(part.x0, part.y0, w, h, src, win->w);
+      }
+      composed_pixels += rect_area(part);
+
+      // Next layer down
+      if (!shadow && (win->flags & COMP_SHADOW)) {
+        shadow = true;
+      } else {
+        win = win->below;
+        shadow = false;
+      }
+      comp_rect_t pieces[4];
+      int n = rect_subtract(r, part, pieces);
+      for (int p = 0; p < n; p++)
+        paint(pieces[p], win, shadow);
+      return;
+    }
+
+    if (!shadow && (win->flags & COMP_SHADOW)) {
+      shadow = true;
+    } else {
+      win = win->below;
+      shadow = false;
+    }
+  }
+
+  graphics_fill_rect(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, background);
+  composed_pixels += rect_area(r);
+}
+
+static void compose(void) {
+  if (!active || suspended || !damage_count)
+    return;
+  uint64_t flags = graphics_lock();
+  for (int i = 0; i < damage_count; i++)
+    paint(damage[i], top, false);
+  damage_count = 0;
+  graphics_present();
+  graphics_unlock(flags);
+  frames++;
+}
+
+static void compose_tasklet(void *arg) {
+  (void)arg;
+  comp_flush();
+}
+
+bool comp_init(uint32_t color) {
+  if (!graphics_is_available() || !graphics_enable_backbuffer())
+    return false;
+
+  FramebufferInfo *fb = graphics_get_info();
+  uint64_t flags = spin_lock_irqsave(&lock);
+  background = color;
+  active = true;
+  add_damage((comp_rect_t){0, 0, (int)fb->width, (int)fb->height});
+  schedule();
+  spin_unlock_irqrestore(&lock, flags);
+  return true;
+}
+
+bool comp_is_active(void) { return active; }
+
+void comp_set_background(uint32_t color) {
+  FramebufferInfo *fb = graphics_get_info();
+  uint64_t flags = spin_lock_irqsave(&lock);
+  background = color;
+  add_damage((comp_rect_t){0, 0, (int)fb->width, (int)fb->height});
+  schedule();
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void comp_redraw(void) {
+  if (!active)
+    return;
+  FramebufferInfo *fb = graphics_get_info();
+  uint64_t flags = spin_lock_irqsave(&lock);
+  // Damage from the old mode may lie outside the new screen
+  damage_count = 0;
+  add_damage((comp_rect_t){0, 0, (int)fb->width, (int)fb->height});
+  spin_unlock_irqrestore(&lock, flags);
+  comp_flush();
+}
+
+void comp_suspend(void) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  suspended = true;
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void comp_resume(void) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  bool was = suspended;
+  suspended = false;
+  spin_unlock_irqrestore(&lock, flags);
+  if (was)
+    comp_redraw();
+}
+
+comp_window_t *comp_create(int x, int y, int w, int h, uint32_t flags,
+                           uint32_t color) {
+  if (!active || w <= 0 || h <= 0)
+    return 0;
+  uint32_t *surface = kmalloc((uint64_t)w * h * 4);
+  if (!surface)
+    return 0;
+  uint64_t count = (uint64_t)w * h;
+  for (uint64_t i = 0; i < count; i++)
+    surface[i] = color;
+
+  uint64_t irq = spin_lock_irqsave(&lock);
+  comp_window_t *win = 0;
+  for (int i = 0; i < COMP_MAX_WINDOWS && !win; i++) {
+    if (!windows[i].pixels)
+      win = &windows[i];
+  }
+  if (!win) {
+    spin_unlock_irqrestore(&lock, irq);
+    kfree(surface);
+    return 0;
+  }
+
+  win->x = x;
+  win->y = y;
+  win->w = w;
+  win->h = h;
+  win->flags = flags;
+  win->pixels = surface;
+  win->above = 0;
+  win->below = top;
+  if (top)
+    top->above = win;
+  top = win;
+  damage_window(win);
+  schedule();
+  spin_unlock_irqrestore(&lock, irq);
+  return win;
+}
+
+static void unlink(comp_window_t *win) {
+  if (win->above)
+    win->above->below = win->below;
+  else
+    top = win->below;
+  if (win->below)
+    win->below->above = win->above;
+  win->above = win->below = 0;
+}
+
+void comp_destroy(comp_window_t *win) {
+  if (!win || !win->pixels)
+    return;
+  uint64_t flags = spin_lock_irqsave(&lock);
+  damage_window(win);
+  unlink(win);
+  uint32_t *surface = win->pixels;
+  win->pixels = 0;
+  schedule();
+  spin_unlock_irqrestore(&lock, flags);
+  kfree(surface);
+}
+
+void comp_move(comp_window_t *win, int x, int y) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (win->x != x || win->y != y) {
+    damage_window(win);
+    win->x = x;
+    win->y = y;
+    damage_window(win);
+    schedule();
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void comp_raise(comp_window_t *win) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (top != win) {
+    unlink(win);
+    win->below = top;
+    if (top)
+      top->above = win;
+    top = win;
+    damage_window(win);
+    schedule();
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+// Clip a surface rectangle in place, false if nothing is left
+static bool clip_surface(const comp_window_t *win, int *x, int *y, int *w,
+                         int *h) {
+  if (*x < 0) {
+    *w += *x;
+    *x = 0;
+  }
+  if (*y < 0) {
+    *h += *y;
+    *y = 0;
+  }
+  if (*x + *w > win->w)
+    *w = win->w - *x;
+  if (*y + *h > win->h)
+    *h = win->h - *y;
+  return *w > 0 && *h > 0;
+}
+
+static void damage_locked(comp_window_t *win, int x, int y, int w, int h) {
+  if (!clip_surface(win, &x, &y, &w, &h))
+    return;
+  add_damage((comp_rect_t){win->x + x, win->y + y, win->x + x + w,
+                           win->y + y + h});
+  schedule();
+}
+
+void comp_damage(comp_window_t *win, int x, int y, int w, int h) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  damage_locked(win, x, y, w, h);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+static void fill_locked(comp_window_t *win, int x, int y, int w, int h,
+                        uint32_t color) {
+  if (!clip_surface(win, &x, &y, &w, &h))
+    return;
+  uint32_t *row = win->pixels + (int64_t)y * win->w + x;
+  for (int r = 0; r < h; r++, row += win->w) {
+    for (int c = 0; c < w; c++)
+      row[c] = color;
+  }
+  damage_locked(win, x, y, w, h);
+}
+
+void comp_fill_rect(comp_window_t *win, int x, int y, int w, int h,
+                    uint32_t color) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  fill_locked(win, x, y, w, h, color);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+static void char_locked(comp_window_t *win, int x, int y, char c, uint32_t fg,
+                        uint32_t bg) {
+  // The glyph cache is graphics.c's, shared with the other CPUs
+  uint64_t flags = graphics_lock();
+  graphics_draw_char_surface(win->pixels, win->w, win->h, x, y, c, fg, bg);
+  graphics_unlock(flags);
+  damage_locked(win, x, y, graphics_get_font_width(),
+                graphics_get_font_height());
+}
+
+void comp_draw_char(comp_window_t *win, int x, int y, char c, uint32_t fg,
+                    uint32_t bg) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  char_locked(win, x, y, c, fg, bg);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+static void string_locked(comp_window_t *win, int x, int y, const char *str,
+                          uint32_t fg, uint32_t bg) {
+  int fw = graphics_get_font_width();
+  for (; *str; str++, x += fw)
+    char_locked(win, x, y, *str, fg, bg);
+}
+
+void comp_draw_string(comp_window_t *win, int x, int y, const char *str,
+                      uint32_t fg, uint32_t bg) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  string_locked(win, x, y, str, fg, bg);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void comp_scroll(comp_window_t *win, int x, int y, int w, int h, int dy,
+                 uint32_t color) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (dy > 0 && clip_surface(win, &x, &y, &w, &h)) {
+    if (dy > h)
+      dy = h;
+    uint32_t *dst = win->pixels + (int64_t)y * win->w + x;
+    const uint32_t *src = dst + (int64_t)dy * win->w;
+    for (int r = 0; r < h - dy; r++, dst += win->w, src += win->w)
+      memcpy(dst, src, w * sizeof(*dst));
+    fill_locked(win, x, y + h - dy, w, dy, color);
+    damage_locked(win, x, y, w, h);
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void comp_draw_frame(comp_window_t *win, const char *title) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  fill_locked(win, 0, 0, win->w, COMP_TITLE_HEIGHT, COLOR_TITLE_BAR);
+  string_locked(win, 10, (COMP_TITLE_HEIGHT - graphics_get_font_height()) / 2,
+                title, COLOR_TITLE_TEXT, COLOR_TITLE_BAR);
+  fill_locked(win, 0, 0, win->w, COMP_BORDER, COLOR_BLACK);
+  fill_locked(win, 0, win->h - COMP_BORDER, win->w, COMP_BORDER, COLOR_BLACK);
+  fill_locked(win, 0, 0, COMP_BORDER, win->h, COLOR_BLACK);
+  fill_locked(win, win->w - COMP_BORDER, 0, COMP_BORDER, win->h, COLOR_BLACK);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void comp_flush(void) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  compose();
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+uint64_t comp_frames(void) { return frames; }
+
+uint64_t comp_pixels(void) { return composed_pixels; }
@@ -0,0 +1,89 @@
+#pragma once
+#include "graphics.h"
+#include "stdint.h"
+
+// Window compositor for the graphical desktop. Every window draws into a
+// surface of its own, w x h 0x00RRGGBB pixels in RAM, and reports what it
+// changed with comp_damage. Damage is kept as a short list of screen
+// rectangles that never overlap: a new one is merged with a rectangle it
+// touches when the union wastes little, and otherwise cut into the parts
+// not yet covered. Composing walks each rectangle down the stack of
+// windows, top first: the part a window covers is copied from its surface
+// and only the rest goes on to the windows below, so every damaged pixel
+// is written once, and hidden parts are never drawn. What no window
+// covers gets the desktop colour. The result goes to the back buffer and
+// out with graphics_present, so a frame costs what changed, not the size
+// of the screen.
+//
+// Frames are composed by a tasklet, so damage reported in a burst (a line
+// of console output, a window dragged a few pixels at a time) becomes one
+// frame. comp_flush composes at once, before tasklets run and for callers
+// that want the frame on screen before going on.
+#define COMP_MAX_WINDOWS 16
+#define COMP_MAX_DAMAGE GRAPHICS_MAX_DIRTY // So present copies no more
+
+// A window's shadow is a COMP_SHADOW_OFFSET pixel offset copy of its
+// rectangle in COMP_SHADOW_COLOR, under it
+#define COMP_SHADOW 0x1
+#define COMP_SHADOW_OFFSET 4
+
+// Frame drawn by comp_draw_frame: a title bar above the client area and a
+// one pixel border around it
+#define COMP_TITLE_HEIGHT 24
+#define COMP_BORDER 1
+
+typedef struct comp_window {
+  int x, y; // Screen position of the surface's top left corner
+  int w, h;
+  uint32_t flags; // COMP_*
+  uint32_t *pixels;
+  struct comp_window *above, *below; // Stacking order
+} comp_window_t;
+
+// Take over the screen, through the back buffer. False without a
+// framebuffer or memory for the back buffer.
+bool comp_init(uint32_t background);
+bool comp_is_active(void);
+void comp_set_background(uint32_t color);
+// Compose the whole screen again, after a mode switch
+void comp_redraw(void);
+// Stop composing while something else (a program, a benchmark) draws on
+// the screen; damage is still collected. Resuming composes the whole
+// screen again, if it was suspended.
+void comp_suspend(void);
+void comp_resume(void);
+
+// A window on top of the others, its surface filled with color. NULL when
+// out of windows or memory.
+comp_window_t *comp_create(int x, int y, int w, int h, uint32_t flags,
+                           uint32_t color);
+void comp_destroy(comp_window_t *win);
+// Damage the old and the new place, nothing else is redrawn
+void comp_move(comp_window_t *win, int x, int y);
+void comp_raise(comp_window_t *win);
+
+// Drawing on a surface, in its own coordinates, clipped to it. Each
+// damages what it drew.
+void comp_fill_rect(comp_window_t *win, int x, int y, int w, int h,
+                    uint32_t color);
+void comp_draw_char(comp_window_t *win, int x, int y, char c, uint32_t fg,
+                    uint32_t bg);
+void comp_draw_string(comp_window_t *win, int x, int y, const char *str,
+                      uint32_t fg, uint32_t bg);
+// Move the rows of [x, x + w) x [y, y + h) up by dy, the dy rows freed at
+// the bottom are filled with color
+void comp_scroll(comp_window_t *win, int x, int y, int w, int h, int dy,
+                 uint32_t color);
+// Title bar and border, around a client area of w - 2 * COMP_BORDER by
+// h - COMP_TITLE_HEIGHT - COMP_BORDER at (COMP_BORDER, COMP_TITLE_HEIGHT)
+void comp_draw_frame(comp_window_t *win, const char *title);
+
+// Report pixels changed by writing win->pixels directly
+void comp_damage(comp_window_t *win, int x, int y, int w, int h);
+
+// Compose and present the damage now
+void comp_flush(void);
+
+// Frames composed, and pixels composed over all of them
+uint64_t comp_frames(void);
+uint64_t comp_pixels(void);
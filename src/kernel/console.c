@@ -0,0 +1,385 @@
+#include "console.h"
+#include "compositor.h"
+#include "serial.h"
+#include "stdint.h"
+
+// The text console keeps every line in a RAM ring, which is what scrollback
+// reads from. VGA memory holds 32KB, enough for 204 lines: the screen is a
+// 25 line window into it that moves down one line per scroll by
+// reprogramming the CRTC start address. Only when the window reaches the
+// end is the live screen copied back to the top in one bulk copy.
+#define VGA_MEMORY_LINES (0x8000 / (VGA_WIDTH * 2))
+#define CONSOLE_LINE_MASK (CONSOLE_LINES - 1)
+
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define VGA_CRTC_START_HIGH 0x0C
+#define VGA_CRTC_CURSOR_HIGH 0x0E
+
+#define VGA_CELL(c, color) ((uint16_t)(uint8_t)(c) | ((uint16_t)(color) << 8))
+#define BLANK_CELL VGA_CELL(' ', VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK))
+
+static uint16_t lines[CONSOLE_LINES][VGA_WIDTH];
+static uint64_t screen_top = 0;    // Ring line shown on screen row 0
+static uint64_t history_start = 0; // Oldest ring line still kept
+static int view_back = 0;          // Lines scrolled back, 0 is the live view
+
+// Global cursor position, relative to the screen
+static int cursor_row = 0;
+static int cursor_col = 0;
+
+static volatile uint16_t *const video_memory = (volatile uint16_t *)VGA_MEMORY;
+static uint32_t vram_top = 0; // VGA memory line shown on screen row 0
+
+// Last values written to the CRTC, so unchanged registers are skipped
+static uint16_t hw_start = 0xFFFF;
+static uint16_t hw_cursor = 0xFFFF;
+
+// Graphical mirror of the screen: each cell is drawn into the window's
+// client area as it changes, with an underline for the cursor
+#define CELL_WIDTH 8
+#define CELL_HEIGHT 16
+#define CELL_X(col) (COMP_BORDER + (col) * CELL_WIDTH)
+#define CELL_Y(row) (COMP_TITLE_HEIGHT + (row) * CELL_HEIGHT)
+
+static comp_window_t *window = 0;
+static int window_cursor = -1; // Cell holding the drawn cursor, -1 if none
+
+static const uint32_t palette[16] = {
+    RGB(0, 0, 0),       RGB(0, 0, 170),     RGB(0, 170, 0),
+    RGB(0, 170, 170),   RGB(170, 0, 0),     RGB(170, 0, 170),
+    RGB(170, 85, 0),    RGB(170, 170, 170), RGB(85, 85, 85),
+    RGB(85, 85, 255),   RGB(85, 255, 85),   RGB(85, 255, 255),
+    RGB(255, 85, 85),   RGB(255, 85, 255),  RGB(255, 255, 85),
+    RGB(255, 255, 255)};
+
+// The screen shows what needs reading, the serial log keeps everything
+static int levels[CONSOLE_BACKENDS] = {LOG_INFO, LOG_DEBUG};
+
+// Helper for port I/O
+static inline void outb(uint16_t port, uint8_t val) {
+  __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+// High byte register first, the low byte register follows it
+static inline void crtc_write16(uint8_t high_reg, uint16_t value) {
+  outb(VGA_CRTC_INDEX, high_reg);
+  outb(VGA_CRTC_DATA, (uint8_t)(value >> 8));
+  outb(VGA_CRTC_INDEX, high_reg + 1);
+  outb(VGA_CRTC_DATA, (uint8_t)(value & 0xFF));
+}
+
+static inline void movsw(volatile uint16_t *dst, const uint16_t *src,
+                         uint64_t count) {
+  __asm__ volatile("rep movsw"
+                   : "+D"(dst), "+S"(src), "+c"(count)
+                   :
+                   : "memory");
+}
+
+static inline void stosw(volatile uint16_t *dst, uint16_t value, uint64_t count) {
+  __asm__ volatile("rep stosw" : "+D"(dst), "+c"(count) : "a"(value) : "memory");
+}
+
+static inline uint16_t *ring_line(uint64_t line) {
+  return lines[line & CONSOLE_LINE_MASK];
+}
+
+// Copy count ring lines starting at line to VGA memory line vram_line, in
+// at most two bulk copies (the ring may wrap in between)
+static void copy_from_ring(uint32_t vram_line, uint64_t line, int count) {
+  while (count > 0) {
+    int run = CONSOLE_LINES - (int)(line & CONSOLE_LINE_MASK);
+    if (run > count)
+      run = count;
+    movsw(video_memory + vram_line * VGA_WIDTH, ring_line(line),
+          (uint64_t)run * VGA_WIDTH);
+    vram_line += run;
+    line += run;
+    count -= run;
+  }
+}
+
+static void window_cell(int col, int row, uint16_t cell) {
+  comp_draw_char(window, CELL_X(col), CELL_Y(row), (char)(cell & 0xFF),
+                 palette[(cell >> 8) & 0xF], palette[(cell >> 12) & 0xF]);
+}
+
+// What the window should show on screen row row
+static inline uint16_t *view_line(int row) {
+  return ring_line(screen_top - view_back + row);
+}
+
+static void window_redraw(void) {
+  for (int row = 0; row < VGA_HEIGHT; row++) {
+    const uint16_t *line = view_line(row);
+    for (int col = 0; col < VGA_WIDTH; col++)
+      window_cell(col, row, line[col]);
+  }
+  window_cursor = -1;
+}
+
+// Move the drawn cursor to the text cursor, hidden while scrolled back
+static void window_flush(void) {
+  int want = view_back ? -1 : cursor_row * VGA_WIDTH + cursor_col;
+  if (window_cursor >= 0 && window_cursor != want) {
+    int row = window_cursor / VGA_WIDTH, col = window_cursor % VGA_WIDTH;
+    window_cell(col, row, view_line(row)[col]);
+  }
+  if (want >= 0) {
+    uint16_t cell = view_line(cursor_row)[cursor_col];
+    comp_fill_rect(window, CELL_X(cursor_col), CELL_Y(cursor_row) + CELL_HEIGHT - 2,
+                   CELL_WIDTH, 2, palette[(cell >> 8) & 0xF]);
+  }
+  window_cursor = want;
+}
+
+// Program the start address and cursor, once per output call
+static void flush(void) {
+  if (window)
+    window_flush();
+
+  uint16_t start = vram_top * VGA_WIDTH;
+  if (start != hw_start) {
+    crtc_write16(VGA_CRTC_START_HIGH, start);
+    hw_start = start;
+  }
+
+  // While scrolled back the cursor is parked just below the window
+  uint16_t pos = view_back ? (vram_top + VGA_HEIGHT) * VGA_WIDTH
+                           : (vram_top + cursor_row) * VGA_WIDTH + cursor_col;
+  if (pos != hw_cursor) {
+    crtc_write16(VGA_CRTC_CURSOR_HIGH, pos);
+    hw_cursor = pos;
+  }
+}
+
+// Output always lands on the live screen, leave scrollback first
+static void live_view(void) {
+  if (!view_back)
+    return;
+  view_back = 0;
+  copy_from_ring(vram_top, screen_top, VGA_HEIGHT);
+  if (window)
+    window_redraw();
+}
+
+static inline void put_cell(int col, int row, uint16_t cell) {
+  ring_line(screen_top + row)[col] = cell;
+  video_memory[(vram_top + row) * VGA_WIDTH + col] = cell;
+  if (window)
+    window_cell(col, row, cell);
+}
+
+// Drop the oldest lines once the ring can't hold the screen and history
+static void trim_history(void) {
+  if (screen_top + VGA_HEIGHT - history_start > CONSOLE_LINES)
+    history_start = screen_top + VGA_HEIGHT - CONSOLE_LINES;
+}
+
+// Scroll the screen content up by one line
+static void scroll(void) {
+  screen_top++;
+  trim_history();
+  uint16_t *line = ring_line(screen_top + VGA_HEIGHT - 1);
+  for (int col = 0; col < VGA_WIDTH; col++)
+    line[col] = BLANK_CELL;
+
+  if (++vram_top + VGA_HEIGHT > VGA_MEMORY_LINES) {
+    vram_top = 0;
+    copy_from_ring(0, screen_top, VGA_HEIGHT - 1);
+  }
+  stosw(video_memory + (vram_top + VGA_HEIGHT - 1) * VGA_WIDTH, BLANK_CELL,
+        VGA_WIDTH);
+
+  // Every pixel of the text area changes, one move does them all
+  if (window) {
+    comp_scroll(window, CELL_X(0), CELL_Y(0), VGA_WIDTH * CELL_WIDTH,
+                VGA_HEIGHT * CELL_HEIGHT, CELL_HEIGHT,
+                palette[(BLANK_CELL >> 12) & 0xF]);
+    if (window_cursor >= VGA_WIDTH)
+      window_cursor -= VGA_WIDTH;
+    else
+      window_cursor = -1;
+  }
+}
+
+static void newline(void) {
+  cursor_col = 0;
+  cursor_row++;
+  // Scroll screen if we've reached the bottom
+  if (cursor_row >= VGA_HEIGHT) {
+    scroll();
+    cursor_row = VGA_HEIGHT - 1;
+  }
+}
+
+static void put_char(char c, uint8_t color) {
+  if (c == '\n') {
+    newline();
+  } else if (c == '\r') {
+    cursor_col = 0;
+  } else if (c == '\b') {
+    // Backspace: move cursor back and clear character
+    if (cursor_col > 0) {
+      cursor_col--;
+      put_cell(cursor_col, cursor_row, VGA_CELL(' ', color));
+    }
+  } else {
+    put_cell(cursor_col, cursor_row, VGA_CELL(c, color));
+    if (++cursor_col >= VGA_WIDTH)
+      newline();
+  }
+}
+
+// Cursor accessors for shell
+int get_cursor_row(void) {
+  uint64_t flags = log_drain_begin();
+  int row = cursor_row;
+  log_drain_end(flags);
+  return row;
+}
+
+int get_cursor_col(void) {
+  uint64_t flags = log_drain_begin();
+  int col = cursor_col;
+  log_drain_end(flags);
+  return col;
+}
+
+void set_cursor_row(int row) {
+  uint64_t flags = log_drain_begin();
+  cursor_row = row;
+  flush();
+  log_drain_end(flags);
+}
+
+void set_cursor_col(int col) {
+  uint64_t flags = log_drain_begin();
+  cursor_col = col;
+  flush();
+  log_drain_end(flags);
+}
+
+// Clear the screen with specified color. What was on it stays in the
+// scrollback, the new screen starts at the top of VGA memory.
+void clear_screen(uint8_t color) {
+  uint64_t flags = log_drain_begin();
+  live_view();
+  screen_top += cursor_row + (cursor_col > 0);
+  trim_history();
+  for (int row = 0; row < VGA_HEIGHT; row++) {
+    uint16_t *line = ring_line(screen_top + row);
+    for (int col = 0; col < VGA_WIDTH; col++)
+      line[col] = VGA_CELL(' ', color);
+  }
+  vram_top = 0;
+  stosw(video_memory, VGA_CELL(' ', color), VGA_WIDTH * VGA_HEIGHT);
+  cursor_row = 0;
+  cursor_col = 0;
+  if (window)
+    window_redraw();
+  flush();
+  log_drain_end(flags);
+}
+
+// Print a character at a screen position, the cursor doesn't move
+void putchar_at(char c, uint8_t color, int col, int row) {
+  if (col < 0 || col >= VGA_WIDTH || row < 0 || row >= VGA_HEIGHT)
+    return;
+  uint64_t flags = log_drain_begin();
+  live_view();
+  put_cell(col, row, VGA_CELL(c, color));
+  flush();
+  log_drain_end(flags);
+}
+
+void console_set_level(int backend, int level) {
+  if (backend >= 0 && backend < CONSOLE_BACKENDS)
+    levels[backend] = level;
+}
+
+int console_get_level(int backend) {
+  if (backend < 0 || backend >= CONSOLE_BACKENDS)
+    return LOG_ERROR;
+  return levels[backend];
+}
+
+static inline bool wants(int backend, int level) {
+  return level <= levels[backend];
+}
+
+void console_emit_screen(const log_record_t *r) {
+  live_view();
+  for (int i = 0; i < r->len; i++)
+    put_char(r->text[i], r->color);
+  flush();
+}
+
+void console_emit(const log_record_t *r) {
+  if (wants(CONSOLE_VGA, r->level))
+    console_emit_screen(r);
+  if (wants(CONSOLE_SERIAL, r->level))
+    serial_write(r->text, r->len);
+}
+
+void klog(int level, const char *str, uint8_t color) {
+  uint64_t len = 0;
+  while (str[len])
+    len++;
+  log_write(level, color, str, len);
+}
+
+// Print a character and advance cursor
+void kputc(char c, uint8_t color) { log_write(LOG_INFO, color, &c, 1); }
+
+// Print a string with specified color
+void kprint(const char *str, uint8_t color) { klog(LOG_INFO, str, color); }
+
+// Print a newline
+void knewline(void) { log_write(LOG_INFO, 0, "\n", 1); }
+
+// Print a horizontal line
+void kprint_line(char c, int count, uint8_t color) {
+  char run[LOG_TEXT];
+  for (int i = 0; i < LOG_TEXT; i++)
+    run[i] = c;
+  for (; count > 0; count -= LOG_TEXT)
+    log_write(LOG_INFO, color, run, count < LOG_TEXT ? (uint64_t)count : LOG_TEXT);
+}
+
+int console_scrollback_lines(void) {
+  uint64_t flags = log_drain_begin();
+  int count = (int)(screen_top - history_start);
+  log_drain_end(flags);
+  return count;
+}
+
+void console_scroll_view(int count) {
+  uint64_t flags = log_drain_begin();
+  int back = view_back + count;
+  int history = (int)(screen_top - history_start);
+  if (back > history)
+    back = history;
+  if (back < 0)
+    back = 0;
+  if (back != view_back) {
+    view_back = back;
+    copy_from_ring(vram_top, screen_top - view_back, VGA_HEIGHT);
+    if (window)
+      window_redraw();
+    flush();
+  }
+  log_drain_end(flags);
+}
+
+void console_set_window(struct comp_window *win) {
+  uint64_t flags = log_drain_begin();
+  window = win;
+  window_cursor = -1;
+  if (window) {
+    window_redraw();
+    flush();
+  }
+  log_drain_end(flags);
+}
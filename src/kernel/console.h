@@ -0,0 +1,80 @@
+#pragma once
+#include "log.h"
+#include "stdint.h"
+
+// VGA text mode constants
+#define VGA_WIDTH 80
+#define VGA_HEIGHT 25
+#define VGA_MEMORY 0xB8000
+
+// VGA color attributes
+#define VGA_COLOR_BLACK 0x0
+#define VGA_COLOR_BLUE 0x1
+#define VGA_COLOR_GREEN 0x2
+#define VGA_COLOR_CYAN 0x3
+#define VGA_COLOR_RED 0x4
+#define VGA_COLOR_MAGENTA 0x5
+#define VGA_COLOR_BROWN 0x6
+#define VGA_COLOR_LIGHT_GRAY 0x7
+#define VGA_COLOR_DARK_GRAY 0x8
+#define VGA_COLOR_LIGHT_BLUE 0x9
+#define VGA_COLOR_LIGHT_GREEN 0xA
+#define VGA_COLOR_LIGHT_CYAN 0xB
+#define VGA_COLOR_LIGHT_RED 0xC
+#define VGA_COLOR_LIGHT_MAGENTA 0xD
+#define VGA_COLOR_YELLOW 0xE
+#define VGA_COLOR_WHITE 0xF
+
+// Create VGA color attribute byte
+#define VGA_ENTRY_COLOR(fg, bg) ((bg << 4) | fg)
+
+// Lines kept in RAM, the visible screen included (power of two)
+#define CONSOLE_LINES 256
+
+// Output backends, each with its own level: a message goes to a backend
+// when its level is at or below the backend's
+#define CONSOLE_VGA 0
+#define CONSOLE_SERIAL 1
+#define CONSOLE_BACKENDS 2
+
+void console_set_level(int backend, int level);
+int console_get_level(int backend);
+
+// Text output, through the kernel log (log.h). Shown, characters go to an
+// in-RAM ring of lines and to VGA memory, the CRTC start address and
+// hardware cursor written once per record, and to COM1 without colour.
+// The k* calls are LOG_INFO, klog picks the level.
+void klog(int level, const char *str, uint8_t color);
+void kputc(char c, uint8_t color);
+void kprint(const char *str, uint8_t color);
+void knewline(void);
+void kprint_line(char c, int count, uint8_t color);
+// Put a log record on the backends whose level passes it. The log drain
+// calls this, holding the drain lock.
+void console_emit(const log_record_t *r);
+// The same on the screen alone, whatever its level, for dmesg; the caller
+// holds the drain lock (log_drain_begin)
+void console_emit_screen(const log_record_t *r);
+
+// These act on the screen directly, after the log is drained
+void clear_screen(uint8_t color);
+void putchar_at(char c, uint8_t color, int col, int row);
+
+int get_cursor_row(void);
+int get_cursor_col(void);
+void set_cursor_row(int row);
+void set_cursor_col(int col);
+
+// Mirror the screen into a compositor window (compositor.h), drawn as
+// VGA_WIDTH x VGA_HEIGHT cells of 8x16 pixels in its client area, so the
+// console shows in graphics mode. NULL stops it. The window size below
+// leaves room for comp_draw_frame's title bar and border.
+struct comp_window;
+void console_set_window(struct comp_window *win);
+#define CONSOLE_WINDOW_WIDTH (VGA_WIDTH * 8 + 2)
+#define CONSOLE_WINDOW_HEIGHT (VGA_HEIGHT * 16 + 25)
+
+// Scrollback: move the view count lines back in history (negative moves
+// forward). Any output snaps the view back to the live screen.
+void console_scroll_view(int count);
+int console_scrollback_lines(void);
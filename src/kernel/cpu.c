@@ -0,0 +1,105 @@
+#include "cpu.h"
+#include "stdint.h"
+
+static uint32_t features = 0;
+
+void cpu_init(void) {
+  uint32_t eax, ebx, ecx, edx;
+
+  cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+  uint32_t max_leaf = eax;
+
+  cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+  if (edx & (1u << 9))
+    features |= CPU_FEATURE_APIC;
+  if (edx & (1u << 16))
+    features |= CPU_FEATURE_PAT;
+  if (edx & (1u << 24))
+    features |= CPU_FEATURE_FXSR;
+  if (edx & (1u << 25))
+    features |= CPU_FEATURE_SSE;
+  if (edx & (1u << 26))
+    features |= CPU_FEATURE_SSE2;
+  if (ecx & (1u << 0))
+    features |= CPU_FEATURE_SSE3;
+  if (ecx & (1u << 3))
+    features |= CPU_FEATURE_MWAIT;
+  if (ecx & (1u << 9))
+    features |= CPU_FEATURE_SSSE3;
+  if (ecx & (1u << 19))
+    features |= CPU_FEATURE_SSE41;
+  if (ecx & (1u << 20))
+    features |= CPU_FEATURE_SSE42;
+  if (ecx & (1u << 21))
+    features |= CPU_FEATURE_X2APIC;
+  if (ecx & (1u << 23))
+    features |= CPU_FEATURE_POPCNT;
+  if (ecx & (1u << 26))
+    features |= CPU_FEATURE_XSAVE;
+  if (ecx & (1u << 28))
+    features |= CPU_FEATURE_AVX;
+
+  if (max_leaf >= 7) {
+    cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    if (ebx & (1u << 5))
+      features |= CPU_FEATURE_AVX2;
+    if (ebx & (1u << 9))
+      features |= CPU_FEATURE_ERMS;
+    if (edx & (1u << 4))
+      features |= CPU_FEATURE_FSRM;
+  }
+
+  cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+  if (eax >= 0x80000001) {
+    cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    if (edx & (1u << 26))
+      features |= CPU_FEATURE_PDPE1GB;
+  }
+}
+
+bool cpu_has(uint32_t feature) { return (features & feature) == feature; }
+
+uint32_t cpu_features(void) { return features; }
+
+const char *cpu_feature_name(uint32_t feature) {
+  switch (feature) {
+  case CPU_FEATURE_FXSR:
+    return "fxsr";
+  case CPU_FEATURE_SSE:
+    return "sse";
+  case CPU_FEATURE_SSE2:
+    return "sse2";
+  case CPU_FEATURE_SSE3:
+    return "sse3";
+  case CPU_FEATURE_SSSE3:
+    return "ssse3";
+  case CPU_FEATURE_SSE41:
+    return "sse4.1";
+  case CPU_FEATURE_SSE42:
+    return "sse4.2";
+  case CPU_FEATURE_POPCNT:
+    return "popcnt";
+  case CPU_FEATURE_XSAVE:
+    return "xsave";
+  case CPU_FEATURE_AVX:
+    return "avx";
+  case CPU_FEATURE_AVX2:
+    return "avx2";
+  case CPU_FEATURE_PAT:
+    return "pat";
+  case CPU_FEATURE_ERMS:
+    return "erms";
+  case CPU_FEATURE_APIC:
+    return "apic";
+  case CPU_FEATURE_X2APIC:
+    return "x2apic";
+  case CPU_FEATURE_PDPE1GB:
+    return "pdpe1gb";
+  case CPU_FEATURE_FSRM:
+    return "fsrm";
+  case CPU_FEATURE_MWAIT:
+    return "mwait";
+  default:
+    return "?";
+  }
+}
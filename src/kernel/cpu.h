@@ -0,0 +1,50 @@
+#pragma once
+#include "stdint.h"
+
+// CPU feature bits detected by cpu_init (not the raw CPUID positions)
+#define CPU_FEATURE_FXSR (1u << 0)
+#define CPU_FEATURE_SSE (1u << 1)
+#define CPU_FEATURE_SSE2 (1u << 2)
+#define CPU_FEATURE_SSE3 (1u << 3)
+#define CPU_FEATURE_SSSE3 (1u << 4)
+#define CPU_FEATURE_SSE41 (1u << 5)
+#define CPU_FEATURE_SSE42 (1u << 6)
+#define CPU_FEATURE_POPCNT (1u << 7)
+#define CPU_FEATURE_XSAVE (1u << 8)
+#define CPU_FEATURE_AVX (1u << 9)
+#define CPU_FEATURE_AVX2 (1u << 10)
+#define CPU_FEATURE_PAT (1u << 11)
+#define CPU_FEATURE_ERMS (1u << 12) // Fast REP MOVSB/STOSB
+#define CPU_FEATURE_APIC (1u << 13)
+#define CPU_FEATURE_X2APIC (1u << 14)
+#define CPU_FEATURE_PDPE1GB (1u << 15) // 1GB pages
+#define CPU_FEATURE_FSRM (1u << 16)    // Fast short REP MOVSB
+#define CPU_FEATURE_MWAIT (1u << 17)   // MONITOR/MWAIT
+#define CPU_FEATURE_LAST CPU_FEATURE_MWAIT
+
+void cpu_init(void);
+bool cpu_has(uint32_t feature);
+uint32_t cpu_features(void);
+
+// Name of a single feature bit, for diagnostics
+const char *cpu_feature_name(uint32_t feature);
+
+static inline uint64_t rdmsr(uint32_t msr) {
+  uint32_t lo, hi;
+  __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+  __asm__ volatile("wrmsr"
+                   :
+                   : "c"(msr), "a"((uint32_t)value),
+                     "d"((uint32_t)(value >> 32)));
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
+                         uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+  __asm__ volatile("cpuid"
+                   : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                   : "a"(leaf), "c"(subleaf));
+}
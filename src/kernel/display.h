@@ -0,0 +1,46 @@
+#pragma once
+#include "stdint.h"
+
+// Display drivers under graphics.c. Stage2 leaves the screen in whatever
+// VESA mode it set through the BIOS; a driver for the adapter itself can
+// change the mode at run time, scan out either of two framebuffers (page
+// flipping), and, where the screen is a copy kept by the host, push only
+// the damaged rectangles to it. graphics_init_display picks the driver.
+#define DISPLAY_BUFFERS 2
+
+// Exclusive right / bottom, like the damage graphics.c keeps
+typedef struct {
+  int x0, y0, x1, y1;
+} display_rect_t;
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  uint32_t pitch; // Bytes per row
+  uint8_t bpp;
+  uint8_t red_pos, red_size;
+  uint8_t green_pos, green_size;
+  uint8_t blue_pos, blue_size;
+  int buffers; // 1, or DISPLAY_BUFFERS when flip can switch between them
+  volatile uint8_t *pixels[DISPLAY_BUFFERS]; // Kernel address of each
+} display_mode_t;
+
+typedef struct {
+  const char *name;
+  // Switch to width x height at bpp bits per pixel and describe the result.
+  // A width or height of 0 picks the adapter's preferred size. The new
+  // framebuffers start out black and buffer 0 is shown.
+  bool (*set_mode)(uint32_t width, uint32_t height, uint32_t bpp,
+                   display_mode_t *mode);
+  // Scan out buffer from the next refresh on, NULL with one buffer
+  void (*flip)(int buffer);
+  // Send rects of buffer to the screen. NULL when the adapter scans the
+  // framebuffer out by itself and stores show without it.
+  void (*flush)(int buffer, const display_rect_t *rects, int count);
+} display_driver_t;
+
+// Bochs/QEMU VGA (and VirtualBox's) through the BGA ports, NULL if absent
+const display_driver_t *bga_probe(void);
+// virtio-gpu, NULL if absent or it fails to start. With vga_only, only a
+// virtio-vga: the adapter the firmware's VGA modes are on.
+const display_driver_t *virtio_gpu_probe(bool vga_only);
@@ -14,6 +14,9 @@ PAGE_WRITABLE   equ 1 << 1
 PAGE_HUGE       equ 1 << 7
 
 global _start
+global pml4_table
+global gdt64_ptr        ; Reused by the AP trampoline (smp_trampoline.asm)
+global stack_top        ; Boot CPU's kernel stack
 extern start64
 
 ; ============================================================================
@@ -39,8 +42,9 @@ _start:
     cli
     
     ; Save multiboot info (EAX = magic, EBX = info pointer)
-    mov edi, eax            ; Save magic in EDI
-    mov esi, ebx            ; Save multiboot info in ESI
+    ; EDI/ESI are clobbered by the page table setup, so keep them in memory
+    mov [multiboot_magic], eax
+    mov [multiboot_info], ebx
     
     ; Set up temporary 32-bit stack
     mov esp, stack_top
@@ -202,9 +206,10 @@ long_mode_start:
     ; Clear direction flag
     cld
     
-    ; RDI already contains multiboot magic (from 32-bit EDI)
-    ; RSI already contains multiboot info ptr (from 32-bit ESI)
-    ; These are the first two arguments in System V AMD64 ABI
+    ; Pass multiboot magic and info pointer as the first two arguments
+    ; (System V AMD64 ABI), zero-extended from the saved 32-bit values
+    mov edi, [multiboot_magic]
+    mov esi, [multiboot_info]
     
     ; Call 64-bit kernel main
     call start64
@@ -252,6 +257,12 @@ pd_table:
 pt_table:
     resb 4096
 
+; Multiboot magic/info saved across the long mode switch
+multiboot_magic:
+    resd 1
+multiboot_info:
+    resd 1
+
 ; ============================================================================
 ; STACK (16KB)
 ; ============================================================================
@@ -0,0 +1,265 @@
+#include "exec.h"
+#include "fat.h"
+#include "kmalloc.h"
+#include "pmm.h"
+#include "string.h"
+
+#define ELF_MAGIC 0x464C457F // "\x7FELF"
+#define ELF_CLASS64 2
+#define ELF_DATA_LSB 1
+#define ET_EXEC 2
+#define EM_X86_64 0x3E
+#define PT_LOAD 1
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+#define PAGE_MASK (PMM_PAGE_SIZE - 1)
+
+typedef struct {
+  uint32_t magic;
+  uint8_t class;
+  uint8_t data;
+  uint8_t version;
+  uint8_t pad[9];
+  uint16_t type;
+  uint16_t machine;
+  uint32_t version2;
+  uint64_t entry;
+  uint64_t phoff;
+  uint64_t shoff;
+  uint32_t flags;
+  uint16_t ehsize;
+  uint16_t phentsize;
+  uint16_t phnum;
+  uint16_t shentsize;
+  uint16_t shnum;
+  uint16_t shstrndx;
+} __attribute__((packed)) elf64_ehdr_t;
+
+typedef struct {
+  uint32_t type;
+  uint32_t flags;
+  uint64_t offset;
+  uint64_t vaddr;
+  uint64_t paddr;
+  uint64_t filesz;
+  uint64_t memsz;
+  uint64_t align;
+} __attribute__((packed)) elf64_phdr_t;
+
+// Exits of every process, exec_wait checks its own flag. Kept out of
+// process_t so the exiting task is done with it once the flag is set.
+static wait_queue_t exit_waiters = WAIT_QUEUE_INIT;
+
+// Turn the PT_LOAD segments into regions of space; *image_end is the end
+// of the highest one
+static int map_segments(vm_space_t *space, int fd, const elf64_ehdr_t *eh,
+                        uint64_t *image_end) {
+  static const int prot_of[8] = {
+      0, VM_EXEC, VM_WRITE, VM_WRITE | VM_EXEC, VM_READ, VM_READ | VM_EXEC,
+      VM_READ | VM_WRITE, VM_READ | VM_WRITE | VM_EXEC};
+
+  elf64_phdr_t ph[EXEC_MAX_SEGMENTS];
+  uint64_t size = (uint64_t)eh->phnum * sizeof(elf64_phdr_t);
+  if (fat_pread(fd, eh->phoff, ph, size) != (int64_t)size)
+    return EXEC_ENOEXEC;
+
+  bool entry_mapped = false;
+  *image_end = VM_USER_BASE;
+  for (int i = 0; i < eh->phnum; i++) {
+    if (ph[i].type != PT_LOAD || !ph[i].memsz)
+      continue;
+    if (ph[i].filesz > ph[i].memsz ||
+        (ph[i].vaddr & PAGE_MASK) != (ph[i].offset & PAGE_MASK) ||
+        ph[i].vaddr < VM_USER_BASE ||
+        ph[i].vaddr + ph[i].memsz > VM_STACK_TOP - VM_STACK_SIZE ||
+        ph[i].vaddr + ph[i].memsz < ph[i].vaddr)
+      return EXEC_ENOEXEC;
+
+    // Whole pages: the part of the first one before vaddr comes from the
+    // file just the same
+    uint64_t lead = ph[i].vaddr & PAGE_MASK;
+    uint64_t start = ph[i].vaddr - lead;
+    uint64_t end = (ph[i].vaddr + ph[i].memsz + PAGE_MASK) & ~PAGE_MASK;
+    uint32_t prot = prot_of[ph[i].flags & (PF_R | PF_W | PF_X)];
+    if (!vm_map(space, start, end, prot, fd, ph[i].offset - lead,
+                ph[i].filesz + lead))
+      return EXEC_ENOEXEC;
+    if (end > *image_end)
+      *image_end = end;
+    if (eh->entry >= ph[i].vaddr && eh->entry < ph[i].vaddr + ph[i].memsz &&
+        (prot & VM_EXEC))
+      entry_mapped = true;
+  }
+  return entry_mapped ? EXEC_OK : EXEC_ENOEXEC;
+}
+
+// Lay out the arguments at the top of the stack the way the SysV ABI has
+// them at process entry: argc at the returned, 16 byte aligned, pointer,
+// then argv[0..argc] and the strings above. The pages fault in as written.
+static uint64_t push_args(process_t *proc) {
+  uint64_t strings = VM_STACK_TOP - proc->args_size;
+  memcpy((void *)(uintptr_t)strings, proc->args, proc->args_size);
+
+  uint64_t words = (uint64_t)proc->argc + 2;
+  uint64_t sp = (strings - words * 8) & ~15ULL;
+  uint64_t *frame = (uint64_t *)(uintptr_t)sp;
+  frame[0] = (uint64_t)proc->argc;
+  uint64_t arg = strings;
+  for (int i = 0; i < proc->argc; i++) {
+    frame[1 + i] = arg;
+    while (*(const char *)(uintptr_t)arg++)
+      ;
+  }
+  frame[1 + proc->argc] = 0;
+
+  kfree(proc->args);
+  proc->args = 0;
+  return sp;
+}
+
+static void process_main(void *arg) {
+  process_t *proc = arg;
+  task_t *task = task_current();
+  task->process = proc;
+  task->vm = proc->vm;
+  vm_activate(proc->vm);
+  user_enter(proc->entry, push_args(proc));
+}
+
+// Copy argv (or just the path) back to back into proc->args
+static int pack_args(process_t *proc, const char *path, char *const argv[]) {
+  const char *only[2] = {path, 0};
+  const char *const *list = argv ? (const char *const *)argv : only;
+  uint32_t size = 0;
+  int argc = 0;
+  for (; list[argc]; argc++) {
+    if (argc == EXEC_MAX_ARGS)
+      return EXEC_E2BIG;
+    for (const char *p = list[argc]; *p; p++)
+      size++;
+    if (++size > EXEC_ARGS_MAX)
+      return EXEC_E2BIG;
+  }
+
+  char *args = kmalloc(size ? size : 1);
+  if (!args)
+    return EXEC_ENOMEM;
+  char *dst = args;
+  for (int i = 0; i < argc; i++)
+    for (const char *p = list[i];; p++)
+      if (!(*dst++ = *p))
+        break;
+  proc->args = args;
+  proc->args_size = size;
+  proc->argc = argc;
+  return EXEC_OK;
+}
+
+int exec_spawn(const char *path, char *const argv[], process_t **out) {
+  int fd = fat_open(path);
+  if (fd < 0)
+    return fd == FAT_ENOMEM ? EXEC_ENOMEM : EXEC_ENOENT;
+
+  elf64_ehdr_t eh;
+  int status = EXEC_OK;
+  if (fat_pread(fd, 0, &eh, sizeof(eh)) != (int64_t)sizeof(eh) ||
+      eh.magic != ELF_MAGIC || eh.class != ELF_CLASS64 ||
+      eh.data != ELF_DATA_LSB || eh.type != ET_EXEC ||
+      eh.machine != EM_X86_64 || eh.phentsize != sizeof(elf64_phdr_t) ||
+      !eh.phnum || eh.phnum > EXEC_MAX_SEGMENTS)
+    status = EXEC_ENOEXEC;
+
+  process_t *proc = 0;
+  vm_space_t *space = 0;
+  uint64_t image_end = 0;
+  if (status == EXEC_OK) {
+    proc = kmalloc(sizeof(process_t));
+    if (proc)
+      proc->args = 0;
+    space = vm_create();
+    if (!proc || !space)
+      status = EXEC_ENOMEM;
+  }
+  if (status == EXEC_OK)
+    status = map_segments(space, fd, &eh, &image_end);
+  if (status == EXEC_OK)
+    status = pack_args(proc, path, argv);
+  if (status == EXEC_OK &&
+      !vm_map(space, VM_STACK_TOP - VM_STACK_SIZE, VM_STACK_TOP,
+              VM_READ | VM_WRITE, -1, 0, 0))
+    status = EXEC_ENOMEM;
+
+  if (status == EXEC_OK) {
+    proc->vm = space;
+    proc->fd = fd;
+    proc->entry = eh.entry;
+    proc->brk_start = proc->brk = image_end;
+    proc->exited = false;
+    proc->exit_code = 0;
+    memset(&proc->usage, 0, sizeof(proc->usage));
+
+    // Named after the file
+    const char *name = path;
+    for (const char *p = path; *p; p++)
+      if (*p == '/' || *p == ':')
+        name = p + 1;
+    proc->task = task_create(name, process_main, proc);
+    if (!proc->task)
+      status = EXEC_ENOMEM;
+  }
+
+  if (status != EXEC_OK) {
+    vm_destroy(space);
+    if (proc)
+      kfree(proc->args);
+    kfree(proc);
+    fat_close(fd);
+    return status;
+  }
+  *out = proc;
+  return EXEC_OK;
+}
+
+int exec_wait(process_t *proc, exec_usage_t *usage) {
+  if (sched_can_block()) {
+    WAIT_EVENT(&exit_waiters, __atomic_load_n(&proc->exited, __ATOMIC_ACQUIRE));
+  } else {
+    while (!__atomic_load_n(&proc->exited, __ATOMIC_ACQUIRE))
+      __asm__ volatile("pause");
+  }
+  int code = proc->exit_code;
+  if (usage)
+    *usage = proc->usage;
+  kfree(proc);
+  return code;
+}
+
+int exec_run(const char *path, char *const argv[]) {
+  process_t *proc;
+  int status = exec_spawn(path, argv, &proc);
+  return status == EXEC_OK ? exec_wait(proc, 0) : status;
+}
+
+void exec_exit(int code) {
+  task_t *task = task_current();
+  process_t *proc = task->process;
+  if (!proc)
+    task_exit();
+
+  // Off the process's tables before they go
+  task->vm = 0;
+  task->process = 0;
+  vm_activate(0);
+  proc->usage.minor_faults = proc->vm->minor_faults;
+  proc->usage.major_faults = proc->vm->major_faults;
+  proc->usage.resident = proc->vm->resident;
+  vm_destroy(proc->vm);
+  fat_close(proc->fd);
+
+  proc->exit_code = code;
+  __atomic_store_n(&proc->exited, true, __ATOMIC_RELEASE);
+  wait_queue_wake_all(&exit_waiters);
+  task_exit();
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include "sched.h"
+#include "stdint.h"
+#include "vm.h"
+
+// ELF64 programs in their own address space. Only the headers are read up
+// front: every PT_LOAD segment becomes a region that faults its pages in
+// from the file through the buffer cache, and .bss and the stack are
+// demand-zero, so a program starts as soon as its headers are checked.
+#define EXEC_OK 0
+#define EXEC_ENOENT -1  // No such file
+#define EXEC_ENOEXEC -2 // Not an x86-64 executable we can load
+#define EXEC_ENOMEM -3
+#define EXEC_E2BIG -4   // Too many or too long arguments
+
+#define EXEC_MAX_SEGMENTS 16
+#define EXEC_PATH_MAX 256
+#define EXEC_MAX_ARGS 64
+#define EXEC_ARGS_MAX 4096 // Bytes of argument strings, terminators included
+
+// What a process used, from its address space at exit
+typedef struct {
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  uint64_t resident; // Pages still mapped at exit
+} exec_usage_t;
+
+typedef struct process {
+  vm_space_t *vm;
+  task_t *task;
+  int fd; // The executable, backs the segments
+  uint64_t entry;
+  // The program break (SYS_SBRK): the heap region runs from brk_start,
+  // just past the image, to brk rounded up to a page
+  uint64_t brk_start, brk;
+  // Argument strings back to back, copied onto the stack at entry
+  char *args;
+  uint32_t args_size;
+  int argc;
+  volatile bool exited;
+  int exit_code;
+  exec_usage_t usage;
+} process_t;
+
+// Load path and start it as a new task; *out is waited on with exec_wait.
+// argv is the null terminated list main gets, 0 for just the path.
+int exec_spawn(const char *path, char *const argv[], process_t **out);
+// Block until the process exits, free it and return its exit code. With
+// usage, also what it used.
+int exec_wait(process_t *proc, exec_usage_t *usage);
+// Spawn and wait, the exit code or a negative EXEC_E* code
+int exec_run(const char *path, char *const argv[]);
+
+// End the calling process, from its own task (SYS_EXIT, fatal faults)
+void exec_exit(int code) __attribute__((noreturn));
+
+// Entry into ring 3 at rip with the given stack (syscall_entry.asm)
+void user_enter(uint64_t rip, uint64_t rsp) __attribute__((noreturn));
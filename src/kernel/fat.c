@@ -0,0 +1,716 @@
+#include "fat.h"
+#include "bcache.h"
+#include "kmalloc.h"
+#include "spinlock.h"
+#include "string.h"
+
+#define SECTOR_SIZE BLK_SECTOR_SIZE
+#define ENTRY_SIZE 32
+#define INLINE_EXTENTS 4
+#define DCACHE_NAME_LEN 32 // Longer names are looked up on disk every time
+#define MIN_HANDLES 16
+
+// A run of clusters that follow each other on disk
+typedef struct {
+  uint32_t index;   // Cluster index within the file where the run starts
+  uint32_t cluster; // Its first cluster on disk
+  uint32_t count;
+} extent_t;
+
+typedef struct {
+  fat_volume_t *vol;
+  uint8_t attr;
+  bool fixed_root; // The FAT12/16 root directory, outside the clusters
+  uint32_t size;   // Directories have none, they end with their chain
+  uint32_t first_cluster;
+  uint64_t pos;
+
+  // The chain decoded so far. 'next' is the first cluster after the last
+  // extent, 0 once the whole chain is known.
+  extent_t *extents;
+  uint32_t extent_count;
+  uint32_t extent_cap;
+  uint32_t mapped; // Clusters covered by the extents
+  uint32_t next;
+  extent_t inline_extents[INLINE_EXTENTS];
+
+  char name[FAT_NAME_MAX];
+} file_t;
+
+typedef struct {
+  const fat_volume_t *vol; // 0 for an unused slot
+  uint32_t dir;            // First cluster of the directory, 0 for a fixed root
+  uint32_t hash;
+  char name[DCACHE_NAME_LEN];
+  uint8_t attr;
+  uint32_t size;
+  uint32_t first_cluster;
+} dcache_entry_t;
+
+static fat_volume_t volumes[FAT_MAX_VOLUMES];
+static int volume_count = 0;
+
+// Handle table and directory-entry cache. Never held across disk reads.
+static spinlock_t lock = SPINLOCK_INIT;
+static file_t **handles = 0;
+static int handle_count = 0;
+static int open_files = 0;
+static dcache_entry_t dcache[FAT_DCACHE_SIZE];
+static fat_stats_t stats;
+
+static uint8_t mount_sector[SECTOR_SIZE]; // Only used by fat_init
+
+static inline uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline char lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+}
+
+static bool name_equal(const char *a, const char *b) {
+  while (*a && lower(*a) == lower(*b)) {
+    a++;
+    b++;
+  }
+  return lower(*a) == lower(*b);
+}
+
+static void copy_name(char *dst, const char *src, int size) {
+  strlcpy(dst, src, size);
+}
+
+// Bytes at a device offset through the buffer cache
+static int read_bytes(blk_device_t *dev, uint64_t offset, void *buffer,
+                      uint64_t len) {
+  uint8_t *out = buffer;
+  while (len) {
+    uint64_t in_block = offset % BCACHE_BLOCK_SIZE;
+    uint64_t take = BCACHE_BLOCK_SIZE - in_block;
+    if (take > len)
+      take = len;
+    bcache_buf_t *b = bread(dev, offset / BCACHE_BLOCK_SIZE);
+    if (!b)
+      return FAT_EIO;
+    memcpy(out, b->data + in_block, take);
+    brelse(b);
+    out += take;
+    offset += take;
+    len -= take;
+  }
+  return FAT_OK;
+}
+
+// The FAT entry of a cluster: the next one in its chain, 0 at the end of
+// the chain or for anything that isn't a valid cluster
+static int next_cluster(fat_volume_t *vol, uint32_t cluster, uint32_t *next) {
+  uint64_t offset;
+  if (vol->type == 12)
+    offset = cluster + cluster / 2;
+  else if (vol->type == 16)
+    offset = (uint64_t)cluster * 2;
+  else
+    offset = (uint64_t)cluster * 4;
+
+  uint8_t raw[4] = {0, 0, 0, 0};
+  int status = read_bytes(vol->dev, vol->fat_lba * SECTOR_SIZE + offset, raw,
+                          vol->type == 32 ? 4 : 2);
+  if (status != FAT_OK)
+    return status;
+
+  uint32_t value;
+  if (vol->type == 12) {
+    value = get16(raw);
+    value = (cluster & 1) ? value >> 4 : value & 0xFFF;
+  } else if (vol->type == 16) {
+    value = get16(raw);
+  } else {
+    value = get32(raw) & 0x0FFFFFFF;
+  }
+  *next = (value >= 2 && value < vol->clusters + 2) ? value : 0;
+  return FAT_OK;
+}
+
+static void file_reset(file_t *f, fat_volume_t *vol, uint8_t attr,
+                       uint32_t size, uint32_t first_cluster) {
+  if (f->extents && f->extents != f->inline_extents)
+    kfree(f->extents);
+  f->vol = vol;
+  f->attr = attr;
+  f->size = size;
+  f->pos = 0;
+  f->extents = f->inline_extents;
+  f->extent_count = 0;
+  f->extent_cap = INLINE_EXTENTS;
+  f->mapped = 0;
+
+  // Cluster 0 in a directory entry (as in "..") means the root
+  if ((attr & FAT_ATTR_DIRECTORY) && first_cluster == 0)
+    first_cluster = vol->root_entries ? 0 : vol->root_cluster;
+  f->fixed_root = (attr & FAT_ATTR_DIRECTORY) && first_cluster == 0;
+  f->first_cluster = first_cluster;
+  f->next = (first_cluster >= 2 && first_cluster < vol->clusters + 2)
+                ? first_cluster
+                : 0;
+}
+
+static void file_free(file_t *f) {
+  if (f->extents && f->extents != f->inline_extents)
+    kfree(f->extents);
+  kfree(f);
+}
+
+// Decode the next run of the chain into a new extent
+static int extend(file_t *f) {
+  if (f->extent_count == f->extent_cap) {
+    extent_t *grown = kmalloc(sizeof(extent_t) * f->extent_cap * 2);
+    if (!grown)
+      return FAT_ENOMEM;
+    memcpy(grown, f->extents, sizeof(extent_t) * f->extent_count);
+    if (f->extents != f->inline_extents)
+      kfree(f->extents);
+    f->extents = grown;
+    f->extent_cap *= 2;
+  }
+
+  uint32_t start = f->next;
+  uint32_t cluster = start;
+  uint32_t count = 1;
+  for (;;) {
+    uint32_t next;
+    int status = next_cluster(f->vol, cluster, &next);
+    if (status != FAT_OK)
+      return status;
+    if (next != cluster + 1) {
+      f->next = next;
+      break;
+    }
+    cluster = next;
+    count++;
+  }
+  // A chain longer than the volume loops back on itself
+  if (f->mapped + count > f->vol->clusters)
+    return FAT_EIO;
+
+  extent_t *e = &f->extents[f->extent_count++];
+  e->index = f->mapped;
+  e->cluster = start;
+  e->count = count;
+  f->mapped += count;
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  stats.extents++;
+  spin_unlock_irqrestore(&lock, flags);
+  return FAT_OK;
+}
+
+// Device sector of a file sector and the contiguous sectors from there.
+// FAT_ENOENT past the end of the chain.
+static int map(file_t *f, uint64_t sector, uint64_t *lba, uint32_t *run) {
+  fat_volume_t *vol = f->vol;
+  if (f->fixed_root) {
+    uint32_t sectors = vol->root_entries * ENTRY_SIZE / SECTOR_SIZE;
+    if (sector >= sectors)
+      return FAT_ENOENT;
+    *lba = vol->root_lba + sector;
+    *run = (uint32_t)(sectors - sector);
+    return FAT_OK;
+  }
+
+  uint64_t index = sector / vol->sectors_per_cluster;
+  while (index >= f->mapped) {
+    if (!f->next)
+      return FAT_ENOENT;
+    int status = extend(f);
+    if (status != FAT_OK)
+      return status;
+  }
+
+  uint32_t lo = 0, hi = f->extent_count - 1;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi + 1) / 2;
+    if (f->extents[mid].index <= index)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  extent_t *e = &f->extents[lo];
+  uint32_t within = (uint32_t)(sector % vol->sectors_per_cluster);
+  uint64_t cluster = e->cluster + (index - e->index);
+  *lba = vol->data_lba + (cluster - 2) * vol->sectors_per_cluster + within;
+  *run = (uint32_t)((e->index + e->count - index) * vol->sectors_per_cluster -
+                    within);
+  return FAT_OK;
+}
+
+static int64_t file_read(file_t *f, uint64_t offset, void *buffer,
+                         uint64_t len) {
+  if (!(f->attr & FAT_ATTR_DIRECTORY)) {
+    if (offset >= f->size)
+      return 0;
+    if (len > f->size - offset)
+      len = f->size - offset;
+  }
+
+  uint8_t *out = buffer;
+  uint64_t done = 0;
+  while (done < len) {
+    uint64_t lba;
+    uint32_t run;
+    int status = map(f, offset / SECTOR_SIZE, &lba, &run);
+    if (status == FAT_ENOENT)
+      break;
+    if (status != FAT_OK)
+      return status;
+
+    uint64_t in_sector = offset % SECTOR_SIZE;
+    uint64_t take = (uint64_t)run * SECTOR_SIZE - in_sector;
+    if (take > len - done)
+      take = len - done;
+    status = read_bytes(f->vol->dev, lba * SECTOR_SIZE + in_sector, out + done,
+                        take);
+    if (status != FAT_OK)
+      return status;
+    done += take;
+    offset += take;
+  }
+  return (int64_t)done;
+}
+
+static uint8_t short_checksum(const uint8_t *name) {
+  uint8_t sum = 0;
+  for (int i = 0; i < 11; i++)
+    sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + name[i]);
+  return sum;
+}
+
+// "NAME    EXT" to "NAME.EXT", lower case where the NT case bits say so
+static void short_name(const uint8_t *e, char *out) {
+  int n = 0;
+  bool lower_base = (e[12] & 0x08) != 0;
+  bool lower_ext = (e[12] & 0x10) != 0;
+  for (int i = 0; i < 8 && e[i] != ' '; i++) {
+    char c = (i == 0 && e[0] == 0x05) ? (char)0xE5 : (char)e[i];
+    out[n++] = lower_base ? lower(c) : c;
+  }
+  if (e[8] != ' ') {
+    out[n++] = '.';
+    for (int i = 8; i < 11 && e[i] != ' '; i++)
+      out[n++] = lower_ext ? lower((char)e[i]) : (char)e[i];
+  }
+  out[n] = '\0';
+}
+
+// Store the 13 characters of one long-name entry at their place in the name
+static void long_name_part(const uint8_t *e, char *name) {
+  static const uint8_t at[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+  int base = ((e[0] & 0x1F) - 1) * 13;
+  for (int i = 0; i < 13; i++) {
+    uint16_t c = get16(e + at[i]);
+    int pos = base + i;
+    if (c == 0x0000 || c == 0xFFFF || pos >= FAT_NAME_MAX - 1)
+      continue;
+    name[pos] = c < 0x80 ? (char)c : '?';
+  }
+}
+
+// Next used entry of a directory from f->pos, with its long name if it has one
+static int dir_next(file_t *f, fat_dirent_t *out) {
+  uint8_t e[ENTRY_SIZE];
+  int expect = 0; // Long-name sequence number wanted next, 0 for none
+  uint8_t checksum = 0;
+
+  for (;;) {
+    int64_t got = file_read(f, f->pos, e, ENTRY_SIZE);
+    if (got < 0)
+      return (int)got;
+    if (got < ENTRY_SIZE || e[0] == 0x00)
+      return 0; // End of the directory, f->pos stays there
+    f->pos += ENTRY_SIZE;
+
+    if (e[0] == 0xE5) {
+      expect = 0;
+      continue;
+    }
+    if ((e[11] & FAT_ATTR_LONG_NAME) == FAT_ATTR_LONG_NAME) {
+      if (e[0] & 0x40) {
+        memset(out->name, 0, FAT_NAME_MAX);
+        expect = e[0] & 0x1F;
+        checksum = e[13];
+      } else if ((e[0] & 0x1F) != expect || e[13] != checksum) {
+        expect = 0;
+        continue;
+      }
+      if (expect) {
+        long_name_part(e, out->name);
+        expect--;
+        // 0 after the last part, -1 marks a finished name
+        if (!expect)
+          expect = -1;
+      }
+      continue;
+    }
+    if (e[11] & FAT_ATTR_VOLUME_ID) {
+      expect = 0;
+      continue;
+    }
+
+    if (expect != -1 || short_checksum(e) != checksum || !out->name[0])
+      short_name(e, out->name);
+    out->attr = e[11];
+    out->size = get32(e + 28);
+    out->first_cluster = ((uint32_t)get16(e + 20) << 16) | get16(e + 26);
+    return 1;
+  }
+}
+
+static uint32_t dcache_hash(const fat_volume_t *vol, uint32_t dir,
+                            const char *name) {
+  uint32_t h = 2166136261u ^ (uint32_t)(vol - volumes) ^ (dir * 16777619u);
+  for (; *name; name++)
+    h = (h ^ (uint8_t)lower(*name)) * 16777619u;
+  return h;
+}
+
+// Find a name in a directory, through the directory-entry cache
+static int lookup(file_t *dir, const char *name, fat_dirent_t *out) {
+  uint32_t h = dcache_hash(dir->vol, dir->first_cluster, name);
+  dcache_entry_t *slot = &dcache[h % FAT_DCACHE_SIZE];
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  stats.lookups++;
+  if (slot->vol == dir->vol && slot->dir == dir->first_cluster &&
+      slot->hash == h && name_equal(slot->name, name)) {
+    stats.hits++;
+    copy_name(out->name, slot->name, FAT_NAME_MAX);
+    out->attr = slot->attr;
+    out->size = slot->size;
+    out->first_cluster = slot->first_cluster;
+    spin_unlock_irqrestore(&lock, flags);
+    return FAT_OK;
+  }
+  spin_unlock_irqrestore(&lock, flags);
+
+  dir->pos = 0;
+  int status;
+  while ((status = dir_next(dir, out)) == 1) {
+    if (!name_equal(out->name, name))
+      continue;
+    int len = 0;
+    while (out->name[len])
+      len++;
+    if (len < DCACHE_NAME_LEN) {
+      flags = spin_lock_irqsave(&lock);
+      slot->vol = dir->vol;
+      slot->dir = dir->first_cluster;
+      slot->hash = h;
+      copy_name(slot->name, out->name, DCACHE_NAME_LEN);
+      slot->attr = out->attr;
+      slot->size = out->size;
+      slot->first_cluster = out->first_cluster;
+      spin_unlock_irqrestore(&lock, flags);
+    }
+    return FAT_OK;
+  }
+  return status < 0 ? status : FAT_ENOENT;
+}
+
+// Walk a path from the root of its volume and leave f on what it names
+static int resolve(file_t *f, const char *path) {
+  fat_volume_t *vol = volume_count ? &volumes[0] : 0;
+
+  // "<disk>:" picks the volume
+  const char *colon = path;
+  while (*colon && *colon != ':' && *colon != '/')
+    colon++;
+  if (*colon == ':') {
+    vol = 0;
+    for (int i = 0; i < volume_count && !vol; i++) {
+      const char *a = volumes[i].dev->name;
+      const char *b = path;
+      while (b < colon && *a == *b) {
+        a++;
+        b++;
+      }
+      if (b == colon && !*a)
+        vol = &volumes[i];
+    }
+    path = colon + 1;
+  }
+  if (!vol)
+    return FAT_ENOENT;
+
+  file_reset(f, vol, FAT_ATTR_DIRECTORY, 0, 0);
+  f->name[0] = '/';
+  f->name[1] = '\0';
+
+  fat_dirent_t ent;
+  char part[FAT_NAME_MAX];
+  while (*path) {
+    while (*path == '/')
+      path++;
+    int n = 0;
+    for (; *path && *path != '/'; path++)
+      if (n < FAT_NAME_MAX - 1)
+        part[n++] = *path;
+    part[n] = '\0';
+    if (!n || (n == 1 && part[0] == '.'))
+      continue;
+    if (!(f->attr & FAT_ATTR_DIRECTORY))
+      return FAT_ENOTDIR;
+
+    int status = lookup(f, part, &ent);
+    if (status != FAT_OK)
+      return status;
+    file_reset(f, vol, ent.attr, ent.size, ent.first_cluster);
+    copy_name(f->name, ent.name, FAT_NAME_MAX);
+  }
+  return FAT_OK;
+}
+
+static file_t *get_file(int fd) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  file_t *f = (fd >= 0 && fd < handle_count) ? handles[fd] : 0;
+  spin_unlock_irqrestore(&lock, flags);
+  return f;
+}
+
+// A free handle for f, doubling the table when all are taken
+static int add_handle(file_t *f) {
+  for (;;) {
+    uint64_t flags = spin_lock_irqsave(&lock);
+    for (int i = 0; i < handle_count; i++) {
+      if (!handles[i]) {
+        handles[i] = f;
+        open_files++;
+        spin_unlock_irqrestore(&lock, flags);
+        return i;
+      }
+    }
+    int count = handle_count;
+    spin_unlock_irqrestore(&lock, flags);
+
+    int grown_count = count ? count * 2 : MIN_HANDLES;
+    file_t **grown = kmalloc(sizeof(file_t *) * grown_count);
+    if (!grown)
+      return FAT_ENOMEM;
+
+    flags = spin_lock_irqsave(&lock);
+    file_t **old = 0;
+    if (handle_count == count) {
+      for (int i = 0; i < grown_count; i++)
+        grown[i] = i < count ? handles[i] : 0;
+      old = handles;
+      handles = grown;
+      handle_count = grown_count;
+      grown = 0;
+    }
+    spin_unlock_irqrestore(&lock, flags);
+    // Whichever table lost (ours if another open grew it first)
+    if (grown)
+      kfree(grown);
+    if (old)
+      kfree(old);
+  }
+}
+
+int fat_open(const char *path) {
+  if (!path)
+    return FAT_EINVAL;
+  file_t *f = kmalloc(sizeof(file_t));
+  if (!f)
+    return FAT_ENOMEM;
+  f->extents = 0;
+
+  int status = resolve(f, path);
+  if (status == FAT_OK) {
+    f->pos = 0;
+    status = add_handle(f);
+  }
+  if (status < 0)
+    file_free(f);
+  return status;
+}
+
+int fat_close(int fd) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  file_t *f = (fd >= 0 && fd < handle_count) ? handles[fd] : 0;
+  if (f) {
+    handles[fd] = 0;
+    open_files--;
+  }
+  spin_unlock_irqrestore(&lock, flags);
+  if (!f)
+    return FAT_EBADF;
+  file_free(f);
+  return FAT_OK;
+}
+
+int64_t fat_read(int fd, void *buffer, uint64_t len) {
+  file_t *f = get_file(fd);
+  if (!f)
+    return FAT_EBADF;
+  if (f->attr & FAT_ATTR_DIRECTORY)
+    return FAT_EISDIR;
+  int64_t got = file_read(f, f->pos, buffer, len);
+  if (got > 0)
+    f->pos += (uint64_t)got;
+  return got;
+}
+
+int64_t fat_pread(int fd, uint64_t offset, void *buffer, uint64_t len) {
+  file_t *f = get_file(fd);
+  if (!f)
+    return FAT_EBADF;
+  if (f->attr & FAT_ATTR_DIRECTORY)
+    return FAT_EISDIR;
+  return file_read(f, offset, buffer, len);
+}
+
+int fat_seek(int fd, uint64_t offset) {
+  file_t *f = get_file(fd);
+  if (!f)
+    return FAT_EBADF;
+  f->pos = offset;
+  return FAT_OK;
+}
+
+int fat_readdir(int fd, fat_dirent_t *out) {
+  file_t *f = get_file(fd);
+  if (!f)
+    return FAT_EBADF;
+  if (!(f->attr & FAT_ATTR_DIRECTORY))
+    return FAT_ENOTDIR;
+  return dir_next(f, out);
+}
+
+int fat_stat(int fd, fat_dirent_t *out) {
+  file_t *f = get_file(fd);
+  if (!f)
+    return FAT_EBADF;
+  copy_name(out->name, f->name, FAT_NAME_MAX);
+  out->attr = f->attr;
+  out->size = f->size;
+  out->first_cluster = f->first_cluster;
+  return FAT_OK;
+}
+
+int fat_bmap(int fd, uint64_t offset, uint64_t *lba, uint32_t *run) {
+  file_t *f = get_file(fd);
+  if (!f)
+    return FAT_EBADF;
+  if (!(f->attr & FAT_ATTR_DIRECTORY) && offset >= f->size)
+    return FAT_EINVAL;
+  return map(f, offset / SECTOR_SIZE, lba, run);
+}
+
+blk_device_t *fat_device(int fd) {
+  file_t *f = get_file(fd);
+  return f ? f->vol->dev : 0;
+}
+
+void fat_get_stats(fat_stats_t *out) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  *out = stats;
+  out->open_files = open_files;
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+int fat_volume_count(void) { return volume_count; }
+
+const fat_volume_t *fat_volume(int index) {
+  return (index >= 0 && index < volume_count) ? &volumes[index] : 0;
+}
+
+// Check the BPB of a file system starting at lba and add it as a volume
+static bool try_mount(blk_device_t *dev, uint64_t lba) {
+  uint8_t *bs = mount_sector;
+  if (volume_count == FAT_MAX_VOLUMES || lba >= dev->sectors ||
+      bcache_read(dev, lba, 1, bs) != BLK_OK)
+    return false;
+
+  uint32_t bytes_per_sector = get16(bs + 11);
+  uint32_t spc = bs[13];
+  uint32_t reserved = get16(bs + 14);
+  uint32_t fats = bs[16];
+  uint32_t root_entries = get16(bs + 17);
+  uint32_t total = get16(bs + 19) ? get16(bs + 19) : get32(bs + 32);
+  uint32_t fat_sectors = get16(bs + 22) ? get16(bs + 22) : get32(bs + 36);
+  if (get16(bs + 510) != 0xAA55 || bytes_per_sector != SECTOR_SIZE || !spc ||
+      (spc & (spc - 1)) || !reserved || !fats || fats > 4 || !fat_sectors ||
+      total > dev->sectors - lba)
+    return false;
+
+  uint32_t root_sectors =
+      (root_entries * ENTRY_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  uint32_t meta = reserved + fats * fat_sectors + root_sectors;
+  if (meta >= total)
+    return false;
+
+  fat_volume_t *vol = &volumes[volume_count];
+  vol->dev = dev;
+  vol->fat_count = (uint8_t)fats;
+  vol->sectors_per_cluster = spc;
+  vol->part_lba = lba;
+  vol->fat_lba = lba + reserved;
+  vol->fat_sectors = fat_sectors;
+  vol->root_lba = vol->fat_lba + (uint64_t)fats * fat_sectors;
+  vol->root_entries = root_entries;
+  vol->data_lba = lba + meta;
+  vol->clusters = (total - meta) / spc;
+  vol->type = vol->clusters < 4085 ? 12 : vol->clusters < 65525 ? 16 : 32;
+
+  // Extended boot record: label at 43 on FAT12/16, at 71 on FAT32
+  const uint8_t *ebr = bs + 36;
+  vol->root_cluster = 0;
+  if (vol->type == 32) {
+    if (root_entries)
+      return false;
+    vol->root_cluster = get32(bs + 44);
+    ebr = bs + 64;
+  } else if (!root_entries) {
+    return false;
+  }
+  int n = 0;
+  if (ebr[2] == 0x29)
+    for (int i = 0; i < 11; i++)
+      vol->label[n++] = (char)ebr[7 + i];
+  while (n && vol->label[n - 1] == ' ')
+    n--;
+  vol->label[n] = '\0';
+
+  volume_count++;
+  return true;
+}
+
+int fat_init(void) {
+  for (int d = 0; d < blk_device_count(); d++) {
+    blk_device_t *dev = blk_device(d);
+    if (bcache_read(dev, 0, 1, mount_sector) != BLK_OK)
+      continue;
+
+    // Partitions from the MBR, copied out since mounting reuses the buffer
+    uint64_t starts[4];
+    int parts = 0;
+    if (get16(mount_sector + 510) == 0xAA55) {
+      for (int i = 0; i < 4; i++) {
+        const uint8_t *p = mount_sector + 446 + i * 16;
+        uint8_t type = p[4];
+        if (type == 0x01 || type == 0x04 || type == 0x06 || type == 0x0B ||
+            type == 0x0C || type == 0x0E)
+          starts[parts++] = get32(p + 8);
+      }
+    }
+
+    bool mounted = false;
+    for (int i = 0; i < parts; i++)
+      mounted |= try_mount(dev, starts[i]);
+    if (!mounted)
+      try_mount(dev, 0);
+  }
+  return volume_count;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "blk.h"
+#include "stdint.h"
+
+// Read-only FAT12/16/32 through the buffer cache. Every disk with a FAT
+// partition (or a FAT file system from sector 0) is mounted by fat_init;
+// paths may start with "<disk>:" to pick one, the first volume otherwise.
+// Each open file caches its cluster chain as extents of contiguous
+// clusters, decoded as far as reads have gone, and path lookups go through
+// a directory-entry cache so repeated opens don't rescan directories.
+#define FAT_MAX_VOLUMES 4
+#define FAT_NAME_MAX 256 // Long names, ASCII only
+#define FAT_DCACHE_SIZE 256
+
+#define FAT_OK 0
+#define FAT_EIO -1
+#define FAT_ENOENT -2
+#define FAT_ENOTDIR -3
+#define FAT_EISDIR -4
+#define FAT_EINVAL -5
+#define FAT_ENOMEM -6
+#define FAT_EBADF -7
+
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN 0x02
+#define FAT_ATTR_SYSTEM 0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE 0x20
+#define FAT_ATTR_LONG_NAME 0x0F
+
+typedef struct {
+  blk_device_t *dev;
+  uint8_t type; // 12, 16 or 32
+  uint8_t fat_count;
+  uint32_t sectors_per_cluster;
+  uint64_t part_lba;     // First sector of the file system
+  uint64_t fat_lba;      // First FAT
+  uint32_t fat_sectors;  // Per FAT
+  uint64_t root_lba;     // FAT12/16 fixed root directory
+  uint32_t root_entries; // FAT12/16, 0 on FAT32
+  uint32_t root_cluster; // FAT32 root directory chain
+  uint64_t data_lba;     // Cluster 2
+  uint32_t clusters;     // Data clusters
+  char label[12];
+} fat_volume_t;
+
+typedef struct {
+  char name[FAT_NAME_MAX];
+  uint8_t attr;
+  uint32_t size;
+  uint32_t first_cluster;
+} fat_dirent_t;
+
+typedef struct {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t extents; // Decoded so far, over all files
+  uint32_t open_files;
+} fat_stats_t;
+
+// Mount every FAT volume on the block devices, returns how many
+int fat_init(void);
+int fat_volume_count(void);
+const fat_volume_t *fat_volume(int index);
+
+// Handles are small integers, the table grows as files are opened. One
+// handle must not be used by two tasks at once.
+int fat_open(const char *path);
+int fat_close(int fd);
+// Bytes read (0 at the end) or a negative FAT_E* code
+int64_t fat_read(int fd, void *buffer, uint64_t len);
+int64_t fat_pread(int fd, uint64_t offset, void *buffer, uint64_t len);
+int fat_seek(int fd, uint64_t offset);
+// Next entry of an open directory: 1, 0 at the end, or a FAT_E* code
+int fat_readdir(int fd, fat_dirent_t *out);
+int fat_stat(int fd, fat_dirent_t *out);
+// Device sector holding a byte of the file, and how many sectors after it
+// are contiguous on disk (for mapping files in page by page)
+int fat_bmap(int fd, uint64_t offset, uint64_t *lba, uint32_t *run);
+blk_device_t *fat_device(int fd);
+
+void fat_get_stats(fat_stats_t *out);
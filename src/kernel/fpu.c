@@ -0,0 +1,270 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "isr.h"
+#include "kmalloc.h"
+#include "smp.h"
+#include "stdint.h"
+#include "string.h"
+
+#define CR0_MP (1ULL << 1)
+#define CR0_EM (1ULL << 2)
+#define CR0_TS (1ULL << 3)
+#define CR0_NE (1ULL << 5)
+#define CR4_OSFXSR (1ULL << 9)
+#define CR4_OSXMMEXCPT (1ULL << 10)
+#define CR4_OSXSAVE (1ULL << 18)
+
+#define XCR0_X87 (1ULL << 0)
+#define XCR0_SSE (1ULL << 1)
+#define XCR0_AVX (1ULL << 2)
+
+#define FXSAVE_SIZE 512
+#define FPU_STATE_MAX 4096
+#define FPU_STATE_ALIGN 64
+
+#define NM_VECTOR 7
+
+#define FPU_NOT_LOADED 0xFFFFFFFFu
+
+struct fpu_context {
+  uint8_t *state;    // FPU_STATE_ALIGN aligned save area
+  bool initialized;  // state holds something worth restoring
+  uint32_t loaded_on; // CPU whose registers were last loaded from state
+};
+
+static bool sse_enabled = false;
+static bool avx_enabled = false;
+static uint64_t xsave_mask = 0;
+static uint32_t state_size = FXSAVE_SIZE;
+static uint64_t traps = 0;
+
+// Which context each CPU's registers hold and which one its running
+// thread uses live in the per-CPU block (fpu_owner, fpu_current).
+// fpu_dirty means the registers are newer than the owner's save area.
+
+static fpu_context_t boot_context;
+static uint8_t boot_state[FPU_STATE_MAX] __attribute__((aligned(FPU_STATE_ALIGN)));
+// Registers right after FNINIT, loaded into fresh contexts
+static uint8_t init_state[FPU_STATE_MAX] __attribute__((aligned(FPU_STATE_ALIGN)));
+
+static kmem_cache_t *state_cache = 0;
+
+static inline uint64_t read_cr0(void) {
+  uint64_t v;
+  __asm__ volatile("mov %%cr0, %0" : "=r"(v));
+  return v;
+}
+
+static inline void write_cr0(uint64_t v) {
+  __asm__ volatile("mov %0, %%cr0" : : "r"(v));
+}
+
+static inline uint64_t read_cr4(void) {
+  uint64_t v;
+  __asm__ volatile("mov %%cr4, %0" : "=r"(v));
+  return v;
+}
+
+static inline void write_cr4(uint64_t v) {
+  __asm__ volatile("mov %0, %%cr4" : : "r"(v));
+}
+
+static inline void clts(void) { __asm__ volatile("clts"); }
+
+static inline void set_ts(void) { write_cr0(read_cr0() | CR0_TS); }
+
+static void save_state(uint8_t *area) {
+  if (avx_enabled)
+    __asm__ volatile("xsave64 (%0)"
+                     :
+                     : "r"(area), "a"((uint32_t)xsave_mask),
+                       "d"((uint32_t)(xsave_mask >> 32))
+                     : "memory");
+  else
+    __asm__ volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+}
+
+static void restore_state(const uint8_t *area) {
+  if (avx_enabled)
+    __asm__ volatile("xrstor64 (%0)"
+                     :
+                     : "r"(area), "a"((uint32_t)xsave_mask),
+                       "d"((uint32_t)(xsave_mask >> 32))
+                     : "memory");
+  else
+    __asm__ volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+}
+
+// Give the registers to ctx, saving whoever had them. TS must be clear.
+static void take_ownership(cpu_t *cpu, fpu_context_t *ctx) {
+  // Still loaded here, unless the thread has run elsewhere since
+  if (cpu->fpu_owner == ctx && (!ctx || ctx->loaded_on == cpu->index))
+    return;
+  if (cpu->fpu_owner && cpu->fpu_dirty)
+    save_state(cpu->fpu_owner->state);
+  cpu->fpu_dirty = false;
+  if (ctx) {
+    restore_state(ctx->initialized ? ctx->state : init_state);
+    ctx->initialized = true;
+    ctx->loaded_on = cpu->index;
+  }
+  cpu->fpu_owner = ctx;
+}
+
+// #NM: the running thread touched the FPU after a switch
+static void fpu_trap(Registers *regs) {
+  (void)regs;
+  cpu_t *cpu = this_cpu();
+  clts();
+  traps++;
+  take_ownership(cpu, cpu->fpu_current);
+  cpu->fpu_dirty = cpu->fpu_owner != 0;
+}
+
+static void enable_sse(void) {
+  // Native x87 error reporting, no emulation, WAIT honours TS
+  write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+  write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+}
+
+static void enable_xsave(void) {
+  write_cr4(read_cr4() | CR4_OSXSAVE);
+  __asm__ volatile("xsetbv"
+                   :
+                   : "c"(0), "a"((uint32_t)xsave_mask),
+                     "d"((uint32_t)(xsave_mask >> 32)));
+}
+
+void fpu_init(void) {
+  if (!cpu_has(CPU_FEATURE_FXSR | CPU_FEATURE_SSE | CPU_FEATURE_SSE2))
+    return;
+
+  enable_sse();
+  sse_enabled = true;
+
+  if (cpu_has(CPU_FEATURE_XSAVE | CPU_FEATURE_AVX)) {
+    xsave_mask = XCR0_X87 | XCR0_SSE | XCR0_AVX;
+    enable_xsave();
+
+    // Save area size for the features just enabled
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+    if (ebx <= FPU_STATE_MAX) {
+      state_size = ebx;
+      avx_enabled = true;
+    } else {
+      xsave_mask = XCR0_X87 | XCR0_SSE;
+      enable_xsave();
+    }
+  }
+
+  // XRSTOR reads the header, so save areas start zeroed
+  memset(init_state, 0, FPU_STATE_MAX);
+  memset(boot_state, 0, FPU_STATE_MAX);
+
+  __asm__ volatile("fninit");
+  uint32_t mxcsr = 0x1F80; // All exceptions masked, round to nearest
+  __asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+  save_state(init_state);
+
+  boot_context.state = boot_state;
+  boot_context.initialized = false;
+  boot_context.loaded_on = FPU_NOT_LOADED;
+  this_cpu()->fpu_current = &boot_context;
+  this_cpu()->fpu_owner = 0;
+  set_ts();
+
+  register_interrupt_handler(NM_VECTOR, fpu_trap);
+}
+
+void fpu_init_cpu(void) {
+  if (!sse_enabled)
+    return;
+  enable_sse();
+  if (xsave_mask)
+    enable_xsave();
+  __asm__ volatile("fninit");
+  this_cpu()->fpu_current = 0;
+  this_cpu()->fpu_owner = 0;
+  set_ts();
+}
+
+fpu_context_t *fpu_context_create(void) {
+  if (!state_cache) {
+    // A multiple of the alignment keeps every object aligned in the slab
+    uint32_t size = (state_size + FPU_STATE_ALIGN - 1) & ~(FPU_STATE_ALIGN - 1);
+    state_cache = kmem_cache_create("fpu-state", size);
+    if (!state_cache)
+      return 0;
+  }
+
+  fpu_context_t *ctx = kmalloc(sizeof(fpu_context_t));
+  if (!ctx)
+    return 0;
+  ctx->state = kmem_cache_alloc(state_cache);
+  if (!ctx->state) {
+    kfree(ctx);
+    return 0;
+  }
+  memset(ctx->state, 0, state_size);
+  ctx->initialized = false;
+  ctx->loaded_on = FPU_NOT_LOADED;
+  return ctx;
+}
+
+void fpu_context_destroy(fpu_context_t *ctx) {
+  if (!ctx || ctx == &boot_context)
+    return;
+  // Other CPUs never save a context that isn't running, and a new one
+  // reusing this memory starts out not loaded anywhere
+  cpu_t *cpu = this_cpu();
+  if (cpu->fpu_owner == ctx) {
+    cpu->fpu_owner = 0;
+    cpu->fpu_dirty = false;
+  }
+  if (cpu->fpu_current == ctx)
+    cpu->fpu_current = 0;
+  kmem_cache_free(state_cache, ctx->state);
+  kfree(ctx);
+}
+
+void fpu_switch(fpu_context_t *ctx) {
+  cpu_t *cpu = this_cpu();
+
+  // Save on the way out so the thread can resume on any CPU. The
+  // registers stay loaded, coming back here costs a trap but no restore.
+  if (cpu->fpu_dirty) {
+    save_state(cpu->fpu_owner->state);
+    cpu->fpu_dirty = false;
+  }
+  cpu->fpu_current = ctx;
+  if (sse_enabled)
+    set_ts();
+}
+
+fpu_context_t *fpu_current(void) { return this_cpu()->fpu_current; }
+
+uint64_t fpu_kernel_begin(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+
+  // The owner's registers are about to be clobbered, park them
+  clts();
+  take_ownership(this_cpu(), 0);
+  return flags;
+}
+
+void fpu_kernel_end(uint64_t flags) {
+  // Whoever runs next reloads its state on first use
+  if (sse_enabled)
+    set_ts();
+  __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+bool fpu_sse_enabled(void) { return sse_enabled; }
+
+bool fpu_avx_enabled(void) { return avx_enabled; }
+
+uint32_t fpu_state_size(void) { return state_size; }
+
+uint64_t fpu_trap_count(void) { return traps; }
@@ -0,0 +1,47 @@
+#pragma once
+#include "stdint.h"
+
+// FPU/SSE/AVX state management
+//
+// The kernel is still built with -mno-sse, so ordinary kernel code and the
+// interrupt path never touch vector registers and never save them. State
+// is switched lazily: fpu_switch() sets CR0.TS, and the first FPU
+// instruction afterwards traps (#NM) so the new owner's registers can be
+// restored with FXRSTOR/XRSTOR (skipped when they are still loaded).
+//
+// Vectorised kernel routines are marked FPU_TARGET_SSE2 / FPU_TARGET_AVX2
+// and must run between fpu_kernel_begin() and fpu_kernel_end().
+
+#define FPU_TARGET_SSE2 __attribute__((target("sse2")))
+#define FPU_TARGET_AVX2 __attribute__((target("avx2")))
+
+typedef struct fpu_context fpu_context_t;
+
+// Turn on SSE (and AVX through XSAVE when present), must run before
+// anything uses the FPU. The boot thread gets the initial context.
+void fpu_init(void);
+// Same control register setup on an application processor
+void fpu_init_cpu(void);
+
+// Per-thread state, starts out as the clean initial state
+fpu_context_t *fpu_context_create(void);
+void fpu_context_destroy(fpu_context_t *ctx);
+
+// Make ctx the current thread's state on this CPU, with interrupts off.
+// State the outgoing thread changed is saved right away so it can resume
+// on another CPU; nothing is loaded until ctx's thread uses the FPU.
+void fpu_switch(fpu_context_t *ctx);
+fpu_context_t *fpu_current(void);
+
+// Let kernel code use vector registers. Saves the owner's live state and
+// keeps interrupts off until fpu_kernel_end().
+uint64_t fpu_kernel_begin(void);
+void fpu_kernel_end(uint64_t flags);
+
+// What was enabled
+bool fpu_sse_enabled(void);
+bool fpu_avx_enabled(void);
+uint32_t fpu_state_size(void);
+
+// Number of #NM traps taken, i.e. lazy restores that actually happened
+uint64_t fpu_trap_count(void);
@@ -0,0 +1,61 @@
+#include "gdt.h"
+#include "stdint.h"
+#include "string.h"
+
+// Flat 64-bit descriptors, same values as gdt64 in entry.asm
+#define DESC_KERNEL_CODE 0x00AF9A000000FFFFULL
+#define DESC_KERNEL_DATA 0x00CF92000000FFFFULL
+#define DESC_USER_DATA 0x00CFF2000000FFFFULL
+#define DESC_USER_CODE 0x00AFFA000000FFFFULL
+
+#define TSS_TYPE_AVAILABLE 0x89 // Present, 64-bit TSS (available)
+
+typedef struct {
+  uint16_t limit;
+  uint64_t base;
+} __attribute__((packed)) gdt_ptr_t;
+
+static void set_tss_descriptor(gdt_t *gdt) {
+  uint64_t base = (uint64_t)(uintptr_t)&gdt->tss;
+  uint64_t limit = sizeof(tss_t) - 1;
+  int slot = GDT_TSS / 8;
+
+  gdt->entries[slot] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                       ((uint64_t)TSS_TYPE_AVAILABLE << 40) |
+                       (((limit >> 16) & 0xF) << 48) |
+                       (((base >> 24) & 0xFF) << 56);
+  gdt->entries[slot + 1] = base >> 32;
+}
+
+void gdt_load(gdt_t *gdt, uint64_t kernel_stack) {
+  gdt->entries[0] = 0;
+  gdt->entries[GDT_KERNEL_CODE / 8] = DESC_KERNEL_CODE;
+  gdt->entries[GDT_KERNEL_DATA / 8] = DESC_KERNEL_DATA;
+  gdt->entries[GDT_USER_DATA / 8] = DESC_USER_DATA;
+  gdt->entries[GDT_USER_CODE / 8] = DESC_USER_CODE;
+
+  memset(&gdt->tss, 0, sizeof(tss_t));
+  gdt->tss.rsp[0] = kernel_stack;
+  gdt->tss.iopb_offset = sizeof(tss_t);
+  set_tss_descriptor(gdt);
+
+  gdt_ptr_t ptr = {sizeof(gdt->entries) - 1, (uint64_t)(uintptr_t)gdt->entries};
+
+  // CS can only be reloaded by a far transfer, return to the next label
+  __asm__ volatile("lgdt %0\n\t"
+                   "pushq %1\n\t"
+                   "leaq 1f(%%rip), %%rax\n\t"
+                   "pushq %%rax\n\t"
+                   "lretq\n"
+                   "1:\n\t"
+                   "mov %w2, %%ds\n\t"
+                   "mov %w2, %%es\n\t"
+                   "mov %w2, %%ss\n\t"
+                   "mov %w3, %%fs\n\t"
+                   "mov %w3, %%gs\n\t"
+                   "ltr %w4"
+                   :
+                   : "m"(ptr), "i"(GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA),
+                     "r"(0), "r"(GDT_TSS)
+                   : "rax", "memory");
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "stdint.h"
+
+// Segment selectors. The layout is fixed by SYSCALL/SYSRET: user data sits
+// directly below user code.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_DATA 0x1B // RPL 3
+#define GDT_USER_CODE 0x23 // RPL 3
+#define GDT_TSS 0x28
+
+#define GDT_ENTRIES 7 // The TSS descriptor takes two slots
+
+// Interrupt stack table slot of the per-CPU IRQ stack
+#define IST_IRQ 1
+
+// 64-bit task state segment, only the stack pointers are used
+typedef struct {
+  uint32_t reserved0;
+  uint64_t rsp[3]; // Stack loaded on entry from ring 0-2 (rsp[0] for ring 3)
+  uint64_t reserved1;
+  uint64_t ist[7]; // Interrupt stack table, selected by an IDT entry's ist
+  uint64_t reserved2;
+  uint16_t reserved3;
+  uint16_t iopb_offset; // Past the end: no I/O permission bitmap
+} __attribute__((packed)) tss_t;
+
+// Every CPU has its own GDT so that it can have its own TSS
+typedef struct {
+  uint64_t entries[GDT_ENTRIES];
+  tss_t tss;
+} __attribute__((aligned(16))) gdt_t;
+
+// Build gdt, load it on this CPU, reload the segment registers (FS and GS
+// end up null, their bases have to be set afterwards) and load the TSS.
+// kernel_stack becomes the ring 0 stack for interrupts from user mode.
+void gdt_load(gdt_t *gdt, uint64_t kernel_stack);
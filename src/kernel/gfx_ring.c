@@ -0,0 +1,147 @@
+#include "gfx_ring.h"
+#include "graphics.h"
+#include "pmm.h"
+#include "string.h"
+#include "vm.h"
+
+#define GFX_RING_MASK (GFX_RING_ENTRIES - 1)
+#define GFX_TEXT_MAX 256 // Longest string one TEXT command draws
+
+// Strings are copied out of the ring first, so the program can't change
+// one while it's being drawn
+static int copy_text(gfx_ring_t *ring, const gfx_cmd_t *cmd, char *text) {
+  uint64_t offset = cmd->data;
+  uint64_t length = (uint64_t)(uint32_t)cmd->w;
+  if (offset > GFX_RING_TEXT_BYTES || length > GFX_RING_TEXT_BYTES - offset)
+    return GFX_EINVAL;
+  if (length > GFX_TEXT_MAX - 1)
+    length = GFX_TEXT_MAX - 1;
+
+  memcpy(text, ring->text + offset, length);
+  text[length] = '\0';
+  return GFX_OK;
+}
+
+// The pixels are read straight from the program's memory, every row of
+// them has to be in its space. Each page is touched here, so it faults in
+// before the graphics lock is taken.
+static int check_pixels(const gfx_cmd_t *cmd) {
+  if (!cmd->data || cmd->w < 0 || cmd->h < 0 ||
+      cmd->pitch < (uint32_t)cmd->w)
+    return GFX_EINVAL;
+  if (!cmd->w || !cmd->h)
+    return GFX_OK;
+  uint64_t bytes =
+      (uint64_t)cmd->pitch * (cmd->h - 1) * 4 + (uint64_t)cmd->w * 4;
+  if (!vm_user_range(cmd->data, bytes, VM_READ))
+    return GFX_EINVAL;
+  uint64_t end = cmd->data + bytes;
+  for (uint64_t addr = cmd->data; addr < end;
+       addr = (addr & ~(PMM_PAGE_SIZE - 1)) + PMM_PAGE_SIZE)
+    (void)*(const volatile uint8_t *)(uintptr_t)addr;
+  return GFX_OK;
+}
+
+static void draw(const gfx_cmd_t *cmd, const char *text) {
+  switch (cmd->op) {
+  case GFX_CMD_CLEAR:
+    graphics_clear(cmd->color);
+    break;
+  case GFX_CMD_PIXEL:
+    graphics_put_pixel(cmd->x, cmd->y, cmd->color);
+    break;
+  case GFX_CMD_FILL_RECT:
+    graphics_fill_rect(cmd->x, cmd->y, cmd->w, cmd->h, cmd->color);
+    break;
+  case GFX_CMD_LINE:
+    graphics_draw_line(cmd->x, cmd->y, cmd->w, cmd->h, cmd->color);
+    break;
+  case GFX_CMD_FILL_CIRCLE:
+    graphics_fill_circle(cmd->x, cmd->y, cmd->w, cmd->color);
+    break;
+  case GFX_CMD_BLIT:
+    graphics_blit(cmd->x, cmd->y, cmd->w, cmd->h,
+                  (const uint32_t *)(uintptr_t)cmd->data, (int)cmd->pitch);
+    break;
+  case GFX_CMD_TEXT:
+    if (cmd->flags & GFX_FLAG_TRANSPARENT)
+      graphics_draw_string_transparent(cmd->x, cmd->y, text, cmd->color);
+    else
+      graphics_draw_string(cmd->x, cmd->y, text, cmd->color, cmd->bg);
+    break;
+  case GFX_CMD_PRESENT:
+    graphics_present();
+    break;
+  case GFX_CMD_DAMAGE:
+    graphics_mark_dirty(cmd->x, cmd->y, cmd->w, cmd->h);
+    break;
+  }
+}
+
+// Everything taken from the program's memory is checked and brought in
+// first, then the command is drawn under the graphics lock
+static int run_command(gfx_ring_t *ring, const gfx_cmd_t *cmd) {
+  char text[GFX_TEXT_MAX];
+  int result = GFX_OK;
+  switch (cmd->op) {
+  case GFX_CMD_NOP:
+    return GFX_OK;
+  case GFX_CMD_CLEAR:
+  case GFX_CMD_PIXEL:
+  case GFX_CMD_FILL_RECT:
+  case GFX_CMD_LINE:
+  case GFX_CMD_FILL_CIRCLE:
+  case GFX_CMD_PRESENT:
+  case GFX_CMD_DAMAGE:
+    break;
+  case GFX_CMD_BLIT:
+    result = check_pixels(cmd);
+    break;
+  case GFX_CMD_TEXT:
+    result = copy_text(ring, cmd, text);
+    break;
+  default:
+    return GFX_EINVAL;
+  }
+  if (result != GFX_OK)
+    return result;
+
+  uint64_t flags = graphics_lock();
+  draw(cmd, text);
+  graphics_unlock(flags);
+  return GFX_OK;
+}
+
+static void complete(gfx_ring_t *ring, uint64_t user_data, int result) {
+  uint32_t tail = ring->cq_tail;
+  if (tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >=
+      GFX_RING_ENTRIES) {
+    ring->cq_overflow++;
+    return;
+  }
+  gfx_cqe_t *cqe = &ring->cq[tail & GFX_RING_MASK];
+  cqe->user_data = user_data;
+  cqe->result = result;
+  __atomic_store_n(&ring->cq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+int64_t gfx_ring_submit(gfx_ring_t *ring) {
+  if (!ring)
+    return GFX_EINVAL;
+
+  uint32_t head = ring->sq_head;
+  uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+  if (tail - head > GFX_RING_ENTRIES)
+    return GFX_EINVAL;
+
+  int64_t done = 0;
+  for (; head != tail; head++, done++) {
+    // Read each command once, the program may already be writing the next
+    gfx_cmd_t cmd = ring->sq[head & GFX_RING_MASK];
+    int result = run_command(ring, &cmd);
+    if (result != GFX_OK || (cmd.flags & GFX_FLAG_COMPLETE))
+      complete(ring, cmd.user_data, result);
+  }
+  __atomic_store_n(&ring->sq_head, head, __ATOMIC_RELEASE);
+  return done;
+}
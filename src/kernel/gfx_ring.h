@@ -0,0 +1,63 @@
+#pragma once
+#include "stdint.h"
+
+// Batched drawing (matches sdk/include/nbos.h). A program fills the
+// submission queue of a ring in its own memory and hands the whole batch
+// over with one SYS_GFX_SUBMIT. The kernel runs the commands in order with
+// the graphics.c primitives and posts completions for the ones that ask
+// for it (and for every command that fails).
+#define GFX_RING_ENTRIES 256 // Power of two
+#define GFX_RING_TEXT_BYTES 4096
+
+#define GFX_CMD_NOP 0
+#define GFX_CMD_CLEAR 1       // color
+#define GFX_CMD_PIXEL 2       // x, y, color
+#define GFX_CMD_FILL_RECT 3   // x, y, w, h, color
+#define GFX_CMD_LINE 4        // x, y to w, h, color
+#define GFX_CMD_FILL_CIRCLE 5 // x, y, radius in w, color
+#define GFX_CMD_BLIT 6        // x, y, w, h, data: 0x00RRGGBB pixels, pitch
+#define GFX_CMD_TEXT 7        // x, y, color, bg, data: text offset, w: length
+#define GFX_CMD_PRESENT 8     // Show everything drawn so far
+#define GFX_CMD_DAMAGE 9      // x, y, w, h: drawn by direct stores
+
+#define GFX_FLAG_COMPLETE 0x1    // Post a completion even on success
+#define GFX_FLAG_TRANSPARENT 0x2 // TEXT: leave background pixels alone
+
+#define GFX_OK 0
+#define GFX_EINVAL -1
+
+typedef struct {
+  uint16_t op;
+  uint16_t flags;
+  uint32_t color;
+  int32_t x, y;
+  int32_t w, h;
+  uint32_t bg;
+  uint32_t pitch; // BLIT: source row length in pixels
+  uint64_t data;
+  uint64_t user_data; // Copied into the completion
+} gfx_cmd_t;
+
+typedef struct {
+  uint64_t user_data;
+  int32_t result;
+  uint32_t reserved;
+} gfx_cqe_t;
+
+// The program owns sq_tail and cq_head, the kernel sq_head and cq_tail.
+// Indices run freely and are masked on use.
+typedef struct {
+  volatile uint32_t sq_head;
+  volatile uint32_t sq_tail;
+  volatile uint32_t cq_head;
+  volatile uint32_t cq_tail;
+  volatile uint32_t cq_overflow; // Completions dropped on a full queue
+  uint32_t reserved[3];
+  gfx_cmd_t sq[GFX_RING_ENTRIES];
+  gfx_cqe_t cq[GFX_RING_ENTRIES];
+  char text[GFX_RING_TEXT_BYTES]; // Strings referenced by TEXT commands
+} gfx_ring_t;
+
+// Run the commands queued on ring, returns how many were consumed or
+// GFX_EINVAL for a malformed ring
+int64_t gfx_ring_submit(gfx_ring_t *ring);
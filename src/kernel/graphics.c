@@ -1,13 +1,40 @@
 #include "graphics.h"
-
-// Address where bootloader stores framebuffer info
-#define FB_INFO_ADDR 0x8000
+#include "display.h"
+#include "fpu.h"
+#include "kmalloc.h"
+#include "multiboot.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "string.h"
 
 // Global framebuffer state
 static FramebufferInfo fb_info;
-static volatile uint8_t *framebuffer = 0;
+static volatile uint8_t *framebuffer = 0; // Drawing target
+static volatile uint8_t *vram = 0;        // The real framebuffer
 static int graphics_available = 0;
 
+// Held by callers around drawing, see graphics_lock
+static spinlock_t lock = SPINLOCK_INIT;
+
+// Optional back buffer in system RAM, same pitch and pixel format as VRAM.
+// Drawing goes there and graphics_present copies the damaged regions out.
+typedef display_rect_t DirtyRect;
+
+static bool backbuffer_enabled = false;
+static DirtyRect dirty[GRAPHICS_MAX_DIRTY];
+static int dirty_count = 0;
+
+// Display driver for the adapter, NULL while stage2's VESA mode is in use.
+// vram is the buffer being scanned out, front its index.
+static const display_driver_t *display = 0;
+static display_mode_t display_mode;
+static int front = 0;
+
+// Damage of the previous present. With two buffers the hidden one was
+// last shown before it, so it lacks that damage as well as the new one.
+static DirtyRect shown[GRAPHICS_MAX_DIRTY];
+static int shown_count = 0;
+
 // Simple 8x16 bitmap font (ASCII 32-126)
 // Each character is 8 pixels wide, 16 pixels tall
 static const uint8_t font8x16[95][16] = {
@@ -301,19 +328,201 @@ static const uint8_t font8x16[95][16] = {
 #define FONT_WIDTH 8
 #define FONT_HEIGHT 16
 
+// Native pixel formats. Colours are 0x00RRGGBB throughout the API and are
+// packed into the framebuffer's layout once per primitive. Every supported
+// layout is stamped out by PIXEL_FORMAT with its channel positions and
+// sizes as constants, graphics_init picks one for the mode.
+typedef struct {
+  uint8_t bpp;
+  uint8_t bytes_pp;
+  uint8_t red_pos, red_size;
+  uint8_t green_pos, green_size;
+  uint8_t blue_pos, blue_size;
+  uint32_t (*pack)(uint32_t rgb);
+  uint32_t (*unpack)(uint32_t native);
+  void (*put)(volatile uint8_t *p, uint32_t native);
+  uint32_t (*get)(const volatile uint8_t *p);
+  // Bresenham run of n + 1 pixels, see graphics_draw_line
+  void (*line)(volatile uint8_t *p, int n, int dx, int dy, int step_x,
+               int step_y, uint32_t native);
+} PixelFormat;
+
+// Widen a size bit channel back to 8 bits, replicating the top bits so
+// full intensity stays 0xFF
+static inline uint32_t expand_channel(uint32_t c, uint32_t size) {
+  if (size >= 8)
+    return c;
+  if (size >= 4)
+    return (c << (8 - size)) | (c >> (2 * size - 8));
+  return c << (8 - size);
+}
+
+#define CHANNEL_PACK(rgb, shift, pos, size)                                    \
+  ((((rgb) >> ((shift) + 8 - (size))) & ((1u << (size)) - 1)) << (pos))
+#define CHANNEL_UNPACK(v, pos, size, shift)                                    \
+  (expand_channel(((v) >> (pos)) & ((1u << (size)) - 1), (size)) << (shift))
+
+#define PIXEL_PUT_4(p, v) (*(volatile uint32_t *)(p) = (v))
+#define PIXEL_PUT_3(p, v) ((p)[0] = (v), (p)[1] = (v) >> 8, (p)[2] = (v) >> 16)
+#define PIXEL_PUT_2(p, v) (*(volatile uint16_t *)(p) = (v))
+#define PIXEL_GET_4(p) (*(const volatile uint32_t *)(p))
+#define PIXEL_GET_3(p) ((p)[0] | ((p)[1] << 8) | ((uint32_t)(p)[2] << 16))
+#define PIXEL_GET_2(p) ((uint32_t)*(const volatile uint16_t *)(p))
+
+#define PIXEL_FORMAT(name, bpp, bytes, rp, rs, gp, gs, bp, bs)                 \
+  static uint32_t name##_pack(uint32_t rgb) {                                  \
+    return CHANNEL_PACK(rgb, 16, rp, rs) | CHANNEL_PACK(rgb, 8, gp, gs) |      \
+           CHANNEL_PACK(rgb, 0, bp, bs);                                       \
+  }                                                                            \
+  static uint32_t name##_unpack(uint32_t v) {                                  \
+    return CHANNEL_UNPACK(v, rp, rs, 16) | CHANNEL_UNPACK(v, gp, gs, 8) |      \
+           CHANNEL_UNPACK(v, bp, bs, 0);                                       \
+  }                                                                            \
+  static void name##_put(volatile uint8_t *p, uint32_t v) {                    \
+    PIXEL_PUT_##bytes(p, v);                                                   \
+  }                                                                            \
+  static uint32_t name##_get(const volatile uint8_t *p) {                      \
+    return PIXEL_GET_##bytes(p);                                               \
+  }                                                                            \
+  static void name##_line(volatile uint8_t *p, int n, int dx, int dy,          \
+                          int step_x, int step_y, uint32_t v) {                \
+    int err = dx - dy;                                                         \
+    for (; n >= 0; n--) {                                                      \
+      PIXEL_PUT_##bytes(p, v);                                                 \
+      int e2 = 2 * err;                                                        \
+      if (e2 > -dy) {                                                          \
+        err -= dy;                                                             \
+        p += step_x;                                                           \
+      }                                                                        \
+      if (e2 < dx) {                                                           \
+        err += dx;                                                             \
+        p += step_y;                                                           \
+      }                                                                        \
+    }                                                                          \
+  }                                                                            \
+  static const PixelFormat name = {                                           \
+      bpp, bytes, rp, rs, gp, gs, bp, bs,                                      \
+      name##_pack, name##_unpack, name##_put, name##_get, name##_line}
+
+PIXEL_FORMAT(xrgb8888, 32, 4, 16, 8, 8, 8, 0, 8);
+PIXEL_FORMAT(xbgr8888, 32, 4, 0, 8, 8, 8, 16, 8);
+PIXEL_FORMAT(rgb888, 24, 3, 16, 8, 8, 8, 0, 8);
+PIXEL_FORMAT(bgr888, 24, 3, 0, 8, 8, 8, 16, 8);
+PIXEL_FORMAT(rgb565, 16, 2, 11, 5, 5, 6, 0, 5);
+PIXEL_FORMAT(rgb555, 15, 2, 10, 5, 5, 5, 0, 5);
+
+// First entry of each depth is the default when the mode has no colour info
+static const PixelFormat *const pixel_formats[] = {
+    &xrgb8888, &xbgr8888, &rgb888, &bgr888, &rgb565, &rgb555,
+};
+
+// Layouts none of the above match keep the stores of their pixel size and
+// shift the channels at run time
+static PixelFormat generic_format;
+
+static uint32_t generic_pack(uint32_t rgb) {
+  const PixelFormat *f = &generic_format;
+  return CHANNEL_PACK(rgb, 16, f->red_pos, f->red_size) |
+         CHANNEL_PACK(rgb, 8, f->green_pos, f->green_size) |
+         CHANNEL_PACK(rgb, 0, f->blue_pos, f->blue_size);
+}
+
+static uint32_t generic_unpack(uint32_t v) {
+  const PixelFormat *f = &generic_format;
+  return CHANNEL_UNPACK(v, f->red_pos, f->red_size, 16) |
+         CHANNEL_UNPACK(v, f->green_pos, f->green_size, 8) |
+         CHANNEL_UNPACK(v, f->blue_pos, f->blue_size, 0);
+}
+
+static const PixelFormat *fmt = &xrgb8888;
+static uint32_t bytes_pp = 4;
+
+static bool format_matches(const PixelFormat *f) {
+  return f->red_pos == fb_info.red_field_pos &&
+         f->red_size == fb_info.red_mask_size &&
+         f->green_pos == fb_info.green_field_pos &&
+         f->green_size == fb_info.green_mask_size &&
+         f->blue_pos == fb_info.blue_field_pos &&
+         f->blue_size == fb_info.blue_mask_size;
+}
+
+// Pick the primitives for the mode's pixel layout, NULL if unsupported
+static const PixelFormat *select_format(void) {
+  uint32_t bytes = (fb_info.bpp + 7) / 8;
+  if (bytes < 2 || bytes > 4)
+    return 0;
+
+  int count = sizeof(pixel_formats) / sizeof(pixel_formats[0]);
+  bool no_colors = !fb_info.red_mask_size && !fb_info.green_mask_size &&
+                   !fb_info.blue_mask_size;
+  const PixelFormat *base = 0;
+  for (int i = 0; i < count; i++) {
+    const PixelFormat *f = pixel_formats[i];
+    if (f->bytes_pp != bytes)
+      continue;
+    if (no_colors ? f->bpp == fb_info.bpp : format_matches(f))
+      return f;
+    if (!base)
+      base = f;
+  }
+  if (no_colors || !base)
+    return base;
+
+  // Unusual layout: channels must fit a pixel and the 8-bit input
+  if (fb_info.red_mask_size > 8 || fb_info.green_mask_size > 8 ||
+      fb_info.blue_mask_size > 8 || fb_info.red_field_pos >= fb_info.bpp ||
+      fb_info.green_field_pos >= fb_info.bpp || fb_info.blue_field_pos >= fb_info.bpp)
+    return 0;
+  generic_format = *base;
+  generic_format.bpp = fb_info.bpp;
+  generic_format.red_pos = fb_info.red_field_pos;
+  generic_format.red_size = fb_info.red_mask_size;
+  generic_format.green_pos = fb_info.green_field_pos;
+  generic_format.green_size = fb_info.green_mask_size;
+  generic_format.blue_pos = fb_info.blue_field_pos;
+  generic_format.blue_size = fb_info.blue_mask_size;
+  generic_format.pack = generic_pack;
+  generic_format.unpack = generic_unpack;
+  return &generic_format;
+}
+
+static void glyph_cache_flush(void);
+
 // Initialize graphics from bootloader info
 void graphics_init(void) {
-  // Read framebuffer info from known address
-  FramebufferInfo *src = (FramebufferInfo *)FB_INFO_ADDR;
+  // Framebuffer comes from the multiboot info (stage2 or GRUB), so
+  // multiboot_init() must have run first
+  fb_info.framebuffer_addr = multiboot_get_framebuffer_addr();
+  fb_info.width = multiboot_get_framebuffer_width();
+  fb_info.height = multiboot_get_framebuffer_height();
+  fb_info.pitch = multiboot_get_framebuffer_pitch();
+  fb_info.bpp = multiboot_get_framebuffer_bpp();
+  fb_info.memory_model = 6; // VBE direct color
+  multiboot_get_framebuffer_colors(&fb_info.red_field_pos, &fb_info.red_mask_size,
+                                   &fb_info.green_field_pos, &fb_info.green_mask_size,
+                                   &fb_info.blue_field_pos, &fb_info.blue_mask_size);
 
-  // Copy to local structure
-  fb_info = *src;
+  // Glyphs expanded for an earlier mode are in that mode's layout
+  glyph_cache_flush();
 
-  // Check if we have a valid framebuffer
+  // Check if we have a valid framebuffer in a layout we can draw
+  const PixelFormat *format = select_format();
   if (fb_info.framebuffer_addr != 0 && fb_info.width > 0 && fb_info.height > 0 &&
-      fb_info.bpp >= 24) {
-    framebuffer = (volatile uint8_t *)(uintptr_t)fb_info.framebuffer_addr;
+      format) {
+    fmt = format;
+    bytes_pp = format->bytes_pp;
+    vram = (volatile uint8_t *)(uintptr_t)fb_info.framebuffer_addr;
+    framebuffer = vram;
     graphics_available = 1;
+
+    // The boot identity map leaves the framebuffer to the MTRRs, which
+    // usually make it uncached. Remap it write-combining so pixel stores
+    // are merged into full bus writes.
+    if (paging_has_pat()) {
+      paging_map(fb_info.framebuffer_addr, fb_info.framebuffer_addr,
+                 (uint64_t)fb_info.pitch * fb_info.height,
+                 PAGE_RW | PAGE_CACHE_WC);
+    }
   } else {
     graphics_available = 0;
   }
@@ -327,22 +536,94 @@ FramebufferInfo *graphics_get_info(void) {
   return &fb_info; 
 }
 
+uint64_t graphics_lock(void) { return spin_lock_irqsave(&lock); }
+
+void graphics_unlock(uint64_t flags) { spin_unlock_irqrestore(&lock, flags); }
+
+// Damage is only needed where stores don't reach the screen by themselves
+static inline bool damage_tracked(void) {
+  return backbuffer_enabled || (display && display->flush);
+}
+
+static inline bool flipping(void) {
+  return display && display->flip && display_mode.buffers > 1;
+}
+
+// Record damage, clipped to the screen. Overlapping or touching rectangles
+// are merged, and once the list is full everything collapses into one
+// bounding box.
+static void mark_dirty(int x, int y, int w, int h) {
+  if (!damage_tracked() || w <= 0 || h <= 0)
+    return;
+
+  DirtyRect r = {x, y, x + w, y + h};
+  if (r.x0 < 0)
+    r.x0 = 0;
+  if (r.y0 < 0)
+    r.y0 = 0;
+  if (r.x1 > (int)fb_info.width)
+    r.x1 = fb_info.width;
+  if (r.y1 > (int)fb_info.height)
+    r.y1 = fb_info.height;
+  if (r.x0 >= r.x1 || r.y0 >= r.y1)
+    return;
+
+  for (int i = 0; i < dirty_count; i++) {
+    DirtyRect *d = &dirty[i];
+    if (r.x0 <= d->x1 && r.x1 >= d->x0 && r.y0 <= d->y1 && r.y1 >= d->y0) {
+      if (r.x0 > d->x0)
+        r.x0 = d->x0;
+      if (r.y0 > d->y0)
+        r.y0 = d->y0;
+      if (r.x1 < d->x1)
+        r.x1 = d->x1;
+      if (r.y1 < d->y1)
+        r.y1 = d->y1;
+      // The grown rectangle may now touch others, merge it in again
+      dirty[i] = dirty[--dirty_count];
+      mark_dirty(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+      return;
+    }
+  }
+
+  if (dirty_count == GRAPHICS_MAX_DIRTY) {
+    for (int i = 0; i < dirty_count; i++) {
+      if (dirty[i].x0 < r.x0)
+        r.x0 = dirty[i].x0;
+      if (dirty[i].y0 < r.y0)
+        r.y0 = dirty[i].y0;
+      if (dirty[i].x1 > r.x1)
+        r.x1 = dirty[i].x1;
+      if (dirty[i].y1 > r.y1)
+        r.y1 = dirty[i].y1;
+    }
+    dirty_count = 0;
+  }
+  dirty[dirty_count++] = r;
+}
+
+void graphics_mark_dirty(int x, int y, int w, int h) { mark_dirty(x, y, w, h); }
+
+static inline volatile uint8_t *pixel_addr(int x, int y) {
+  return framebuffer + (uint32_t)y * fb_info.pitch + (uint32_t)x * bytes_pp;
+}
+
+// Store a native pixel without recording damage, callers mark their
+// bounding box
+static inline void plot(int x, int y, uint32_t native) {
+  if (x < 0 || x >= (int)fb_info.width || y < 0 || y >= (int)fb_info.height)
+    return;
+  fmt->put(pixel_addr(x, y), native);
+}
+
 // Put a pixel at (x, y) with given color
 void graphics_put_pixel(int x, int y, uint32_t color) {
   if (!graphics_available)
     return;
   if (x < 0 || x >= (int)fb_info.width || y < 0 || y >= (int)fb_info.height)
     return;
-
-  uint32_t offset = y * fb_info.pitch + x * (fb_info.bpp / 8);
-
-  if (fb_info.bpp == 32) {
-    *(uint32_t *)(framebuffer + offset) = color;
-  } else if (fb_info.bpp == 24) {
-    framebuffer[offset + 0] = (color >> fb_info.blue_field_pos) & 0xFF;
-    framebuffer[offset + 1] = (color >> fb_info.green_field_pos) & 0xFF;
-    framebuffer[offset + 2] = (color >> fb_info.red_field_pos) & 0xFF;
-  }
+  mark_dirty(x, y, 1, 1);
+  fmt->put(pixel_addr(x, y), fmt->pack(color));
 }
 
 uint32_t graphics_get_pixel(int x, int y) {
@@ -350,95 +631,552 @@ uint32_t graphics_get_pixel(int x, int y) {
     return 0;
   if (x < 0 || x >= (int)fb_info.width || y < 0 || y >= (int)fb_info.height)
     return 0;
+  return fmt->unpack(fmt->get(pixel_addr(x, y)));
+}
+
+// Rows into VRAM at least this wide use SSE non-temporal stores, narrower
+// ones use rep stosd (the FPU hand-off isn't worth it for short runs). The
+// back buffer is written through the cache: present reads it right back.
+#define FILL_STREAM_MIN_BYTES 256
+
+// 16 byte blocks of non-temporal stores, they go out as whole write-combining
+// lines without reading the destination first
+FPU_TARGET_SSE2 static void stream_fill32(volatile uint8_t *dst, uint64_t blocks,
+                                          uint32_t color) {
+  __asm__ volatile("movd %k2, %%xmm0\n"
+                   "pshufd $0, %%xmm0, %%xmm0\n"
+                   "1:\n"
+                   "movntdq %%xmm0, (%0)\n"
+                   "add $16, %0\n"
+                   "dec %1\n"
+                   "jnz 1b\n"
+                   : "+r"(dst), "+r"(blocks)
+                   : "r"(color)
+                   : "xmm0", "memory", "cc");
+}
 
-  uint32_t offset = y * fb_info.pitch + x * (fb_info.bpp / 8);
+static inline void stosd_fill32(volatile uint8_t *dst, uint64_t count,
+                                uint32_t color) {
+  __asm__ volatile("rep stosl"
+                   : "+D"(dst), "+c"(count)
+                   : "a"(color)
+                   : "memory");
+}
+
+// Fill count 4 byte pixels on each of rows rows
+static void fill_rows32(volatile uint8_t *row, uint32_t count, uint32_t rows,
+                        uint32_t color) {
+  bool stream = framebuffer == vram && fpu_sse_enabled() &&
+                count * 4 >= FILL_STREAM_MIN_BYTES;
+  uint64_t flags = 0;
+  if (stream)
+    flags = fpu_kernel_begin();
+
+  for (uint32_t r = 0; r < rows; r++, row += fb_info.pitch) {
+    if (!stream) {
+      stosd_fill32(row, count, color);
+      continue;
+    }
 
-  if (fb_info.bpp == 32) {
-    return *(uint32_t *)(framebuffer + offset);
-  } else if (fb_info.bpp == 24) {
-    return framebuffer[offset + 0] | (framebuffer[offset + 1] << 8) |
-           (framebuffer[offset + 2] << 16);
+    // Scalar head up to 16 byte alignment, streamed body, scalar tail
+    volatile uint8_t *p = row;
+    uint32_t left = count;
+    uint32_t head = ((16 - ((uintptr_t)p & 15)) & 15) / 4;
+    if (head > left)
+      head = left;
+    stosd_fill32(p, head, color);
+    p += head * 4;
+    left -= head;
+    if (left >= 4) {
+      stream_fill32(p, left / 4, color);
+      p += (left & ~3u) * 4;
+      left &= 3;
+    }
+    stosd_fill32(p, left, color);
+  }
+
+  if (stream) {
+    __asm__ volatile("sfence" ::: "memory");
+    fpu_kernel_end(flags);
   }
-  return 0;
 }
 
-// Clear screen with a single color
-void graphics_clear(uint32_t color) {
+// Fill count 3 byte pixels on each of rows rows. Four pixels make a 12 byte
+// pattern that is written as three 32-bit stores.
+static void fill_rows24(volatile uint8_t *row, uint32_t count, uint32_t rows,
+                        uint32_t native) {
+  uint32_t b0 = native & 0xFF;
+  uint32_t b1 = (native >> 8) & 0xFF;
+  uint32_t b2 = (native >> 16) & 0xFF;
+  uint32_t w0 = b0 | (b1 << 8) | (b2 << 16) | (b0 << 24);
+  uint32_t w1 = b1 | (b2 << 8) | (b0 << 16) | (b1 << 24);
+  uint32_t w2 = b2 | (b0 << 8) | (b1 << 16) | (b2 << 24);
+
+  for (uint32_t r = 0; r < rows; r++, row += fb_info.pitch) {
+    volatile uint8_t *p = row;
+    uint32_t groups = count / 4;
+    for (uint32_t g = 0; g < groups; g++, p += 12) {
+      *(volatile uint32_t *)(p + 0) = w0;
+      *(volatile uint32_t *)(p + 4) = w1;
+      *(volatile uint32_t *)(p + 8) = w2;
+    }
+    for (uint32_t i = 0; i < (count & 3); i++, p += 3) {
+      p[0] = b0;
+      p[1] = b1;
+      p[2] = b2;
+    }
+  }
+}
+
+// Fill count 2 byte pixels on each of rows rows: a halfword to reach 4 byte
+// alignment, then pixel pairs through the 32-bit path, then a halfword tail
+static void fill_rows16(volatile uint8_t *row, uint32_t count, uint32_t rows,
+                        uint32_t native) {
+  uint32_t pair = (native & 0xFFFF) | (native << 16);
+  for (uint32_t r = 0; r < rows; r++, row += fb_info.pitch) {
+    volatile uint8_t *p = row;
+    uint32_t left = count;
+    if (((uintptr_t)p & 2) && left) {
+      *(volatile uint16_t *)p = native;
+      p += 2;
+      left--;
+    }
+    if (left >= 2) {
+      fill_rows32(p, left / 2, 1, pair);
+      p += (left & ~1u) * 2;
+    }
+    if (left & 1)
+      *(volatile uint16_t *)p = native;
+  }
+}
+
+// Fill an already clipped rectangle
+static void fill_clipped(int x, int y, int w, int h, uint32_t color) {
+  mark_dirty(x, y, w, h);
+  volatile uint8_t *row = pixel_addr(x, y);
+  uint32_t native = fmt->pack(color);
+  if (bytes_pp == 4)
+    fill_rows32(row, w, h, native);
+  else if (bytes_pp == 3)
+    fill_rows24(row, w, h, native);
+  else
+    fill_rows16(row, w, h, native);
+}
+
+// Clip a rectangle to the screen, false if nothing is left
+static bool clip_rect(int *x, int *y, int *w, int *h) {
   if (!graphics_available)
-    return;
+    return false;
+  if (*x < 0) {
+    *w += *x;
+    *x = 0;
+  }
+  if (*y < 0) {
+    *h += *y;
+    *y = 0;
+  }
+  if (*x + *w > (int)fb_info.width)
+    *w = (int)fb_info.width - *x;
+  if (*y + *h > (int)fb_info.height)
+    *h = (int)fb_info.height - *y;
+  return *w > 0 && *h > 0;
+}
+
+// Horizontal run of w pixels starting at (x, y)
+void graphics_fill_span(int x, int y, int w, uint32_t color) {
+  int h = 1;
+  if (clip_rect(&x, &y, &w, &h))
+    fill_clipped(x, y, w, h, color);
+}
+
+// 16 byte blocks from (unaligned) src to (aligned) dst with non-temporal
+// stores, the source stays in the cache for the next frame's drawing
+FPU_TARGET_SSE2 static void stream_copy(volatile uint8_t *dst,
+                                        const volatile uint8_t *src,
+                                        uint64_t blocks) {
+  __asm__ volatile("1:\n"
+                   "movdqu (%1), %%xmm0\n"
+                   "movntdq %%xmm0, (%0)\n"
+                   "add $16, %0\n"
+                   "add $16, %1\n"
+                   "dec %2\n"
+                   "jnz 1b\n"
+                   : "+r"(dst), "+r"(src), "+r"(blocks)
+                   :
+                   : "xmm0", "memory", "cc");
+}
+
+static inline void movsb_copy(volatile uint8_t *dst, const volatile uint8_t *src,
+                              uint64_t bytes) {
+  __asm__ volatile("rep movsb"
+                   : "+D"(dst), "+S"(src), "+c"(bytes)
+                   :
+                   : "memory");
+}
 
-  for (uint32_t y = 0; y < fb_info.height; y++) {
-    for (uint32_t x = 0; x < fb_info.width; x++) {
-      graphics_put_pixel(x, y, color);
+// Copy bytes on each of rows rows between two surfaces with the given
+// pitches, streamed like the fills when dst is VRAM
+static void copy_rows(volatile uint8_t *dst, uint32_t dst_pitch,
+                      const volatile uint8_t *src, uint32_t src_pitch,
+                      uint32_t bytes, uint32_t rows, bool to_vram) {
+  bool stream = to_vram && fpu_sse_enabled() && bytes >= FILL_STREAM_MIN_BYTES;
+  uint64_t flags = 0;
+  if (stream)
+    flags = fpu_kernel_begin();
+
+  for (uint32_t r = 0; r < rows; r++, dst += dst_pitch, src += src_pitch) {
+    if (!stream) {
+      movsb_copy(dst, src, bytes);
+      continue;
     }
+
+    uint32_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+    if (head > bytes)
+      head = bytes;
+    movsb_copy(dst, src, head);
+    uint32_t left = bytes - head;
+    if (left >= 16)
+      stream_copy(dst + head, src + head, left / 16);
+    movsb_copy(dst + head + (left & ~15u), src + head + (left & ~15u), left & 15);
+  }
+
+  if (stream) {
+    __asm__ volatile("sfence" ::: "memory");
+    fpu_kernel_end(flags);
+  }
+}
+
+bool graphics_enable_backbuffer(void) {
+  if (!graphics_available)
+    return false;
+  if (backbuffer_enabled)
+    return true;
+
+  uint64_t size = (uint64_t)fb_info.pitch * fb_info.height;
+  if (!paging_alloc(VMAP_BACKBUFFER, size, PAGE_RW))
+    return false;
+
+  // Start from what's on screen, so undamaged areas already match
+  framebuffer = (volatile uint8_t *)(uintptr_t)VMAP_BACKBUFFER;
+  copy_rows(framebuffer, fb_info.pitch, vram, fb_info.pitch,
+            fb_info.width * bytes_pp, fb_info.height, false);
+  // The hidden buffer of a flipping display has none of it yet
+  shown[0] = (DirtyRect){0, 0, (int)fb_info.width, (int)fb_info.height};
+  shown_count = flipping() ? 1 : 0;
+  backbuffer_enabled = true;
+  return true;
+}
+
+void graphics_disable_backbuffer(void) {
+  if (!backbuffer_enabled)
+    return;
+  graphics_present();
+  backbuffer_enabled = false;
+  framebuffer = vram;
+  paging_free(VMAP_BACKBUFFER, (uint64_t)fb_info.pitch * fb_info.height);
+}
+
+bool graphics_has_backbuffer(void) { return backbuffer_enabled; }
+
+uint64_t graphics_get_target(void) { return (uint64_t)(uintptr_t)framebuffer; }
+
+bool graphics_needs_damage(void) { return damage_tracked(); }
+
+// Copy the damaged regions of the back buffer to dst
+static void copy_damage(volatile uint8_t *dst) {
+  for (int i = 0; i < dirty_count; i++) {
+    DirtyRect *d = &dirty[i];
+    uint32_t offset = d->y0 * fb_info.pitch + d->x0 * bytes_pp;
+    copy_rows(dst + offset, fb_info.pitch, framebuffer + offset, fb_info.pitch,
+              (d->x1 - d->x0) * bytes_pp, d->y1 - d->y0, true);
+  }
+}
+
+// Bring the hidden buffer up to date and scan it out. Nothing is drawn
+// into a buffer while it's on screen, so the switch can't tear.
+static void present_flip(void) {
+  if (!dirty_count)
+    return;
+  DirtyRect now[GRAPHICS_MAX_DIRTY];
+  int now_count = dirty_count;
+  memcpy(now, dirty, now_count * sizeof(*now));
+  for (int i = 0; i < shown_count; i++)
+    mark_dirty(shown[i].x0, shown[i].y0, shown[i].x1 - shown[i].x0,
+               shown[i].y1 - shown[i].y0);
+
+  int back = front ^ 1;
+  copy_damage(display_mode.pixels[back]);
+  display->flip(back);
+  if (display->flush)
+    display->flush(back, dirty, dirty_count);
+  front = back;
+  vram = display_mode.pixels[back];
+
+  memcpy(shown, now, now_count * sizeof(*now));
+  shown_count = now_count;
+  dirty_count = 0;
+}
+
+void graphics_present(void) {
+  if (backbuffer_enabled && flipping()) {
+    present_flip();
+    return;
+  }
+  if (backbuffer_enabled)
+    copy_damage(vram);
+  if (display && display->flush && dirty_count)
+    display->flush(front, dirty, dirty_count);
+  dirty_count = 0;
+}
+
+// Draw into a mode the display driver has just set
+static bool use_mode(const display_mode_t *mode) {
+  fb_info.width = mode->width;
+  fb_info.height = mode->height;
+  fb_info.pitch = mode->pitch;
+  fb_info.bpp = mode->bpp;
+  fb_info.red_field_pos = mode->red_pos;
+  fb_info.red_mask_size = mode->red_size;
+  fb_info.green_field_pos = mode->green_pos;
+  fb_info.green_mask_size = mode->green_size;
+  fb_info.blue_field_pos = mode->blue_pos;
+  fb_info.blue_mask_size = mode->blue_size;
+  glyph_cache_flush();
+
+  const PixelFormat *format = select_format();
+  if (!format) {
+    graphics_available = 0;
+    return false;
   }
+  fmt = format;
+  bytes_pp = format->bytes_pp;
+  display_mode = *mode;
+  front = 0;
+  vram = mode->pixels[0];
+  framebuffer = vram;
+  dirty_count = 0;
+  shown_count = 0;
+  graphics_available = 1;
+  return true;
+}
+
+bool graphics_init_display(void) {
+  // Stay on the adapter stage2 set its VESA mode on: a virtio-vga is that
+  // adapter, then Bochs/QEMU VGA, and a secondary virtio-gpu only when
+  // there is neither
+  const display_driver_t *driver = virtio_gpu_probe(true);
+  if (!driver)
+    driver = bga_probe();
+  if (!driver)
+    driver = virtio_gpu_probe(false);
+  if (!driver)
+    return false;
+
+  // Keep stage2's resolution; without one the driver picks. Drivers that
+  // can't do its depth get 32 bits per pixel.
+  uint32_t width = graphics_available ? fb_info.width : 0;
+  uint32_t height = graphics_available ? fb_info.height : 0;
+  uint32_t bpp = graphics_available ? fb_info.bpp : 32;
+  display_mode_t mode;
+  if (!driver->set_mode(width, height, bpp, &mode) &&
+      !driver->set_mode(width, height, 32, &mode))
+    return false;
+  display = driver;
+  return use_mode(&mode);
+}
+
+const char *graphics_display_name(void) {
+  return display ? display->name : "vesa";
+}
+
+bool graphics_set_mode(uint32_t width, uint32_t height, uint32_t bpp) {
+  if (!display || !width || !height)
+    return false;
+
+  // The back buffer is sized for the mode, it's rebuilt around the switch
+  bool backbuffer = backbuffer_enabled;
+  graphics_disable_backbuffer();
+  uint32_t old_width = fb_info.width;
+  uint32_t old_height = fb_info.height;
+  uint32_t old_bpp = fb_info.bpp;
+  display_mode_t mode;
+  bool ok = display->set_mode(width, height, bpp, &mode) && use_mode(&mode);
+  if (!ok && display->set_mode(old_width, old_height, old_bpp, &mode))
+    use_mode(&mode);
+  if (backbuffer)
+    graphics_enable_backbuffer();
+  return ok;
+}
+
+// Clear screen with a single color
+void graphics_clear(uint32_t color) {
+  if (!graphics_available)
+    return;
+  fill_clipped(0, 0, fb_info.width, fb_info.height, color);
 }
 
 // Draw rectangle outline
 void graphics_draw_rect(int x, int y, int w, int h, uint32_t color) {
+  if (w <= 0 || h <= 0)
+    return;
   // Top and bottom
-  for (int i = 0; i < w; i++) {
-    graphics_put_pixel(x + i, y, color);
-    graphics_put_pixel(x + i, y + h - 1, color);
-  }
+  graphics_fill_span(x, y, w, color);
+  graphics_fill_span(x, y + h - 1, w, color);
   // Left and right
-  for (int i = 0; i < h; i++) {
-    graphics_put_pixel(x, y + i, color);
-    graphics_put_pixel(x + w - 1, y + i, color);
-  }
+  graphics_fill_rect(x, y + 1, 1, h - 2, color);
+  graphics_fill_rect(x + w - 1, y + 1, 1, h - 2, color);
 }
 
 // Fill rectangle
 void graphics_fill_rect(int x, int y, int w, int h, uint32_t color) {
-  for (int j = 0; j < h; j++) {
-    for (int i = 0; i < w; i++) {
-      graphics_put_pixel(x + i, y + j, color);
+  if (clip_rect(&x, &y, &w, &h))
+    fill_clipped(x, y, w, h, color);
+}
+
+// Copy a block of 0x00RRGGBB pixels, stride of them per source row. An
+// XRGB8888 framebuffer takes the row copies, other layouts pack each one.
+void graphics_blit(int x, int y, int w, int h, const uint32_t *pixels,
+                   int stride) {
+  if (!pixels || stride < w)
+    return;
+  int src_x = x;
+  int src_y = y;
+  if (!clip_rect(&x, &y, &w, &h))
+    return;
+  pixels += (int64_t)(y - src_y) * stride + (x - src_x);
+
+  mark_dirty(x, y, w, h);
+  volatile uint8_t *row = pixel_addr(x, y);
+  if (fmt == &xrgb8888) {
+    copy_rows(row, fb_info.pitch, (const volatile uint8_t *)pixels,
+              (uint32_t)stride * 4, (uint32_t)w * 4, h, framebuffer == vram);
+    return;
+  }
+  for (int r = 0; r < h; r++, row += fb_info.pitch, pixels += stride) {
+    volatile uint8_t *p = row;
+    for (int c = 0; c < w; c++, p += bytes_pp)
+      fmt->put(p, fmt->pack(pixels[c]));
+  }
+}
+
+// Cohen-Sutherland outcodes
+#define CLIP_LEFT 1
+#define CLIP_RIGHT 2
+#define CLIP_TOP 4
+#define CLIP_BOTTOM 8
+
+static int outcode(int x, int y) {
+  int code = 0;
+  if (x < 0)
+    code |= CLIP_LEFT;
+  else if (x >= (int)fb_info.width)
+    code |= CLIP_RIGHT;
+  if (y < 0)
+    code |= CLIP_TOP;
+  else if (y >= (int)fb_info.height)
+    code |= CLIP_BOTTOM;
+  return code;
+}
+
+// Clip a line to the screen, false if none of it is visible
+static bool clip_line(int *x0, int *y0, int *x1, int *y1) {
+  int xmax = fb_info.width - 1;
+  int ymax = fb_info.height - 1;
+  int code0 = outcode(*x0, *y0);
+  int code1 = outcode(*x1, *y1);
+
+  // Each pass moves one endpoint onto an edge. Integer rounding can in
+  // rare cases bounce between edges, the pass limit stops that.
+  for (int pass = 0; pass < 8; pass++) {
+    if (!(code0 | code1))
+      return true;
+    if (code0 & code1)
+      return false;
+
+    int code = code0 ? code0 : code1;
+    int64_t dx = *x1 - *x0;
+    int64_t dy = *y1 - *y0;
+    int x, y;
+    if (code & CLIP_TOP) {
+      x = *x0 + (int)(dx * (0 - *y0) / dy);
+      y = 0;
+    } else if (code & CLIP_BOTTOM) {
+      x = *x0 + (int)(dx * (ymax - *y0) / dy);
+      y = ymax;
+    } else if (code & CLIP_RIGHT) {
+      y = *y0 + (int)(dy * (xmax - *x0) / dx);
+      x = xmax;
+    } else {
+      y = *y0 + (int)(dy * (0 - *x0) / dx);
+      x = 0;
+    }
+
+    if (code == code0) {
+      *x0 = x;
+      *y0 = y;
+      code0 = outcode(x, y);
+    } else {
+      *x1 = x;
+      *y1 = y;
+      code1 = outcode(x, y);
     }
   }
+  return !(code0 | code1);
 }
 
-// Draw line using Bresenham's algorithm
+// Draw line: clipped once up front, then Bresenham stepping a pointer
 void graphics_draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
+  if (!graphics_available || !clip_line(&x0, &y0, &x1, &y1))
+    return;
+
+  // Axis aligned lines are spans
+  if (y0 == y1) {
+    graphics_fill_span(x0 < x1 ? x0 : x1, y0, (x0 < x1 ? x1 - x0 : x0 - x1) + 1,
+                       color);
+    return;
+  }
+  if (x0 == x1) {
+    graphics_fill_rect(x0, y0 < y1 ? y0 : y1, 1,
+                       (y0 < y1 ? y1 - y0 : y0 - y1) + 1, color);
+    return;
+  }
+
   int dx = x1 - x0;
   int dy = y1 - y0;
-  int sx = (dx > 0) ? 1 : -1;
-  int sy = (dy > 0) ? 1 : -1;
+  int step_x = (dx > 0) ? (int)bytes_pp : -(int)bytes_pp;
+  int step_y = (dy > 0) ? (int)fb_info.pitch : -(int)fb_info.pitch;
   dx = (dx < 0) ? -dx : dx;
   dy = (dy < 0) ? -dy : dy;
+  mark_dirty(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1, dx + 1, dy + 1);
 
-  int err = dx - dy;
-
-  while (1) {
-    graphics_put_pixel(x0, y0, color);
-    if (x0 == x1 && y0 == y1)
-      break;
-    int e2 = 2 * err;
-    if (e2 > -dy) {
-      err -= dy;
-      x0 += sx;
-    }
-    if (e2 < dx) {
-      err += dx;
-      y0 += sy;
-    }
-  }
+  fmt->line(pixel_addr(x0, y0), dx > dy ? dx : dy, dx, dy, step_x, step_y,
+            fmt->pack(color));
 }
 
 // Draw circle outline using midpoint algorithm
 void graphics_draw_circle(int cx, int cy, int radius, uint32_t color) {
+  if (!graphics_available || radius < 0)
+    return;
+  // Entirely off screen
+  if (cx + radius < 0 || cy + radius < 0 || cx - radius >= (int)fb_info.width ||
+      cy - radius >= (int)fb_info.height)
+    return;
+  mark_dirty(cx - radius, cy - radius, 2 * radius + 1, 2 * radius + 1);
+
+  uint32_t native = fmt->pack(color);
   int x = radius;
   int y = 0;
   int err = 0;
 
   while (x >= y) {
-    graphics_put_pixel(cx + x, cy + y, color);
-    graphics_put_pixel(cx + y, cy + x, color);
-    graphics_put_pixel(cx - y, cy + x, color);
-    graphics_put_pixel(cx - x, cy + y, color);
-    graphics_put_pixel(cx - x, cy - y, color);
-    graphics_put_pixel(cx - y, cy - x, color);
-    graphics_put_pixel(cx + y, cy - x, color);
-    graphics_put_pixel(cx + x, cy - y, color);
+    plot(cx + x, cy + y, native);
+    plot(cx + y, cy + x, native);
+    plot(cx - y, cy + x, native);
+    plot(cx - x, cy + y, native);
+    plot(cx - x, cy - y, native);
+    plot(cx - y, cy - x, native);
+    plot(cx + y, cy - x, native);
+    plot(cx + x, cy - y, native);
 
     y++;
     err += 1 + 2 * y;
@@ -449,13 +1187,189 @@ void graphics_draw_circle(int cx, int cy, int radius, uint32_t color) {
   }
 }
 
-// Fill circle
+// Fill circle with one span per row. The half width x of row y is the
+// largest x with x*x + y*y <= r*r; it only shrinks as y grows, so it is
+// walked down incrementally with the midpoint error term.
 void graphics_fill_circle(int cx, int cy, int radius, uint32_t color) {
-  for (int y = -radius; y <= radius; y++) {
-    for (int x = -radius; x <= radius; x++) {
-      if (x * x + y * y <= radius * radius) {
-        graphics_put_pixel(cx + x, cy + y, color);
-      }
+  if (!graphics_available || radius < 0)
+    return;
+
+  int x = radius;
+  int err = 0; // r*r - x*x - y*y
+  for (int y = 0; y <= radius; y++) {
+    while (err < 0) {
+      err += 2 * x - 1;
+      x--;
+    }
+    graphics_fill_span(cx - x, cy + y, 2 * x + 1, color);
+    if (y)
+      graphics_fill_span(cx - x, cy - y, 2 * x + 1, color);
+    err -= 2 * y + 1;
+  }
+}
+
+// Glyph cache: each glyph expanded for one fg/bg pair into native-format
+// rows, so drawing a character is 16 row copies instead of 128 pixel stores.
+// A handful of colour pairs is kept, the least recently used one is reused.
+// Surfaces (0x00RRGGBB whatever the screen is) have a cache of their own.
+#define GLYPH_COUNT 95
+#define GLYPH_CACHE_PAIRS 4
+#define GLYPH_ROW_BYTES (FONT_WIDTH * 4)
+
+typedef struct {
+  bool valid;
+  bool xrgb; // Expanded as 0x00RRGGBB rather than the screen's format
+  uint32_t fg, bg;
+  uint64_t last_use;
+  uint8_t expanded[GLYPH_COUNT];
+  uint8_t (*pixels)[FONT_HEIGHT][GLYPH_ROW_BYTES];
+} GlyphCacheSet;
+
+static GlyphCacheSet glyph_cache[GLYPH_CACHE_PAIRS];
+static GlyphCacheSet surface_glyphs[GLYPH_CACHE_PAIRS];
+static uint64_t glyph_clock = 0;
+
+// The expanded pixels are kept for the next colour pair to use
+static void glyph_cache_flush(void) {
+  for (int i = 0; i < GLYPH_CACHE_PAIRS; i++)
+    glyph_cache[i].valid = false;
+}
+
+static GlyphCacheSet *glyph_set(GlyphCacheSet *cache, uint32_t fg,
+                                uint32_t bg) {
+  GlyphCacheSet *victim = &cache[0];
+  for (int i = 0; i < GLYPH_CACHE_PAIRS; i++) {
+    GlyphCacheSet *set = &cache[i];
+    if (set->valid && set->fg == fg && set->bg == bg) {
+      set->last_use = ++glyph_clock;
+      return set;
+    }
+    if (!set->pixels || (victim->pixels && set->last_use < victim->last_use))
+      victim = set;
+  }
+
+  if (!victim->pixels) {
+    victim->pixels = kmalloc(sizeof(*victim->pixels) * GLYPH_COUNT);
+    if (!victim->pixels)
+      return 0;
+  }
+  memset(victim->expanded, 0, sizeof(victim->expanded));
+  victim->valid = true;
+  victim->xrgb = cache == surface_glyphs;
+  victim->fg = fg;
+  victim->bg = bg;
+  victim->last_use = ++glyph_clock;
+  return victim;
+}
+
+// Pixel rows of glyph index g in the set's colours, expanded on first use
+static const uint8_t (*glyph_rows(GlyphCacheSet *set, int g))[GLYPH_ROW_BYTES] {
+  uint8_t (*rows)[GLYPH_ROW_BYTES] = set->pixels[g];
+  if (set->expanded[g])
+    return (const uint8_t (*)[GLYPH_ROW_BYTES])rows;
+
+  if (set->xrgb) {
+    for (int row = 0; row < FONT_HEIGHT; row++) {
+      uint8_t bits = font8x16[g][row];
+      uint32_t *p = (uint32_t *)rows[row];
+      for (int col = 0; col < FONT_WIDTH; col++)
+        p[col] = (bits & (0x80 >> col)) ? set->fg : set->bg;
+    }
+    set->expanded[g] = 1;
+    return (const uint8_t (*)[GLYPH_ROW_BYTES])rows;
+  }
+
+  uint32_t fg = fmt->pack(set->fg);
+  uint32_t bg = fmt->pack(set->bg);
+  for (int row = 0; row < FONT_HEIGHT; row++) {
+    uint8_t bits = font8x16[g][row];
+    uint8_t *p = rows[row];
+    for (int col = 0; col < FONT_WIDTH; col++, p += bytes_pp)
+      fmt->put(p, (bits & (0x80 >> col)) ? fg : bg);
+  }
+  set->expanded[g] = 1;
+  return (const uint8_t (*)[GLYPH_ROW_BYTES])rows;
+}
+
+static inline int glyph_index(char c) {
+  if (c < 32 || c > 126)
+    c = ' ';
+  return c - 32;
+}
+
+static inline bool glyph_on_screen(int x, int y) {
+  return x >= 0 && y >= 0 && x + FONT_WIDTH <= (int)fb_info.width &&
+         y + FONT_HEIGHT <= (int)fb_info.height;
+}
+
+// Slow path: per-pixel with clipping, for glyphs crossing the screen edge
+// or when the cache couldn't be allocated
+static void draw_char_clipped(int x, int y, int g, uint32_t fg, uint32_t bg,
+                              bool transparent) {
+  fg = fmt->pack(fg);
+  bg = fmt->pack(bg);
+  for (int row = 0; row < FONT_HEIGHT; row++) {
+    uint8_t bits = font8x16[g][row];
+    for (int col = 0; col < FONT_WIDTH; col++) {
+      if (bits & (0x80 >> col))
+        plot(x + col, y + row, fg);
+      else if (!transparent)
+        plot(x + col, y + row, bg);
+    }
+  }
+}
+
+// Copy a cached glyph with 64-bit stores (one per row per byte of pixel)
+static void blit_glyph(GlyphCacheSet *set, int x, int y, int g) {
+  const uint8_t (*rows)[GLYPH_ROW_BYTES] = glyph_rows(set, g);
+  uint32_t words = FONT_WIDTH * bytes_pp / 8;
+  volatile uint8_t *dst = pixel_addr(x, y);
+
+  for (int row = 0; row < FONT_HEIGHT; row++, dst += fb_info.pitch) {
+    const uint64_t *src = (const uint64_t *)rows[row];
+    volatile uint64_t *d = (volatile uint64_t *)dst;
+    for (uint32_t w = 0; w < words; w++)
+      d[w] = src[w];
+  }
+}
+
+static void draw_char_opaque(GlyphCacheSet *set, int x, int y, char c,
+                             uint32_t fg, uint32_t bg) {
+  int g = glyph_index(c);
+  mark_dirty(x, y, FONT_WIDTH, FONT_HEIGHT);
+  if (set && glyph_on_screen(x, y))
+    blit_glyph(set, x, y, g);
+  else
+    draw_char_clipped(x, y, g, fg, bg, false);
+}
+
+// Transparent background: with 4 byte pixels two at a time, pairs with no
+// foreground bits are skipped and mixed pairs are merged through a mask
+static void draw_char_transparent(int x, int y, char c, uint32_t fg) {
+  static const uint64_t pair_mask[4] = {0, 0xFFFFFFFF00000000ULL,
+                                        0x00000000FFFFFFFFULL, ~0ULL};
+  int g = glyph_index(c);
+  mark_dirty(x, y, FONT_WIDTH, FONT_HEIGHT);
+
+  if (bytes_pp != 4 || !glyph_on_screen(x, y)) {
+    draw_char_clipped(x, y, g, fg, 0, true);
+    return;
+  }
+
+  uint64_t native = fmt->pack(fg);
+  uint64_t fg2 = (native << 32) | native;
+  volatile uint8_t *dst = pixel_addr(x, y);
+  for (int row = 0; row < FONT_HEIGHT; row++, dst += fb_info.pitch) {
+    uint8_t bits = font8x16[g][row];
+    if (!bits)
+      continue;
+    volatile uint64_t *d = (volatile uint64_t *)dst;
+    for (int pair = 0; pair < FONT_WIDTH / 2; pair++) {
+      uint32_t b = (bits >> (6 - 2 * pair)) & 3;
+      if (b == 3)
+        d[pair] = fg2;
+      else if (b)
+        d[pair] = (d[pair] & ~pair_mask[b]) | (fg2 & pair_mask[b]);
     }
   }
 }
@@ -464,26 +1378,73 @@ void graphics_fill_circle(int cx, int cy, int radius, uint32_t color) {
 void graphics_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg) {
   if (!graphics_available)
     return;
-  if (c < 32 || c > 126)
-    c = ' ';
+  draw_char_opaque(glyph_set(glyph_cache, fg, bg), x, y, c, fg, bg);
+}
 
-  const uint8_t *glyph = font8x16[c - 32];
+void graphics_draw_char_surface(uint32_t *pixels, int width, int height,
+                                int x, int y, char c, uint32_t fg,
+                                uint32_t bg) {
+  int g = glyph_index(c);
+  GlyphCacheSet *set = glyph_set(surface_glyphs, fg, bg);
+  const uint8_t (*rows)[GLYPH_ROW_BYTES] = set ? glyph_rows(set, g) : 0;
+
+  if (rows && x >= 0 && y >= 0 && x + FONT_WIDTH <= width &&
+      y + FONT_HEIGHT <= height) {
+    uint32_t *dst = pixels + (int64_t)y * width + x;
+    for (int row = 0; row < FONT_HEIGHT; row++, dst += width)
+      memcpy(dst, rows[row], GLYPH_ROW_BYTES);
+    return;
+  }
 
   for (int row = 0; row < FONT_HEIGHT; row++) {
-    uint8_t bits = glyph[row];
+    int py = y + row;
+    if (py < 0 || py >= height)
+      continue;
+    uint32_t *dst = pixels + (int64_t)py * width;
     for (int col = 0; col < FONT_WIDTH; col++) {
-      if (bits & (0x80 >> col)) {
-        graphics_put_pixel(x + col, y + row, fg);
-      } else {
-        graphics_put_pixel(x + col, y + row, bg);
-      }
+      int px = x + col;
+      if (px < 0 || px >= width)
+        continue;
+      if (rows)
+        dst[px] = ((const uint32_t *)rows[row])[col];
+      else
+        dst[px] = (font8x16[g][row] & (0x80 >> col)) ? fg : bg;
     }
   }
 }
 
-// Draw a string
+// Draw a single character, leaving background pixels untouched
+void graphics_draw_char_transparent(int x, int y, char c, uint32_t fg) {
+  if (!graphics_available)
+    return;
+  draw_char_transparent(x, y, c, fg);
+}
+
+// Draw a string (the colour pair is looked up once for the whole string)
 void graphics_draw_string(int x, int y, const char *str, uint32_t fg,
                           uint32_t bg) {
+  if (!graphics_available)
+    return;
+  GlyphCacheSet *set = glyph_set(glyph_cache, fg, bg);
+  int start_x = x;
+  while (*str) {
+    if (*str == '\n') {
+      x = start_x;
+      y += FONT_HEIGHT;
+    } else if (*str == '\r') {
+      x = start_x;
+    } else {
+      draw_char_opaque(set, x, y, *str, fg, bg);
+      x += FONT_WIDTH;
+    }
+    str++;
+  }
+}
+
+void graphics_draw_string_transparent(int x, int y, const char *str,
+                                      uint32_t fg) {
+  if (!graphics_available)
+    return;
   int start_x = x;
   while (*str) {
     if (*str == '\n') {
@@ -492,7 +1453,7 @@ void graphics_draw_string(int x, int y, const char *str, uint32_t fg,
     } else if (*str == '\r') {
       x = start_x;
     } else {
-      graphics_draw_char(x, y, *str, fg, bg);
+      draw_char_transparent(x, y, *str, fg);
       x += FONT_WIDTH;
     }
     str++;
@@ -20,25 +20,98 @@ typedef struct {
 // Initialize graphics system from bootloader's framebuffer info
 void graphics_init(void);
 
+// Take the screen over from stage2's VESA mode with a driver for the
+// adapter (virtio-gpu or Bochs/QEMU BGA, see display.h), at the same
+// resolution. After pci_init and before the back buffer is enabled. False,
+// and VESA stays, when there is neither.
+bool graphics_init_display(void);
+// The driver in charge, "vesa" without one
+const char *graphics_display_name(void);
+// Switch to width x height at bpp bits per pixel through the display
+// driver. The screen starts out black and the back buffer, if on, is
+// rebuilt at the new size. Programs must not have the screen mapped. On
+// failure the old mode is set again.
+bool graphics_set_mode(uint32_t width, uint32_t height, uint32_t bpp);
+
 // Check if we're in graphics mode
 int graphics_is_available(void);
 
 // Get framebuffer info
 FramebufferInfo *graphics_get_info(void);
 
+// Nothing below locks by itself. Code that may draw while another CPU does
+// (the compositor, programs through their syscalls) holds this around it;
+// it disables interrupts, so no program memory may fault in while it's held.
+uint64_t graphics_lock(void);
+void graphics_unlock(uint64_t flags);
+
+// What SYS_MAP_FRAMEBUFFER hands a program (matches sdk/include/nbos.h):
+// where the pixels are mapped and how they are laid out
+#define FB_MAP_SCREEN 0  // What the kernel draws into, shared with the ring
+#define FB_MAP_PRIVATE 1 // A zeroed 32bpp buffer of its own, shown by blitting
+
+#define FB_INFO_DAMAGE 0x1 // Stores show once reported with GFX_CMD_DAMAGE
+
+typedef struct {
+  uint64_t addr;
+  uint32_t width;
+  uint32_t height;
+  uint32_t pitch; // Bytes per row
+  uint8_t bpp;
+  uint8_t bytes_pp;
+  uint8_t red_pos, red_size;
+  uint8_t green_pos, green_size;
+  uint8_t blue_pos, blue_size;
+  uint32_t flags; // FB_INFO_*
+  uint32_t reserved;
+} FramebufferMapping;
+
+// Maximum damaged regions tracked between presents before they are merged
+#define GRAPHICS_MAX_DIRTY 16
+
+// Off-screen back buffer. While enabled all drawing (and get_pixel) works on
+// a copy in system RAM; graphics_present copies only the damaged regions to
+// the framebuffer, or, on a display with two, to the hidden one and flips.
+// Code writing the back buffer directly reports damage with
+// graphics_mark_dirty.
+bool graphics_enable_backbuffer(void);
+void graphics_disable_backbuffer(void);
+bool graphics_has_backbuffer(void);
+// Where drawing goes: the back buffer while it's on, the framebuffer if not
+uint64_t graphics_get_target(void);
+void graphics_present(void);
+void graphics_mark_dirty(int x, int y, int w, int h);
+// Whether stores to the drawing target only show once damage is reported
+// and presented: with the back buffer, or on a display (virtio-gpu) that
+// is sent what changed
+bool graphics_needs_damage(void);
+
 // Basic drawing primitives
 void graphics_clear(uint32_t color);
 void graphics_put_pixel(int x, int y, uint32_t color);
 uint32_t graphics_get_pixel(int x, int y);
 void graphics_draw_rect(int x, int y, int w, int h, uint32_t color);
 void graphics_fill_rect(int x, int y, int w, int h, uint32_t color);
+// Horizontal run of w pixels, clipped once and filled with wide stores
+void graphics_fill_span(int x, int y, int w, uint32_t color);
 void graphics_draw_line(int x0, int y0, int x1, int y1, uint32_t color);
 void graphics_draw_circle(int cx, int cy, int radius, uint32_t color);
 void graphics_fill_circle(int cx, int cy, int radius, uint32_t color);
+// Copy w x h 0x00RRGGBB pixels (stride per source row) to (x, y), clipped
+void graphics_blit(int x, int y, int w, int h, const uint32_t *pixels,
+                   int stride);
 
 // Text rendering (simple built-in font)
 void graphics_draw_char(int x, int y, char c, uint32_t fg, uint32_t bg);
 void graphics_draw_string(int x, int y, const char *str, uint32_t fg, uint32_t bg);
+// Same, but only foreground pixels are written
+void graphics_draw_char_transparent(int x, int y, char c, uint32_t fg);
+void graphics_draw_string_transparent(int x, int y, const char *str, uint32_t fg);
+// Character at (x, y) of a width x height surface of 0x00RRGGBB pixels,
+// clipped to it, from a glyph cache of its own
+void graphics_draw_char_surface(uint32_t *pixels, int width, int height,
+                                int x, int y, char c, uint32_t fg,
+                                uint32_t bg);
 int graphics_get_font_width(void);
 int graphics_get_font_height(void);
 
@@ -66,3 +66,11 @@ void i8259_disable() {
   outb(PIC1_DATA, 0xFF);
   outb(PIC2_DATA, 0xFF);
 }
+
+void i8259_unmask_irq(uint8_t irq) {
+  if (irq >= 8) {
+    outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+    irq = 2;
+  }
+  outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+}
@@ -11,3 +11,5 @@
 void i8259_init();
 void i8259_send_eoi(int pic);
 void i8259_disable();
+// Let one IRQ line (0-15) through, and the cascade with a slave's line
+void i8259_unmask_irq(uint8_t irq);
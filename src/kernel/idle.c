@@ -0,0 +1,241 @@
+#include "idle.h"
+#include "boottime.h"
+#include "cpu.h"
+#include "smp.h"
+#include "string.h"
+#include "timer.h"
+
+#define CPUID_MWAIT_LEAF 5
+#define CPUID_POWER_LEAF 6
+#define POWER_ARAT 0x4 // Leaf 6 EAX: the APIC timer runs in every C-state
+#define MWAIT_ENUMERATES 0x1 // Leaf 5 ECX: EDX lists the C-states
+#define MWAIT_CSTATES 7      // C1 to C7, a nibble of leaf 5 EDX each
+#define MWAIT_TIMER_CSTATES 2 // C1 and C2 keep the APIC timer without ARAT
+
+#define IDLE_HISTORY_SHIFT 3 // Recent sleeps are averaged over about 8
+
+// Shortest sleep each depth pays off for, rough figures for current
+// parts (the exit latency and the cache refill after it add up to about
+// this). Leaf 5 only says which states exist, not what they cost.
+static const uint64_t cstate_residency_ns[MWAIT_CSTATES] = {
+    2000, 20000, 100000, 300000, 600000, 1000000, 2000000,
+};
+static const char *const cstate_names[MWAIT_CSTATES] = {
+    "C1", "C2", "C3", "C4", "C5", "C6", "C7",
+};
+
+typedef struct {
+  const char *name;
+  uint32_t hint; // MWAIT EAX
+  uint64_t residency_ns;
+} idle_state_t;
+
+// Wakers store to the doorbell, so nothing the owner writes while it
+// sleeps may share the line
+typedef struct {
+  volatile uint64_t doorbell; // TSC of the first ring since it woke, or 0
+  volatile bool monitoring;   // MONITOR is armed, a ring alone wakes it
+} __attribute__((aligned(64))) doorbell_t;
+
+typedef struct {
+  idle_stats_t stats;
+  uint64_t average_ns; // Of the recent sleeps
+  uint32_t samples;
+} __attribute__((aligned(64))) idle_cpu_t;
+
+static idle_state_t states[IDLE_MAX_STATES] = {{"hlt", 0, 0}};
+static int state_count = 1;
+static bool mwait = false;
+
+static doorbell_t doorbells[SMP_MAX_CPUS];
+static idle_cpu_t idle_cpus[SMP_MAX_CPUS];
+
+static inline uint64_t irq_save(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+  __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+void idle_init(void) {
+  uint32_t eax, ebx, ecx, edx;
+  if (!cpu_has(CPU_FEATURE_MWAIT))
+    return;
+  cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+  uint32_t max_leaf = eax;
+  if (max_leaf < CPUID_MWAIT_LEAF)
+    return;
+
+  // Without ARAT the APIC timer stops from C3 down, and an idle CPU with
+  // its tick stopped has only that one shot to wake it
+  int deepest = MWAIT_TIMER_CSTATES;
+  if (max_leaf >= CPUID_POWER_LEAF) {
+    cpuid(CPUID_POWER_LEAF, 0, &eax, &ebx, &ecx, &edx);
+    if (eax & POWER_ARAT)
+      deepest = MWAIT_CSTATES;
+  }
+
+  // Without the enumeration only C1 (hint 0) is known to exist
+  cpuid(CPUID_MWAIT_LEAF, 0, &eax, &ebx, &ecx, &edx);
+  if (!(ecx & MWAIT_ENUMERATES))
+    edx = 1u << 4;
+
+  int count = 0;
+  for (int c = 0; c < deepest; c++) {
+    if (!((edx >> (4 * (c + 1))) & 0xF))
+      continue;
+    states[count].name = cstate_names[c];
+    states[count].hint = (uint32_t)c << 4; // Sub-state 0
+    states[count].residency_ns = cstate_residency_ns[c];
+    count++;
+  }
+  if (!count)
+    return;
+  state_count = count;
+  mwait = true;
+}
+
+int idle_state_count(void) { return state_count; }
+
+const char *idle_state_name(int state) {
+  return state >= 0 && state < state_count ? states[state].name : "?";
+}
+
+bool idle_uses_mwait(void) { return mwait; }
+
+// The deepest state that pays off for the sleep expected: the recent
+// average (doubled, most sleeps are ended by interrupts that come in
+// bursts) but never past the deadline
+static int select_state(idle_cpu_t *ic, uint64_t deadline_ns) {
+  uint64_t now = timer_now_ns();
+  uint64_t expected = deadline_ns > now ? deadline_ns - now : 0;
+  if (ic->samples >= (1u << IDLE_HISTORY_SHIFT) &&
+      ic->average_ns * 2 < expected)
+    expected = ic->average_ns * 2;
+
+  int state = 0;
+  while (state + 1 < state_count &&
+         states[state + 1].residency_ns <= expected)
+    state++;
+  return state;
+}
+
+// Interrupts off. The sti right before hlt or mwait only takes effect
+// after it, so an interrupt that arrives in between ends the sleep
+// rather than being handled before it.
+static void sleep_in(int state, doorbell_t *bell, bool ringable) {
+  if (!mwait) {
+    __asm__ volatile("sti; hlt; cli" ::: "memory");
+    return;
+  }
+
+  // Pairs with the fence in idle_ring: either the waker sees monitoring
+  // or the check below sees its ring (a ring after MONITOR wakes MWAIT)
+  if (ringable) {
+    __atomic_store_n(&bell->monitoring, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+  __asm__ volatile("monitor" : : "a"(bell), "c"(0), "d"(0) : "memory");
+  if (!ringable || !__atomic_load_n(&bell->doorbell, __ATOMIC_RELAXED))
+    __asm__ volatile("sti; mwait; cli"
+                     :
+                     : "a"(states[state].hint), "c"(0)
+                     : "memory");
+  if (ringable)
+    __atomic_store_n(&bell->monitoring, false, __ATOMIC_RELAXED);
+}
+
+static void account(idle_cpu_t *ic, int state, uint64_t start) {
+  uint64_t ns = timer_tsc_to_ns(rdtsc() - start);
+  ic->stats.entries[state]++;
+  ic->stats.residency_ns[state] += ns;
+  if (ic->samples < (1u << IDLE_HISTORY_SHIFT)) {
+    ic->samples++;
+    ic->average_ns = ns;
+  } else {
+    ic->average_ns = ic->average_ns - (ic->average_ns >> IDLE_HISTORY_SHIFT) +
+                     (ns >> IDLE_HISTORY_SHIFT);
+  }
+}
+
+bool idle_enter(uint64_t deadline_ns) {
+  uint32_t index = this_cpu()->index;
+  idle_cpu_t *ic = &idle_cpus[index];
+  doorbell_t *bell = &doorbells[index];
+
+  if (!__atomic_load_n(&bell->doorbell, __ATOMIC_RELAXED)) {
+    int state = select_state(ic, deadline_ns);
+    uint64_t start = rdtsc();
+    sleep_in(state, bell, true);
+    account(ic, state, start);
+  }
+
+  uint64_t rung = __atomic_exchange_n(&bell->doorbell, 0, __ATOMIC_ACQUIRE);
+  if (!rung)
+    return false;
+  uint64_t now = rdtsc();
+  uint64_t ns = now > rung ? timer_tsc_to_ns(now - rung) : 0;
+  ic->stats.wakeups++;
+  ic->stats.wake_ns_total += ns;
+  if (ns > ic->stats.wake_ns_max)
+    ic->stats.wake_ns_max = ns;
+  return true;
+}
+
+bool idle_ring(int cpu) {
+  doorbell_t *bell = &doorbells[cpu];
+  uint64_t quiet = 0;
+  __atomic_compare_exchange_n(&bell->doorbell, &quiet, rdtsc(), false,
+                              __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&bell->monitoring, __ATOMIC_RELAXED))
+    return false;
+  __atomic_add_fetch(&idle_cpus[cpu].stats.ipis_saved, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+void idle_exit(void) {
+  __atomic_store_n(&doorbells[this_cpu()->index].doorbell, 0,
+                   __ATOMIC_RELAXED);
+}
+
+void idle_wait(void) {
+  cpu_t *cpu = this_cpu();
+  idle_cpu_t *ic = &idle_cpus[cpu->index];
+  uint64_t flags = irq_save();
+
+  // Nothing rings a CPU outside the idle loop, but a running tick still
+  // bounds the sleep
+  uint64_t deadline = timer_next_deadline();
+  if (cpu->tick_ns && timer_now_ns() + cpu->tick_ns < deadline)
+    deadline = timer_now_ns() + cpu->tick_ns;
+  int state = select_state(ic, deadline);
+  uint64_t start = rdtsc();
+  sleep_in(state, &doorbells[cpu->index], false);
+  account(ic, state, start);
+  irq_restore(flags);
+}
+
+void idle_halt(void) {
+  __asm__ volatile("cli");
+  for (;;) {
+    if (mwait) {
+      __asm__ volatile("monitor" : : "a"(&doorbells[this_cpu()->index]),
+                       "c"(0), "d"(0));
+      __asm__ volatile("mwait" : : "a"(states[state_count - 1].hint), "c"(0));
+    } else {
+      __asm__ volatile("hlt");
+    }
+  }
+}
+
+void idle_get_stats(int cpu, idle_stats_t *stats) {
+  if (cpu < 0 || cpu >= SMP_MAX_CPUS) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  memcpy(stats, &idle_cpus[cpu].stats, sizeof(*stats));
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "stdint.h"
+
+// Idle governor. A CPU with nothing to do sleeps in the deepest C-state
+// it expects to stay in long enough to pay back the cost of getting
+// there: the next deadline bounds the sleep, the recent sleeps on that
+// CPU predict it. The C-states are the MWAIT hints CPUID leaf 5 lists;
+// without MONITOR/MWAIT there is only hlt.
+//
+// Every CPU also has a doorbell, a word on a cache line of its own that
+// the scheduler rings when it queues work for an idle CPU. A CPU sleeping
+// in MWAIT has MONITOR armed on that line, so the store alone wakes it
+// and the waker can skip the IPI. The ring carries its TSC, which gives
+// the wake-up latency.
+#define IDLE_MAX_STATES 8
+
+typedef struct {
+  uint64_t entries[IDLE_MAX_STATES];
+  uint64_t residency_ns[IDLE_MAX_STATES];
+  uint64_t wakeups;    // Doorbell rings answered
+  uint64_t ipis_saved; // Rings that woke it without an IPI
+  uint64_t wake_ns_total;
+  uint64_t wake_ns_max;
+} idle_stats_t;
+
+// Read the C-states from CPUID, on the boot CPU after cpu_init
+void idle_init(void);
+int idle_state_count(void);
+const char *idle_state_name(int state);
+bool idle_uses_mwait(void);
+
+// The scheduler's idle loop: sleep once, until an interrupt has been
+// handled or the doorbell rings. deadline_ns is when the CPU will be
+// woken anyway. Interrupts off on entry and again on return. True if
+// the doorbell rang, there is work to look for.
+bool idle_enter(uint64_t deadline_ns);
+
+// Ring cpu's doorbell. True if it is waiting in MWAIT and wakes from the
+// store, otherwise the caller has to send it an IPI.
+bool idle_ring(int cpu);
+
+// This CPU is leaving idle, a ring from now on is stale
+void idle_exit(void);
+
+// Sleep until the next interrupt has been handled, for flows that wait
+// outside the scheduler. Interrupts are as they were on return.
+void idle_wait(void);
+
+// Stop this CPU for good, interrupts off
+void idle_halt(void) __attribute__((noreturn));
+
+void idle_get_stats(int cpu, idle_stats_t *stats);
@@ -4,9 +4,6 @@
 IDTEntry idt[256];
 IDTPtr idt_ptr;
 
-// External assembly function to load the IDT
-extern void idt_load();
-
 void idt_set_gate(int num, uint64_t base, uint16_t sel, uint8_t flags)
 {
     idt[num].base_low = base & 0xFFFF;
@@ -18,6 +15,11 @@ void idt_set_gate(int num, uint64_t base, uint16_t sel, uint8_t flags)
     idt[num].reserved = 0;
 }
 
+void idt_set_ist(int num, uint8_t ist)
+{
+    idt[num].ist = ist;
+}
+
 void idt_init()
 {
     idt_ptr.limit = (sizeof(IDTEntry) * 256) - 1;
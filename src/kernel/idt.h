@@ -23,5 +23,11 @@ typedef struct
 // Initialize the IDT
 void idt_init();
 
+// Load the IDT on the calling CPU (interrupts.asm)
+void idt_load();
+
 // Set an entry in the IDT
 void idt_set_gate(int num, uint64_t base, uint16_t sel, uint8_t flags);
+
+// Run vector num on interrupt stack ist (1-7, 0 for the current stack)
+void idt_set_ist(int num, uint8_t ist);
@@ -7,6 +7,9 @@ extern idt_ptr
 extern isr_handler
 extern irq_handler
 
+; Defined in irqstat.c
+extern irqstat_record
+
 global idt_load
 global isr0
 global isr1
@@ -40,6 +43,9 @@ global isr28
 global isr29
 global isr30
 global isr31
+global isr50
+global isr128
+global isr255
 
 global irq0
 global irq1
@@ -57,14 +63,54 @@ global irq12
 global irq13
 global irq14
 global irq15
+global irq16
+global irq17
+global irq18
+global irq19
+global irq20
+global irq21
+global irq22
 
 ; Load the IDT
 idt_load:
     lidt [idt_ptr]
     ret
 
+; Kernel GS holds this CPU's cpu_t, swap it in when coming from ring 3
+; (argument: offset of the saved CS from RSP)
+%macro SWAPGS_IF_USER 1
+    test qword [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
+; Handler timing for irqstat. With the registers saved, R12 and R13 are
+; free to hold the entry TSC and the vector across the call: the frame
+; may be swapped for another task's by then, so neither is read back
+; from it.
+%macro IRQSTAT_BEGIN 0
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    mov r12, rax
+    mov r13, [rsp + 15 * 8]     ; Interrupt number
+%endmacro
+
+%macro IRQSTAT_END 0
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    sub rax, r12
+    mov rdi, r13
+    mov rsi, rax
+    call irqstat_record
+%endmacro
+
 ; Common ISR stub for 64-bit mode
 isr_common_stub:
+    SWAPGS_IF_USER 24
+
     ; Save all general purpose registers
     push rax
     push rbx
@@ -82,6 +128,8 @@ isr_common_stub:
     push r14
     push r15
 
+    IRQSTAT_BEGIN
+
     ; Pass pointer to stack frame as first argument (RDI in System V ABI)
     mov rdi, rsp
     
@@ -90,7 +138,8 @@ isr_common_stub:
     and rsp, ~0xF
     
     call isr_handler
-    
+    IRQSTAT_END
+
     ; Restore stack
     mov rsp, rbp
 
@@ -114,10 +163,14 @@ isr_common_stub:
     ; Remove error code and interrupt number from stack
     add rsp, 16
 
+    ; The frame may now belong to another task, check its CS again
+    SWAPGS_IF_USER 8
     iretq
 
 ; Common IRQ stub for 64-bit mode
 irq_common_stub:
+    SWAPGS_IF_USER 24
+
     ; Save all general purpose registers
     push rax
     push rbx
@@ -135,6 +188,8 @@ irq_common_stub:
     push r14
     push r15
 
+    IRQSTAT_BEGIN
+
     ; Pass pointer to stack frame as first argument (RDI in System V ABI)
     mov rdi, rsp
     
@@ -143,7 +198,8 @@ irq_common_stub:
     and rsp, ~0xF
     
     call irq_handler
-    
+    IRQSTAT_END
+
     ; Restore stack
     mov rsp, rbp
 
@@ -167,6 +223,8 @@ irq_common_stub:
     ; Remove error code and interrupt number from stack
     add rsp, 16
 
+    ; The frame may now belong to another task, check its CS again
+    SWAPGS_IF_USER 8
     iretq
 
 ; Macros to define ISRs
@@ -224,6 +282,15 @@ ISR_NOERRCODE 29
 ISR_NOERRCODE 30
 ISR_NOERRCODE 31
 
+; Scheduler yield (int 50)
+ISR_NOERRCODE 50
+
+; System call gate (int 0x80)
+ISR_NOERRCODE 128
+
+; Local APIC spurious interrupt
+ISR_NOERRCODE 255
+
 ; Define IRQs
 IRQ 0,  32
 IRQ 1,  33
@@ -241,3 +308,16 @@ IRQ 12, 44
 IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
+
+; Local APIC sources: scheduler tick and reschedule IPI
+IRQ 16, 48
+IRQ 17, 49
+
+; Message signalled interrupts, handed out by pci_alloc_vector()
+IRQ 18, 51
+IRQ 19, 52
+IRQ 20, 53
+IRQ 21, 54
+
+; Self-IPI for the bench command's interrupt latency test
+IRQ 22, 55
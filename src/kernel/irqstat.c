@@ -0,0 +1,132 @@
+#include "irqstat.h"
+#include "apic.h"
+#include "bench.h"
+#include "pmm.h"
+#include "sched.h"
+#include "string.h"
+#include "syscall.h"
+
+#define IRQSTAT_PAGES                                                          \
+  ((sizeof(irqstat_t) + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE)
+
+static const char *const exception_names[32] = {
+    "#DE", "#DB", "NMI", "#BP", "#OF", "#BR", "#UD", "#NM",
+    "#DF", "CSO", "#TS", "#NP", "#SS", "#GP", "#PF", "exc 15",
+    "#MF", "#AC", "#MC", "#XM", "#VE", "#CP", "exc 22", "exc 23",
+    "exc 24", "exc 25", "exc 26", "exc 27", "#HV", "#VC", "#SX", "exc 31",
+};
+
+void irqstat_init_cpu(cpu_t *cpu) {
+  uint64_t base = pmm_alloc_pages(IRQSTAT_PAGES);
+  if (!base)
+    return;
+  uint64_t words = IRQSTAT_PAGES * PMM_PAGE_SIZE / 8;
+  void *dst = (void *)(uintptr_t)base;
+  __asm__ volatile("rep stosq" : "+D"(dst), "+c"(words) : "a"(0ULL) : "memory");
+  cpu->irqstat = (irqstat_t *)(uintptr_t)base;
+}
+
+void irqstat_record(uint64_t vector, uint64_t cycles) {
+  irqstat_t *s = this_cpu()->irqstat;
+  if (!s || vector >= IRQSTAT_VECTORS)
+    return;
+
+  int bucket = 0;
+  if (cycles >> IRQSTAT_MIN_SHIFT) {
+    bucket = 64 - __builtin_clzll(cycles) - IRQSTAT_MIN_SHIFT;
+    if (bucket >= IRQSTAT_BUCKETS)
+      bucket = IRQSTAT_BUCKETS - 1;
+  }
+  s->count[vector]++;
+  s->cycles[vector] += cycles;
+  if (cycles > s->max_cycles[vector])
+    s->max_cycles[vector] = cycles;
+  s->histogram[vector][bucket]++;
+}
+
+void irqstat_summary(int vector, irqstat_summary_t *out) {
+  memset(out, 0, sizeof(*out));
+  if (vector < 0 || vector >= IRQSTAT_VECTORS)
+    return;
+
+  for (int i = 0; i < smp_cpu_count(); i++) {
+    const irqstat_t *s = smp_cpu(i)->irqstat;
+    if (!s)
+      continue;
+    out->count += s->count[vector];
+    out->cycles += s->cycles[vector];
+    if (s->max_cycles[vector] > out->max_cycles)
+      out->max_cycles = s->max_cycles[vector];
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++)
+      out->histogram[b] += s->histogram[vector][b];
+  }
+}
+
+uint64_t irqstat_cpu_count(const cpu_t *cpu, int vector) {
+  if (!cpu->irqstat || vector < 0 || vector >= IRQSTAT_VECTORS)
+    return 0;
+  return cpu->irqstat->count[vector];
+}
+
+uint64_t irqstat_percentile(const irqstat_summary_t *s, int percent) {
+  if (!s->count)
+    return 0;
+  // Smallest bucket that covers percent of the samples, rounded up
+  uint64_t target = (s->count * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (int b = 0; b < IRQSTAT_BUCKETS - 1; b++) {
+    seen += s->histogram[b];
+    if (seen >= target) {
+      uint64_t limit = 1ULL << (IRQSTAT_MIN_SHIFT + b);
+      return limit < s->max_cycles ? limit : s->max_cycles;
+    }
+  }
+  return s->max_cycles;
+}
+
+static void append(char *buf, int size, int *pos, const char *str) {
+  while (*str && *pos < size - 1)
+    buf[(*pos)++] = *str++;
+  buf[*pos] = '\0';
+}
+
+const char *irqstat_vector_name(int vector, char *buf, int size) {
+  if (vector >= 0 && vector < 32)
+    return exception_names[vector];
+  switch (vector) {
+  case IRQ_BASE_VECTOR:
+    return "timer";
+  case IRQ_BASE_VECTOR + 1:
+    return "keyboard";
+  case SCHED_TICK_VECTOR:
+    return "tick";
+  case SCHED_KICK_VECTOR:
+    return "kick ipi";
+  case SCHED_YIELD_VECTOR:
+    return "yield";
+  case BENCH_VECTOR:
+    return "bench ipi";
+  case SYSCALL_VECTOR:
+    return "syscall";
+  case APIC_SPURIOUS_VECTOR:
+    return "spurious";
+  }
+
+  // "irq n" for the other ISA lines, "vec n" for everything else
+  int pos = 0;
+  int n = vector;
+  bool isa = vector >= IRQ_BASE_VECTOR && vector < IRQ_BASE_VECTOR + 16;
+  if (isa)
+    n -= IRQ_BASE_VECTOR;
+  append(buf, size, &pos, isa ? "irq " : "vec ");
+  char digits[4];
+  int d = 0;
+  do {
+    digits[d++] = '0' + n % 10;
+    n /= 10;
+  } while (n && d < 3);
+  while (d > 0 && pos < size - 1)
+    buf[pos++] = digits[--d];
+  buf[pos] = '\0';
+  return buf;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "smp.h"
+#include "stdint.h"
+
+// Per-CPU, per-vector interrupt accounting. The common stubs in
+// interrupts.asm read the TSC around each handler call and report the
+// cycles here; nothing is shared between CPUs, so recording takes no lock.
+#define IRQSTAT_VECTORS 256
+#define IRQSTAT_BUCKETS 16
+// Bucket 0 holds durations below 2^IRQSTAT_MIN_SHIFT cycles, bucket b the
+// ones below 2^(IRQSTAT_MIN_SHIFT + b); the last one everything longer
+#define IRQSTAT_MIN_SHIFT 8
+
+typedef struct irqstat {
+  uint64_t count[IRQSTAT_VECTORS];
+  uint64_t cycles[IRQSTAT_VECTORS];
+  uint64_t max_cycles[IRQSTAT_VECTORS];
+  uint32_t histogram[IRQSTAT_VECTORS][IRQSTAT_BUCKETS];
+} irqstat_t;
+
+// Give cpu its counters (before it takes interrupts worth counting)
+void irqstat_init_cpu(cpu_t *cpu);
+
+// Called by the stubs with the vector and the handler's duration
+void irqstat_record(uint64_t vector, uint64_t cycles);
+
+// Counters of one vector, summed over every CPU
+typedef struct {
+  uint64_t count;
+  uint64_t cycles;
+  uint64_t max_cycles;
+  uint64_t histogram[IRQSTAT_BUCKETS];
+} irqstat_summary_t;
+
+void irqstat_summary(int vector, irqstat_summary_t *out);
+uint64_t irqstat_cpu_count(const cpu_t *cpu, int vector);
+
+// Upper bound in cycles of the bucket holding the given percentile (the
+// last bucket reports the longest duration seen)
+uint64_t irqstat_percentile(const irqstat_summary_t *s, int percent);
+
+// Short name for a vector ("#PF", "keyboard", "irq 5", ...)
+const char *irqstat_vector_name(int vector, char *buf, int size);
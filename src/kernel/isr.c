@@ -1,11 +1,11 @@
 #include "isr.h"
+#include "apic.h"
+#include "console.h"
 #include "i8259.h"
 #include "idt.h"
-
-// For now, we'll just print to screen. We need to declare kprint/knewline from
-// main.c
-void kprint(const char *str, uint8_t color);
-void knewline(void);
+#include "sched.h"
+#include "smp.h"
+#include "trace.h"
 
 // External assembly ISR handlers
 extern void isr0();
@@ -120,46 +120,45 @@ void register_interrupt_handler(uint8_t n, ISRHandler handler) {
   interrupt_handlers[n] = handler;
 }
 
-// Simple number to string for debugging (64-bit version)
-static void print_hex64(uint64_t num) {
-  char hex[] = "0x0000000000000000";
-  const char digits[] = "0123456789ABCDEF";
-  for (int i = 17; i >= 2; i--) {
-    hex[i] = digits[num & 0xF];
-    num >>= 4;
-  }
-  kprint(hex, 0x0C);
-}
-
 void isr_handler(Registers *regs) {
+  TRACE(TRACE_EXCEPTION, regs->rip, regs->int_no, regs->err_code);
   if (interrupt_handlers[regs->int_no] != 0) {
     ISRHandler handler = interrupt_handlers[regs->int_no];
     handler(regs);
   } else {
     // Unhandled exception
-    kprint("Unhandled Exception #", 0x0C); // Light Red
-    print_hex64(regs->int_no);
-    kprint(" err=", 0x0C);
-    print_hex64(regs->err_code);
-    kprint(" rip=", 0x0C);
-    print_hex64(regs->rip);
-    knewline();
-    kprint("Halted.", 0x0C);
+    klogf(LOG_ERROR, 0x0C, // Light Red
+          "Unhandled Exception #0x%016llX err=0x%016llX rip=0x%016llX\nHalted.\n",
+          regs->int_no, regs->err_code, regs->rip);
+    // Nothing drains the log or the TX ring from here on
+    log_panic_flush();
     for (;;)
       ;
   }
 }
 
 void irq_handler(Registers *regs) {
-  // Send EOI (End of Interrupt) to PICs
-  // If IRQ >= 8, send to slave PIC
-  if (regs->int_no >= 40) {
-    i8259_send_eoi(1); // Slave
+  TRACE(TRACE_IRQ_ENTRY, regs->rip, regs->int_no, 0);
+  this_cpu()->irqs++;
+
+  if (apic_enabled()) {
+    // One register write, no port I/O
+    apic_eoi();
+  } else {
+    // Send EOI (End of Interrupt) to PICs
+    // If IRQ >= 8, send to slave PIC
+    if (regs->int_no >= 40) {
+      i8259_send_eoi(1); // Slave
+    }
+    i8259_send_eoi(0); // Master
   }
-  i8259_send_eoi(0); // Master
 
   if (interrupt_handlers[regs->int_no] != 0) {
     ISRHandler handler = interrupt_handlers[regs->int_no];
     handler(regs);
   }
+  TRACE(TRACE_IRQ_EXIT, 0, regs->int_no, 0);
+
+  // Preempt if the handler woke something or the slice ran out
+  sched_irq_exit(regs);
 }
@@ -1,10 +1,9 @@
 #include "keyboard.h"
+#include "idle.h"
 #include "isr.h"
-#include "shell.h"
+#include "sched.h"
 #include "stdint.h"
-
-// External functions from main.c (for debugging only)
-extern void kputc(char c, uint8_t color);
+#include "timer.h"
 
 // Helper functions for I/O
 static inline uint8_t inb(uint16_t port) {
@@ -35,122 +34,148 @@ static const char scancode_to_ascii_shift[] = {
     0,    0,    0,   0,   '-', 0,   0,   0,   '+', 0,   0,   0,   0,   '.',
     0,    0,    0,   0,   0,   0,   0,   0,   0,   0,   0,   0};
 
-// Keyboard state
-static uint8_t shift_pressed = 0;
-static uint8_t caps_lock = 0;
-
-// Simple key buffer for polling
-#define KEY_BUFFER_SIZE 32
-static volatile char key_buffer[KEY_BUFFER_SIZE];
-static volatile int key_buffer_head = 0;
-static volatile int key_buffer_tail = 0;
-
-// Add key to buffer
-static void key_buffer_push(char c) {
-  int next = (key_buffer_head + 1) % KEY_BUFFER_SIZE;
-  if (next != key_buffer_tail) {
-    key_buffer[key_buffer_head] = c;
-    key_buffer_head = next;
+// Modifier state, only touched by the interrupt handler
+static uint8_t modifiers = 0;
+static bool extended = false;
+
+// Single producer (the handler), single consumer (the reader). Indices run
+// freely; the producer publishes with a release store of tail and the
+// consumer frees slots with a release store of head.
+static key_event_t events[KEY_EVENT_QUEUE_SIZE];
+static volatile uint32_t event_head = 0;
+static volatile uint32_t event_tail = 0;
+static volatile uint64_t dropped = 0;
+static wait_queue_t readers = WAIT_QUEUE_INIT;
+
+#define EVENT_MASK (KEY_EVENT_QUEUE_SIZE - 1)
+
+static char translate(uint8_t scancode) {
+  if (scancode >= sizeof(scancode_to_ascii))
+    return 0;
+  char c = (modifiers & KEY_MOD_SHIFT) ? scancode_to_ascii_shift[scancode]
+                                       : scancode_to_ascii[scancode];
+  // Caps lock inverts the case of letters
+  if ((modifiers & KEY_MOD_CAPS) && c >= 'a' && c <= 'z')
+    c = c - 'a' + 'A';
+  else if ((modifiers & KEY_MOD_CAPS) && c >= 'A' && c <= 'Z')
+    c = c - 'A' + 'a';
+  return c;
+}
+
+static void update_modifiers(uint8_t keycode, bool released) {
+  uint8_t bit = 0;
+  if (keycode == KEY_LSHIFT || keycode == KEY_RSHIFT)
+    bit = KEY_MOD_SHIFT;
+  else if (keycode == KEY_LCTRL || keycode == KEY_RCTRL)
+    bit = KEY_MOD_CTRL;
+  else if (keycode == KEY_LALT || keycode == KEY_RALT)
+    bit = KEY_MOD_ALT;
+  else if (keycode == KEY_CAPSLOCK && !released)
+    modifiers ^= KEY_MOD_CAPS;
+
+  if (bit && released)
+    modifiers &= ~bit;
+  else if (bit)
+    modifiers |= bit;
+}
+
+static void push_event(const key_event_t *event) {
+  uint32_t tail = event_tail;
+  if (tail - __atomic_load_n(&event_head, __ATOMIC_ACQUIRE) >=
+      KEY_EVENT_QUEUE_SIZE) {
+    dropped++;
+    return;
+  }
+  events[tail & EVENT_MASK] = *event;
+  __atomic_store_n(&event_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Consumer side
+static bool pop_event(key_event_t *event) {
+  uint32_t head = event_head;
+  if (head == __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE))
+    return false;
+  *event = events[head & EVENT_MASK];
+  __atomic_store_n(&event_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static bool event_ready(void) {
+  return event_head != __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE);
+}
+
+bool keyboard_read_event(key_event_t *event, bool wait) {
+  while (!pop_event(event)) {
+    if (!wait)
+      return false;
+    if (sched_can_block())
+      WAIT_EVENT(&readers, event_ready());
+    else
+      idle_wait();
   }
+  return true;
 }
 
-// Check if key available
+uint64_t keyboard_dropped_events(void) { return dropped; }
+
+// Leading events that don't type anything are dropped
 int keyboard_has_key(void) {
-  return key_buffer_head != key_buffer_tail;
+  uint32_t head = event_head;
+  while (head != __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE)) {
+    const key_event_t *event = &events[head & EVENT_MASK];
+    if (event->ascii && !(event->flags & KEY_EVENT_RELEASE))
+      return 1;
+    __atomic_store_n(&event_head, ++head, __ATOMIC_RELEASE);
+  }
+  return 0;
 }
 
 // Get key (blocking)
 char keyboard_get_key(void) {
-  while (!keyboard_has_key()) {
-    __asm__ volatile("hlt");
+  key_event_t event;
+  for (;;) {
+    keyboard_read_event(&event, true);
+    if (event.ascii && !(event.flags & KEY_EVENT_RELEASE))
+      return event.ascii;
   }
-  char c = key_buffer[key_buffer_tail];
-  key_buffer_tail = (key_buffer_tail + 1) % KEY_BUFFER_SIZE;
-  return c;
 }
 
 // Get key (non-blocking)
 char keyboard_get_key_nonblocking(void) {
-  if (!keyboard_has_key()) return 0;
-  char c = key_buffer[key_buffer_tail];
-  key_buffer_tail = (key_buffer_tail + 1) % KEY_BUFFER_SIZE;
-  return c;
+  if (!keyboard_has_key())
+    return 0;
+  return keyboard_get_key();
 }
 
-// Keyboard interrupt handler
-void keyboard_handler(Registers *regs) {
-  (void)regs; // Unused parameter
-
-  // Read scancode from keyboard
-  uint8_t scancode = inb(KEYBOARD_DATA_PORT);
-  static uint8_t extended = 0;
-
+// Decode one scancode, queue the event and wake the reader; everything the
+// key causes happens in the reader's task
+void keyboard_process_scancode(uint8_t scancode) {
   // Handle extended scancode prefix (0xE0)
   if (scancode == 0xE0) {
-    extended = 1;
+    extended = true;
     return;
   }
 
-  // Check if it's a key release (bit 7 set)
-  if (scancode & 0x80) {
-    scancode &= 0x7F; // Remove release bit
-    if (scancode == 0x2A || scancode == 0x36) {
-      shift_pressed = 0;
-    }
-    extended = 0;
-  } else {
-    // Key press
-    if (scancode == 0x2A || scancode == 0x36) {
-      shift_pressed = 1;
-      extended = 0;
-      return;
-    } else if (scancode == 0x3A) {
-      caps_lock = !caps_lock;
-      extended = 0;
-      return;
-    }
-
-    // Arrow keys (extended scancodes: Up=0x48, Down=0x50, Left=0x4B,
-    // Right=0x4D) Also block non-extended arrow scancodes (same codes used by
-    // numpad without NumLock) Arrow keys (extended scancodes: Up=0x48,
-    // Down=0x50, Left=0x4B, Right=0x4D) Also block non-extended arrow scancodes
-    // (same codes used by numpad without NumLock)
-    if (scancode == 0x48 || scancode == 0x50 || scancode == 0x4B ||
-        scancode == 0x4D) {
-      shell_handle_arrow(scancode);
-      extended = 0;
-      return;
-    }
-
-    if (extended) {
-      // Other extended keys - ignore for now
-      extended = 0;
-      return;
-    }
-
-    // Translate scancode to ASCII
-    char c = 0;
-    if (scancode < sizeof(scancode_to_ascii)) {
-      if (shift_pressed) {
-        c = scancode_to_ascii_shift[scancode];
-      } else {
-        c = scancode_to_ascii[scancode];
-      }
-
-      // Apply caps lock to letters
-      if (caps_lock && c >= 'a' && c <= 'z') {
-        c = c - 'a' + 'A';
-      } else if (caps_lock && c >= 'A' && c <= 'Z') {
-        c = c - 'A' + 'a';
-      }
-
-      // Print character if valid
-      if (c != 0) {
-        key_buffer_push(c);  // Also add to buffer for polling
-        shell_putchar(c);
-      }
-    }
-  }
+  key_event_t event = {0};
+  event.time_ns = timer_now_ns();
+  event.scancode = scancode & 0x7F;
+  event.keycode = event.scancode | (extended ? 0x80 : 0);
+  event.flags = (scancode & 0x80) ? KEY_EVENT_RELEASE : 0;
+  extended = false;
+
+  update_modifiers(event.keycode, event.flags & KEY_EVENT_RELEASE);
+  event.modifiers = modifiers;
+  if (event.keycode < 0x80)
+    event.ascii = translate(event.scancode);
+
+  push_event(&event);
+  wait_queue_wake_all(&readers);
+}
+
+// Keyboard interrupt handler
+void keyboard_handler(Registers *regs) {
+  (void)regs; // Unused parameter
+  keyboard_process_scancode(inb(KEYBOARD_DATA_PORT));
 }
 
 void keyboard_init(void) {
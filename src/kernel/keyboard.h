@@ -5,10 +5,63 @@
 #define KEYBOARD_DATA_PORT 0x60
 #define KEYBOARD_STATUS_PORT 0x64
 
+// Key events in arrival order, filled by the interrupt handler. Power of
+// two; when it is full new events are dropped and counted.
+#define KEY_EVENT_QUEUE_SIZE 128
+
+// Keycodes are the set 1 scancode, with 0x80 added for 0xE0-prefixed keys
+#define KEY_ESCAPE 0x01
+#define KEY_BACKSPACE 0x0E
+#define KEY_TAB 0x0F
+#define KEY_ENTER 0x1C
+#define KEY_LCTRL 0x1D
+#define KEY_LSHIFT 0x2A
+#define KEY_RSHIFT 0x36
+#define KEY_LALT 0x38
+#define KEY_SPACE 0x39
+#define KEY_CAPSLOCK 0x3A
+#define KEY_RCTRL 0x9D
+#define KEY_RALT 0xB8
+#define KEY_UP 0xC8
+#define KEY_PAGEUP 0xC9
+#define KEY_LEFT 0xCB
+#define KEY_RIGHT 0xCD
+#define KEY_DOWN 0xD0
+#define KEY_PAGEDOWN 0xD1
+
+// Modifier state when the event happened
+#define KEY_MOD_SHIFT 0x01
+#define KEY_MOD_CTRL 0x02
+#define KEY_MOD_ALT 0x04
+#define KEY_MOD_CAPS 0x08
+
+#define KEY_EVENT_RELEASE 0x01
+
+typedef struct {
+  uint64_t time_ns; // timer_now_ns() (the TSC clock) in the interrupt
+  uint8_t scancode; // Raw set 1 code, release bit cleared
+  uint8_t keycode;
+  uint8_t modifiers;
+  uint8_t flags;
+  char ascii; // Character the key types with these modifiers, or 0
+  uint8_t reserved[3];
+} key_event_t;
+
 // Initialize keyboard driver
 void keyboard_init(void);
 
-// Check if a key is available in the buffer
+// What the interrupt handler does with each byte read from the controller
+// (interrupts off, one caller at a time); tools/hostbench feeds it directly
+void keyboard_process_scancode(uint8_t scancode);
+
+// Next event, false if there is none and wait is false. Waiting blocks the
+// task until the interrupt handler wakes it (the boot flow halts instead).
+// One reader at a time: the shell, or the program it is running.
+bool keyboard_read_event(key_event_t *event, bool wait);
+uint64_t keyboard_dropped_events(void);
+
+// Character interface on top of the events: releases and keys without a
+// character are skipped
 int keyboard_has_key(void);
 
 // Get the next key from the buffer (blocking)
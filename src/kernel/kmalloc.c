@@ -0,0 +1,285 @@
+#include "kmalloc.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "stdint.h"
+#include "string.h"
+
+#define KMEM_SLAB_MAGIC 0x42414C53  // 'SLAB'
+#define KMEM_LARGE_MAGIC 0x4547524C // 'LRGE'
+
+// Offset of the first object in a slab, keeps objects cache line aligned
+#define KMEM_SLAB_HEADER_SIZE 64
+
+// Aim for at least this many objects per slab when sizing cache slabs
+#define KMEM_MIN_OBJECTS 8
+
+typedef struct kmem_object {
+  struct kmem_object *next;
+} kmem_object_t;
+
+// Lives at the start of every slab. Slabs come from the buddy allocator,
+// so they're aligned to their own size and an object's slab is found by
+// masking its address.
+typedef struct kmem_slab {
+  uint32_t magic;
+  uint32_t in_use;
+  kmem_cache_t *cache;
+  struct kmem_slab *next;
+  struct kmem_slab *prev;
+  kmem_object_t *free;
+} kmem_slab_t;
+
+// Header in front of page sized allocations
+typedef struct {
+  uint32_t magic;
+  uint32_t pages;
+  uint64_t reserved;
+} kmem_large_t;
+
+struct kmem_cache {
+  kmem_stats_t stats;
+  uint32_t slab_order;
+  kmem_slab_t *partial; // Slabs with at least one free object
+  kmem_slab_t *empty;   // One fully free slab kept to avoid thrashing
+  spinlock_t lock;
+};
+
+static kmem_cache_t caches[KMEM_MAX_CACHES];
+static int cache_count = 0;
+static kmem_cache_t *size_classes[KMALLOC_CLASSES];
+
+static uint64_t large_allocs = 0;
+static uint64_t large_active_pages = 0;
+static spinlock_t large_lock = SPINLOCK_INIT;
+static spinlock_t caches_lock = SPINLOCK_INIT;
+
+static void slab_list_push(kmem_slab_t **list, kmem_slab_t *slab) {
+  slab->prev = 0;
+  slab->next = *list;
+  if (slab->next)
+    slab->next->prev = slab;
+  *list = slab;
+}
+
+static void slab_list_remove(kmem_slab_t **list, kmem_slab_t *slab) {
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+}
+
+static kmem_slab_t *slab_create(kmem_cache_t *cache) {
+  uint64_t addr = pmm_alloc_pages(1ULL << cache->slab_order);
+  if (!addr)
+    return 0;
+
+  kmem_slab_t *slab = (kmem_slab_t *)(uintptr_t)addr;
+  slab->magic = KMEM_SLAB_MAGIC;
+  slab->in_use = 0;
+  slab->cache = cache;
+  slab->free = 0;
+
+  // Chain the objects in address order
+  uint8_t *base = (uint8_t *)slab + KMEM_SLAB_HEADER_SIZE;
+  for (int i = cache->stats.objects_per_slab - 1; i >= 0; i--) {
+    kmem_object_t *obj =
+        (kmem_object_t *)(base + (uint64_t)i * cache->stats.object_size);
+    obj->next = slab->free;
+    slab->free = obj;
+  }
+
+  cache->stats.slabs++;
+  return slab;
+}
+
+static kmem_cache_t *cache_setup(const char *name, uint32_t object_size,
+                                 uint32_t order) {
+  uint32_t per_slab =
+      ((PMM_PAGE_SIZE << order) - KMEM_SLAB_HEADER_SIZE) / object_size;
+  if (per_slab == 0)
+    return 0;
+
+  uint64_t flags = spin_lock_irqsave(&caches_lock);
+  if (cache_count >= KMEM_MAX_CACHES) {
+    spin_unlock_irqrestore(&caches_lock, flags);
+    return 0;
+  }
+  kmem_cache_t *cache = &caches[cache_count++];
+  spin_unlock_irqrestore(&caches_lock, flags);
+
+  strlcpy(cache->stats.name, name, KMEM_NAME_LEN);
+  cache->stats.object_size = object_size;
+  cache->stats.objects_per_slab = per_slab;
+  cache->stats.allocs = 0;
+  cache->stats.frees = 0;
+  cache->stats.active = 0;
+  cache->stats.slabs = 0;
+  cache->stats.failed = 0;
+  cache->slab_order = order;
+  cache->partial = 0;
+  cache->empty = 0;
+  cache->lock.locked = 0;
+  return cache;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t object_size) {
+  if (object_size == 0)
+    return 0;
+
+  // Objects hold the free list link while free and stay 16 byte aligned
+  if (object_size < KMALLOC_MIN_SIZE)
+    object_size = KMALLOC_MIN_SIZE;
+  object_size = (object_size + 15) & ~15u;
+
+  // Smallest slab that holds a reasonable number of objects
+  uint32_t order = 0;
+  while (order < PMM_MAX_ORDER &&
+         ((PMM_PAGE_SIZE << order) - KMEM_SLAB_HEADER_SIZE) / object_size <
+             KMEM_MIN_OBJECTS)
+    order++;
+
+  return cache_setup(name, object_size, order);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+  uint64_t flags = spin_lock_irqsave(&cache->lock);
+  kmem_slab_t *slab = cache->partial;
+  if (!slab) {
+    slab = cache->empty;
+    if (slab)
+      cache->empty = 0;
+    else
+      slab = slab_create(cache);
+    if (!slab) {
+      cache->stats.failed++;
+      spin_unlock_irqrestore(&cache->lock, flags);
+      return 0;
+    }
+    slab_list_push(&cache->partial, slab);
+  }
+
+  kmem_object_t *obj = slab->free;
+  slab->free = obj->next;
+  slab->in_use++;
+
+  // Full slabs drop off the partial list until an object is freed
+  if (!slab->free)
+    slab_list_remove(&cache->partial, slab);
+
+  cache->stats.allocs++;
+  cache->stats.active++;
+  spin_unlock_irqrestore(&cache->lock, flags);
+  return obj;
+}
+
+static void slab_free_object(kmem_slab_t *slab, void *ptr) {
+  kmem_cache_t *cache = slab->cache;
+  kmem_object_t *obj = (kmem_object_t *)ptr;
+  uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+  if (!slab->free)
+    slab_list_push(&cache->partial, slab);
+  obj->next = slab->free;
+  slab->free = obj;
+  slab->in_use--;
+
+  cache->stats.frees++;
+  cache->stats.active--;
+
+  // Keep one empty slab around, give any others back to the frame allocator
+  if (slab->in_use == 0) {
+    slab_list_remove(&cache->partial, slab);
+    if (!cache->empty) {
+      cache->empty = slab;
+    } else {
+      slab->magic = 0;
+      pmm_free_pages((uint64_t)(uintptr_t)slab, 1ULL << cache->slab_order);
+      cache->stats.slabs--;
+    }
+  }
+  spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+  if (!obj)
+    return;
+  uint64_t mask = ((uint64_t)PMM_PAGE_SIZE << cache->slab_order) - 1;
+  kmem_slab_t *slab = (kmem_slab_t *)((uintptr_t)obj & ~mask);
+  if (slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache)
+    return;
+  slab_free_object(slab, obj);
+}
+
+void kmalloc_init(void) {
+  static const char *names[KMALLOC_CLASSES] = {
+      "kmalloc-16",  "kmalloc-32",  "kmalloc-64",  "kmalloc-128",
+      "kmalloc-256", "kmalloc-512", "kmalloc-1024"};
+
+  // Size classes always use single-page slabs, kfree finds them by masking
+  for (int i = 0; i < KMALLOC_CLASSES; i++)
+    size_classes[i] = cache_setup(names[i], KMALLOC_MIN_SIZE << i, 0);
+}
+
+void *kmalloc(size_t size) {
+  if (size == 0)
+    return 0;
+
+  if (size <= KMALLOC_MAX_SIZE) {
+    int index = 0;
+    while ((size_t)(KMALLOC_MIN_SIZE << index) < size)
+      index++;
+    return kmem_cache_alloc(size_classes[index]);
+  }
+
+  uint64_t pages =
+      (size + sizeof(kmem_large_t) + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+  uint64_t addr = pmm_alloc_pages(pages);
+  if (!addr)
+    return 0;
+
+  kmem_large_t *header = (kmem_large_t *)(uintptr_t)addr;
+  header->magic = KMEM_LARGE_MAGIC;
+  header->pages = (uint32_t)pages;
+  uint64_t flags = spin_lock_irqsave(&large_lock);
+  large_allocs++;
+  large_active_pages += pages;
+  spin_unlock_irqrestore(&large_lock, flags);
+  return header + 1;
+}
+
+void kfree(void *ptr) {
+  if (!ptr)
+    return;
+
+  // Both slabs and large allocations start on a page with a magic header
+  void *page = (void *)((uintptr_t)ptr & ~(uintptr_t)(PMM_PAGE_SIZE - 1));
+  kmem_slab_t *slab = (kmem_slab_t *)page;
+  if (slab->magic == KMEM_SLAB_MAGIC && slab->cache->slab_order == 0) {
+    slab_free_object(slab, ptr);
+    return;
+  }
+
+  kmem_large_t *header = (kmem_large_t *)page;
+  if (header->magic == KMEM_LARGE_MAGIC && ptr == (void *)(header + 1)) {
+    header->magic = 0;
+    uint64_t flags = spin_lock_irqsave(&large_lock);
+    large_active_pages -= header->pages;
+    spin_unlock_irqrestore(&large_lock, flags);
+    pmm_free_pages((uint64_t)(uintptr_t)page, header->pages);
+  }
+}
+
+int kmem_cache_count(void) { return cache_count; }
+
+int kmem_get_stats(int index, kmem_stats_t *out) {
+  if (index < 0 || index >= cache_count)
+    return 0;
+  *out = caches[index].stats;
+  return 1;
+}
+
+uint64_t kmalloc_large_active_pages(void) { return large_active_pages; }
+
+uint64_t kmalloc_large_allocs(void) { return large_allocs; }
@@ -0,0 +1,47 @@
+#pragma once
+#include "stdint.h"
+
+// Kernel heap
+//
+// Small allocations come from power-of-two size classes (16 to 1024 bytes),
+// each backed by a slab cache: single-page slabs from the frame allocator,
+// carved into equal objects kept on a per-slab free list. Larger requests
+// take whole pages. Hot fixed-size kernel objects can get their own cache
+// with kmem_cache_create so they don't round up to a size class.
+
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SIZE 1024 // Largest size class, above this pages are used
+#define KMALLOC_CLASSES 7
+
+#define KMEM_MAX_CACHES 32
+#define KMEM_NAME_LEN 16
+
+typedef struct kmem_cache kmem_cache_t;
+
+// Per-cache counters, used to spot hot size classes and fragmentation
+typedef struct {
+  char name[KMEM_NAME_LEN];
+  uint32_t object_size;
+  uint32_t objects_per_slab;
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t active;  // Objects currently allocated
+  uint64_t slabs;   // Slabs currently owned (including the cached empty one)
+  uint64_t failed;  // Allocations that found no memory
+} kmem_stats_t;
+
+void kmalloc_init(void);
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+// Object caches for fixed-size kernel objects
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t object_size);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+// Statistics
+int kmem_cache_count(void);
+int kmem_get_stats(int index, kmem_stats_t *out);
+uint64_t kmalloc_large_active_pages(void);
+uint64_t kmalloc_large_allocs(void);
@@ -0,0 +1,414 @@
+#include "log.h"
+#include "console.h"
+#include "serial.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "string.h"
+#include "tasklet.h"
+#include "timer.h"
+
+#define LOG_MASK (LOG_RECORDS - 1)
+// A writer with interrupts on drains for itself past this backlog, so a
+// loop printing faster than the worker gets to run doesn't lose output
+#define LOG_BACKLOG (LOG_RECORDS / 2)
+// Records shown per drain lock hold, so the worker keeps interrupt
+// latency bounded
+#define DRAIN_BATCH 64
+
+#define va_start(ap, last) __builtin_va_start(ap, last)
+#define va_arg(ap, type) __builtin_va_arg(ap, type)
+#define va_end(ap) __builtin_va_end(ap)
+
+static log_record_t ring[LOG_RECORDS];
+static volatile uint64_t head = 0; // Next position to hand out
+static uint64_t drained = 0;       // Next position to show, under drain_lock
+static uint64_t lost = 0;
+static spinlock_t drain_lock = SPINLOCK_INIT;
+static volatile bool async = false;
+
+static void drain_tasklet_fn(void *arg);
+static tasklet_t drain_tasklet = TASKLET_INIT(drain_tasklet_fn, 0);
+
+static inline uint64_t irq_save(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+  __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+#define RFLAGS_IF 0x200
+
+// Claim a position and fill its record. Interrupts stay off while the
+// record is written, so a writer can't be preempted halfway and leave the
+// drain waiting on it.
+static void put_record(int level, uint8_t color, const char *s, uint8_t len) {
+  uint64_t flags = irq_save();
+  uint64_t pos = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  log_record_t *r = &ring[pos & LOG_MASK];
+  __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  r->ns = timer_now_ns();
+  r->level = (uint8_t)level;
+  r->color = color;
+  r->cpu = smp_cpu_count() ? (uint8_t)this_cpu()->index : 0;
+  r->len = len;
+  memcpy(r->text, s, len);
+  __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+  irq_restore(flags);
+}
+
+bool log_read(uint64_t pos, log_record_t *out) {
+  const log_record_t *r = &ring[pos & LOG_MASK];
+  if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    return false;
+  *out = *r;
+  // A writer that came round again in the meantime cleared seq first
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == pos + 1;
+}
+
+uint64_t log_head(void) { return __atomic_load_n(&head, __ATOMIC_ACQUIRE); }
+
+uint64_t log_oldest(void) {
+  uint64_t h = log_head();
+  return h > LOG_RECORDS ? h - LOG_RECORDS : 0;
+}
+
+uint64_t log_lost(void) { return lost; }
+
+// Show up to max records, drain_lock held. Stops at a record still being
+// written: its writer kicks the drain again once it's done.
+static uint64_t drain_locked(uint64_t max) {
+  uint64_t shown = 0;
+  log_record_t r;
+  while (shown < max && drained < log_head()) {
+    if (log_read(drained, &r)) {
+      console_emit(&r);
+    } else if (log_head() - drained > LOG_RECORDS) {
+      // Lapped by the writers, skip to the oldest record still there
+      uint64_t oldest = log_oldest();
+      lost += oldest - drained;
+      drained = oldest;
+      continue;
+    } else {
+      break;
+    }
+    drained++;
+    shown++;
+  }
+  return shown;
+}
+
+uint64_t log_drain_begin(void) {
+  uint64_t flags = spin_lock_irqsave(&drain_lock);
+  drain_locked(~0ULL);
+  return flags;
+}
+
+void log_drain_end(uint64_t flags) {
+  spin_unlock_irqrestore(&drain_lock, flags);
+}
+
+void log_drain(void) { log_drain_end(log_drain_begin()); }
+
+static void drain_tasklet_fn(void *arg) {
+  (void)arg;
+  uint64_t shown;
+  do {
+    uint64_t flags = spin_lock_irqsave(&drain_lock);
+    shown = drain_locked(DRAIN_BATCH);
+    spin_unlock_irqrestore(&drain_lock, flags);
+  } while (shown == DRAIN_BATCH);
+}
+
+void log_start_async(void) { async = true; }
+
+void log_panic_flush(void) {
+  drain_locked(~0ULL);
+  serial_flush();
+}
+
+static bool irqs_on(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0" : "=r"(flags));
+  return (flags & RFLAGS_IF) != 0;
+}
+
+void log_write(int level, uint8_t color, const char *s, uint64_t len) {
+  while (len) {
+    uint8_t n = len > LOG_TEXT ? LOG_TEXT : (uint8_t)len;
+    put_record(level, color, s, n);
+    s += n;
+    len -= n;
+  }
+
+  // With interrupts off the caller may hold a lock or be a handler, it
+  // only leaves the work for the worker
+  if (!async || (irqs_on() && log_head() - drained > LOG_BACKLOG))
+    log_drain();
+  else
+    tasklet_schedule(&drain_tasklet);
+}
+
+// Formatting. Output goes to a sink a character at a time: a buffer for
+// ksnprintf, a record-sized chunk that's logged as it fills for klogf.
+typedef struct sink {
+  char *buf;
+  uint64_t size;
+  uint64_t len; // Characters produced, including any that didn't fit
+  void (*full)(struct sink *s);
+  int level;
+  uint8_t color;
+} sink_t;
+
+static inline void emit(sink_t *s, char c) {
+  if (s->len < s->size)
+    s->buf[s->len] = c;
+  s->len++;
+  if (s->full && s->len == s->size)
+    s->full(s);
+}
+
+static void emit_pad(sink_t *s, char c, int count) {
+  while (count-- > 0)
+    emit(s, c);
+}
+
+#define F_LEFT 0x01
+#define F_ZERO 0x02
+#define F_PLUS 0x04
+#define F_SPACE 0x08
+#define F_ALT 0x10
+
+// One integer conversion: sign or prefix, zeros to the precision or
+// width, then the digits
+static void emit_number(sink_t *s, uint64_t val, bool negative, int base,
+                        bool upper, int flags, int width, int precision) {
+  const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  char tmp[24];
+  int n = 0;
+  if (val || precision != 0) {
+    do {
+      tmp[n++] = digits[val % base];
+      val /= base;
+    } while (val);
+  }
+
+  char sign = 0;
+  if (negative)
+    sign = '-';
+  else if (flags & F_PLUS)
+    sign = '+';
+  else if (flags & F_SPACE)
+    sign = ' ';
+  const char *prefix = "";
+  if ((flags & F_ALT) && base == 16 && n && !(n == 1 && tmp[0] == '0'))
+    prefix = upper ? "0X" : "0x";
+  else if ((flags & F_ALT) && base == 8 && (!n || tmp[n - 1] != '0'))
+    prefix = "0";
+  int prefix_len = prefix[0] ? (prefix[1] ? 2 : 1) : 0;
+
+  int zeros = precision > n ? precision - n : 0;
+  int body = (sign != 0) + prefix_len + zeros + n;
+  if (precision < 0 && (flags & (F_ZERO | F_LEFT)) == F_ZERO && width > body) {
+    zeros += width - body;
+    body = width;
+  }
+
+  if (!(flags & F_LEFT))
+    emit_pad(s, ' ', width - body);
+  if (sign)
+    emit(s, sign);
+  for (int i = 0; i < prefix_len; i++)
+    emit(s, prefix[i]);
+  emit_pad(s, '0', zeros);
+  while (n)
+    emit(s, tmp[--n]);
+  if (flags & F_LEFT)
+    emit_pad(s, ' ', width - body);
+}
+
+static void format(sink_t *s, const char *fmt, __builtin_va_list ap) {
+  while (*fmt) {
+    if (*fmt != '%') {
+      emit(s, *fmt++);
+      continue;
+    }
+    fmt++;
+
+    int flags = 0;
+    for (;; fmt++) {
+      if (*fmt == '-')
+        flags |= F_LEFT;
+      else if (*fmt == '0')
+        flags |= F_ZERO;
+      else if (*fmt == '+')
+        flags |= F_PLUS;
+      else if (*fmt == ' ')
+        flags |= F_SPACE;
+      else if (*fmt == '#')
+        flags |= F_ALT;
+      else
+        break;
+    }
+
+    int width = 0;
+    if (*fmt == '*') {
+      width = va_arg(ap, int);
+      if (width < 0) {
+        flags |= F_LEFT;
+        width = -width;
+      }
+      fmt++;
+    } else {
+      for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+        width = width * 10 + (*fmt - '0');
+    }
+
+    int precision = -1;
+    if (*fmt == '.') {
+      fmt++;
+      precision = 0;
+      if (*fmt == '*') {
+        precision = va_arg(ap, int);
+        fmt++;
+      } else {
+        for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+          precision = precision * 10 + (*fmt - '0');
+      }
+    }
+
+    // Size of the argument in bytes, int unless a modifier says otherwise
+    int size = 4;
+    if (*fmt == 'h') {
+      size = 2;
+      if (*++fmt == 'h') {
+        size = 1;
+        fmt++;
+      }
+    } else if (*fmt == 'l') {
+      size = 8;
+      if (*++fmt == 'l')
+        fmt++;
+    } else if (*fmt == 'z' || *fmt == 'j' || *fmt == 't') {
+      size = 8;
+      fmt++;
+    }
+
+    char conv = *fmt;
+    if (!conv)
+      break;
+    fmt++;
+
+    switch (conv) {
+    case 'd':
+    case 'i': {
+      int64_t v = size == 8 ? va_arg(ap, int64_t) : va_arg(ap, int);
+      if (size == 2)
+        v = (int16_t)v;
+      else if (size == 1)
+        v = (int8_t)v;
+      uint64_t mag = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+      emit_number(s, mag, v < 0, 10, false, flags, width, precision);
+      break;
+    }
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o': {
+      uint64_t v = size == 8 ? va_arg(ap, uint64_t) : va_arg(ap, unsigned int);
+      if (size == 2)
+        v = (uint16_t)v;
+      else if (size == 1)
+        v = (uint8_t)v;
+      int base = conv == 'u' ? 10 : conv == 'o' ? 8 : 16;
+      emit_number(s, v, false, base, conv == 'X', flags & ~(F_PLUS | F_SPACE),
+                  width, precision);
+      break;
+    }
+    case 'p':
+      emit_number(s, (uint64_t)(uintptr_t)va_arg(ap, void *), false, 16,
+                  false, flags | F_ALT, width, precision);
+      break;
+    case 'c': {
+      if (!(flags & F_LEFT))
+        emit_pad(s, ' ', width - 1);
+      emit(s, (char)va_arg(ap, int));
+      if (flags & F_LEFT)
+        emit_pad(s, ' ', width - 1);
+      break;
+    }
+    case 's': {
+      const char *str = va_arg(ap, const char *);
+      if (!str)
+        str = "(null)";
+      int n = 0;
+      while (str[n] && (precision < 0 || n < precision))
+        n++;
+      if (!(flags & F_LEFT))
+        emit_pad(s, ' ', width - n);
+      for (int i = 0; i < n; i++)
+        emit(s, str[i]);
+      if (flags & F_LEFT)
+        emit_pad(s, ' ', width - n);
+      break;
+    }
+    case '%':
+      emit(s, '%');
+      break;
+    default:
+      // Unknown conversion, show it as written
+      emit(s, '%');
+      emit(s, conv);
+      break;
+    }
+  }
+}
+
+int kvsnprintf(char *buf, uint64_t size, const char *fmt, __builtin_va_list ap) {
+  sink_t s = {buf, size ? size - 1 : 0, 0, 0, 0, 0};
+  format(&s, fmt, ap);
+  if (size)
+    buf[s.len < s.size ? s.len : s.size] = '\0';
+  return (int)s.len;
+}
+
+int ksnprintf(char *buf, uint64_t size, const char *fmt, ...) {
+  __builtin_va_list ap;
+  va_start(ap, fmt);
+  int n = kvsnprintf(buf, size, fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+// A chunk became a record's worth, log it and start the next
+static void chunk_full(sink_t *s) {
+  log_write(s->level, s->color, s->buf, s->len);
+  s->len = 0;
+}
+
+void kvlogf(int level, uint8_t color, const char *fmt, __builtin_va_list ap) {
+  char chunk[LOG_TEXT];
+  sink_t s = {chunk, LOG_TEXT, 0, chunk_full, level, color};
+  format(&s, fmt, ap);
+  if (s.len)
+    log_write(level, color, chunk, s.len);
+}
+
+void klogf(int level, uint8_t color, const char *fmt, ...) {
+  __builtin_va_list ap;
+  va_start(ap, fmt);
+  kvlogf(level, color, fmt, ap);
+  va_end(ap);
+}
+
+void kprintf(const char *fmt, ...) {
+  __builtin_va_list ap;
+  va_start(ap, fmt);
+  kvlogf(LOG_INFO, VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK), fmt,
+         ap);
+  va_end(ap);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "stdint.h"
+
+// Message levels, most important first
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+// Kernel log: every piece of console output becomes a record in a ring
+// that any CPU, interrupt handlers included, adds to without a lock. A
+// record is a memcpy; the console and COM1 are written later, when the
+// tasklet worker drains the ring. Before the worker runs, and when a
+// writer that may take its time falls too far behind, the writer drains
+// it itself. Old records stay in the ring for dmesg until overwritten.
+#define LOG_RECORDS 2048 // Power of two
+#define LOG_TEXT 44      // Text bytes per record, longer output takes several
+
+typedef struct {
+  uint64_t seq; // Position + 1 once written, 0 while being written
+  uint64_t ns;  // timer_now_ns() when logged, 0 before the timer is up
+  uint8_t level;
+  uint8_t color;
+  uint8_t cpu;
+  uint8_t len;
+  char text[LOG_TEXT];
+} log_record_t;
+
+// Append len bytes as one or more records
+void log_write(int level, uint8_t color, const char *s, uint64_t len);
+
+// Formatted output. Conversions d i u x X o c s p %, flags - 0 + space #,
+// width and precision (numbers or *), length modifiers hh h l ll z j t.
+// kprintf logs at LOG_INFO in light gray.
+void kprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void klogf(int level, uint8_t color, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+void kvlogf(int level, uint8_t color, const char *fmt, __builtin_va_list ap);
+
+// snprintf: at most size - 1 characters and a terminator, returns the
+// length the whole output would have had
+int ksnprintf(char *buf, uint64_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+int kvsnprintf(char *buf, uint64_t size, const char *fmt, __builtin_va_list ap);
+
+// Hand records to the console from the tasklet worker from now on, once
+// tasklet_init() has run
+void log_start_async(void);
+
+// Write out every record not yet shown. begin leaves the drain lock held
+// so the caller can touch console state in order with the log; end
+// releases it.
+uint64_t log_drain_begin(void);
+void log_drain_end(uint64_t flags);
+void log_drain(void);
+
+// Drain without the lock and push COM1 out by polling, for the panic path
+void log_panic_flush(void);
+
+// Reading the ring: records [log_oldest(), log_head()) may be there.
+// log_read copies one out, false if it was overwritten or isn't finished.
+uint64_t log_head(void);
+uint64_t log_oldest(void);
+bool log_read(uint64_t pos, log_record_t *out);
+
+// Records overwritten before the console saw them
+uint64_t log_lost(void);
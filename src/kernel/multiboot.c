@@ -1,39 +1,95 @@
 #include "multiboot.h"
 #include "stdint.h"
+#include "string.h"
 
 // External functions
 extern void kprint(const char *str, uint8_t color);
 
 // Global to store framebuffer info
 static struct {
-  uint32_t addr;
+  uint64_t addr;
   uint32_t width;
   uint32_t height;
   uint32_t pitch;
   uint8_t bpp;
   uint8_t type;
+  uint8_t color_info[6];
 } framebuffer_info = {0};
 
+// Memory information (the mmap is copied, low memory may be reused later)
+static uint32_t mem_lower = 0;
+static uint32_t mem_upper = 0;
+static multiboot_mmap_entry_t mmap_entries[MULTIBOOT_MAX_MMAP_ENTRIES];
+static int mmap_count = 0;
+static multiboot_video_mode_t video_modes[MULTIBOOT_MAX_VIDEO_MODES];
+static int video_mode_count = 0;
+
+static void parse_mmap(multiboot_info_t *mbi) {
+  uintptr_t addr = mbi->mmap_addr;
+  uintptr_t end = addr + mbi->mmap_length;
+
+  mmap_count = 0;
+  while (addr < end && mmap_count < MULTIBOOT_MAX_MMAP_ENTRIES) {
+    multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t *)addr;
+    mmap_entries[mmap_count].size = entry->size;
+    mmap_entries[mmap_count].base_addr = entry->base_addr;
+    mmap_entries[mmap_count].length = entry->length;
+    mmap_entries[mmap_count].type = entry->type;
+    mmap_count++;
+
+    // Entries are variable sized, 'size' excludes the size field itself
+    addr += entry->size + sizeof(entry->size);
+  }
+}
+
+static void parse_video_modes(multiboot_info_t *mbi) {
+  const multiboot_video_mode_t *modes =
+      (const multiboot_video_mode_t *)(uintptr_t)mbi->video_modes_addr;
+  uint32_t count = mbi->video_modes_count;
+  if (count > MULTIBOOT_MAX_VIDEO_MODES)
+    count = MULTIBOOT_MAX_VIDEO_MODES;
+
+  memcpy(video_modes, modes, count * sizeof(*modes));
+  video_mode_count = (int)count;
+}
+
 void multiboot_init(uint32_t magic, multiboot_info_t *mbi) {
   // Verify magic - silently skip if not multiboot (custom bootloader is fine)
-  if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+  if (magic != MULTIBOOT_BOOTLOADER_MAGIC || mbi == NULL) {
     // Not booted by Multiboot - that's OK, we have our own bootloader
     return;
   }
 
+  if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+    mem_lower = mbi->mem_lower;
+    mem_upper = mbi->mem_upper;
+  }
+
+  if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+    parse_mmap(mbi);
+  }
+
   // Check if framebuffer info is available (bit 12 of flags)
-  if (mbi->flags & (1 << 12)) {
-    framebuffer_info.addr = (uint32_t)mbi->framebuffer_addr;
+  if (mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER_INFO) {
+    framebuffer_info.addr = mbi->framebuffer_addr;
     framebuffer_info.width = mbi->framebuffer_width;
     framebuffer_info.height = mbi->framebuffer_height;
     framebuffer_info.pitch = mbi->framebuffer_pitch;
     framebuffer_info.bpp = mbi->framebuffer_bpp;
     framebuffer_info.type = mbi->framebuffer_type;
+    for (int i = 0; i < 6; i++)
+      framebuffer_info.color_info[i] = mbi->color_info[i];
+  }
+
+  if (mbi->flags & MULTIBOOT_INFO_NBOS_VIDEO_MODES) {
+    parse_video_modes(mbi);
   }
 }
 
 // Get framebuffer address
-uint32_t multiboot_get_framebuffer_addr(void) { return framebuffer_info.addr; }
+uint32_t multiboot_get_framebuffer_addr(void) {
+  return (uint32_t)framebuffer_info.addr;
+}
 
 // Get framebuffer width
 uint32_t multiboot_get_framebuffer_width(void) {
@@ -52,3 +108,50 @@ uint32_t multiboot_get_framebuffer_pitch(void) {
 
 // Get framebuffer bits per pixel
 uint8_t multiboot_get_framebuffer_bpp(void) { return framebuffer_info.bpp; }
+
+// Get framebuffer color layout (only meaningful for RGB framebuffers)
+void multiboot_get_framebuffer_colors(uint8_t *red_pos, uint8_t *red_size,
+                                      uint8_t *green_pos, uint8_t *green_size,
+                                      uint8_t *blue_pos, uint8_t *blue_size) {
+  *red_pos = framebuffer_info.color_info[0];
+  *red_size = framebuffer_info.color_info[1];
+  *green_pos = framebuffer_info.color_info[2];
+  *green_size = framebuffer_info.color_info[3];
+  *blue_pos = framebuffer_info.color_info[4];
+  *blue_size = framebuffer_info.color_info[5];
+}
+
+int multiboot_get_video_mode_count(void) { return video_mode_count; }
+
+const multiboot_video_mode_t *multiboot_get_video_mode(int index) {
+  if (index < 0 || index >= video_mode_count)
+    return NULL;
+  return &video_modes[index];
+}
+
+// Conventional memory in KB
+uint32_t multiboot_get_mem_lower(void) { return mem_lower; }
+
+// Memory above 1MB in KB
+uint32_t multiboot_get_mem_upper(void) { return mem_upper; }
+
+int multiboot_get_mmap_count(void) { return mmap_count; }
+
+const multiboot_mmap_entry_t *multiboot_get_mmap_entry(int index) {
+  if (index < 0 || index >= mmap_count)
+    return NULL;
+  return &mmap_entries[index];
+}
+
+uint64_t multiboot_get_usable_memory(void) {
+  uint64_t total = 0;
+  for (int i = 0; i < mmap_count; i++) {
+    if (mmap_entries[i].type == MULTIBOOT_MEMORY_AVAILABLE)
+      total += mmap_entries[i].length;
+  }
+
+  // Fall back to the basic fields if there was no map
+  if (total == 0)
+    total = ((uint64_t)mem_lower + mem_upper) * 1024;
+  return total;
+}
@@ -10,6 +10,30 @@
 #define MULTIBOOT_MEMORY_INFO 0x00000002
 #define MULTIBOOT_VIDEO_MODE 0x00000004
 
+// Multiboot info flags
+#define MULTIBOOT_INFO_MEMORY 0x00000001
+#define MULTIBOOT_INFO_BOOTDEV 0x00000002
+#define MULTIBOOT_INFO_MEM_MAP 0x00000040
+#define MULTIBOOT_INFO_BOOT_LOADER_NAME 0x00000200
+#define MULTIBOOT_INFO_FRAMEBUFFER_INFO 0x00001000
+// Set by stage2 only: video_modes_addr/count are valid
+#define MULTIBOOT_INFO_NBOS_VIDEO_MODES 0x80000000
+
+// Memory map entry types
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED 2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS 4
+#define MULTIBOOT_MEMORY_BADRAM 5
+
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB 1
+
+// Maximum number of memory map entries kept by the kernel
+#define MULTIBOOT_MAX_MMAP_ENTRIES 64
+
+// Maximum number of video modes kept by the kernel
+#define MULTIBOOT_MAX_VIDEO_MODES 64
+
 // Multiboot info structure (passed by GRUB in EBX)
 typedef struct {
   uint32_t flags;
@@ -42,8 +66,38 @@ typedef struct {
   uint8_t framebuffer_bpp;
   uint8_t framebuffer_type;
   uint8_t color_info[6];
+
+  // stage2's extension (if flags bit 31 is set), GRUB stops before it
+  uint32_t video_modes_addr;
+  uint32_t video_modes_count;
 } __attribute__((packed)) multiboot_info_t;
 
+// Memory map entry (size field does not count itself)
+typedef struct {
+  uint32_t size;
+  uint64_t base_addr;
+  uint64_t length;
+  uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+// A usable VESA mode from stage2: linear framebuffer, direct color, 15 to
+// 32 bpp. Layout matches stage2's VideoMode.
+typedef struct {
+  uint16_t mode; // VBE mode number
+  uint16_t width;
+  uint16_t height;
+  uint16_t pitch;
+  uint32_t framebuffer;
+  uint8_t bpp;
+  uint8_t red_mask_size;
+  uint8_t red_field_pos;
+  uint8_t green_mask_size;
+  uint8_t green_field_pos;
+  uint8_t blue_mask_size;
+  uint8_t blue_field_pos;
+  uint8_t reserved;
+} __attribute__((packed)) multiboot_video_mode_t;
+
 // Function to parse Multiboot info
 void multiboot_init(uint32_t magic, multiboot_info_t *mbi);
 
@@ -53,3 +107,23 @@ uint32_t multiboot_get_framebuffer_width(void);
 uint32_t multiboot_get_framebuffer_height(void);
 uint32_t multiboot_get_framebuffer_pitch(void);
 uint8_t multiboot_get_framebuffer_bpp(void);
+
+// Framebuffer channel layout (field position / mask size in bits)
+void multiboot_get_framebuffer_colors(uint8_t *red_pos, uint8_t *red_size,
+                                      uint8_t *green_pos, uint8_t *green_size,
+                                      uint8_t *blue_pos, uint8_t *blue_size);
+
+// Video modes the boot loader found, best ranked (32bpp, closest to its
+// preferred resolution) first. Entry 0 is the mode it set. None when booted
+// by GRUB.
+int multiboot_get_video_mode_count(void);
+const multiboot_video_mode_t *multiboot_get_video_mode(int index);
+
+// Memory information
+uint32_t multiboot_get_mem_lower(void);
+uint32_t multiboot_get_mem_upper(void);
+int multiboot_get_mmap_count(void);
+const multiboot_mmap_entry_t *multiboot_get_mmap_entry(int index);
+
+// Total bytes of usable RAM in the memory map
+uint64_t multiboot_get_usable_memory(void);
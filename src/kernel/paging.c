@@ -1,12 +1,438 @@
 #include "paging.h"
+#include "cpu.h"
+#include "multiboot.h"
+#include "pmm.h"
 #include "stdint.h"
+#include "string.h"
 
-// Paging is now handled in entry.asm for 64-bit long mode
-// These functions are stubs for compatibility
+// entry.asm builds the boot page tables: PML4[0] -> PDPT[0..3] -> 2MB pages
+// identity mapping the first 4GB. paging_init takes them over from there
+// and adds the direct map in the upper half.
+extern pml4_entry_t pml4_table[];
+
+#define IA32_PAT_MSR 0x277
+#define CR0_WP (1ULL << 16)
+
+// PAT memory type encodings
+#define PAT_UC 0x00
+#define PAT_WC 0x01
+#define PAT_WT 0x04
+#define PAT_WB 0x06
+#define PAT_UC_MINUS 0x07
+
+// Entries 0-3 are selected by PWT/PCD alone, 4-7 repeat them with PAT set
+#define PAT_VALUE                                                              \
+  ((uint64_t)PAT_WB | ((uint64_t)PAT_WC << 8) | ((uint64_t)PAT_UC_MINUS << 16) | \
+   ((uint64_t)PAT_UC << 24) | ((uint64_t)PAT_WB << 32) |                      \
+   ((uint64_t)PAT_WC << 40) | ((uint64_t)PAT_UC_MINUS << 48) |               \
+   ((uint64_t)PAT_UC << 56))
+
+#define PAGE_TABLE_ENTRIES 512
+
+static bool pat_enabled = false;
+static uint64_t direct_end = 0;
+static uint64_t direct_1g = 0;
+static uint64_t direct_2m = 0;
+static uint64_t direct_4k = 0;
+
+static inline void invlpg(uint64_t addr) {
+  __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline void flush_tlb(void) {
+  uint64_t cr3 = get_cr3();
+  __asm__ volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+// Read-only pages stay read-only for the kernel too, so its writes to a
+// user's copy-on-write page fault and get a copy like the user's would
+static void enable_write_protect(void) {
+  __asm__ volatile("mov %0, %%cr0" : : "r"(get_cr0() | CR0_WP) : "memory");
+}
+
+// Page tables are identity mapped, so a table's physical address is also
+// its virtual address
+static inline uint64_t *entry_table(uint64_t entry) {
+  return (uint64_t *)(uintptr_t)(entry & PAGE_ADDR_MASK);
+}
+
+static uint64_t *alloc_table(void) {
+  uint64_t addr = pmm_alloc_page();
+  if (!addr)
+    return 0;
+  uint64_t *table = (uint64_t *)(uintptr_t)addr;
+  memset(table, 0, PAGE_TABLE_ENTRIES * sizeof(*table));
+  return table;
+}
+
+// Replace a large page entry with a table of the next smaller page size
+// mapping the same memory with the same attributes
+static bool split_large(uint64_t *entry, uint64_t child_size) {
+  uint64_t *table = alloc_table();
+  if (!table)
+    return false;
+
+  uint64_t flags = *entry & ~PAGE_ADDR_MASK;
+  uint64_t base = *entry & PAGE_ADDR_MASK & ~(PAGE_SIZE_2M - 1);
+  if (child_size == PAGE_SIZE_1G / PAGE_TABLE_ENTRIES) {
+    // 1GB -> 2MB pages, the large page format stays the same. The PAT
+    // bit sits inside the address field, so it isn't in flags yet.
+    base = *entry & PAGE_ADDR_MASK & ~(PAGE_SIZE_1G - 1);
+    flags |= *entry & PAGE_PAT_HUGE;
+  } else {
+    // 2MB -> 4K pages, the PAT bit moves down to where PS was
+    flags &= ~(uint64_t)(PAGE_HUGE | PAGE_PAT_HUGE);
+    if (*entry & PAGE_PAT_HUGE)
+      flags |= PAGE_PAT;
+  }
+
+  for (int i = 0; i < PAGE_TABLE_ENTRIES; i++)
+    table[i] = (base + i * child_size) | flags;
+
+  // Intermediate entries keep generous permissions, leaves restrict
+  *entry = (uint64_t)(uintptr_t)table | PAGE_PRESENT | PAGE_RW |
+           (flags & PAGE_USER);
+  return true;
+}
+
+// Get the table an entry points to, creating or splitting it if asked
+static uint64_t *next_table(uint64_t *entry, uint64_t child_size, bool create,
+                            uint64_t flags) {
+  if (!(*entry & PAGE_PRESENT)) {
+    if (!create)
+      return 0;
+    uint64_t *table = alloc_table();
+    if (!table)
+      return 0;
+    *entry = (uint64_t)(uintptr_t)table | PAGE_PRESENT | PAGE_RW |
+             (flags & PAGE_USER);
+    return table;
+  }
+
+  if (*entry & PAGE_HUGE) {
+    if (!create || !split_large(entry, child_size))
+      return 0;
+  } else if (flags & PAGE_USER) {
+    *entry |= PAGE_USER;
+  }
+  return entry_table(*entry);
+}
+
+static inline int pml4_index(uint64_t virt) { return (virt >> 39) & 0x1FF; }
+static inline int pdpt_index(uint64_t virt) { return (virt >> 30) & 0x1FF; }
+static inline int pd_index(uint64_t virt) { return (virt >> 21) & 0x1FF; }
+static inline int pt_index(uint64_t virt) { return (virt >> 12) & 0x1FF; }
+
+// Walk to the page directory covering virt
+static uint64_t *walk_pd(uint64_t virt, bool create, uint64_t flags) {
+  uint64_t *pdpt =
+      next_table(&pml4_table[pml4_index(virt)], PAGE_SIZE_1G, create, flags);
+  if (!pdpt)
+    return 0;
+  return next_table(&pdpt[pdpt_index(virt)], PAGE_SIZE_2M, create, flags);
+}
+
+bool paging_map(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+  flags = (flags & ~PAGE_ADDR_MASK) | PAGE_PRESENT;
+  uint64_t huge_flags = (flags & ~(uint64_t)PAGE_PAT) | PAGE_HUGE;
+  if (flags & PAGE_PAT)
+    huge_flags |= PAGE_PAT_HUGE;
+
+  uint64_t end = (virt + size + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+  virt &= ~(PAGE_SIZE_4K - 1);
+  phys &= ~(PAGE_SIZE_4K - 1);
+
+  while (virt < end) {
+    uint64_t *pd = walk_pd(virt, true, flags);
+    if (!pd)
+      return false;
+    uint64_t *pde = &pd[pd_index(virt)];
+
+    if (((virt | phys) & (PAGE_SIZE_2M - 1)) == 0 && end - virt >= PAGE_SIZE_2M) {
+      // A whole 2MB page, drop any page table that was below it
+      uint64_t old = *pde;
+      *pde = phys | huge_flags;
+      if ((old & PAGE_PRESENT) && !(old & PAGE_HUGE)) {
+        // The table's 4K translations may each be cached on their own
+        for (uint64_t off = 0; off < PAGE_SIZE_2M; off += PAGE_SIZE_4K)
+          invlpg(virt + off);
+        pmm_free_page(old & PAGE_ADDR_MASK);
+      } else {
+        invlpg(virt);
+      }
+      virt += PAGE_SIZE_2M;
+      phys += PAGE_SIZE_2M;
+      continue;
+    }
+
+    uint64_t *pt = next_table(pde, PAGE_SIZE_4K, true, flags);
+    if (!pt)
+      return false;
+    pt[pt_index(virt)] = phys | flags;
+    invlpg(virt);
+    virt += PAGE_SIZE_4K;
+    phys += PAGE_SIZE_4K;
+  }
+  return true;
+}
+
+void paging_unmap(uint64_t virt, uint64_t size) {
+  uint64_t end = (virt + size + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+  virt &= ~(PAGE_SIZE_4K - 1);
+
+  while (virt < end) {
+    uint64_t *pd = walk_pd(virt, false, 0);
+    uint64_t *pde = pd ? &pd[pd_index(virt)] : 0;
+    if (!pde || !(*pde & PAGE_PRESENT)) {
+      // Nothing mapped in this 2MB region
+      virt = (virt + PAGE_SIZE_2M) & ~(PAGE_SIZE_2M - 1);
+      continue;
+    }
+
+    if ((*pde & PAGE_HUGE) && (virt & (PAGE_SIZE_2M - 1)) == 0 &&
+        end - virt >= PAGE_SIZE_2M) {
+      *pde = 0;
+      invlpg(virt);
+      virt += PAGE_SIZE_2M;
+      continue;
+    }
+
+    // Partially unmapping a large page keeps the rest of it mapped
+    uint64_t *pt = next_table(pde, PAGE_SIZE_4K, (*pde & PAGE_HUGE) != 0, 0);
+    if (pt) {
+      pt[pt_index(virt)] = 0;
+      invlpg(virt);
+    }
+    virt += PAGE_SIZE_4K;
+  }
+}
+
+bool paging_alloc(uint64_t virt, uint64_t size, uint64_t flags) {
+  uint64_t pages = (size + PAGE_SIZE_4K - 1) / PAGE_SIZE_4K;
+  uint64_t done = 0;
+
+  while (done < pages) {
+    // Largest power of two block that still fits what's left
+    uint64_t chunk = 1ULL << PMM_MAX_ORDER;
+    while (chunk > pages - done)
+      chunk >>= 1;
+
+    uint64_t phys = 0;
+    while (chunk && !(phys = pmm_alloc_pages_high(chunk)))
+      chunk >>= 1;
+    if (!phys ||
+        !paging_map(virt + done * PAGE_SIZE_4K, phys, chunk * PAGE_SIZE_4K, flags)) {
+      if (phys)
+        pmm_free_pages(phys, chunk);
+      paging_free(virt, done * PAGE_SIZE_4K);
+      return false;
+    }
+    done += chunk;
+  }
+  return true;
+}
+
+void paging_free(uint64_t virt, uint64_t size) {
+  // Each run starts with the head frame of a pmm block
+  uint64_t end = virt + size;
+  uint64_t addr = virt;
+  while (addr < end) {
+    uint64_t phys, pages = 0;
+    if (paging_translate(addr, &phys))
+      pages = pmm_block_pages(phys);
+    if (pages) {
+      pmm_free_pages(phys, pages);
+      addr += pages * PAGE_SIZE_4K;
+    } else {
+      addr += PAGE_SIZE_4K;
+    }
+  }
+  paging_unmap(virt, size);
+}
+
+bool paging_translate(uint64_t virt, uint64_t *phys) {
+  uint64_t entry = pml4_table[pml4_index(virt)];
+  if (!(entry & PAGE_PRESENT))
+    return false;
+
+  entry = entry_table(entry)[pdpt_index(virt)];
+  if (!(entry & PAGE_PRESENT))
+    return false;
+  if (entry & PAGE_HUGE) {
+    *phys = (entry & PAGE_ADDR_MASK & ~(PAGE_SIZE_1G - 1)) +
+            (virt & (PAGE_SIZE_1G - 1));
+    return true;
+  }
+
+  entry = entry_table(entry)[pd_index(virt)];
+  if (!(entry & PAGE_PRESENT))
+    return false;
+  if (entry & PAGE_HUGE) {
+    *phys = (entry & PAGE_ADDR_MASK & ~(PAGE_SIZE_2M - 1)) +
+            (virt & (PAGE_SIZE_2M - 1));
+    return true;
+  }
+
+  entry = entry_table(entry)[pt_index(virt)];
+  if (!(entry & PAGE_PRESENT))
+    return false;
+  *phys = (entry & PAGE_ADDR_MASK) + (virt & (PAGE_SIZE_4K - 1));
+  return true;
+}
+
+bool paging_has_pat(void) { return pat_enabled; }
+
+uint64_t paging_direct_end(void) { return direct_end; }
+uint64_t paging_direct_1g_bytes(void) { return direct_1g; }
+uint64_t paging_direct_2m_bytes(void) { return direct_2m; }
+uint64_t paging_direct_4k_bytes(void) { return direct_4k; }
+
+static bool is_ram(uint32_t type) {
+  return type == MULTIBOOT_MEMORY_AVAILABLE ||
+         type == MULTIBOOT_MEMORY_ACPI_RECLAIMABLE ||
+         type == MULTIBOOT_MEMORY_NVS;
+}
+
+// Whether any RAM lies in the 2MB at base
+static bool chunk_has_ram(uint64_t base) {
+  for (int i = 0; i < multiboot_get_mmap_count(); i++) {
+    const multiboot_mmap_entry_t *e = multiboot_get_mmap_entry(i);
+    if (is_ram(e->type) && e->length && e->base_addr < base + PAGE_SIZE_2M &&
+        e->base_addr + e->length > base)
+      return true;
+  }
+  return false;
+}
+
+// Whether RAM covers every byte of the 2MB at base, possibly through
+// several adjacent entries
+static bool chunk_is_ram(uint64_t base) {
+  uint64_t end = base + PAGE_SIZE_2M;
+  bool advanced = true;
+  while (base < end && advanced) {
+    advanced = false;
+    for (int i = 0; i < multiboot_get_mmap_count(); i++) {
+      const multiboot_mmap_entry_t *e = multiboot_get_mmap_entry(i);
+      if (is_ram(e->type) && e->base_addr <= base &&
+          e->base_addr + e->length > base) {
+        base = e->base_addr + e->length;
+        advanced = true;
+      }
+    }
+  }
+  return base >= end;
+}
+
+// The whole pages of RAM in a chunk that is only partly RAM, so the holes
+// (the VGA window and ROMs below 1MB, MMIO) never get a write-back mapping
+static bool map_ram_pages(uint64_t chunk) {
+  for (int i = 0; i < multiboot_get_mmap_count(); i++) {
+    const multiboot_mmap_entry_t *e = multiboot_get_mmap_entry(i);
+    if (!is_ram(e->type))
+      continue;
+    uint64_t start = e->base_addr > chunk ? e->base_addr : chunk;
+    uint64_t end = e->base_addr + e->length;
+    if (end > chunk + PAGE_SIZE_2M)
+      end = chunk + PAGE_SIZE_2M;
+    start = (start + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+    end &= ~(PAGE_SIZE_4K - 1);
+    if (start >= end)
+      continue;
+    if (!paging_map(VMAP_DIRECT + start, start, end - start,
+                    PAGE_RW | PAGE_CACHE_WB))
+      return false;
+    direct_4k += end - start;
+  }
+  return true;
+}
+
+// One gigabyte of the direct map at phys: a single 1GB entry when every
+// byte of it is RAM, otherwise 2MB entries for the chunks that are RAM
+// throughout and 4K pages for the RAM in the rest. A large page must not
+// span memory types, so holes are never covered by one. The 1GB and 2MB
+// entries are written directly, nothing was mapped here before.
+static bool direct_map_gig(uint64_t phys, bool use_1g) {
+  uint64_t virt = VMAP_DIRECT + phys;
+  uint64_t leaf = PAGE_PRESENT | PAGE_RW | PAGE_HUGE | PAGE_CACHE_WB;
+  uint32_t full = 0, partial = 0;
+  for (uint64_t off = 0; off < PAGE_SIZE_1G; off += PAGE_SIZE_2M) {
+    if (chunk_is_ram(phys + off))
+      full++;
+    else if (chunk_has_ram(phys + off))
+      partial++;
+  }
+  if (!full && !partial)
+    return true;
+
+  uint64_t *pdpt = next_table(&pml4_table[pml4_index(virt)], PAGE_SIZE_1G,
+                              true, PAGE_RW);
+  if (!pdpt)
+    return false;
+  uint64_t *pdpte = &pdpt[pdpt_index(virt)];
+  if (use_1g && full == PAGE_TABLE_ENTRIES) {
+    *pdpte = phys | leaf;
+    direct_1g += PAGE_SIZE_1G;
+    return true;
+  }
+
+  uint64_t *pd = next_table(pdpte, PAGE_SIZE_2M, true, PAGE_RW);
+  if (!pd)
+    return false;
+  for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+    uint64_t chunk = phys + (uint64_t)i * PAGE_SIZE_2M;
+    if (chunk_is_ram(chunk)) {
+      pd[i] = chunk | leaf;
+      direct_2m += PAGE_SIZE_2M;
+    } else if (chunk_has_ram(chunk) && !map_ram_pages(chunk)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void direct_map_init(void) {
+  uint64_t top = 0;
+  for (int i = 0; i < multiboot_get_mmap_count(); i++) {
+    const multiboot_mmap_entry_t *e = multiboot_get_mmap_entry(i);
+    if (is_ram(e->type) && e->base_addr + e->length > top)
+      top = e->base_addr + e->length;
+  }
+  if (top > VMAP_BACKBUFFER - VMAP_DIRECT)
+    top = VMAP_BACKBUFFER - VMAP_DIRECT;
+
+  bool use_1g = cpu_has(CPU_FEATURE_PDPE1GB);
+  for (uint64_t phys = 0; phys < top; phys += PAGE_SIZE_1G) {
+    if (!direct_map_gig(phys, use_1g))
+      return;
+    direct_end = phys + PAGE_SIZE_1G < top ? phys + PAGE_SIZE_1G : top;
+  }
+}
 
 void paging_init(void) {
-  // Paging already set up in entry.asm with identity mapping
-  // First 1GB is identity mapped using 2MB pages
+  enable_write_protect();
+  // Page tables themselves come from the frame allocator, so pmm_init()
+  // must have run first
+  if (cpu_has(CPU_FEATURE_PAT)) {
+    // Flush caches around the change so no line is left with a stale type
+    __asm__ volatile("wbinvd" ::: "memory");
+    wrmsr(IA32_PAT_MSR, PAT_VALUE);
+    __asm__ volatile("wbinvd" ::: "memory");
+    flush_tlb();
+    pat_enabled = true;
+  }
+
+  // Only new upper half entries, no TLB entry can be stale
+  direct_map_init();
+}
+
+void paging_init_cpu(void) {
+  enable_write_protect();
+  if (!pat_enabled)
+    return;
+  __asm__ volatile("wbinvd" ::: "memory");
+  wrmsr(IA32_PAT_MSR, PAT_VALUE);
+  __asm__ volatile("wbinvd" ::: "memory");
+  flush_tlb();
 }
 
 uint64_t get_cr0(void) {
@@ -11,6 +11,29 @@
 #define PAGE_DIRTY 0x40
 #define PAGE_HUGE 0x80  // 2MB page (PSE)
 #define PAGE_GLOBAL 0x100
+#define PAGE_PAT 0x80        // PAT index bit in a 4K page table entry
+#define PAGE_PAT_HUGE 0x1000 // PAT index bit in a 2MB or 1GB entry
+
+// Memory types, valid once paging_init has programmed the PAT. Entry 1 is
+// switched from write-through to write-combining, the rest keep their
+// power-on values (0 WB, 2 UC-, 3 UC).
+#define PAGE_CACHE_WB 0
+#define PAGE_CACHE_WC PAGE_WRITE_THROUGH
+#define PAGE_CACHE_UC (PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH)
+#define PAGE_CACHE_MASK (PAGE_PAT | PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH)
+
+#define PAGE_SIZE_4K 0x1000ULL
+#define PAGE_SIZE_2M 0x200000ULL
+#define PAGE_SIZE_1G 0x40000000ULL
+
+// Physical address bits of a table entry
+#define PAGE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+
+// Kernel virtual regions outside the identity map
+#define VMAP_DIRECT 0xFFFF800000000000ULL     // All RAM, see phys_to_virt
+#define VMAP_BACKBUFFER 0xFFFF900000000000ULL // Graphics back buffer
+#define VMAP_DISPLAY 0xFFFFA00000000000ULL    // virtio-gpu scanout backing
+#define VMAP_BENCH 0xFFFFB00000000000ULL      // bench command buffers
 
 // Page table entry types (all 64-bit in long mode)
 typedef uint64_t pml4_entry_t;
@@ -18,8 +41,46 @@ typedef uint64_t pdpt_entry_t;
 typedef uint64_t pd_entry_t;
 typedef uint64_t pt_entry_t;
 
+// The direct map: every page of RAM (the memory map's available and ACPI
+// ranges) at VMAP_DIRECT + its address, write-back, in 1GB pages where the
+// CPU has them and the whole gigabyte is RAM, 2MB pages where those 2MB
+// are, and 4K pages around the holes.
+// Unlike the identity map it reaches past 4GB. Valid once paging_init ran.
+static inline void *phys_to_virt(uint64_t phys) {
+  return (void *)(uintptr_t)(VMAP_DIRECT + phys);
+}
+
+// End of the RAM the direct map covers, and how much of it is in each page
+// size
+uint64_t paging_direct_end(void);
+uint64_t paging_direct_1g_bytes(void);
+uint64_t paging_direct_2m_bytes(void);
+uint64_t paging_direct_4k_bytes(void);
+
 // Functions
+// Program the PAT, set CR0.WP and build the direct map, after pmm_init()
 void paging_init(void);
+// The PAT and CR0.WP on an application processor, to match the boot CPU
+void paging_init_cpu(void);
+
+// Map [virt, virt + size) to [phys, phys + size) with the given entry flags
+// (4K page format, e.g. PAGE_RW | PAGE_CACHE_WC; PAGE_PRESENT is implied).
+// Uses 2MB pages where both addresses are aligned and splits existing large
+// pages as needed. Returns false if a page table couldn't be allocated.
+bool paging_map(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+void paging_unmap(uint64_t virt, uint64_t size);
+
+// Back [virt, virt + size) with newly allocated frames, taken in the
+// largest contiguous blocks available so 2MB pages can be used
+bool paging_alloc(uint64_t virt, uint64_t size, uint64_t flags);
+// Unmap a paging_alloc region and give its frames back
+void paging_free(uint64_t virt, uint64_t size);
+
+// Look up the physical address behind virt, false if it isn't mapped
+bool paging_translate(uint64_t virt, uint64_t *phys);
+
+// Whether the CPU has a PAT, without one PAGE_CACHE_WC falls back to WT
+bool paging_has_pat(void);
 uint64_t get_cr0(void);
 uint64_t get_cr3(void);
 uint64_t get_cr4(void);
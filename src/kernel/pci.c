@@ -0,0 +1,248 @@
+#include "pci.h"
+#include "apic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "smp.h"
+#include "spinlock.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+#define PCI_CONFIG_ENABLE 0x80000000
+
+#define PCI_HEADER_MULTIFUNCTION 0x80
+#define PCI_HEADER_LAYOUT 0x7F
+#define PCI_HEADER_BRIDGE 0x01
+
+#define PCI_BAR_IO 0x1
+#define PCI_BAR_TYPE_64 0x4
+
+#define MSI_CONTROL 2
+#define MSI_ADDRESS 4
+#define MSI_CONTROL_ENABLE 0x1
+#define MSI_CONTROL_MULTIPLE 0x70 // Messages enabled, 0 means one
+#define MSI_CONTROL_64BIT 0x80
+#define MSI_ADDRESS_BASE 0xFEE00000
+
+extern void irq18();
+extern void irq19();
+extern void irq20();
+extern void irq21();
+
+static void (*const vector_stubs[PCI_VECTORS])() = {irq18, irq19, irq20,
+                                                     irq21};
+
+static pci_device_t devices[PCI_MAX_DEVICES];
+static int device_count = 0;
+static int vectors_used = 0;
+static spinlock_t config_lock = SPINLOCK_INIT; // Address and data go together
+
+static inline void outl(uint16_t port, uint32_t val) {
+  __asm__ volatile("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline void outw(uint16_t port, uint16_t val) {
+  __asm__ volatile("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+  uint32_t ret;
+  __asm__ volatile("inl %1, %0" : "=a"(ret) : "Nd"(port));
+  return ret;
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t func,
+                            uint8_t offset) {
+  uint64_t flags = spin_lock_irqsave(&config_lock);
+  outl(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE | (uint32_t)bus << 16 |
+                               (uint32_t)slot << 11 | (uint32_t)func << 8 |
+                               (offset & 0xFC));
+  uint32_t value = inl(PCI_CONFIG_DATA);
+  spin_unlock_irqrestore(&config_lock, flags);
+  return value;
+}
+
+static void config_write(uint8_t bus, uint8_t slot, uint8_t func,
+                         uint8_t offset, uint32_t value) {
+  uint64_t flags = spin_lock_irqsave(&config_lock);
+  outl(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE | (uint32_t)bus << 16 |
+                               (uint32_t)slot << 11 | (uint32_t)func << 8 |
+                               (offset & 0xFC));
+  outl(PCI_CONFIG_DATA, value);
+  spin_unlock_irqrestore(&config_lock, flags);
+}
+
+uint32_t pci_read32(const pci_device_t *dev, uint8_t offset) {
+  return config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+uint16_t pci_read16(const pci_device_t *dev, uint8_t offset) {
+  return pci_read32(dev, offset) >> ((offset & 2) * 8);
+}
+
+uint8_t pci_read8(const pci_device_t *dev, uint8_t offset) {
+  return pci_read32(dev, offset) >> ((offset & 3) * 8);
+}
+
+void pci_write32(const pci_device_t *dev, uint8_t offset, uint32_t value) {
+  config_write(dev->bus, dev->slot, dev->func, offset, value);
+}
+
+// A dword write would also hit the other half, which is the write-one-to-
+// clear status register next to PCI_COMMAND
+void pci_write16(const pci_device_t *dev, uint8_t offset, uint16_t value) {
+  uint64_t flags = spin_lock_irqsave(&config_lock);
+  outl(PCI_CONFIG_ADDRESS, PCI_CONFIG_ENABLE | (uint32_t)dev->bus << 16 |
+                               (uint32_t)dev->slot << 11 |
+                               (uint32_t)dev->func << 8 | (offset & 0xFC));
+  outw(PCI_CONFIG_DATA + (offset & 2), value);
+  spin_unlock_irqrestore(&config_lock, flags);
+}
+
+static void scan_bus(uint8_t bus);
+
+static void add_function(uint8_t bus, uint8_t slot, uint8_t func) {
+  uint32_t id = config_read(bus, slot, func, PCI_VENDOR_ID);
+  if ((id & 0xFFFF) == 0xFFFF || device_count == PCI_MAX_DEVICES)
+    return;
+
+  pci_device_t *dev = &devices[device_count++];
+  dev->bus = bus;
+  dev->slot = slot;
+  dev->func = func;
+  dev->vendor_id = id & 0xFFFF;
+  dev->device_id = id >> 16;
+  uint32_t class = config_read(bus, slot, func, 0x08);
+  dev->class_code = class >> 24;
+  dev->subclass = class >> 16;
+  dev->prog_if = class >> 8;
+  dev->irq_line = pci_read8(dev, PCI_INTERRUPT_LINE);
+
+  uint8_t header = pci_read8(dev, PCI_HEADER_TYPE) & PCI_HEADER_LAYOUT;
+  if (dev->class_code == PCI_CLASS_BRIDGE &&
+      dev->subclass == PCI_SUBCLASS_PCI_BRIDGE &&
+      header == PCI_HEADER_BRIDGE) {
+    uint8_t secondary = pci_read8(dev, PCI_SECONDARY_BUS);
+    if (secondary > bus)
+      scan_bus(secondary);
+  }
+}
+
+static void scan_bus(uint8_t bus) {
+  for (uint8_t slot = 0; slot < 32; slot++) {
+    uint32_t id = config_read(bus, slot, 0, PCI_VENDOR_ID);
+    if ((id & 0xFFFF) == 0xFFFF)
+      continue;
+    uint32_t header = config_read(bus, slot, 0, 0x0C) >> 16;
+    int funcs = header & PCI_HEADER_MULTIFUNCTION ? 8 : 1;
+    for (uint8_t func = 0; func < funcs; func++)
+      add_function(bus, slot, func);
+  }
+}
+
+void pci_init(void) {
+  device_count = 0;
+  scan_bus(0);
+}
+
+int pci_device_count(void) { return device_count; }
+
+const pci_device_t *pci_device(int index) {
+  if (index < 0 || index >= device_count)
+    return 0;
+  return &devices[index];
+}
+
+const pci_device_t *pci_find_class(uint8_t class_code, uint8_t subclass,
+                                   int index) {
+  for (int i = 0; i < device_count; i++)
+    if (devices[i].class_code == class_code &&
+        devices[i].subclass == subclass && index-- == 0)
+      return &devices[i];
+  return 0;
+}
+
+const pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id,
+                                    int index) {
+  for (int i = 0; i < device_count; i++)
+    if (devices[i].vendor_id == vendor_id &&
+        devices[i].device_id == device_id && index-- == 0)
+      return &devices[i];
+  return 0;
+}
+
+uint64_t pci_bar(const pci_device_t *dev, int n, bool *io) {
+  if (n < 0 || n > 5)
+    return 0;
+  uint32_t low = pci_read32(dev, PCI_BAR0 + n * 4);
+  if (low & PCI_BAR_IO) {
+    *io = true;
+    return low & ~3u;
+  }
+  *io = false;
+  uint64_t base = low & ~0xFu;
+  if ((low & 0x6) == PCI_BAR_TYPE_64 && n < 5)
+    base |= (uint64_t)pci_read32(dev, PCI_BAR0 + (n + 1) * 4) << 32;
+  return base;
+}
+
+void pci_enable(const pci_device_t *dev, uint16_t command) {
+  pci_write16(dev, PCI_COMMAND, pci_read16(dev, PCI_COMMAND) | command);
+}
+
+// First capability with id at or after the list entry offset points to
+static uint8_t walk_capabilities(const pci_device_t *dev, uint8_t offset,
+                                 uint8_t id) {
+  // The list is short; the bound only stops a looping one
+  for (int i = 0; offset && i < 48; i++) {
+    uint16_t header = pci_read16(dev, offset);
+    if ((header & 0xFF) == id)
+      return offset;
+    offset = (header >> 8) & 0xFC;
+  }
+  return 0;
+}
+
+uint8_t pci_find_capability(const pci_device_t *dev, uint8_t id) {
+  if (!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAPABILITIES))
+    return 0;
+  return walk_capabilities(dev, pci_read8(dev, PCI_CAPABILITIES) & 0xFC, id);
+}
+
+uint8_t pci_next_capability(const pci_device_t *dev, uint8_t offset,
+                            uint8_t id) {
+  return walk_capabilities(dev, (pci_read16(dev, offset) >> 8) & 0xFC, id);
+}
+
+int pci_alloc_vector(ISRHandler handler) {
+  if (vectors_used == PCI_VECTORS)
+    return -1;
+  int vector = PCI_VECTOR_BASE + vectors_used;
+  idt_set_gate(vector, (uint64_t)vector_stubs[vectors_used], GDT_KERNEL_CODE,
+               0x8E);
+  // Handlers may wake tasks, and switches only happen on the IST stack
+  if (this_cpu()->irq_stack_top)
+    idt_set_ist(vector, IST_IRQ);
+  register_interrupt_handler(vector, handler);
+  vectors_used++;
+  return vector;
+}
+
+bool pci_enable_msi(const pci_device_t *dev, uint8_t vector) {
+  uint8_t cap = pci_find_capability(dev, PCI_CAP_MSI);
+  if (!cap || !apic_enabled())
+    return false;
+
+  uint16_t control = pci_read16(dev, cap + MSI_CONTROL);
+  uint32_t address = MSI_ADDRESS_BASE | smp_cpu(0)->apic_id << 12;
+  pci_write32(dev, cap + MSI_ADDRESS, address);
+  if (control & MSI_CONTROL_64BIT) {
+    pci_write32(dev, cap + MSI_ADDRESS + 4, 0);
+    pci_write16(dev, cap + MSI_ADDRESS + 8, vector); // Edge, fixed delivery
+  } else {
+    pci_write16(dev, cap + MSI_ADDRESS + 4, vector);
+  }
+  control &= ~MSI_CONTROL_MULTIPLE;
+  pci_write16(dev, cap + MSI_CONTROL, control | MSI_CONTROL_ENABLE);
+  pci_enable(dev, PCI_COMMAND_INTX_DISABLE);
+  return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "isr.h"
+#include "stdint.h"
+
+// PCI configuration space through the legacy 0xCF8/0xCFC ports. pci_init
+// walks bus 0 and every bus behind a bridge once and keeps what it finds.
+#define PCI_MAX_DEVICES 64
+
+// Vectors for message signalled interrupts (irq18-irq21 in interrupts.asm)
+#define PCI_VECTOR_BASE 51
+#define PCI_VECTORS 4
+
+// Configuration registers
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_STATUS 0x06
+#define PCI_PROG_IF 0x09
+#define PCI_SUBCLASS 0x0A
+#define PCI_CLASS 0x0B
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_SECONDARY_BUS 0x19 // PCI-to-PCI bridges
+#define PCI_CAPABILITIES 0x34
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO 0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_MASTER 0x4
+#define PCI_COMMAND_INTX_DISABLE 0x400
+
+#define PCI_STATUS_CAPABILITIES 0x10
+
+#define PCI_CAP_MSI 0x05
+#define PCI_CAP_VENDOR 0x09
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_CLASS_DISPLAY 0x03
+#define PCI_CLASS_BRIDGE 0x06
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_SUBCLASS_SATA 0x06
+#define PCI_SUBCLASS_VGA 0x00
+#define PCI_SUBCLASS_PCI_BRIDGE 0x04
+
+typedef struct {
+  uint8_t bus;
+  uint8_t slot;
+  uint8_t func;
+  uint8_t irq_line; // As the firmware routed it, 0xFF for none
+  uint16_t vendor_id;
+  uint16_t device_id;
+  uint8_t class_code;
+  uint8_t subclass;
+  uint8_t prog_if;
+} pci_device_t;
+
+void pci_init(void);
+int pci_device_count(void);
+const pci_device_t *pci_device(int index);
+// The index'th device of a class, 0 when there are fewer
+const pci_device_t *pci_find_class(uint8_t class_code, uint8_t subclass,
+                                   int index);
+// The index'th device with this vendor and device ID, 0 when there are fewer
+const pci_device_t *pci_find_device(uint16_t vendor_id, uint16_t device_id,
+                                    int index);
+
+uint32_t pci_read32(const pci_device_t *dev, uint8_t offset);
+uint16_t pci_read16(const pci_device_t *dev, uint8_t offset);
+uint8_t pci_read8(const pci_device_t *dev, uint8_t offset);
+void pci_write32(const pci_device_t *dev, uint8_t offset, uint32_t value);
+void pci_write16(const pci_device_t *dev, uint8_t offset, uint16_t value);
+
+// Base address of BAR n (both halves of a 64-bit one), io tells whether it
+// is a port range. 0 if the BAR is unused.
+uint64_t pci_bar(const pci_device_t *dev, int n, bool *io);
+// Set PCI_COMMAND_* bits
+void pci_enable(const pci_device_t *dev, uint16_t command);
+
+// Offset of a capability in configuration space, 0 if the device lacks it
+uint8_t pci_find_capability(const pci_device_t *dev, uint8_t id);
+// The next one with the same id after the one at offset, for devices that
+// have several (virtio's vendor capabilities)
+uint8_t pci_next_capability(const pci_device_t *dev, uint8_t offset,
+                            uint8_t id);
+
+// Give handler a vector of its own (on the interrupt stack like the other
+// IRQs), -1 once they are used up
+int pci_alloc_vector(ISRHandler handler);
+// Have the device signal vector to the boot CPU with MSI instead of its
+// INTx line. Needs the local APIC.
+bool pci_enable_msi(const pci_device_t *dev, uint8_t vector);
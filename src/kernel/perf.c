@@ -0,0 +1,172 @@
+#include "perf.h"
+#include "pmm.h"
+#include "sched.h"
+#include "smp.h"
+
+#define PERF_RING_MASK (PERF_RING_SIZE - 1)
+#define PERF_RING_PAGES                                                        \
+  ((PERF_RING_SIZE * sizeof(perf_sample_t) + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE)
+
+#define DEBUGCON_PORT 0xE9
+
+_Static_assert(sizeof(perf_sample_t) == 64, "one sample per cache line");
+
+// Each ring is written by its own CPU only, from the tick
+static perf_sample_t *rings[SMP_MAX_CPUS];
+static volatile uint64_t heads[SMP_MAX_CPUS];
+static volatile bool running = false;
+static uint32_t sample_hz = 0;
+
+static inline void outb(uint16_t port, uint8_t val) {
+  __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static bool alloc_rings(void) {
+  for (int i = 0; i < smp_cpu_count(); i++) {
+    if (rings[i])
+      continue;
+    uint64_t base = pmm_alloc_pages(PERF_RING_PAGES);
+    if (!base)
+      return false;
+    rings[i] = (perf_sample_t *)(uintptr_t)base;
+  }
+  return true;
+}
+
+bool perf_start(uint32_t hz) {
+  if (!hz)
+    hz = PERF_DEFAULT_HZ;
+  if (hz > PERF_MAX_HZ)
+    hz = PERF_MAX_HZ;
+
+  perf_stop();
+  if (!alloc_rings())
+    return false;
+  for (int i = 0; i < SMP_MAX_CPUS; i++)
+    heads[i] = 0;
+  if (!sched_set_tick_period(1000000000ULL / hz))
+    return false;
+  sample_hz = hz;
+  __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+  return true;
+}
+
+void perf_stop(void) {
+  if (!running)
+    return;
+  __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+  sched_set_tick_period(0);
+}
+
+bool perf_running(void) { return running; }
+
+uint32_t perf_hz(void) { return sample_hz; }
+
+// Follow the rbp chain while it stays inside the interrupted stack, moving
+// up with every frame. Anything else ends the walk rather than fault on a
+// frame built by code without frame pointers.
+static int walk_frames(const Registers *regs, uint64_t top, uint64_t *out) {
+  uint64_t fp = regs->rbp;
+  uint64_t low = regs->rsp;
+  int depth = 0;
+  while (depth < PERF_DEPTH) {
+    if (fp < low || fp & 7 || fp + 16 > top)
+      break;
+    const uint64_t *frame = (const uint64_t *)(uintptr_t)fp;
+    if (!frame[1])
+      break;
+    out[depth++] = frame[1];
+    if (frame[0] <= fp)
+      break;
+    fp = frame[0];
+  }
+  return depth;
+}
+
+void perf_sample(const Registers *regs) {
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    return;
+  cpu_t *cpu = this_cpu();
+  perf_sample_t *ring = rings[cpu->index];
+  if (!ring)
+    return;
+
+  uint64_t head = heads[cpu->index];
+  perf_sample_t *s = &ring[head & PERF_RING_MASK];
+  s->rip = regs->rip;
+  s->cpu = cpu->index;
+  s->flags = 0;
+  s->depth = 0;
+  if (regs->cs & 3) {
+    s->flags = PERF_SAMPLE_USER;
+  } else {
+    task_t *task = cpu->current;
+    uint64_t top = task && task->stack
+                       ? task->stack + TASK_STACK_PAGES * PMM_PAGE_SIZE
+                       : cpu->stack_top;
+    s->depth = walk_frames(regs, top, s->stack);
+  }
+  __atomic_store_n(&heads[cpu->index], head + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t perf_sample_count(int cpu) {
+  if (cpu < 0 || cpu >= SMP_MAX_CPUS)
+    return 0;
+  return __atomic_load_n(&heads[cpu], __ATOMIC_ACQUIRE);
+}
+
+int perf_buffered(int cpu) {
+  uint64_t count = perf_sample_count(cpu);
+  return count < PERF_RING_SIZE ? (int)count : PERF_RING_SIZE;
+}
+
+bool perf_read(int cpu, int index, perf_sample_t *out) {
+  if (index < 0 || index >= perf_buffered(cpu) || !rings[cpu])
+    return false;
+  uint64_t first = perf_sample_count(cpu) - perf_buffered(cpu);
+  *out = rings[cpu][(first + index) & PERF_RING_MASK];
+  return true;
+}
+
+static void debugcon_puts(const char *s) {
+  while (*s)
+    outb(DEBUGCON_PORT, *s++);
+}
+
+static void debugcon_hex(uint64_t val) {
+  const char *hex = "0123456789abcdef";
+  for (int shift = 60; shift >= 0; shift -= 4)
+    outb(DEBUGCON_PORT, hex[(val >> shift) & 0xF]);
+}
+
+static void debugcon_dec(uint64_t val) {
+  char buf[21];
+  int pos = 20;
+  buf[pos] = '\0';
+  do {
+    buf[--pos] = '0' + val % 10;
+    val /= 10;
+  } while (val);
+  debugcon_puts(&buf[pos]);
+}
+
+// perf: <cpu> <k|u> <rip> [<return address>...]
+int perf_dump(void) {
+  int lines = 0;
+  perf_sample_t s;
+  for (int cpu = 0; cpu < smp_cpu_count(); cpu++) {
+    for (int i = 0; perf_read(cpu, i, &s); i++) {
+      debugcon_puts("perf: ");
+      debugcon_dec(s.cpu);
+      debugcon_puts(s.flags & PERF_SAMPLE_USER ? " u " : " k ");
+      debugcon_hex(s.rip);
+      for (int d = 0; d < s.depth; d++) {
+        outb(DEBUGCON_PORT, ' ');
+        debugcon_hex(s.stack[d]);
+      }
+      outb(DEBUGCON_PORT, '\n');
+      lines++;
+    }
+  }
+  return lines;
+}
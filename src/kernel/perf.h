@@ -0,0 +1,42 @@
+#pragma once
+#include "isr.h"
+#include "stdint.h"
+
+// Sampling profiler. While it runs the scheduler tick fires at the sample
+// rate, and every tick records where its CPU was interrupted: the RIP and,
+// in the kernel, the return addresses found by following the saved frame
+// pointers. Samples go to a per-CPU ring that overwrites its oldest entries.
+#define PERF_DEPTH 6        // Return addresses kept per sample
+#define PERF_RING_SIZE 2048 // Samples per CPU, power of two
+#define PERF_DEFAULT_HZ 1000
+#define PERF_MAX_HZ 10000
+
+#define PERF_SAMPLE_USER 0x1 // Taken in ring 3, RIP only
+
+typedef struct {
+  uint64_t rip;
+  uint64_t stack[PERF_DEPTH]; // Innermost caller first
+  uint8_t depth;
+  uint8_t flags;
+  uint16_t cpu;
+  uint32_t reserved;
+} perf_sample_t;
+
+// Clear the rings and start sampling at hz, false without an APIC timer
+bool perf_start(uint32_t hz);
+void perf_stop(void);
+bool perf_running(void);
+uint32_t perf_hz(void);
+
+// Called from the tick with the interrupted frame
+void perf_sample(const Registers *regs);
+
+// Samples taken on a CPU since the start, and the ones still in its ring
+// (the newest PERF_RING_SIZE), oldest first
+uint64_t perf_sample_count(int cpu);
+int perf_buffered(int cpu);
+bool perf_read(int cpu, int index, perf_sample_t *out);
+
+// Write every buffered sample as a "perf:" line to the 0xE9 debug console
+// (QEMU -debugcon file:perf.txt) for tools/ksym, returns the lines written
+int perf_dump(void);
@@ -0,0 +1,314 @@
+#include "pmm.h"
+#include "multiboot.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "stdint.h"
+
+// One state byte per frame. The head frame of a free block holds
+// PMM_FRAME_FREE | order, the head of an allocated block holds its order,
+// and every other frame (block tails, holes, reserved memory) holds
+// PMM_FRAME_NONE, so a buddy is mergeable exactly when its byte reads
+// PMM_FRAME_FREE | order.
+#define PMM_FRAME_FREE 0x80
+#define PMM_FRAME_NONE 0x7F
+
+// Free blocks are linked through their own first bytes, reached through
+// the identity map in low memory and the direct map above it
+typedef struct pmm_block {
+  struct pmm_block *next;
+  struct pmm_block *prev;
+} pmm_block_t;
+
+extern uint8_t _kernel_end[];
+
+static uint8_t *frame_map = 0;
+static uint64_t frame_count = 0;
+#define ZONE_LOW 0
+#define ZONE_HIGH 1
+#define ZONE_COUNT 2
+#define LOW_FRAMES (PMM_LOW_LIMIT >> PMM_PAGE_SHIFT)
+
+static pmm_block_t *free_lists[ZONE_COUNT][PMM_MAX_ORDER + 1];
+static uint64_t free_blocks[PMM_MAX_ORDER + 1];
+static uint64_t total_pages = 0;
+static uint64_t free_pages = 0;
+static uint64_t high_pages = 0;
+static spinlock_t lock = SPINLOCK_INIT;
+
+#define PAGE_ALIGN_UP(x) (((x) + PMM_PAGE_SIZE - 1) & ~(uint64_t)(PMM_PAGE_SIZE - 1))
+#define PAGE_ALIGN_DOWN(x) ((x) & ~(uint64_t)(PMM_PAGE_SIZE - 1))
+
+static inline int frame_zone(uint64_t frame) {
+  return frame < LOW_FRAMES ? ZONE_LOW : ZONE_HIGH;
+}
+
+static inline pmm_block_t *frame_block(uint64_t frame) {
+  uint64_t phys = frame << PMM_PAGE_SHIFT;
+  if (frame < LOW_FRAMES)
+    return (pmm_block_t *)(uintptr_t)phys;
+  return (pmm_block_t *)phys_to_virt(phys);
+}
+
+static inline uint64_t block_frame(const pmm_block_t *block) {
+  uint64_t addr = (uint64_t)(uintptr_t)block;
+  if (addr >= VMAP_DIRECT)
+    addr -= VMAP_DIRECT;
+  return addr >> PMM_PAGE_SHIFT;
+}
+
+static void list_push(int order, uint64_t frame) {
+  pmm_block_t **head = &free_lists[frame_zone(frame)][order];
+  pmm_block_t *block = frame_block(frame);
+  block->prev = 0;
+  block->next = *head;
+  if (block->next)
+    block->next->prev = block;
+  *head = block;
+  free_blocks[order]++;
+  frame_map[frame] = PMM_FRAME_FREE | order;
+}
+
+static void list_remove(int order, uint64_t frame) {
+  pmm_block_t *block = frame_block(frame);
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    free_lists[frame_zone(frame)][order] = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+  free_blocks[order]--;
+  frame_map[frame] = PMM_FRAME_NONE;
+}
+
+// Return a block to the free lists, merging it with its buddy for as long
+// as the buddy is free too. Bounded by PMM_MAX_ORDER steps.
+static void free_block(uint64_t frame, int order) {
+  while (order < PMM_MAX_ORDER) {
+    uint64_t buddy = frame ^ (1ULL << order);
+    if (buddy >= frame_count || frame_map[buddy] != (PMM_FRAME_FREE | order))
+      break;
+    list_remove(order, buddy);
+    frame_map[frame] = PMM_FRAME_NONE;
+    if (buddy < frame)
+      frame = buddy;
+    order++;
+  }
+  list_push(order, frame);
+}
+
+static int alloc_block(int zone, int order, uint64_t *frame_out) {
+  int found = order;
+  while (found <= PMM_MAX_ORDER && !free_lists[zone][found])
+    found++;
+  if (found > PMM_MAX_ORDER)
+    return 0;
+
+  uint64_t frame = block_frame(free_lists[zone][found]);
+  list_remove(found, frame);
+
+  // Split down to the requested size, the upper halves go back on the lists
+  while (found > order) {
+    found--;
+    list_push(found, frame + (1ULL << found));
+  }
+
+  frame_map[frame] = order;
+  *frame_out = frame;
+  return 1;
+}
+
+static int order_for_count(uint64_t count) {
+  int order = 0;
+  while ((1ULL << order) < count)
+    order++;
+  return order;
+}
+
+// Add the page range [start, end) to the allocator
+static void add_range(uint64_t start, uint64_t end) {
+  uint64_t frame = start >> PMM_PAGE_SHIFT;
+  uint64_t last = end >> PMM_PAGE_SHIFT;
+  total_pages += last - frame;
+  free_pages += last - frame;
+
+  while (frame < last) {
+    int order = 0;
+    while (order < PMM_MAX_ORDER && (frame & ((2ULL << order) - 1)) == 0 &&
+           frame + (2ULL << order) <= last)
+      order++;
+    free_block(frame, order);
+    frame += 1ULL << order;
+  }
+}
+
+// Clip a memory map entry to the range [floor, limit) the allocator may
+// hand out
+static int usable_range(const multiboot_mmap_entry_t *e, uint64_t floor,
+                        uint64_t limit, uint64_t *start, uint64_t *end) {
+  if (e->type != MULTIBOOT_MEMORY_AVAILABLE)
+    return 0;
+  uint64_t s = PAGE_ALIGN_UP(e->base_addr);
+  uint64_t t = PAGE_ALIGN_DOWN(e->base_addr + e->length);
+  if (s < floor)
+    s = floor;
+  if (t > limit)
+    t = limit;
+  if (s >= t)
+    return 0;
+  *start = s;
+  *end = t;
+  return 1;
+}
+
+void pmm_init(void) {
+  int count = multiboot_get_mmap_count();
+  uint64_t floor = PAGE_ALIGN_UP((uint64_t)(uintptr_t)_kernel_end);
+  uint64_t start, end;
+
+  for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+    for (int zone = 0; zone < ZONE_COUNT; zone++)
+      free_lists[zone][order] = 0;
+    free_blocks[order] = 0;
+  }
+  total_pages = 0;
+  free_pages = 0;
+  high_pages = 0;
+
+  // Size the frame map for the highest usable address, high memory
+  // included, and place it at the start of the first low range large
+  // enough. Without one, high memory stays out.
+  uint64_t top = 0;
+  for (int i = 0; i < count; i++) {
+    if (usable_range(multiboot_get_mmap_entry(i), floor, PMM_MAX_ADDRESS,
+                     &start, &end) &&
+        end > top)
+      top = end;
+  }
+  frame_map = 0;
+  for (int pass = 0; pass < 2 && !frame_map; pass++) {
+    if (pass && top > PMM_LOW_LIMIT)
+      top = PMM_LOW_LIMIT;
+    frame_count = top >> PMM_PAGE_SHIFT;
+    uint64_t size = PAGE_ALIGN_UP(frame_count);
+    for (int i = 0; i < count && !frame_map; i++) {
+      if (usable_range(multiboot_get_mmap_entry(i), floor, PMM_LOW_LIMIT,
+                       &start, &end) &&
+          end - start >= size)
+        frame_map = (uint8_t *)(uintptr_t)start;
+    }
+  }
+  uint64_t map_size = PAGE_ALIGN_UP(frame_count);
+  if (!frame_map) {
+    frame_count = 0;
+    return;
+  }
+
+  for (uint64_t i = 0; i < frame_count; i++)
+    frame_map[i] = PMM_FRAME_NONE;
+
+  uint64_t map_start = (uint64_t)(uintptr_t)frame_map;
+  uint64_t map_end = map_start + map_size;
+  for (int i = 0; i < count; i++) {
+    if (!usable_range(multiboot_get_mmap_entry(i), floor, PMM_LOW_LIMIT,
+                      &start, &end))
+      continue;
+    // Leave the frame map itself out
+    if (start < map_end && end > map_start) {
+      if (start < map_start)
+        add_range(start, map_start);
+      if (end > map_end)
+        add_range(map_end, end);
+    } else {
+      add_range(start, end);
+    }
+  }
+}
+
+void pmm_init_high(void) {
+  // Only what the direct map reaches, the free lists are written through it
+  uint64_t limit = frame_count << PMM_PAGE_SHIFT;
+  if (limit > paging_direct_end())
+    limit = paging_direct_end();
+
+  uint64_t start, end;
+  uint64_t flags = spin_lock_irqsave(&lock);
+  for (int i = 0; i < multiboot_get_mmap_count(); i++) {
+    if (!usable_range(multiboot_get_mmap_entry(i), PMM_LOW_LIMIT, limit,
+                      &start, &end))
+      continue;
+    add_range(start, end);
+    high_pages += (end - start) >> PMM_PAGE_SHIFT;
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+uint64_t pmm_alloc_page(void) { return pmm_alloc_pages(1); }
+
+void pmm_free_page(uint64_t addr) { pmm_free_pages(addr, 1); }
+
+// Take a block from zone first, or the ones below it down to last
+static uint64_t alloc_zones(uint64_t count, int first, int last) {
+  int order = order_for_count(count);
+  uint64_t frame;
+  if (count == 0 || order > PMM_MAX_ORDER)
+    return 0;
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  int zone = first;
+  while (zone >= last && !alloc_block(zone, order, &frame))
+    zone--;
+  if (zone < last) {
+    spin_unlock_irqrestore(&lock, flags);
+    return 0;
+  }
+  free_pages -= 1ULL << order;
+  spin_unlock_irqrestore(&lock, flags);
+  return frame << PMM_PAGE_SHIFT;
+}
+
+uint64_t pmm_alloc_pages(uint64_t count) {
+  return alloc_zones(count, ZONE_LOW, ZONE_LOW);
+}
+
+uint64_t pmm_alloc_page_high(void) { return pmm_alloc_pages_high(1); }
+
+uint64_t pmm_alloc_pages_high(uint64_t count) {
+  return alloc_zones(count, ZONE_HIGH, ZONE_LOW);
+}
+
+void pmm_free_pages(uint64_t addr, uint64_t count) {
+  uint64_t frame = addr >> PMM_PAGE_SHIFT;
+  int order = order_for_count(count);
+
+  // Ignore frees that don't match an allocated block (double frees,
+  // wrong sizes or memory the allocator never owned)
+  if (count == 0 || (addr & (PMM_PAGE_SIZE - 1)) || frame >= frame_count)
+    return;
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (frame_map[frame] == order) {
+    free_pages += 1ULL << order;
+    free_block(frame, order);
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+uint64_t pmm_block_pages(uint64_t addr) {
+  uint64_t frame = addr >> PMM_PAGE_SHIFT;
+  if ((addr & (PMM_PAGE_SIZE - 1)) || frame >= frame_count ||
+      frame_map[frame] > PMM_MAX_ORDER)
+    return 0;
+  return 1ULL << frame_map[frame];
+}
+
+uint64_t pmm_get_total_pages(void) { return total_pages; }
+
+uint64_t pmm_get_free_pages(void) { return free_pages; }
+
+uint64_t pmm_get_high_pages(void) { return high_pages; }
+
+uint64_t pmm_get_free_blocks(int order) {
+  if (order < 0 || order > PMM_MAX_ORDER)
+    return 0;
+  return free_blocks[order];
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "stdint.h"
+
+// Physical page frame allocator (binary buddy system)
+//
+// Built from the multiboot memory map. Frames below 1MB and the kernel
+// image are never handed out. Block sizes go from one page (order 0) up to
+// 2^PMM_MAX_ORDER pages, and every block is aligned to its own size, which
+// makes contiguous allocations usable for DMA and framebuffers.
+
+#define PMM_PAGE_SIZE 4096
+#define PMM_PAGE_SHIFT 12
+#define PMM_MAX_ORDER 10 // 4MB blocks
+
+// Memory is kept in two zones. Low memory, below 4GB, is identity mapped
+// and can be dereferenced at its physical address; memory above that is
+// only reachable through phys_to_virt() and joins once paging_init() has
+// built the direct map. No block spans both.
+#define PMM_LOW_LIMIT 0x100000000ULL
+#define PMM_MAX_ADDRESS 0x10000000000ULL // 1TB
+
+// Low memory only
+void pmm_init(void);
+// Add the memory above 4GB, after paging_init()
+void pmm_init_high(void);
+
+// Single pages, returns the physical address or 0 when out of memory
+uint64_t pmm_alloc_page(void);
+void pmm_free_page(uint64_t addr);
+
+// Physically contiguous runs, rounded up to a power of two pages and aligned
+// to that size. The same count must be passed back when freeing.
+uint64_t pmm_alloc_pages(uint64_t count);
+void pmm_free_pages(uint64_t addr, uint64_t count);
+
+// The same, for memory only used through page tables or phys_to_virt():
+// high memory first, low memory when that is gone. Freed the same way.
+uint64_t pmm_alloc_page_high(void);
+uint64_t pmm_alloc_pages_high(uint64_t count);
+
+// Size in pages of the allocated block starting at addr, 0 if addr isn't
+// the start of one
+uint64_t pmm_block_pages(uint64_t addr);
+
+// Statistics
+uint64_t pmm_get_total_pages(void);
+uint64_t pmm_get_free_pages(void);
+uint64_t pmm_get_high_pages(void);
+uint64_t pmm_get_free_blocks(int order);
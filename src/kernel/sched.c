@@ -0,0 +1,529 @@
+#include "sched.h"
+#include "apic.h"
+#include "gdt.h"
+#include "idle.h"
+#include "idt.h"
+#include "kmalloc.h"
+#include "perf.h"
+#include "pmm.h"
+#include "string.h"
+#include "timer.h"
+#include "trace.h"
+#include "vm.h"
+
+// Every switch happens on the way out of an interrupt (the tick, a kick
+// IPI or the yield vector), which run on the per-CPU IST stack. The frame
+// there is copied into the outgoing task and replaced by the incoming
+// task's, so the outgoing task's stack is free the moment its frame has
+// been saved and another CPU can pick it up at once.
+//
+// Each CPU owns a run queue that only it pushes to. Any CPU takes from
+// the head with a CAS: the owner in FIFO order for its own time slicing,
+// idle CPUs to steal. Tasks are queued wherever they become ready and
+// spread out through stealing.
+//
+// An idle CPU runs no tick: it has no slice to use up, and waking it every
+// period would only cost power. Queuing work rings the doorbell of one
+// idle CPU (idle.c), which is enough on its own when that CPU waits in
+// MWAIT and takes an IPI otherwise.
+
+#define RUNQ_MASK (SCHED_RUNQ_SIZE - 1)
+
+#define RFLAGS_IF 0x200
+#define RFLAGS_RESERVED 0x2
+
+typedef struct run_queue {
+  volatile int64_t head; // Next entry to take, advanced by CAS
+  char pad[56];          // Keep thieves off the owner's cache line
+  volatile int64_t tail; // Next free slot, written by the owner only
+  task_t *volatile slots[SCHED_RUNQ_SIZE];
+} __attribute__((aligned(64))) run_queue_t;
+
+extern void irq16();
+extern void irq17();
+extern void isr50();
+
+static run_queue_t run_queues[SMP_MAX_CPUS];
+static task_t boot_tasks[SMP_MAX_CPUS]; // Each CPU's initial flow
+
+static volatile bool started = false;
+static volatile int task_count = 0;
+static volatile uint32_t next_id = 1;
+static volatile uint64_t idle_mask = 0; // CPUs currently running idle
+
+static ktimer_t pit_tick; // Tick when there is no local APIC timer
+static volatile uint64_t tick_period = SCHED_SLICE_NS;
+
+static inline uint64_t irq_save(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+  __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+static void copy_frame(Registers *dst, const Registers *src) {
+  uint64_t words = sizeof(Registers) / 8;
+  __asm__ volatile("rep movsq" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+}
+
+static void copy_name(task_t *task, const char *name) {
+  strlcpy(task->name, name, TASK_NAME_LEN);
+}
+
+// Owner only, interrupts off. Never full: it holds SCHED_MAX_TASKS.
+static void runq_push(run_queue_t *q, task_t *task) {
+  int64_t tail = q->tail;
+  q->slots[tail & RUNQ_MASK] = task;
+  __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Any CPU. The slot is read before the CAS, a failed CAS means another
+// CPU took it first (and the owner can only refill it after that).
+static task_t *runq_take(run_queue_t *q) {
+  for (;;) {
+    int64_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    int64_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (head >= tail)
+      return 0;
+    task_t *task = q->slots[head & RUNQ_MASK];
+    if (__atomic_compare_exchange_n(&q->head, &head, head + 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return task;
+  }
+}
+
+int sched_runq_length(const cpu_t *cpu) {
+  const run_queue_t *q = cpu->run_queue;
+  if (!q)
+    return 0;
+  int64_t length = q->tail - q->head;
+  return length > 0 ? (int)length : 0;
+}
+
+// Own queue first, then the other CPUs' in turn
+static task_t *pick_next(cpu_t *cpu) {
+  task_t *task = runq_take(cpu->run_queue);
+  int count = smp_cpu_count();
+  for (int i = 1; !task && i < count; i++) {
+    cpu_t *victim = smp_cpu((cpu->index + i) % count);
+    if (victim->run_queue && (task = runq_take(victim->run_queue)))
+      cpu->steals++;
+  }
+
+  // Woken while its old CPU is still switching away from it, leave it
+  // for the next round rather than wait for that CPU (unless that CPU is
+  // this one, then it can simply carry on)
+  if (task && task->on_cpu && task != cpu->current) {
+    runq_push(cpu->run_queue, task);
+    cpu->need_resched = true;
+    return 0;
+  }
+  return task;
+}
+
+// Exited tasks are freed by the CPU that switched away from them, their
+// stack is no longer in use by then
+static void reap(task_t *task) {
+  pmm_free_pages(task->stack, TASK_STACK_PAGES);
+  fpu_context_destroy(task->fpu);
+  kfree(task);
+  __atomic_sub_fetch(&task_count, 1, __ATOMIC_RELAXED);
+}
+
+// Replace the tick with one shot SCHED_IDLE_MAX_NS out, and return when
+// the CPU next has to be awake: then or at the next timer deadline, which
+// is likely to wake a task
+static uint64_t stop_tick(cpu_t *cpu) {
+  uint64_t now = timer_now_ns();
+  if (cpu->idle_deadline <= now &&
+      apic_timer_oneshot(SCHED_IDLE_MAX_NS, SCHED_TICK_VECTOR))
+    cpu->idle_deadline = now + SCHED_IDLE_MAX_NS;
+  uint64_t deadline = timer_next_deadline();
+  uint64_t limit = cpu->idle_deadline ? cpu->idle_deadline : now + cpu->tick_ns;
+  return deadline < limit ? deadline : limit;
+}
+
+static void restart_tick(cpu_t *cpu) {
+  if (!cpu->idle_deadline)
+    return;
+  cpu->idle_deadline = 0;
+  apic_timer_start(cpu->tick_ns, SCHED_TICK_VECTOR);
+}
+
+// The boot flow keeps its CPU until it turns into the idle task
+static bool pinned(cpu_t *cpu) {
+  return cpu->current == &boot_tasks[cpu->index] && cpu->current != cpu->idle;
+}
+
+static void schedule(cpu_t *cpu, Registers *regs) {
+  task_t *prev = cpu->current;
+  if (pinned(cpu))
+    return;
+
+  task_t *next = pick_next(cpu);
+  if (!next) {
+    if (prev->state == TASK_RUNNING)
+      return;
+    next = cpu->idle;
+  }
+
+  uint64_t now = timer_now_ns();
+  if (prev == cpu->idle) {
+    cpu->idle_ns += now - cpu->idle_since;
+    __atomic_and_fetch(&idle_mask, ~(1ULL << cpu->index), __ATOMIC_RELAXED);
+    idle_exit();
+    restart_tick(cpu);
+  }
+  if (next == cpu->idle) {
+    cpu->idle_since = now;
+    __atomic_or_fetch(&idle_mask, 1ULL << cpu->index, __ATOMIC_RELAXED);
+  }
+
+  TRACE(TRACE_SCHED_SWITCH, prev->state, prev->id, next->id);
+  copy_frame(&prev->context, regs);
+  fpu_switch(next->fpu);
+
+  // Its frame and FPU state are saved, another CPU may take it from here.
+  // A blocked task that is READY already has been queued by its waker.
+  bool requeue = prev->state == TASK_RUNNING && prev != cpu->idle && prev != next;
+  if (requeue)
+    prev->state = TASK_READY;
+  __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+  if (requeue)
+    runq_push(cpu->run_queue, prev);
+  else if (prev->state == TASK_DEAD)
+    reap(prev);
+
+  next->on_cpu = true;
+  next->state = TASK_RUNNING;
+  next->cpu = cpu->index;
+  next->switches++;
+  cpu->current = next;
+  if (next->stack) {
+    // Entries from ring 3 (SYSCALL and interrupts) land on its own stack
+    uint64_t top = next->stack + TASK_STACK_PAGES * PMM_PAGE_SIZE;
+    cpu->syscall_rsp = top;
+    cpu->gdt.tss.rsp[0] = top;
+  }
+  // Kernel tasks go back to the kernel's tables too, so a space that is
+  // torn down is never left loaded on a CPU that once ran its program
+  vm_activate(next->vm);
+  cpu->context_switches++;
+  cpu->slice_ns = 0;
+  copy_frame(regs, &next->context);
+}
+
+// The idle loop switches away itself once the interrupt that woke it has
+// returned, after it has accounted for the sleep
+void sched_irq_exit(Registers *regs) {
+  cpu_t *cpu = this_cpu();
+  if (!cpu->need_resched || !cpu->current || cpu->current == cpu->idle)
+    return;
+  cpu->need_resched = false;
+  schedule(cpu, regs);
+}
+
+// Wake one idle CPU other than this one to come and steal
+static void kick_idle_cpu(void) {
+  uint64_t mask = idle_mask & ~(1ULL << this_cpu()->index);
+  if (!mask || !apic_enabled())
+    return;
+  cpu_t *cpu = smp_cpu(__builtin_ctzll(mask));
+  if (cpu && !idle_ring(cpu->index))
+    apic_send_ipi(cpu->apic_id, LAPIC_ICR_FIXED | SCHED_KICK_VECTOR);
+}
+
+// Make task runnable from this CPU, interrupts off
+static void enqueue(task_t *task) {
+  cpu_t *cpu = this_cpu();
+  runq_push(cpu->run_queue, task);
+  if (cpu->current == cpu->idle)
+    cpu->need_resched = true;
+  kick_idle_cpu();
+}
+
+static void tick_handler(Registers *regs) {
+  cpu_t *cpu = this_cpu();
+  cpu->ticks++;
+
+  // The one shot an idle CPU left in place of its tick, time to look
+  // for work that a lost kick left queued
+  if (cpu->idle_deadline) {
+    cpu->need_resched = true;
+    return;
+  }
+  if (regs)
+    perf_sample(regs);
+
+  // A faster tick still hands out whole slices
+  cpu->slice_ns += cpu->tick_ns;
+  if (cpu->slice_ns >= SCHED_SLICE_NS) {
+    cpu->slice_ns = 0;
+    cpu->need_resched = true;
+  }
+
+  // Every CPU picks up a new period on its own next tick
+  uint64_t period = __atomic_load_n(&tick_period, __ATOMIC_RELAXED);
+  if (regs && period != cpu->tick_ns &&
+      apic_timer_start(period, SCHED_TICK_VECTOR))
+    cpu->tick_ns = period;
+}
+
+static void pit_tick_handler(void *arg) {
+  (void)arg;
+  tick_handler(0);
+  timer_arm(&pit_tick, timer_now_ns() + SCHED_SLICE_NS, pit_tick_handler, 0);
+}
+
+static void kick_handler(Registers *regs) {
+  (void)regs;
+  this_cpu()->need_resched = true;
+}
+
+static void yield_handler(Registers *regs) {
+  cpu_t *cpu = this_cpu();
+  cpu->need_resched = false;
+  schedule(cpu, regs);
+}
+
+static void task_entry(task_fn_t fn, void *arg) {
+  fn(arg);
+  task_exit();
+}
+
+task_t *task_create(const char *name, task_fn_t fn, void *arg) {
+  if (!started)
+    return 0;
+  if (__atomic_add_fetch(&task_count, 1, __ATOMIC_RELAXED) > SCHED_MAX_TASKS) {
+    __atomic_sub_fetch(&task_count, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  task_t *task = kmalloc(sizeof(task_t));
+  uint64_t stack = pmm_alloc_pages(TASK_STACK_PAGES);
+  fpu_context_t *fpu = fpu_context_create();
+  if (!task || !stack || !fpu) {
+    kfree(task);
+    if (stack)
+      pmm_free_pages(stack, TASK_STACK_PAGES);
+    fpu_context_destroy(fpu);
+    __atomic_sub_fetch(&task_count, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  memset(task, 0, sizeof(task_t));
+
+  // First switch "returns" into task_entry(fn, arg) with interrupts on,
+  // the stack aligned as if it had been called
+  uint64_t top = stack + TASK_STACK_PAGES * PMM_PAGE_SIZE;
+  task->context.rip = (uint64_t)(uintptr_t)task_entry;
+  task->context.cs = GDT_KERNEL_CODE;
+  task->context.rflags = RFLAGS_IF | RFLAGS_RESERVED;
+  task->context.rsp = top - 8;
+  task->context.ss = GDT_KERNEL_DATA;
+  task->context.rdi = (uint64_t)(uintptr_t)fn;
+  task->context.rsi = (uint64_t)(uintptr_t)arg;
+
+  task->stack = stack;
+  task->fpu = fpu;
+  task->state = TASK_READY;
+  task->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+  copy_name(task, name);
+
+  uint64_t flags = irq_save();
+  enqueue(task);
+  irq_restore(flags);
+  return task;
+}
+
+void task_exit(void) {
+  __asm__ volatile("cli");
+  this_cpu()->current->state = TASK_DEAD;
+  __asm__ volatile("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+  for (;;)
+    __asm__ volatile("hlt");
+}
+
+task_t *task_current(void) { return this_cpu()->current; }
+
+void sched_yield(void) {
+  if (started)
+    __asm__ volatile("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+}
+
+void sched_block(void) {
+  uint64_t flags = irq_save();
+  task_t *task = this_cpu()->current;
+  uint64_t locked = spin_lock_irqsave(&task->lock);
+  if (task->wake_pending) {
+    task->wake_pending = false;
+    spin_unlock_irqrestore(&task->lock, locked);
+    irq_restore(flags);
+    return;
+  }
+  task->state = TASK_BLOCKED;
+  spin_unlock_irqrestore(&task->lock, locked);
+
+  // A waker may queue it from here on, on_cpu keeps others from running
+  // it before this CPU has switched away
+  __asm__ volatile("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+  irq_restore(flags);
+}
+
+void sched_wake(task_t *task) {
+  uint64_t flags = spin_lock_irqsave(&task->lock);
+  if (task->state == TASK_BLOCKED) {
+    task->state = TASK_READY;
+    enqueue(task);
+  } else if (task->state != TASK_DEAD) {
+    // Not asleep yet (maybe preempted on its way), its next block returns
+    task->wake_pending = true;
+  }
+  spin_unlock_irqrestore(&task->lock, flags);
+}
+
+static void wake_task(void *arg) { sched_wake((task_t *)arg); }
+
+void sched_sleep_until(uint64_t deadline_ns) {
+  ktimer_t timer = {0};
+  if (deadline_ns <= timer_now_ns())
+    return;
+  if (!started || pinned(this_cpu()) ||
+      !timer_arm(&timer, deadline_ns, wake_task, this_cpu()->current)) {
+    timer_sleep_until(deadline_ns);
+    return;
+  }
+  while (timer_now_ns() < deadline_ns)
+    sched_block();
+  timer_cancel(&timer);
+}
+
+bool sched_can_block(void) { return started && !pinned(this_cpu()); }
+
+void wait_prepare(wait_queue_t *wq) {
+  task_t *task = this_cpu()->current;
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  task_t **link = &wq->head;
+  while (*link && *link != task)
+    link = &(*link)->wait_next;
+  if (!*link) {
+    task->wait_next = 0;
+    *link = task;
+  }
+  spin_unlock_irqrestore(&wq->lock, flags);
+  // Pairs with the fence in wait_queue_wake_all: either the waker sees
+  // this task on the queue or the caller sees the condition it set
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void wait_finish(wait_queue_t *wq) {
+  task_t *task = this_cpu()->current;
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  for (task_t **link = &wq->head; *link; link = &(*link)->wait_next) {
+    if (*link == task) {
+      *link = task->wait_next;
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_queue_wake_all(wait_queue_t *wq) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&wq->head, __ATOMIC_RELAXED))
+    return;
+  uint64_t flags = spin_lock_irqsave(&wq->lock);
+  for (task_t *task = wq->head; task; task = task->wait_next)
+    sched_wake(task);
+  spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+static void start_tick(void) {
+  this_cpu()->tick_ns = SCHED_SLICE_NS;
+  if (!apic_timer_start(SCHED_SLICE_NS, SCHED_TICK_VECTOR) &&
+      this_cpu()->index == 0)
+    timer_arm(&pit_tick, timer_now_ns() + SCHED_SLICE_NS, pit_tick_handler, 0);
+}
+
+bool sched_set_tick_period(uint64_t period_ns) {
+  if (!apic_enabled())
+    return false;
+  if (!period_ns || period_ns > SCHED_SLICE_NS)
+    period_ns = SCHED_SLICE_NS;
+  __atomic_store_n(&tick_period, period_ns, __ATOMIC_RELAXED);
+  return true;
+}
+
+// The calling flow becomes the CPU's first task
+static void adopt_boot_flow(cpu_t *cpu, const char *name) {
+  task_t *task = &boot_tasks[cpu->index];
+  copy_name(task, name);
+  task->fpu = fpu_current();
+  task->state = TASK_RUNNING;
+  task->on_cpu = true;
+  task->cpu = cpu->index;
+  task->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+  cpu->run_queue = &run_queues[cpu->index];
+  cpu->current = task;
+}
+
+void sched_init(void) {
+  cpu_t *cpu = this_cpu();
+  adopt_boot_flow(cpu, "main");
+
+  idt_set_gate(SCHED_TICK_VECTOR, (uint64_t)irq16, GDT_KERNEL_CODE, 0x8E);
+  idt_set_gate(SCHED_KICK_VECTOR, (uint64_t)irq17, GDT_KERNEL_CODE, 0x8E);
+  idt_set_gate(SCHED_YIELD_VECTOR, (uint64_t)isr50, GDT_KERNEL_CODE, 0x8E);
+  register_interrupt_handler(SCHED_TICK_VECTOR, tick_handler);
+  register_interrupt_handler(SCHED_KICK_VECTOR, kick_handler);
+  register_interrupt_handler(SCHED_YIELD_VECTOR, yield_handler);
+
+  // Everything that can end in a switch runs on the IST stack
+  if (cpu->irq_stack_top)
+    for (int v = IRQ_BASE_VECTOR; v <= SCHED_YIELD_VECTOR; v++)
+      idt_set_ist(v, IST_IRQ);
+
+  start_tick();
+  __atomic_store_n(&started, true, __ATOMIC_RELEASE);
+}
+
+void sched_start_cpu(void) {
+  while (!__atomic_load_n(&started, __ATOMIC_ACQUIRE))
+    __asm__ volatile("pause");
+  cpu_t *cpu = this_cpu();
+  adopt_boot_flow(cpu, "idle");
+  start_tick();
+  sched_idle();
+}
+
+void sched_idle(void) {
+  cpu_t *cpu = this_cpu();
+  __asm__ volatile("cli");
+  copy_name(cpu->current, "idle");
+  cpu->idle = cpu->current;
+  cpu->idle_since = timer_now_ns();
+  __atomic_or_fetch(&idle_mask, 1ULL << cpu->index, __ATOMIC_RELAXED);
+  cpu->need_resched = true;
+  for (;;) {
+    if (cpu->need_resched) {
+      __asm__ volatile("int %0" : : "i"(SCHED_YIELD_VECTOR) : "memory");
+      continue;
+    }
+    if (idle_enter(stop_tick(cpu)))
+      cpu->need_resched = true;
+  }
+}
+
+bool sched_running(void) { return started; }
+
+int sched_task_count(void) { return task_count; }
+
+uint64_t sched_idle_ns(const cpu_t *cpu) {
+  uint64_t ns = cpu->idle_ns;
+  if (cpu->idle && cpu->current == cpu->idle)
+    ns += timer_now_ns() - cpu->idle_since;
+  return ns;
+}
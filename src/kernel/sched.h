@@ -0,0 +1,114 @@
+#pragma once
+#include "fpu.h"
+#include "isr.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "stdint.h"
+
+// Scheduler vectors, just above the 16 ISA IRQs
+#define SCHED_TICK_VECTOR 48  // Local APIC timer
+#define SCHED_KICK_VECTOR 49  // IPI: new work for an idle CPU
+#define SCHED_YIELD_VECTOR 50 // int from sched_yield()
+
+#define SCHED_SLICE_NS 10000000ULL // 10ms time slice
+#define SCHED_IDLE_MAX_NS 1000000000ULL // Longest an idle CPU goes unwoken
+#define SCHED_MAX_TASKS 256
+#define SCHED_RUNQ_SIZE 256 // Power of two, holds every task
+
+#define TASK_STACK_PAGES 4 // 16KB kernel stack
+#define TASK_NAME_LEN 16
+
+typedef enum {
+  TASK_READY,   // On a run queue
+  TASK_RUNNING, // Current task of some CPU
+  TASK_BLOCKED, // Waiting for sched_wake()
+  TASK_DEAD,    // Exited, freed by the next switch on its CPU
+} task_state_t;
+
+typedef void (*task_fn_t)(void *arg);
+
+typedef struct task {
+  // Interrupt frame the task resumes from, saved whenever it is switched
+  // out. Scheduler entries run on the per-CPU interrupt stack, so the
+  // frame is copied in and out rather than left on the task's stack.
+  Registers context;
+  uint64_t stack; // Base of the kernel stack, 0 for a CPU's boot stack
+  fpu_context_t *fpu;
+  spinlock_t lock; // Orders block against wake
+  volatile int state;
+  volatile bool on_cpu; // Still running, or its CPU hasn't finished leaving
+  bool wake_pending;    // Woken before it got to block
+  uint32_t id;
+  uint32_t cpu; // CPU it runs or last ran on
+  uint64_t switches;
+  struct task *wait_next; // Link on the wait queue it is on
+  struct vm_space *vm;      // User address space, 0 for kernel tasks
+  struct process *process;  // The program it runs (exec.c), if any
+  char name[TASK_NAME_LEN];
+} task_t;
+
+// Tasks waiting for some condition, woken together when it may have become
+// true. Wakers can be interrupt handlers.
+typedef struct {
+  spinlock_t lock;
+  task_t *head;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT {SPINLOCK_INIT, 0}
+
+// Set up run queues, the tick and the scheduler vectors, with the boot
+// flow as the first task. Needs smp_init() to have run. The boot flow is
+// never switched away from (and must not block) until sched_idle().
+void sched_init(void);
+
+// Application processor entry once it is online, never returns
+void sched_start_cpu(void) __attribute__((noreturn));
+
+// Turn the calling flow into this CPU's idle task, it only runs when
+// nothing else is ready
+void sched_idle(void) __attribute__((noreturn));
+
+task_t *task_create(const char *name, task_fn_t fn, void *arg);
+void task_exit(void) __attribute__((noreturn));
+task_t *task_current(void);
+
+// Give up the CPU. Task context only, never from an interrupt handler.
+void sched_yield(void);
+// Sleep until sched_wake(), returns at once if a wake-up already came in
+void sched_block(void);
+void sched_wake(task_t *task);
+void sched_sleep_until(uint64_t deadline_ns);
+
+// True when the caller is a task that may block, false for the boot flow
+// before sched_idle() (which has to poll instead)
+bool sched_can_block(void);
+
+// Put the current task on wq, then check the condition and sched_block()
+// if it doesn't hold; wait_finish() takes it off again. A wake between
+// the two is never lost. WAIT_EVENT wraps the loop.
+void wait_prepare(wait_queue_t *wq);
+void wait_finish(wait_queue_t *wq);
+void wait_queue_wake_all(wait_queue_t *wq);
+
+#define WAIT_EVENT(wq, condition)                                              \
+  do {                                                                         \
+    for (;;) {                                                                 \
+      wait_prepare(wq);                                                        \
+      if (condition)                                                           \
+        break;                                                                 \
+      sched_block();                                                           \
+    }                                                                          \
+    wait_finish(wq);                                                           \
+  } while (0)
+
+// Called on the way out of every IRQ, switches tasks if one is due
+void sched_irq_exit(Registers *regs);
+
+// Run the local APIC tick faster than the slice (for sampling), 0 goes back
+// to one tick per slice. Needs the APIC timer; CPUs switch on their next tick.
+bool sched_set_tick_period(uint64_t period_ns);
+
+bool sched_running(void);
+int sched_task_count(void);
+int sched_runq_length(const cpu_t *cpu);
+uint64_t sched_idle_ns(const cpu_t *cpu);
@@ -0,0 +1,202 @@
+#include "serial.h"
+#include "apic.h"
+#include "i8259.h"
+#include "isr.h"
+#include "spinlock.h"
+
+#define REG_DATA 0
+#define REG_IER 1
+#define REG_IIR 2 // Read
+#define REG_FCR 2 // Write
+#define REG_LCR 3
+#define REG_MCR 4
+#define REG_LSR 5
+#define REG_MSR 6
+
+#define LCR_DLAB 0x80
+#define LCR_8N1 0x03
+#define FCR_ENABLE_CLEAR 0xC7 // FIFOs on and cleared, 14 byte trigger
+#define MCR_DTR_RTS_OUT2 0x0B // OUT2 gates the UART's IRQ line
+#define MCR_LOOPBACK 0x1E
+#define LSR_THRE 0x20
+#define IER_THRI 0x02
+
+#define IIR_NO_INT 0x01
+#define IIR_ID_MASK 0x0E
+#define IIR_THRE 0x02
+#define IIR_RDA 0x04
+#define IIR_RLS 0x06
+#define IIR_TIMEOUT 0x0C
+
+// A THRE interrupt means the whole 16 byte FIFO is empty
+#define TX_FIFO 16
+#define TX_MASK (SERIAL_TX_RING - 1)
+
+#define DIVISOR_115200 1
+// Line status polls before a character is dropped, a stuck UART mustn't
+// hang the caller
+#define THRE_SPINS 100000
+
+static inline void outb(uint16_t port, uint8_t val) {
+  __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+  uint8_t ret;
+  __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+  return ret;
+}
+
+static bool present = false;
+static spinlock_t lock = SPINLOCK_INIT;
+
+// Producers add at head, the interrupt takes from tail; both under lock
+static char tx_ring[SERIAL_TX_RING];
+static uint64_t tx_head = 0;
+static uint64_t tx_tail = 0;
+static uint64_t tx_dropped = 0;
+static bool irq_mode = false;
+// THRI is enabled, an interrupt will come when the FIFO empties
+static bool tx_active = false;
+
+bool serial_init(void) {
+  uint16_t base = SERIAL_COM1;
+  outb(base + REG_IER, 0);
+  outb(base + REG_LCR, LCR_DLAB);
+  outb(base + REG_DATA, DIVISOR_115200 & 0xFF);
+  outb(base + REG_IER, DIVISOR_115200 >> 8);
+  outb(base + REG_LCR, LCR_8N1);
+  outb(base + REG_FCR, FCR_ENABLE_CLEAR);
+
+  // A byte sent in loopback mode has to come back
+  outb(base + REG_MCR, MCR_LOOPBACK);
+  outb(base + REG_DATA, 0xAE);
+  present = inb(base + REG_DATA) == 0xAE;
+  outb(base + REG_MCR, MCR_DTR_RTS_OUT2);
+  return present;
+}
+
+bool serial_present(void) { return present; }
+
+static void put_polled(char c) {
+  for (int i = 0; i < THRE_SPINS; i++) {
+    if (inb(SERIAL_COM1 + REG_LSR) & LSR_THRE) {
+      outb(SERIAL_COM1 + REG_DATA, (uint8_t)c);
+      return;
+    }
+    __asm__ volatile("pause");
+  }
+}
+
+// Hand up to a FIFO's worth of the ring to the UART, and stop the
+// interrupt once the ring is empty. Only called when THR is empty.
+static void refill_locked(void) {
+  for (int i = 0; i < TX_FIFO && tx_tail != tx_head; i++)
+    outb(SERIAL_COM1 + REG_DATA, (uint8_t)tx_ring[tx_tail++ & TX_MASK]);
+
+  bool more = tx_tail != tx_head;
+  if (more != tx_active) {
+    outb(SERIAL_COM1 + REG_IER, more ? IER_THRI : 0);
+    tx_active = more;
+  }
+}
+
+// An idle transmitter gets the first FIFO load here and the interrupt takes
+// it from there. One still busy with earlier output interrupts once it's
+// done with it.
+static void start_locked(void) {
+  if (tx_active || tx_tail == tx_head)
+    return;
+  if (inb(SERIAL_COM1 + REG_LSR) & LSR_THRE) {
+    refill_locked();
+  } else {
+    outb(SERIAL_COM1 + REG_IER, IER_THRI);
+    tx_active = true;
+  }
+}
+
+static void serial_handler(Registers *regs) {
+  (void)regs;
+  uint64_t flags = spin_lock_irqsave(&lock);
+  uint8_t iir;
+  while (!((iir = inb(SERIAL_COM1 + REG_IIR)) & IIR_NO_INT)) {
+    switch (iir & IIR_ID_MASK) {
+    case IIR_THRE:
+      refill_locked();
+      break;
+    case IIR_RDA:
+    case IIR_TIMEOUT:
+      inb(SERIAL_COM1 + REG_DATA); // No input side, discard
+      break;
+    case IIR_RLS:
+      inb(SERIAL_COM1 + REG_LSR);
+      break;
+    default:
+      inb(SERIAL_COM1 + REG_MSR);
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+void serial_enable_irq(void) {
+  if (!present)
+    return;
+  register_interrupt_handler(IRQ_BASE_VECTOR + SERIAL_IRQ, serial_handler);
+  // The IOAPIC routes every ISA IRQ unmasked; the 8259 keeps the masks the
+  // BIOS left, which may well include COM1's
+  if (!apic_enabled())
+    i8259_unmask_irq(SERIAL_IRQ);
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  irq_mode = true;
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+static inline void queue_locked(char c) {
+  if (tx_head - tx_tail == SERIAL_TX_RING) {
+    tx_dropped++;
+    return;
+  }
+  tx_ring[tx_head++ & TX_MASK] = c;
+}
+
+void serial_putc(char c) { serial_write(&c, 1); }
+
+// Newlines go out as CR LF for terminals
+void serial_write(const char *s, uint64_t len) {
+  if (!present)
+    return;
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (!irq_mode) {
+    for (uint64_t i = 0; i < len; i++) {
+      if (s[i] == '\n')
+        put_polled('\r');
+      put_polled(s[i]);
+    }
+  } else {
+    for (uint64_t i = 0; i < len; i++) {
+      if (s[i] == '\n')
+        queue_locked('\r');
+      queue_locked(s[i]);
+    }
+    start_locked();
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+// The rest of the system is stopped or broken by now, and whoever held the
+// lock may never let go of it, so it isn't taken
+void serial_flush(void) {
+  if (!present)
+    return;
+  outb(SERIAL_COM1 + REG_IER, 0);
+  tx_active = false;
+  irq_mode = false;
+  while (tx_tail != tx_head)
+    put_polled(tx_ring[tx_tail++ & TX_MASK]);
+}
+
+uint64_t serial_dropped(void) { return tx_dropped; }
+
+uint64_t serial_pending(void) { return tx_head - tx_tail; }
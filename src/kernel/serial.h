@@ -0,0 +1,31 @@
+#pragma once
+#include "stdint.h"
+
+// COM1 at 115200 8N1, output only. Writes are copied into a TX ring that
+// the transmit interrupt drains, so callers never wait on the UART; until
+// serial_enable_irq they go straight out, polled.
+#define SERIAL_COM1 0x3F8
+#define SERIAL_IRQ 4
+
+// Bytes of output the TX ring holds (power of two). Output that doesn't
+// fit is dropped and counted rather than waited for.
+#define SERIAL_TX_RING 65536
+
+// Program the UART; false (and writes are dropped) if none answers
+bool serial_init(void);
+bool serial_present(void);
+
+// Switch to interrupt-driven output, once the IDT and IRQ routing are up
+void serial_enable_irq(void);
+
+void serial_putc(char c);
+void serial_write(const char *s, uint64_t len);
+
+// Push out whatever is queued by polling, for the panic path where no
+// more interrupts will come
+void serial_flush(void);
+
+// Bytes dropped because the TX ring was full
+uint64_t serial_dropped(void);
+// Bytes queued and not yet handed to the UART
+uint64_t serial_pending(void);
@@ -1,16 +1,34 @@
 #include "shell.h"
+#include "apic.h"
+#include "bcache.h"
+#include "bench.h"
+#include "blk.h"
+#include "boottime.h"
+#include "compositor.h"
+#include "console.h"
+#include "cpu.h"
+#include "exec.h"
+#include "fat.h"
+#include "fpu.h"
+#include "graphics.h"
+#include "idle.h"
+#include "irqstat.h"
+#include "keyboard.h"
+#include "kmalloc.h"
+#include "log.h"
+#include "multiboot.h"
 #include "paging.h"
+#include "pci.h"
+#include "perf.h"
+#include "pmm.h"
+#include "sched.h"
+#include "serial.h"
+#include "smp.h"
 #include "stdint.h"
-
-// External functions from main.c
-extern void kputc(char c, uint8_t color);
-extern void kprint(const char *str, uint8_t color);
-extern void knewline(void);
-extern void clear_screen(uint8_t color);
-extern int get_cursor_col(void);
-extern int get_cursor_row(void);
-extern void set_cursor_col(int col);
-extern void set_cursor_row(int row);
+#include "string.h"
+#include "tasklet.h"
+#include "timer.h"
+#include "trace.h"
 
 // Helper for port I/O
 static inline uint8_t inb(uint16_t port) {
@@ -33,33 +51,6 @@ static inline uint8_t inb(uint16_t port) {
 static char input_buffer[INPUT_BUFFER_SIZE];
 static int input_pos = 0;
 
-// String functions
-static int strlen(const char *str) {
-  int len = 0;
-  while (str[len])
-    len++;
-  return len;
-}
-
-static int strcmp(const char *s1, const char *s2) {
-  while (*s1 && (*s1 == *s2)) {
-    s1++;
-    s2++;
-  }
-  return *(unsigned char *)s1 - *(unsigned char *)s2;
-}
-
-static int strncmp(const char *s1, const char *s2, int n) {
-  while (n && *s1 && (*s1 == *s2)) {
-    s1++;
-    s2++;
-    n--;
-  }
-  if (n == 0)
-    return 0;
-  return *(unsigned char *)s1 - *(unsigned char *)s2;
-}
-
 // Display prompt
 static void show_prompt(void) {
   kprint("$ ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -98,6 +89,73 @@ static void cmd_help(void) {
   kprint("  info   - Show system register info",
          VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
   knewline();
+  kprint("  boottime - Show boot phase timings",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  mem    - Show physical memory usage",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  kmem   - Show kernel heap caches",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  modes  - List the video modes the boot loader found",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  mode   - Switch the display mode (mode <w>x<h>[x<bpp>])",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  uptime - Show time since boot and timer state",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  cpus   - Show online CPUs and per-CPU counters",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  sched  - Show run queues, scheduler and idle counters",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  irqstat - Show interrupt counts and times (irqstat <vec>)",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  perf   - Sample CPU time (perf start [hz] | stop | top | dump)",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  bench  - Measure hot paths (bench mem | gfx | irq | tlb)",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  trace  - Event tracer (trace start [irq exception pagefault "
+         "syscall sched blk] | stop | dump)",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  loglevel - Console levels (loglevel [vga|serial <level>])",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  dmesg  - Show the kernel log (dmesg [level])",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  pci    - List PCI devices",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  blk    - Show disks, or dump a sector (blk <dev> <lba>)",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  bcache - Show buffer cache counters",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  sync   - Write back dirty buffers",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  fat    - Show mounted FAT volumes",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  ls     - List a directory (ls [path])",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  cat    - Print a file (cat <path>)",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  exec   - Run an ELF program and wait for it (exec <path> [args])",
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
 }
 
 // Built-in command: clear
@@ -137,14 +195,6 @@ static uint64_t atoi_hex(const char *s) {
   return res;
 }
 
-// Helper to print hex byte
-static void print_hex_byte(uint8_t byte) {
-  char hex[] = "0123456789ABCDEF";
-  kputc(hex[(byte >> 4) & 0xF],
-        VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-  kputc(hex[byte & 0xF], VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-}
-
 // Built-in command: reboot
 static void cmd_reboot(void) {
   knewline();
@@ -193,10 +243,7 @@ static void cmd_shutdown(void) {
          VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
 
   // Disable interrupts and halt
-  __asm__ volatile("cli");
-  for (;;) {
-    __asm__ volatile("hlt");
-  }
+  idle_halt();
 }
 
 // Built-in command: halt
@@ -208,10 +255,7 @@ static void cmd_halt(void) {
          VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
 
   // Disable interrupts and halt
-  __asm__ volatile("cli");
-  for (;;) {
-    __asm__ volatile("hlt");
-  }
+  idle_halt();
 }
 
 // Built-in command: peek
@@ -234,10 +278,9 @@ static void cmd_peek(const char *args) {
   kprint(": ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
 
   // Print 16 bytes
-  for (int i = 0; i < 16; i++) {
-    print_hex_byte(ptr[i]);
-    kputc(' ', VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
-  }
+  for (int i = 0; i < 16; i++)
+    klogf(LOG_INFO, VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK), "%02X ",
+          ptr[i]);
   knewline();
 }
 
@@ -265,14 +308,1085 @@ static void cmd_about(void) {
   knewline();
 }
 
-// Helper to print 32-bit hex value
-static void print_hex32(uint32_t val) {
-  char hex[] = "0123456789ABCDEF";
-  kprint("0x", VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-  for (int i = 28; i >= 0; i -= 4) {
-    kputc(hex[(val >> i) & 0xF],
-          VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+// Helper to print an unsigned decimal value
+static void print_dec64(uint64_t val, uint8_t color) {
+  klogf(LOG_INFO, color, "%llu", val);
+}
+
+// Built-in command: boottime
+// Shows each boot milestone with the time since the previous one and since
+// the start of stage2, in microseconds
+static void cmd_boottime(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+
+  knewline();
+  kprint("Boot timeline (us, delta / total):",
+         VGA_ENTRY_COLOR(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
+  knewline();
+
+  int count = boottime_count();
+  if (count == 0) {
+    kprint("  No boot timestamps recorded", label);
+    knewline();
+    return;
+  }
+
+  uint64_t first = boottime_get(0)->tsc;
+  uint64_t prev = first;
+  for (int i = 0; i < count; i++) {
+    const boottime_entry_t *e = boottime_get(i);
+    kprint("  ", label);
+    kprint(e->name, label);
+    for (int pad = strlen(e->name); pad < BOOT_TIMING_NAME_LEN; pad++)
+      kputc(' ', label);
+    kputc('+', value);
+    print_dec64(timer_tsc_to_ns(e->tsc - prev) / 1000, value);
+    kprint(" / ", label);
+    print_dec64(timer_tsc_to_ns(e->tsc - first) / 1000, value);
+    knewline();
+    prev = e->tsc;
+  }
+}
+
+// Built-in command: uptime
+static void cmd_uptime(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint64_t now = timer_now_ns();
+
+  knewline();
+  kprint("Uptime:          ", label);
+  print_dec64(now / 1000000000, value);
+  kputc('.', value);
+  uint64_t ms = now / 1000000 % 1000;
+  kputc('0' + ms / 100, value);
+  kputc('0' + ms / 10 % 10, value);
+  kputc('0' + ms % 10, value);
+  kprint(" s", label);
+  knewline();
+  kprint("TSC frequency:   ", label);
+  print_dec64(timer_tsc_hz() / 1000000, value);
+  kprint(" MHz", label);
+  knewline();
+  kprint("Timer IRQs:      ", label);
+  print_dec64(timer_irq_count(), value);
+  knewline();
+  kprint("Pending timers:  ", label);
+  print_dec64(timer_pending(), value);
+  knewline();
+}
+
+// Space out to a table column
+static void pad_to(int col, uint8_t color) {
+  while (get_cursor_col() < col)
+    kputc(' ', color);
+}
+
+// Built-in command: cpus
+static void cmd_cpus(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+
+  knewline();
+  kprint("CPU  APIC  IRQs        Switches", label);
+  knewline();
+  for (int i = 0; i < smp_cpu_count(); i++) {
+    cpu_t *cpu = smp_cpu(i);
+    print_dec64(cpu->index, value);
+    pad_to(5, value);
+    print_dec64(cpu->apic_id, value);
+    pad_to(11, value);
+    print_dec64(cpu->irqs, value);
+    pad_to(23, value);
+    print_dec64(cpu->context_switches, value);
+    if (cpu == this_cpu())
+      kprint("  (this cpu)", label);
+    knewline();
+  }
+}
+
+// Built-in command: sched
+static void cmd_sched(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+
+  knewline();
+  if (!sched_running()) {
+    kprint("Scheduler not running", label);
+    knewline();
+    return;
+  }
+  kprint("Tasks: ", label);
+  print_dec64(sched_task_count(), value);
+  kprint("  Tasklets run: ", label);
+  print_dec64(tasklet_run_count(), value);
+  knewline();
+  kprint("CPU  Current          Queue  Switches    Steals  Ticks     Idle",
+         label);
+  knewline();
+  uint64_t now = timer_now_ns();
+  for (int i = 0; i < smp_cpu_count(); i++) {
+    cpu_t *cpu = smp_cpu(i);
+    print_dec64(cpu->index, value);
+    pad_to(5, value);
+    kprint(cpu->current ? cpu->current->name : "-", value);
+    pad_to(22, value);
+    print_dec64(sched_runq_length(cpu), value);
+    pad_to(29, value);
+    print_dec64(cpu->context_switches, value);
+    pad_to(41, value);
+    print_dec64(cpu->steals, value);
+    pad_to(49, value);
+    print_dec64(cpu->ticks, value);
+    pad_to(59, value);
+    print_dec64(now ? sched_idle_ns(cpu) * 100 / now : 0, value);
+    kputc('%', value);
+    knewline();
+  }
+
+  // Time asleep in each C-state, and how long a doorbell took to be
+  // answered
+  kprint("Idle with ", label);
+  kprint(idle_uses_mwait() ? "mwait" : "hlt", value);
+  knewline();
+  kprint("CPU  Wakeups   No IPI    Wake avg  Wake max  Residency", label);
+  knewline();
+  for (int i = 0; i < smp_cpu_count(); i++) {
+    idle_stats_t st;
+    idle_get_stats(i, &st);
+    print_dec64(i, value);
+    pad_to(5, value);
+    print_dec64(st.wakeups, value);
+    pad_to(15, value);
+    print_dec64(st.ipis_saved, value);
+    pad_to(25, value);
+    print_dec64(st.wakeups ? st.wake_ns_total / st.wakeups / 1000 : 0, value);
+    kprint("us", label);
+    pad_to(35, value);
+    print_dec64(st.wake_ns_max / 1000, value);
+    kprint("us", label);
+    pad_to(45, value);
+    for (int s = 0; s < idle_state_count(); s++) {
+      kprint(idle_state_name(s), label);
+      kputc(' ', label);
+      print_dec64(now ? st.residency_ns[s] * 100 / now : 0, value);
+      kprint("% ", value);
+    }
+    knewline();
+  }
+}
+
+// Built-in command: irqstat [vector]
+// Every vector that has fired with its count and handler time, or one
+// vector's per-CPU counts and duration histogram
+static void cmd_irqstat(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  irqstat_summary_t s;
+  char name[12];
+
+  knewline();
+  if (*args) {
+    int vector = 0;
+    for (; *args >= '0' && *args <= '9'; args++)
+      vector = vector * 10 + (*args - '0');
+    irqstat_summary(vector, &s);
+    kprint("Vector ", label);
+    print_dec64(vector, value);
+    kprint(" (", label);
+    kprint(irqstat_vector_name(vector, name, sizeof(name)), value);
+    kprint("), ", label);
+    print_dec64(s.count, value);
+    kprint(" calls", label);
+    knewline();
+    for (int i = 0; i < smp_cpu_count(); i++) {
+      kprint("  cpu ", label);
+      print_dec64(i, value);
+      pad_to(10, value);
+      print_dec64(irqstat_cpu_count(smp_cpu(i), vector), value);
+      knewline();
+    }
+    kprint("  Under (ns)   Calls", label);
+    knewline();
+    for (int b = 0; b < IRQSTAT_BUCKETS; b++) {
+      if (!s.histogram[b])
+        continue;
+      kprint("  ", label);
+      if (b == IRQSTAT_BUCKETS - 1)
+        kprint("longer", value);
+      else
+        print_dec64(timer_tsc_to_ns(1ULL << (IRQSTAT_MIN_SHIFT + b)), value);
+      pad_to(15, value);
+      print_dec64(s.histogram[b], value);
+      knewline();
+    }
+    return;
+  }
+
+  kprint("Vec  Name      Calls       Avg ns  p50 ns  p99 ns  Max ns", label);
+  knewline();
+  for (int v = 0; v < IRQSTAT_VECTORS; v++) {
+    irqstat_summary(v, &s);
+    if (!s.count)
+      continue;
+    print_dec64(v, value);
+    pad_to(5, value);
+    kprint(irqstat_vector_name(v, name, sizeof(name)), value);
+    pad_to(15, value);
+    print_dec64(s.count, value);
+    pad_to(27, value);
+    print_dec64(timer_tsc_to_ns(s.cycles / s.count), value);
+    pad_to(35, value);
+    print_dec64(timer_tsc_to_ns(irqstat_percentile(&s, 50)), value);
+    pad_to(43, value);
+    print_dec64(timer_tsc_to_ns(irqstat_percentile(&s, 99)), value);
+    pad_to(51, value);
+    print_dec64(timer_tsc_to_ns(s.max_cycles), value);
+    knewline();
+  }
+}
+
+#define PERF_TOP_SLOTS 1024 // Distinct RIPs perf top can count
+#define PERF_TOP_ROWS 15
+
+static struct {
+  uint64_t rip;
+  uint32_t count;
+  bool user;
+} perf_top[PERF_TOP_SLOTS];
+
+static void print_hex64(uint64_t val, uint8_t color) {
+  klogf(LOG_INFO, color, "%016llx", val);
+}
+
+// Count samples per exact RIP, returns the samples that found no slot
+static uint64_t perf_count_rips(uint64_t *total) {
+  uint64_t dropped = 0;
+  perf_sample_t sample;
+  for (int i = 0; i < PERF_TOP_SLOTS; i++)
+    perf_top[i].count = 0;
+  *total = 0;
+  for (int cpu = 0; cpu < smp_cpu_count(); cpu++) {
+    for (int i = 0; perf_read(cpu, i, &sample); i++) {
+      (*total)++;
+      uint32_t slot =
+          (uint32_t)((sample.rip * 0x9E3779B97F4A7C15ULL) >> 32) % PERF_TOP_SLOTS;
+      int probes = 0;
+      while (perf_top[slot].count && perf_top[slot].rip != sample.rip &&
+             probes++ < PERF_TOP_SLOTS)
+        slot = (slot + 1) % PERF_TOP_SLOTS;
+      if (probes >= PERF_TOP_SLOTS) {
+        dropped++;
+        continue;
+      }
+      perf_top[slot].rip = sample.rip;
+      perf_top[slot].user = sample.flags & PERF_SAMPLE_USER;
+      perf_top[slot].count++;
+    }
   }
+  return dropped;
+}
+
+// Built-in command: perf start [hz] | stop | top | dump
+// Samples the interrupted RIP and kernel call chain on every CPU. top ranks
+// raw addresses; dump sends the samples out the 0xE9 debug console for
+// tools/ksym to symbolize against build/kernel.elf.
+static void cmd_perf(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  if (strncmp(args, "start", 5) == 0) {
+    uint32_t hz = 0;
+    for (args += 5; *args == ' '; args++)
+      ;
+    for (; *args >= '0' && *args <= '9'; args++)
+      hz = hz * 10 + (*args - '0');
+    if (!perf_start(hz)) {
+      kprint("perf: needs the local APIC timer", error);
+      knewline();
+      return;
+    }
+    kprint("Sampling at ", label);
+    print_dec64(perf_hz(), value);
+    kprint(" Hz on every CPU", label);
+    knewline();
+  } else if (strcmp(args, "stop") == 0) {
+    perf_stop();
+    uint64_t total = 0;
+    for (int cpu = 0; cpu < smp_cpu_count(); cpu++)
+      total += perf_sample_count(cpu);
+    kprint("Stopped, ", label);
+    print_dec64(total, value);
+    kprint(" samples", label);
+    knewline();
+  } else if (strcmp(args, "top") == 0) {
+    uint64_t total;
+    uint64_t dropped = perf_count_rips(&total);
+    if (!total) {
+      kprint("No samples (perf start)", label);
+      knewline();
+      return;
+    }
+    kprint("Samples  %    Where  RIP", label);
+    knewline();
+    for (int row = 0; row < PERF_TOP_ROWS; row++) {
+      int best = -1;
+      for (int i = 0; i < PERF_TOP_SLOTS; i++)
+        if (perf_top[i].count &&
+            (best < 0 || perf_top[i].count > perf_top[best].count))
+          best = i;
+      if (best < 0)
+        break;
+      print_dec64(perf_top[best].count, value);
+      pad_to(9, value);
+      print_dec64(perf_top[best].count * 100 / total, value);
+      pad_to(14, value);
+      kprint(perf_top[best].user ? "user" : "kernel", value);
+      pad_to(21, value);
+      print_hex64(perf_top[best].rip, value);
+      knewline();
+      perf_top[best].count = 0;
+    }
+    if (dropped) {
+      print_dec64(dropped, value);
+      kprint(" samples not counted (too many distinct RIPs)", label);
+      knewline();
+    }
+  } else if (strcmp(args, "dump") == 0) {
+    print_dec64(perf_dump(), value);
+    kprint(" samples written to port 0xE9 (tools/ksym)", label);
+    knewline();
+  } else {
+    kprint("perf: ", label);
+    kprint(perf_running() ? "running" : "stopped", value);
+    kprint(", usage: perf start [hz] | stop | top | dump", label);
+    knewline();
+  }
+}
+
+// Hundredths as "n.nn"
+static void print_hundredths(uint64_t val, uint8_t color) {
+  klogf(LOG_INFO, color, "%llu.%02llu", val / 100, val % 100);
+}
+
+// Built-in command: bench
+// Microbenchmarks run in kernel context with interrupts off while timed,
+// see bench.h
+static void cmd_bench(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  if (strcmp(args, "mem") == 0) {
+    bench_mem_t r[BENCH_MEM_LEVELS];
+    int count = bench_mem(r);
+    kprint("memcpy/memset: ", label);
+    kprint(string_impl_name(), value);
+    knewline();
+    kprint("Level  Size KB   memcpy MB/s  memset MB/s", label);
+    knewline();
+    for (int i = 0; i < count; i++) {
+      kprint(r[i].level, value);
+      pad_to(7, value);
+      print_dec64(r[i].size / 1024, value);
+      pad_to(17, value);
+      print_dec64(r[i].copy_bps / 1000000, value);
+      pad_to(30, value);
+      print_dec64(r[i].set_bps / 1000000, value);
+      knewline();
+    }
+    if (count < BENCH_MEM_LEVELS) {
+      kprint("bench: out of memory for the larger buffers", error);
+      knewline();
+    }
+  } else if (strcmp(args, "gfx") == 0) {
+    bench_gfx_t r[BENCH_GFX_TESTS];
+    comp_suspend();
+    int count = bench_gfx(r);
+    comp_resume();
+    if (!count) {
+      kprint("bench: no framebuffer", error);
+      knewline();
+      return;
+    }
+    kprint("Test                  Pixels    Mpixels/s", label);
+    knewline();
+    for (int i = 0; i < count; i++) {
+      kprint(r[i].name, value);
+      pad_to(22, value);
+      print_dec64(r[i].pixels, value);
+      pad_to(32, value);
+      print_dec64(r[i].pixels_per_s / 1000000, value);
+      knewline();
+    }
+  } else if (strcmp(args, "irq") == 0) {
+    bench_irq_t r;
+    if (!bench_irq(&r)) {
+      kprint("bench: needs the local APIC for a self-IPI", error);
+      knewline();
+      return;
+    }
+    klogf(LOG_INFO, label, "Self-IPI, %u samples (ns)   Min     p50     p99",
+          BENCH_IRQ_SAMPLES);
+    knewline();
+    kprint("  To handler", label);
+    klogf(LOG_INFO, value, "%18llu %7llu %7llu", r.entry_min, r.entry_p50,
+          r.entry_p99);
+    knewline();
+    kprint("  Round trip", label);
+    klogf(LOG_INFO, value, "%18llu %7llu %7llu", r.round_min, r.round_p50,
+          r.round_p99);
+    knewline();
+  } else if (strcmp(args, "tlb") == 0) {
+    bench_tlb_t r;
+    if (!bench_tlb(&r)) {
+      kprint("bench: out of memory", error);
+      knewline();
+      return;
+    }
+    kprint("Pointer chase, one line on each of ", label);
+    print_dec64(r.pages, value);
+    kprint(" pages (cycles per access)", label);
+    knewline();
+    kprint("  4K pages: ", label);
+    print_hundredths(r.small_cycles_x100, value);
+    kprint("  Large pages: ", label);
+    print_hundredths(r.large_cycles_x100, value);
+    kprint("  Page walk: ", label);
+    print_hundredths(r.small_cycles_x100 > r.large_cycles_x100
+                         ? r.small_cycles_x100 - r.large_cycles_x100
+                         : 0,
+                     value);
+    knewline();
+  } else {
+    kprint("Usage: bench mem | gfx | irq | tlb", label);
+    knewline();
+  }
+}
+
+// Built-in command: trace
+static void cmd_trace(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  if (strncmp(args, "start", 5) == 0 && (!args[5] || args[5] == ' ')) {
+    // Space separated groups, all of them when none are named
+    uint32_t mask = 0;
+    char name[16];
+    for (args += 5; *args;) {
+      while (*args == ' ')
+        args++;
+      int n = 0;
+      for (; *args && *args != ' '; args++)
+        if (n < (int)sizeof(name) - 1)
+          name[n++] = *args;
+      name[n] = '\0';
+      if (!n)
+        break;
+      uint32_t group = trace_group(name);
+      if (!group) {
+        kprint("trace: unknown events ", error);
+        kprint(name, value);
+        knewline();
+        return;
+      }
+      mask |= group;
+    }
+    if (!trace_start(mask ? mask : TRACE_ALL)) {
+      kprint("trace: out of memory for the rings", error);
+      knewline();
+      return;
+    }
+    kprint("Tracing on every CPU", label);
+    knewline();
+  } else if (strcmp(args, "stop") == 0 || strcmp(args, "dump") == 0) {
+    bool dump = args[0] == 'd';
+    trace_stop();
+    uint64_t total = 0, kept = 0;
+    for (int cpu = 0; cpu < smp_cpu_count(); cpu++) {
+      uint64_t count = trace_count(cpu);
+      total += count;
+      kept += count < TRACE_RING_SIZE ? count : TRACE_RING_SIZE;
+    }
+    kprint("Stopped, ", label);
+    print_dec64(total, value);
+    kprint(" events, ", label);
+    print_dec64(kept, value);
+    kprint(" still buffered", label);
+    knewline();
+    if (dump) {
+      kprint("Wrote ", label);
+      print_dec64(trace_dump(), value);
+      kprint(" lines to COM1", label);
+      knewline();
+    }
+  } else {
+    kprint("Usage: trace start [irq exception pagefault syscall sched blk] | "
+           "stop | dump",
+           label);
+    knewline();
+  }
+}
+
+static const char *const level_names[] = {"error", "warn", "info", "debug"};
+
+// Built-in command: loglevel [vga|serial <level>]
+// The level each console backend shows, and how COM1's TX ring is doing
+static void cmd_loglevel(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  if (*args) {
+    int backend = -1;
+    if (strncmp(args, "vga ", 4) == 0) {
+      backend = CONSOLE_VGA;
+      args += 4;
+    } else if (strncmp(args, "serial ", 7) == 0) {
+      backend = CONSOLE_SERIAL;
+      args += 7;
+    }
+    int level = -1;
+    for (int i = 0; i <= LOG_DEBUG; i++)
+      if (strcmp(args, level_names[i]) == 0)
+        level = i;
+    if (backend < 0 || level < 0) {
+      kprint("usage: loglevel [vga|serial error|warn|info|debug]", error);
+      knewline();
+      return;
+    }
+    console_set_level(backend, level);
+  }
+
+  kprint("vga:    ", label);
+  kprint(level_names[console_get_level(CONSOLE_VGA)], value);
+  knewline();
+  kprint("serial: ", label);
+  kprint(level_names[console_get_level(CONSOLE_SERIAL)], value);
+  if (!serial_present()) {
+    kprint(" (no UART)", label);
+  } else {
+    kprint(", ", label);
+    print_dec64(serial_pending(), value);
+    kprint(" bytes queued, ", label);
+    print_dec64(serial_dropped(), value);
+    kprint(" dropped", label);
+  }
+  knewline();
+  klogf(LOG_INFO, label, "log:    %llu records, %llu lost before shown",
+        log_head(), log_lost());
+  knewline();
+}
+
+// Built-in command: dmesg [level]
+// The kernel log still in the ring, oldest first, up to the given level,
+// each line stamped with the time it was started. It goes to the screen
+// only and doesn't log itself again.
+static void cmd_dmesg(const char *args) {
+  int max = *args ? -1 : LOG_DEBUG;
+  for (int i = 0; i <= LOG_DEBUG; i++)
+    if (strcmp(args, level_names[i]) == 0)
+      max = i;
+  knewline();
+  if (max < 0) {
+    kprint("usage: dmesg [error|warn|info|debug]",
+           VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+    knewline();
+    return;
+  }
+
+  uint64_t end = log_head();
+  bool line_start = true;
+  log_record_t r, stamp;
+  stamp.color = VGA_ENTRY_COLOR(VGA_COLOR_DARK_GRAY, VGA_COLOR_BLACK);
+  for (uint64_t pos = log_oldest(); pos < end; pos++) {
+    if (!log_read(pos, &r) || r.level > max)
+      continue;
+    uint64_t flags = log_drain_begin();
+    if (line_start) {
+      stamp.len = (uint8_t)ksnprintf(stamp.text, LOG_TEXT, "[%5llu.%06llu] ",
+                                     r.ns / 1000000000, r.ns / 1000 % 1000000);
+      console_emit_screen(&stamp);
+    }
+    console_emit_screen(&r);
+    log_drain_end(flags);
+    line_start = r.len && r.text[r.len - 1] == '\n';
+  }
+  if (!line_start)
+    knewline();
+}
+
+static uint8_t blk_sector[BLK_SECTOR_SIZE]; // Buffer for blk <dev> <lba>
+
+// Built-in command: blk [<dev> <lba>]
+// Disks with their request counters, or the first bytes of one sector
+static void cmd_blk(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  if (*args) {
+    char name[BLK_NAME_LEN];
+    int n = 0;
+    for (; *args && *args != ' ' && n < BLK_NAME_LEN - 1; args++)
+      name[n++] = *args;
+    name[n] = '\0';
+    while (*args == ' ')
+      args++;
+    uint64_t lba = 0;
+    for (; *args >= '0' && *args <= '9'; args++)
+      lba = lba * 10 + (*args - '0');
+
+    blk_device_t *dev = blk_find(name);
+    int status = dev ? blk_read(dev, lba, 1, blk_sector) : BLK_EINVAL;
+    if (status != BLK_OK) {
+      kprint("blk: read failed", error);
+      knewline();
+      return;
+    }
+    for (int row = 0; row < 8; row++) {
+      for (int i = 0; i < 16; i++)
+        klogf(LOG_INFO, value, "%02X ", blk_sector[row * 16 + i]);
+      knewline();
+    }
+    return;
+  }
+
+  kprint("Name   Size MB   Requests  Merged  Commands  Read KB   Written KB",
+         label);
+  knewline();
+  for (int i = 0; i < blk_device_count(); i++) {
+    blk_device_t *dev = blk_device(i);
+    kprint(dev->name, value);
+    pad_to(7, value);
+    print_dec64(dev->sectors * BLK_SECTOR_SIZE / (1024 * 1024), value);
+    pad_to(17, value);
+    print_dec64(dev->requests, value);
+    pad_to(27, value);
+    print_dec64(dev->merges, value);
+    pad_to(35, value);
+    print_dec64(dev->commands, value);
+    pad_to(45, value);
+    print_dec64(dev->sectors_read / 2, value);
+    pad_to(55, value);
+    print_dec64(dev->sectors_written / 2, value);
+    if (dev->errors) {
+      kprint("  errors ", error);
+      print_dec64(dev->errors, error);
+    }
+    knewline();
+  }
+  if (!blk_device_count()) {
+    kprint("No disks", label);
+    knewline();
+  }
+}
+
+static void print_stat(const char *name, uint64_t n) {
+  kprint(name, VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  pad_to(18, VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  print_dec64(n, VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  knewline();
+}
+
+// Built-in command: bcache
+static void cmd_bcache(void) {
+  bcache_stats_t st;
+  bcache_get_stats(&st);
+
+  knewline();
+  print_stat("Buffers", st.buffers);
+  print_stat("Dirty", st.dirty);
+  print_stat("Lookups", st.lookups);
+  print_stat("Hits", st.hits);
+  print_stat("Hit rate %", st.lookups ? st.hits * 100 / st.lookups : 0);
+  print_stat("Evictions", st.evictions);
+  print_stat("Read ahead", st.readahead);
+  print_stat("Read-ahead hits", st.readahead_hits);
+  print_stat("Write-backs", st.writebacks);
+  print_stat("Errors", st.errors);
+}
+
+static const char *fat_error(int status) {
+  switch (status) {
+  case FAT_ENOENT:
+    return "not found";
+  case FAT_ENOTDIR:
+    return "not a directory";
+  case FAT_EISDIR:
+    return "is a directory";
+  case FAT_ENOMEM:
+    return "out of memory";
+  default:
+    return "I/O error";
+  }
+}
+
+// Built-in command: fat
+static void cmd_fat(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+
+  knewline();
+  kprint("Disk   Type   Label        Start LBA  Clusters  Cluster KB", label);
+  knewline();
+  for (int i = 0; i < fat_volume_count(); i++) {
+    const fat_volume_t *vol = fat_volume(i);
+    kprint(vol->dev->name, value);
+    pad_to(7, value);
+    kprint("FAT", value);
+    print_dec64(vol->type, value);
+    pad_to(14, value);
+    kprint(vol->label, value);
+    pad_to(27, value);
+    print_dec64(vol->part_lba, value);
+    pad_to(38, value);
+    print_dec64(vol->clusters, value);
+    pad_to(48, value);
+    print_dec64(vol->sectors_per_cluster / 2, value);
+    knewline();
+  }
+  if (!fat_volume_count()) {
+    kprint("No FAT volumes", label);
+    knewline();
+    return;
+  }
+
+  fat_stats_t st;
+  fat_get_stats(&st);
+  print_stat("Open files", st.open_files);
+  print_stat("Extents", st.extents);
+  print_stat("Lookups", st.lookups);
+  print_stat("Lookup hits", st.hits);
+}
+
+// Built-in command: ls [path]
+static void cmd_ls(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  int fd = fat_open(*args ? args : "/");
+  if (fd < 0) {
+    kprint("ls: ", error);
+    kprint(fat_error(fd), error);
+    knewline();
+    return;
+  }
+
+  static fat_dirent_t ent;
+  int status;
+  while ((status = fat_readdir(fd, &ent)) == 1) {
+    if (ent.attr & FAT_ATTR_DIRECTORY) {
+      kprint("<dir>", label);
+    } else {
+      print_dec64(ent.size, value);
+    }
+    pad_to(12, value);
+    kprint(ent.name, (ent.attr & FAT_ATTR_DIRECTORY)
+                         ? VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK)
+                         : value);
+    knewline();
+  }
+  if (status < 0) {
+    kprint("ls: ", error);
+    kprint(fat_error(status), error);
+    knewline();
+  }
+  fat_close(fd);
+}
+
+// Built-in command: cat <path>
+static void cmd_cat(const char *args) {
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  int fd = fat_open(args);
+  int64_t got = fd;
+  if (fd >= 0) {
+    static char chunk[512];
+    while ((got = fat_read(fd, chunk, sizeof(chunk))) > 0) {
+      for (int64_t i = 0; i < got; i++) {
+        if (chunk[i] == '\n')
+          knewline();
+        else if (chunk[i] != '\r')
+          kputc(chunk[i], value);
+      }
+    }
+    fat_close(fd);
+  }
+  if (got < 0) {
+    kprint("cat: ", error);
+    kprint(fat_error((int)got), error);
+  }
+  knewline();
+}
+
+// Built-in command: exec <path> [args...]
+static void cmd_exec(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  knewline();
+  if (!*args) {
+    kprint("usage: exec <path> [args...]", label);
+    knewline();
+    return;
+  }
+
+  // Split at spaces, argv[0] is the path
+  char line[INPUT_BUFFER_SIZE];
+  char *argv[EXEC_MAX_ARGS + 1];
+  int argc = 0;
+  int len = 0;
+  for (; args[len] && len < INPUT_BUFFER_SIZE - 1; len++)
+    line[len] = args[len];
+  line[len] = '\0';
+  for (char *p = line; *p && argc < EXEC_MAX_ARGS;) {
+    while (*p == ' ')
+      *p++ = '\0';
+    if (!*p)
+      break;
+    argv[argc++] = p;
+    while (*p && *p != ' ')
+      p++;
+  }
+  argv[argc] = 0;
+
+  process_t *proc;
+  int status = exec_spawn(argv[0], argv, &proc);
+  if (status != EXEC_OK) {
+    kprint("exec: ", error);
+    kprint(status == EXEC_ENOENT    ? "not found"
+           : status == EXEC_ENOEXEC ? "not an x86-64 ELF executable"
+           : status == EXEC_E2BIG   ? "argument list too long"
+                                    : "out of memory",
+           error);
+    knewline();
+    return;
+  }
+  exec_usage_t usage;
+  int code = exec_wait(proc, &usage);
+  // Take the screen back if the program drew on it
+  comp_resume();
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  knewline();
+  kprint("exited with ", label);
+  if (code < 0) {
+    kputc('-', value);
+    code = -code;
+  }
+  print_dec64((uint64_t)code, value);
+  kprint(", page faults ", label);
+  print_dec64(usage.minor_faults, value);
+  kprint(" minor ", label);
+  print_dec64(usage.major_faults, value);
+  kprint(" major, ", label);
+  print_dec64(usage.resident * PMM_PAGE_SIZE / 1024, value);
+  kprint(" KB resident", label);
+  knewline();
+}
+
+// Built-in command: sync
+static void cmd_sync(void) {
+  bcache_stats_t st;
+  bcache_get_stats(&st);
+  uint32_t dirty = st.dirty;
+  bcache_sync(0);
+
+  knewline();
+  print_dec64(dirty, VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  kprint(" buffers written back",
+         VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  knewline();
+}
+
+// Built-in command: pci
+static void cmd_pci(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+
+  knewline();
+  kprint("Bus Dev Fn  Vendor:Device  Class  IRQ", label);
+  knewline();
+  for (int i = 0; i < pci_device_count(); i++) {
+    const pci_device_t *dev = pci_device(i);
+    print_dec64(dev->bus, value);
+    pad_to(4, value);
+    print_dec64(dev->slot, value);
+    pad_to(8, value);
+    print_dec64(dev->func, value);
+    pad_to(12, value);
+    klogf(LOG_INFO, value, "%04X", dev->vendor_id);
+    kputc(':', label);
+    klogf(LOG_INFO, value, "%04X", dev->device_id);
+    pad_to(27, value);
+    klogf(LOG_INFO, value, "%02X%02X%02X", dev->class_code, dev->subclass,
+          dev->prog_if);
+    pad_to(34, value);
+    if (dev->irq_line < 16)
+      print_dec64(dev->irq_line, value);
+    else
+      kputc('-', value);
+    knewline();
+  }
+}
+
+// Built-in command: mem
+// Shows the frame allocator's page counts, the direct map's page sizes and
+// free blocks per buddy order
+static void cmd_mem(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  uint64_t total = pmm_get_total_pages();
+  uint64_t free = pmm_get_free_pages();
+
+  knewline();
+  kprint("Physical memory:", VGA_ENTRY_COLOR(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
+  knewline();
+  kprint("  Total: ", label);
+  print_dec64(total * PMM_PAGE_SIZE / 1024, value);
+  kprint(" KB  Used: ", label);
+  print_dec64((total - free) * PMM_PAGE_SIZE / 1024, value);
+  kprint(" KB  Free: ", label);
+  print_dec64(free * PMM_PAGE_SIZE / 1024, value);
+  kprint(" KB", label);
+  knewline();
+  kprint("  Above 4GB: ", label);
+  print_dec64(pmm_get_high_pages() * PMM_PAGE_SIZE / 1024, value);
+  kprint(" KB  Direct map: ", label);
+  print_dec64(paging_direct_1g_bytes() >> 30, value);
+  kprint(" x 1GB + ", label);
+  print_dec64(paging_direct_2m_bytes() >> 21, value);
+  kprint(" x 2MB + ", label);
+  print_dec64(paging_direct_4k_bytes() >> 10, value);
+  kprint(" KB", label);
+  knewline();
+  kprint("  Free blocks by order:", label);
+  for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+    kputc(' ', label);
+    print_dec64(pmm_get_free_blocks(order), value);
+  }
+  knewline();
+}
+
+// Built-in command: modes
+// The boot loader's usable VESA modes in its rank order, the active one
+// marked
+static void cmd_modes(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  int count = multiboot_get_video_mode_count();
+
+  knewline();
+  kprint("Display: ", label);
+  kprint(graphics_display_name(), value);
+  if (graphics_is_available()) {
+    FramebufferInfo *fb = graphics_get_info();
+    klogf(LOG_INFO, value, " %ux%ux%u", fb->width, fb->height, fb->bpp);
+  }
+  knewline();
+  kprint("Video modes (mode width x height x bpp pitch):",
+         VGA_ENTRY_COLOR(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
+  knewline();
+  if (!count) {
+    kprint("  None reported by the boot loader", label);
+    knewline();
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    const multiboot_video_mode_t *m = multiboot_get_video_mode(i);
+    bool active = m->width == multiboot_get_framebuffer_width() &&
+                  m->height == multiboot_get_framebuffer_height() &&
+                  m->bpp == multiboot_get_framebuffer_bpp();
+    klogf(LOG_INFO, active ? value : label, "  %c 0x%03x %4ux%-4u x %2u %5u",
+          active ? '*' : ' ', m->mode, m->width, m->height, m->bpp, m->pitch);
+    knewline();
+  }
+}
+
+// Built-in command: mode
+// Switch resolution through the display driver and have the desktop
+// composed again at the new size
+static void cmd_mode(const char *args) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t error = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+  uint32_t value[3] = {0, 0, 32};
+  int n = 0;
+
+  knewline();
+  for (; n < 3 && *args >= '0' && *args <= '9'; n++) {
+    value[n] = 0;
+    for (; *args >= '0' && *args <= '9'; args++)
+      value[n] = value[n] * 10 + (*args - '0');
+    if (*args == 'x')
+      args++;
+  }
+  if (n < 2) {
+    kprint("Usage: mode <width>x<height>[x<bpp>]", label);
+    knewline();
+    return;
+  }
+  if (!graphics_set_mode(value[0], value[1], value[2])) {
+    kprint("mode: not supported by the ", error);
+    kprint(graphics_display_name(), error);
+    kprint(" display", error);
+    knewline();
+    return;
+  }
+  comp_redraw();
+  FramebufferInfo *fb = graphics_get_info();
+  klogf(LOG_INFO, label, "%ux%ux%u on %s", fb->width, fb->height, fb->bpp,
+        graphics_display_name());
+  knewline();
+}
+
+// Built-in command: kmem
+// One line per heap cache: object size, live objects, slabs, alloc and free
+// counts. Live objects against slabs * objects per slab shows fragmentation.
+static void cmd_kmem(void) {
+  uint8_t label = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK);
+  uint8_t value = VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
+  kmem_stats_t stats;
+
+  knewline();
+  kprint("Kernel heap (size active/capacity slabs allocs frees):",
+         VGA_ENTRY_COLOR(VGA_COLOR_YELLOW, VGA_COLOR_BLACK));
+  knewline();
+  for (int i = 0; kmem_get_stats(i, &stats); i++) {
+    kprint("  ", label);
+    kprint(stats.name, label);
+    for (int pad = strlen(stats.name); pad < KMEM_NAME_LEN; pad++)
+      kputc(' ', label);
+    print_dec64(stats.object_size, value);
+    kputc(' ', label);
+    print_dec64(stats.active, value);
+    kputc('/', label);
+    print_dec64(stats.slabs * stats.objects_per_slab, value);
+    kputc(' ', label);
+    print_dec64(stats.slabs, value);
+    kputc(' ', label);
+    print_dec64(stats.allocs, value);
+    kputc(' ', label);
+    print_dec64(stats.frees, value);
+    knewline();
+  }
+  kprint("  Large: ", label);
+  print_dec64(kmalloc_large_allocs(), value);
+  kprint(" allocs, ", label);
+  print_dec64(kmalloc_large_active_pages(), value);
+  kprint(" pages in use", label);
+  knewline();
 }
 
 // Built-in command: info
@@ -283,7 +1397,8 @@ static void cmd_info(void) {
   knewline();
 
   kprint("  CR0: ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
-  print_hex32(get_cr0());
+  klogf(LOG_INFO, VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK), "0x%08X",
+        (uint32_t)get_cr0());
   kprint("  (PG=", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
   kprint((get_cr0() & 0x80000000) ? "1" : "0",
          VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
@@ -291,16 +1406,53 @@ static void cmd_info(void) {
   knewline();
 
   kprint("  CR3: ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
-  print_hex32(get_cr3());
+  klogf(LOG_INFO, VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK), "0x%08X",
+        (uint32_t)get_cr3());
   knewline();
 
   kprint("  CR4: ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
-  print_hex32(get_cr4());
+  klogf(LOG_INFO, VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK), "0x%08X",
+        (uint32_t)get_cr4());
   kprint("  (PAE=", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
   kprint((get_cr4() & 0x20) ? "1" : "0",
          VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
   kprint(")", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
   knewline();
+
+  kprint("  CPU:", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  for (uint32_t bit = 1; bit <= CPU_FEATURE_LAST; bit <<= 1) {
+    if (cpu_has(bit)) {
+      kputc(' ', VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+      kprint(cpu_feature_name(bit),
+             VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    }
+  }
+  knewline();
+
+  kprint("  FPU: ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  kprint(fpu_avx_enabled() ? "xsave (avx)"
+                           : (fpu_sse_enabled() ? "fxsave (sse)" : "off"),
+         VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  kprint(", ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  print_dec64(fpu_trap_count(), VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  kprint(" lazy restores", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  knewline();
+
+  kprint("  IRQ: ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  if (apic_enabled()) {
+    kprint(apic_is_x2apic() ? "x2apic" : "apic",
+           VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    kprint(", ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+    print_dec64(apic_cpu_count(),
+                VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    kprint(" cpus, ", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+    print_dec64(apic_ioapic_count(),
+                VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    kprint(" ioapics", VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_GRAY, VGA_COLOR_BLACK));
+  } else {
+    kprint("8259 pic", VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+  }
+  knewline();
 }
 
 // Execute command
@@ -356,6 +1508,50 @@ static void execute_command(void) {
     cmd_about();
   } else if (strcmp(cmd, "info") == 0) { // Added info command dispatch
     cmd_info();
+  } else if (strcmp(cmd, "kmem") == 0) {
+    cmd_kmem();
+  } else if (strcmp(cmd, "mem") == 0) {
+    cmd_mem();
+  } else if (strcmp(cmd, "modes") == 0) {
+    cmd_modes();
+  } else if (strcmp(cmd, "mode") == 0) {
+    cmd_mode(args);
+  } else if (strcmp(cmd, "boottime") == 0) {
+    cmd_boottime();
+  } else if (strcmp(cmd, "uptime") == 0) {
+    cmd_uptime();
+  } else if (strcmp(cmd, "cpus") == 0) {
+    cmd_cpus();
+  } else if (strcmp(cmd, "sched") == 0) {
+    cmd_sched();
+  } else if (strcmp(cmd, "irqstat") == 0) {
+    cmd_irqstat(args);
+  } else if (strcmp(cmd, "perf") == 0) {
+    cmd_perf(args);
+  } else if (strcmp(cmd, "bench") == 0) {
+    cmd_bench(args);
+  } else if (strcmp(cmd, "trace") == 0) {
+    cmd_trace(args);
+  } else if (strcmp(cmd, "loglevel") == 0) {
+    cmd_loglevel(args);
+  } else if (strcmp(cmd, "dmesg") == 0) {
+    cmd_dmesg(args);
+  } else if (strcmp(cmd, "pci") == 0) {
+    cmd_pci();
+  } else if (strcmp(cmd, "blk") == 0) {
+    cmd_blk(args);
+  } else if (strcmp(cmd, "bcache") == 0) {
+    cmd_bcache();
+  } else if (strcmp(cmd, "sync") == 0) {
+    cmd_sync();
+  } else if (strcmp(cmd, "fat") == 0) {
+    cmd_fat();
+  } else if (strcmp(cmd, "ls") == 0) {
+    cmd_ls(args);
+  } else if (strcmp(cmd, "cat") == 0) {
+    cmd_cat(args);
+  } else if (strcmp(cmd, "exec") == 0) {
+    cmd_exec(args);
   } else {
     knewline();
     kprint("Unknown command: ",
@@ -458,7 +1654,7 @@ void shell_handle_arrow(uint8_t scancode) {
   } else if (scancode == 0x4D) { // Right Arrow
     // Move cursor right visually and update input_pos (insertion point)
     // Only move right if we are not at the end of the current input string
-    if (input_pos < strlen(input_buffer)) {
+    if (input_pos < (int)strlen(input_buffer)) {
       input_pos++;
       set_cursor_col(get_cursor_col() + 1);
     }
@@ -468,6 +1664,29 @@ void shell_handle_arrow(uint8_t scancode) {
 // Initialize shell
 void shell_init(void) { input_pos = 0; }
 
+// The shell's own task: every key press turns into editing or a command
+static void shell_main(void *arg) {
+  (void)arg;
+  key_event_t event;
+  for (;;) {
+    keyboard_read_event(&event, true);
+    if (event.flags & KEY_EVENT_RELEASE)
+      continue;
+
+    // Arrows, numpad ones included
+    if (event.scancode == 0x48 || event.scancode == 0x50 ||
+        event.scancode == 0x4B || event.scancode == 0x4D) {
+      shell_handle_arrow(event.scancode);
+    } else if (event.keycode == KEY_PAGEUP || event.keycode == KEY_PAGEDOWN) {
+      // Page through the console scrollback
+      console_scroll_view(event.keycode == KEY_PAGEUP ? VGA_HEIGHT / 2
+                                                      : -VGA_HEIGHT / 2);
+    } else if (event.ascii) {
+      shell_putchar(event.ascii);
+    }
+  }
+}
+
 // Run shell
 void shell_run(void) {
   knewline();
@@ -481,8 +1700,12 @@ void shell_run(void) {
 
   show_prompt();
 
-  // Shell runs in infinite loop - keyboard interrupt will call shell_putchar
-  for (;;) {
-    __asm__ volatile("hlt"); // Halt until next interrupt
+  // Input is read by the shell task; the boot flow retires into CPU 0's
+  // idle task
+  if (!task_create("shell", shell_main, 0)) {
+    kprint("Can't start the shell task",
+           VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+    knewline();
   }
+  sched_idle();
 }
@@ -0,0 +1,166 @@
+#include "smp.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "idt.h"
+#include "irqstat.h"
+#include "paging.h"
+#include "pmm.h"
+#include "sched.h"
+#include "string.h"
+#include "syscall.h"
+#include "timer.h"
+
+#define IA32_EFER_MSR 0xC0000080
+#define IA32_GS_BASE_MSR 0xC0000101
+#define EFER_LMA (1ULL << 10)
+
+// INIT, then up to two startup IPIs (the second only matters on CPUs that
+// miss the first), then wait for the AP to report in
+#define INIT_DELAY_US 10000
+#define SIPI_DELAY_US 200
+#define START_TIMEOUT_US 100000
+
+typedef struct {
+  uint32_t cr3;
+  uint32_t reserved;
+  uint64_t efer;
+  uint64_t stack;
+  uint64_t cpu;
+  uint64_t entry;
+} __attribute__((packed)) smp_trampoline_params_t;
+
+extern const uint8_t smp_trampoline_start[];
+extern const uint8_t smp_trampoline_end[];
+extern const uint8_t smp_trampoline_params[];
+extern uint8_t stack_top[];
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static int cpu_count = 0;
+
+static void delay_us(uint64_t us) {
+  uint64_t end = timer_now_ns() + us * 1000;
+  while (timer_now_ns() < end)
+    __asm__ volatile("pause");
+}
+
+static void set_gs_base(cpu_t *cpu) {
+  wrmsr(IA32_GS_BASE_MSR, (uint64_t)(uintptr_t)cpu);
+}
+
+static uint64_t alloc_stack(uint64_t pages) {
+  uint64_t base = pmm_alloc_pages(pages);
+  return base ? base + pages * PMM_PAGE_SIZE : 0;
+}
+
+// First C code on an AP, on its own stack with interrupts off
+static void ap_main(cpu_t *cpu) {
+  gdt_load(&cpu->gdt, cpu->stack_top);
+  cpu->gdt.tss.ist[IST_IRQ - 1] = cpu->irq_stack_top;
+  set_gs_base(cpu);
+  idt_load();
+  paging_init_cpu();
+  fpu_init_cpu();
+  apic_init_cpu();
+  syscall_init_cpu();
+
+  __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+  sched_start_cpu();
+}
+
+static bool start_ap(cpu_t *cpu) {
+  uint8_t vector = SMP_TRAMPOLINE_ADDR >> 12;
+
+  apic_send_ipi(cpu->apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+  delay_us(INIT_DELAY_US);
+  for (int i = 0; i < 2 && !cpu->online; i++) {
+    apic_send_ipi(cpu->apic_id, LAPIC_ICR_STARTUP | vector);
+    delay_us(SIPI_DELAY_US);
+  }
+
+  uint64_t deadline = timer_now_ns() + START_TIMEOUT_US * 1000ULL;
+  while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+    if (timer_now_ns() >= deadline)
+      return false;
+    __asm__ volatile("pause");
+  }
+  return true;
+}
+
+void smp_init_bsp(void) {
+  cpu_t *cpu = &cpus[0];
+  cpu->self = cpu;
+  cpu->index = 0;
+  cpu->stack_top = (uint64_t)(uintptr_t)stack_top;
+  cpu->online = true;
+  cpu->syscall_rsp = cpu->stack_top;
+  gdt_load(&cpu->gdt, cpu->stack_top);
+  set_gs_base(cpu);
+  cpu_count = 1;
+}
+
+int smp_init(void) {
+  // The boot CPU's IRQ stack, the APs get theirs below
+  cpus[0].irq_stack_top = alloc_stack(SMP_IRQ_STACK_PAGES);
+  cpus[0].gdt.tss.ist[IST_IRQ - 1] = cpus[0].irq_stack_top;
+  irqstat_init_cpu(&cpus[0]);
+
+  if (!apic_enabled())
+    return cpu_count;
+  cpus[0].apic_id = apic_current_id();
+
+  // Identity mapped, so the physical page can be written directly
+  uint8_t *trampoline = (uint8_t *)(uintptr_t)SMP_TRAMPOLINE_ADDR;
+  memcpy(trampoline, smp_trampoline_start,
+         smp_trampoline_end - smp_trampoline_start);
+
+  volatile smp_trampoline_params_t *params =
+      (volatile smp_trampoline_params_t *)(trampoline +
+                                           (smp_trampoline_params -
+                                            smp_trampoline_start));
+  params->cr3 = (uint32_t)get_cr3();
+  params->efer = rdmsr(IA32_EFER_MSR) & ~EFER_LMA;
+  params->entry = (uint64_t)(uintptr_t)ap_main;
+
+  for (int i = 0; i < apic_cpu_count() && cpu_count < SMP_MAX_CPUS; i++) {
+    uint32_t apic_id = apic_cpu_id(i);
+    if (apic_id == cpus[0].apic_id)
+      continue;
+    // An xAPIC ICR only holds 8-bit destinations
+    if (!apic_is_x2apic() && apic_id > 0xFF)
+      continue;
+
+    uint64_t stack = alloc_stack(SMP_STACK_PAGES);
+    uint64_t irq_stack = alloc_stack(SMP_IRQ_STACK_PAGES);
+    if (!stack || !irq_stack)
+      break;
+
+    cpu_t *cpu = &cpus[cpu_count];
+    cpu->self = cpu;
+    cpu->index = cpu_count;
+    cpu->apic_id = apic_id;
+    cpu->stack_top = stack;
+    cpu->irq_stack_top = irq_stack;
+    cpu->syscall_rsp = stack;
+    irqstat_init_cpu(cpu);
+    cpu->online = false;
+
+    params->stack = cpu->stack_top;
+    params->cpu = (uint64_t)(uintptr_t)cpu;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // A CPU that didn't come up may still wake later and use its slot and
+    // the trampoline, so stop here rather than hand them to the next one
+    if (!start_ap(cpu))
+      break;
+    cpu_count++;
+  }
+  return cpu_count;
+}
+
+int smp_cpu_count(void) { return cpu_count; }
+
+cpu_t *smp_cpu(int index) {
+  if (index < 0 || index >= cpu_count)
+    return 0;
+  return &cpus[index];
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include "apic.h"
+#include "gdt.h"
+#include "stdint.h"
+
+#define SMP_MAX_CPUS APIC_MAX_CPUS
+
+// Physical page the APs start in, below 1MB and page aligned (the startup
+// IPI vector is its page number)
+#define SMP_TRAMPOLINE_ADDR 0x8000
+
+#define SMP_STACK_PAGES 4 // 16KB kernel stack per AP
+#define SMP_IRQ_STACK_PAGES 4
+
+// Offsets syscall_entry.asm uses
+#define CPU_SYSCALL_RSP 40
+#define CPU_USER_RSP 48
+
+struct task;
+struct run_queue;
+struct fpu_context;
+struct irqstat;
+
+// Per-CPU data, reached through GS. Only the owning CPU writes its block
+// (the online flag aside), so nothing here needs a lock.
+typedef struct cpu {
+  struct cpu *self; // %gs:0, makes this_cpu() a single load
+  uint32_t index;   // Position in smp_cpu(), 0 is the boot CPU
+  uint32_t apic_id;
+  volatile bool online;
+  uint64_t stack_top;
+  uint64_t irq_stack_top; // IST_IRQ, interrupts that may switch tasks
+  uint64_t syscall_rsp;   // Kernel stack for SYSCALL (the task's)
+  uint64_t user_rsp;      // Scratch for syscall_entry.asm
+
+  struct task *current;
+  struct task *idle;
+  struct run_queue *run_queue;
+  struct irqstat *irqstat; // Per-vector counters (irqstat.c)
+  volatile bool need_resched;
+  uint64_t tick_ns;  // Period the local tick runs at
+  uint64_t slice_ns; // Of the current slice used up, in tick periods
+  uint64_t idle_deadline; // Tick stopped for idle, one shot due then
+
+  // Lazy FPU switching (fpu.c)
+  struct fpu_context *fpu_owner;   // Context the registers hold
+  struct fpu_context *fpu_current; // Context of the running thread
+  bool fpu_dirty;
+
+  // Statistics
+  uint64_t irqs;
+  uint64_t ticks;
+  uint64_t context_switches;
+  uint64_t steals;
+  uint64_t idle_ns;
+  uint64_t idle_since;
+
+  gdt_t gdt;
+} __attribute__((aligned(64))) cpu_t;
+
+static inline cpu_t *this_cpu(void) {
+  cpu_t *cpu;
+  __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+  return cpu;
+}
+
+// Give the boot CPU its per-CPU block, GDT and TSS. Must run before
+// interrupts are enabled.
+void smp_init_bsp(void);
+
+// Start every other CPU listed in the MADT (needs the APIC and the timer),
+// returns the number of CPUs online
+int smp_init(void);
+
+int smp_cpu_count(void);
+cpu_t *smp_cpu(int index);
@@ -0,0 +1,126 @@
+; Application processor start-up code
+;
+; smp_init() copies everything from smp_trampoline_start to
+; smp_trampoline_end down to SMP_TRAMPOLINE_ADDR and sends the startup IPI
+; there. The AP wakes up in real mode, goes through protected mode on a
+; throwaway GDT, then enters long mode the way entry.asm does: the boot
+; CPU's page tables and EFER, then gdt64 and a far jump. The last step
+; calls the C entry with its per-CPU block on its own stack.
+;
+; Everything here runs from the copy, so addresses inside the blob go
+; through TRAMPOLINE().
+
+SMP_TRAMPOLINE_ADDR equ 0x8000      ; Must match smp.h
+
+%define TRAMPOLINE(label) (SMP_TRAMPOLINE_ADDR + (label) - smp_trampoline_start)
+
+CR0_PE          equ 1 << 0
+CR0_PG          equ 1 << 31
+CR4_PAE         equ 1 << 5
+EFER_MSR        equ 0xC0000080
+
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+extern gdt64_ptr
+
+section .rodata
+align 16
+
+; ============================================================================
+; 16-BIT REAL MODE (CS:IP = 0x0800:0000)
+; ============================================================================
+bits 16
+
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [TRAMPOLINE(trampoline_gdt_ptr)]
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE(trampoline_32)
+
+; ============================================================================
+; 32-BIT PROTECTED MODE
+; ============================================================================
+bits 32
+
+trampoline_32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+
+    mov eax, [TRAMPOLINE(trampoline_cr3)]
+    mov cr3, eax
+
+    ; Same EFER as the boot CPU, LME included
+    mov ecx, EFER_MSR
+    mov eax, [TRAMPOLINE(trampoline_efer)]
+    mov edx, [TRAMPOLINE(trampoline_efer) + 4]
+    wrmsr
+
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+
+    ; Kernel GDT from entry.asm, selector 0x08 is the 64-bit code segment
+    lgdt [gdt64_ptr]
+    jmp 0x08:TRAMPOLINE(trampoline_64)
+
+; ============================================================================
+; 64-BIT LONG MODE
+; ============================================================================
+bits 64
+
+trampoline_64:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor eax, eax
+    mov fs, ax
+    mov gs, ax
+
+    mov rsp, [TRAMPOLINE(trampoline_stack)]
+    mov rdi, [TRAMPOLINE(trampoline_cpu)]
+    mov rax, [TRAMPOLINE(trampoline_entry)]
+    call rax
+
+    ; The entry never returns
+    cli
+.halt:
+    hlt
+    jmp .halt
+
+; Flat 32-bit code and data, only used on the way through protected mode
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+
+trampoline_gdt_ptr:
+    dw $ - trampoline_gdt - 1
+    dd TRAMPOLINE(trampoline_gdt)
+
+; Filled in by smp_init() before each AP is started, laid out like
+; smp_trampoline_params_t in smp.c
+align 8
+smp_trampoline_params:
+trampoline_cr3:     dd 0
+                    dd 0
+trampoline_efer:    dq 0
+trampoline_stack:   dq 0
+trampoline_cpu:     dq 0
+trampoline_entry:   dq 0
+
+smp_trampoline_end:
@@ -0,0 +1,26 @@
+#pragma once
+#include "stdint.h"
+
+// Test-and-test-and-set spinlock. Every lock in the kernel can be taken
+// from interrupt context, so taking one also disables interrupts on this
+// CPU; the caller gets the old flags back to restore on unlock.
+typedef struct {
+  volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+  while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+    while (lock->locked)
+      __asm__ volatile("pause");
+  }
+  return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+  __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+  __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
@@ -0,0 +1,422 @@
+#include "string.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "vm.h"
+
+// Copies and fills at least this long may use the vector loops. Below it,
+// handing the FPU over (saving its owner's registers) costs more than the
+// wider stores save.
+#define VECTOR_MIN_BYTES 2048
+// Without FSRM, rep movsb and stosb take a few dozen cycles to get going;
+// up to here the overlapping word moves below are quicker
+#define SHORT_MAX_BYTES 64
+
+typedef struct {
+  const char *name;
+  void (*copy)(uint8_t *dst, const uint8_t *src, size_t n);
+  void (*set)(uint8_t *dst, uint64_t pattern, size_t n);
+} string_impl_t;
+
+// Unaligned accesses of any type, exempt from strict aliasing
+typedef uint64_t __attribute__((may_alias, aligned(1))) u64_any;
+typedef uint32_t __attribute__((may_alias, aligned(1))) u32_any;
+typedef uint16_t __attribute__((may_alias, aligned(1))) u16_any;
+
+static inline uint64_t load64(const uint8_t *p) { return *(const u64_any *)p; }
+static inline void store64(uint8_t *p, uint64_t v) { *(u64_any *)p = v; }
+
+// Up to SHORT_MAX_BYTES without a loop: the first and the last words,
+// overlapping in the middle. Everything is loaded before anything is
+// stored, so it is also a correct memmove.
+static inline void short_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  if (n >= 16) {
+    uint64_t a0 = load64(src), a1 = load64(src + 8);
+    uint64_t b0 = load64(src + n - 16), b1 = load64(src + n - 8);
+    if (n > 32) {
+      uint64_t a2 = load64(src + 16), a3 = load64(src + 24);
+      uint64_t b2 = load64(src + n - 32), b3 = load64(src + n - 24);
+      store64(dst + 16, a2);
+      store64(dst + 24, a3);
+      store64(dst + n - 32, b2);
+      store64(dst + n - 24, b3);
+    }
+    store64(dst, a0);
+    store64(dst + 8, a1);
+    store64(dst + n - 16, b0);
+    store64(dst + n - 8, b1);
+  } else if (n >= 8) {
+    uint64_t a = load64(src), b = load64(src + n - 8);
+    store64(dst, a);
+    store64(dst + n - 8, b);
+  } else if (n >= 4) {
+    uint32_t a = *(const u32_any *)src, b = *(const u32_any *)(src + n - 4);
+    *(u32_any *)dst = a;
+    *(u32_any *)(dst + n - 4) = b;
+  } else if (n >= 2) {
+    uint16_t a = *(const u16_any *)src, b = *(const u16_any *)(src + n - 2);
+    *(u16_any *)dst = a;
+    *(u16_any *)(dst + n - 2) = b;
+  } else if (n) {
+    *dst = *src;
+  }
+}
+
+static inline void short_set(uint8_t *dst, uint64_t pattern, size_t n) {
+  if (n >= 16) {
+    if (n > 32) {
+      store64(dst + 16, pattern);
+      store64(dst + 24, pattern);
+      store64(dst + n - 32, pattern);
+      store64(dst + n - 24, pattern);
+    }
+    store64(dst, pattern);
+    store64(dst + 8, pattern);
+    store64(dst + n - 16, pattern);
+    store64(dst + n - 8, pattern);
+  } else if (n >= 8) {
+    store64(dst, pattern);
+    store64(dst + n - 8, pattern);
+  } else if (n >= 4) {
+    *(u32_any *)dst = (uint32_t)pattern;
+    *(u32_any *)(dst + n - 4) = (uint32_t)pattern;
+  } else if (n >= 2) {
+    *(u16_any *)dst = (uint16_t)pattern;
+    *(u16_any *)(dst + n - 2) = (uint16_t)pattern;
+  } else if (n) {
+    *dst = (uint8_t)pattern;
+  }
+}
+
+static inline void rep_movsb(uint8_t *dst, const uint8_t *src, size_t n) {
+  __asm__ volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(n) : : "memory");
+}
+
+static inline void rep_stosb(uint8_t *dst, uint64_t pattern, size_t n) {
+  __asm__ volatile("rep stosb"
+                   : "+D"(dst), "+c"(n)
+                   : "a"(pattern)
+                   : "memory");
+}
+
+// Quadwords, then the odd bytes
+static inline void rep_movsq(uint8_t *dst, const uint8_t *src, size_t n) {
+  size_t words = n / 8;
+  __asm__ volatile("rep movsq\n"
+                   "mov %3, %%rcx\n"
+                   "rep movsb"
+                   : "+D"(dst), "+S"(src), "+c"(words)
+                   : "r"(n & 7)
+                   : "memory");
+}
+
+static inline void rep_stosq(uint8_t *dst, uint64_t pattern, size_t n) {
+  size_t words = n / 8;
+  __asm__ volatile("rep stosq\n"
+                   "mov %2, %%rcx\n"
+                   "rep stosb"
+                   : "+D"(dst), "+c"(words)
+                   : "r"(n & 7), "a"(pattern)
+                   : "memory");
+}
+
+// Baseline x86-64
+static void movsq_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  if (n <= SHORT_MAX_BYTES)
+    short_copy(dst, src, n);
+  else
+    rep_movsq(dst, src, n);
+}
+
+static void stosq_set(uint8_t *dst, uint64_t pattern, size_t n) {
+  if (n <= SHORT_MAX_BYTES)
+    short_set(dst, pattern, n);
+  else
+    rep_stosq(dst, pattern, n);
+}
+
+// ERMS: rep movsb/stosb move whole cache lines at a time once started
+static void erms_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  if (n <= SHORT_MAX_BYTES)
+    short_copy(dst, src, n);
+  else
+    rep_movsb(dst, src, n);
+}
+
+static void erms_set(uint8_t *dst, uint64_t pattern, size_t n) {
+  if (n <= SHORT_MAX_BYTES)
+    short_set(dst, pattern, n);
+  else
+    rep_stosb(dst, pattern, n);
+}
+
+// FSRM: fast from the first byte
+static void fsrm_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  rep_movsb(dst, src, n);
+}
+
+static void fsrm_set(uint8_t *dst, uint64_t pattern, size_t n) {
+  rep_stosb(dst, pattern, n);
+}
+
+// 64 byte blocks to a 32 byte aligned dst
+FPU_TARGET_SSE2 static void sse2_copy_blocks(uint8_t *dst, const uint8_t *src,
+                                             size_t blocks) {
+  __asm__ volatile("1:\n"
+                   "movdqu (%1), %%xmm0\n"
+                   "movdqu 16(%1), %%xmm1\n"
+                   "movdqu 32(%1), %%xmm2\n"
+                   "movdqu 48(%1), %%xmm3\n"
+                   "movdqa %%xmm0, (%0)\n"
+                   "movdqa %%xmm1, 16(%0)\n"
+                   "movdqa %%xmm2, 32(%0)\n"
+                   "movdqa %%xmm3, 48(%0)\n"
+                   "add $64, %1\n"
+                   "add $64, %0\n"
+                   "dec %2\n"
+                   "jnz 1b\n"
+                   : "+r"(dst), "+r"(src), "+r"(blocks)
+                   :
+                   : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+}
+
+FPU_TARGET_SSE2 static void sse2_set_blocks(uint8_t *dst, uint64_t pattern,
+                                            size_t blocks) {
+  __asm__ volatile("movq %2, %%xmm0\n"
+                   "punpcklqdq %%xmm0, %%xmm0\n"
+                   "1:\n"
+                   "movdqa %%xmm0, (%0)\n"
+                   "movdqa %%xmm0, 16(%0)\n"
+                   "movdqa %%xmm0, 32(%0)\n"
+                   "movdqa %%xmm0, 48(%0)\n"
+                   "add $64, %0\n"
+                   "dec %1\n"
+                   "jnz 1b\n"
+                   : "+r"(dst), "+r"(blocks)
+                   : "r"(pattern)
+                   : "xmm0", "memory", "cc");
+}
+
+FPU_TARGET_AVX2 static void avx2_copy_blocks(uint8_t *dst, const uint8_t *src,
+                                             size_t blocks) {
+  __asm__ volatile("1:\n"
+                   "vmovdqu (%1), %%ymm0\n"
+                   "vmovdqu 32(%1), %%ymm1\n"
+                   "vmovdqa %%ymm0, (%0)\n"
+                   "vmovdqa %%ymm1, 32(%0)\n"
+                   "add $64, %1\n"
+                   "add $64, %0\n"
+                   "dec %2\n"
+                   "jnz 1b\n"
+                   "vzeroupper\n"
+                   : "+r"(dst), "+r"(src), "+r"(blocks)
+                   :
+                   : "xmm0", "xmm1", "memory", "cc");
+}
+
+FPU_TARGET_AVX2 static void avx2_set_blocks(uint8_t *dst, uint64_t pattern,
+                                            size_t blocks) {
+  __asm__ volatile("vmovq %2, %%xmm0\n"
+                   "vpbroadcastq %%xmm0, %%ymm0\n"
+                   "1:\n"
+                   "vmovdqa %%ymm0, (%0)\n"
+                   "vmovdqa %%ymm0, 32(%0)\n"
+                   "add $64, %0\n"
+                   "dec %1\n"
+                   "jnz 1b\n"
+                   "vzeroupper\n"
+                   : "+r"(dst), "+r"(blocks)
+                   : "r"(pattern)
+                   : "xmm0", "memory", "cc");
+}
+
+// The vector loops run with interrupts off (fpu_kernel_begin), where a
+// fault on user memory can't be waited for, so they only take kernel
+// buffers
+static inline bool vector_ok(const uint8_t *p, size_t n) {
+  uintptr_t a = (uintptr_t)p;
+  return n >= VECTOR_MIN_BYTES && (a >= VM_USER_TOP || a + n <= VM_USER_BASE);
+}
+
+// Head up to dst alignment and the sub-block tail as short moves
+static void vector_copy(uint8_t *dst, const uint8_t *src, size_t n,
+                        void (*blocks)(uint8_t *, const uint8_t *, size_t)) {
+  size_t head = -(uintptr_t)dst & 31;
+  short_copy(dst, src, head);
+  dst += head;
+  src += head;
+  n -= head;
+
+  uint64_t flags = fpu_kernel_begin();
+  blocks(dst, src, n / 64);
+  fpu_kernel_end(flags);
+
+  size_t done = n & ~(size_t)63;
+  short_copy(dst + done, src + done, n & 63);
+}
+
+static void vector_set(uint8_t *dst, uint64_t pattern, size_t n,
+                       void (*blocks)(uint8_t *, uint64_t, size_t)) {
+  size_t head = -(uintptr_t)dst & 31;
+  short_set(dst, pattern, head);
+  dst += head;
+  n -= head;
+
+  uint64_t flags = fpu_kernel_begin();
+  blocks(dst, pattern, n / 64);
+  fpu_kernel_end(flags);
+
+  short_set(dst + (n & ~(size_t)63), pattern, n & 63);
+}
+
+static void sse2_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  if (vector_ok(dst, n) && vector_ok(src, n))
+    vector_copy(dst, src, n, sse2_copy_blocks);
+  else
+    movsq_copy(dst, src, n);
+}
+
+static void sse2_set(uint8_t *dst, uint64_t pattern, size_t n) {
+  if (vector_ok(dst, n))
+    vector_set(dst, pattern, n, sse2_set_blocks);
+  else
+    stosq_set(dst, pattern, n);
+}
+
+static void avx2_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  if (vector_ok(dst, n) && vector_ok(src, n))
+    vector_copy(dst, src, n, avx2_copy_blocks);
+  else
+    movsq_copy(dst, src, n);
+}
+
+static void avx2_set(uint8_t *dst, uint64_t pattern, size_t n) {
+  if (vector_ok(dst, n))
+    vector_set(dst, pattern, n, avx2_set_blocks);
+  else
+    stosq_set(dst, pattern, n);
+}
+
+static const string_impl_t movsq_impl = {"movsq", movsq_copy, stosq_set};
+static const string_impl_t erms_impl = {"erms", erms_copy, erms_set};
+static const string_impl_t fsrm_impl = {"fsrm", fsrm_copy, fsrm_set};
+static const string_impl_t sse2_impl = {"sse2", sse2_copy, sse2_set};
+static const string_impl_t avx2_impl = {"avx2", avx2_copy, avx2_set};
+
+static const string_impl_t *impl = &movsq_impl;
+
+void string_init(void) {
+  // Fast strings win where the CPU has them: as quick as the vector loops
+  // on large buffers, with no FPU hand-off and interrupts left alone
+  if (cpu_has(CPU_FEATURE_FSRM))
+    impl = &fsrm_impl;
+  else if (cpu_has(CPU_FEATURE_ERMS))
+    impl = &erms_impl;
+  else if (cpu_has(CPU_FEATURE_AVX2) && fpu_avx_enabled())
+    impl = &avx2_impl;
+  else if (fpu_sse_enabled())
+    impl = &sse2_impl;
+}
+
+const char *string_impl_name(void) { return impl->name; }
+
+void *memcpy(void *dst, const void *src, size_t n) {
+  impl->copy(dst, src, n);
+  return dst;
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  if (n <= SHORT_MAX_BYTES) {
+    short_copy(d, s, n);
+  } else if (d + n <= s || s + n <= d) {
+    impl->copy(d, s, n);
+  } else if (d < s) {
+    // rep movsb behaves as a byte at a time, so a forward copy down onto
+    // an overlapping source is safe
+    rep_movsb(d, s, n);
+  } else if (d > s) {
+    // Backwards a piece at a time, each piece loaded whole before it is
+    // stored (no std: the interrupt stubs don't clear the direction flag)
+    while (n > SHORT_MAX_BYTES) {
+      n -= SHORT_MAX_BYTES;
+      short_copy(d + n, s + n, SHORT_MAX_BYTES);
+    }
+    short_copy(d, s, n);
+  }
+  return dst;
+}
+
+void *memset(void *dst, int c, size_t n) {
+  impl->set(dst, 0x0101010101010101ULL * (uint8_t)c, n);
+  return dst;
+}
+
+// A word at a time; the first differing byte is the lowest set one of the
+// xor, since x86 is little endian
+int memcmp(const void *a, const void *b, size_t n) {
+  const uint8_t *p = a, *q = b;
+  for (; n >= 8; n -= 8, p += 8, q += 8) {
+    uint64_t x = load64(p), y = load64(q);
+    if (x != y) {
+      int shift = __builtin_ctzll(x ^ y) & ~7;
+      return (int)((x >> shift) & 0xFF) - (int)((y >> shift) & 0xFF);
+    }
+  }
+  for (; n; n--, p++, q++) {
+    if (*p != *q)
+      return *p - *q;
+  }
+  return 0;
+}
+
+// The string functions run over names, paths and command lines, far too
+// short for anything but the plain loops
+size_t strlen(const char *s) {
+  const char *p = s;
+  while (*p)
+    p++;
+  return p - s;
+}
+
+size_t strnlen(const char *s, size_t max) {
+  size_t len = 0;
+  while (len < max && s[len])
+    len++;
+  return len;
+}
+
+int strcmp(const char *a, const char *b) {
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *(const unsigned char *)a - *(const unsigned char *)b;
+}
+
+int strncmp(const char *a, const char *b, size_t n) {
+  for (; n; n--, a++, b++) {
+    if (!*a || *a != *b)
+      return *(const unsigned char *)a - *(const unsigned char *)b;
+  }
+  return 0;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+
+char *strchr(const char *s, int c) {
+  for (;; s++) {
+    if (*s == (char)c)
+      return (char *)s;
+    if (!*s)
+      return 0;
+  }
+}
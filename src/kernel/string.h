@@ -0,0 +1,31 @@
+#pragma once
+#include "stdint.h"
+
+// Memory and string functions for the whole kernel. GCC may also emit calls
+// to memcpy, memmove, memset and memcmp by itself (struct copies, loops it
+// recognises), so these are the real symbols.
+//
+// The bulk functions have one implementation per CPU class, picked by
+// string_init from the CPUID feature table: rep movsb/stosb where the CPU
+// has fast strings (ERMS, and FSRM for short ones too), otherwise SSE2 or
+// AVX2 loops for large kernel buffers and rep movsq/stosq for the rest.
+// Until string_init runs, rep movsq/stosq is used, which every x86-64 has.
+
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+size_t strlen(const char *s);
+size_t strnlen(const char *s, size_t max);
+int strcmp(const char *a, const char *b);
+int strncmp(const char *a, const char *b, size_t n);
+// Copies at most size - 1 characters and always terminates (unless size is
+// 0). Returns strlen(src), so a result >= size means it was cut short.
+size_t strlcpy(char *dst, const char *src, size_t size);
+char *strchr(const char *s, int c);
+
+// After fpu_init: the vector versions need the FPU enabled
+void string_init(void);
+// Which implementation memcpy and memset use ("erms", "avx2", ...)
+const char *string_impl_name(void);
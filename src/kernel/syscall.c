@@ -0,0 +1,544 @@
+#include "syscall.h"
+#include "compositor.h"
+#include "console.h"
+#include "cpu.h"
+#include "exec.h"
+#include "gdt.h"
+#include "gfx_ring.h"
+#include "graphics.h"
+#include "idt.h"
+#include "keyboard.h"
+#include "kmalloc.h"
+#include "paging.h"
+#include "sched.h"
+#include "serial.h"
+#include "smp.h"
+#include "timer.h"
+#include "trace.h"
+#include "vblank.h"
+#include "vm.h"
+
+#define IA32_EFER_MSR 0xC0000080
+#define IA32_STAR_MSR 0xC0000081
+#define IA32_LSTAR_MSR 0xC0000082
+#define IA32_FMASK_MSR 0xC0000084
+#define EFER_SCE (1ULL << 0)
+
+// Cleared on SYSCALL: TF, IF, DF and AC
+#define SYSCALL_RFLAGS_MASK 0x40700
+
+// SYSRET loads CS from STAR[63:48] + 16 and SS from STAR[63:48] + 8, so
+// the base sits just below the user data and code selectors
+#define STAR_USER_BASE (GDT_USER_DATA - 8)
+
+extern void isr128();
+extern void syscall_entry();
+
+_Static_assert(__builtin_offsetof(cpu_t, syscall_rsp) == CPU_SYSCALL_RSP,
+               "syscall_entry.asm expects syscall_rsp here");
+_Static_assert(__builtin_offsetof(cpu_t, user_rsp) == CPU_USER_RSP,
+               "syscall_entry.asm expects user_rsp here");
+
+static SyscallHandler syscall_table[SYSCALL_MAX];
+
+static uint64_t sys_exit(uint64_t code, uint64_t arg2, uint64_t arg3,
+                         uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  if (!task_current()->process)
+    return SYSCALL_ERROR;
+  exec_exit((int)code);
+}
+
+static uint64_t sys_print(uint64_t str, uint64_t arg2, uint64_t arg3,
+                          uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  char chunk[128];
+  int n;
+  do {
+    n = vm_copy_string(chunk, str, sizeof(chunk));
+    if (n < 0)
+      return SYSCALL_ERROR;
+    kprint(chunk, VGA_ENTRY_COLOR(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    str += n;
+  } while (n == sizeof(chunk) - 1);
+  return 0;
+}
+
+// The same to COM1, for output meant to be captured
+static uint64_t sys_serial_write(uint64_t str, uint64_t arg2, uint64_t arg3,
+                                 uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  char chunk[128];
+  int n;
+  do {
+    n = vm_copy_string(chunk, str, sizeof(chunk));
+    if (n < 0)
+      return SYSCALL_ERROR;
+    serial_write(chunk, (uint64_t)n);
+    str += n;
+  } while (n == sizeof(chunk) - 1);
+  return 0;
+}
+
+// Run another program and wait for it, its exit code or a negative
+// EXEC_E* code. argv is a null terminated array of strings in the caller,
+// 0 passes just the path.
+static uint64_t sys_exec(uint64_t path, uint64_t argv, uint64_t arg3,
+                         uint64_t arg4, uint64_t arg5) {
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  char buf[EXEC_PATH_MAX];
+  if (vm_copy_string(buf, path, sizeof(buf)) < 0)
+    return SYSCALL_ERROR;
+  if (!argv)
+    return (uint64_t)(int64_t)exec_run(buf, 0);
+
+  // The strings go back to back into one buffer, exec_spawn copies them on
+  char *strings = kmalloc(EXEC_ARGS_MAX);
+  char **list = kmalloc((EXEC_MAX_ARGS + 1) * sizeof(char *));
+  int64_t status = EXEC_ENOMEM;
+  if (strings && list) {
+    uint64_t used = 0;
+    int argc = 0;
+    status = EXEC_OK;
+    for (;; argc++) {
+      uint64_t slot = argv + (uint64_t)argc * 8;
+      if (!vm_user_range(slot, 8, VM_READ)) {
+        status = SYSCALL_ERROR;
+        break;
+      }
+      uint64_t str = *(const uint64_t *)(uintptr_t)slot;
+      if (!str)
+        break;
+      if (argc == EXEC_MAX_ARGS) {
+        status = EXEC_E2BIG;
+        break;
+      }
+      int n = vm_copy_string(strings + used, str, EXEC_ARGS_MAX - used);
+      if (n < 0) {
+        status = SYSCALL_ERROR;
+        break;
+      }
+      // Filling the rest of the buffer may have cut the string short
+      if (used + (uint64_t)n + 1 == EXEC_ARGS_MAX) {
+        status = EXEC_E2BIG;
+        break;
+      }
+      list[argc] = strings + used;
+      used += (uint64_t)n + 1;
+    }
+    list[argc] = 0;
+    if (status == EXEC_OK)
+      status = exec_run(buf, list);
+  }
+  kfree(strings);
+  kfree(list);
+  return (uint64_t)status;
+}
+
+static uint64_t sys_getkey(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                           uint64_t arg4, uint64_t arg5) {
+  (void)arg1;
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  return (uint8_t)keyboard_get_key();
+}
+
+static uint64_t sys_kbhit(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                          uint64_t arg4, uint64_t arg5) {
+  (void)arg1;
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  return keyboard_has_key();
+}
+
+// Next key_event_t into the caller's buffer, 0 if none came and wait is 0
+static uint64_t sys_getevent(uint64_t event, uint64_t wait, uint64_t arg3,
+                             uint64_t arg4, uint64_t arg5) {
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  if (!vm_user_range(event, sizeof(key_event_t), VM_WRITE))
+    return SYSCALL_ERROR;
+  return keyboard_read_event((key_event_t *)(uintptr_t)event, wait != 0);
+}
+
+#define PAGE_ROUND(x) (((x) + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1))
+
+// Move the program break by increment bytes and return the old one. The
+// heap is one demand-zero region from the end of the image, resized to
+// cover the break.
+static uint64_t sys_sbrk(uint64_t increment, uint64_t arg2, uint64_t arg3,
+                         uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  process_t *proc = task_current()->process;
+  if (!proc)
+    return SYSCALL_ERROR;
+  int64_t delta = (int64_t)increment;
+  uint64_t old = proc->brk;
+  uint64_t brk = old + (uint64_t)delta;
+  if ((delta < 0 && brk > old) || (delta > 0 && brk < old) ||
+      brk < proc->brk_start || brk > VM_MMAP_BASE)
+    return SYSCALL_ERROR;
+
+  vm_space_t *space = proc->vm;
+  uint64_t have = PAGE_ROUND(old), want = PAGE_ROUND(brk);
+  bool ok = true;
+  if (want > have && have == proc->brk_start)
+    ok = vm_map(space, have, want, VM_READ | VM_WRITE, -1, 0, 0);
+  else if (want < have && want == proc->brk_start)
+    ok = vm_unmap(space, want, have);
+  else if (want != have)
+    ok = vm_resize(space, proc->brk_start, want);
+  if (!ok)
+    return SYSCALL_ERROR;
+  proc->brk = brk;
+  return old;
+}
+
+// Anonymous demand-zero memory: length bytes with prot VM_* access,
+// somewhere in [VM_MMAP_BASE, VM_SCREEN_BASE). The address is only a hint
+// and not used yet.
+static uint64_t sys_mmap(uint64_t addr, uint64_t length, uint64_t prot,
+                         uint64_t arg4, uint64_t arg5) {
+  (void)addr;
+  (void)arg4;
+  (void)arg5;
+  vm_space_t *space = task_current()->vm;
+  uint64_t size = PAGE_ROUND(length);
+  if (!space || !length || size < length ||
+      (prot & ~(uint64_t)(VM_READ | VM_WRITE | VM_EXEC)))
+    return SYSCALL_ERROR;
+  uint64_t start = vm_find_free(space, size, VM_MMAP_BASE, VM_SCREEN_BASE);
+  if (!start || !vm_map(space, start, start + size, (uint32_t)prot, -1, 0, 0))
+    return SYSCALL_ERROR;
+  return start;
+}
+
+// Give back [addr, addr + length) of what SYS_MMAP handed out
+static uint64_t sys_munmap(uint64_t addr, uint64_t length, uint64_t arg3,
+                           uint64_t arg4, uint64_t arg5) {
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  vm_space_t *space = task_current()->vm;
+  uint64_t end = addr + PAGE_ROUND(length);
+  if (!space || !length || (addr & (PAGE_SIZE_4K - 1)) || end <= addr ||
+      addr < VM_MMAP_BASE || end > VM_SCREEN_BASE)
+    return SYSCALL_ERROR;
+  return vm_unmap(space, addr, end) ? 0 : SYSCALL_ERROR;
+}
+
+// Sleeps block the task until the deadline, other tasks get the CPU
+static void sleep_until(uint64_t deadline_ns) {
+  if (sched_can_block())
+    sched_sleep_until(deadline_ns);
+  else
+    timer_sleep_until(deadline_ns);
+}
+
+static uint64_t sys_sleep(uint64_t ms, uint64_t arg2, uint64_t arg3,
+                          uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  sleep_until(timer_now_ns() + ms * 1000000);
+  return 0;
+}
+
+static uint64_t sys_clock(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                          uint64_t arg4, uint64_t arg5) {
+  (void)arg1;
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  return timer_now_ns();
+}
+
+static uint64_t sys_sleep_until(uint64_t deadline_ns, uint64_t arg2,
+                                uint64_t arg3, uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  sleep_until(deadline_ns);
+  return 0;
+}
+
+// A program that draws has the screen: the compositor stops until the
+// shell takes it back. The drawing itself is under the graphics lock, the
+// compositor or another program may be drawing on another CPU.
+static uint64_t draw_begin(void) {
+  comp_suspend();
+  return graphics_lock();
+}
+
+// Drawing calls show their result right away; with the back buffer on
+// that copies just the damaged area
+static uint64_t sys_putpixel(uint64_t x, uint64_t y, uint64_t color,
+                             uint64_t arg4, uint64_t arg5) {
+  (void)arg4;
+  (void)arg5;
+  uint64_t flags = draw_begin();
+  graphics_put_pixel((int)x, (int)y, (uint32_t)color);
+  graphics_present();
+  graphics_unlock(flags);
+  return 0;
+}
+
+static uint64_t sys_getpixel(uint64_t x, uint64_t y, uint64_t arg3,
+                             uint64_t arg4, uint64_t arg5) {
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  uint64_t flags = graphics_lock();
+  uint32_t color = graphics_get_pixel((int)x, (int)y);
+  graphics_unlock(flags);
+  return color;
+}
+
+static uint64_t sys_clear(uint64_t color, uint64_t arg2, uint64_t arg3,
+                          uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  uint64_t flags = draw_begin();
+  graphics_clear((uint32_t)color);
+  graphics_present();
+  graphics_unlock(flags);
+  return 0;
+}
+
+static uint64_t sys_getwidth(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                             uint64_t arg4, uint64_t arg5) {
+  (void)arg1;
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  return graphics_is_available() ? graphics_get_info()->width : 0;
+}
+
+static uint64_t sys_getheight(uint64_t arg1, uint64_t arg2, uint64_t arg3,
+                              uint64_t arg4, uint64_t arg5) {
+  (void)arg1;
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  return graphics_is_available() ? graphics_get_info()->height : 0;
+}
+
+static uint64_t sys_line(uint64_t x0, uint64_t y0, uint64_t x1, uint64_t y1,
+                         uint64_t color) {
+  uint64_t flags = draw_begin();
+  graphics_draw_line((int)x0, (int)y0, (int)x1, (int)y1, (uint32_t)color);
+  graphics_present();
+  graphics_unlock(flags);
+  return 0;
+}
+
+static uint64_t sys_fillrect(uint64_t x, uint64_t y, uint64_t w, uint64_t h,
+                             uint64_t color) {
+  uint64_t flags = draw_begin();
+  graphics_fill_rect((int)x, (int)y, (int)w, (int)h, (uint32_t)color);
+  graphics_present();
+  graphics_unlock(flags);
+  return 0;
+}
+
+static uint64_t sys_fillcircle(uint64_t cx, uint64_t cy, uint64_t radius,
+                               uint64_t color, uint64_t arg5) {
+  (void)arg5;
+  uint64_t flags = draw_begin();
+  graphics_fill_circle((int)cx, (int)cy, (int)radius, (uint32_t)color);
+  graphics_present();
+  graphics_unlock(flags);
+  return 0;
+}
+
+// Map the screen (FB_MAP_SCREEN) or a private 0x00RRGGBB buffer
+// (FB_MAP_PRIVATE) into the caller, describe it at info and return its
+// address. The screen is whatever graphics.c draws into: with the back
+// buffer on the program shares its RAM pages and reports damage through
+// the ring, otherwise it gets the framebuffer write-combining. Asking again
+// returns the existing mapping.
+static uint64_t sys_map_framebuffer(uint64_t info, uint64_t mode,
+                                    uint64_t arg3, uint64_t arg4,
+                                    uint64_t arg5) {
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  vm_space_t *space = task_current()->vm;
+  if (!space || !graphics_is_available() || mode > FB_MAP_PRIVATE ||
+      !vm_user_range(info, sizeof(FramebufferMapping), VM_WRITE))
+    return SYSCALL_ERROR;
+  comp_suspend();
+
+  FramebufferInfo *fb = graphics_get_info();
+  FramebufferMapping map = {0};
+  map.width = fb->width;
+  map.height = fb->height;
+  if (mode == FB_MAP_PRIVATE) {
+    map.addr = VM_PRIVATE_FB_BASE;
+    map.pitch = fb->width * 4;
+    map.bpp = 32;
+    map.bytes_pp = 4;
+    map.red_pos = 16;
+    map.green_pos = 8;
+    map.red_size = map.green_size = map.blue_size = 8;
+  } else {
+    map.addr = VM_SCREEN_BASE;
+    map.pitch = fb->pitch;
+    map.bpp = fb->bpp;
+    map.bytes_pp = (uint8_t)((fb->bpp + 7) / 8);
+    map.red_pos = fb->red_field_pos;
+    map.red_size = fb->red_mask_size;
+    map.green_pos = fb->green_field_pos;
+    map.green_size = fb->green_mask_size;
+    map.blue_pos = fb->blue_field_pos;
+    map.blue_size = fb->blue_mask_size;
+    if (graphics_needs_damage())
+      map.flags = FB_INFO_DAMAGE;
+  }
+
+  uint64_t size = ((uint64_t)map.pitch * map.height + PAGE_SIZE_4K - 1) &
+                  ~(PAGE_SIZE_4K - 1);
+  if (!vm_find_region(space, map.addr)) {
+    if (mode == FB_MAP_PRIVATE) {
+      if (!vm_map(space, map.addr, map.addr + size, VM_READ | VM_WRITE, -1, 0,
+                  0))
+        return SYSCALL_ERROR;
+    } else {
+      if (!vm_map(space, map.addr, map.addr + size, VM_READ | VM_WRITE,
+                  VM_FD_DEVICE, 0, 0))
+        return SYSCALL_ERROR;
+      // RAM the stores only show from (the back buffer, a virtio-gpu
+      // backing) is scattered pages, a framebuffer in VRAM is one run
+      uint64_t target = graphics_get_target();
+      bool shared = (map.flags & FB_INFO_DAMAGE) != 0;
+      for (uint64_t off = 0; off < size; off += PAGE_SIZE_4K) {
+        uint64_t phys = target + off;
+        if (shared && !paging_translate(target + off, &phys))
+          return SYSCALL_ERROR;
+        if (!vm_map_page(space, map.addr + off, phys,
+                         PAGE_RW | (shared ? PAGE_CACHE_WB : PAGE_CACHE_WC)))
+          return SYSCALL_ERROR;
+      }
+    }
+  }
+  *(FramebufferMapping *)(uintptr_t)info = map;
+  return map.addr;
+}
+
+// Sleep until the next vertical blank and return its sequence number,
+// described at info unless that's 0
+static uint64_t sys_wait_vblank(uint64_t info, uint64_t arg2, uint64_t arg3,
+                                uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  if (info && !vm_user_range(info, sizeof(vblank_info_t), VM_WRITE))
+    return SYSCALL_ERROR;
+  vblank_info_t v;
+  vblank_wait(&v);
+  if (info)
+    *(vblank_info_t *)(uintptr_t)info = v;
+  return v.seq;
+}
+
+// A whole batch of drawing commands, the ring says when to present
+static uint64_t sys_gfx_submit(uint64_t ring, uint64_t arg2, uint64_t arg3,
+                               uint64_t arg4, uint64_t arg5) {
+  (void)arg2;
+  (void)arg3;
+  (void)arg4;
+  (void)arg5;
+  if (!vm_user_range(ring, sizeof(gfx_ring_t), VM_READ | VM_WRITE))
+    return SYSCALL_ERROR;
+  comp_suspend();
+  return (uint64_t)gfx_ring_submit((gfx_ring_t *)(uintptr_t)ring);
+}
+
+void syscall_dispatch(Registers *regs) {
+  uint64_t num = regs->rax;
+  TRACE(TRACE_SYSCALL_ENTRY, regs->rbx, num, 0);
+  if (num >= SYSCALL_MAX || !syscall_table[num]) {
+    regs->rax = SYSCALL_ERROR;
+  } else {
+    regs->rax = syscall_table[num](regs->rbx, regs->rcx, regs->rdx,
+                                   regs->rsi, regs->rdi);
+  }
+  TRACE(TRACE_SYSCALL_EXIT, regs->rax, num, 0);
+}
+
+void syscall_init_cpu(void) {
+  wrmsr(IA32_EFER_MSR, rdmsr(IA32_EFER_MSR) | EFER_SCE);
+  wrmsr(IA32_STAR_MSR, ((uint64_t)STAR_USER_BASE << 48) |
+                           ((uint64_t)GDT_KERNEL_CODE << 32));
+  wrmsr(IA32_LSTAR_MSR, (uint64_t)(uintptr_t)syscall_entry);
+  wrmsr(IA32_FMASK_MSR, SYSCALL_RFLAGS_MASK);
+}
+
+void syscall_register(uint32_t num, SyscallHandler handler) {
+  if (num < SYSCALL_MAX)
+    syscall_table[num] = handler;
+}
+
+void syscall_init(void) {
+  for (int i = 0; i < SYSCALL_MAX; i++)
+    syscall_table[i] = 0;
+
+  syscall_register(SYS_EXIT, sys_exit);
+  syscall_register(SYS_PRINT, sys_print);
+  syscall_register(SYS_SERIAL_WRITE, sys_serial_write);
+  syscall_register(SYS_EXEC, sys_exec);
+  syscall_register(SYS_GETKEY, sys_getkey);
+  syscall_register(SYS_KBHIT, sys_kbhit);
+  syscall_register(SYS_GETEVENT, sys_getevent);
+  syscall_register(SYS_SBRK, sys_sbrk);
+  syscall_register(SYS_MMAP, sys_mmap);
+  syscall_register(SYS_MUNMAP, sys_munmap);
+  syscall_register(SYS_SLEEP, sys_sleep);
+  syscall_register(SYS_CLOCK, sys_clock);
+  syscall_register(SYS_SLEEP_UNTIL, sys_sleep_until);
+  syscall_register(SYS_PUTPIXEL, sys_putpixel);
+  syscall_register(SYS_GETPIXEL, sys_getpixel);
+  syscall_register(SYS_CLEAR, sys_clear);
+  syscall_register(SYS_GETWIDTH, sys_getwidth);
+  syscall_register(SYS_GETHEIGHT, sys_getheight);
+  syscall_register(SYS_LINE, sys_line);
+  syscall_register(SYS_FILLRECT, sys_fillrect);
+  syscall_register(SYS_FILLCIRCLE, sys_fillcircle);
+  syscall_register(SYS_GFX_SUBMIT, sys_gfx_submit);
+  syscall_register(SYS_MAP_FRAMEBUFFER, sys_map_framebuffer);
+  syscall_register(SYS_WAIT_VBLANK, sys_wait_vblank);
+
+  // DPL 3 trap gate so user code can raise it, interrupts stay enabled
+  idt_set_gate(SYSCALL_VECTOR, (uint64_t)isr128, 0x08, 0xEF);
+  register_interrupt_handler(SYSCALL_VECTOR, syscall_dispatch);
+
+  // The fast path; the APs set up their own MSRs in smp.c
+  syscall_init_cpu();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "isr.h"
+#include "stdint.h"
+
+// Software interrupt kept for programs built without SYSCALL support
+#define SYSCALL_VECTOR 0x80
+
+// System call numbers (matches sdk/include/nbos.h)
+#define SYS_EXIT 0
+#define SYS_PRINT 1
+#define SYS_GETKEY 2
+#define SYS_KBHIT 3
+// 4 and 5 were SYS_MALLOC and SYS_FREE, which handed out kernel memory
+#define SYS_SLEEP 6
+#define SYS_CLOCK 7
+#define SYS_SLEEP_UNTIL 8
+#define SYS_PUTPIXEL 10
+#define SYS_GETPIXEL 11
+#define SYS_CLEAR 12
+#define SYS_GETWIDTH 13
+#define SYS_GETHEIGHT 14
+#define SYS_LINE 15
+#define SYS_FILLRECT 16
+#define SYS_FILLCIRCLE 17
+#define SYS_GFX_SUBMIT 18
+#define SYS_GETEVENT 19
+#define SYS_EXEC 20
+#define SYS_MAP_FRAMEBUFFER 21
+#define SYS_SBRK 22
+#define SYS_MMAP 23
+#define SYS_MUNMAP 24
+#define SYS_WAIT_VBLANK 25
+#define SYS_SERIAL_WRITE 26
+
+#define SYSCALL_MAX 64
+
+// Returned in RAX for unknown or unimplemented calls
+#define SYSCALL_ERROR ((uint64_t)-1)
+
+// Arguments arrive in RBX, RCX, RDX, RSI and RDI, the result goes back in RAX.
+// SYSCALL passes the second one in R10 instead, syscall_entry.asm moves it
+// into the frame's RCX slot.
+typedef uint64_t (*SyscallHandler)(uint64_t arg1, uint64_t arg2,
+                                   uint64_t arg3, uint64_t arg4,
+                                   uint64_t arg5);
+
+void syscall_init(void);
+// Enable SYSCALL on this CPU (syscall_init does the boot CPU)
+void syscall_init_cpu(void);
+// Run the call described by regs, from int 0x80 or syscall_entry.asm
+void syscall_dispatch(Registers *regs);
+void syscall_register(uint32_t num, SyscallHandler handler);
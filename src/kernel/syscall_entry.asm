@@ -0,0 +1,128 @@
+[bits 64]
+
+; SYSCALL entry. The CPU leaves the user RIP in RCX and RFLAGS in R11 and
+; masks interrupts (SFMASK); RSP is still the user stack. This builds the
+; same Registers frame int 0x80 would, on the task's kernel stack, so
+; syscall_dispatch and the scheduler only ever see one layout.
+
+; cpu_t offsets, must match smp.h
+CPU_SYSCALL_RSP equ 40
+CPU_USER_RSP equ 48
+
+USER_CS equ 0x23
+USER_SS equ 0x1B
+SYSCALL_VECTOR equ 0x80
+
+; Defined in syscall.c
+extern syscall_dispatch
+
+global syscall_entry
+global user_enter
+
+section .text
+
+syscall_entry:
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_SYSCALL_RSP]
+
+    ; What the processor would have pushed for an interrupt
+    push qword USER_SS
+    push qword [gs:CPU_USER_RSP]
+    push r11                    ; RFLAGS
+    push qword USER_CS
+    push rcx                    ; RIP
+    push qword 0                ; Error code
+    push qword SYSCALL_VECTOR   ; Interrupt number
+
+    push rax
+    push rbx
+    push r10                    ; Second argument, in the RCX slot
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    ; The frame is complete, so the call can be interrupted (or preempted)
+    sti
+    mov rdi, rsp
+    mov rbp, rsp
+    and rsp, ~0xF
+    call syscall_dispatch
+    mov rsp, rbp
+    cli
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 16
+
+    ; SYSRET faults in ring 0 on a non-canonical RIP, so a frame that no
+    ; longer returns to plain user code goes back through iretq instead
+    mov rcx, [rsp]
+    mov r11, rcx
+    shr r11, 47
+    jnz .iret
+    cmp qword [rsp + 8], USER_CS
+    jne .iret
+
+    mov r11, [rsp + 16]
+    mov rsp, [rsp + 24]
+    swapgs
+    o64 sysret
+
+.iret:
+    test qword [rsp + 8], 3
+    jz .kernel
+    swapgs
+.kernel:
+    iretq
+
+; First entry into a program: rdi = RIP, rsi = user RSP. Starts it with
+; interrupts on and every other register zero, so nothing from the kernel
+; leaks into ring 3.
+user_enter:
+    cli
+    push qword USER_SS
+    push rsi
+    push qword 0x202            ; IF
+    push qword USER_CS
+    push rdi
+
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    xor r8, r8
+    xor r9, r9
+    xor r10, r10
+    xor r11, r11
+    xor r12, r12
+    xor r13, r13
+    xor r14, r14
+    xor r15, r15
+    swapgs
+    iretq
@@ -0,0 +1,61 @@
+#include "tasklet.h"
+#include "sched.h"
+
+// Scheduled tasklets sit on a lock-free stack: any CPU pushes with a CAS,
+// the worker takes the whole stack with one exchange and runs it oldest
+// first.
+static tasklet_t *volatile pending = 0;
+static task_t *worker = 0;
+static volatile uint64_t runs = 0;
+
+void tasklet_schedule(tasklet_t *t) {
+  if (__atomic_exchange_n(&t->queued, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  tasklet_t *head = __atomic_load_n(&pending, __ATOMIC_RELAXED);
+  do {
+    t->next = head;
+  } while (!__atomic_compare_exchange_n(&pending, &head, t, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  task_t *w = __atomic_load_n(&worker, __ATOMIC_ACQUIRE);
+  if (w)
+    sched_wake(w);
+}
+
+static void worker_main(void *arg) {
+  (void)arg;
+  for (;;) {
+    tasklet_t *list = __atomic_exchange_n(&pending, 0, __ATOMIC_ACQUIRE);
+    if (!list) {
+      // A schedule after the exchange leaves a wake-up pending, so this
+      // returns at once rather than missing it
+      sched_block();
+      continue;
+    }
+
+    // Pushed newest first, run them in the order they came in
+    tasklet_t *ordered = 0;
+    while (list) {
+      tasklet_t *next = list->next;
+      list->next = ordered;
+      ordered = list;
+      list = next;
+    }
+
+    while (ordered) {
+      tasklet_t *t = ordered;
+      ordered = t->next;
+      __atomic_store_n(&t->queued, 0, __ATOMIC_RELEASE);
+      t->fn(t->arg);
+      runs++;
+    }
+  }
+}
+
+void tasklet_init(void) {
+  task_t *task = task_create("tasklet", worker_main, 0);
+  __atomic_store_n(&worker, task, __ATOMIC_RELEASE);
+}
+
+uint64_t tasklet_run_count(void) { return runs; }
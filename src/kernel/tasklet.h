@@ -0,0 +1,25 @@
+#pragma once
+#include "stdint.h"
+
+// Deferred interrupt work. An interrupt handler does the minimum (read the
+// device, queue the data) and schedules a tasklet; the tasklet worker runs
+// it later as an ordinary task, with interrupts on and preemptible, so a
+// long bottom half never holds off other devices.
+typedef struct tasklet {
+  struct tasklet *next;
+  void (*fn)(void *arg);
+  void *arg;
+  volatile uint32_t queued; // Set from schedule until fn starts
+} tasklet_t;
+
+#define TASKLET_INIT(fn, arg) {0, (fn), (arg), 0}
+
+// Start the worker, once sched_init() has run. Tasklets scheduled before
+// that wait for it.
+void tasklet_init(void);
+
+// Queue t to run once, from any context. Scheduling it again before fn
+// has started is a no-op; scheduling it from fn runs it again.
+void tasklet_schedule(tasklet_t *t);
+
+uint64_t tasklet_run_count(void);
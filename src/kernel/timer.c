@@ -0,0 +1,257 @@
+#include "timer.h"
+#include "boottime.h"
+#include "idle.h"
+#include "isr.h"
+#include "spinlock.h"
+
+// The TSC is the clock: it is read without a port access or interrupt and
+// converted to nanoseconds with one multiply. The PIT only measures its
+// rate at boot and then runs in one-shot mode, programmed for the earliest
+// pending deadline (at most ~55ms ahead, longer waits re-arm on the way).
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61 // Channel 2 gate (bit 0) and output (bit 5)
+
+#define PIT_MODE0_CH0 0x30 // Channel 0, lo/hi byte, interrupt on terminal count
+#define PIT_MODE0_CH2 0xB0 // Channel 2, lo/hi byte, interrupt on terminal count
+
+#define TIMER_IRQ_VECTOR 32
+
+// Calibration runs, the shortest one wins (SMIs and emulator exits only
+// ever make a run longer)
+#define CALIBRATE_MS 10
+#define CALIBRATE_RUNS 3
+
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_base = 0;
+static uint64_t ns_mult = 0; // Nanoseconds per cycle, 32.32 fixed point
+
+// Any CPU arms and cancels timers while the one that takes IRQ0 runs
+// them, the lock covers the heap and the PIT's lo/hi byte writes
+static spinlock_t lock = SPINLOCK_INIT;
+static ktimer_t *heap[TIMER_MAX];
+static int heap_count = 0;
+static uint64_t timer_irqs = 0;
+static volatile uint64_t next_deadline = ~0ULL; // As last programmed
+
+// Helpers for port I/O
+static inline void outb(uint16_t port, uint8_t val) {
+  __asm__ volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+  uint8_t ret;
+  __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+  return ret;
+}
+
+static inline uint64_t irq_save(void) {
+  uint64_t flags;
+  __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+  return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+  __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+// Cycles taken by one PIT channel 2 countdown of CALIBRATE_MS, 0 if the
+// PIT never finished (no PIT, or it is not wired up)
+static uint64_t calibrate_once(void) {
+  uint16_t count = PIT_HZ / (1000 / CALIBRATE_MS);
+
+  // Gate on, speaker off
+  outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+  outb(PIT_COMMAND, PIT_MODE0_CH2);
+  outb(PIT_CHANNEL2, count & 0xFF);
+  outb(PIT_CHANNEL2, count >> 8);
+
+  // Counting starts with the high byte, the output rises at zero
+  uint64_t start = rdtsc();
+  for (uint32_t spins = 0; !(inb(PIT_GATE_PORT) & 0x20); spins++) {
+    if (spins > 10000000)
+      return 0;
+  }
+  return rdtsc() - start;
+}
+
+static uint64_t calibrate_tsc(void) {
+  uint64_t best = 0;
+  for (int i = 0; i < CALIBRATE_RUNS; i++) {
+    uint64_t cycles = calibrate_once();
+    if (cycles && (!best || cycles < best))
+      best = cycles;
+  }
+  return best * (1000 / CALIBRATE_MS);
+}
+
+uint64_t timer_tsc_hz(void) { return tsc_hz; }
+
+uint64_t timer_tsc_to_ns(uint64_t cycles) {
+  return (uint64_t)(((unsigned __int128)cycles * ns_mult) >> 32);
+}
+
+uint64_t timer_now_ns(void) { return timer_tsc_to_ns(rdtsc() - tsc_base); }
+
+// Program channel 0 to interrupt at the earliest deadline
+static void program_next(uint64_t now) {
+  next_deadline = heap_count ? heap[0]->deadline : ~0ULL;
+  if (!heap_count)
+    return;
+
+  uint64_t ticks = 1;
+  if (heap[0]->deadline > now) {
+    uint64_t delta = heap[0]->deadline - now;
+    if (delta > 60000000) // Beyond the 16-bit counter, wake up and re-arm
+      delta = 60000000;
+    ticks = (delta * PIT_HZ + 999999999) / 1000000000;
+  }
+  if (ticks > 0xFFFF)
+    ticks = 0xFFFF;
+  if (!ticks)
+    ticks = 1;
+
+  outb(PIT_COMMAND, PIT_MODE0_CH0);
+  outb(PIT_CHANNEL0, ticks & 0xFF);
+  outb(PIT_CHANNEL0, ticks >> 8);
+}
+
+// Binary min-heap on deadline, each timer knows its slot so it can be
+// removed from the middle
+static void heap_set(int i, ktimer_t *t) {
+  heap[i] = t;
+  t->slot = i + 1;
+}
+
+static void sift_up(int i) {
+  ktimer_t *t = heap[i];
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap[parent]->deadline <= t->deadline)
+      break;
+    heap_set(i, heap[parent]);
+    i = parent;
+  }
+  heap_set(i, t);
+}
+
+static void sift_down(int i) {
+  ktimer_t *t = heap[i];
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= heap_count)
+      break;
+    if (child + 1 < heap_count &&
+        heap[child + 1]->deadline < heap[child]->deadline)
+      child++;
+    if (t->deadline <= heap[child]->deadline)
+      break;
+    heap_set(i, heap[child]);
+    i = child;
+  }
+  heap_set(i, t);
+}
+
+static void heap_remove(ktimer_t *t) {
+  int i = t->slot - 1;
+  t->slot = 0;
+  ktimer_t *last = heap[--heap_count];
+  if (i == heap_count)
+    return;
+  heap_set(i, last);
+  sift_down(i);
+  sift_up(last->slot - 1);
+}
+
+bool timer_arm(ktimer_t *t, uint64_t deadline_ns, timer_callback_t fn,
+               void *arg) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (t->slot)
+    heap_remove(t);
+  if (heap_count == TIMER_MAX) {
+    spin_unlock_irqrestore(&lock, flags);
+    return false;
+  }
+
+  t->deadline = deadline_ns;
+  t->fn = fn;
+  t->arg = arg;
+  heap_set(heap_count, t);
+  sift_up(heap_count++);
+
+  // A new earliest deadline moves the hardware timer forward
+  if (heap[0] == t)
+    program_next(timer_now_ns());
+  spin_unlock_irqrestore(&lock, flags);
+  return true;
+}
+
+void timer_cancel(ktimer_t *t) {
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (t->slot)
+    heap_remove(t);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+int timer_pending(void) { return heap_count; }
+
+uint64_t timer_next_deadline(void) { return next_deadline; }
+
+uint64_t timer_irq_count(void) { return timer_irqs; }
+
+static void timer_irq(Registers *regs) {
+  (void)regs;
+  timer_irqs++;
+
+  // Callbacks may arm new timers, so they run without the lock. The timer
+  // itself may be gone once it is off the heap (a sleeper that gave up
+  // on it), only its callback and argument are used.
+  uint64_t flags = spin_lock_irqsave(&lock);
+  uint64_t now = timer_now_ns();
+  while (heap_count && heap[0]->deadline <= now) {
+    ktimer_t *t = heap[0];
+    timer_callback_t fn = t->fn;
+    void *arg = t->arg;
+    heap_remove(t);
+    spin_unlock_irqrestore(&lock, flags);
+    fn(arg);
+    flags = spin_lock_irqsave(&lock);
+    now = timer_now_ns();
+  }
+  program_next(now);
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+static void wake_flag(void *arg) { *(volatile bool *)arg = true; }
+
+void timer_sleep_until(uint64_t deadline_ns) {
+  volatile bool done = false;
+  ktimer_t t = {0};
+  if (deadline_ns <= timer_now_ns() ||
+      !timer_arm(&t, deadline_ns, wake_flag, (void *)&done))
+    return;
+
+  // idle_wait enables interrupts in the same instruction pair as it halts,
+  // so the wake-up can't slip in between the check and the halt
+  uint64_t flags = irq_save();
+  while (!done)
+    idle_wait();
+  irq_restore(flags);
+}
+
+void timer_sleep_ns(uint64_t ns) { timer_sleep_until(timer_now_ns() + ns); }
+
+void timer_init(void) {
+  tsc_hz = calibrate_tsc();
+  if (!tsc_hz)
+    tsc_hz = 1000000000ULL; // No PIT to measure against, assume 1GHz
+  ns_mult = (1000000000ULL << 32) / tsc_hz;
+  tsc_base = rdtsc();
+
+  // Stop the BIOS's periodic tick until the first timer is armed
+  outb(PIT_COMMAND, PIT_MODE0_CH0);
+  outb(PIT_CHANNEL0, 0xFF);
+  outb(PIT_CHANNEL0, 0xFF);
+  register_interrupt_handler(TIMER_IRQ_VECTOR, timer_irq);
+}
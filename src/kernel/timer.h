@@ -0,0 +1,43 @@
+#pragma once
+#include "stdint.h"
+
+// PIT input clock
+#define PIT_HZ 1193182
+
+// Pending one-shot timers at any one time
+#define TIMER_MAX 64
+
+typedef void (*timer_callback_t)(void *arg);
+
+// One-shot deadline timer. The caller owns the storage, it must stay valid
+// until the callback has run or the timer is cancelled.
+typedef struct {
+  uint64_t deadline; // Monotonic nanoseconds
+  timer_callback_t fn;
+  void *arg;
+  int slot; // Heap position + 1 while armed, 0 (zeroed) otherwise
+} ktimer_t;
+
+// Calibrate the TSC against the PIT and take over IRQ0
+void timer_init(void);
+
+// Monotonic clock, nanoseconds since timer_init
+uint64_t timer_now_ns(void);
+
+uint64_t timer_tsc_hz(void);
+uint64_t timer_tsc_to_ns(uint64_t cycles);
+
+// Run fn(arg) from the timer interrupt once deadline_ns has passed. False if
+// too many timers are pending. Re-arming an armed timer moves it.
+bool timer_arm(ktimer_t *t, uint64_t deadline_ns, timer_callback_t fn,
+               void *arg);
+void timer_cancel(ktimer_t *t);
+int timer_pending(void);
+// Earliest pending deadline, ~0 when none. Read without the timers' lock:
+// a cancelled timer may still show, so it can only be early.
+uint64_t timer_next_deadline(void);
+uint64_t timer_irq_count(void);
+
+// Halt until the deadline, interrupts must be enabled
+void timer_sleep_until(uint64_t deadline_ns);
+void timer_sleep_ns(uint64_t ns);
@@ -0,0 +1,186 @@
+#include "trace.h"
+#include "blk.h"
+#include "boottime.h"
+#include "log.h"
+#include "pmm.h"
+#include "sched.h"
+#include "serial.h"
+#include "smp.h"
+#include "string.h"
+#include "timer.h"
+
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+#define TRACE_RING_BYTES (TRACE_RING_SIZE * sizeof(trace_record_t))
+#define TRACE_RING_PAGES ((TRACE_RING_BYTES + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE)
+#define TRACE_LINE_MAX 128
+
+_Static_assert(sizeof(trace_record_t) == 32, "two records per cache line");
+
+uint32_t trace_mask = 0;
+
+// Each CPU's write position on a line of its own
+typedef struct {
+  uint64_t pos;
+} __attribute__((aligned(64))) trace_head_t;
+
+static trace_record_t *rings[SMP_MAX_CPUS];
+static trace_head_t heads[SMP_MAX_CPUS];
+
+static const struct {
+  const char *name;
+  uint32_t mask;
+} groups[] = {
+    {"irq", (1u << TRACE_IRQ_ENTRY) | (1u << TRACE_IRQ_EXIT)},
+    {"exception", 1u << TRACE_EXCEPTION},
+    {"pagefault", 1u << TRACE_PAGE_FAULT},
+    {"syscall", (1u << TRACE_SYSCALL_ENTRY) | (1u << TRACE_SYSCALL_EXIT)},
+    {"sched", 1u << TRACE_SCHED_SWITCH},
+    {"blk", (1u << TRACE_BLK_SUBMIT) | (1u << TRACE_BLK_COMPLETE)},
+    {"all", TRACE_ALL},
+};
+
+// Only the owning CPU writes a ring, but an interrupt can land between
+// claiming a slot and filling it, so the claim is an atomic add and the
+// record is marked complete last
+void trace_write(int event, uint64_t arg0, uint32_t arg1, uint32_t arg2) {
+  cpu_t *cpu = this_cpu();
+  trace_record_t *ring = rings[cpu->index];
+  if (!ring)
+    return;
+
+  uint64_t pos =
+      __atomic_fetch_add(&heads[cpu->index].pos, 1, __ATOMIC_RELAXED);
+  trace_record_t *r = &ring[pos & TRACE_RING_MASK];
+  __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  r->tsc = rdtsc();
+  r->event = (uint16_t)event;
+  r->cpu = (uint16_t)cpu->index;
+  r->arg0 = arg0;
+  r->arg1 = arg1;
+  r->arg2 = arg2;
+  __atomic_store_n(&r->seq, (uint32_t)pos + 1, __ATOMIC_RELEASE);
+}
+
+bool trace_start(uint32_t mask) {
+  trace_stop();
+  for (int i = 0; i < smp_cpu_count(); i++) {
+    if (!rings[i]) {
+      uint64_t base = pmm_alloc_pages(TRACE_RING_PAGES);
+      if (!base)
+        return false;
+      rings[i] = (trace_record_t *)(uintptr_t)base;
+    }
+    memset(rings[i], 0, TRACE_RING_BYTES);
+    heads[i].pos = 0;
+  }
+  __atomic_store_n(&trace_mask, mask & TRACE_ALL, __ATOMIC_RELEASE);
+  return true;
+}
+
+void trace_stop(void) { __atomic_store_n(&trace_mask, 0, __ATOMIC_RELEASE); }
+
+uint32_t trace_group(const char *name) {
+  for (uint32_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++)
+    if (strcmp(name, groups[i].name) == 0)
+      return groups[i].mask;
+  return 0;
+}
+
+uint64_t trace_count(int cpu) {
+  if (cpu < 0 || cpu >= SMP_MAX_CPUS)
+    return 0;
+  return __atomic_load_n(&heads[cpu].pos, __ATOMIC_ACQUIRE);
+}
+
+// The record at pos in cpu's ring, if it is complete and not overwritten
+static const trace_record_t *record_at(int cpu, uint64_t pos) {
+  const trace_record_t *r = &rings[cpu][pos & TRACE_RING_MASK];
+  return __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) == (uint32_t)pos + 1 ? r
+                                                                          : 0;
+}
+
+static int format(char *buf, const trace_record_t *r, uint64_t ns) {
+  int n = ksnprintf(buf, TRACE_LINE_MAX, "trace: %llu.%03llu cpu%u ",
+                    ns / 1000, ns % 1000, r->cpu);
+  char *p = buf + n;
+  uint64_t left = TRACE_LINE_MAX - n;
+  switch (r->event) {
+  case TRACE_IRQ_ENTRY:
+    return n + ksnprintf(p, left, "irq_entry vector=%u rip=%llx\n", r->arg1,
+                         r->arg0);
+  case TRACE_IRQ_EXIT:
+    return n + ksnprintf(p, left, "irq_exit vector=%u\n", r->arg1);
+  case TRACE_EXCEPTION:
+    return n + ksnprintf(p, left, "exception vector=%u err=%x rip=%llx\n",
+                         r->arg1, r->arg2, r->arg0);
+  case TRACE_PAGE_FAULT:
+    return n + ksnprintf(p, left, "page_fault addr=%llx err=%x\n", r->arg0,
+                         r->arg1);
+  case TRACE_SYSCALL_ENTRY:
+    return n + ksnprintf(p, left, "syscall_entry nr=%u arg=%llx\n", r->arg1,
+                         r->arg0);
+  case TRACE_SYSCALL_EXIT:
+    return n + ksnprintf(p, left, "syscall_exit nr=%u ret=%llx\n", r->arg1,
+                         r->arg0);
+  case TRACE_SCHED_SWITCH:
+    return n + ksnprintf(p, left, "sched_switch prev=%u state=%llu next=%u\n",
+                         r->arg1, r->arg0, r->arg2);
+  case TRACE_BLK_SUBMIT:
+    return n + ksnprintf(p, left, "blk_submit lba=%llu sectors=%u %s\n",
+                         r->arg0, r->arg1,
+                         r->arg2 == BLK_WRITE ? "write" : "read");
+  case TRACE_BLK_COMPLETE:
+    return n + ksnprintf(p, left, "blk_complete lba=%llu sectors=%u status=%d\n",
+                         r->arg0, r->arg1, (int)r->arg2);
+  default:
+    return n + ksnprintf(p, left, "event%u\n", r->event);
+  }
+}
+
+// trace: <us since the first record> cpu<n> <event> <fields>
+int trace_dump(void) {
+  trace_stop();
+
+  // A cursor per CPU, and each round takes the earliest record under
+  // any of them. The TSCs are synchronised, so this is the order the
+  // events happened in.
+  uint64_t cursor[SMP_MAX_CPUS], end[SMP_MAX_CPUS];
+  int cpus = smp_cpu_count();
+  for (int cpu = 0; cpu < cpus; cpu++) {
+    end[cpu] = rings[cpu] ? trace_count(cpu) : 0;
+    cursor[cpu] = end[cpu] > TRACE_RING_SIZE ? end[cpu] - TRACE_RING_SIZE : 0;
+  }
+
+  int lines = 0;
+  uint64_t first_tsc = 0;
+  char line[TRACE_LINE_MAX];
+  for (;;) {
+    int best = -1;
+    const trace_record_t *next = 0;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+      const trace_record_t *r = 0;
+      while (cursor[cpu] < end[cpu] && !(r = record_at(cpu, cursor[cpu])))
+        cursor[cpu]++;
+      if (r && (!next || r->tsc < next->tsc)) {
+        next = r;
+        best = cpu;
+      }
+    }
+    if (!next)
+      break;
+    cursor[best]++;
+
+    if (!lines)
+      first_tsc = next->tsc;
+    int len = format(line, next, timer_tsc_to_ns(next->tsc - first_tsc));
+    if (len >= TRACE_LINE_MAX)
+      len = TRACE_LINE_MAX - 1;
+    // The TX ring drops what doesn't fit, so let the UART catch up
+    while (serial_pending() + TRACE_LINE_MAX > SERIAL_TX_RING)
+      sched_yield();
+    serial_write(line, len);
+    lines++;
+  }
+  return lines;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "stdint.h"
+
+// Event tracer. Tracepoints are compiled in at fixed places (interrupts,
+// exceptions, syscalls, context switches, block I/O) and each one that is
+// enabled appends a TSC-stamped record to its CPU's ring, overwriting the
+// oldest. A disabled tracepoint is one load of trace_mask and a branch
+// that is predicted not taken. The rings from all CPUs, merged by time,
+// give the order things happened in around a latency spike.
+#define TRACE_RING_SIZE 8192 // Records per CPU, power of two
+
+// Events, one trace_mask bit each
+#define TRACE_IRQ_ENTRY 0     // arg0 rip, arg1 vector
+#define TRACE_IRQ_EXIT 1      // arg1 vector
+#define TRACE_EXCEPTION 2     // arg0 rip, arg1 vector, arg2 error code
+#define TRACE_PAGE_FAULT 3    // arg0 address, arg1 error code
+#define TRACE_SYSCALL_ENTRY 4 // arg0 first argument, arg1 number
+#define TRACE_SYSCALL_EXIT 5  // arg0 result, arg1 number
+#define TRACE_SCHED_SWITCH 6  // arg0 prev state, arg1 prev id, arg2 next id
+#define TRACE_BLK_SUBMIT 7    // arg0 lba, arg1 sectors, arg2 op
+#define TRACE_BLK_COMPLETE 8  // arg0 lba, arg1 sectors, arg2 status
+#define TRACE_EVENTS 9
+
+#define TRACE_ALL ((1u << TRACE_EVENTS) - 1)
+
+typedef struct {
+  uint64_t tsc;
+  uint32_t seq; // Low bits of position + 1 once written, 0 while written
+  uint16_t event;
+  uint16_t cpu;
+  uint64_t arg0;
+  uint32_t arg1;
+  uint32_t arg2;
+} trace_record_t;
+
+extern uint32_t trace_mask;
+
+void trace_write(int event, uint64_t arg0, uint32_t arg1, uint32_t arg2);
+
+#define TRACE(event, arg0, arg1, arg2)                                         \
+  do {                                                                         \
+    if (__builtin_expect(trace_mask & (1u << (event)), 0))                     \
+      trace_write(event, arg0, arg1, arg2);                                    \
+  } while (0)
+
+// Clear the rings and enable the events in mask, false if the rings
+// can't be allocated
+bool trace_start(uint32_t mask);
+void trace_stop(void);
+
+// Mask bits for a group name: irq, exception, pagefault, syscall, sched,
+// blk or all. 0 for anything else.
+uint32_t trace_group(const char *name);
+
+// Records written on a CPU since the start; the newest TRACE_RING_SIZE
+// of them are still in its ring
+uint64_t trace_count(int cpu);
+
+// Stop tracing and write every buffered record from all CPUs, oldest
+// first, as a "trace:" line to COM1. Returns the lines written.
+int trace_dump(void);
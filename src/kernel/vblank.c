@@ -0,0 +1,126 @@
+#include "vblank.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define VGA_INPUT_STATUS 0x3DA
+#define VGA_RETRACE 0x08
+
+#define PROBE_NS 100000000ULL  // Long enough for a few refreshes at 30Hz
+#define PROBE_EDGES 4
+#define MIN_PERIOD_NS 5000000  // 200Hz
+#define MAX_PERIOD_NS 40000000 // 25Hz
+// Waits on the VGA sleep until this long before the predicted edge and
+// poll from there
+#define EARLY_NS 1000000ULL
+
+#define PROBE_NONE 0
+#define PROBE_RUNNING 1
+#define PROBE_DONE 2
+
+static inline uint8_t inb(uint16_t port) {
+  uint8_t ret;
+  __asm__ volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+  return ret;
+}
+
+static spinlock_t lock = SPINLOCK_INIT;
+// Vblank n begins at epoch + n * period
+static uint64_t epoch = 0;
+static uint64_t period = 1000000000ULL / VBLANK_DEFAULT_HZ;
+static uint32_t source = VBLANK_SOURCE_TIMER;
+static volatile int probe_state = PROBE_NONE;
+
+static inline bool in_retrace(void) {
+  return (inb(VGA_INPUT_STATUS) & VGA_RETRACE) != 0;
+}
+
+// Time the retrace edges for a while. A real one is set for a small part
+// of evenly spaced periods; a bit that changes on most reads, or never,
+// isn't one.
+static void probe(void) {
+  uint64_t edges[PROBE_EDGES];
+  int count = 0;
+  uint64_t reads = 0, changes = 0;
+  bool was = in_retrace();
+  uint64_t start = timer_now_ns();
+  while (count < PROBE_EDGES && timer_now_ns() - start < PROBE_NS) {
+    bool now = in_retrace();
+    reads++;
+    if (now != was) {
+      changes++;
+      if (now)
+        edges[count++] = timer_now_ns();
+    }
+    was = now;
+  }
+  if (count < PROBE_EDGES || changes * 8 > reads)
+    return;
+
+  uint64_t first = edges[1] - edges[0];
+  for (int i = 2; i < PROBE_EDGES; i++) {
+    uint64_t p = edges[i] - edges[i - 1];
+    if (p > first + first / 50 || p + first / 50 < first)
+      return;
+  }
+  uint64_t measured = (edges[PROBE_EDGES - 1] - edges[0]) / (PROBE_EDGES - 1);
+  if (measured < MIN_PERIOD_NS || measured > MAX_PERIOD_NS)
+    return;
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  period = measured;
+  epoch = edges[PROBE_EDGES - 1] % measured;
+  source = VBLANK_SOURCE_VGA;
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+// Poll for the leading edge of a retrace until the deadline, its time or 0
+static uint64_t wait_edge(uint64_t deadline) {
+  bool was = in_retrace();
+  uint64_t now;
+  while ((now = timer_now_ns()) < deadline) {
+    bool set = in_retrace();
+    if (set && !was)
+      return now;
+    was = set;
+    __asm__ volatile("pause");
+  }
+  return 0;
+}
+
+void vblank_wait(vblank_info_t *info) {
+  int expected = PROBE_NONE;
+  if (__atomic_compare_exchange_n(&probe_state, &expected, PROBE_RUNNING,
+                                  false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    probe();
+    __atomic_store_n(&probe_state, PROBE_DONE, __ATOMIC_RELEASE);
+  }
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  uint64_t base = epoch, step = period;
+  uint32_t from = source;
+  spin_unlock_irqrestore(&lock, flags);
+
+  uint64_t now = timer_now_ns();
+  uint64_t seq = (now - base) / step + 1;
+  uint64_t when = base + seq * step;
+
+  if (from == VBLANK_SOURCE_VGA) {
+    timer_sleep_until(when - EARLY_NS);
+    uint64_t edge = wait_edge(when + step / 4);
+    if (edge) {
+      // Follow the display's phase, the clocks drift apart slowly
+      when = edge;
+      flags = spin_lock_irqsave(&lock);
+      epoch = edge - seq * step;
+      spin_unlock_irqrestore(&lock, flags);
+    }
+  } else {
+    timer_sleep_until(when);
+  }
+
+  info->seq = seq;
+  info->time_ns = when;
+  info->period_ns = step;
+  info->source = from;
+  info->reserved = 0;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "stdint.h"
+
+// Vertical blank pacing for SYS_WAIT_VBLANK. The first wait checks whether
+// the VGA input status register (port 0x3DA) follows a real retrace; if it
+// does, waits end on its leading edge and the refresh period is measured
+// from it. Emulated VGAs that flip the bit on every read, and machines
+// without one, get vblanks from the monotonic clock at VBLANK_DEFAULT_HZ.
+#define VBLANK_SOURCE_TIMER 0
+#define VBLANK_SOURCE_VGA 1
+
+#define VBLANK_DEFAULT_HZ 60
+
+// Matches sdk/include/nbos.h
+typedef struct {
+  uint64_t seq;       // Vblanks since boot
+  uint64_t time_ns;   // timer_now_ns() when this one began
+  uint64_t period_ns; // Refresh period
+  uint32_t source;    // VBLANK_SOURCE_*
+  uint32_t reserved;
+} vblank_info_t;
+
+// Sleep until the next vblank begins and describe it. Interrupts must be
+// enabled.
+void vblank_wait(vblank_info_t *info);
@@ -0,0 +1,590 @@
+#include "display.h"
+#include "paging.h"
+#include "pci.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "string.h"
+#include "timer.h"
+
+// virtio-gpu over the virtio 1.0 PCI transport. The screen is a 2D
+// resource on the host, backed by guest pages at VMAP_DISPLAY: drawing
+// goes to those pages, TRANSFER_TO_HOST_2D copies a rectangle of them into
+// the resource and RESOURCE_FLUSH puts it on the display, so a present
+// costs the damage rather than the screen. The host only shows what was
+// flushed, which already makes presents tear-free; flipping to a second
+// resource would add a full redraw on the host for every SET_SCANOUT.
+//
+// Commands go on the control queue in batches and are polled for. They
+// complete in microseconds, and a present has to wait for its transfers
+// before the pages may change again anyway.
+#define VIRTIO_VENDOR 0x1AF4
+#define VIRTIO_GPU_DEVICE 0x1050 // 0x1040 + device type 16
+
+// Vendor capabilities locate the register blocks
+#define CAP_TYPE 3
+#define CAP_BAR 4
+#define CAP_OFFSET 8
+#define CAP_LENGTH 12
+#define CAP_NOTIFY_MULTIPLIER 16
+
+#define CFG_COMMON 1
+#define CFG_NOTIFY 2
+
+// Common configuration registers
+#define COMMON_DEVICE_FEATURE_SELECT 0x00
+#define COMMON_DEVICE_FEATURE 0x04
+#define COMMON_DRIVER_FEATURE_SELECT 0x08
+#define COMMON_DRIVER_FEATURE 0x0C
+#define COMMON_STATUS 0x14
+#define COMMON_QUEUE_SELECT 0x16
+#define COMMON_QUEUE_SIZE 0x18
+#define COMMON_QUEUE_ENABLE 0x1C
+#define COMMON_QUEUE_NOTIFY_OFF 0x1E
+#define COMMON_QUEUE_DESC 0x20
+#define COMMON_QUEUE_DRIVER 0x28
+#define COMMON_QUEUE_DEVICE 0x30
+
+#define STATUS_ACKNOWLEDGE 0x01
+#define STATUS_DRIVER 0x02
+#define STATUS_DRIVER_OK 0x04
+#define STATUS_FEATURES_OK 0x08
+#define STATUS_FAILED 0x80
+
+#define FEATURE_VERSION_1 (1u << 0) // Bit 32, in the second feature word
+
+// Control queue: QUEUE_SIZE descriptors, two per command (request, then
+// the response the device writes), in one page
+#define QUEUE_SIZE 64
+#define QUEUE_CMDS (QUEUE_SIZE / 2)
+#define QUEUE_AVAIL_OFFSET 1024
+#define QUEUE_USED_OFFSET 2048
+
+#define DESC_F_NEXT 1
+#define DESC_F_WRITE 2
+#define AVAIL_F_NO_INTERRUPT 1
+
+// Each command gets a 128 byte slot of the command page, response last
+#define SLOT_SIZE 128
+#define SLOT_RESPONSE 96
+
+#define VIRTIO_GPU_TIMEOUT_NS 1000000000ULL
+
+// Command and response types
+#define CMD_GET_DISPLAY_INFO 0x0100
+#define CMD_RESOURCE_CREATE_2D 0x0101
+#define CMD_RESOURCE_UNREF 0x0102
+#define CMD_SET_SCANOUT 0x0103
+#define CMD_RESOURCE_FLUSH 0x0104
+#define CMD_TRANSFER_TO_HOST_2D 0x0105
+#define CMD_RESOURCE_ATTACH_BACKING 0x0106
+#define CMD_RESOURCE_DETACH_BACKING 0x0107
+#define RESP_OK_NODATA 0x1100
+#define RESP_OK_DISPLAY_INFO 0x1101
+#define RESP_ERR_FIRST 0x1200
+
+#define FORMAT_B8G8R8X8 2 // 0x00RRGGBB as a little-endian word
+#define MAX_SCANOUTS 16
+#define MAX_DIMENSION 8192
+#define DEFAULT_WIDTH 1024
+#define DEFAULT_HEIGHT 768
+
+typedef struct {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  uint16_t ring[QUEUE_SIZE];
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct {
+  uint16_t flags;
+  uint16_t idx;
+  struct {
+    uint32_t id;
+    uint32_t len;
+  } ring[QUEUE_SIZE];
+} __attribute__((packed)) virtq_used_t;
+
+typedef struct {
+  uint32_t type;
+  uint32_t flags;
+  uint64_t fence_id;
+  uint32_t ctx_id;
+  uint32_t padding;
+} __attribute__((packed)) gpu_hdr_t;
+
+typedef struct {
+  uint32_t x, y, width, height;
+} __attribute__((packed)) gpu_rect_t;
+
+typedef struct {
+  gpu_hdr_t hdr;
+  uint32_t resource_id;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+} __attribute__((packed)) cmd_create_2d_t;
+
+// UNREF and DETACH_BACKING
+typedef struct {
+  gpu_hdr_t hdr;
+  uint32_t resource_id;
+  uint32_t padding;
+} __attribute__((packed)) cmd_resource_t;
+
+typedef struct {
+  gpu_hdr_t hdr;
+  gpu_rect_t r;
+  uint32_t scanout_id;
+  uint32_t resource_id;
+} __attribute__((packed)) cmd_set_scanout_t;
+
+typedef struct {
+  gpu_hdr_t hdr;
+  gpu_rect_t r;
+  uint32_t resource_id;
+  uint32_t padding;
+} __attribute__((packed)) cmd_flush_t;
+
+typedef struct {
+  gpu_hdr_t hdr;
+  gpu_rect_t r;
+  uint64_t offset;
+  uint32_t resource_id;
+  uint32_t padding;
+} __attribute__((packed)) cmd_transfer_t;
+
+typedef struct {
+  gpu_hdr_t hdr;
+  uint32_t resource_id;
+  uint32_t nr_entries;
+  struct {
+    uint64_t addr;
+    uint32_t length;
+    uint32_t padding;
+  } entries[];
+} __attribute__((packed)) cmd_attach_t;
+
+typedef struct {
+  gpu_hdr_t hdr;
+  struct {
+    gpu_rect_t r;
+    uint32_t enabled;
+    uint32_t flags;
+  } pmodes[MAX_SCANOUTS];
+} __attribute__((packed)) resp_display_info_t;
+
+static volatile uint8_t *common;
+static volatile uint16_t *doorbell; // The control queue's notify register
+static virtq_desc_t *desc;
+static volatile virtq_avail_t *avail;
+static volatile virtq_used_t *used;
+static uint8_t *slots; // QUEUE_CMDS command slots, identity mapped
+static volatile gpu_hdr_t *responses[QUEUE_CMDS];
+static int queued; // Commands on the queue since the last kick
+static bool probed, failed;
+static spinlock_t lock = SPINLOCK_INIT;
+
+static uint32_t preferred_width = DEFAULT_WIDTH;
+static uint32_t preferred_height = DEFAULT_HEIGHT;
+
+// The scanout's resource and its backing, 0 before the first mode
+static uint32_t resource;
+static uint32_t next_resource = 1;
+static uint32_t pitch;
+static uint64_t backing_size;
+
+static inline void common_write8(uint32_t reg, uint8_t value) {
+  *(volatile uint8_t *)(common + reg) = value;
+}
+
+static inline void common_write16(uint32_t reg, uint16_t value) {
+  *(volatile uint16_t *)(common + reg) = value;
+}
+
+static inline void common_write32(uint32_t reg, uint32_t value) {
+  *(volatile uint32_t *)(common + reg) = value;
+}
+
+static inline void common_write64(uint32_t reg, uint64_t value) {
+  common_write32(reg, (uint32_t)value);
+  common_write32(reg + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint8_t common_read8(uint32_t reg) {
+  return *(volatile uint8_t *)(common + reg);
+}
+
+static inline uint16_t common_read16(uint32_t reg) {
+  return *(volatile uint16_t *)(common + reg);
+}
+
+static inline uint32_t common_read32(uint32_t reg) {
+  return *(volatile uint32_t *)(common + reg);
+}
+
+// Give up on the device: a reset stops it using the queue, and nothing is
+// sent from here on
+static void fail(void) {
+  failed = true;
+  queued = 0;
+  if (common)
+    common_write8(COMMON_STATUS, 0);
+}
+
+// Put a request and its response buffer (identity mapped) on the queue,
+// the device sees them at the next kick
+static void queue_buffers(void *request, uint32_t request_len,
+                          volatile void *response, uint32_t response_len) {
+  int i = queued++;
+  virtq_desc_t *d = &desc[2 * i];
+  d[0].addr = (uint64_t)(uintptr_t)request;
+  d[0].len = request_len;
+  d[0].flags = DESC_F_NEXT;
+  d[0].next = 2 * i + 1;
+  d[1].addr = (uint64_t)(uintptr_t)response;
+  d[1].len = response_len;
+  d[1].flags = DESC_F_WRITE;
+  d[1].next = 0;
+  avail->ring[(uint16_t)(avail->idx + i) % QUEUE_SIZE] = 2 * i;
+  responses[i] = (volatile gpu_hdr_t *)response;
+}
+
+// Send the queued commands and wait for all of them. False if one failed;
+// a device that stops answering is reset and left alone.
+static bool kick(void) {
+  if (failed)
+    return false;
+  if (!queued)
+    return true;
+
+  uint16_t target = avail->idx + queued;
+  __asm__ volatile("" ::: "memory"); // Ring entries before the index
+  avail->idx = target;
+  __asm__ volatile("mfence" ::: "memory");
+  *doorbell = 0;
+
+  uint64_t deadline = timer_now_ns() + VIRTIO_GPU_TIMEOUT_NS;
+  while (used->idx != target) {
+    if (timer_now_ns() > deadline) {
+      fail();
+      return false;
+    }
+    __asm__ volatile("pause");
+  }
+
+  bool ok = true;
+  for (int i = 0; i < queued; i++)
+    if (responses[i]->type < RESP_OK_NODATA ||
+        responses[i]->type >= RESP_ERR_FIRST)
+      ok = false;
+  queued = 0;
+  return ok;
+}
+
+// A zeroed request of size bytes in the next free slot, with its type set.
+// It goes out with the next kick.
+static void *command(uint32_t type, uint32_t size) {
+  if (queued == QUEUE_CMDS)
+    kick();
+  uint8_t *slot = slots + queued * SLOT_SIZE;
+  memset(slot, 0, SLOT_SIZE);
+  ((gpu_hdr_t *)slot)->type = type;
+  queue_buffers(slot, size, slot + SLOT_RESPONSE, sizeof(gpu_hdr_t));
+  return slot;
+}
+
+static void set_scanout(uint32_t id, uint32_t w, uint32_t h) {
+  cmd_set_scanout_t *c = command(CMD_SET_SCANOUT, sizeof(*c));
+  c->r.width = w;
+  c->r.height = h;
+  c->scanout_id = 0;
+  c->resource_id = id;
+}
+
+static void transfer(const display_rect_t *r) {
+  cmd_transfer_t *c = command(CMD_TRANSFER_TO_HOST_2D, sizeof(*c));
+  c->r.x = r->x0;
+  c->r.y = r->y0;
+  c->r.width = r->x1 - r->x0;
+  c->r.height = r->y1 - r->y0;
+  c->offset = (uint64_t)r->y0 * pitch + (uint64_t)r->x0 * 4;
+  c->resource_id = resource;
+}
+
+static void flush(const display_rect_t *r) {
+  cmd_flush_t *c = command(CMD_RESOURCE_FLUSH, sizeof(*c));
+  c->r.x = r->x0;
+  c->r.y = r->y0;
+  c->r.width = r->x1 - r->x0;
+  c->r.height = r->y1 - r->y0;
+  c->resource_id = resource;
+}
+
+// Physically contiguous runs of the backing at VMAP_DISPLAY. With entries
+// NULL they are only counted.
+static uint32_t backing_runs(cmd_attach_t *attach) {
+  uint32_t count = 0;
+  uint64_t run_start = 0, run_end = 0;
+  for (uint64_t off = 0; off <= backing_size; off += PAGE_SIZE_4K) {
+    uint64_t phys = 0;
+    bool more = off < backing_size &&
+                paging_translate(VMAP_DISPLAY + off, &phys);
+    if (more && count && phys == run_end) {
+      run_end += PAGE_SIZE_4K;
+      continue;
+    }
+    if (run_end > run_start && attach) {
+      attach->entries[count - 1].addr = run_start;
+      attach->entries[count - 1].length = run_end - run_start;
+    }
+    if (!more)
+      break;
+    run_start = phys;
+    run_end = phys + PAGE_SIZE_4K;
+    count++;
+  }
+  return count;
+}
+
+// Hand the backing's pages to the resource in one command
+static bool attach_backing(void) {
+  uint32_t count = backing_runs(0);
+  uint64_t bytes = sizeof(cmd_attach_t) +
+                   count * sizeof(((cmd_attach_t *)0)->entries[0]) +
+                   sizeof(gpu_hdr_t);
+  uint64_t pages = (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+  uint64_t page = pmm_alloc_pages(pages);
+  if (!page)
+    return false;
+  cmd_attach_t *c = (cmd_attach_t *)(uintptr_t)page;
+  memset(c, 0, bytes);
+  c->hdr.type = CMD_RESOURCE_ATTACH_BACKING;
+  c->resource_id = resource;
+  c->nr_entries = count;
+  backing_runs(c);
+  gpu_hdr_t *response = (gpu_hdr_t *)((uint8_t *)c + bytes - sizeof(gpu_hdr_t));
+  queue_buffers(c, bytes - sizeof(gpu_hdr_t), response, sizeof(gpu_hdr_t));
+  bool ok = kick();
+  pmm_free_pages(page, pages);
+  return ok;
+}
+
+// Take the scanout's resource down and give its pages back
+static void release_resource(void) {
+  if (!resource)
+    return;
+  set_scanout(0, 0, 0);
+  cmd_resource_t *c = command(CMD_RESOURCE_DETACH_BACKING, sizeof(*c));
+  c->resource_id = resource;
+  c = command(CMD_RESOURCE_UNREF, sizeof(*c));
+  c->resource_id = resource;
+  kick();
+  resource = 0;
+  // Pages a device that stopped answering may still read can't be reused
+  if (!failed)
+    paging_free(VMAP_DISPLAY, backing_size);
+  backing_size = 0;
+}
+
+static bool vgpu_set_mode(uint32_t w, uint32_t h, uint32_t bpp,
+                          display_mode_t *mode) {
+  if (!w || !h) {
+    w = preferred_width;
+    h = preferred_height;
+  }
+  if (bpp != 32 || w > MAX_DIMENSION || h > MAX_DIMENSION)
+    return false;
+
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (failed) {
+    spin_unlock_irqrestore(&lock, flags);
+    return false;
+  }
+  release_resource();
+
+  uint64_t size = ((uint64_t)w * 4 * h + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+  bool ok = !failed && paging_alloc(VMAP_DISPLAY, size, PAGE_RW);
+  if (ok) {
+    backing_size = size;
+    pitch = w * 4;
+    memset((void *)(uintptr_t)VMAP_DISPLAY, 0, size);
+
+    resource = next_resource++;
+    cmd_create_2d_t *c = command(CMD_RESOURCE_CREATE_2D, sizeof(*c));
+    c->resource_id = resource;
+    c->format = FORMAT_B8G8R8X8;
+    c->width = w;
+    c->height = h;
+    ok = kick() && attach_backing();
+    if (ok) {
+      display_rect_t all = {0, 0, (int)w, (int)h};
+      set_scanout(resource, w, h);
+      transfer(&all);
+      flush(&all);
+      ok = kick();
+    }
+    if (!ok)
+      release_resource();
+  }
+  spin_unlock_irqrestore(&lock, flags);
+  if (!ok)
+    return false;
+
+  mode->width = w;
+  mode->height = h;
+  mode->pitch = pitch;
+  mode->bpp = 32;
+  mode->red_pos = 16;
+  mode->green_pos = 8;
+  mode->blue_pos = 0;
+  mode->red_size = mode->green_size = mode->blue_size = 8;
+  mode->buffers = 1;
+  for (int i = 0; i < DISPLAY_BUFFERS; i++)
+    mode->pixels[i] = (volatile uint8_t *)(uintptr_t)VMAP_DISPLAY;
+  return true;
+}
+
+// All the transfers first, then the flushes: the host runs the control
+// queue in order, so every rectangle is in the resource before any shows
+static void vgpu_flush(int buffer, const display_rect_t *rects, int count) {
+  (void)buffer;
+  uint64_t flags = spin_lock_irqsave(&lock);
+  if (resource && !failed) {
+    for (int i = 0; i < count; i++)
+      transfer(&rects[i]);
+    for (int i = 0; i < count; i++)
+      flush(&rects[i]);
+    kick();
+  }
+  spin_unlock_irqrestore(&lock, flags);
+}
+
+static const display_driver_t vgpu_driver = {
+    "virtio-gpu",
+    vgpu_set_mode,
+    0,
+    vgpu_flush,
+};
+
+// Map the register block a vendor capability points to
+static volatile uint8_t *map_capability(const pci_device_t *pci, uint8_t cap) {
+  bool io;
+  uint64_t bar = pci_bar(pci, pci_read8(pci, cap + CAP_BAR), &io);
+  if (!bar || io)
+    return 0;
+  uint64_t addr = bar + pci_read32(pci, cap + CAP_OFFSET);
+  uint64_t base = addr & ~(PAGE_SIZE_4K - 1);
+  uint64_t size = addr + pci_read32(pci, cap + CAP_LENGTH) - base;
+  if (!paging_map(base, base, size, PAGE_RW | PAGE_CACHE_UC))
+    return 0;
+  return (volatile uint8_t *)(uintptr_t)addr;
+}
+
+// Reset, negotiate VERSION_1 and nothing else, and set up the control queue
+static bool start(const pci_device_t *pci) {
+  volatile uint8_t *notify = 0;
+  uint32_t multiplier = 0;
+  for (uint8_t cap = pci_find_capability(pci, PCI_CAP_VENDOR); cap;
+       cap = pci_next_capability(pci, cap, PCI_CAP_VENDOR)) {
+    uint8_t type = pci_read8(pci, cap + CAP_TYPE);
+    if (type == CFG_COMMON && !common) {
+      common = map_capability(pci, cap);
+    } else if (type == CFG_NOTIFY && !notify) {
+      notify = map_capability(pci, cap);
+      multiplier = pci_read32(pci, cap + CAP_NOTIFY_MULTIPLIER);
+    }
+  }
+  if (!common || !notify)
+    return false;
+  pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+
+  common_write8(COMMON_STATUS, 0);
+  uint64_t deadline = timer_now_ns() + VIRTIO_GPU_TIMEOUT_NS;
+  while (common_read8(COMMON_STATUS))
+    if (timer_now_ns() > deadline)
+      return false;
+  common_write8(COMMON_STATUS, STATUS_ACKNOWLEDGE);
+  common_write8(COMMON_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+  common_write32(COMMON_DEVICE_FEATURE_SELECT, 1);
+  if (!(common_read32(COMMON_DEVICE_FEATURE) & FEATURE_VERSION_1))
+    return false;
+  common_write32(COMMON_DRIVER_FEATURE_SELECT, 0);
+  common_write32(COMMON_DRIVER_FEATURE, 0);
+  common_write32(COMMON_DRIVER_FEATURE_SELECT, 1);
+  common_write32(COMMON_DRIVER_FEATURE, FEATURE_VERSION_1);
+  common_write8(COMMON_STATUS,
+                STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_FEATURES_OK);
+  if (!(common_read8(COMMON_STATUS) & STATUS_FEATURES_OK))
+    return false;
+
+  common_write16(COMMON_QUEUE_SELECT, 0);
+  if (common_read16(COMMON_QUEUE_SIZE) < QUEUE_SIZE)
+    return false;
+  uint64_t ring = pmm_alloc_page();
+  uint64_t page = pmm_alloc_page();
+  if (!ring || !page)
+    return false;
+  memset((void *)(uintptr_t)ring, 0, PMM_PAGE_SIZE);
+  desc = (virtq_desc_t *)(uintptr_t)ring;
+  avail = (volatile virtq_avail_t *)(uintptr_t)(ring + QUEUE_AVAIL_OFFSET);
+  used = (volatile virtq_used_t *)(uintptr_t)(ring + QUEUE_USED_OFFSET);
+  slots = (uint8_t *)(uintptr_t)page;
+  // Completions are polled for, so the device needn't interrupt
+  avail->flags = AVAIL_F_NO_INTERRUPT;
+
+  common_write16(COMMON_QUEUE_SIZE, QUEUE_SIZE);
+  common_write64(COMMON_QUEUE_DESC, ring);
+  common_write64(COMMON_QUEUE_DRIVER, ring + QUEUE_AVAIL_OFFSET);
+  common_write64(COMMON_QUEUE_DEVICE, ring + QUEUE_USED_OFFSET);
+  doorbell = (volatile uint16_t *)(notify +
+                                   common_read16(COMMON_QUEUE_NOTIFY_OFF) *
+                                       multiplier);
+  common_write16(COMMON_QUEUE_ENABLE, 1);
+  common_write8(COMMON_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER |
+                                   STATUS_FEATURES_OK | STATUS_DRIVER_OK);
+  return true;
+}
+
+// The host window's size is the preferred mode
+static void read_display_info(void) {
+  uint64_t page = pmm_alloc_page();
+  if (!page)
+    return;
+  gpu_hdr_t *request = (gpu_hdr_t *)(uintptr_t)page;
+  resp_display_info_t *info = (resp_display_info_t *)(request + 1);
+  memset(request, 0, sizeof(*request) + sizeof(*info));
+  request->type = CMD_GET_DISPLAY_INFO;
+  queue_buffers(request, sizeof(*request), info, sizeof(*info));
+  if (kick() && info->hdr.type == RESP_OK_DISPLAY_INFO &&
+      info->pmodes[0].enabled && info->pmodes[0].r.width &&
+      info->pmodes[0].r.height) {
+    preferred_width = info->pmodes[0].r.width;
+    preferred_height = info->pmodes[0].r.height;
+  }
+  pmm_free_page(page);
+}
+
+const display_driver_t *virtio_gpu_probe(bool vga_only) {
+  const pci_device_t *pci =
+      pci_find_device(VIRTIO_VENDOR, VIRTIO_GPU_DEVICE, 0);
+  if (!pci || (vga_only && (pci->class_code != PCI_CLASS_DISPLAY ||
+                            pci->subclass != PCI_SUBCLASS_VGA)))
+    return 0;
+  if (probed)
+    return failed ? 0 : &vgpu_driver;
+  probed = true;
+
+  if (!start(pci)) {
+    fail();
+    return 0;
+  }
+  read_display_info();
+  return failed ? 0 : &vgpu_driver;
+}
@@ -0,0 +1,439 @@
+#include "vm.h"
+#include "console.h"
+#include "exec.h"
+#include "fat.h"
+#include "kmalloc.h"
+#include "paging.h"
+#include "pmm.h"
+#include "sched.h"
+#include "string.h"
+#include "trace.h"
+
+// The kernel's own tables, from entry.asm
+extern pml4_entry_t pml4_table[];
+
+#define PAGE_FAULT_VECTOR 14
+#define PF_PRESENT 0x1 // Protection fault rather than a missing page
+#define PF_WRITE 0x2
+#define PF_USER 0x4
+
+#define RFLAGS_IF 0x200
+#define ENTRIES 512
+#define USER_SLOT_FIRST 1
+#define USER_SLOT_END 256 // The upper half belongs to the kernel
+#define TABLE_FLAGS (PAGE_PRESENT | PAGE_RW | PAGE_USER)
+
+static inline void invlpg(uint64_t addr) {
+  __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Read-only behind every untouched zero fill page that has been read
+static uint64_t zero_frame = 0;
+
+static uint64_t *alloc_table(void) {
+  uint64_t frame = pmm_alloc_page();
+  if (frame)
+    memset((void *)(uintptr_t)frame, 0, PMM_PAGE_SIZE);
+  return (uint64_t *)(uintptr_t)frame;
+}
+
+// The page table entry for virt, creating the tables on the way if asked
+static uint64_t *walk(vm_space_t *space, uint64_t virt, bool create) {
+  uint64_t *table = space->pml4;
+  for (int shift = 39; shift > 12; shift -= 9) {
+    uint64_t *entry = &table[(virt >> shift) & 0x1FF];
+    if (!(*entry & PAGE_PRESENT)) {
+      if (!create)
+        return 0;
+      uint64_t *next = alloc_table();
+      if (!next)
+        return 0;
+      *entry = (uint64_t)(uintptr_t)next | TABLE_FLAGS;
+    }
+    table = (uint64_t *)(uintptr_t)(*entry & PAGE_ADDR_MASK);
+  }
+  return &table[(virt >> 12) & 0x1FF];
+}
+
+vm_region_t *vm_find_region(vm_space_t *space, uint64_t addr) {
+  for (vm_region_t *r = space->regions; r; r = r->next)
+    if (addr >= r->start && addr < r->end)
+      return r;
+  return 0;
+}
+
+vm_space_t *vm_create(void) {
+  vm_space_t *space = kmalloc(sizeof(vm_space_t));
+  uint64_t *pml4 = alloc_table();
+  if (!space || !pml4) {
+    kfree(space);
+    if (pml4)
+      pmm_free_page((uint64_t)(uintptr_t)pml4);
+    return 0;
+  }
+  // Slot 0 (the identity map) and the upper half point at the kernel's
+  // own lower tables, so changes below them show up everywhere
+  pml4[0] = pml4_table[0];
+  memcpy(&pml4[USER_SLOT_END], &pml4_table[USER_SLOT_END],
+         (ENTRIES - USER_SLOT_END) * sizeof(*pml4));
+  space->pml4 = pml4;
+  space->regions = 0;
+  space->resident = 0;
+  space->minor_faults = 0;
+  space->major_faults = 0;
+  return space;
+}
+
+// Free a user table and everything below it; level 1 is a page table
+static void free_table(uint64_t *table, int level) {
+  for (int i = 0; i < ENTRIES; i++) {
+    uint64_t entry = table[i];
+    if (!(entry & PAGE_PRESENT))
+      continue;
+    if (level > 1)
+      free_table((uint64_t *)(uintptr_t)(entry & PAGE_ADDR_MASK), level - 1);
+    else if (entry & VM_PTE_OWNED)
+      pmm_free_page(entry & PAGE_ADDR_MASK);
+  }
+  pmm_free_page((uint64_t)(uintptr_t)table);
+}
+
+void vm_destroy(vm_space_t *space) {
+  if (!space)
+    return;
+  for (int i = USER_SLOT_FIRST; i < USER_SLOT_END; i++)
+    if (space->pml4[i] & PAGE_PRESENT)
+      free_table((uint64_t *)(uintptr_t)(space->pml4[i] & PAGE_ADDR_MASK), 3);
+  pmm_free_page((uint64_t)(uintptr_t)space->pml4);
+
+  vm_region_t *r = space->regions;
+  while (r) {
+    vm_region_t *next = r->next;
+    kfree(r);
+    r = next;
+  }
+  kfree(space);
+}
+
+void vm_activate(vm_space_t *space) {
+  uint64_t root = space ? (uint64_t)(uintptr_t)space->pml4
+                        : (uint64_t)(uintptr_t)pml4_table;
+  if ((get_cr3() & PAGE_ADDR_MASK) != root)
+    __asm__ volatile("mov %0, %%cr3" : : "r"(root) : "memory");
+}
+
+bool vm_map(vm_space_t *space, uint64_t start, uint64_t end, uint32_t prot,
+            int fd, uint64_t file_offset, uint64_t file_size) {
+  if ((start | end) & (PMM_PAGE_SIZE - 1) || start >= end ||
+      start < VM_USER_BASE || end > VM_USER_TOP)
+    return false;
+  for (vm_region_t *r = space->regions; r; r = r->next)
+    if (start < r->end && r->start < end)
+      return false;
+
+  vm_region_t *region = kmalloc(sizeof(vm_region_t));
+  if (!region)
+    return false;
+  region->start = start;
+  region->end = end;
+  region->prot = prot;
+  region->fd = fd;
+  region->file_offset = file_offset;
+  region->file_size = fd >= 0 ? file_size : 0;
+  region->next = space->regions;
+  space->regions = region;
+  return true;
+}
+
+// Free the pages of [start, end) that were faulted in or mapped
+static void release_pages(vm_space_t *space, uint64_t start, uint64_t end) {
+  for (uint64_t page = start; page < end; page += PMM_PAGE_SIZE) {
+    uint64_t *pte = walk(space, page, false);
+    if (!pte || !(*pte & PAGE_PRESENT))
+      continue;
+    if (*pte & VM_PTE_OWNED) {
+      pmm_free_page(*pte & PAGE_ADDR_MASK);
+      space->resident--;
+    }
+    *pte = 0;
+    invlpg(page);
+  }
+}
+
+// Start r at start instead, keeping the file where it was
+static void trim_front(vm_region_t *r, uint64_t start) {
+  uint64_t cut = start - r->start;
+  r->file_offset += cut;
+  r->file_size = r->file_size > cut ? r->file_size - cut : 0;
+  r->start = start;
+}
+
+bool vm_unmap(vm_space_t *space, uint64_t start, uint64_t end) {
+  if ((start | end) & (PMM_PAGE_SIZE - 1) || start >= end)
+    return false;
+  vm_region_t **link = &space->regions;
+  while (*link) {
+    vm_region_t *r = *link;
+    if (end <= r->start || r->end <= start) {
+      link = &r->next;
+      continue;
+    }
+    uint64_t lo = start > r->start ? start : r->start;
+    uint64_t hi = end < r->end ? end : r->end;
+    if (lo == r->start && hi == r->end) {
+      *link = r->next;
+      release_pages(space, lo, hi);
+      kfree(r);
+      continue;
+    }
+    if (lo > r->start && hi < r->end) {
+      // A hole in the middle: the part above it becomes its own region
+      vm_region_t *tail = kmalloc(sizeof(vm_region_t));
+      if (!tail)
+        return false;
+      *tail = *r;
+      trim_front(tail, hi);
+      r->next = tail;
+      r->end = lo;
+    } else if (lo > r->start) {
+      r->end = lo;
+    } else {
+      trim_front(r, hi);
+    }
+    release_pages(space, lo, hi);
+    link = &r->next;
+  }
+  return true;
+}
+
+bool vm_resize(vm_space_t *space, uint64_t start, uint64_t end) {
+  vm_region_t *r = vm_find_region(space, start);
+  if (!r || r->start != start || (end & (PMM_PAGE_SIZE - 1)) ||
+      end <= start || end > VM_USER_TOP)
+    return false;
+  if (end > r->end) {
+    for (vm_region_t *o = space->regions; o; o = o->next)
+      if (o != r && r->end < o->end && o->start < end)
+        return false;
+  } else {
+    release_pages(space, end, r->end);
+  }
+  r->end = end;
+  return true;
+}
+
+uint64_t vm_find_free(vm_space_t *space, uint64_t size, uint64_t base,
+                      uint64_t limit) {
+  uint64_t addr = base;
+  bool moved = true;
+  // Step past whatever is in the way until nothing is
+  while (moved) {
+    if (addr + size < addr || addr + size > limit)
+      return 0;
+    moved = false;
+    for (vm_region_t *r = space->regions; r; r = r->next)
+      if (addr < r->end && r->start < addr + size) {
+        addr = r->end;
+        moved = true;
+      }
+  }
+  return addr;
+}
+
+bool vm_map_page(vm_space_t *space, uint64_t virt, uint64_t phys,
+                 uint64_t flags) {
+  vm_region_t *r = vm_find_region(space, virt);
+  if (!r || r->fd != VM_FD_DEVICE || ((virt | phys) & (PMM_PAGE_SIZE - 1)))
+    return false;
+  uint64_t *pte = walk(space, virt, true);
+  if (!pte)
+    return false;
+  *pte = (phys & PAGE_ADDR_MASK) | PAGE_PRESENT | PAGE_USER |
+         (flags & (PAGE_RW | PAGE_CACHE_MASK));
+  invlpg(virt);
+  return true;
+}
+
+bool vm_user_range(uint64_t addr, uint64_t len, uint32_t prot) {
+  task_t *task = task_current();
+  vm_space_t *space = task ? task->vm : 0;
+  if (!space || addr + len < addr)
+    return false;
+  uint64_t end = addr + len;
+  while (addr < end) {
+    vm_region_t *r = vm_find_region(space, addr);
+    if (!r || (r->prot & prot) != prot)
+      return false;
+    addr = r->end;
+  }
+  return true;
+}
+
+int vm_copy_string(char *dst, uint64_t src, uint64_t size) {
+  uint64_t n = 0;
+  for (; n + 1 < size; n++) {
+    uint64_t addr = src + n;
+    if ((n == 0 || (addr & (PMM_PAGE_SIZE - 1)) == 0) &&
+        !vm_user_range(addr, 1, VM_READ))
+      return -1;
+    char c = *(const char *)(uintptr_t)addr;
+    if (!c)
+      break;
+    dst[n] = c;
+  }
+  dst[n] = '\0';
+  return (int)n;
+}
+
+// A write to a copy-on-write page: give the space its own copy
+static bool copy_on_write(vm_space_t *space, uint64_t page, uint64_t *pte) {
+  uint64_t frame = pmm_alloc_page_high();
+  if (!frame)
+    return false;
+  uint64_t shared = *pte & PAGE_ADDR_MASK;
+  if (shared == zero_frame)
+    memset(phys_to_virt(frame), 0, PMM_PAGE_SIZE);
+  else
+    memcpy(phys_to_virt(frame), phys_to_virt(shared), PMM_PAGE_SIZE);
+  *pte = frame | PAGE_PRESENT | PAGE_USER | PAGE_RW | VM_PTE_OWNED;
+  invlpg(page);
+  space->resident++;
+  space->minor_faults++;
+  return true;
+}
+
+// Back the page holding addr. Runs with interrupts on, reading the file
+// may block.
+static bool resolve(vm_space_t *space, uint64_t addr, uint64_t err) {
+  vm_region_t *r = vm_find_region(space, addr);
+  if (!r || r->fd == VM_FD_DEVICE ||
+      ((err & PF_WRITE) && !(r->prot & VM_WRITE)))
+    return false;
+
+  uint64_t page = addr & ~(PMM_PAGE_SIZE - 1);
+  if (err & PF_PRESENT) {
+    // The only protection fault that isn't the program's fault
+    uint64_t *pte = walk(space, page, false);
+    if (!(err & PF_WRITE) || !pte || !(*pte & VM_PTE_COW))
+      return false;
+    return copy_on_write(space, page, pte);
+  }
+
+  // Reads of zero fill share the zero page until the first write
+  uint64_t rel = page - r->start;
+  bool from_file = rel < r->file_size;
+  if (!from_file && !(err & PF_WRITE) && zero_frame) {
+    uint64_t *pte = walk(space, page, true);
+    if (!pte)
+      return false;
+    *pte = zero_frame | PAGE_PRESENT | PAGE_USER |
+           (r->prot & VM_WRITE ? VM_PTE_COW : 0);
+    invlpg(page);
+    space->minor_faults++;
+    return true;
+  }
+
+  // User pages are only touched through the direct map, so they can come
+  // from above 4GB
+  uint64_t frame = pmm_alloc_page_high();
+  if (!frame)
+    return false;
+  void *data = phys_to_virt(frame);
+  memset(data, 0, PMM_PAGE_SIZE);
+
+  // The file's part of the page, the rest stays zero (.bss, the stack)
+  if (from_file) {
+    uint64_t len = r->file_size - rel;
+    if (len > PMM_PAGE_SIZE)
+      len = PMM_PAGE_SIZE;
+    if (fat_pread(r->fd, r->file_offset + rel, data, len) != (int64_t)len) {
+      pmm_free_page(frame);
+      return false;
+    }
+  }
+
+  uint64_t *pte = walk(space, page, true);
+  if (!pte) {
+    pmm_free_page(frame);
+    return false;
+  }
+  uint64_t flags = PAGE_PRESENT | PAGE_USER | VM_PTE_OWNED;
+  if (r->prot & VM_WRITE)
+    flags |= PAGE_RW;
+  *pte = frame | flags;
+  invlpg(page);
+  space->resident++;
+  if (from_file)
+    space->major_faults++;
+  else
+    space->minor_faults++;
+  return true;
+}
+
+static void print_hex(uint64_t value, uint8_t color) {
+  char buf[19] = "0x";
+  for (int i = 0; i < 16; i++)
+    buf[2 + i] = "0123456789ABCDEF"[(value >> (60 - 4 * i)) & 0xF];
+  buf[18] = '\0';
+  kprint(buf, color);
+}
+
+static void page_fault_handler(Registers *regs) {
+  uint64_t addr;
+  __asm__ volatile("mov %%cr2, %0" : "=r"(addr));
+  TRACE(TRACE_PAGE_FAULT, addr, regs->err_code, 0);
+  uint8_t color = VGA_ENTRY_COLOR(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+
+  task_t *task = task_current();
+  vm_space_t *space = task ? task->vm : 0;
+  bool user_addr = addr >= VM_USER_BASE && addr < VM_USER_TOP;
+
+  if (space && !user_addr) {
+    // A kernel table added to the top level after the space was made
+    uint64_t slot = (addr >> 39) & 0x1FF;
+    if (!(space->pml4[slot] & PAGE_PRESENT) &&
+        (pml4_table[slot] & PAGE_PRESENT)) {
+      space->pml4[slot] = pml4_table[slot];
+      return;
+    }
+  }
+
+  if (space && user_addr) {
+    // Interrupt gates leave IF clear, filling the page may have to wait
+    // for the disk
+    if (regs->rflags & RFLAGS_IF)
+      __asm__ volatile("sti");
+    if (resolve(space, addr, regs->err_code))
+      return;
+  }
+
+  if (space && (user_addr || (regs->cs & 3))) {
+    knewline();
+    kprint(task->name, color);
+    kprint(": segmentation fault at ", color);
+    print_hex(addr, color);
+    kprint(" rip=", color);
+    print_hex(regs->rip, color);
+    knewline();
+    exec_exit(-1);
+  }
+
+  kprint("Page fault at ", color);
+  print_hex(addr, color);
+  kprint(" err=", color);
+  print_hex(regs->err_code, color);
+  kprint(" rip=", color);
+  print_hex(regs->rip, color);
+  knewline();
+  kprint("Halted.", color);
+  for (;;)
+    __asm__ volatile("cli; hlt");
+}
+
+void vm_init(void) {
+  // Without it, reads of zero fill get a zeroed page each
+  zero_frame = pmm_alloc_page();
+  if (zero_frame)
+    memset((void *)(uintptr_t)zero_frame, 0, PMM_PAGE_SIZE);
+  register_interrupt_handler(PAGE_FAULT_VECTOR, page_fault_handler);
+}
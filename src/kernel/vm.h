@@ -0,0 +1,101 @@
+#pragma once
+#include "isr.h"
+#include "stdint.h"
+
+// User address spaces. Each has its own PML4 that shares the kernel's
+// entries (the identity map in slot 0 and the upper half), while slots 1
+// to 255 hold the program. Memory is described by regions and only backed
+// when first touched: the page fault handler fills a page from the file a
+// region maps, or with zeros past the file's part of it. A read of a page
+// that would be all zeros maps the shared zero page copy-on-write instead,
+// so memory that is only ever read costs nothing.
+#define VM_USER_BASE 0x0000008000000000ULL // PML4 slot 1, sdk/lib/nbos.ld
+#define VM_USER_TOP 0x0000800000000000ULL  // End of the lower canonical half
+#define VM_STACK_TOP 0x00007FFFFFFFF000ULL // One guard page below the top
+#define VM_STACK_SIZE 0x100000ULL          // 1MB, demand-zero
+
+// SYS_MMAP hands out ranges from here up to VM_SCREEN_BASE; the program
+// break grows from the end of the image towards it
+#define VM_MMAP_BASE 0x0000400000000000ULL
+
+// Where SYS_MAP_FRAMEBUFFER puts the screen and the private back buffer
+#define VM_SCREEN_BASE 0x0000700000000000ULL
+#define VM_PRIVATE_FB_BASE 0x0000700040000000ULL
+
+#define VM_READ 0x1
+#define VM_WRITE 0x2
+#define VM_EXEC 0x4
+
+// Page table entry bit (one the CPU ignores) for frames the space owns
+// and frees with it
+#define VM_PTE_OWNED 0x200
+// And for a read-only mapping of a frame the space doesn't own (the zero
+// page), replaced by a private copy on the first write
+#define VM_PTE_COW 0x400
+
+// Region fd for memory mapped up front with vm_map_page, never faulted in
+#define VM_FD_DEVICE -2
+
+typedef struct vm_region {
+  uint64_t start, end; // Page aligned
+  uint32_t prot;
+  int fd;              // FAT handle of the backing file, -1 for zero fill
+                       // or VM_FD_DEVICE
+  uint64_t file_offset; // File byte at start
+  uint64_t file_size;   // Bytes from start backed by the file, zeros after
+  struct vm_region *next;
+} vm_region_t;
+
+typedef struct vm_space {
+  uint64_t *pml4; // Identity mapped, also its physical address
+  vm_region_t *regions;
+  uint64_t resident;     // Pages faulted in
+  uint64_t minor_faults; // Resolved without I/O: zero fill, copy-on-write
+  uint64_t major_faults; // Read from the file
+} vm_space_t;
+
+// Claim the page fault vector
+void vm_init(void);
+
+vm_space_t *vm_create(void);
+// Free every page and table of the space, it must not be loaded anywhere
+void vm_destroy(vm_space_t *space);
+// Load the space on this CPU, 0 for the kernel's own tables
+void vm_activate(vm_space_t *space);
+
+// Reserve [start, end) (page aligned, inside the user range, not overlapping
+// another region) backed by file_size bytes of a file from file_offset and
+// zeros after. fd -1 maps zeros only, VM_FD_DEVICE reserves the range
+// for vm_map_page.
+bool vm_map(vm_space_t *space, uint64_t start, uint64_t end, uint32_t prot,
+            int fd, uint64_t file_offset, uint64_t file_size);
+
+// Point the page at virt, inside a VM_FD_DEVICE region, at phys with the
+// given PAGE_* flags (PAGE_RW, a PAGE_CACHE_* type). The frame stays with
+// its owner when the space goes.
+bool vm_map_page(vm_space_t *space, uint64_t virt, uint64_t phys,
+                 uint64_t flags);
+
+// Drop [start, end) (page aligned) from the space: regions are trimmed or
+// split around it and their pages freed. False if a split ran out of memory.
+bool vm_unmap(vm_space_t *space, uint64_t start, uint64_t end);
+
+// Move the end of the region that begins at start, freeing the pages it
+// gives up. Growing fails if it would run into another region.
+bool vm_resize(vm_space_t *space, uint64_t start, uint64_t end);
+
+// The lowest page aligned address in [base, limit) with size bytes free
+// for a region, or 0
+uint64_t vm_find_free(vm_space_t *space, uint64_t size, uint64_t base,
+                      uint64_t limit);
+
+// The region of space holding addr, or 0
+vm_region_t *vm_find_region(vm_space_t *space, uint64_t addr);
+
+// Whether [addr, addr + len) lies inside the regions of the current task's
+// space with the given access, for checking system call pointers
+bool vm_user_range(uint64_t addr, uint64_t len, uint32_t prot);
+
+// Copy a string from the current task's space: at most size - 1 bytes and
+// always terminated. The number copied, or -1 if it runs outside the space.
+int vm_copy_string(char *dst, uint64_t src, uint64_t size);
@@ -1,9 +1,41 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Reads files out of FAT12/16/32 images. The image is mapped once, the FAT
+// decoded into a next-cluster table and every directory indexed up front,
+// so any number of lookups, extractions and checks share that work:
+//
+//   fat [-o offset] <image> <file>                  print a file (any name)
+//   fat [-o offset] <image> ls [dir]...
+//   fat [-o offset] <image> cat <path>...
+//   fat [-o offset] <image> extract <path> <dest> [<path> <dest>]...
+//   fat [-o offset] <image> verify <path> <host file> [<path> <host file>]...
+//   fat [-o offset] <image> batch [script]          the above, one per line
+//
+// Partitioned images are found through the MBR, -o gives the byte offset of
+// the file system by hand. Paths are 8.3 names separated by '/', matched
+// without regard to case; an 11 character name like "KERNEL  BIN" is taken
+// as it is stored.
+
+#define ATTR_VOLUME_ID 0x08
+#define ATTR_DIRECTORY 0x10
+#define ATTR_LFN 0x0F
+#define CASE_LOWER_BASE 0x08
+#define CASE_LOWER_EXT 0x10
+
+#define CLUSTER_END 0xFFFFFFFFu
+#define MAX_LINE 4096
+#define MAX_ARGS 64
 
 typedef struct
 {
@@ -21,24 +53,19 @@ typedef struct
     uint16_t Heads;
     uint32_t HiddenSectors;
     uint32_t LargeSectorCount;
-          
-    uint8_t DriveNumber;
-    uint8_t _Reserved;
-    uint8_t Signature;
-    uint8_t VolumeLabel[11];
-    uint8_t SystemId[8];    
-    
-    // ... More fields can be added as needed
-
-    // ... Even more space for asthetics, cause, why not?
 
+    // FAT32 only, FAT12/16 keep the drive number and label here
+    uint32_t SectorsPerFat32;
+    uint16_t ExtFlags;
+    uint16_t FsVersion;
+    uint32_t RootCluster;
 } __attribute__((packed)) BootSector;
 
 typedef struct
 {
     uint8_t Name[11];
     uint8_t Attributes;
-    uint8_t _Reserved;
+    uint8_t CaseFlags; // Windows NT: which parts of the 8.3 name are lower case
     uint8_t CreatedTimeTenths;
     uint16_t CreatedTime;
     uint16_t CreatedDate;
@@ -50,154 +77,676 @@ typedef struct
     uint32_t Size;
 } __attribute__((packed)) DirectoryEntry;
 
-BootSector g_BootSector;
-uint8_t* g_Fat = NULL;
-DirectoryEntry* g_RootDirectory = NULL;
-uint32_t g_RootDirectoryEnd;
+typedef struct
+{
+    uint8_t Status;
+    uint8_t ChsFirst[3];
+    uint8_t Type;
+    uint8_t ChsLast[3];
+    uint32_t LbaFirst;
+    uint32_t SectorCount;
+} __attribute__((packed)) PartitionEntry;
+
+// Every file and directory on the volume, parents before their contents;
+// entry 0 is the root
+typedef struct
+{
+    uint8_t Name[11];
+    uint8_t Attributes;
+    uint8_t CaseFlags;
+    uint32_t Parent;
+    uint32_t FirstCluster;
+    uint32_t Size;
+} IndexEntry;
+
+static int g_ImageFd = -1;
+static const uint8_t* g_Image = NULL;
+static uint64_t g_ImageSize;
+static uint64_t g_Offset; // Where the file system starts in the image
+
+static BootSector g_BootSector;
+static int g_FatBits;
+static uint32_t g_ClusterCount;
+static uint32_t g_ClusterBytes;
+static uint64_t g_RootOffset;  // FAT12/16: the fixed root directory
+static uint64_t g_DataOffset;  // Cluster 2
+static uint32_t* g_Next = NULL; // Next cluster of each, CLUSTER_END at the end
+
+static IndexEntry* g_Index = NULL;
+static uint32_t g_IndexCount;
+static uint32_t g_IndexCapacity;
+static uint32_t* g_Sorted = NULL; // By parent, then name
 
-bool  readBootSector(FILE* disk)
+/* ============================================================================
+ * Image
+ * ============================================================================ */
+
+static bool sectorSizeValid(uint16_t size)
 {
-    return fread(&g_BootSector, sizeof(BootSector), 1, disk) > 0;
+    return size == 512 || size == 1024 || size == 2048 || size == 4096;
 }
 
-bool readSectors(FILE* disk, uint32_t lba, uint32_t count, void* bufferOut)
+static bool bootSectorValid(const BootSector* bs)
 {
-    bool ok =true;
-    ok = ok && (fseek(disk, lba * g_BootSector.BytesPerSector, SEEK_SET) == 0);
-    ok = ok && (fread(bufferOut, g_BootSector.BytesPerSector, count, disk) == count);
-    return ok;
+    return sectorSizeValid(bs->BytesPerSector) && bs->SectorsPerCluster &&
+           !(bs->SectorsPerCluster & (bs->SectorsPerCluster - 1)) &&
+           bs->ReservedSectors && bs->FatCount;
+}
+
+// The first FAT partition of an MBR, when sector 0 isn't a boot sector
+static bool findPartition(uint64_t* offset)
+{
+    static const uint8_t fatTypes[] = {0x01, 0x04, 0x06, 0x0B, 0x0C, 0x0E};
+    if (g_ImageSize < 512 || g_Image[510] != 0x55 || g_Image[511] != 0xAA)
+        return false;
+
+    const PartitionEntry* parts = (const PartitionEntry*)(g_Image + 446);
+    for (int i = 0; i < 4; i++)
+        for (size_t t = 0; t < sizeof(fatTypes); t++)
+            if (parts[i].Type == fatTypes[t] && parts[i].LbaFirst)
+            {
+                *offset = (uint64_t)parts[i].LbaFirst * 512;
+                return true;
+            }
+    return false;
+}
+
+static uint32_t readFatEntry(const uint8_t* fat, uint32_t cluster)
+{
+    if (g_FatBits == 12)
+    {
+        uint32_t index = cluster * 3 / 2;
+        uint32_t v = fat[index] | (fat[index + 1] << 8);
+        v = (cluster & 1) ? v >> 4 : v & 0x0FFF;
+        return v >= 0x0FF7 ? CLUSTER_END : v;
+    }
+    if (g_FatBits == 16)
+    {
+        uint32_t v = fat[cluster * 2] | (fat[cluster * 2 + 1] << 8);
+        return v >= 0xFFF7 ? CLUSTER_END : v;
+    }
+    uint32_t v;
+    memcpy(&v, fat + cluster * 4, 4);
+    v &= 0x0FFFFFFF;
+    return v >= 0x0FFFFFF7 ? CLUSTER_END : v;
+}
+
+bool openImage(const char* path, bool haveOffset)
+{
+    g_ImageFd = open(path, O_RDONLY);
+    struct stat st;
+    if (g_ImageFd < 0 || fstat(g_ImageFd, &st) < 0 || st.st_size < 512)
+        return false;
+    g_ImageSize = (uint64_t)st.st_size;
+    g_Image = mmap(NULL, g_ImageSize, PROT_READ, MAP_PRIVATE, g_ImageFd, 0);
+    if (g_Image == MAP_FAILED)
+    {
+        g_Image = NULL;
+        return false;
+    }
+
+    if (!haveOffset)
+    {
+        memcpy(&g_BootSector, g_Image, sizeof(BootSector));
+        if (!bootSectorValid(&g_BootSector) && !findPartition(&g_Offset))
+            return false;
+    }
+    if (g_Offset + sizeof(BootSector) > g_ImageSize)
+        return false;
+    memcpy(&g_BootSector, g_Image + g_Offset, sizeof(BootSector));
+    const BootSector* bs = &g_BootSector;
+    if (!bootSectorValid(bs))
+        return false;
+
+    // The FAT type follows from the number of clusters alone
+    uint32_t sectorsPerFat = bs->SectorsPerFat ? bs->SectorsPerFat : bs->SectorsPerFat32;
+    uint32_t totalSectors = bs->TotalSectors ? bs->TotalSectors : bs->LargeSectorCount;
+    uint32_t rootSectors = (bs->DirEntryCount * 32u + bs->BytesPerSector - 1) / bs->BytesPerSector;
+    uint64_t dataSector = bs->ReservedSectors + (uint64_t)bs->FatCount * sectorsPerFat + rootSectors;
+    if (!sectorsPerFat || dataSector >= totalSectors)
+        return false;
+    g_ClusterCount = (uint32_t)((totalSectors - dataSector) / bs->SectorsPerCluster);
+    g_FatBits = g_ClusterCount < 4085 ? 12 : g_ClusterCount < 65525 ? 16 : 32;
+    g_ClusterBytes = (uint32_t)bs->SectorsPerCluster * bs->BytesPerSector;
+    g_RootOffset = g_Offset + ((uint64_t)bs->ReservedSectors + (uint64_t)bs->FatCount * sectorsPerFat) * bs->BytesPerSector;
+    g_DataOffset = g_Offset + dataSector * bs->BytesPerSector;
+
+    uint64_t fatOffset = g_Offset + (uint64_t)bs->ReservedSectors * bs->BytesPerSector;
+    uint64_t fatBytes = (uint64_t)sectorsPerFat * bs->BytesPerSector;
+    uint64_t needed = ((uint64_t)g_ClusterCount + 2) * g_FatBits / 8 + 2;
+    if (fatOffset + fatBytes > g_ImageSize || needed > fatBytes)
+        return false;
+
+    // Decode the FAT once, chains are then one array lookup a cluster
+    g_Next = malloc(((size_t)g_ClusterCount + 2) * sizeof(uint32_t));
+    if (!g_Next)
+        return false;
+    const uint8_t* fat = g_Image + fatOffset;
+    for (uint32_t c = 0; c < g_ClusterCount + 2; c++)
+    {
+        uint32_t next = readFatEntry(fat, c);
+        g_Next[c] = next >= 2 && next < g_ClusterCount + 2 ? next : CLUSTER_END;
+    }
+    return true;
+}
+
+static bool clusterValid(uint32_t cluster)
+{
+    return cluster >= 2 && cluster < g_ClusterCount + 2 &&
+           g_DataOffset + (uint64_t)(cluster - 1) * g_ClusterBytes <= g_ImageSize;
 }
 
-bool readFat(FILE* disk)
+static uint64_t clusterOffset(uint32_t cluster)
 {
-    g_Fat = (uint8_t*) malloc(g_BootSector.SectorsPerFat * g_BootSector.BytesPerSector);
-    return readSectors(disk, g_BootSector.ReservedSectors, g_BootSector.SectorsPerFat, g_Fat);
+    return g_DataOffset + (uint64_t)(cluster - 2) * g_ClusterBytes;
 }
 
-bool readRootDirectory(FILE* disk)
+// Calls fn for each run of contiguous clusters holding the first size bytes
+// of the chain at first, merged so a whole run is one call
+typedef bool (*RunFn)(uint64_t imageOffset, uint64_t fileOffset, uint64_t length, void* ctx);
+
+static bool forEachRun(uint32_t first, uint64_t size, RunFn fn, void* ctx)
 {
-    uint32_t lba = g_BootSector.ReservedSectors + (g_BootSector.FatCount * g_BootSector.SectorsPerFat);
-    uint32_t size = g_BootSector.DirEntryCount * sizeof(DirectoryEntry);
-    uint32_t sectors = (size / g_BootSector.BytesPerSector);
+    uint64_t done = 0;
+    uint32_t cluster = first;
+    uint32_t steps = 0;
+    while (done < size)
+    {
+        if (!clusterValid(cluster))
+            return false;
+        uint32_t start = cluster;
+        uint64_t length = 0;
+        do
+        {
+            length += g_ClusterBytes;
+            cluster = g_Next[cluster];
+            if (++steps > g_ClusterCount)
+                return false; // A loop in the chain
+        } while (done + length < size && cluster == start + length / g_ClusterBytes &&
+                 clusterValid(cluster));
+        if (length > size - done)
+            length = size - done;
+        if (!fn(clusterOffset(start), done, length, ctx))
+            return false;
+        done += length;
+    }
+    return true;
+}
 
-    if(size % g_BootSector.BytesPerSector > 0) sectors++;
+/* ============================================================================
+ * Index
+ * ============================================================================ */
 
-    g_RootDirectoryEnd = lba + sectors;
-    g_RootDirectory = (DirectoryEntry*) malloc(sectors * g_BootSector.BytesPerSector);
-    return readSectors(disk, lba, sectors, g_RootDirectory);
+static bool addEntry(const DirectoryEntry* de, uint32_t parent)
+{
+    if (g_IndexCount == g_IndexCapacity)
+    {
+        uint32_t capacity = g_IndexCapacity ? g_IndexCapacity * 2 : 256;
+        IndexEntry* grown = realloc(g_Index, capacity * sizeof(IndexEntry));
+        if (!grown)
+            return false;
+        g_Index = grown;
+        g_IndexCapacity = capacity;
+    }
+    IndexEntry* e = &g_Index[g_IndexCount++];
+    memcpy(e->Name, de->Name, 11);
+    e->Attributes = de->Attributes;
+    e->CaseFlags = de->CaseFlags;
+    e->Parent = parent;
+    e->FirstCluster = ((uint32_t)de->FirstClusterHigh << 16) | de->FirstClusterLow;
+    if (g_FatBits != 32)
+        e->FirstCluster &= 0xFFFF;
+    e->Size = de->Size;
+    return true;
 }
 
-DirectoryEntry* findFile(const char* name)
+// Index count entries of a directory; false once its end marker is found
+static bool addEntries(const DirectoryEntry* de, uint32_t count, uint32_t parent, bool* ok)
 {
-    for(uint32_t i = 0; i < g_BootSector.DirEntryCount; i++)
+    for (uint32_t i = 0; i < count; i++)
     {
-        if(memcmp(name, g_RootDirectory[i].Name, 11) == 0)
+        if (de[i].Name[0] == 0x00)
+            return false;
+        if (de[i].Name[0] == 0xE5 || de[i].Name[0] == '.' ||
+            (de[i].Attributes & ATTR_LFN) == ATTR_LFN || (de[i].Attributes & ATTR_VOLUME_ID))
+            continue;
+        if (!addEntry(&de[i], parent))
         {
-            return &g_RootDirectory[i];
+            *ok = false;
+            return false;
         }
     }
+    return true;
+}
+
+typedef struct
+{
+    uint32_t Parent;
+    bool* Ok;
+    bool Ended;
+} DirectoryWalk;
 
-    return NULL;
+static bool addRun(uint64_t imageOffset, uint64_t fileOffset, uint64_t length, void* ctx)
+{
+    (void)fileOffset;
+    DirectoryWalk* walk = ctx;
+    if (walk->Ended)
+        return true;
+    walk->Ended = !addEntries((const DirectoryEntry*)(g_Image + imageOffset),
+                              (uint32_t)(length / sizeof(DirectoryEntry)), walk->Parent, walk->Ok);
+    return *walk->Ok;
 }
 
-bool readFile(DirectoryEntry* fileEntry, FILE* disk, uint8_t* outputBuffer)
+static int compareSorted(const void* a, const void* b)
 {
-    bool ok = true;
-    uint16_t currentCluster = fileEntry->FirstClusterLow;
+    const IndexEntry* x = &g_Index[*(const uint32_t*)a];
+    const IndexEntry* y = &g_Index[*(const uint32_t*)b];
+    if (x->Parent != y->Parent)
+        return x->Parent < y->Parent ? -1 : 1;
+    return memcmp(x->Name, y->Name, 11);
+}
 
-    do
+// Walk every directory once, breadth first: the index doubles as the queue
+bool buildIndex(void)
+{
+    DirectoryEntry root = {0};
+    memset(root.Name, ' ', 11);
+    root.Attributes = ATTR_DIRECTORY;
+    if (g_FatBits == 32)
     {
-        uint32_t lba = g_RootDirectoryEnd + (currentCluster - 2) * g_BootSector.SectorsPerCluster;
-        ok = ok && readSectors(disk, lba, g_BootSector.SectorsPerCluster, outputBuffer);
-        outputBuffer += g_BootSector.SectorsPerCluster * g_BootSector.BytesPerSector;
+        root.FirstClusterHigh = (uint16_t)(g_BootSector.RootCluster >> 16);
+        root.FirstClusterLow = (uint16_t)g_BootSector.RootCluster;
+    }
+    bool ok = addEntry(&root, 0);
 
-        uint32_t fatIndex = currentCluster * 3 / 2;
-        if(currentCluster % 2 == 0)
+    for (uint32_t i = 0; ok && i < g_IndexCount; i++)
+    {
+        if (!(g_Index[i].Attributes & ATTR_DIRECTORY))
+            continue;
+        if (i == 0 && g_FatBits != 32)
         {
-            currentCluster = (*(uint16_t*)(&g_Fat[fatIndex])) & 0x0FFF;
+            uint64_t bytes = (uint64_t)g_BootSector.DirEntryCount * sizeof(DirectoryEntry);
+            if (g_RootOffset + bytes > g_ImageSize)
+                return false;
+            addEntries((const DirectoryEntry*)(g_Image + g_RootOffset),
+                       g_BootSector.DirEntryCount, 0, &ok);
+            continue;
         }
+        // Directories have no size, their chain ends them
+        DirectoryWalk walk = {i, &ok, false};
+        forEachRun(g_Index[i].FirstCluster, (uint64_t)g_ClusterCount * g_ClusterBytes, addRun, &walk);
+    }
+    if (!ok)
+        return false;
+
+    g_Sorted = malloc(g_IndexCount * sizeof(uint32_t));
+    if (!g_Sorted)
+        return false;
+    for (uint32_t i = 0; i < g_IndexCount; i++)
+        g_Sorted[i] = i;
+    qsort(g_Sorted + 1, g_IndexCount - 1, sizeof(uint32_t), compareSorted);
+    return true;
+}
+
+static int findChild(uint32_t parent, const uint8_t name[11])
+{
+    uint32_t lo = 1, hi = g_IndexCount;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const IndexEntry* e = &g_Index[g_Sorted[mid]];
+        int cmp = e->Parent != parent ? (e->Parent < parent ? -1 : 1) : memcmp(e->Name, name, 11);
+        if (cmp == 0)
+            return (int)g_Sorted[mid];
+        if (cmp < 0)
+            lo = mid + 1;
         else
-        {
-            currentCluster = (*(uint16_t*)(&g_Fat[fatIndex])) >> 4;
-        }
-    } while (ok && currentCluster < 0x0FF8);
+            hi = mid;
+    }
+    return -1;
+}
 
-    return ok;
+// One path component as stored: "hello.elf" becomes "HELLO   ELF"
+static bool toShortName(const char* s, size_t len, uint8_t out[11])
+{
+    memset(out, ' ', 11);
+    if (len == 11 && !memchr(s, '.', len))
+    {
+        for (size_t i = 0; i < 11; i++)
+            out[i] = (uint8_t)toupper((unsigned char)s[i]);
+        return true;
+    }
+    const char* dot = memchr(s, '.', len);
+    size_t base = dot ? (size_t)(dot - s) : len;
+    size_t ext = dot ? len - base - 1 : 0;
+    if (!base || base > 8 || ext > 3)
+        return false;
+    for (size_t i = 0; i < base; i++)
+        out[i] = (uint8_t)toupper((unsigned char)s[i]);
+    for (size_t i = 0; i < ext; i++)
+        out[8 + i] = (uint8_t)toupper((unsigned char)dot[1 + i]);
+    return true;
 }
 
-int main(int argc, char** argv) 
+static int lookup(const char* path)
 {
-    if(argc < 3)
+    int current = 0;
+    while (*path)
     {
-        fprintf(stdout, "Syntax: %s <disk image> <file name>\n", argv[0]);
-        return 1;
+        while (*path == '/')
+            path++;
+        if (!*path)
+            break;
+        size_t len = strcspn(path, "/");
+        uint8_t name[11];
+        if (!(g_Index[current].Attributes & ATTR_DIRECTORY) || !toShortName(path, len, name))
+            return -1;
+        current = findChild((uint32_t)current, name);
+        if (current < 0)
+            return -1;
+        path += len;
     }
+    return current;
+}
 
-    FILE* disk = fopen(argv[1], "rb");
-    if(!disk)
+static void printName(const IndexEntry* e, FILE* out)
+{
+    int base = 8, ext = 3;
+    while (base && e->Name[base - 1] == ' ')
+        base--;
+    while (ext && e->Name[8 + ext - 1] == ' ')
+        ext--;
+    for (int i = 0; i < base; i++)
+        fputc((e->CaseFlags & CASE_LOWER_BASE) ? tolower(e->Name[i]) : e->Name[i], out);
+    if (ext)
+        fputc('.', out);
+    for (int i = 0; i < ext; i++)
+        fputc((e->CaseFlags & CASE_LOWER_EXT) ? tolower(e->Name[8 + i]) : e->Name[8 + i], out);
+}
+
+static void printPath(uint32_t index, FILE* out)
+{
+    if (index == 0)
+        return;
+    printPath(g_Index[index].Parent, out);
+    fputc('/', out);
+    printName(&g_Index[index], out);
+}
+
+/* ============================================================================
+ * Commands
+ * ============================================================================ */
+
+static int findFile(const char* path, bool wantDirectory)
+{
+    int index = lookup(path);
+    if (index < 0)
+    {
+        fprintf(stderr, "Error: Could not find '%s'!\n", path);
+        return -1;
+    }
+    if (((g_Index[index].Attributes & ATTR_DIRECTORY) != 0) != wantDirectory)
     {
-        fprintf(stderr, "Error: Could not open disk image '%s'!\n", argv[1]);
+        fprintf(stderr, wantDirectory ? "Error: '%s' is not a directory!\n"
+                                      : "Error: '%s' is a directory!\n", path);
         return -1;
     }
+    return index;
+}
 
-    if(!readBootSector(disk))
+static bool commandList(const char* path)
+{
+    int dir = findFile(path, true);
+    if (dir < 0)
+        return false;
+    // Children sit together in g_Sorted, in name order
+    for (uint32_t i = 1; i < g_IndexCount; i++)
     {
-        fprintf(stderr, "Error: Could not read boot sector from disk image '%s'!\n", argv[1]);
-        return -2;
+        const IndexEntry* e = &g_Index[g_Sorted[i]];
+        if (e->Parent != (uint32_t)dir)
+            continue;
+        printf("%10u ", (e->Attributes & ATTR_DIRECTORY) ? 0 : e->Size);
+        printPath(g_Sorted[i], stdout);
+        printf("%s\n", (e->Attributes & ATTR_DIRECTORY) ? "/" : "");
     }
+    return true;
+}
 
-    if(!readFat(disk))
+static bool printRun(uint64_t imageOffset, uint64_t fileOffset, uint64_t length, void* ctx)
+{
+    (void)fileOffset;
+    (void)ctx;
+    const uint8_t* p = g_Image + imageOffset;
+    for (uint64_t i = 0; i < length; i++)
     {
-        fprintf(stderr, "Error: Could not read FAT from disk image '%s'!\n", argv[1]);
-        free(g_Fat);
-        return -3;
+        if (isprint(p[i]) || p[i] == '\n' || p[i] == '\r' || p[i] == '\t')
+            fputc(p[i], stdout);
+        else
+            fprintf(stdout, "<%02x>", p[i]);
     }
+    return true;
+}
 
-    if(!readRootDirectory(disk))
+static bool commandCat(const char* path)
+{
+    int index = findFile(path, false);
+    if (index < 0)
+        return false;
+    bool ok = forEachRun(g_Index[index].FirstCluster, g_Index[index].Size, printRun, NULL);
+    fprintf(stdout, "\n");
+    if (!ok)
+        fprintf(stderr, "Error: Could not read '%s', its cluster chain is broken!\n", path);
+    return ok;
+}
+
+// Straight from the image file to the output where the kernel can, from
+// the mapping otherwise
+static bool writeRun(uint64_t imageOffset, uint64_t fileOffset, uint64_t length, void* ctx)
+{
+    int out = *(int*)ctx;
+#ifdef __linux__
+    loff_t in = (loff_t)imageOffset, at = (loff_t)fileOffset;
+    while (length)
     {
-        fprintf(stderr, "Error: Could not read root directory from disk image '%s'!\n", argv[1]);
-        free(g_Fat);
-        free(g_RootDirectory);
-        return -4;
+        ssize_t n = copy_file_range(g_ImageFd, &in, out, &at, length, 0);
+        if (n <= 0)
+            break;
+        length -= (uint64_t)n;
     }
+    imageOffset = (uint64_t)in;
+    fileOffset = (uint64_t)at;
+#endif
+    while (length)
+    {
+        ssize_t n = pwrite(out, g_Image + imageOffset, length, (off_t)fileOffset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        imageOffset += (uint64_t)n;
+        fileOffset += (uint64_t)n;
+        length -= (uint64_t)n;
+    }
+    return true;
+}
 
-    DirectoryEntry* fileEntry = findFile(argv[2]);
-    if(!fileEntry)
+static bool commandExtract(const char* path, const char* dest)
+{
+    int index = findFile(path, false);
+    if (index < 0)
+        return false;
+    int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
     {
-        fprintf(stderr, "Error: Could not find file '%s' on disk image '%s'!\n", argv[2], argv[1]);
-        free(g_Fat);
-        free(g_RootDirectory);
-        return -5;
+        fprintf(stderr, "Error: Could not create '%s': %s\n", dest, strerror(errno));
+        return false;
     }
+    bool ok = ftruncate(out, g_Index[index].Size) == 0 &&
+              forEachRun(g_Index[index].FirstCluster, g_Index[index].Size, writeRun, &out);
+    if (close(out) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Error: Could not extract '%s' to '%s'!\n", path, dest);
+    return ok;
+}
 
-    uint8_t* buffer = (uint8_t*) malloc(fileEntry->Size + g_BootSector.BytesPerSector);
-    if(!readFile(fileEntry, disk, buffer))
+static bool compareRun(uint64_t imageOffset, uint64_t fileOffset, uint64_t length, void* ctx)
+{
+    const uint8_t* host = ctx;
+    return memcmp(g_Image + imageOffset, host + fileOffset, length) == 0;
+}
+
+static bool commandVerify(const char* path, const char* hostPath)
+{
+    int index = findFile(path, false);
+    if (index < 0)
+        return false;
+    int fd = open(hostPath, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
     {
-        fprintf(stderr, "Error: Could not read file '%s' from disk image '%s'!\n", argv[2], argv[1]);
-        free(g_Fat);
-        free(g_RootDirectory);
-        free(buffer);
-        return -6;
+        fprintf(stderr, "Error: Could not open '%s': %s\n", hostPath, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
     }
 
-    for(size_t i = 0; i < fileEntry->Size; i++)
+    uint32_t size = g_Index[index].Size;
+    bool same = (uint64_t)st.st_size == size;
+    if (same && size)
     {
-        if(isprint(buffer[i]) || buffer[i] == '\n' || buffer[i] == '\r' || buffer[i] == '\t')
+        void* host = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        same = host != MAP_FAILED &&
+               forEachRun(g_Index[index].FirstCluster, size, compareRun, host);
+        if (host != MAP_FAILED)
+            munmap(host, size);
+    }
+    close(fd);
+    printf("%s %s %s\n", same ? "OK" : "DIFFERS", path, hostPath);
+    return same;
+}
+
+// Paired arguments: extract and verify take a path and a host file each
+static bool runCommand(int argc, char** argv)
+{
+    const char* cmd = argv[0];
+    bool ok = true;
+    if (strcmp(cmd, "ls") == 0)
+    {
+        if (argc == 1)
+            return commandList("/");
+        for (int i = 1; i < argc; i++)
+            ok = commandList(argv[i]) && ok;
+    }
+    else if (strcmp(cmd, "cat") == 0)
+    {
+        for (int i = 1; i < argc; i++)
+            ok = commandCat(argv[i]) && ok;
+    }
+    else if (strcmp(cmd, "extract") == 0 || strcmp(cmd, "verify") == 0)
+    {
+        if (argc < 3 || argc % 2 == 0)
         {
-            fputc(buffer[i], stdout);
+            fprintf(stderr, "Error: %s takes pairs of arguments!\n", cmd);
+            return false;
         }
-        else
+        bool extract = cmd[0] == 'e';
+        for (int i = 1; i + 1 < argc; i += 2)
+            ok = (extract ? commandExtract(argv[i], argv[i + 1])
+                          : commandVerify(argv[i], argv[i + 1])) && ok;
+    }
+    else
+    {
+        fprintf(stderr, "Error: Unknown command '%s'!\n", cmd);
+        return false;
+    }
+    return ok;
+}
+
+// Commands one per line, words separated by blanks; # starts a comment
+static bool commandBatch(const char* scriptPath)
+{
+    FILE* script = scriptPath ? fopen(scriptPath, "r") : stdin;
+    if (!script)
+    {
+        fprintf(stderr, "Error: Could not open '%s': %s\n", scriptPath, strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), script))
+    {
+        char* args[MAX_ARGS];
+        int argc = 0;
+        for (char* word = strtok(line, " \t\r\n"); word && argc < MAX_ARGS;
+             word = strtok(NULL, " \t\r\n"))
         {
-            fprintf(stdout, "<%02x>", buffer[i]);
+            if (word[0] == '#')
+                break;
+            args[argc++] = word;
         }
+        if (argc)
+            ok = runCommand(argc, args) && ok;
     }
-    fprintf(stdout, "\n");
-    free(buffer);
-    free(g_Fat);
-    free(g_RootDirectory);
-    return 0;
+    if (script != stdin)
+        fclose(script);
+    return ok;
 }
 
-// ... There aren't many comments in this code. I am tired of writing that many on assembly portion of the osdev project. So I decided to write more C code for utilities like this one.
+static void usage(const char* self)
+{
+    fprintf(stdout,
+            "Syntax: %s [-o offset] <disk image> <file name>\n"
+            "        %s [-o offset] <disk image> ls [dir]...\n"
+            "        %s [-o offset] <disk image> cat <path>...\n"
+            "        %s [-o offset] <disk image> extract <path> <dest> [<path> <dest>]...\n"
+            "        %s [-o offset] <disk image> verify <path> <host file> [<path> <host file>]...\n"
+            "        %s [-o offset] <disk image> batch [script]\n",
+            self, self, self, self, self, self);
+}
+
+int main(int argc, char** argv)
+{
+    const char* self = argv[0];
+    bool haveOffset = false;
+    if (argc > 2 && strcmp(argv[1], "-o") == 0)
+    {
+        g_Offset = strtoull(argv[2], NULL, 0);
+        haveOffset = true;
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 3)
+    {
+        usage(self);
+        return 1;
+    }
 
-// ... Worked on this with less than 3 hours of sleep, most reasonable life choice ik ik :D
+    if (!openImage(argv[1], haveOffset))
+    {
+        fprintf(stderr, "Error: Could not read a FAT file system from disk image '%s'!\n", argv[1]);
+        return -2;
+    }
+    if (!buildIndex())
+    {
+        fprintf(stderr, "Error: Could not read the directories of disk image '%s'!\n", argv[1]);
+        return -4;
+    }
+
+    const char* cmd = argv[2];
+    bool ok;
+    if (strcmp(cmd, "batch") == 0)
+        ok = commandBatch(argc > 3 ? argv[3] : NULL);
+    else if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "cat") == 0 ||
+             strcmp(cmd, "extract") == 0 || strcmp(cmd, "verify") == 0)
+        ok = runCommand(argc - 2, argv + 2);
+    else
+        ok = commandCat(cmd);
+
+    free(g_Next);
+    free(g_Index);
+    free(g_Sorted);
+    munmap((void*)g_Image, g_ImageSize);
+    close(g_ImageFd);
+    return ok ? 0 : -5;
+}
@@ -0,0 +1,759 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "hostbench.h"
+#include "memdefs.h"
+
+// Runs kernel and bootloader hot paths as host code and times them with the
+// TSC: the kernel's graphics.c drawing into a framebuffer in memory at 32
+// and 24 bpp, its keyboard event ring, and stage2's fat.c reading a FAT12
+// floppy image through a DISK layer that copies out of the image. Each
+// result is one line, in the same form as the NBOS bench program's:
+//
+//   BENCH <name> ops=<n> cycles_per_op=<n> ns_per_op=<n> rate=<n> unit=<per second>
+//
+// Every benchmark runs REPEATS times and the median run counts; the spread
+// between the quartile runs, in percent of the median, is how noisy it
+// was. With -b each cycles_per_op is compared to a baseline file (lines of
+// "<name> <cycles_per_op> <spread>", # comments), and anything slower by
+// more than the tolerance plus the spread of both, and still after being
+// measured again, is a regression: the exit status is 1. -w writes the baseline. Cycle counts only compare on
+// the same machine, so make bench-host-baseline keeps one under the build
+// directory and make bench-host only compares once it exists.
+//
+//   hostbench [-b baseline] [-w baseline] [-t percent] [-i image] [group...]
+//
+// The groups are gfx32, gfx24, kbd and fat. Without -i the floppy image is
+// built in memory; it holds /stage2.bin, /kernel.lz4 and /bin/frag.bin,
+// the last with every other cluster skipped so it is all fragments.
+
+#define REPEATS 9
+#define CONFIRM_RETRIES 3 // Times a regression is measured again before it counts
+#define DEFAULT_TOLERANCE 20
+#define MAX_RESULTS 64
+#define LINE_LENGTH 256
+
+#define FB_WIDTH 1024
+#define FB_HEIGHT 768
+
+#define SECTOR_SIZE 512
+#define IMAGE_SECTORS 2880
+#define RESERVED_SECTORS 1
+#define FAT_COUNT 2
+#define SECTORS_PER_FAT 9
+#define ROOT_ENTRIES 224
+#define DATA_LBA (RESERVED_SECTORS + FAT_COUNT * SECTORS_PER_FAT + ROOT_ENTRIES * 32 / SECTOR_SIZE)
+#define MAX_FILE_SIZE (1024 * 1024)
+
+typedef struct
+{
+    uint8_t BootJumpInstruction[3];
+    uint8_t OemIdentifier[8];
+    uint16_t BytesPerSector;
+    uint8_t SectorsPerCluster;
+    uint16_t ReservedSectors;
+    uint8_t FatCount;
+    uint16_t DirEntryCount;
+    uint16_t TotalSectors;
+    uint8_t MediaDescriptorType;
+    uint16_t SectorsPerFat;
+    uint16_t SectorsPerTrack;
+    uint16_t Heads;
+    uint32_t HiddenSectors;
+    uint32_t LargeSectorCount;
+} __attribute__((packed)) BootSector;
+
+typedef struct
+{
+    uint8_t Name[11];
+    uint8_t Attributes;
+    uint8_t Reserved[8];
+    uint16_t FirstClusterHigh;
+    uint8_t Modified[4];
+    uint16_t FirstClusterLow;
+    uint32_t Size;
+} __attribute__((packed)) DirectoryEntry;
+
+typedef struct
+{
+    char Name[64];
+    uint64_t CyclesPerOp;
+    uint64_t Spread; // Percent of CyclesPerOp
+} Result;
+
+static uint64_t g_TscHz;
+static Result g_Baseline[MAX_RESULTS];
+static int g_BaselineCount;
+static Result g_Results[MAX_RESULTS];
+static int g_ResultCount;
+static int g_Tolerance = DEFAULT_TOLERANCE;
+static int g_Regressions;
+static int g_Failures;
+
+static uint8_t *g_Image;
+static uint32_t g_ImageSectors;
+static uint8_t *g_FileBuffer;
+static uint32_t g_Seed;
+
+/* ============================================================================
+ * Host Services
+ * ============================================================================ */
+
+void *host_alloc(unsigned long long size)
+{
+    return malloc(size);
+}
+
+void host_free(void *ptr)
+{
+    free(ptr);
+}
+
+unsigned long long host_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+unsigned char host_disk_read(unsigned int lba, unsigned int count, void *out)
+{
+    if (lba > g_ImageSectors || count > g_ImageSectors - lba)
+        return false;
+    memcpy(out, g_Image + (size_t)lba * SECTOR_SIZE, (size_t)count * SECTOR_SIZE);
+    return true;
+}
+
+/* ============================================================================
+ * Timing
+ * ============================================================================ */
+
+// The fences keep the timed code from drifting across the reads
+static inline uint64_t cyclesBegin(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t cyclesEnd(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi) : : "rcx", "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t calibrateTsc(void)
+{
+    uint64_t t0 = host_now_ns(), c0 = cyclesBegin();
+    struct timespec delay = {0, 100000000};
+    nanosleep(&delay, NULL);
+    uint64_t c1 = cyclesEnd(), t1 = host_now_ns();
+    return (uint64_t)((double)(c1 - c0) * 1e9 / (double)(t1 - t0));
+}
+
+static const Result *findResult(const Result *results, int count, const char *name)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(results[i].Name, name) == 0)
+            return &results[i];
+    }
+    return NULL;
+}
+
+static long long changeFrom(const Result *base, uint64_t perOp)
+{
+    return ((long long)perOp - (long long)base->CyclesPerOp) * 100 / (long long)base->CyclesPerOp;
+}
+
+static long long allowedChange(const Result *base, uint64_t spread)
+{
+    return g_Tolerance + (long long)(base->Spread + spread);
+}
+
+static void report(const char *name, uint64_t ops, uint64_t cycles, uint64_t spread, uint64_t work,
+                   const char *unit)
+{
+    uint64_t perOp = cycles / ops;
+    printf("BENCH %s ops=%llu cycles_per_op=%llu ns_per_op=%llu rate=%llu unit=%s",
+           name, (unsigned long long)ops, (unsigned long long)perOp,
+           (unsigned long long)((double)perOp * 1e9 / (double)g_TscHz),
+           (unsigned long long)((double)work * (double)g_TscHz / (double)cycles), unit);
+
+    const Result *base = findResult(g_Baseline, g_BaselineCount, name);
+    if (base != NULL && base->CyclesPerOp)
+    {
+        long long change = changeFrom(base, perOp);
+        long long allowed = allowedChange(base, spread);
+        printf(" baseline=%llu change=%+lld%% allowed=%lld%%", (unsigned long long)base->CyclesPerOp, change,
+               allowed);
+        if (change > allowed)
+        {
+            printf(" REGRESSION");
+            g_Regressions++;
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+
+    if (g_ResultCount < MAX_RESULTS)
+    {
+        snprintf(g_Results[g_ResultCount].Name, sizeof(g_Results[0].Name), "%s", name);
+        g_Results[g_ResultCount].CyclesPerOp = perOp;
+        g_Results[g_ResultCount].Spread = spread;
+        g_ResultCount++;
+    }
+}
+
+// Times REPEATS runs of iterations calls: the median, and the spread of
+// the middle half in percent of it
+static void measure(void (*run)(uint64_t), uint64_t iterations, uint64_t *median, uint64_t *spread)
+{
+    uint64_t runs[REPEATS];
+    for (int r = 0; r < REPEATS; r++)
+    {
+        g_Seed = 12345;
+        uint64_t c0 = cyclesBegin();
+        run(iterations);
+        uint64_t c1 = cyclesEnd();
+
+        // Insertion sort as they come
+        int i = r;
+        for (; i > 0 && runs[i - 1] > c1 - c0; i--)
+            runs[i] = runs[i - 1];
+        runs[i] = c1 - c0;
+    }
+    *median = runs[REPEATS / 2] ? runs[REPEATS / 2] : 1;
+    *spread = (runs[REPEATS * 3 / 4] - runs[REPEATS / 4]) * 100 / *median;
+}
+
+// Measures and reports; work counts units for the rate. A result past the
+// baseline has to hold up when measured again, the host may have been
+// busy through all REPEATS runs.
+static void timeRun(const char *name, void (*run)(uint64_t), uint64_t iterations,
+                    uint64_t work, const char *unit)
+{
+    uint64_t median, spread;
+    measure(run, iterations, &median, &spread);
+
+    const Result *base = findResult(g_Baseline, g_BaselineCount, name);
+    for (int retry = 0; retry < CONFIRM_RETRIES && base != NULL && base->CyclesPerOp &&
+                        changeFrom(base, median / iterations) > allowedChange(base, spread);
+         retry++)
+    {
+        struct timespec pause = {0, 50000000};
+        nanosleep(&pause, NULL);
+        uint64_t again, againSpread;
+        measure(run, iterations, &again, &againSpread);
+        if (again < median)
+        {
+            median = again;
+            spread = againSpread;
+        }
+    }
+    report(name, iterations, median, spread, work, unit);
+}
+
+static void fail(const char *name, const char *what)
+{
+    printf("BENCH_FAIL %s %s\n", name, what);
+    g_Failures++;
+}
+
+static int rnd(int range)
+{
+    g_Seed = g_Seed * 1103515245 + 12345;
+    return (int)((g_Seed >> 8) % (uint32_t)range);
+}
+
+/* ============================================================================
+ * Graphics
+ * ============================================================================ */
+
+static void runClear(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        graphics_clear((uint32_t)i * 0x00102030);
+}
+
+static void runFillRect(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        graphics_fill_rect(rnd(FB_WIDTH - 100), rnd(FB_HEIGHT - 100), 100, 100, 0x0000FF);
+}
+
+static void runLine(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        graphics_draw_line(rnd(FB_WIDTH), rnd(FB_HEIGHT), rnd(FB_WIDTH), rnd(FB_HEIGHT), 0x55FF55);
+}
+
+static void runCircle(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        graphics_draw_circle(rnd(FB_WIDTH), rnd(FB_HEIGHT), 8 + rnd(64), 0xFFFF55);
+}
+
+static void runFillCircle(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        graphics_fill_circle(72 + rnd(FB_WIDTH - 144), 72 + rnd(FB_HEIGHT - 144), 8 + rnd(64), 0xFF5555);
+}
+
+static const char g_Text[] = "0123456789ABCDEF0123456789ABCDEF";
+
+static void runText(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        graphics_draw_string(rnd(FB_WIDTH - 256), rnd(FB_HEIGHT - 16), g_Text, 0xFFFFFF, 0x000080);
+}
+
+static void runTextTransparent(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        graphics_draw_string_transparent(rnd(FB_WIDTH - 256), rnd(FB_HEIGHT - 16), g_Text, 0xFFFFFF);
+}
+
+static void benchGraphics(const char *group, uint8_t bpp)
+{
+    char name[64];
+    uint32_t pitch = FB_WIDTH * (bpp / 8);
+    size_t size = (size_t)pitch * FB_HEIGHT;
+
+    // graphics.c takes 32-bit framebuffer addresses, as multiboot gives them
+    uint8_t *fb = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (fb == MAP_FAILED)
+    {
+        fail(group, "no_framebuffer");
+        return;
+    }
+    memset(fb, 0, size);
+
+    kshim_set_framebuffer((uint32_t)(uintptr_t)fb, FB_WIDTH, FB_HEIGHT, pitch, bpp);
+    graphics_init();
+    if (!graphics_is_available())
+    {
+        fail(group, "bad_mode");
+        munmap(fb, size);
+        return;
+    }
+
+    graphics_fill_rect(10, 10, 4, 4, 0x123456);
+    if (graphics_get_pixel(12, 12) != 0x123456 || graphics_get_pixel(14, 14) != 0)
+        fail(group, "fill_rect_wrong");
+
+    uint64_t screen = (uint64_t)FB_WIDTH * FB_HEIGHT;
+    snprintf(name, sizeof(name), "%s/clear", group);
+    timeRun(name, runClear, 50, 50 * screen, "pixels/s");
+    snprintf(name, sizeof(name), "%s/fill_rect", group);
+    timeRun(name, runFillRect, 5000, 5000 * 100 * 100, "pixels/s");
+    snprintf(name, sizeof(name), "%s/line", group);
+    timeRun(name, runLine, 20000, 20000, "lines/s");
+    snprintf(name, sizeof(name), "%s/circle", group);
+    timeRun(name, runCircle, 20000, 20000, "circles/s");
+    snprintf(name, sizeof(name), "%s/fill_circle", group);
+    timeRun(name, runFillCircle, 5000, 5000, "circles/s");
+    snprintf(name, sizeof(name), "%s/text", group);
+    timeRun(name, runText, 20000, 20000 * 32, "chars/s");
+    snprintf(name, sizeof(name), "%s/text_transparent", group);
+    timeRun(name, runTextTransparent, 20000, 20000 * 32, "chars/s");
+
+    munmap(fb, size);
+}
+
+/* ============================================================================
+ * Keyboard
+ * ============================================================================ */
+
+#define SCANCODE_A 0x1E
+#define BURST_KEYS 64 // Press and release each, the whole event ring
+
+static void runKey(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        keyboard_process_scancode(SCANCODE_A);
+        keyboard_process_scancode(SCANCODE_A | 0x80);
+        kshim_read_key();
+    }
+}
+
+static void runBurst(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+    {
+        for (int k = 0; k < BURST_KEYS; k++)
+        {
+            keyboard_process_scancode(SCANCODE_A);
+            keyboard_process_scancode(SCANCODE_A | 0x80);
+        }
+        while (kshim_read_key() >= 0);
+    }
+}
+
+static void benchKeyboard(void)
+{
+    keyboard_process_scancode(SCANCODE_A);
+    keyboard_process_scancode(SCANCODE_A | 0x80);
+    if (kshim_read_key() != 'a' || kshim_read_key() != -1)
+        fail("kbd", "wrong_key");
+
+    timeRun("kbd/key", runKey, 1000000, 1000000, "keys/s");
+    timeRun("kbd/burst", runBurst, 20000, 20000 * BURST_KEYS, "keys/s");
+}
+
+/* ============================================================================
+ * FAT
+ * ============================================================================ */
+
+static uint8_t patternByte(uint32_t seed, uint32_t offset)
+{
+    uint32_t x = (offset / 4 + 1) * 2654435761u + seed;
+    return (uint8_t)(x >> (8 * (offset & 3)));
+}
+
+static void setFat12(uint32_t cluster, uint32_t value)
+{
+    for (int copy = 0; copy < FAT_COUNT; copy++)
+    {
+        uint8_t *fat = g_Image + (RESERVED_SECTORS + copy * SECTORS_PER_FAT) * SECTOR_SIZE;
+        uint8_t *p = fat + cluster * 3 / 2;
+        if (cluster & 1)
+        {
+            p[0] = (uint8_t)((p[0] & 0x0F) | (value << 4));
+            p[1] = (uint8_t)(value >> 4);
+        }
+        else
+        {
+            p[0] = (uint8_t)value;
+            p[1] = (uint8_t)((p[1] & 0xF0) | ((value >> 8) & 0x0F));
+        }
+    }
+}
+
+// Chains clusters clusters, stride apart, from the first free one
+static uint32_t allocateChain(uint32_t *nextFree, uint32_t clusters, uint32_t stride)
+{
+    uint32_t first = *nextFree;
+    for (uint32_t i = 0; i < clusters; i++)
+    {
+        uint32_t cluster = first + i * stride;
+        setFat12(cluster, i + 1 < clusters ? cluster + stride : 0xFFF);
+    }
+    *nextFree = first + (clusters - 1) * stride + 1;
+    return first;
+}
+
+static uint8_t *clusterData(uint32_t cluster)
+{
+    return g_Image + (size_t)(DATA_LBA + cluster - 2) * SECTOR_SIZE;
+}
+
+static void addEntry(DirectoryEntry *entry, const char *name, uint8_t attributes, uint32_t cluster, uint32_t size)
+{
+    memcpy(entry->Name, name, 11);
+    entry->Attributes = attributes;
+    entry->FirstClusterLow = (uint16_t)cluster;
+    entry->Size = size;
+}
+
+static void addFile(DirectoryEntry *entry, uint32_t *nextFree, const char *name, uint32_t size, uint32_t stride, uint32_t seed)
+{
+    uint32_t clusters = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t first = allocateChain(nextFree, clusters, stride);
+    for (uint32_t offset = 0; offset < size; offset++)
+        clusterData(first + offset / SECTOR_SIZE * stride)[offset % SECTOR_SIZE] = patternByte(seed, offset);
+    addEntry(entry, name, 0x20, first, size);
+}
+
+// A 1.44MB FAT12 floppy laid out like the boot floppy, one sector a cluster
+static void buildImage(void)
+{
+    g_ImageSectors = IMAGE_SECTORS;
+    g_Image = calloc(IMAGE_SECTORS, SECTOR_SIZE);
+
+    BootSector *bs = (BootSector *)g_Image;
+    memcpy(bs->BootJumpInstruction, "\xEB\x3C\x90", 3);
+    memcpy(bs->OemIdentifier, "MSWIN4.1", 8);
+    bs->BytesPerSector = SECTOR_SIZE;
+    bs->SectorsPerCluster = 1;
+    bs->ReservedSectors = RESERVED_SECTORS;
+    bs->FatCount = FAT_COUNT;
+    bs->DirEntryCount = ROOT_ENTRIES;
+    bs->TotalSectors = IMAGE_SECTORS;
+    bs->MediaDescriptorType = 0xF0;
+    bs->SectorsPerFat = SECTORS_PER_FAT;
+    bs->SectorsPerTrack = 18;
+    bs->Heads = 2;
+    g_Image[510] = 0x55;
+    g_Image[511] = 0xAA;
+    setFat12(0, 0xFF0);
+    setFat12(1, 0xFFF);
+
+    DirectoryEntry *root = (DirectoryEntry *)(g_Image + (RESERVED_SECTORS + FAT_COUNT * SECTORS_PER_FAT) * SECTOR_SIZE);
+    uint32_t nextFree = 2;
+    addFile(&root[0], &nextFree, "STAGE2  BIN", 32 * 1024, 1, 1);
+    addFile(&root[1], &nextFree, "KERNEL  LZ4", 640 * 1024, 1, 2);
+
+    uint32_t bin = allocateChain(&nextFree, 1, 1);
+    addEntry(&root[2], "BIN        ", 0x10, bin, 0);
+    DirectoryEntry *dir = (DirectoryEntry *)clusterData(bin);
+    addEntry(&dir[0], ".          ", 0x10, bin, 0);
+    addEntry(&dir[1], "..         ", 0x10, 0, 0);
+    addFile(&dir[2], &nextFree, "FRAG    BIN", 128 * 1024, 2, 3);
+}
+
+static bool loadImage(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Cannot open image %s\n", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    g_ImageSectors = (uint32_t)(size / SECTOR_SIZE);
+    g_Image = malloc((size_t)g_ImageSectors * SECTOR_SIZE + 1);
+    bool ok = g_Image != NULL && fread(g_Image, SECTOR_SIZE, g_ImageSectors, f) == g_ImageSectors;
+    fclose(f);
+    if (!ok)
+        fprintf(stderr, "Cannot read image %s\n", path);
+    return ok;
+}
+
+// fat.c keeps its state at fixed addresses below 1MB
+static bool mapStage2Memory(void)
+{
+    uintptr_t start = (uintptr_t)MEMORY_FAT_ADDR;
+    uintptr_t end = ((uintptr_t)MEMORY_DIRCACHE_ADDR + MEMORY_DIRCACHE_SIZE + 4095) & ~(uintptr_t)4095;
+    void *p = mmap((void *)start, end - start, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    return p == (void *)start;
+}
+
+static const char *g_ReadPath;
+static uint32_t g_ReadChunk;
+
+static void runMount(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        s2shim_mount();
+}
+
+static void runOpen(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        s2shim_open_close(g_ReadPath);
+}
+
+static void runRead(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        s2shim_read_file(g_ReadPath, g_FileBuffer, g_ReadChunk);
+}
+
+// Reads the file once to check it (when the image is ours) and find its
+// size, then times reading it chunk bytes at a time
+static void benchRead(const char *name, const char *path, uint32_t chunk, uint32_t seed, uint64_t iterations)
+{
+    uint32_t size = s2shim_read_file(path, g_FileBuffer, chunk);
+    if (size == 0xFFFFFFFF)
+    {
+        printf("BENCH_SKIP %s reason=no_file\n", name);
+        return;
+    }
+    for (uint32_t offset = 0; seed && offset < size; offset++)
+    {
+        if (g_FileBuffer[offset] != patternByte(seed, offset))
+        {
+            fail(name, "wrong_data");
+            return;
+        }
+    }
+
+    g_ReadPath = path;
+    g_ReadChunk = chunk;
+    timeRun(name, runRead, iterations, iterations * size, "bytes/s");
+}
+
+static void benchFat(const char *imagePath)
+{
+    if (imagePath == NULL)
+    {
+        buildImage();
+    }
+    else if (!loadImage(imagePath))
+    {
+        g_Failures++;
+        return;
+    }
+    if (!mapStage2Memory())
+    {
+        fail("fat", "no_stage2_memory");
+        return;
+    }
+    g_FileBuffer = malloc(MAX_FILE_SIZE + SECTOR_SIZE);
+    if (!s2shim_mount())
+    {
+        fail("fat", "mount_failed");
+        return;
+    }
+
+    timeRun("fat/mount", runMount, 2000, 2000, "mounts/s");
+    if (!s2shim_mount())
+        fail("fat", "mount_failed");
+
+    // Directories are read once, later opens are answered from the cache
+    g_ReadPath = "/bin/frag.bin";
+    s2shim_open_close(g_ReadPath);
+    unsigned long long reads = s2shim_disk_reads();
+    s2shim_open_close(g_ReadPath);
+    if (s2shim_disk_reads() != reads)
+        fail("fat/open", "directory_reread");
+
+    g_ReadPath = "/stage2.bin";
+    timeRun("fat/open_root", runOpen, 200000, 200000, "opens/s");
+    g_ReadPath = "/bin/frag.bin";
+    timeRun("fat/open_subdir", runOpen, 200000, 200000, "opens/s");
+
+    // The seeds buildImage filled the files with, 0 skips the check
+    bool known = imagePath == NULL;
+    benchRead("fat/read_contig", "/kernel.lz4", MAX_FILE_SIZE, known ? 2 : 0, 200);
+    benchRead("fat/read_contig_512", "/kernel.lz4", 512, known ? 2 : 0, 200);
+    benchRead("fat/read_contig_1000", "/kernel.lz4", 1000, known ? 2 : 0, 200);
+    benchRead("fat/read_frag", "/bin/frag.bin", MAX_FILE_SIZE, known ? 3 : 0, 500);
+    benchRead("fat/read_small", "/stage2.bin", MAX_FILE_SIZE, known ? 1 : 0, 5000);
+}
+
+/* ============================================================================
+ * Baseline
+ * ============================================================================ */
+
+static bool loadBaseline(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Cannot open baseline %s\n", path);
+        return false;
+    }
+
+    char line[LINE_LENGTH];
+    while (fgets(line, sizeof(line), f) != NULL && g_BaselineCount < MAX_RESULTS)
+    {
+        Result *r = &g_Baseline[g_BaselineCount];
+        unsigned long long cycles, spread = 0;
+        if (line[0] == '#' || sscanf(line, "%63s %llu %llu", r->Name, &cycles, &spread) < 2)
+            continue;
+        r->CyclesPerOp = cycles;
+        r->Spread = spread;
+        g_BaselineCount++;
+    }
+    fclose(f);
+    return true;
+}
+
+static bool writeBaseline(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Cannot write baseline %s\n", path);
+        return false;
+    }
+
+    fprintf(f, "# hostbench baseline: <benchmark> <cycles per op> <spread %%>, median of %d runs\n", REPEATS);
+    fprintf(f, "# Regenerate with make bench-host-baseline, on the machine that compares\n");
+    for (int i = 0; i < g_ResultCount; i++)
+        fprintf(f, "%s %llu %llu\n", g_Results[i].Name, (unsigned long long)g_Results[i].CyclesPerOp,
+                (unsigned long long)g_Results[i].Spread);
+    fclose(f);
+    return true;
+}
+
+/* ============================================================================
+ * Main
+ * ============================================================================ */
+
+static bool wanted(int groups, char **names, const char *group)
+{
+    if (groups == 0)
+        return true;
+    for (int i = 0; i < groups; i++)
+    {
+        if (strcmp(names[i], group) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-b baseline] [-w baseline] [-t percent] [-i image] [gfx32|gfx24|kbd|fat]...\n", program);
+}
+
+int main(int argc, char **argv)
+{
+    const char *baselinePath = NULL;
+    const char *writePath = NULL;
+    const char *imagePath = NULL;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (arg + 1 >= argc || argv[arg][2] != '\0')
+        {
+            usage(argv[0]);
+            return -1;
+        }
+        switch (argv[arg][1])
+        {
+        case 'b':
+            baselinePath = argv[++arg];
+            break;
+        case 'w':
+            writePath = argv[++arg];
+            break;
+        case 't':
+            g_Tolerance = atoi(argv[++arg]);
+            break;
+        case 'i':
+            imagePath = argv[++arg];
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    int groups = argc - arg;
+    char **names = argv + arg;
+
+    if (baselinePath != NULL && !loadBaseline(baselinePath))
+        return -1;
+
+    g_TscHz = calibrateTsc();
+    printf("BENCH_BEGIN version=1 tsc_hz=%llu\n", (unsigned long long)g_TscHz);
+
+    if (wanted(groups, names, "gfx32"))
+        benchGraphics("gfx32", 32);
+    if (wanted(groups, names, "gfx24"))
+        benchGraphics("gfx24", 24);
+    if (wanted(groups, names, "kbd"))
+        benchKeyboard();
+    if (wanted(groups, names, "fat"))
+        benchFat(imagePath);
+
+    printf("BENCH_END regressions=%d failures=%d\n", g_Regressions, g_Failures);
+
+    if (writePath != NULL && !writeBaseline(writePath))
+        return -1;
+    return (g_Regressions || g_Failures) ? 1 : 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// What the harness and the shims see of each other. The kernel and stage2
+// code is compiled against its own headers, the harness against the C
+// library, so everything here uses plain C types: uint32_t is unsigned int
+// on both sides and the kernel's bool is an unsigned char.
+
+// Provided by hostbench.c
+void *host_alloc(unsigned long long size);
+void host_free(void *ptr);
+unsigned long long host_now_ns(void);
+// false past the end of the image
+unsigned char host_disk_read(unsigned int lba, unsigned int count, void *out);
+
+// Provided by kernel_shim.c: the mode graphics_init will find
+void kshim_set_framebuffer(unsigned int addr, unsigned int width,
+                           unsigned int height, unsigned int pitch,
+                           unsigned char bpp);
+// Next queued character, -1 if there is none
+int kshim_read_key(void);
+
+// The kernel code under test (src/kernel/graphics.h, keyboard.h)
+void graphics_init(void);
+int graphics_is_available(void);
+void graphics_clear(unsigned int color);
+unsigned int graphics_get_pixel(int x, int y);
+void graphics_fill_rect(int x, int y, int w, int h, unsigned int color);
+void graphics_draw_line(int x0, int y0, int x1, int y1, unsigned int color);
+void graphics_draw_circle(int cx, int cy, int radius, unsigned int color);
+void graphics_fill_circle(int cx, int cy, int radius, unsigned int color);
+void graphics_draw_string(int x, int y, const char *str, unsigned int fg,
+                          unsigned int bg);
+void graphics_draw_string_transparent(int x, int y, const char *str,
+                                      unsigned int fg);
+void keyboard_process_scancode(unsigned char scancode);
+
+// Provided by stage2_shim.c, on top of src/bootloader/stage2/fat.c. The
+// FAT code keeps its state at the fixed addresses of memdefs.h, which the
+// harness maps before mounting.
+unsigned char s2shim_mount(void);
+unsigned char s2shim_open_close(const char *path);
+// Reads the whole file chunk bytes at a time, returns the bytes read or
+// 0xFFFFFFFF if it can't be opened
+unsigned int s2shim_read_file(const char *path, void *out, unsigned int chunk);
+unsigned long long s2shim_disk_reads(void);
@@ -0,0 +1,110 @@
+// Stands in for the parts of the kernel graphics.c and keyboard.c call, so
+// they run as ordinary host code. Built with the kernel's headers.
+
+#include "display.h"
+#include "fpu.h"
+#include "idle.h"
+#include "isr.h"
+#include "keyboard.h"
+#include "kmalloc.h"
+#include "multiboot.h"
+#include "paging.h"
+#include "sched.h"
+#include "timer.h"
+#include "hostbench.h"
+
+static uint32_t fb_addr, fb_width, fb_height, fb_pitch;
+static uint8_t fb_bpp;
+
+void kshim_set_framebuffer(unsigned int addr, unsigned int width,
+                           unsigned int height, unsigned int pitch,
+                           unsigned char bpp) {
+  fb_addr = addr;
+  fb_width = width;
+  fb_height = height;
+  fb_pitch = pitch;
+  fb_bpp = bpp;
+}
+
+int kshim_read_key(void) {
+  key_event_t event;
+  while (keyboard_read_event(&event, false)) {
+    if (event.ascii && !(event.flags & KEY_EVENT_RELEASE))
+      return (unsigned char)event.ascii;
+  }
+  return -1;
+}
+
+// Multiboot: one 0x00RRGGBB mode, as VBE reports it at 24 and 32 bpp
+uint32_t multiboot_get_framebuffer_addr(void) { return fb_addr; }
+uint32_t multiboot_get_framebuffer_width(void) { return fb_width; }
+uint32_t multiboot_get_framebuffer_height(void) { return fb_height; }
+uint32_t multiboot_get_framebuffer_pitch(void) { return fb_pitch; }
+uint8_t multiboot_get_framebuffer_bpp(void) { return fb_bpp; }
+
+void multiboot_get_framebuffer_colors(uint8_t *red_pos, uint8_t *red_size,
+                                      uint8_t *green_pos, uint8_t *green_size,
+                                      uint8_t *blue_pos, uint8_t *blue_size) {
+  *red_pos = 16;
+  *red_size = 8;
+  *green_pos = 8;
+  *green_size = 8;
+  *blue_pos = 0;
+  *blue_size = 8;
+}
+
+// SSE is always usable in user space, nothing needs saving around it
+uint64_t fpu_kernel_begin(void) { return 0; }
+void fpu_kernel_end(uint64_t flags) { (void)flags; }
+bool fpu_sse_enabled(void) { return true; }
+
+// The framebuffer is ordinary memory. There is no back buffer: the harness
+// measures the drawing itself, not the copies present makes.
+bool paging_has_pat(void) { return false; }
+
+// No display device to find, graphics stays on the multiboot framebuffer
+const display_driver_t *bga_probe(void) { return NULL; }
+const display_driver_t *virtio_gpu_probe(bool vga_only) {
+  (void)vga_only;
+  return NULL;
+}
+
+bool paging_map(uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+  (void)virt;
+  (void)phys;
+  (void)size;
+  (void)flags;
+  return true;
+}
+
+bool paging_alloc(uint64_t virt, uint64_t size, uint64_t flags) {
+  (void)virt;
+  (void)size;
+  (void)flags;
+  return false;
+}
+
+void paging_free(uint64_t virt, uint64_t size) {
+  (void)virt;
+  (void)size;
+}
+
+void *kmalloc(size_t size) { return host_alloc(size); }
+void kfree(void *ptr) { host_free(ptr); }
+
+uint64_t timer_now_ns(void) { return host_now_ns(); }
+
+// The harness is the only reader and never waits
+void register_interrupt_handler(uint8_t n, ISRHandler handler) {
+  (void)n;
+  (void)handler;
+}
+
+// keyboard_read_event only waits when asked to, which the harness never is
+void idle_wait(void) {}
+
+bool sched_can_block(void) { return false; }
+void sched_block(void) {}
+void wait_prepare(wait_queue_t *wq) { (void)wq; }
+void wait_finish(wait_queue_t *wq) { (void)wq; }
+void wait_queue_wake_all(wait_queue_t *wq) { (void)wq; }
@@ -0,0 +1,19 @@
+#pragma once
+
+// Forced into every stage2 file the harness builds. stage2 has its own
+// memcpy, strlen, printf and so on with its own prototypes; renamed, they
+// can't collide with the C library the harness links against.
+
+#define memcpy stage2_memcpy
+#define memset stage2_memset
+#define memcmp stage2_memcmp
+#define strchr stage2_strchr
+#define strcpy stage2_strcpy
+#define strlen stage2_strlen
+#define toupper stage2_toupper
+#define isLower stage2_isLower
+#define align stage2_align
+#define min stage2_min
+#define printf stage2_printf
+#define puts stage2_puts
+#define putc stage2_putc
@@ -0,0 +1,93 @@
+// A DISK layer backed by the harness's image, and the calls it times, for
+// stage2's fat.c built as host code. Built with the stage2 headers.
+
+#include "disk.h"
+#include "fat.h"
+#include "stdio.h"
+#include "hostbench.h"
+
+static DISK g_Disk;
+static unsigned long long g_DiskReads;
+
+bool DISK_Initialize(DISK *disk, uint8_t driveNumber)
+{
+    // 1.44MB floppy geometry, which only the BIOS code uses
+    disk->id = driveNumber;
+    disk->cylinders = 80;
+    disk->sectors = 18;
+    disk->heads = 2;
+    disk->haveExtensions = true;
+    reciprocal_init(&disk->sectorsRecip, disk->sectors);
+    reciprocal_init(&disk->headsRecip, disk->heads);
+    disk->cacheHits = 0;
+    disk->cacheMisses = 0;
+    return true;
+}
+
+bool DISK_ReadSectors(DISK *disk, uint32_t lba, uint16_t sectors, void *dataOut)
+{
+    (void)disk;
+    g_DiskReads++;
+    return host_disk_read(lba, sectors, dataOut);
+}
+
+// Error messages from fat.c, which only come up if the image is broken
+void _cdecl printf(const char *fmt, ...)
+{
+    puts(fmt);
+}
+
+void puts(const char *str)
+{
+    while (*str)
+    {
+        putc(*str++);
+    }
+}
+
+void putc(char c)
+{
+    (void)c;
+}
+
+unsigned char s2shim_mount(void)
+{
+    return DISK_Initialize(&g_Disk, 0) && FAT_Initialize(&g_Disk);
+}
+
+unsigned char s2shim_open_close(const char *path)
+{
+    FAT_File *file = FAT_Open(&g_Disk, path);
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    FAT_Close(file);
+    return true;
+}
+
+unsigned int s2shim_read_file(const char *path, void *out, unsigned int chunk)
+{
+    FAT_File *file = FAT_Open(&g_Disk, path);
+    if (file == NULL)
+    {
+        return 0xFFFFFFFF;
+    }
+
+    uint8_t *u8Out = (uint8_t *)out;
+    uint32_t total = 0;
+    uint32_t got;
+    while ((got = FAT_Read(&g_Disk, file, chunk, u8Out + total)) > 0)
+    {
+        total += got;
+    }
+
+    FAT_Close(file);
+    return total;
+}
+
+unsigned long long s2shim_disk_reads(void)
+{
+    return g_DiskReads;
+}
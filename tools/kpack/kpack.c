@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Packs the PT_LOAD segments of kernel.elf into an LZ4 compressed image that
+// stage2 decompresses straight to the load addresses.
+// Image layout (matches bootloader/stage2/kimage.h):
+//   KImageHeader, KImageSegment[SegmentCount], then for every segment its
+//   blocks in order, each a KImageBlock followed by its data.
+
+#define KIMAGE_MAGIC 0x5A4B424E // 'NBKZ'
+#define KIMAGE_BLOCK_SIZE 0x8000
+#define KIMAGE_BLOCK_UNCOMPRESSED 0x80000000u
+#define KIMAGE_MAX_SEGMENTS 16
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 14
+
+typedef struct
+{
+    uint8_t Ident[16];
+    uint16_t Type;
+    uint16_t Machine;
+    uint32_t Version;
+    uint64_t Entry;
+    uint64_t ProgramHeaderOffset;
+    uint64_t SectionHeaderOffset;
+    uint32_t Flags;
+    uint16_t HeaderSize;
+    uint16_t ProgramHeaderEntrySize;
+    uint16_t ProgramHeaderCount;
+    uint16_t SectionHeaderEntrySize;
+    uint16_t SectionHeaderCount;
+    uint16_t SectionNamesIndex;
+} __attribute__((packed)) Elf64Header;
+
+typedef struct
+{
+    uint32_t Type;
+    uint32_t Flags;
+    uint64_t Offset;
+    uint64_t VirtualAddress;
+    uint64_t PhysicalAddress;
+    uint64_t FileSize;
+    uint64_t MemorySize;
+    uint64_t Align;
+} __attribute__((packed)) Elf64ProgramHeader;
+
+typedef struct
+{
+    uint32_t Magic;
+    uint32_t Entry;
+    uint32_t SegmentCount;
+} __attribute__((packed)) KImageHeader;
+
+typedef struct
+{
+    uint32_t Address;
+    uint32_t FileSize;
+    uint32_t MemorySize;
+    uint32_t BlockCount;
+} __attribute__((packed)) KImageSegment;
+
+typedef struct
+{
+    uint32_t CompressedSize;
+    uint32_t Size;
+} __attribute__((packed)) KImageBlock;
+
+static uint32_t hash4(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t* writeLength(uint8_t* out, uint32_t length)
+{
+    while (length >= 255)
+    {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+static uint8_t* writeSequence(uint8_t* out, const uint8_t* literals, uint32_t literalCount, uint32_t offset, uint32_t matchLength)
+{
+    uint8_t* token = out++;
+    uint32_t literalNibble = literalCount < 15 ? literalCount : 15;
+    uint32_t matchNibble = 0;
+
+    if (literalCount >= 15)
+        out = writeLength(out, literalCount - 15);
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+
+    if (matchLength > 0)
+    {
+        *out++ = offset & 0xFF;
+        *out++ = offset >> 8;
+        uint32_t extra = matchLength - LZ4_MIN_MATCH;
+        matchNibble = extra < 15 ? extra : 15;
+        if (extra >= 15)
+            out = writeLength(out, extra - 15);
+    }
+
+    *token = (uint8_t)((literalNibble << 4) | matchNibble);
+    return out;
+}
+
+// Compress data[start, end) as one LZ4 block. Matches may reach back into
+// earlier blocks of the same segment, the decompressor keeps them in memory.
+static uint32_t compressBlock(const uint8_t* data, uint32_t start, uint32_t end, uint32_t* table, uint8_t* out)
+{
+    uint8_t* o = out;
+    uint32_t anchor = start;
+    uint32_t pos = start;
+
+    while (pos + LZ4_MATCH_LIMIT <= end)
+    {
+        uint32_t h = hash4(data + pos);
+        uint32_t candidate = table[h];
+        table[h] = pos + 1;
+
+        if (candidate == 0 || pos - (candidate - 1) > LZ4_MAX_OFFSET ||
+            memcmp(data + candidate - 1, data + pos, LZ4_MIN_MATCH) != 0)
+        {
+            pos++;
+            continue;
+        }
+
+        uint32_t ref = candidate - 1;
+        uint32_t length = LZ4_MIN_MATCH;
+        while (pos + length < end - LZ4_LAST_LITERALS && data[ref + length] == data[pos + length])
+            length++;
+
+        o = writeSequence(o, data + anchor, pos - anchor, pos - ref, length);
+
+        for (uint32_t i = pos + 1; i < pos + length && i + 4 <= end; i++)
+            table[hash4(data + i)] = i + 1;
+
+        pos += length;
+        anchor = pos;
+    }
+
+    o = writeSequence(o, data + anchor, end - anchor, 0, 0);
+    return (uint32_t)(o - out);
+}
+
+// Reference decompressor, used to verify every block before it is written
+static bool decompressBlock(const uint8_t* in, uint32_t inSize, uint8_t* segment, uint32_t start, uint32_t size)
+{
+    const uint8_t* ip = in;
+    const uint8_t* ipEnd = in + inSize;
+    uint32_t op = start;
+
+    while (ip < ipEnd)
+    {
+        uint8_t token = *ip++;
+        uint32_t literals = token >> 4;
+        if (literals == 15)
+        {
+            uint8_t b;
+            do { b = *ip++; literals += b; } while (b == 255);
+        }
+        if (op + literals > start + size)
+            return false;
+        memcpy(segment + op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip >= ipEnd)
+            break;
+
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        uint32_t length = (token & 0xF) + LZ4_MIN_MATCH;
+        if ((token & 0xF) == 15)
+        {
+            uint8_t b;
+            do { b = *ip++; length += b; } while (b == 255);
+        }
+        if (offset == 0 || offset > op || op + length > start + size)
+            return false;
+        for (uint32_t i = 0; i < length; i++, op++)
+            segment[op] = segment[op - offset];
+    }
+
+    return op == start + size;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("Syntax: %s <kernel.elf> <kernel.lz4>\n", argv[0]);
+        return -1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Cannot open file %s!\n", argv[1]);
+        return -1;
+    }
+
+    fseek(in, 0, SEEK_END);
+    long elfSize = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t* elf = malloc(elfSize);
+    if (fread(elf, 1, elfSize, in) != (size_t)elfSize)
+    {
+        fprintf(stderr, "Could not read %s!\n", argv[1]);
+        return -2;
+    }
+    fclose(in);
+
+    Elf64Header* header = (Elf64Header*)elf;
+    if (elfSize < (long)sizeof(Elf64Header) || memcmp(header->Ident, "\x7F" "ELF", 4) != 0 || header->Ident[4] != 2)
+    {
+        fprintf(stderr, "%s is not an ELF64 file!\n", argv[1]);
+        return -3;
+    }
+
+    KImageHeader image = { KIMAGE_MAGIC, (uint32_t)header->Entry, 0 };
+    KImageSegment segments[KIMAGE_MAX_SEGMENTS];
+    const Elf64ProgramHeader* loads[KIMAGE_MAX_SEGMENTS];
+
+    for (int i = 0; i < header->ProgramHeaderCount; i++)
+    {
+        const Elf64ProgramHeader* ph = (const Elf64ProgramHeader*)(elf + header->ProgramHeaderOffset + i * header->ProgramHeaderEntrySize);
+        if (ph->Type != 1 || ph->MemorySize == 0)
+            continue;
+
+        if (image.SegmentCount == KIMAGE_MAX_SEGMENTS)
+        {
+            fprintf(stderr, "Too many segments!\n");
+            return -4;
+        }
+
+        KImageSegment* segment = &segments[image.SegmentCount];
+        segment->Address = (uint32_t)ph->PhysicalAddress;
+        segment->FileSize = (uint32_t)ph->FileSize;
+        segment->MemorySize = (uint32_t)ph->MemorySize;
+        segment->BlockCount = (segment->FileSize + KIMAGE_BLOCK_SIZE - 1) / KIMAGE_BLOCK_SIZE;
+        loads[image.SegmentCount++] = ph;
+    }
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Cannot create file %s!\n", argv[2]);
+        return -1;
+    }
+
+    fwrite(&image, sizeof(image), 1, out);
+    fwrite(segments, sizeof(KImageSegment), image.SegmentCount, out);
+
+    uint32_t* table = malloc(sizeof(uint32_t) << LZ4_HASH_BITS);
+    uint8_t* packed = malloc(KIMAGE_BLOCK_SIZE * 2);
+    uint32_t totalIn = 0, totalOut = sizeof(image) + image.SegmentCount * sizeof(KImageSegment);
+
+    for (uint32_t s = 0; s < image.SegmentCount; s++)
+    {
+        const uint8_t* data = elf + loads[s]->Offset;
+        uint32_t size = segments[s].FileSize;
+        uint8_t* check = calloc(1, size ? size : 1);
+        memset(table, 0, sizeof(uint32_t) << LZ4_HASH_BITS);
+
+        for (uint32_t start = 0; start < size; start += KIMAGE_BLOCK_SIZE)
+        {
+            uint32_t end = start + KIMAGE_BLOCK_SIZE < size ? start + KIMAGE_BLOCK_SIZE : size;
+            KImageBlock block = { compressBlock(data, start, end, table, packed), end - start };
+
+            if (!decompressBlock(packed, block.CompressedSize, check, start, block.Size) ||
+                memcmp(check + start, data + start, block.Size) != 0)
+            {
+                fprintf(stderr, "Compression self-check failed at segment %u offset %u!\n", s, start);
+                return -5;
+            }
+
+            // Incompressible blocks are stored as-is
+            if (block.CompressedSize >= block.Size)
+            {
+                block.CompressedSize = block.Size | KIMAGE_BLOCK_UNCOMPRESSED;
+                fwrite(&block, sizeof(block), 1, out);
+                fwrite(data + start, 1, block.Size, out);
+                totalOut += sizeof(block) + block.Size;
+            }
+            else
+            {
+                fwrite(&block, sizeof(block), 1, out);
+                fwrite(packed, 1, block.CompressedSize, out);
+                totalOut += sizeof(block) + block.CompressedSize;
+            }
+        }
+
+        totalIn += size;
+        free(check);
+    }
+
+    fclose(out);
+    printf("kpack: %u segments, %u -> %u bytes\n", image.SegmentCount, totalIn, totalOut);
+
+    free(packed);
+    free(table);
+    free(elf);
+    return 0;
+}
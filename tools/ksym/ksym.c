@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Symbolizes the samples the kernel profiler writes to the debug console
+// (perf dump, captured with qemu -debugcon file:perf.txt) against the
+// kernel.elf they came from. Each sample is a line
+//   perf: <cpu> <k|u> <rip> [<return address>...]
+// with the addresses in hex, innermost first. The default output is a flat
+// profile: samples with the function on top (self) and anywhere in the
+// chain (total). -f prints folded stacks (outer;...;inner count) instead,
+// the input format of flamegraph.pl.
+
+#define SHT_SYMTAB 2
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+#define MAX_DEPTH 16
+#define LINE_LENGTH 512
+
+typedef struct
+{
+    uint8_t Ident[16];
+    uint16_t Type;
+    uint16_t Machine;
+    uint32_t Version;
+    uint64_t Entry;
+    uint64_t ProgramHeaderOffset;
+    uint64_t SectionHeaderOffset;
+    uint32_t Flags;
+    uint16_t HeaderSize;
+    uint16_t ProgramHeaderEntrySize;
+    uint16_t ProgramHeaderCount;
+    uint16_t SectionHeaderEntrySize;
+    uint16_t SectionHeaderCount;
+    uint16_t SectionNamesIndex;
+} __attribute__((packed)) Elf64Header;
+
+typedef struct
+{
+    uint32_t Name;
+    uint32_t Type;
+    uint64_t Flags;
+    uint64_t Address;
+    uint64_t Offset;
+    uint64_t Size;
+    uint32_t Link;
+    uint32_t Info;
+    uint64_t AddressAlign;
+    uint64_t EntrySize;
+} __attribute__((packed)) Elf64SectionHeader;
+
+typedef struct
+{
+    uint32_t Name;
+    uint8_t Info;
+    uint8_t Other;
+    uint16_t SectionIndex;
+    uint64_t Value;
+    uint64_t Size;
+} __attribute__((packed)) Elf64Symbol;
+
+typedef struct
+{
+    uint64_t Address;
+    uint64_t Size;
+    const char* Name;
+    uint64_t Self;
+    uint64_t Total;
+    uint64_t Seen; // Sample that last counted it in Total
+} Symbol;
+
+typedef struct
+{
+    char* Stack;
+    uint64_t Count;
+} Folded;
+
+static Symbol* symbols;
+static int symbolCount;
+static Symbol userSymbol = { 0, 0, "[user]", 0, 0, 0 };
+static Symbol unknownSymbol = { 0, 0, "[unknown]", 0, 0, 0 };
+
+static int compareAddress(const void* a, const void* b)
+{
+    const Symbol* x = a;
+    const Symbol* y = b;
+    return x->Address < y->Address ? -1 : x->Address > y->Address;
+}
+
+static int compareSelf(const void* a, const void* b)
+{
+    const Symbol* x = *(const Symbol* const*)a;
+    const Symbol* y = *(const Symbol* const*)b;
+    if (x->Self != y->Self)
+        return x->Self < y->Self ? 1 : -1;
+    return x->Total < y->Total ? 1 : x->Total > y->Total ? -1 : 0;
+}
+
+static bool loadSymbols(const uint8_t* elf, long size)
+{
+    const Elf64Header* header = (const Elf64Header*)elf;
+    if (size < (long)sizeof(Elf64Header) || memcmp(header->Ident, "\x7F" "ELF", 4) != 0 || header->Ident[4] != 2)
+        return false;
+
+    for (int i = 0; i < header->SectionHeaderCount; i++)
+    {
+        const Elf64SectionHeader* sh = (const Elf64SectionHeader*)(elf + header->SectionHeaderOffset + i * header->SectionHeaderEntrySize);
+        if (sh->Type != SHT_SYMTAB || sh->Link >= header->SectionHeaderCount)
+            continue;
+
+        const Elf64SectionHeader* strings = (const Elf64SectionHeader*)(elf + header->SectionHeaderOffset + sh->Link * header->SectionHeaderEntrySize);
+        const Elf64Symbol* table = (const Elf64Symbol*)(elf + sh->Offset);
+        int count = (int)(sh->Size / sizeof(Elf64Symbol));
+        symbols = calloc(count, sizeof(Symbol));
+
+        for (int s = 0; s < count; s++)
+        {
+            int type = table[s].Info & 0xF;
+            if ((type != STT_FUNC && type != STT_NOTYPE) || !table[s].Value || !table[s].SectionIndex || !table[s].Name)
+                continue;
+            const char* name = (const char*)(elf + strings->Offset + table[s].Name);
+            // Skip local labels (stub.loop) and linker symbols (_kernel_end)
+            if (strchr(name, '.') || name[0] == '_')
+                continue;
+            symbols[symbolCount].Address = table[s].Value;
+            symbols[symbolCount].Size = table[s].Size;
+            symbols[symbolCount].Name = name;
+            symbolCount++;
+        }
+        qsort(symbols, symbolCount, sizeof(Symbol), compareAddress);
+        return symbolCount > 0;
+    }
+    return false;
+}
+
+// Closest symbol at or below address (asm labels have no size, so a sized
+// symbol only gets what it covers)
+static Symbol* lookup(uint64_t address)
+{
+    int low = 0, high = symbolCount - 1, found = -1;
+    while (low <= high)
+    {
+        int mid = (low + high) / 2;
+        if (symbols[mid].Address <= address)
+        {
+            found = mid;
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    if (found < 0 || (symbols[found].Size && address >= symbols[found].Address + symbols[found].Size))
+        return &unknownSymbol;
+    return &symbols[found];
+}
+
+static Folded* folded;
+static int foldedCount, foldedCapacity;
+
+static void addFolded(const char* stack)
+{
+    for (int i = 0; i < foldedCount; i++)
+    {
+        if (strcmp(folded[i].Stack, stack) == 0)
+        {
+            folded[i].Count++;
+            return;
+        }
+    }
+    if (foldedCount == foldedCapacity)
+    {
+        foldedCapacity = foldedCapacity ? foldedCapacity * 2 : 256;
+        folded = realloc(folded, foldedCapacity * sizeof(Folded));
+    }
+    folded[foldedCount].Stack = strdup(stack);
+    folded[foldedCount].Count = 1;
+    foldedCount++;
+}
+
+int main(int argc, char** argv)
+{
+    bool fold = false;
+    const char* elfPath = NULL;
+    const char* samplePath = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+            fold = true;
+        else if (!elfPath)
+            elfPath = argv[i];
+        else
+            samplePath = argv[i];
+    }
+    if (!elfPath)
+    {
+        printf("Syntax: %s [-f] <kernel.elf> [perf.txt]\n", argv[0]);
+        return -1;
+    }
+
+    FILE* in = fopen(elfPath, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Cannot open file %s!\n", elfPath);
+        return -1;
+    }
+
+    fseek(in, 0, SEEK_END);
+    long elfSize = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t* elf = malloc(elfSize);
+    if (fread(elf, 1, elfSize, in) != (size_t)elfSize)
+    {
+        fprintf(stderr, "Could not read %s!\n", elfPath);
+        return -2;
+    }
+    fclose(in);
+
+    if (!loadSymbols(elf, elfSize))
+    {
+        fprintf(stderr, "%s has no ELF64 symbol table!\n", elfPath);
+        return -3;
+    }
+
+    FILE* samples = samplePath ? fopen(samplePath, "r") : stdin;
+    if (!samples)
+    {
+        fprintf(stderr, "Cannot open file %s!\n", samplePath);
+        return -1;
+    }
+
+    char line[LINE_LENGTH];
+    uint64_t total = 0;
+    while (fgets(line, sizeof(line), samples))
+    {
+        // The kernel's lines may share the capture with other output
+        char* p = strstr(line, "perf: ");
+        if (!p)
+            continue;
+        p += 6;
+
+        strtoul(p, &p, 10);
+        while (*p == ' ')
+            p++;
+        bool user = *p == 'u';
+        if (*p != 'u' && *p != 'k')
+            continue;
+        p++;
+
+        uint64_t addresses[MAX_DEPTH];
+        int depth = 0;
+        char* end;
+        for (uint64_t a = strtoull(p, &end, 16); end != p && depth < MAX_DEPTH; a = strtoull(p, &end, 16))
+        {
+            addresses[depth++] = a;
+            p = end;
+        }
+        if (!depth)
+            continue;
+        total++;
+
+        // Return addresses point past the call, look up the call itself
+        Symbol* chain[MAX_DEPTH];
+        for (int d = 0; d < depth; d++)
+            chain[d] = user ? &userSymbol : lookup(d ? addresses[d] - 1 : addresses[d]);
+
+        chain[0]->Self++;
+        for (int d = 0; d < depth; d++)
+        {
+            if (chain[d]->Seen == total)
+                continue;
+            chain[d]->Seen = total;
+            chain[d]->Total++;
+        }
+
+        if (fold)
+        {
+            char stack[MAX_DEPTH * 64] = "";
+            for (int d = depth - 1; d >= 0; d--)
+            {
+                strncat(stack, chain[d]->Name, sizeof(stack) - strlen(stack) - 2);
+                if (d)
+                    strcat(stack, ";");
+            }
+            addFolded(stack);
+        }
+    }
+    if (samples != stdin)
+        fclose(samples);
+
+    if (!total)
+    {
+        fprintf(stderr, "No perf: samples found!\n");
+        return -4;
+    }
+
+    if (fold)
+    {
+        for (int i = 0; i < foldedCount; i++)
+            printf("%s %llu\n", folded[i].Stack, (unsigned long long)folded[i].Count);
+        return 0;
+    }
+
+    Symbol** ranked = malloc((symbolCount + 2) * sizeof(Symbol*));
+    int rankedCount = 0;
+    for (int i = 0; i < symbolCount; i++)
+        if (symbols[i].Total)
+            ranked[rankedCount++] = &symbols[i];
+    if (userSymbol.Total)
+        ranked[rankedCount++] = &userSymbol;
+    if (unknownSymbol.Total)
+        ranked[rankedCount++] = &unknownSymbol;
+    qsort(ranked, rankedCount, sizeof(Symbol*), compareSelf);
+
+    printf("%llu samples\n", (unsigned long long)total);
+    printf("  Self%%  Total%%      Self  Function\n");
+    for (int i = 0; i < rankedCount; i++)
+    {
+        printf("%6.2f  %6.2f  %8llu  %s\n",
+               100.0 * ranked[i]->Self / total, 100.0 * ranked[i]->Total / total,
+               (unsigned long long)ranked[i]->Self, ranked[i]->Name);
+    }
+
+    free(ranked);
+    free(symbols);
+    free(elf);
+    return 0;
+}